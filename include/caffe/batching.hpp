@@ -0,0 +1,122 @@
+#ifndef CAFFE_BATCHING_HPP_
+#define CAFFE_BATCHING_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+template <typename Dtype> class NetBatcher;
+
+/// @brief Collector thread of a NetBatcher; packs pending items into
+///        batches and runs the net on them.
+template <typename Dtype>
+class NetBatcherWorker : public InternalThread {
+ public:
+  explicit NetBatcherWorker(NetBatcher<Dtype>* parent) : parent_(parent) {}
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  NetBatcher<Dtype>* parent_;
+};
+
+/**
+ * @brief Coalesces single-item inference requests into batched Forwards.
+ *
+ * Serving frontends receive one image per request, but the net only
+ * reaches its throughput with a full batch. Threads hand single items to
+ * Forward, which blocks; a collector thread packs up to max_batch of
+ * them into the net's input blob, runs one Forward over the whole batch
+ * and copies each item's rows of the output blobs back to its caller. A
+ * batch launches as soon as it is full, or once its oldest item has
+ * waited max_delay_ms -- the knob trading tail latency against batch
+ * size. max_batch is the num() of the net's input blob; a batch that
+ * launches short leaves the unused rows zeroed and only its real items
+ * are demuxed. batches_run, items_served and queue_depth expose the
+ * tradeoff actually achieved. The net must not be used by anyone else
+ * while a NetBatcher is attached to it.
+ */
+template <typename Dtype>
+class NetBatcher {
+ public:
+  /**
+   * @param net a net with exactly one input blob, run in the caller's
+   *        current mode and (in GPU mode) on its current device.
+   * @param max_delay_ms longest time a pending item may wait for its
+   *        batch to fill before the batch launches anyway.
+   */
+  NetBatcher(shared_ptr<Net<Dtype> > net, const int max_delay_ms);
+  /// @brief Serves the still-pending items in one final batch, then
+  ///        stops the collector.
+  ~NetBatcher();
+
+  /**
+   * @brief Submit one item and block until its batch has run.
+   *
+   * input must hold input_item_count() values and stay valid until the
+   * call returns; outputs is resized to one blob per net output, each
+   * with num() == 1, holding this item's rows. Thread safe.
+   */
+  void Forward(const Dtype* input,
+      vector<shared_ptr<Blob<Dtype> > >* outputs);
+
+  /// @brief Values one item occupies in the input blob.
+  int input_item_count() const { return item_count_; }
+  /// @brief Items per full batch (the input blob's num()).
+  int max_batch() const { return max_batch_; }
+  /// @brief Batched Forwards run so far.
+  int64_t batches_run() const { return batches_run_; }
+  /// @brief Items served so far; divide by batches_run() for the mean
+  ///        achieved batch size.
+  int64_t items_served() const { return items_served_; }
+  /// @brief Items currently waiting for a batch.
+  int queue_depth();
+
+ private:
+  friend class NetBatcherWorker<Dtype>;
+
+  /// One submitted item: where to read it, where to report it.
+  struct Request {
+    const Dtype* input;
+    vector<shared_ptr<Blob<Dtype> > >* outputs;
+    bool done;
+  };
+
+  void CollectorEntry();
+  /// @brief Pack, run and demux one batch of up to max_batch requests;
+  ///        called on the collector with the lock held.
+  void RunBatch();
+
+  // Holds the boost mutex and condition variables; kept behind a forward
+  // declaration so this header stays free of boost::thread includes (see
+  // internal_thread.hpp).
+  class sync;
+
+  shared_ptr<Net<Dtype> > net_;
+  int max_delay_ms_;
+  int max_batch_;
+  int item_count_;
+  // Mode and device the net was handed over in; the collector thread's
+  // Caffe singleton is its own and must be set up to match.
+  Caffe::Brew mode_;
+  int device_;
+  bool must_stop_;
+  vector<Request*> queue_;
+  int64_t batches_run_;
+  int64_t items_served_;
+  shared_ptr<sync> sync_;
+  shared_ptr<NetBatcherWorker<Dtype> > collector_;
+
+  DISABLE_COPY_AND_ASSIGN(NetBatcher);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_BATCHING_HPP_
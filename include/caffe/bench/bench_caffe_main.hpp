@@ -0,0 +1,46 @@
+// The main caffe microbenchmark code. Your bench cpp code should include
+// this hpp to register benchmarks with the binary built by 'make bench'.
+
+#ifndef CAFFE_BENCH_BENCH_CAFFE_MAIN_HPP_
+#define CAFFE_BENCH_BENCH_CAFFE_MAIN_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+typedef void (*BenchFunction)();
+
+// Adds a microbenchmark to the registry run by the bench binary; returns
+// true so registration can ride a file-scope initializer.
+bool RegisterBenchmark(const char* name, BenchFunction function);
+
+// Runs every registered benchmark in registration order.
+void RunAllBenchmarks();
+
+// Prints one fixed-width result row and records it for the baseline
+// comparison. flops and bytes describe the work of a single call and are
+// converted to GFLOP/s and GB/s; pass 0 to leave a column blank.
+void ReportBenchmark(const std::string& name, const float ms_per_call,
+    const double flops, const double bytes);
+
+// Identifies the machine and mode a baseline was recorded on, e.g.
+// "myhost GPU". Timings only compare meaningfully against a baseline
+// with the same tag.
+std::string BenchMachineTag();
+
+// Compares the recorded results against the baseline file. If the file
+// does not exist, or was recorded on a different machine or mode, the
+// current timings are written to it instead and 0 is returned. Otherwise
+// prints the per-workload delta against the baseline and returns the
+// number of workloads that regressed by more than the given fraction.
+int CheckBenchmarkBaseline(const std::string& path, const float threshold);
+
+}  // namespace caffe
+
+#define REGISTER_BENCHMARK(function) \
+  static bool g_registered_##function = \
+      caffe::RegisterBenchmark(#function, function)
+
+#endif  // CAFFE_BENCH_BENCH_CAFFE_MAIN_HPP_
@@ -19,8 +19,8 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : data_(), diff_(), num_(0), channels_(0), height_(0), width_(0),
-       count_(0), capacity_(0) {}
+       : data_(), diff_(), data_compressed_(false), num_(0), channels_(0),
+       height_(0), width_(0), width_pitch_(0), count_(0), capacity_(0) {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
   /**
@@ -39,11 +39,36 @@ class Blob {
    */
   void Reshape(const int num, const int channels, const int height,
     const int width);
+  /**
+   * @brief Like Reshape, but pad each row of width elements out to pitch
+   *        elements so that every row starts on the same alignment as the
+   *        first.
+   *
+   * Opt-in layout for layer-internal buffers whose kernels want
+   * full-width aligned vector loads on awkward spatial widths. count()
+   * and offset() account for the padding; width() stays the logical
+   * width. The padding lanes start at zero (SyncedMemory zero-fills on
+   * first access) and pitch-aware kernels must keep them defined.
+   * Pitched blobs cannot be serialized or CopyFrom'd across different
+   * pitches -- they are negotiated per layer, not propagated by Net.
+   */
+  void ReshapePitched(const int num, const int channels, const int height,
+    const int width, const int pitch);
   void ReshapeLike(const Blob& other);
+  /// @brief The smallest pitch >= width placing consecutive rows
+  ///        kCaffeHostAlignment bytes apart, for ReshapePitched.
+  static inline int AlignedPitch(const int width) {
+    const int elems = kCaffeHostAlignment / sizeof(Dtype);
+    return (width + elems - 1) / elems * elems;
+  }
   inline int num() const { return num_; }
   inline int channels() const { return channels_; }
   inline int height() const { return height_; }
   inline int width() const { return width_; }
+  /// @brief Allocated elements per row; equal to width() unless the blob
+  ///        was shaped with ReshapePitched.
+  inline int width_pitch() const { return width_pitch_; }
+  inline bool has_pitch() const { return width_pitch_ != width_; }
   inline int count() const { return count_; }
   inline int offset(const int n, const int c = 0, const int h = 0,
       const int w = 0) const {
@@ -55,7 +80,7 @@ class Blob {
     CHECK_LE(h, height_);
     CHECK_GE(width_, 0);
     CHECK_LE(w, width_);
-    return ((n * channels_ + c) * height_ + h) * width_ + w;
+    return ((n * channels_ + c) * height_ + h) * width_pitch_ + w;
   }
   /**
    * @brief Copy from a source Blob.
@@ -100,13 +125,47 @@ class Blob {
   Dtype* mutable_gpu_diff();
   void Update();
   void FromProto(const BlobProto& proto);
-  void ToProto(BlobProto* proto, bool write_diff = false) const;
+  // With write_half, the data payload is stored as binary16 at half the
+  // size (rounding to nearest even); the diff, when written, stays at
+  // full precision. FromProto up-converts transparently, recovering the
+  // element width from the byte count as for the other raw payloads.
+  void ToProto(BlobProto* proto, bool write_diff = false,
+      bool write_half = false) const;
+
+  /**
+   * @brief True iff ptr sits on the kCaffeHostAlignment (64-byte)
+   *        boundary that CaffeMallocHost guarantees.
+   *
+   * Freshly allocated blob data and diff always qualify; blobs sharing
+   * another blob's memory at a byte offset (arena views placed by the
+   * activation-memory planner) may not. SIMD kernels use this to decide
+   * between aligned and unaligned loads.
+   */
+  static inline bool IsAligned(const void* ptr) {
+    return reinterpret_cast<uintptr_t>(ptr) % kCaffeHostAlignment == 0;
+  }
 
   /// @brief Compute the sum of absolute values (L1 norm) of the data.
   Dtype asum_data() const;
   /// @brief Compute the sum of absolute values (L1 norm) of the diff.
   Dtype asum_diff() const;
 
+  /**
+   * @brief Like asum_data, but read only every @p stride -th element.
+   *
+   * Runs on whichever device currently holds the data, like asum_data.
+   * A sparse stride makes the reduction cheap enough for always-on
+   * monitoring; note the result is the sum over the sample, so divide
+   * by the sample count, not count(), for a mean.
+   */
+  Dtype sampled_asum_data(const int stride) const;
+  /// @brief Like sampled_asum_data, over the diff.
+  Dtype sampled_asum_diff(const int stride) const;
+  /// @brief Largest absolute value among every @p stride -th data element.
+  Dtype sampled_amax_data(const int stride) const;
+  /// @brief Largest absolute value among every @p stride -th diff element.
+  Dtype sampled_amax_diff(const int stride) const;
+
   /**
    * @brief Set the data_ shared_ptr to point to the SyncedMemory holding the
    *        data_ of Blob other -- useful in Layer&s which simply perform a copy
@@ -116,6 +175,14 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareData(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to the given SyncedMemory,
+   *        which must be at least count_ * sizeof(Dtype) bytes.
+   *
+   * Used by Net's activation-memory planner to place several blobs with
+   * disjoint lifetimes in one arena.
+   */
+  void ShareData(const shared_ptr<SyncedMemory>& data);
   /**
    * @brief Set the diff_ shared_ptr to point to the SyncedMemory holding the
    *        diff_ of Blob other -- useful in Layer&s which simply perform a copy
@@ -125,14 +192,46 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /// @brief Like ShareData(shared_ptr), but for the diff.
+  void ShareDiff(const shared_ptr<SyncedMemory>& diff);
+
+  /**
+   * @brief Discard the data, replacing data_ with fresh storage of the
+   *        same size that is not allocated until the next access.
+   *
+   * Used by Net's checkpoint scheduler to free intermediate activations
+   * after the forward pass; the segment's forward is re-run to regenerate
+   * them before Backward reads them. The diff is untouched.
+   */
+  void ReleaseData();
+
+  /**
+   * @brief Convert the data to half precision and release the full
+   *        precision storage, halving this blob's memory footprint.
+   *
+   * The first compression rounds values to the nearest half; further
+   * compress/decompress round trips are exact. Used by Net between layers
+   * when half_activations is set. No-op when already compressed.
+   */
+  void CompressDataToHalf();
+  /// @brief Restore full precision data from the half copy, if compressed.
+  void DecompressDataFromHalf();
+  bool data_compressed() const { return data_compressed_; }
 
  protected:
   shared_ptr<SyncedMemory> data_;
   shared_ptr<SyncedMemory> diff_;
+  /// Half precision copy of the data while compressed (see
+  /// CompressDataToHalf); kept around so repeated compressions reuse it.
+  shared_ptr<SyncedMemory> half_data_;
+  bool data_compressed_;
   int num_;
   int channels_;
   int height_;
   int width_;
+  /// Allocated elements per row; width_ for dense blobs (see
+  /// ReshapePitched).
+  int width_pitch_;
   int count_;
   int capacity_;
 
@@ -43,6 +43,8 @@ private:\
 
 namespace caffe {
 
+template <typename Dtype> class Blob;
+
 // We will use the boost shared_ptr instead of the new C++11 one mainly
 // because cuda does not work (at least now) well with C++11 features.
 using boost::shared_ptr;
@@ -70,12 +72,11 @@ void GlobalInit(int* pargc, char*** pargv);
 class Caffe {
  public:
   ~Caffe();
-  inline static Caffe& Get() {
-    if (!singleton_.get()) {
-      singleton_.reset(new Caffe());
-    }
-    return *singleton_;
-  }
+  // Each thread gets its own Caffe instance (and thus its own mode, phase,
+  // device, stream and cublas/curand handles), so worker threads can drive
+  // different GPUs -- or separate Net replicas on one GPU -- concurrently.
+  // The instance is created on first use.
+  static Caffe& Get();
   enum Brew { CPU, GPU };
   enum Phase { TRAIN, TEST };
 
@@ -102,10 +103,44 @@ class Caffe {
     return *(Get().random_generator_);
   }
 #ifndef CPU_ONLY
-  inline static cublasHandle_t cublas_handle() { return Get().cublas_handle_; }
+  // The CUDA handles are created on first use, not in the constructor:
+  // instantiating the CUDA context costs seconds, which CPU-mode runs
+  // and short CLI tools should never pay. Each accessor creates its
+  // handle (and the stream it binds to) the first time it is called and
+  // returns NULL if creation failed, matching the old constructor-time
+  // error handling.
+  inline static cublasHandle_t cublas_handle() {
+    if (!Get().cublas_tried_) InitCublas();
+    return Get().cublas_handle_;
+  }
   inline static curandGenerator_t curand_generator() {
+    if (!Get().curand_tried_) InitCurand();
     return Get().curand_generator_;
   }
+  // The stream this thread's cublas and curand work is issued on. Each
+  // thread gets its own (legacy-blocking) stream, so Nets running in
+  // different threads do not serialize on the default stream, while
+  // kernels still launched on the default stream keep ordering correctly
+  // against it. NULL if stream creation failed (the default stream).
+  inline static cudaStream_t cuda_stream() {
+    if (!Get().cuda_stream_tried_) InitCudaStream();
+    return Get().cuda_stream_;
+  }
+#ifdef USE_CUDNN
+  // Shared pool of cuDNN handles, each bound to its own (blocking)
+  // stream, grown on demand and owned by this thread's singleton.
+  // cudnnCreate is expensive (tens of milliseconds), so layers index
+  // into the pool instead of each creating private handles: a layer
+  // that issues work on k streams in parallel uses indices 0..k-1, and
+  // layers agreeing on an index share the handle, which is safe because
+  // a thread runs its layers sequentially. Like the constant-blob
+  // cache, the pool belongs to the device this thread drives and is
+  // torn down on SetDevice.
+  static cudnnHandle_t cudnn_handle(const int index);
+  // The stream handle `index` issues its work on, for enqueuing
+  // auxiliary work (copies, cleanup kernels) behind that handle's ops.
+  static cudaStream_t cudnn_stream(const int index);
+#endif
 #endif
 
   // Returns the mode: running on CPU or GPU.
@@ -120,24 +155,173 @@ class Caffe {
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
   // Sets the phase.
   inline static void set_phase(Phase phase) { Get().phase_ = phase; }
+  // Returns whether SyncedMemory draws allocations from the caching
+  // MemoryPool instead of malloc/cudaMalloc.
+  inline static bool memory_pool_enabled() {
+    return Get().memory_pool_enabled_;
+  }
+  // Enables or disables the caching MemoryPool for subsequent allocations.
+  // Allocations remember where they came from, so toggling at any time is
+  // safe for memory already handed out.
+  inline static void set_memory_pool_enabled(bool enabled) {
+    Get().memory_pool_enabled_ = enabled;
+  }
+  // Returns whether host allocations of kHugePageSize and up are aligned
+  // and advised for transparent huge pages (see CaffeMallocHuge).
+  inline static bool huge_pages_enabled() {
+    return Get().huge_pages_enabled_;
+  }
+  // Enables or disables huge-page backing for subsequent large host
+  // allocations; memory already handed out frees correctly either way.
+  inline static void set_huge_pages_enabled(bool enabled) {
+    Get().huge_pages_enabled_ = enabled;
+  }
+  // Returns whether neuron layers whose engine is left at DEFAULT use
+  // the fast approximate CPU kernels (caffe_cpu_fast_tanh and friends
+  // in math_functions.hpp) instead of per-element libm calls. An
+  // explicit per-layer engine setting always wins over this switch.
+  inline static bool fast_math() { return Get().fast_math_; }
+  inline static void set_fast_math(bool enabled) {
+    Get().fast_math_ = enabled;
+  }
+  // When set, every fast-math forward also runs the exact computation
+  // and CHECKs the approximation against its documented error bound,
+  // logging the observed maximum. This costs more than the exact path
+  // alone; it is for qualifying a deployment, not for production.
+  inline static bool fast_math_verify() { return Get().fast_math_verify_; }
+  inline static void set_fast_math_verify(bool enabled) {
+    Get().fast_math_verify_ = enabled;
+  }
+  // Returns whether buffers marked skip_zero_fill (see
+  // SyncedMemory::set_skip_zero_fill) are poisoned with all-ones bytes
+  // on first touch instead of left as allocated, so a layer that claims
+  // a full overwrite but reads first produces NaNs instead of silently
+  // seeing whatever the allocator returned. Debugging aid, off by
+  // default.
+  inline static bool poison_skipped_fills() {
+    return Get().poison_skipped_fills_;
+  }
+  inline static void set_poison_skipped_fills(bool enabled) {
+    Get().poison_skipped_fills_ = enabled;
+  }
+  // Transfer instrumentation: between BeginHotRegion and EndHotRegion
+  // (which nest), any device-to-host synchronization SyncedMemory
+  // performs on this thread is logged with the buffer's debug name and
+  // a backtrace, so a stray cpu_data() call hiding in the training loop
+  // points at its caller instead of showing up as unexplained wall
+  // time. Marking is per thread, like the rest of this singleton.
+  inline static void BeginHotRegion() { ++Get().hot_region_depth_; }
+  inline static void EndHotRegion() {
+    CHECK_GT(Get().hot_region_depth_, 0)
+        << "EndHotRegion called without a matching BeginHotRegion";
+    --Get().hot_region_depth_;
+  }
+  inline static bool in_hot_region() { return Get().hot_region_depth_ > 0; }
+  // Returns a shared read-only blob holding `count` ones (shaped
+  // 1 x 1 x 1 x count), created and filled on first request. Layers use
+  // it for the all-ones bias multipliers consumed by BLAS instead of
+  // each allocating and filling a private copy. The cache belongs to
+  // this thread's singleton -- and thus to the device the thread
+  // drives -- and is dropped on SetDevice. Callers must never write
+  // through the returned blob.
+  template <typename Dtype>
+  static const Blob<Dtype>& ones(const int count);
+  // Like ones, but all zeros. The blob is never touched on the host, so
+  // SyncedMemory's zero-fill materializes it directly on whichever side
+  // reads it first.
+  template <typename Dtype>
+  static const Blob<Dtype>& zeros(const int count);
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // The process-wide master seed: the last value given to
+  // set_random_seed, or one drawn from the system entropy source the
+  // first time anything asks.
+  static unsigned int random_seed();
+  // The seed of stream `stream_id` derived from the master seed.
+  // Consecutive ids map to decorrelated seeds and no id maps back onto
+  // the master seed itself, so worker streams never replay the main
+  // thread's draws.
+  static unsigned int rng_stream_seed(const unsigned int stream_id);
+  // Reseeds the calling thread's boost generator with stream `stream_id`
+  // of the master seed (curand is left alone). Worker i calling
+  // set_rng_stream(i) at startup makes its random draws depend only on
+  // the master seed and i -- not on how the threads interleave -- so
+  // parallel transform and fill work is reproducible.
+  static void set_rng_stream(const unsigned int stream_id);
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
   // Prints the current GPU status.
   static void DeviceQuery();
+  // NUMA topology control for multi-socket machines. The node is
+  // process-wide: SetNumaNode pins the calling thread to the node's CPUs
+  // and prefers node-local pages for its allocations, and internal
+  // (prefetch) threads re-pin themselves at startup via PinToNumaNode.
+  // Threads they spawn inherit mask and policy. No effect unless built
+  // with USE_NUMA; -1 (the default) leaves placement to the kernel.
+  static void SetNumaNode(const int node);
+  // The configured NUMA node, or -1 if unset.
+  static int numa_node();
+  // Pin the calling thread to the configured node (no-op if unset).
+  static void PinToNumaNode();
+  // Logs the kernel's per-node allocation counters (numa_hit, numa_miss,
+  // other_node); a growing miss count means cross-node traffic.
+  static void LogNumaStats();
+  // Thread-budget coordinator for CPU training on many-core machines.
+  // The BLAS pool and the data layers' decode workers are sized
+  // independently, so a fixed split oversubscribes some models and
+  // idles cores on others. SetThreadBudget (process-wide, like the
+  // NUMA node) hands the coordinator a core budget -- non-positive
+  // uses all online cores -- which it splits between the two pools.
+  // BalanceThreads, fed once per telemetry window with the window's
+  // data-wait fraction and throughput, shifts one thread at a time
+  // toward the starved side and reverts a shift that lowered images/s,
+  // settling where throughput plateaus. While the coordinator is
+  // inactive, blas_threads/decode_threads return 0 and the independent
+  // settings (OPENBLAS_NUM_THREADS, data_param().decode_threads())
+  // stay in charge.
+  static void SetThreadBudget(const int budget);
+  static int blas_threads();
+  static int decode_threads();
+  static void BalanceThreads(const double data_wait_fraction,
+      const double images_per_second);
 
  protected:
 #ifndef CPU_ONLY
+  // One-shot lazy creation for the handles above; each sets its tried
+  // flag so a failed creation is reported once, not on every access.
+  static void InitCublas();
+  static void InitCurand();
+  static void InitCudaStream();
+
   cublasHandle_t cublas_handle_;
   curandGenerator_t curand_generator_;
+  cudaStream_t cuda_stream_;
+  bool cublas_tried_;
+  bool curand_tried_;
+  bool cuda_stream_tried_;
+#ifdef USE_CUDNN
+  // The cuDNN handle/stream pool behind cudnn_handle, in index order.
+  // The two vectors grow in lockstep.
+  vector<cudnnHandle_t> cudnn_handles_;
+  vector<cudaStream_t> cudnn_streams_;
+#endif
 #endif
   shared_ptr<RNG> random_generator_;
 
   Brew mode_;
   Phase phase_;
-  static shared_ptr<Caffe> singleton_;
+  bool memory_pool_enabled_;
+  bool huge_pages_enabled_;
+  bool fast_math_;
+  bool fast_math_verify_;
+  bool poison_skipped_fills_;
+  int hot_region_depth_;
+  // Constant-blob caches behind Caffe::ones and Caffe::zeros, keyed by
+  // count and type-erased so this header need not see Blob. Index 0
+  // holds the float blobs, index 1 the double ones.
+  map<int, shared_ptr<void> > ones_blobs_[2];
+  map<int, shared_ptr<void> > zeros_blobs_[2];
 
  private:
   // The private constructor to avoid duplicate instantiation.
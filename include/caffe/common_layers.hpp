@@ -1,6 +1,8 @@
 #ifndef CAFFE_COMMON_LAYERS_HPP_
 #define CAFFE_COMMON_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -63,6 +65,10 @@ class ArgMaxLayer : public Layer<Dtype> {
    */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  /// @brief On-device top-k selection, so downstream consumers of the
+  ///        predictions never force the scores back to the host.
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
   /// @brief Not implemented (non-differentiable function)
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
@@ -148,6 +154,17 @@ class ConcatLayer : public Layer<Dtype> {
   int height_;
   int width_;
   int concat_dim_;
+  // In-place concatenation (ConcatParameter.in_place): each bottom is
+  // re-pointed at a view of its slice of the top's storage the first time
+  // it is copied, so later passes find the data already in place and the
+  // layer does no work. The views are rebuilt whenever the top's backing
+  // memory changes; a bottom whose producer re-points its top each pass
+  // (as SplitLayer does) simply falls back to the copy.
+  bool in_place_;
+  shared_ptr<SyncedMemory> data_base_;
+  shared_ptr<SyncedMemory> diff_base_;
+  vector<shared_ptr<SyncedMemory> > bottom_data_views_;
+  vector<shared_ptr<SyncedMemory> > bottom_diff_views_;
 };
 
 /**
@@ -189,6 +206,59 @@ class EltwiseLayer : public Layer<Dtype> {
   bool stable_prod_grad_;
 };
 
+/**
+ * @brief A learned lookup table: maps integer ids to dense vectors by
+ *        gathering rows of a weight matrix, the sparse equivalent of an
+ *        InnerProductLayer fed one-hot inputs.
+ *
+ * Every element of the bottom blob is an id in [0, input_dim); each is
+ * replaced by its num_output-wide embedding row, so a bottom of shape
+ * (N x C x 1 x 1) produces a top of shape (N x C*num_output x 1 x 1).
+ * Forward is a row gather and Backward scatters the top gradient into
+ * just the looked-up weight rows -- no GEMM against a mostly-zero
+ * matrix and no dense weight gradient. The layer reports the touched
+ * rows through sparse_param_rows() so SGDSolver can keep its update
+ * work sparse as well. Ids are not differentiable, so gradients are
+ * never propagated to the bottom.
+ */
+template <typename Dtype>
+class EmbedLayer : public Layer<Dtype> {
+ public:
+  explicit EmbedLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_EMBED;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+  // Ids cannot receive gradients; ignore force_backward.
+  virtual inline bool AllowForceBackward(const int bottom_index) const {
+    return false;
+  }
+
+  virtual const vector<int>* sparse_param_rows(const int param_id) const {
+    return param_id == 0 ? &touched_rows_ : NULL;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  int M_;  // ids per batch (bottom count)
+  int K_;  // vocabulary size (input_dim)
+  int N_;  // embedding dimension (num_output)
+  bool bias_term_;
+  /// Sorted, deduplicated weight rows the last Backward wrote to.
+  vector<int> touched_rows_;
+};
+
 /**
  * @brief Reshapes the input Blob into flat vectors.
  *
@@ -254,7 +324,7 @@ template <typename Dtype>
 class InnerProductLayer : public Layer<Dtype> {
  public:
   explicit InnerProductLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), bias_multiplier_(NULL) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -280,7 +350,118 @@ class InnerProductLayer : public Layer<Dtype> {
   int K_;
   int N_;
   bool bias_term_;
-  Blob<Dtype> bias_multiplier_;
+  /// Shared all-ones blob for adding biases by BLAS, handed out by the
+  /// singleton's constant cache; NULL until Reshape runs with a bias.
+  const Blob<Dtype>* bias_multiplier_;
+  // If true, the weight blob is stored transposed (K x N) so the forward
+  // GEMM needs no CblasTrans on the static weight matrix.
+  bool transpose_;
+
+  // INT8 inference path (see QuantizationParameter in caffe.proto).
+  // Weights are quantized once, the first time Forward_cpu runs.
+  void SetUpQuantization();
+  bool quantize_;
+  Dtype input_scale_;
+  Dtype weight_scale_;
+  vector<int8_t> int8_weight_;
+  vector<int8_t> int8_bottom_;
+  vector<int32_t> int32_top_;
+
+  // Weights-only int8 storage with per-row scales, dequantized inside a
+  // fused GEMV (quantize_weights); the full precision weight pages are
+  // released once quantized.
+  void SetUpWeightQuantization();
+  bool quantize_weights_;
+  vector<Dtype> weight_row_scale_;
+};
+
+/**
+ * @brief Inner product over a CSR-compressed weight matrix
+ *        (engine: SPARSE), for heavily pruned models.
+ *
+ * The weight blob is converted to compressed sparse rows (one row per
+ * output) the first time Forward_cpu runs, so forward time and the
+ * working set shrink in proportion to the fraction of nonzero weights.
+ * The conversion is invalidated by Backward; the GPU forward and the
+ * backward pass use the dense path of the base class.
+ */
+template <typename Dtype>
+class SparseInnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit SparseInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param), csr_built_(false) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// @brief Compress the weight blob to CSR form.
+  void BuildSparseWeight();
+
+  bool csr_built_;
+  vector<Dtype> csr_val_;
+  vector<int> csr_col_;
+  vector<int> csr_ptr_;
+};
+
+/**
+ * @brief Inner product split column-wise (over outputs) across several
+ *        devices (inner_product_param.shard_device).
+ *
+ * Shard s holds an N_s x K slice of the weight matrix (and the matching
+ * bias slice) as its own parameter blob, computes its strip of the output
+ * with a local GEMM, and the strips are gathered into the top blob -- so
+ * a classifier head too large for one card's memory scales across cards.
+ * On the GPU each shard runs in its own worker thread bound to its
+ * device; the backward pass reduces the per-shard bottom-gradient
+ * partials internally, so callers see an ordinary layer. Parameter blobs
+ * are stored per shard (w0, b0, w1, b1, ...), so blobs_lr / weight_decay
+ * need an entry per shard blob and unsharded snapshots do not load.
+ * Listing the same device several times is allowed (useful for testing).
+ */
+template <typename Dtype>
+class ShardedInnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit ShardedInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// @brief Runs shard @p s of the forward pass on its own device.
+  void ForwardShard(const int s, const Dtype* bottom_data);
+  /// @brief Runs shard @p s of the backward pass on its own device.
+  void BackwardShard(const int s, const Dtype* top_diff,
+      const bool propagate_down);
+
+  /// Number of output columns owned by each shard; first_output_[s] is
+  /// the offset of shard s's strip in the top blob.
+  vector<int> shard_outputs_;
+  vector<int> first_output_;
+  // Shard-local working memory, first-touched on the shard's device:
+  // a copy of the bottom (whose diff carries the shard's bottom-gradient
+  // partial in backward), the shard's output strip (whose diff carries
+  // the incoming top-diff strip), and ones for the bias terms.
+  vector<shared_ptr<Blob<Dtype> > > shard_bottom_;
+  vector<shared_ptr<Blob<Dtype> > > shard_top_;
+  vector<shared_ptr<Blob<Dtype> > > shard_ones_;
+  /// Staging buffer on the caller's device for the bottom-diff reduction.
+  Blob<Dtype> shard_scratch_;
 };
 
 /**
@@ -412,6 +593,46 @@ class CuDNNSoftmaxLayer : public SoftmaxLayer<Dtype> {
 };
 #endif
 
+/**
+ * @brief Copies the bottom Blob across a pipeline stage boundary so the
+ *        consuming stage reads a device-local copy instead of
+ *        dereferencing peer memory on every access.
+ *
+ * Inserted automatically at Init time when NetParameter.pipeline_device
+ * is set (see util/insert_pipeline_transfers.hpp); it is not meant to be
+ * written into prototxts by hand. On the GPU the copy is a peer-to-peer
+ * cudaMemcpy between the producing and consuming stages' devices, issued
+ * asynchronously on the consumer's stream; cross-device ordering against
+ * the producer is handled by the events Net::ForwardPipelined places
+ * around the stage hand-off. Backward copies the diff the opposite way.
+ */
+template <typename Dtype>
+class PipelineTransferLayer : public Layer<Dtype> {
+ public:
+  explicit PipelineTransferLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_PIPELINE_TRANSFER;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  int count_;
+};
+
 /**
  * @brief Creates a "split" path in the network by copying the bottom Blob
  *        into multiple top Blob%s to be used by multiple consuming layers.
@@ -485,6 +706,17 @@ class SliceLayer : public Layer<Dtype> {
   int width_;
   int slice_dim_;
   vector<int> slice_point_;
+  // Zero-copy slicing along num (SliceParameter.in_place): each top is
+  // re-pointed at a view of its slice of the bottom's storage, so Forward
+  // moves no data. Top diffs are aliased into the bottom diff the first
+  // time Backward copies them, after which Backward moves no data either.
+  // The views are rebuilt whenever the bottom's backing memory or the
+  // slice layout changes.
+  bool in_place_;
+  shared_ptr<SyncedMemory> data_base_;
+  shared_ptr<SyncedMemory> diff_base_;
+  vector<shared_ptr<SyncedMemory> > top_data_views_;
+  vector<shared_ptr<SyncedMemory> > top_diff_views_;
 };
 
 }  // namespace caffe
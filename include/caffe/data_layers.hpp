@@ -1,13 +1,20 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <list>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "boost/scoped_ptr.hpp"
 #include "hdf5.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
+#include "leveldb/filter_policy.h"
 #include "lmdb.h"
 
 #include "caffe/blob.hpp"
@@ -17,9 +24,16 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace boost { class thread; }
 
 namespace caffe {
 
+// Defined in window_data_layer.cpp to keep OpenCV types out of this header.
+class WindowImageCache;
+
 #define HDF5_DATA_DATASET_NAME "data"
 #define HDF5_DATA_LABEL_NAME "label"
 
@@ -67,12 +81,38 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+/**
+ * @brief One prefetched batch: the data blob and (optionally) the label blob
+ *        that a prefetch thread fills and the consuming Forward drains.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+  // Staging buffers for the GPU transform path (see
+  // TransformationParameter.use_gpu_transform): the packed uint8 source
+  // pixels and the per-image crop/mirror draws (3 ints per image) made on
+  // the prefetch thread. Unallocated unless that path is active.
+  shared_ptr<SyncedMemory> raw_data_, transform_params_;
+  // Database key of the record the batch after this one starts at, set
+  // by database-backed LoadBatch implementations with a deterministic
+  // read order; consuming the batch makes it the layer's resume point
+  // (see Layer::data_cursor_key).
+  string cursor_key_;
+};
+
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
   explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+      : BaseDataLayer<Dtype>(param), must_stop_prefetch_(false),
+        use_gpu_transform_(false), gpu_cache_(false), cache_complete_(false),
+        cache_active_(false), cache_num_(0), collect_timing_(false),
+        read_time_ms_(0), decode_time_ms_(0), transform_time_ms_(0),
+        batches_timed_(0), prefetch_wait_ms_(0), prefetch_busy_ms_(0),
+        prefetch_period_ms_(0), window_wait_ms_(0), window_busy_ms_(0),
+        window_period_ms_(0), prefetch_period_started_(false) {}
   virtual ~BasePrefetchingDataLayer() {}
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
@@ -85,21 +125,153 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
+  // Pipeline timing for tools/data_benchmark: when enabled, LoadBatch
+  // breaks down where the prefetch thread spends its time (database read
+  // vs. datum decode vs. transform). Off by default so training pays no
+  // timing overhead. The counters are maintained on the prefetch thread
+  // and are only meant to be read for reporting.
+  void set_collect_timing(bool collect) { collect_timing_ = collect; }
+  double read_time_ms() const { return read_time_ms_; }
+  double decode_time_ms() const { return decode_time_ms_; }
+  double transform_time_ms() const { return transform_time_ms_; }
+  int batches_timed() const { return batches_timed_; }
+
+  // Pipeline-bubble accounting, always on (two wall-clock reads per
+  // batch): the time the consuming Forward spent blocked waiting for a
+  // prefetched batch versus the time the prefetch thread spent filling
+  // batches, over the wall time spanned by the consuming forwards.
+  // wait / period is the "idle waiting for data" fraction dashboards
+  // want; busy / period near 1 means the prefetch thread has no slack
+  // left. Cumulative counters here; PrefetchTiming with window set
+  // reports (and drains) the interval since its previous windowed call.
+  // The busy counter is written on the prefetch thread and is only
+  // meant to be read for reporting, like the breakdown above.
+  double prefetch_wait_ms() const { return prefetch_wait_ms_; }
+  double prefetch_busy_ms() const { return prefetch_busy_ms_; }
+  double prefetch_period_ms() const { return prefetch_period_ms_; }
+  virtual bool PrefetchTiming(const bool window, double* wait_ms,
+      double* busy_ms, double* period_ms) {
+    if (window) {
+      *wait_ms += window_wait_ms_;
+      *busy_ms += window_busy_ms_;
+      *period_ms += window_period_ms_;
+      window_wait_ms_ = window_busy_ms_ = window_period_ms_ = 0;
+    } else {
+      *wait_ms += prefetch_wait_ms_;
+      *busy_ms += prefetch_busy_ms_;
+      *period_ms += prefetch_period_ms_;
+    }
+    return true;
+  }
+
+  // The resume point: where the batch after the last consumed one
+  // starts, as recorded by LoadBatch into Batch::cursor_key_.
+  virtual string data_cursor_key() const { return consumed_cursor_key_; }
+
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // The persistent thread's function: pops free batches, fills them via
+  // LoadBatch, and hands them to the consumer through prefetch_full_.
+  virtual void InternalThreadEntry();
 
  protected:
+  // Fills one batch; implemented by each prefetching data layer.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+
+  // Pops the next full batch, charging the blocked time to the wait
+  // counters and the time since the previous pop to the period counters
+  // (see PrefetchTiming above). Both forwards consume through this.
+  Batch<Dtype>* DequeueBatch();
+
+  // On-GPU dataset cache (data_param().gpu_cache()): while caching() is
+  // true, the LoadBatch implementation hands each example it stages to
+  // CacheExample exactly once (on the prefetch thread) and calls
+  // set_cache_complete() when its cursor wraps. The next Forward_gpu then
+  // uploads the cache, shuts the prefetch pipeline down, and serves every
+  // later batch from device memory; see ActivateGpuCache below.
+  bool caching() const { return gpu_cache_ && !cache_complete_; }
+  void CacheExample(const uint8_t* pixels, const Dtype label);
+  void set_cache_complete() { cache_complete_ = true; }
+#ifndef CPU_ONLY
+  // Uploads the staged examples, joins the prefetch thread and releases
+  // the batch ring; from then on Forward_gpu runs ForwardCachedBatch,
+  // which draws batch_size examples uniformly at random and feeds their
+  // indices plus fresh crop/mirror draws to the gather variant of the
+  // fused transform kernel. Only the tiny per-batch index/parameter/label
+  // staging crosses the PCIe bus.
+  void ActivateGpuCache();
+  void ForwardCachedBatch(vector<Blob<Dtype>*>* top);
+#endif
+
+  // prefetch_data_ and prefetch_label_ only hold the shapes that
+  // DataLayerSetUp determined; the actual batches live in the ring below.
   Blob<Dtype> prefetch_data_;
   Blob<Dtype> prefetch_label_;
+  // The ring of preloaded batches, of size DataParameter.prefetch.
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  bool must_stop_prefetch_;
+  // True when transform_param().use_gpu_transform() is set and the mode is
+  // GPU: LoadBatch stages raw pixels into Batch::raw_data_ and Forward_gpu
+  // runs the fused transform kernel on the device.
+  bool use_gpu_transform_;
+  // On-GPU dataset cache state (see caching() above). The staging vectors
+  // collect the first epoch's examples on the host; ActivateGpuCache
+  // moves the pixels into cache_data_ on the device and keeps only the
+  // labels host-side. cache_complete_ is written by the prefetch thread
+  // and read by Forward_gpu, like must_stop_prefetch_ in the other
+  // direction. The cache_batch_* buffers stage one batch's example
+  // indices, transform draws and labels for upload.
+  bool gpu_cache_;
+  bool cache_complete_;
+  bool cache_active_;
+  int cache_num_;
+  vector<uint8_t> cache_staging_;
+  vector<Dtype> cache_labels_;
+  shared_ptr<SyncedMemory> cache_data_;
+  shared_ptr<SyncedMemory> cache_batch_indices_;
+  shared_ptr<SyncedMemory> cache_batch_params_;
+  shared_ptr<SyncedMemory> cache_batch_labels_;
+  shared_ptr<Caffe::RNG> cache_rng_;
+  // See set_collect_timing above. Decode worker times are summed across
+  // the workers, so they measure CPU cost rather than wall time.
+  bool collect_timing_;
+  double read_time_ms_;
+  double decode_time_ms_;
+  double transform_time_ms_;
+  int batches_timed_;
+  // See prefetch_wait_ms above: cumulative and windowed wait/busy/period
+  // counters, and the timer spanning consecutive DequeueBatch calls.
+  double prefetch_wait_ms_;
+  double prefetch_busy_ms_;
+  double prefetch_period_ms_;
+  double window_wait_ms_;
+  double window_busy_ms_;
+  double window_period_ms_;
+  CPUTimer prefetch_period_timer_;
+  bool prefetch_period_started_;
+  // See data_cursor_key above.
+  string consumed_cursor_key_;
+};
+
+// One entry of DataLayer's host-RAM example cache (see
+// DataParameter.example_cache_size): the decoded uint8 pixels and the
+// label of one record. The key is kept so eviction from the LRU list can
+// also drop the index entry.
+template <typename Dtype>
+struct CachedExample {
+  string key;
+  string pixels;
+  Dtype label;
 };
 
 template <typename Dtype>
 class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit DataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), wrapped_(false),
+        example_cache_bytes_(0) {}
   virtual ~DataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -111,10 +283,66 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline int MaxTopBlobs() const { return 2; }
 
+  // Repositions the read cursor at the snapshotted key with one keyed
+  // seek, restarting the prefetch pipeline from there; a no-op for
+  // randomized read orders (chunk shuffle, extra sources, gpu_cache).
+  virtual void RestoreDataCursor(const string& key);
+
  protected:
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Advances the cursor to this layer's next record, wrapping at the end.
+  // With sharding (data_param().num_shards() > 1) this steps num_shards
+  // records so the layer only visits its own 1/N stripe.
+  void Next();
+  // Positions the cursor at the record whose key carries the zero-padded
+  // numeric index `record` with one keyed seek (O(log n) in the database),
+  // instead of stepping there linearly. Only databases keyed the way our
+  // conversion tools write them support this; returns false without moving
+  // the cursor when the keys have a different format.
+  bool SeekToRecord(unsigned int record);
+  // Chunk-shuffled reading (data_param().shuffle_chunks() > 0): records
+  // are drawn at random from a buffer that StreamChunk refills by
+  // streaming whole chunks in random order, so disk reads stay
+  // sequential while the record order seen by training approximates a
+  // global shuffle. Requires the zero-padded numeric keys that
+  // SeekToRecord relies on; see DataParameter for the knobs.
+  void SetUpChunkShuffle();
+  // Streams the next chunk of this layer's chunk order into the buffer,
+  // drawing a fresh order once every chunk has been visited.
+  void StreamChunk();
+  // Removes one buffered record, chosen uniformly. leveldb bytes are
+  // swapped into *value (which *data then aliases); LMDB records alias
+  // the pinned memory map directly and also report their *key for the
+  // parallel decode path (key may be NULL when unwanted).
+  void DrawShuffledRecord(string* key, string* value, const void** data,
+      size_t* size);
+  size_t ShuffleBufferSize() const;
+  // Weighted multi-source reading (data_param().extra_source_size() > 0):
+  // draws the index of the source supplying the next record, where 0 is
+  // the primary source and k > 0 is extra_source(k - 1).
+  int PickSource();
+  // Reads the current record of extra source `index` and advances its
+  // cursor, wrapping at the end. leveldb bytes are staged into *value
+  // (which *data then aliases); LMDB records alias the source's pinned
+  // memory map directly.
+  void ReadExtraSource(const int index, string* value, const void** data,
+      size_t* size);
+  // Host-RAM example cache (data_param().example_cache_size()): decoded
+  // uint8 examples keyed by record, retained LRU within the byte budget.
+  // A hit skips the database value read and the parse/decode; only the
+  // transform remains. Both methods run on the prefetch thread only.
+  // Lookup returns NULL on a miss and refreshes the entry's LRU position
+  // on a hit; the returned pointer stays valid until the next insertion.
+  const CachedExample<Dtype>* LookupCachedExample(const string& key);
+  void InsertCachedExample(const string& key, const char* pixels,
+      const size_t size, const Dtype label);
 
   // LEVELDB
+  // Optional tuning objects the open DB points at (see the leveldb_*
+  // fields of DataParameter); declared before db_ so they outlive it
+  // at destruction.
+  shared_ptr<leveldb::Cache> leveldb_cache_;
+  shared_ptr<const leveldb::FilterPolicy> leveldb_filter_;
   shared_ptr<leveldb::DB> db_;
   shared_ptr<leveldb::Iterator> iter_;
   // LMDB
@@ -123,6 +351,57 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   MDB_txn* mdb_txn_;
   MDB_cursor* mdb_cursor_;
   MDB_val mdb_key_, mdb_value_;
+
+  // Weighted extra sources: one open database and cursor per entry of
+  // data_param().extra_source(), in the backend's flavor. The sampling
+  // distribution lives in source_cdf_ as cumulative weights, entry 0
+  // covering the primary source; source_rng_ draws from it on the
+  // prefetch thread.
+  vector<shared_ptr<leveldb::DB> > extra_dbs_;
+  vector<shared_ptr<leveldb::Iterator> > extra_iters_;
+  vector<MDB_env*> extra_mdb_envs_;
+  vector<MDB_dbi> extra_mdb_dbis_;
+  vector<MDB_txn*> extra_mdb_txns_;
+  vector<MDB_cursor*> extra_mdb_cursors_;
+  vector<double> source_cdf_;
+  shared_ptr<Caffe::RNG> source_rng_;
+
+  // Set by Next() whenever the cursor wraps to the first record; LoadBatch
+  // clears and polls it to tell when the GPU dataset cache has seen one
+  // full pass (data_param().gpu_cache()).
+  bool wrapped_;
+
+  // Host-RAM example cache storage: the LRU list owns the entries (front
+  // is most recent) and the index maps record keys to list positions.
+  // example_cache_bytes_ counts the pixel bytes held, against
+  // data_param().example_cache_size().
+  std::list<CachedExample<Dtype> > example_cache_;
+  std::map<string, typename std::list<CachedExample<Dtype> >::iterator>
+      example_cache_index_;
+  size_t example_cache_bytes_;
+
+  // Chunk-shuffle state: the record count parsed from the last key, the
+  // shuffled chunk visiting order, and the buffer itself -- owned value
+  // bytes for leveldb, key plus memory-map alias for LMDB.
+  unsigned int num_records_;
+  vector<unsigned int> chunk_order_;
+  unsigned int next_chunk_;
+  vector<string> buffer_values_;
+  vector<string> buffer_keys_;
+  vector<const void*> buffer_data_;
+  vector<size_t> buffer_sizes_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+
+  // Decode-worker transformers, created once and reused across batches
+  // so each worker's RNG stream (seeded per worker index off the master
+  // seed, see Caffe::rng_stream_seed) continues instead of restarting
+  // every batch.
+  vector<shared_ptr<DataTransformer<Dtype> > > decode_transformers_;
+
+  // Background page-cache warmup (data_param().warm_page_cache()):
+  // started at setup, joined at destruction. The thread only touches
+  // copies of the source paths, never layer state.
+  shared_ptr<boost::thread> warmup_thread_;
 };
 
 /**
@@ -159,16 +438,31 @@ class DummyDataLayer : public Layer<Dtype> {
   vector<bool> refill_;
 };
 
+/**
+ * @brief One contiguous run of rows that the HDF5 prefetch thread reads
+ *        from a file as a hyperslab.
+ */
+template <typename Dtype>
+class HDF5Chunk {
+ public:
+  Blob<Dtype> data_, label_;
+};
+
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * A background thread reads the files chunk by chunk (hyperslab reads of
+ * hdf5_data_param.chunk_size rows) into a small ring of staged chunks, so
+ * Forward never stalls on file I/O and host memory is bounded by the ring
+ * rather than the file size.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), num_files_(0), current_file_(0),
+        current_row_(0), chunk_rows_(0), current_chunk_(NULL),
+        must_stop_prefetch_(false) {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -182,6 +476,10 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
+  // The prefetch thread's function: walks the file list in order, reading
+  // hyperslab chunks into the free ring slots.
+  virtual void InternalThreadEntry();
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -191,23 +489,34 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  // Recycles the drained current chunk and blocks for the next staged one.
+  HDF5Chunk<Dtype>* NextChunk();
+  void JoinPrefetchThread();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
-  unsigned int current_file_;
-  hsize_t current_row_;
-  Blob<Dtype> data_blob_;
-  Blob<Dtype> label_blob_;
+  unsigned int current_file_;  // Position of the prefetch thread.
+  hsize_t current_row_;        // Consumer position within current_chunk_.
+  hsize_t chunk_rows_;         // Rows per chunk; 0 reads each file whole.
+  // The ring of staged chunks, of size hdf5_data_param.prefetch.
+  vector<shared_ptr<HDF5Chunk<Dtype> > > chunks_;
+  BlockingQueue<HDF5Chunk<Dtype>*> free_chunks_;
+  BlockingQueue<HDF5Chunk<Dtype>*> full_chunks_;
+  HDF5Chunk<Dtype>* current_chunk_;
+  bool must_stop_prefetch_;
 };
 
 /**
  * @brief Write blobs to disk as HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * With hdf5_output_param.staging_batches set, Forward only copies the
+ * bottoms into a ring of staging buffers and a writer thread appends them
+ * to chunked (optionally deflate-compressed) datasets, so the net is not
+ * throttled to disk speed; Forward blocks only when every staging buffer
+ * is waiting on the writer.
  */
 template <typename Dtype>
-class HDF5OutputLayer : public Layer<Dtype> {
+class HDF5OutputLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5OutputLayer(const LayerParameter& param);
   virtual ~HDF5OutputLayer();
@@ -236,11 +545,35 @@ class HDF5OutputLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void SaveBlobs();
+  // The writer thread: drains staged batches into chunked appends until
+  // the destructor pushes the NULL sentinel.
+  virtual void InternalThreadEntry();
+  // Copies the bottoms into a free staging buffer, blocking only when all
+  // of them are in flight; sources from the GPU when use_gpu is set.
+  void StageBlobs(const vector<Blob<Dtype>*>& bottom, const bool use_gpu);
 
   std::string file_name_;
   hid_t file_id_;
   Blob<Dtype> data_blob_;
   Blob<Dtype> label_blob_;
+  // The staging ring handed between Forward and the writer thread, of
+  // size hdf5_output_param.staging_batches (empty when writing is
+  // synchronous).
+  int staging_batches_;
+  int compression_level_;
+  vector<shared_ptr<HDF5Chunk<Dtype> > > staged_;
+  BlockingQueue<HDF5Chunk<Dtype>*> free_batches_;
+  BlockingQueue<HDF5Chunk<Dtype>*> full_batches_;
+};
+
+// One entry of a packed image archive: the byte span of the encoded image
+// within the archive file, plus its label. The filename is only kept for
+// error messages.
+struct ImageArchiveEntry {
+  std::string filename;
+  int label;
+  off_t offset;
+  size_t size;
 };
 
 /**
@@ -252,7 +585,7 @@ template <typename Dtype>
 class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit ImageDataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), archive_fd_(-1) {}
   virtual ~ImageDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -266,10 +599,14 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // Populated instead of lines_ when image_data_param.archive is set; the
+  // encoded images are then read from archive_fd_ by offset.
+  vector<ImageArchiveEntry> archive_entries_;
+  int archive_fd_;
 };
 
 /**
@@ -281,7 +618,8 @@ template <typename Dtype>
 class MemoryDataLayer : public BaseDataLayer<Dtype> {
  public:
   explicit MemoryDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param), has_new_data_(false) {}
+      : BaseDataLayer<Dtype>(param), has_new_data_(false), ring_slots_(0),
+        ring_head_(0), ring_tail_(0), ring_busy_(false) {}
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -291,8 +629,23 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
+  // Transforms one batch of datums into the layer's buffers. With the
+  // ring enabled this claims a slot (spinning while the ring is full) and
+  // commits it; note that the shared data transformer's RNG makes this a
+  // single-producer convenience -- concurrent feed threads should claim
+  // raw slots with ClaimBatchSlot instead.
   virtual void AddDatumVector(const vector<Datum>& datum_vector);
 
+  // Producer API of the batch-slot ring (memory_data_param.ring_slots).
+  // Any number of feed threads may call ClaimBatchSlot concurrently: it
+  // claims one batch slot with an atomic cursor and points *data and
+  // *labels at the slot's buffers (pinned host memory in GPU mode),
+  // returning false when the ring is full. Once the producer has written
+  // batch_size() images it publishes the slot with CommitBatchSlot;
+  // Forward consumes published slots in claim order without locks.
+  bool ClaimBatchSlot(Dtype** data, Dtype** labels, unsigned int* slot);
+  void CommitBatchSlot(unsigned int slot);
+
   // Reset should accept const pointers, but can't, because the memory
   //  will be given to Blob, which is mutable
   void Reset(Dtype* data, Dtype* label, int n);
@@ -311,6 +664,18 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   Blob<Dtype> added_data_;
   Blob<Dtype> added_label_;
   bool has_new_data_;
+  // Ring buffer of batch slots. Each slot carries a sequence number in
+  // slot_seq_ that orders claims, commits and consumption; see the note
+  // in memory_data_layer.cpp for the protocol.
+  int ring_slots_;
+  vector<shared_ptr<Blob<Dtype> > > slot_data_;
+  vector<shared_ptr<Blob<Dtype> > > slot_label_;
+  vector<unsigned int> slot_seq_;
+  unsigned int ring_head_;
+  unsigned int ring_tail_;
+  // Whether the previous Forward handed out a slot that still has to be
+  // recycled; only the consumer touches this.
+  bool ring_busy_;
 };
 
 /**
@@ -336,13 +701,14 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
   vector<vector<float> > bg_windows_;
+  shared_ptr<WindowImageCache> image_cache_;
 };
 
 }  // namespace caffe
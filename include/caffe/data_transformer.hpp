@@ -1,8 +1,13 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <stdint.h>
+
+#include <vector>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
 
 namespace caffe {
 
@@ -16,10 +21,21 @@ class DataTransformer {
   explicit DataTransformer(const TransformationParameter& param)
     : param_(param) {
     phase_ = Caffe::phase();
+    for (int c = 0; c < param_.mean_value_size(); ++c) {
+      mean_values_.push_back(Dtype(param_.mean_value(c)));
+    }
   }
   virtual ~DataTransformer() {}
 
   void InitRand();
+  // As above but with an explicit seed, for deterministic per-worker
+  // streams (see Caffe::rng_stream_seed).
+  void InitRand(const unsigned int seed);
+
+  // Override the phase captured at construction time. Needed when the
+  // transformer is constructed on a helper thread, whose thread-local
+  // Caffe::phase() may not match the consuming layer's phase.
+  void set_phase(Caffe::Phase phase) { phase_ = phase; }
 
   /**
    * @brief Applies the transformation defined in the data layer's
@@ -31,6 +47,8 @@ class DataTransformer {
    * @param datum
    *    Datum containing the data to be transformed.
    * @param mean
+   *    The mean image; ignored when mean_value is configured, in which
+   *    case the per-channel constants are subtracted in registers.
    * @param transformed_data
    *    This is meant to be the top blob's data. The transformed data will be
    *    written at the appropriate place within the blob's data.
@@ -38,12 +56,70 @@ class DataTransformer {
   void Transform(const int batch_item_id, const Datum& datum,
                  const Dtype* mean, Dtype* transformed_data);
 
+  /**
+   * @brief As above, but for decoded uint8 pixels that are no longer
+   * wrapped in a Datum -- e.g. entries of DataLayer's host example cache
+   * (see DataParameter.example_cache_size). The Datum overload delegates
+   * here whenever the datum carries uint8 data.
+   */
+  void Transform(const int batch_item_id, const char* data,
+                 const int channels, const int height, const int width,
+                 const Dtype* mean, Dtype* transformed_data);
+
+  /**
+   * @brief Stages a datum for the GPU transform path: copies its raw uint8
+   * pixels into raw_data and draws the crop offsets and mirror flag into
+   * transform_params (3 ints per item: h_off, w_off, do_mirror).
+   *
+   * The random draws stay on the host so that the prefetch thread owns the
+   * RNG, exactly as in the CPU Transform; only the per-pixel arithmetic
+   * moves to the device.
+   */
+  void Fill(const int batch_item_id, const Datum& datum,
+            uint8_t* raw_data, int* transform_params);
+
+  /**
+   * @brief Draws the per-item crop offsets and mirror flag for the GPU
+   * transform path without staging any pixels, for sources whose raw
+   * bytes are already resident on the device (see DataParameter.gpu_cache).
+   * Fill is this plus the pixel copy.
+   */
+  void FillParams(const int batch_item_id, const int height, const int width,
+                  int* transform_params);
+
+#ifndef CPU_ONLY
+  /**
+   * @brief Applies the fused crop/mirror/mean-subtract/scale kernel to a
+   * batch of raw uint8 pixels already resident on the device, using the
+   * per-item parameters drawn by Fill.
+   *
+   * With a non-NULL indices array (batch item i sources its pixels from
+   * example indices[i] of raw_data) the kernel gathers out of a larger
+   * pool instead of reading the items in order; this is how batches are
+   * drawn from the on-GPU dataset cache.
+   */
+  void TransformGPU(const int num, const int channels, const int height,
+                    const int width, const uint8_t* raw_data,
+                    const int* indices, const int* transform_params,
+                    const Dtype* mean, Dtype* transformed_data);
+  void TransformGPU(const int num, const int channels, const int height,
+                    const int width, const uint8_t* raw_data,
+                    const int* transform_params, const Dtype* mean,
+                    Dtype* transformed_data);
+#endif
+
  protected:
   virtual unsigned int Rand();
 
   // Tranformation parameters
   TransformationParameter param_;
 
+  // Per-channel scalar means parsed from mean_value; empty when a mean
+  // file (or no mean) is used. A single entry applies to every channel.
+  vector<Dtype> mean_values_;
+  // Device copy of the means, expanded to one entry per channel; built
+  // lazily on the first TransformGPU call.
+  shared_ptr<SyncedMemory> mean_values_mem_;
 
   shared_ptr<Caffe::RNG> rng_;
   Caffe::Phase phase_;
@@ -85,7 +85,7 @@ class GaussianFiller : public Filler<Dtype> {
       Dtype non_zero_probability = Dtype(sparse) / Dtype(num_inputs);
       rand_vec_.reset(new SyncedMemory(blob->count() * sizeof(int)));
       int* mask = reinterpret_cast<int*>(rand_vec_->mutable_cpu_data());
-      caffe_rng_bernoulli(blob->count(), non_zero_probability, mask);
+      caffe_rng_bernoulli_block(blob->count(), non_zero_probability, mask);
       for (int i = 0; i < blob->count(); ++i) {
         data[i] *= mask[i];
       }
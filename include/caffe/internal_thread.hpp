@@ -5,28 +5,21 @@
 
 namespace caffe {
 
-/**
- * A minimal wrapper for boost::thread to force host compilation for boost
- * Defined in caffe/util/thread.hpp
- */
-class Thread {
- public:
-  template<typename Callable, class A1>
-  Thread(Callable func, A1 a1);
-  void join();
-  bool joinable();
- private:
-  void* thread_;
-};
-
 /**
  * Virtual class encapsulate boost::thread for use in base class
  * The child class will acquire the ability to run a single thread,
  * by reimplementing the virutal function InternalThreadEntry.
+ *
+ * The thread is created once, on the first StartInternalThread, and
+ * parked on a condition variable between runs: each StartInternalThread
+ * hands it one execution of InternalThreadEntry, and
+ * WaitForInternalThreadToExit blocks until that execution has finished.
+ * The prefetching data layers cycle start/wait every batch, so reusing
+ * the worker saves the per-iteration thread creation and teardown.
  */
 class InternalThread {
  public:
-  InternalThread() : thread_(NULL) {}
+  InternalThread() : worker_(NULL), started_(false) {}
   virtual ~InternalThread();
 
   /** Returns true if the thread was successfully started. **/
@@ -35,14 +28,24 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
-  bool is_started() const { return thread_ != NULL && thread_->joinable(); }
+  bool is_started() const { return started_; }
 
  protected:
   /* Implement this method in your subclass
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
-  caffe::Thread* thread_;
+ private:
+  /* Owns the persistent boost::thread and the run/park state. Defined in
+      internal_thread.cpp so that boost::thread stays out of headers that
+      nvcc compiles. */
+  class Worker;
+
+  Worker* worker_;
+  /* Whether a run has been started and not yet waited for, mirroring the
+      joinable() state the previous thread-per-run implementation
+      exposed. Only the owning thread starts and waits, so no lock. */
+  bool started_;
 };
 
 }  // namespace caffe
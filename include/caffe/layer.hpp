@@ -155,9 +155,30 @@ class Layer {
   const LayerParameter& layer_param() const { return layer_param_; }
 
   /**
-   * @brief Writes the layer parameter to a protocol buffer
+   * @brief Writes the layer parameter to a protocol buffer; write_half
+   *        stores the parameter data payloads in half precision (see
+   *        Blob::ToProto).
    */
-  virtual void ToProto(LayerParameter* param, bool write_diff = false);
+  virtual void ToProto(LayerParameter* param, bool write_diff = false,
+      bool write_half = false);
+
+  /**
+   * @brief Bytes of scratch workspace this layer wants, e.g. for an im2col
+   *        buffer; 0 if none. Valid once the layer is set up.
+   *
+   * Under sequential execution only one layer's scratch is live at a time,
+   * so the Net sizes one shared arena to the maximum requirement and hands
+   * it to every requesting layer through SetWorkspace.
+   */
+  virtual size_t WorkspaceSize() const { return 0; }
+
+  /**
+   * @brief Gives the layer a shared scratch arena (and a matching one for
+   *        diffs) at least WorkspaceSize() bytes large. Layers without
+   *        scratch needs ignore it.
+   */
+  virtual void SetWorkspace(const shared_ptr<SyncedMemory>& data,
+      const shared_ptr<SyncedMemory>& diff) {}
 
   /**
    * @brief Returns the scalar loss associated with a top blob at a given index.
@@ -291,6 +312,53 @@ class Layer {
     param_propagate_down_[param_id] = value;
   }
 
+  /**
+   * @brief The rows of parameter blob param_id that received gradient in
+   *        the last Backward pass, or NULL when the whole blob did.
+   *
+   * Rows index the blob's height dimension, each width() values long.
+   * Layers whose parameter gradients are sparse by construction (e.g.
+   * EmbedLayer, which only touches the rows looked up in the batch)
+   * override this so the solver can restrict its regularization,
+   * history and update work to those rows (see
+   * SGDSolver::ComputeUpdateValue).
+   */
+  virtual const vector<int>* sparse_param_rows(const int param_id) const {
+    return NULL;
+  }
+
+  /**
+   * @brief Prefetch pipeline accounting for data layers that produce
+   *        batches on a background thread.
+   *
+   * Adds to *wait_ms the milliseconds this layer's Forward spent blocked
+   * waiting for a prefetched batch, to *busy_ms the milliseconds its
+   * prefetch thread spent producing batches, and to *period_ms the wall
+   * time spanned by the consuming forwards; wait / period is the
+   * "idle waiting for data" fraction of this layer's consumer. Counters
+   * are cumulative since setup, or since the previous windowed call when
+   * window is set (the window is drained by reading it). Returns false
+   * for layers that do not prefetch. See BasePrefetchingDataLayer and
+   * Net::PrefetchTiming.
+   */
+  virtual bool PrefetchTiming(const bool window, double* wait_ms,
+      double* busy_ms, double* period_ms) {
+    return false;
+  }
+
+  /**
+   * @brief Mid-epoch resume support for database-backed data layers.
+   *
+   * data_cursor_key() is the database key the batch after the last
+   * consumed one starts at, or empty when the layer reads no database
+   * (or its read order is randomized). Solver::Snapshot stores the keys
+   * in SolverState and Restore hands them back to RestoreDataCursor,
+   * which repositions the read cursor with one keyed seek so the
+   * restored run continues in the exact data order it left off. See
+   * DataLayer.
+   */
+  virtual string data_cursor_key() const { return ""; }
+  virtual void RestoreDataCursor(const string& key) {}
 
  protected:
   /** The protobuf that stores the layer parameters */
@@ -459,12 +527,13 @@ inline void Layer<Dtype>::Backward(const vector<Blob<Dtype>*>& top,
 
 // Serialize LayerParameter to protocol buffer
 template <typename Dtype>
-void Layer<Dtype>::ToProto(LayerParameter* param, bool write_diff) {
+void Layer<Dtype>::ToProto(LayerParameter* param, bool write_diff,
+    bool write_half) {
   param->Clear();
   param->CopyFrom(layer_param_);
   param->clear_blobs();
   for (int i = 0; i < blobs_.size(); ++i) {
-    blobs_[i]->ToProto(param->add_blobs(), write_diff);
+    blobs_[i]->ToProto(param->add_blobs(), write_diff, write_half);
   }
 }
 
@@ -71,6 +71,10 @@ class AccuracyLayer : public Layer<Dtype> {
    */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  /// @brief On-device top-k check, so TEST iterations avoid syncing the
+  ///        full predictions back to the host.
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
 
   /// @brief Not implemented -- AccuracyLayer cannot be used as a loss.
@@ -82,6 +86,8 @@ class AccuracyLayer : public Layer<Dtype> {
   }
 
   int top_k_;
+  /// Per-image correctness flags reduced on-device by Forward_gpu.
+  Blob<Dtype> correct_;
 };
 
 /**
@@ -485,6 +491,9 @@ class InfogainLossLayer : public LossLayer<Dtype> {
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
   Blob<Dtype> infogain_;
+  /// Clamped log-probabilities, computed in one vectorized pass so the
+  /// loss reduces to a BLAS dot per sample against a row of infogain_.
+  Blob<Dtype> log_prob_;
 };
 
 /**
@@ -565,6 +574,67 @@ class MultinomialLogisticLossLayer : public LossLayer<Dtype> {
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 };
 
+/**
+ * @brief Sampled-softmax training loss for very large vocabularies:
+ *        scores the label plus a drawn set of negative classes instead
+ *        of all num_classes, cutting the classifier head's cost from
+ *        O(num_classes) to O(num_samples) per image.
+ *
+ * Unlike SoftmaxWithLossLayer this layer owns the classifier weights
+ * (num_classes x dim, plus biases) and takes the features as its first
+ * bottom, since computing all the logits first would already cost the
+ * full projection. Sampled logits are corrected by -log(expected
+ * count) so the loss is an estimator of the full softmax loss; the
+ * label's logit needs no correction as it is always scored. A serving
+ * net keeps the exact softmax by pairing an INNER_PRODUCT layer with
+ * this layer's weights via param name sharing.
+ *
+ * @param bottom input Blob vector (length 2)
+ *   -# @f$ (N \times C \times H \times W) @f$ the features, flattened
+ *      to @f$ N \times CHW @f$
+ *   -# @f$ (N \times 1 \times 1 \times 1) @f$ the labels
+ * @param top output Blob vector (length 1)
+ *   -# @f$ (1 \times 1 \times 1 \times 1) @f$ the estimated
+ *      cross-entropy classification loss
+ */
+template <typename Dtype>
+class SampledSoftmaxLossLayer : public LossLayer<Dtype> {
+ public:
+  explicit SampledSoftmaxLossLayer(const LayerParameter& param)
+      : LossLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_SAMPLED_SOFTMAX_LOSS;
+  }
+
+ protected:
+  /// @copydoc SampledSoftmaxLossLayer
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// Draws one class id from the configured proposal distribution.
+  int SampleClass();
+  /// -log of the expected number of times SampleClass draws `id` in
+  /// num_samples_ draws, the importance correction for sampled logits.
+  Dtype LogExpectedCount(int id) const;
+
+  int M_;  // batch size
+  int K_;  // feature dimension
+  int num_classes_;
+  int num_samples_;
+  bool bias_term_;
+  /// Class ids scored per image, label first: M_ x (num_samples_ + 1).
+  Blob<int> sample_ids_;
+  /// Softmax over the corrected logits, kept for Backward.
+  Blob<Dtype> prob_;
+};
+
 /**
  * @brief Computes the cross-entropy (logistic) loss @f$
  *          E = \frac{-1}{n} \sum\limits_{n=1}^N \left[
@@ -660,6 +730,8 @@ class SigmoidCrossEntropyLossLayer : public LossLayer<Dtype> {
   vector<Blob<Dtype>*> sigmoid_bottom_vec_;
   /// top vector holder to call the underlying SigmoidLayer::Forward
   vector<Blob<Dtype>*> sigmoid_top_vec_;
+  /// Per-element losses summed on the GPU (unused on the CPU path).
+  Blob<Dtype> loss_buffer_;
 };
 
 // Forward declare SoftmaxLayer for use in SoftmaxWithLossLayer.
@@ -761,6 +833,17 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   vector<Blob<Dtype>*> softmax_bottom_vec_;
   /// top vector holder used in call to the underlying SoftmaxLayer::Forward
   vector<Blob<Dtype>*> softmax_top_vec_;
+  /// Whether the fused path is active: when the softmax output is not
+  /// requested as a second top, the loss is computed straight from the
+  /// predictions (max, sum-exp and label log-prob in one pass) and
+  /// Backward writes softmax-minus-indicator directly, so the full
+  /// probability blob is never materialized. Only the per-position max
+  /// and sum-exp below are kept for Backward.
+  bool fused_;
+  Blob<Dtype> fused_max_;
+  Blob<Dtype> fused_sum_;
+  /// Per-position losses summed on the GPU (unused on the CPU path).
+  Blob<Dtype> fused_loss_;
 };
 
 }  // namespace caffe
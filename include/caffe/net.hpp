@@ -1,6 +1,11 @@
 #ifndef CAFFE_NET_HPP_
 #define CAFFE_NET_HPP_
 
+#include <stdint.h>
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
 #include <map>
 #include <set>
 #include <string>
@@ -11,9 +16,33 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mmap_model.hpp"
 
 namespace caffe {
 
+class PerfCounters;
+
+/**
+ * @brief Receives finished parameter gradients while a backward pass is
+ *        still running; see Net::set_gradient_reducer.
+ *
+ * Reduction backends (multi-GPU averaging, distributed exchange)
+ * implement this to start communicating a layer's gradients while the
+ * layers below it are still computing, instead of waiting for the whole
+ * backward pass to finish.
+ */
+template <typename Dtype>
+class GradientReducer {
+ public:
+  virtual ~GradientReducer() {}
+  /**
+   * @brief Called with a bucket of parameter blobs whose diffs are final
+   *        for this pass, in reverse layer order. The diffs may be read
+   *        (or reduced in place) until the pass's next bucket arrives.
+   */
+  virtual void Reduce(const vector<Blob<Dtype>*>& bucket) = 0;
+};
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -25,7 +54,7 @@ class Net {
  public:
   explicit Net(const NetParameter& param);
   explicit Net(const string& param_file);
-  virtual ~Net() {}
+  virtual ~Net();
 
   /// @brief Initialize a network with a NetParameter.
   void Init(const NetParameter& param);
@@ -57,6 +86,98 @@ class Net {
    */
   string Forward(const string& input_blob_protos, Dtype* loss = NULL);
 
+  /**
+   * @brief Run forward adopting one caller-owned buffer per net input,
+   *        without copying or serializing anything.
+   *
+   * Each pointer must hold input_blobs()[i]->count() elements in the
+   * usual NCHW layout, start on a 64-byte boundary (Blob::IsAligned),
+   * and stay valid until the caller feeds the next input -- the net
+   * reads from it directly. The returned blobs are the net's own
+   * output views, valid until the next forward pass; serving callers
+   * read cpu_data() straight out of them. Together this replaces the
+   * parse-copy-serialize round trip of Forward(const string&) for the
+   * in-process RPC path.
+   */
+  const vector<Blob<Dtype>*>& ForwardZeroCopy(const vector<Dtype*>& inputs,
+      Dtype* loss = NULL);
+
+  /**
+   * @brief Run forward with early exits, stopping at the first
+   *        configured classifier branch that is confident enough.
+   *
+   * The branches come from NetParameter.early_exit_blob, shallowest
+   * first with the final classifier last. The pass runs the layer
+   * segments up to each branch in turn; after each, the confidence is
+   * that blob's top class probability, minimized over the batch, so
+   * every example clears early_exit_threshold before the deeper layers
+   * are skipped (serve with batch 1 for per-example exits). Returns
+   * the probability blob of the exit taken; *exit_index gets its
+   * position in early_exit_blob and *confidence the measured value.
+   * The final branch is returned regardless of its confidence, and
+   * layers past it (e.g. loss layers) never run. Inputs must already
+   * be fed, as for ForwardPrefilled.
+   */
+  const Blob<Dtype>* ForwardEarlyExit(int* exit_index = NULL,
+      Dtype* confidence = NULL);
+
+  /**
+   * @brief Run dummy passes so the first real iterations hit steady
+   *        state: lazy blob allocations, handle creation, and engine
+   *        autotuning all complete here instead of on live traffic.
+   *
+   * Runs @p iterations forward passes at the current shapes -- resize
+   * with ReshapeInput first to warm other resolutions -- plus backward
+   * when any layer needs it, then clears the scribbled param diffs and
+   * (in GPU mode) drains the device before returning. Inputs fed via
+   * input fields read as zeros, which every layer handles; note that a
+   * net whose input comes from a data layer consumes that many batches
+   * from its source.
+   */
+  void WarmUp(const int iterations = 1);
+
+#ifndef CPU_ONLY
+  /**
+   * @brief Enqueue the whole forward pass behind any work already queued on
+   *        the caller's stream and return without waiting for the GPU.
+   *
+   * The layers launch on the legacy default stream; events order that stream
+   * after the head of @p stream and publish the pass's completion back to
+   * it, so the caller sees stream-ordered semantics. Read the output blobs
+   * only after Synchronize() (or after waiting on the stream). Output blobs
+   * carrying loss weights still synchronize at the loss reduction in
+   * Layer::Forward, so serving nets should not mark losses.
+   */
+  void ForwardAsync(cudaStream_t stream = 0);
+  /// @brief Block until the pass queued by ForwardAsync has drained.
+  void Synchronize();
+  /// @brief Return true once the pass queued by ForwardAsync has drained.
+  bool ForwardComplete();
+
+  /**
+   * @brief Start copying the output blobs into pinned staging buffers
+   *        with cudaMemcpyAsync and return a ticket for the copies.
+   *
+   * Reading results through output_blobs()[i]->cpu_data() takes a
+   * synchronous pageable copy that blocks the serving thread until the
+   * device drains. This instead queues the copies on the legacy
+   * default stream behind the forward pass that produced the outputs
+   * and returns at once, so the caller can feed and launch the next
+   * request while they land; post-processing then overlaps the next
+   * forward. The staging ring holds two requests: each call waits out
+   * the copies of the slot it reuses, and a ticket's buffers stay
+   * valid until two later tickets have been issued.
+   */
+  int BeginOutputReadback();
+  /**
+   * @brief Block until the ticket's copies have landed and return one
+   *        pinned host buffer per output blob, in output_blobs()
+   *        order, shaped as the outputs were when the ticket was
+   *        issued.
+   */
+  const vector<const Dtype*>& WaitOutputReadback(const int ticket);
+#endif
+
   /**
    * The network backward should take no input and output, since it solely
    * computes the gradient w.r.t the parameters, and the data has already been
@@ -67,6 +188,25 @@ class Net {
   void BackwardFrom(int start);
   void BackwardTo(int end);
 
+  /**
+   * @brief Stream finished parameter gradients to @p reducer during
+   *        every backward pass, in size-bucketed chunks.
+   *
+   * A parameter's diff is handed over once the lowest-indexed layer
+   * touching it has run its backward step; shared parameters wait for
+   * all their sharers, whose diffs are folded into the owner's (and
+   * zeroed) at hand-off so the handed diff is complete and the later
+   * accumulation in Update cannot double-count it.
+   * Finished diffs are gathered until they total at
+   * least @p bucket_size elements, then passed to GradientReducer::
+   * Reduce, so one hand-off message amortizes over several small blobs
+   * while big blobs ship as soon as they are ready. The pass's last
+   * bucket is flushed before BackwardFromTo returns, whatever its size.
+   * Pass NULL to detach. The reducer is not owned.
+   */
+  void set_gradient_reducer(GradientReducer<Dtype>* reducer,
+      const size_t bucket_size);
+
   /**
    * @brief Reshape all layers from bottom to top.
    *
@@ -75,6 +215,46 @@ class Net {
    */
   void Reshape();
 
+  /**
+   * @brief Switch one of the net's input blobs to a new resolution.
+   *
+   * Reshapes input blob @p input_id and re-runs the layers' Reshape
+   * chain -- never their full SetUp -- so derived shapes and buffers
+   * follow. Returns immediately when the shape is unchanged. Blob
+   * capacity only ever grows, so once a shape has been visited (and the
+   * largest one has sized every buffer) switching between warmed shapes
+   * allocates nothing: it costs just the shape arithmetic walk.
+   */
+  void ReshapeInput(const int input_id, const int num, const int channels,
+      const int height, const int width);
+  /// @brief Distinct input-shape combinations ReshapeInput has warmed.
+  inline int warmed_shapes() const { return warmed_shapes_.size(); }
+
+  /**
+   * @brief Cache the frozen prefix's output activations across epochs.
+   *
+   * In finetune jobs whose early layers are all frozen (see
+   * first_backward_layer()), every epoch recomputes identical features
+   * for every example. With the cache enabled, a full forward pass
+   * stores @p boundary_blob -- which must be produced inside the frozen
+   * prefix -- to "<prefix>_<key>.blobproto" on its first visit, and
+   * later visits to the same key load it back and run only the layers
+   * above the boundary, turning a conv-bound pass into an fc-bound one.
+   * Source layers (those with no bottoms) still run on a hit, so labels
+   * stay in step with the cached features. The key advances with every
+   * full pass; reset it with set_activation_cache_key(0) at each epoch
+   * start. Requires a deterministic, unshuffled data order.
+   */
+  void EnableActivationCache(const string& prefix,
+      const string& boundary_blob);
+  /// @brief Key the next full forward pass reads and writes under.
+  inline void set_activation_cache_key(const int64_t key) {
+    activation_cache_key_ = key;
+  }
+  inline int64_t activation_cache_key() const {
+    return activation_cache_key_;
+  }
+
   Dtype ForwardBackward(const vector<Blob<Dtype>* > & bottom) {
     Dtype loss;
     Forward(bottom, &loss);
@@ -82,14 +262,84 @@ class Net {
     return loss;
   }
 
+  /**
+   * @brief Run @p micro_batches forward passes through the pipeline
+   *        stages (NetParameter.pipeline_device), one worker thread per
+   *        stage, and return the average loss per micro-batch.
+   *
+   * A stage hands a micro-batch downstream as soon as its layers have
+   * run, and is released for the next micro-batch once the downstream
+   * stage's transfer layers have copied the boundary blobs, so
+   * consecutive micro-batches execute on the stages' devices
+   * concurrently instead of the devices idling alternately. Source
+   * layers run once per micro-batch and so consume @p micro_batches
+   * consecutive batches from their dataset; the output blobs hold the
+   * last micro-batch's values on return.
+   */
+  Dtype ForwardPipelined(const int micro_batches = 1);
+  /**
+   * @brief Run one backward pass as a reverse wave over the pipeline
+   *        stages, each stage's layers on its own device.
+   *
+   * With a single batch in flight the stages alternate rather than
+   * overlap, but each stage's kernels run against device-local memory
+   * instead of dereferencing another device's over the bus. Gradients
+   * are left in the parameter diffs exactly as after Backward.
+   * Overlapping backward micro-batches would need the per-micro-batch
+   * activations that the forward pass overwrites, so it is not offered.
+   */
+  void BackwardPipelined();
+
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
+  /**
+   * @brief Zeroes out the diffs of all net parameters.
+   *        Should be run before Backward when the diffs are accumulated
+   *        over several forward/backward passes (iter_size > 1).
+   */
+  void ClearParamDiffs();
+  /// @brief Scales the diffs of all net parameters, e.g. to average the
+  ///        gradient accumulated over iter_size passes.
+  void ScaleParamDiffs(const Dtype scale);
 
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
    */
   void ShareTrainedLayersWith(Net* other);
+  /**
+   * @brief Point this net's activation blobs at another net's storage,
+   *        for nets that are guaranteed never to run concurrently.
+   *
+   * Matches activation blobs by name and shares the donor's data
+   * memory wherever it is large enough for this net's blob, so the two
+   * nets hand one set of activation buffers back and forth instead of
+   * each holding a full allocation. Blobs with no large-enough match
+   * (or no match at all) keep their own storage. The Solver uses this
+   * to run its test nets inside the training net's activation memory:
+   * a test forward scribbles over the training activations, which is
+   * safe because the next training iteration recomputes them from the
+   * data layer onward. Never use it for nets that run at the same
+   * time, e.g. the asynchronous-test path or serving replicas.
+   */
+  void ShareActivationsWith(Net* other);
+  /**
+   * @brief Build a replica of this net for concurrent serving: same
+   *        structure, parameters aliased read-only, private activations.
+   *
+   * The replica is constructed from the structure this net was built
+   * from (no weights re-fill survives; its parameter blobs are pointed
+   * at this net's storage), so N serving threads cost one copy of the
+   * parameters plus N sets of activations. Activation storage
+   * allocates lazily on first use -- enable the caching MemoryPool on
+   * the serving thread to make that cheap. Creating a replica marks
+   * the shared parameter memory read-only for every net involved,
+   * including this one, so a stray weight write fails fast instead of
+   * corrupting all replicas; do not replicate a net you still intend
+   * to train. Each replica must be driven by a single thread at a
+   * time, like any Net.
+   */
+  shared_ptr<Net<Dtype> > CreateReplica();
   // For an already initialized net, CopyTrainedLayersFrom() copies the already
   // trained layers from another net parameter instance.
   /**
@@ -98,8 +348,32 @@ class Net {
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
   void CopyTrainedLayersFrom(const string trained_filename);
-  /// @brief Writes the net to a proto.
-  void ToProto(NetParameter* param, bool write_diff = false);
+  /**
+   * @brief Point this net's parameter blobs directly at the payloads of a
+   *        memory-mapped model container (see util/mmap_model.hpp).
+   *
+   * Nothing is copied: the blobs alias the mapped pages, which the kernel
+   * faults in lazily and shares read-only across processes. Intended for
+   * forward-only nets; training would fault private copies of the pages.
+   */
+  void MapTrainedLayersFrom(const string& mmap_filename);
+  /// @brief Writes the net to a proto; write_half stores the parameter
+  /// data payloads in half precision (see Blob::ToProto).
+  void ToProto(NetParameter* param, bool write_diff = false,
+      bool write_half = false);
+  /**
+   * @brief Serialize the net straight to @p filename in NetParameter
+   *        wire format, streaming it layer by layer.
+   *
+   * Produces a file ReadProtoFromBinaryFile parses like a ToProto dump,
+   * but without materializing a second full copy of the weights in host
+   * RAM first: each layer's metadata is staged alone and the blob
+   * payloads are written directly from their host pointers, bounding
+   * the serialization overhead to one blob (one half-precision payload
+   * with write_half).
+   */
+  void ToBinaryFile(const string& filename, bool write_diff = false,
+      bool write_half = false);
 
   /// @brief returns the network name.
   inline const string& name() { return name_; }
@@ -132,7 +406,58 @@ class Net {
   /// @brief returns the parameter learning rate multipliers
   inline vector<float>& params_lr() { return params_lr_; }
   inline vector<float>& params_weight_decay() { return params_weight_decay_; }
-  const map<string, int>& param_names_index() { return param_names_index_; }
+  // The params the update loops must visit: every param with a non-zero
+  // learning rate, plus frozen owners that receive a learnable sharer's
+  // gradient. When most of a finetuned net is frozen (blobs_lr: 0), the
+  // solver and Update skip the frozen blobs entirely.
+  inline const vector<int>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
+  // The rows of parameter blob param_id the last Backward touched, as
+  // reported by the owning layer (see Layer::sparse_param_rows), or
+  // NULL when the gradient is dense. Shared parameters report dense:
+  // other sharers contribute gradient the owner's layer knows nothing
+  // about.
+  const vector<int>* sparse_param_rows(int param_id) const;
+  // Sums the prefetch pipeline accounting of the net's data layers (see
+  // Layer::PrefetchTiming): time the forwards spent blocked waiting for
+  // a batch, time the prefetch threads spent producing, and the wall
+  // time spanned by the forwards -- wait / period is the net's "idle
+  // waiting for data" fraction. Cumulative, or the interval since the
+  // previous windowed call when window is set (reading the window drains
+  // it). Returns false when no layer prefetches.
+  bool PrefetchTiming(bool window, double* wait_ms, double* busy_ms,
+      double* period_ms);
+  // The contiguous learnable-parameter arenas built by Init when no
+  // parameters are shared: every parameter's data and diff is a view into
+  // one allocation each, covering params_total_count() values, so solvers
+  // can run the update as a few large operations. Null when the
+  // parameters could not be made contiguous.
+  inline const shared_ptr<SyncedMemory>& params_data_arena() const {
+    return params_data_arena_;
+  }
+  inline const shared_ptr<SyncedMemory>& params_diff_arena() const {
+    return params_diff_arena_;
+  }
+  inline int params_total_count() const { return params_total_count_; }
+  const boost::unordered_map<string, int>& param_names_index() {
+    return param_names_index_;
+  }
+  /// @brief Deepest layer that needs backward computation; Backward
+  ///        stops there instead of walking the frozen prefix below.
+  inline int first_backward_layer() const { return first_backward_layer_; }
+  /**
+   * @brief A multi-line breakdown of where this net's memory goes.
+   *
+   * Lists activations (data + diff of each layer's top blobs, counted at
+   * the producing layer) and parameters per layer, net totals, and the
+   * process-wide SyncedMemory accounting (current and peak host/device
+   * bytes; the difference to the net totals is what lives outside the
+   * named blobs -- col buffers, other nets, prefetch batches). Shared
+   * parameters are counted once, at their owning layer. Logged after
+   * Init for nets small enough to print.
+   */
+  string memory_report() const;
   /// @brief Input and output blob numbers
   inline int num_inputs() { return net_input_blobs_.size(); }
   inline int num_outputs() { return net_output_blobs_.size(); }
@@ -146,6 +471,57 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  // Stride for the debug-info statistics: with a value k > 1 the data
+  // and diff reductions read every k-th element only, making debug_info
+  // cheap enough to leave on for gradient-health monitoring.
+  void set_debug_info_sample_stride(const int stride) {
+    CHECK_GE(stride, 1);
+    debug_info_sample_stride_ = stride;
+  }
+
+  /**
+   * @brief Enable or disable per-layer timing of Forward and Backward.
+   *
+   * While enabled, ForwardFromTo and BackwardFromTo accumulate wall-clock
+   * milliseconds per layer; query them with layer_forward_times() /
+   * layer_backward_times() or log a summary with PrintTimingInfo().
+   */
+  void set_timing(const bool value) { timing_ = value; }
+  bool timing() const { return timing_; }
+  /// @brief Zero the accumulated per-layer timings.
+  void ResetTiming();
+  /// @brief Log the accumulated per-layer average timings.
+  void PrintTimingInfo();
+  /// @brief Accumulated forward milliseconds per layer, indexed by layer id.
+  const vector<double>& layer_forward_times() const {
+    return forward_time_per_layer_;
+  }
+  /// @brief Accumulated backward milliseconds per layer, indexed by layer id.
+  const vector<double>& layer_backward_times() const {
+    return backward_time_per_layer_;
+  }
+  /**
+   * @brief Additionally sample hardware performance counters around each
+   * timed layer (see PerfCounters in util/benchmark.hpp).
+   *
+   * Cycle, instruction, LLC miss and stalled-cycle deltas tell apart a
+   * layer that started executing more instructions from one whose cache
+   * behavior changed, which wall time alone cannot. Only takes effect
+   * together with set_timing(true); silently stays off where perf_event
+   * is unavailable. The counters measure the thread running the net, so
+   * the numbers are meaningful for CPU-mode analysis.
+   */
+  void set_timing_counters(const bool value);
+  bool timing_counters() const { return perf_counters_.get() != NULL; }
+  /// @brief Accumulated forward counter values, indexed by
+  /// layer_id * PerfCounters::NUM_COUNTERS + counter.
+  const vector<uint64_t>& layer_forward_counters() const {
+    return forward_counters_per_layer_;
+  }
+  /// @brief As layer_forward_counters, for Backward.
+  const vector<uint64_t>& layer_backward_counters() const {
+    return backward_counters_per_layer_;
+  }
 
   // Helpers for Init.
   /**
@@ -162,35 +538,135 @@ class Net {
   // Helpers for Init.
   /// @brief Append a new input or top blob to the net.
   void AppendTop(const NetParameter& param, const int layer_id,
-                 const int top_id, set<string>* available_blobs,
-                 map<string, int>* blob_name_to_idx);
+                 const int top_id,
+                 boost::unordered_set<string>* available_blobs,
+                 boost::unordered_map<string, int>* blob_name_to_idx);
   /// @brief Append a new bottom blob to the net.
   int AppendBottom(const NetParameter& param, const int layer_id,
-                   const int bottom_id, set<string>* available_blobs,
-                   map<string, int>* blob_name_to_idx);
+                   const int bottom_id,
+                   boost::unordered_set<string>* available_blobs,
+                   boost::unordered_map<string, int>* blob_name_to_idx);
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Format a blob's mean absolute data or diff value for the
+  ///        debug-info logs, sampling at debug_info_sample_stride_; in
+  ///        sampled mode the largest sampled magnitude is appended.
+  string DebugStats(const Blob<Dtype>& blob, const bool use_diff) const;
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
   void BackwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Update.
   void UpdateDebugInfo(const int param_id);
+  /// @brief Add perf_counters_'s latched values into one layer's slot of
+  ///        a per-layer counter accumulator.
+  void AccumulateCounters(const int layer_id, vector<uint64_t>* accumulator);
+  /// @brief Add a shared parameter's diff into its owner's and zero it;
+  ///        used by the reducer hand-off in BackwardFromTo.
+  void FoldSharedDiff(const int param_id);
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
 
+  /**
+   * @brief Rebase all parameter blobs into one contiguous data arena and
+   *        one contiguous diff arena, so the solver update runs as a few
+   *        large operations instead of a few per blob.
+   *
+   * Skipped (leaving the arenas null) when parameters are shared, since
+   * shared diffs accumulate into their owner between scaling and update.
+   */
+  void MakeParamsContiguous();
+
+  /**
+   * @brief Assign intermediate blobs with disjoint lifetimes to shared
+   *        memory arenas (NetParameter.optimize_memory).
+   *
+   * Lifetimes follow from bottom/top producer-consumer edges: a blob is live
+   * from the layer that produces it to the last layer that reads it. Net
+   * inputs and outputs always keep their own storage. The planned net must
+   * only be used through Forward.
+   */
+  void PlanMemory();
+
+  /**
+   * @brief Build the layer dependency graph for DAG-parallel Forward
+   *        (NetParameter.dag_forward).
+   *
+   * A layer depends on the last earlier layer that wrote each of its bottom
+   * blobs; in-place layers also depend on every earlier reader of the blob
+   * they overwrite.
+   */
+  void BuildForwardDag();
+  /// @brief Run a full forward pass with independent layers in parallel.
+  Dtype ForwardDag();
+
+  /**
+   * @brief Record the layer range and leading transfer-layer count of
+   *        each pipeline stage (NetParameter.pipeline_device).
+   *
+   * Checks that the stages are contiguous and that pipeline_device
+   * lists a device for each of them.
+   */
+  void BuildPipelinePlan();
+
+  /**
+   * @brief Group layers into checkpoint segments and mark the activations
+   *        to free after Forward (NetParameter.checkpoint_interval).
+   *
+   * A blob may be freed when everything that produces or reads it in
+   * Forward lies inside one recomputable segment; Backward re-runs that
+   * segment's forward to regenerate it. Layers with stateful forwards
+   * (data layers, dropout) get single-layer segments that are never
+   * recomputed, so the rerun cannot advance a dataset or redraw a mask.
+   */
+  void BuildCheckpointPlan();
+
+  /// @brief "NxCxHxW;..." signature of the current input blob shapes.
+  string InputShapeKey() const;
+
+  /// @brief One full pass through the activation cache: load the
+  ///        boundary blob on a hit, store it after a miss.
+  Dtype ForwardWithActivationCache();
+  /// @brief Cache file holding the boundary blob for one key.
+  string ActivationCacheFile(const int64_t key) const;
+
+#ifndef CPU_ONLY
+  /**
+   * @brief Plan the activation offload schedule
+   *        (NetParameter.offload_activations).
+   *
+   * A blob is offloaded after the last layer that reads it in Forward and
+   * prefetched back just before that layer's Backward, so early-layer
+   * activations spend the interval in host memory instead of on the GPU.
+   * Net inputs/outputs and blobs below a size threshold stay resident.
+   */
+  void BuildOffloadPlan();
+  /// @brief Start D2H copies for blobs whose last forward read was layer_id.
+  void StartActivationOffloads(const int layer_id);
+  /// @brief Release device buffers whose offload copies have completed;
+  ///        with drain, wait for the stragglers as well.
+  void PollActivationOffloads(const bool drain);
+  /// @brief Start H2D copies for the offloaded bottoms of layer_id and
+  ///        order the default stream after them.
+  void PrefetchActivations(const int layer_id);
+#endif
+
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
   vector<string> layer_names_;
-  map<string, int> layer_names_index_;
+  boost::unordered_map<string, int> layer_names_index_;
   vector<bool> layer_need_backward_;
+  /// Index of the deepest layer that needs backward computation;
+  /// BackwardFromTo stops there instead of walking the frozen prefix
+  /// below (layers_.size() when nothing needs backward).
+  int first_backward_layer_;
   /// @brief the blobs storing intermediate results between the layer.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   vector<string> blob_names_;
-  map<string, int> blob_names_index_;
+  boost::unordered_map<string, int> blob_names_index_;
   vector<bool> blob_need_backward_;
   /// bottom_vecs stores the vectors containing the input for each layer.
   /// They don't actually host the blobs (blobs_ does), so we simply store
@@ -207,12 +683,32 @@ class Net {
   vector<int> param_owners_;
   vector<string> param_display_names_;
   vector<pair<int, int> > param_layer_indices_;
-  map<string, int> param_names_index_;
+  /// Bucketed gradient hand-off during Backward (see
+  /// set_gradient_reducer); reduce_params_per_layer_[i] lists the net
+  /// param ids whose diffs become final when layer i completes, and
+  /// reduce_param_sharers_[p] the shared copies folded into owner p at
+  /// hand-off time.
+  GradientReducer<Dtype>* gradient_reducer_;
+  size_t reducer_bucket_size_;
+  vector<vector<int> > reduce_params_per_layer_;
+  vector<vector<int> > reduce_param_sharers_;
+  boost::unordered_map<string, int> param_names_index_;
   /// blob indices for the input and the output of the net
   vector<int> net_input_blob_indices_;
   vector<int> net_output_blob_indices_;
   vector<Blob<Dtype>*> net_input_blobs_;
   vector<Blob<Dtype>*> net_output_blobs_;
+  /// Input-shape combinations already visited by ReshapeInput; their
+  /// buffer capacities are warm (see ReshapeInput).
+  set<string> warmed_shapes_;
+  /// Frozen-prefix activation cache (see EnableActivationCache): the
+  /// layer producing the boundary blob (-1 disables the cache), the
+  /// boundary blob id, the cache file prefix, and the key the next full
+  /// pass reads and writes under.
+  int activation_cache_boundary_;
+  int activation_cache_blob_;
+  string activation_cache_prefix_;
+  int64_t activation_cache_key_;
   string name_;
   /// The parameters in the network.
   vector<shared_ptr<Blob<Dtype> > > params_;
@@ -220,10 +716,104 @@ class Net {
   vector<float> params_lr_;
   /// the weight decay multipliers
   vector<float> params_weight_decay_;
+  /// param ids with a non-zero effective learning rate; see
+  /// learnable_param_ids().
+  vector<int> learnable_param_ids_;
+  /// One allocation backing all parameter data, and one for the diffs;
+  /// see MakeParamsContiguous.
+  shared_ptr<SyncedMemory> params_data_arena_;
+  shared_ptr<SyncedMemory> params_diff_arena_;
+  int params_total_count_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// The transformed structure Init built from, with weights stripped;
+  /// CreateReplica constructs replicas from it.
+  NetParameter replica_param_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Element stride the debug-info reductions sample at (1: every one).
+  int debug_info_sample_stride_;
+  /// Whether to collect per-layer timing, and the accumulated timings.
+  bool timing_;
+  vector<double> forward_time_per_layer_;
+  vector<double> backward_time_per_layer_;
+  /// Per-layer visit counters used to turn the sums above into averages.
+  int forward_timing_passes_;
+  int backward_timing_passes_;
+  /// Hardware counter sampler (set only while counter sampling is on)
+  /// and the accumulated per-layer counter deltas; see
+  /// layer_forward_counters() for the layout.
+  shared_ptr<PerfCounters> perf_counters_;
+  vector<uint64_t> forward_counters_per_layer_;
+  vector<uint64_t> backward_counters_per_layer_;
+  /// Whether to schedule Forward over the layer DAG, and with how many
+  /// workers (0 picks one per hardware thread).
+  bool dag_forward_;
+  int dag_forward_threads_;
+  /// Number of earlier layers each layer waits for, and the reverse edges.
+  vector<int> layer_num_dependencies_;
+  vector<vector<int> > layer_dependents_;
+  /// Device of each pipeline stage (empty: no pipeline), the [first,
+  /// last] layer range of each stage, and how many of the range's
+  /// leading layers are its PipelineTransferLayers.
+  vector<int> pipeline_device_;
+  vector<int> pipeline_stage_first_;
+  vector<int> pipeline_stage_last_;
+  vector<int> pipeline_stage_transfers_;
+  /// Keeps a memory-mapped model alive while parameter blobs alias it.
+  shared_ptr<MMapModel<Dtype> > mmap_model_;
+#ifndef CPU_ONLY
+  /// Events bracketing the pass queued by ForwardAsync, created on first
+  /// use; forward_done_ backs Synchronize() and ForwardComplete().
+  cudaEvent_t forward_start_;
+  cudaEvent_t forward_done_;
+  bool async_events_created_;
+#endif
+  /// Whether to keep activations in half precision between layers during
+  /// CPU Forward, and which blobs may be compressed (net inputs and
+  /// outputs are exempt so callers always see full precision data).
+  bool half_activations_;
+  vector<bool> blob_half_eligible_;
+  /// Whether to offload large activations to host memory between their
+  /// last forward read and their backward use (GPU training only).
+  bool offload_activations_;
+  /// Segment length for recompute-in-backward (0 or 1 disables), the
+  /// first layer of each layer's segment, whether each layer's segment is
+  /// re-run during Backward, and the blob ids to free after each layer's
+  /// forward. recomputing_ suppresses the freeing while a segment's
+  /// forward is being re-run.
+  int checkpoint_interval_;
+  vector<int> checkpoint_segment_start_;
+  vector<bool> checkpoint_recompute_;
+  vector<vector<int> > drop_after_layer_;
+  bool recomputing_;
+  /// Early-exit inference (see ForwardEarlyExit): the producing layer
+  /// and blob id of each configured classifier branch, in depth order,
+  /// and the confidence an exit must clear.
+  vector<int> early_exit_layers_;
+  vector<int> early_exit_blobs_;
+  Dtype early_exit_threshold_;
+#ifndef CPU_ONLY
+  /// Blob ids to offload after each layer's forward, the offloaded
+  /// candidates among each layer's bottoms, copies awaiting completion,
+  /// and the side stream and per-blob events that carry them. The stream
+  /// and events are created on first use.
+  vector<vector<int> > offload_after_layer_;
+  vector<vector<int> > offload_bottom_ids_;
+  vector<int> pending_offloads_;
+  cudaStream_t offload_stream_;
+  vector<cudaEvent_t> offload_events_;
+  bool offload_resources_created_;
+  /// The pinned output-readback ring (BeginOutputReadback), created on
+  /// first use: per-slot pinned staging buffers with their capacities
+  /// and the host-side views handed to callers, one per output blob,
+  /// plus a completion event per slot.
+  vector<vector<Dtype*> > readback_buffers_;
+  vector<vector<size_t> > readback_capacity_;
+  vector<vector<const Dtype*> > readback_views_;
+  vector<cudaEvent_t> readback_events_;
+  int readback_next_ticket_;
+#endif
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
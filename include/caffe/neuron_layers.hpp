@@ -212,6 +212,61 @@ class DropoutLayer : public NeuronLayer<Dtype> {
   unsigned int uint_thres_;
 };
 
+/**
+ * @brief Computes a chain of elementwise neuron functions -- e.g.
+ *        @f$ y = \tanh((\alpha x + \beta) ^ \gamma) @f$ -- in a single pass
+ *        over the input.
+ *
+ * Built by the Net::Init fusion pass (see NetParameter::fuse_neuron_layers)
+ * from runs of consecutive NeuronLayers, so a chain reads and writes each
+ * activation once instead of once per layer. The fused functions are kept as
+ * a small opcode program interpreted per element; Dropout contributes no
+ * opcode since it is the identity at test time.
+ */
+template <typename Dtype>
+class NeuronChainLayer : public NeuronLayer<Dtype> {
+ public:
+  explicit NeuronChainLayer(const LayerParameter& param)
+      : NeuronLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_NEURON_CHAIN;
+  }
+
+  /// @brief The elementwise functions the interpreter understands.
+  enum OpType {
+    OP_RELU = 0,
+    OP_SIGMOID = 1,
+    OP_TANH = 2,
+    OP_POWER = 3,
+    OP_BNLL = 4,
+    OP_ABSVAL = 5,
+    OP_THRESHOLD = 6
+  };
+  /// @brief Dtypes per opcode record: [type, arg0, arg1, arg2].
+  static const int kOpFields = 4;
+
+ protected:
+  /// @copydoc NeuronChainLayer
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  /// @brief Not implemented -- fused chains are for test-phase nets only.
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+    NOT_IMPLEMENTED;
+  }
+
+  /// the number of opcode records in ops_
+  int num_ops_;
+  /// the opcode program, kept in a SyncedMemory so that the GPU interpreter
+  /// can read it without a copy per Forward
+  shared_ptr<SyncedMemory> ops_;
+};
+
 /**
  * @brief Computes @f$ y = (\alpha x + \beta) ^ \gamma @f$,
  *        as specified by the scale @f$ \alpha @f$, shift @f$ \beta @f$,
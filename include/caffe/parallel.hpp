@@ -0,0 +1,340 @@
+#ifndef CAFFE_PARALLEL_HPP_
+#define CAFFE_PARALLEL_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// The gradient codec for compressed pushes
+// (util/gradient_compression.hpp); only held by pointer here.
+template <typename Dtype> class GradientCompressor;
+
+template <typename Dtype> class DataParallel;
+
+/**
+ * @brief One replica thread of a DataParallel group; owns the Net replica
+ *        living on its GPU and mirrors the root's iteration steps.
+ */
+template <typename Dtype>
+class DataParallelWorker : public InternalThread {
+ public:
+  DataParallelWorker(DataParallel<Dtype>* parent, int index)
+      : parent_(parent), index_(index) {}
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  DataParallel<Dtype>* parent_;
+  int index_;
+};
+
+/**
+ * @brief Synchronous data-parallel training across the GPUs of one machine.
+ *
+ * The root thread keeps its Net as replica 0; one worker thread per further
+ * GPU builds a replica from the root's NetParameter. Every iteration all
+ * replicas run ForwardBackward on their own batches, the root averages the
+ * gradients over replicas (through host staging buffers), the solver applies
+ * its usual update to the root net, and BroadcastParams pushes the new
+ * weights back out. Until sharded reading lands, give each replica's data
+ * layer a distinct source or a rand_skip so they do not see identical
+ * batches.
+ */
+template <typename Dtype>
+class DataParallel {
+ public:
+  /**
+   * @param root_net the net owned by the calling (root) thread.
+   * @param gpus all participating device ids; gpus[0] must be the device
+   *        the root thread is already running on.
+   */
+  DataParallel(shared_ptr<Net<Dtype> > root_net, const vector<int>& gpus);
+  ~DataParallel();
+
+  /**
+   * @brief Run one synchronized ForwardBackward across all replicas.
+   *
+   * On return the root net's parameter diffs hold the replica-averaged
+   * gradient; returns the replica-averaged loss.
+   */
+  Dtype ForwardBackward(const vector<Blob<Dtype>*>& bottom);
+
+  /// @brief Push the root net's weights to every replica; call after the
+  ///        solver has applied its update.
+  void BroadcastParams();
+
+ private:
+  friend class DataParallelWorker<Dtype>;
+  void WorkerEntry(int index);
+
+  // Holds the boost barriers; kept behind a forward declaration so this
+  // header stays free of boost::thread includes (see internal_thread.hpp).
+  class sync;
+
+  shared_ptr<Net<Dtype> > root_net_;
+  vector<int> gpus_;
+  NetParameter net_param_;
+  vector<shared_ptr<DataParallelWorker<Dtype> > > workers_;
+  // Replica nets, registered by each worker thread at startup; index 0 is
+  // unused (the root net is replica 0).
+  vector<Net<Dtype>*> replica_nets_;
+  vector<Dtype> losses_;
+  bool must_stop_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(DataParallel);
+};
+
+template <typename Dtype> class AsyncParallel;
+
+/**
+ * @brief One Hogwild worker thread of an AsyncParallel group; runs a
+ *        full solver replica sharing the root net's weight memory.
+ */
+template <typename Dtype>
+class AsyncParallelWorker : public InternalThread {
+ public:
+  AsyncParallelWorker(AsyncParallel<Dtype>* parent, int index)
+      : parent_(parent), index_(index) {}
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  AsyncParallel<Dtype>* parent_;
+  int index_;
+};
+
+/**
+ * @brief Lock-free asynchronous (Hogwild) CPU training on one host.
+ *
+ * Every worker thread runs a full solver of its own whose net weights
+ * alias the root net's host memory, so all solvers apply their updates
+ * to the shared model at their own pace, with no barriers or locks.
+ * Concurrent updates occasionally overlap, which stochastic gradient
+ * descent absorbs; in exchange aggregate throughput scales with cores.
+ * Meant for sweeps where images/s matters more than per-step
+ * determinism; across machines, combine with the parameter server's
+ * asynchronous mode instead. Each worker runs max_iter iterations of
+ * its own, so the shared model receives async_threads * max_iter
+ * updates in total. As with DataParallel, give each replica's data
+ * layer a distinct source or a rand_skip so the workers do not chew
+ * through identical batches.
+ */
+template <typename Dtype>
+class AsyncParallel {
+ public:
+  /**
+   * @param root_net the root solver's net; its weights become the
+   *        shared model.
+   * @param param the root solver's settings; workers run a copy with
+   *        display, testing and snapshotting disabled.
+   */
+  AsyncParallel(shared_ptr<Net<Dtype> > root_net,
+      const SolverParameter& param);
+  ~AsyncParallel() { Join(); }
+
+  /// @brief Block until every worker solver has finished its run.
+  void Join();
+
+ private:
+  friend class AsyncParallelWorker<Dtype>;
+  void WorkerEntry(int index);
+
+  shared_ptr<Net<Dtype> > root_net_;
+  SolverParameter param_;
+  vector<shared_ptr<AsyncParallelWorker<Dtype> > > workers_;
+
+  DISABLE_COPY_AND_ASSIGN(AsyncParallel);
+};
+
+/**
+ * @brief Byte-stream transport between a parameter server and one worker.
+ *
+ * Kept abstract so the wire can be swapped out (tests can run over a
+ * socketpair, faster fabrics can slot in later) without touching the
+ * protocol logic. Transports must expose a descriptor the server can
+ * poll for readability.
+ */
+class ParamTransport {
+ public:
+  virtual ~ParamTransport() {}
+  /// @brief Write exactly size bytes; LOG(FATAL)s on failure.
+  virtual void Send(const void* data, size_t size) = 0;
+  /// @brief Read exactly size bytes; returns false if the peer closed
+  ///        the stream before the first byte.
+  virtual bool Recv(void* data, size_t size) = 0;
+  /// @brief Descriptor to select() on for incoming data.
+  virtual int poll_fd() const = 0;
+  /// @brief Whether Send/Recv accept device pointers without a host
+  ///        copy (e.g. the RDMA backend with GPUDirect); the protocol
+  ///        layer then hands over gpu_data instead of cpu_data.
+  virtual bool supports_device_memory() const { return false; }
+};
+
+/// @brief ParamTransport over a connected stream socket; owns the fd.
+class SocketTransport : public ParamTransport {
+ public:
+  explicit SocketTransport(int fd);
+  virtual ~SocketTransport();
+  virtual void Send(const void* data, size_t size);
+  virtual bool Recv(void* data, size_t size);
+  virtual int poll_fd() const { return fd_; }
+
+ private:
+  int fd_;
+
+  DISABLE_COPY_AND_ASSIGN(SocketTransport);
+};
+
+/// @brief Split the host out of a "host:port" parameter-server address.
+string ParamServerHost(const string& address);
+/// @brief Split the port out of a "host:port" parameter-server address.
+int ParamServerPort(const string& address);
+/// @brief Whether the address selects the RDMA transport
+///        ("rdma://host:port"); requires a USE_RDMA build.
+bool ParamServerUsesRdma(const string& address);
+
+// The server-side verbs listener (util/rdma_transport.hpp), only ever
+// instantiated in USE_RDMA builds.
+class RdmaListener;
+
+/**
+ * @brief Master copy of a net's parameters, served to worker solvers.
+ *
+ * Workers connect, pull the starting weights, and then once per
+ * iteration push their update values (the diffs their solver would have
+ * applied locally) and receive the refreshed master weights in the same
+ * round trip. With sync_workers > 0 the server gathers that many pushes
+ * per round, applies their average and answers the pushers together
+ * (synchronous SGD); otherwise every push is applied on arrival, except
+ * that pushes computed against weights more than max_staleness rounds
+ * old are dropped -- their sender still gets fresh weights back.
+ *
+ * The serving loop is single threaded and all master-side math runs on
+ * the CPU; workers and server must agree on Dtype and endianness.
+ *
+ * With gradient_compression set, pushes arrive as compact codec
+ * payloads (top-k index/value pairs or 1-bit signs with scales; see
+ * util/gradient_compression.hpp) and are expanded to a dense diff
+ * before the usual apply path, cutting the worker-to-server volume
+ * 20-100x. Replies carry the full weights either way.
+ */
+template <typename Dtype>
+class ParamServer {
+ public:
+  /**
+   * @param params the master parameter blobs, updated in place.
+   * @param param solver settings; sync_workers and max_staleness apply.
+   * @param port TCP port to listen on; 0 lets the kernel pick one.
+   */
+  ParamServer(const vector<shared_ptr<Blob<Dtype> > >& params,
+      const SolverParameter& param, const int port);
+  ~ParamServer();
+
+  /// @brief Port actually bound; differs from the requested one only
+  ///        when the request was port 0.
+  int port() const { return port_; }
+  /// @brief Number of applied update rounds so far.
+  int64_t round() const { return round_; }
+
+  /// @brief Serve until every worker that connected has disconnected.
+  void Run();
+
+ private:
+  /// One connected worker: its transport and, in synchronous mode,
+  /// whether it has pushed this round and awaits the joint reply.
+  struct Connection {
+    shared_ptr<ParamTransport> transport;
+    bool waiting;
+  };
+
+  /// @brief Process one message from connections_[index]; returns false
+  ///        when the connection should be dropped.
+  bool HandleMessage(const int index);
+  /// @brief Receive a push payload -- raw or compressed, per the header
+  ///        type -- into recv_buffer_ as a dense diff.
+  void RecvPush(const Connection& conn, const uint64_t bytes,
+      const bool compressed);
+  void SendParams(const Connection& conn);
+  /// @brief weights -= scale * diff across all parameter blobs.
+  void ApplyDiff(const Dtype* diff, const Dtype scale);
+
+  vector<shared_ptr<Blob<Dtype> > > params_;
+  SolverParameter param_;
+  size_t count_;  // total parameter element count
+  // Verbs listener on the same port, so rdma:// workers can connect
+  // alongside TCP ones; empty unless built with USE_RDMA.
+  shared_ptr<RdmaListener> rdma_listener_;
+  int listen_fd_;
+  int port_;
+  int64_t round_;
+  int64_t dropped_;
+  int pending_;  // pushes gathered towards a synchronous round
+  vector<Connection> connections_;
+  vector<Dtype> recv_buffer_;
+  vector<Dtype> sum_;  // synchronous-mode diff accumulator
+  // Decoder for compressed pushes and its receive staging buffer;
+  // empty with gradient_compression COMPRESS_NONE. Decompression is
+  // stateless, so one decoder serves every connection.
+  shared_ptr<GradientCompressor<Dtype> > compressor_;
+  vector<uint8_t> payload_;
+
+  DISABLE_COPY_AND_ASSIGN(ParamServer);
+};
+
+/**
+ * @brief Worker-side connection to a ParamServer; attaches the solver's
+ *        parameter blobs to the master copy.
+ */
+template <typename Dtype>
+class ParamServerClient {
+ public:
+  /// @brief Connect to the server at a "host:port" address; the solver
+  ///        settings select the push codec (gradient_compression).
+  ParamServerClient(const string& address,
+      const vector<shared_ptr<Blob<Dtype> > >& params,
+      const SolverParameter& solver_param = SolverParameter());
+  /// @brief Attach over an already established transport (tests).
+  ParamServerClient(shared_ptr<ParamTransport> transport,
+      const vector<shared_ptr<Blob<Dtype> > >& params,
+      const SolverParameter& solver_param = SolverParameter());
+  ~ParamServerClient();
+
+  /// @brief Replace the local weights with the master copy.
+  void PullParams();
+  /// @brief Push the local update values and receive the refreshed
+  ///        master weights into the local data.
+  void PushPull();
+  /// @brief Server round the local weights were taken from.
+  int64_t round() const { return round_; }
+
+ private:
+  void ReceiveParams();
+
+  shared_ptr<ParamTransport> transport_;
+  vector<shared_ptr<Blob<Dtype> > > params_;
+  size_t count_;  // total parameter element count
+  int64_t round_;
+  // Push codec and its staging buffers: the blob diffs are gathered
+  // dense into send_buffer_, encoded into payload_, and the payload
+  // goes on the wire instead. Empty with COMPRESS_NONE. The codec
+  // carries this worker's error-feedback residual across pushes.
+  shared_ptr<GradientCompressor<Dtype> > compressor_;
+  vector<Dtype> send_buffer_;
+  vector<uint8_t> payload_;
+
+  DISABLE_COPY_AND_ASSIGN(ParamServerClient);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_PARALLEL_HPP_
@@ -5,9 +5,51 @@
 #include <vector>
 
 #include "caffe/net.hpp"
+#include "caffe/parallel.hpp"
+
+namespace boost { class thread; }
 
 namespace caffe {
 
+/**
+ * @brief Rolling training-throughput statistics collected by Solve when
+ *        SolverParameter::telemetry_interval is set.
+ *
+ * Times are milliseconds per iteration (summed over iter_size passes).
+ * The per-phase fields are exponential moving averages; the percentile
+ * fields describe the full-iteration times of the last completed
+ * telemetry window.
+ */
+struct SolverTelemetry {
+  SolverTelemetry()
+      : iterations(0), images_per_second(0), data_ms(0), forward_ms(0),
+        backward_ms(0), update_ms(0), iteration_ms(0), iteration_ms_p50(0),
+        iteration_ms_p90(0), iteration_ms_max(0), data_wait_fraction(0),
+        prefetch_load_fraction(0) {}
+  // Iterations measured so far.
+  int iterations;
+  // Throughput over the last completed window.
+  double images_per_second;
+  // Moving averages: time blocked in the data layer (prefetch wait), the
+  // rest of forward, backward, and the parameter update.
+  double data_ms;
+  double forward_ms;
+  double backward_ms;
+  double update_ms;
+  double iteration_ms;
+  // Full-iteration percentiles over the last completed window.
+  double iteration_ms_p50;
+  double iteration_ms_p90;
+  double iteration_ms_max;
+  // Pipeline-bubble ratios over the last completed window, from the data
+  // layers' own counters (see Net::PrefetchTiming): the fraction of the
+  // window the forwards spent blocked waiting for a prefetched batch
+  // ("idle waiting for data"), and the fraction the prefetch threads
+  // spent producing (near 1 means no slack left).
+  double data_wait_fraction;
+  double prefetch_load_fraction;
+};
+
 /**
  * @brief An interface for classes that perform optimization on Net%s.
  *
@@ -26,11 +68,53 @@ class Solver {
   // in a non-zero iter number to resume training for a pre-trained net.
   virtual void Solve(const char* resume_file = NULL);
   inline void Solve(const string resume_file) { Solve(resume_file.c_str()); }
-  virtual ~Solver() {}
+  virtual ~Solver() {
+    WaitForSnapshot();
+    WaitForTest();
+  }
   inline shared_ptr<Net<Dtype> > net() { return net_; }
   inline const vector<shared_ptr<Net<Dtype> > >& test_nets() {
     return test_nets_;
   }
+  // Current throughput statistics; only populated while Solve runs with
+  // telemetry_interval > 0.
+  inline const SolverTelemetry& telemetry() const { return telemetry_; }
+
+  /**
+   * @brief Instrumentation hooks invoked by Solve and the test passes
+   *        (custom metrics, external reporting, early stopping) without
+   *        patching the solver loop.
+   *
+   * All methods default to no-ops; override only what is needed.
+   * Callbacks run synchronously in registration order, and a loop with
+   * none registered pays only an empty-vector test per site. With
+   * test_async, on_test_done fires on the evaluation thread.
+   */
+  class Callback {
+   public:
+    virtual ~Callback() {}
+    // Entering this iteration, before any snapshot or test pass.
+    virtual void on_iteration_start(const int iter) {}
+    // The iteration's forward/backward passes finished with this loss
+    // (averaged over iter_size, before smoothing).
+    virtual void on_forward_done(const int iter, const Dtype loss) {}
+    // The parameter update has been applied (or pushed to the master).
+    virtual void on_update_done(const int iter) {}
+    // The iteration is complete, with the smoothed loss Solve displays.
+    virtual void on_iteration_end(const int iter,
+        const Dtype smoothed_loss) {}
+    // A snapshot was written (or, with snapshot_async, handed to the
+    // writer thread) under this model filename.
+    virtual void on_snapshot(const int iter,
+        const string& model_filename) {}
+    // One test net finished evaluating, with its mean loss when
+    // test_compute_loss is set (0 otherwise).
+    virtual void on_test_done(const int iter, const int test_net_id,
+        const Dtype loss) {}
+  };
+  // Registers a callback. The caller keeps ownership and must keep the
+  // object alive through Solve.
+  void AddCallback(Callback* callback) { callbacks_.push_back(callback); }
 
  protected:
   // PreSolve is run before any solving iteration starts, allowing one to
@@ -43,22 +127,82 @@ class Solver {
   // function that produces a SolverState protocol buffer that needs to be
   // written to disk together with the learned net.
   void Snapshot();
+  // Block until a pending asynchronous snapshot has been written to disk.
+  void WaitForSnapshot();
+  // Fill a delta snapshot: the parameter blocks that drifted more than
+  // snapshot_delta_threshold from the copy taken at the last full base.
+  void FillSnapshotDelta(NetDelta* delta);
+  // Load the net weights a snapshot's learned_net names, reading the
+  // full base and laying the blocks over it for a .caffedelta file.
+  void RestoreNet(const string& learned_net);
+  void ApplyNetDelta(const NetDelta& delta);
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
+  // The forward passes and score reporting for one test net, shared by
+  // the inline and background evaluation paths.
+  void RunTest(const int test_net_id, const int iter);
+  // Entry of the background evaluation thread (test_async).
+  void TestAllEntry(const int iter, const Caffe::Brew mode, const int device);
+  // Block until a pending background evaluation has reported.
+  void WaitForTest();
   virtual void SnapshotSolverState(SolverState* state) = 0;
   // The Restore function implements how one should restore the solver to a
   // previously snapshotted state. You should implement the RestoreSolverState()
   // function that restores the state from a SolverState protocol buffer.
   void Restore(const char* resume_file);
   virtual void RestoreSolverState(const SolverState& state) = 0;
+  // Restore from a memory-mapped state container (util/mmap_model.hpp):
+  // adopt the mapped history payloads instead of parsing them.
+  virtual void RestoreSolverStateFromMMap(
+      shared_ptr<MMapSolverState<Dtype> > state) = 0;
+  // Reposition the data layers at the cursor keys recorded by Snapshot,
+  // so a resumed run continues mid-epoch in the exact data order.
+  void RestoreDataCursors(const SolverState& state);
   void DisplayOutputBlobs(const int net_id);
+  // Run one ForwardBackward, across all replicas when data-parallel
+  // training is active.
+  Dtype ForwardBackward(const vector<Blob<Dtype>*>& bottom);
+  // Fold one timed iteration into telemetry_ and its window.
+  void UpdateTelemetry(const float data_ms, const float forward_ms,
+      const float backward_ms, const float update_ms, const int images);
+  // Compute the window percentiles and throughput, log the telemetry
+  // line, and start a new window.
+  void LogTelemetry();
 
   SolverParameter param_;
   int iter_;
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  // Multi-GPU replica group, live only while Solve runs with several gpu
+  // ids configured.
+  shared_ptr<DataParallel<Dtype> > data_parallel_;
+  // Connection to the parameter server, live only while Solve runs with
+  // param_server configured; the master then applies the updates.
+  shared_ptr<ParamServerClient<Dtype> > param_client_;
+  // Lock-free Hogwild worker group, live only while Solve runs with
+  // async_threads > 1 in CPU mode.
+  shared_ptr<AsyncParallel<Dtype> > async_parallel_;
+  // Writer thread of a snapshot still in flight (snapshot_async).
+  shared_ptr<boost::thread> snapshot_thread_;
+  // Delta-snapshot bookkeeping (snapshot_deltas): the parameter values
+  // and filename of the last full base, and how many deltas were
+  // written against it. The base filename stays empty until a full
+  // snapshot happens, so a restored run opens with a fresh base.
+  vector<Dtype> snapshot_base_;
+  string snapshot_base_filename_;
+  int deltas_since_base_;
+  // Evaluation thread of a test pass still in flight (test_async).
+  shared_ptr<boost::thread> test_thread_;
+  // Throughput statistics and the full-iteration times and image count
+  // of the telemetry window being filled.
+  SolverTelemetry telemetry_;
+  vector<float> telemetry_window_ms_;
+  int telemetry_window_images_;
+  // Registered instrumentation hooks, not owned; empty unless
+  // AddCallback was called.
+  vector<Callback*> callbacks_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -82,13 +226,29 @@ class SGDSolver : public Solver<Dtype> {
   virtual void PreSolve();
   Dtype GetLearningRate();
   virtual void ComputeUpdateValue();
+  // Row-wise update value for a parameter whose layer reported a sparse
+  // gradient (see Layer::sparse_param_rows): regularization, momentum
+  // history and the update are computed only for the touched rows.
+  void SparseComputeUpdateValue(int param_id, Dtype local_rate,
+      Dtype local_decay, const vector<int>& rows);
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
+  virtual void RestoreSolverStateFromMMap(
+      shared_ptr<MMapSolverState<Dtype> > state);
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // With history_half, the momentum lives here as binary16 at half the
+  // size (see util/half.hpp) and the history blobs only carry shapes.
+  vector<shared_ptr<SyncedMemory> > history_half_;
+  // When the net's parameters are contiguous, the blobs above are views
+  // into one arena each, so the update can run as a few bulk operations.
+  shared_ptr<SyncedMemory> history_arena_, update_arena_, temp_arena_;
+  // When the history was adopted from a mapped state container, this
+  // keeps the mapping alive for as long as the blobs point into it.
+  shared_ptr<MMapSolverState<Dtype> > mmap_state_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -97,12 +257,16 @@ template <typename Dtype>
 class NesterovSolver : public SGDSolver<Dtype> {
  public:
   explicit NesterovSolver(const SolverParameter& param)
-      : SGDSolver<Dtype>(param) {}
+      : SGDSolver<Dtype>(param) { constructor_sanity_check(); }
   explicit NesterovSolver(const string& param_file)
-      : SGDSolver<Dtype>(param_file) {}
+      : SGDSolver<Dtype>(param_file) { constructor_sanity_check(); }
 
  protected:
   virtual void ComputeUpdateValue();
+  void constructor_sanity_check() {
+    CHECK(!this->param_.history_half())
+        << "history_half is not supported by the Nesterov solver.";
+  }
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -120,6 +284,8 @@ class AdaGradSolver : public SGDSolver<Dtype> {
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
+    CHECK(!this->param_.history_half())
+        << "history_half is not supported by the AdaGrad solver.";
   }
 
   DISABLE_COPY_AND_ASSIGN(AdaGradSolver);
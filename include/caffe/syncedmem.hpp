@@ -22,11 +22,75 @@ namespace caffe {
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
+// Size of a transparent huge page, and the threshold above which host
+// allocations are candidates for huge-page backing.
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Alignment guaranteed for every host allocation made through
+// CaffeMallocHost: one cache line, which is also wide enough for aligned
+// AVX-512 loads. SIMD kernels may rely on this for buffers they own
+// outright; views into a shared arena (see the SyncedMemory view
+// constructor) are only as aligned as their byte offset allows.
+const size_t kCaffeHostAlignment = 64;
+
+// Allocate size bytes on a 2 MB boundary and advise the kernel to back
+// the range with transparent huge pages, cutting dTLB misses on large
+// buffers (fc weights, prefetch batches). Falls back to plain malloc if
+// the aligned allocation fails. The pointer is released with free(), so
+// CaffeFreeHost needs no bookkeeping.
+void* CaffeMallocHuge(size_t size);
+
+// How many host allocations (and bytes) received the huge-page advice
+// since startup.
+void CaffeHugePageStats(size_t* allocs, size_t* bytes);
+
+// Highest device id the allocation accounting tracks individually.
+const int kMaxAccountedDevices = 64;
+
+// Process-wide SyncedMemory allocation accounting. Every host and device
+// byte a SyncedMemory holds is counted, whether it came from the
+// MemoryPool or straight from the system; blocks the pool caches but has
+// not handed out are not. Peaks are high-water marks since startup.
+struct MemoryAccounting {
+  size_t host_bytes;
+  size_t host_bytes_peak;
+  size_t device_bytes;       // summed over all devices
+  size_t device_bytes_peak;  // sum of the per-device peaks
+};
+void CaffeMemoryAccounting(MemoryAccounting* accounting);
+// Current and peak bytes held on one device.
+void CaffeDeviceMemoryAccounting(int device, size_t* bytes, size_t* peak);
+
+// When use_pinned is set (and we are not built CPU_ONLY), the allocation
+// goes through cudaMallocHost so that host-to-device copies of the buffer
+// can run asynchronously via DMA. Pinned allocations must be released with
+// CaffeFreeHost(ptr, true).
+inline void CaffeMallocHost(void** ptr, size_t size, bool use_pinned = false) {
+#ifndef CPU_ONLY
+  if (use_pinned) {
+    CUDA_CHECK(cudaMallocHost(ptr, size));
+    return;
+  }
+#endif
+  if (Caffe::huge_pages_enabled() && size >= kHugePageSize) {
+    *ptr = CaffeMallocHuge(size);
+    return;
+  }
+  // posix_memalign pointers are released with free(), so CaffeFreeHost
+  // needs no bookkeeping; fall back to malloc only if the aligned
+  // allocation fails.
+  if (posix_memalign(ptr, kCaffeHostAlignment, size) != 0) {
+    *ptr = malloc(size);
+  }
 }
 
-inline void CaffeFreeHost(void* ptr) {
+inline void CaffeFreeHost(void* ptr, bool use_pinned = false) {
+#ifndef CPU_ONLY
+  if (use_pinned) {
+    CUDA_CHECK(cudaFreeHost(ptr));
+    return;
+  }
+#endif
   free(ptr);
 }
 
@@ -41,10 +105,30 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), cpu_from_pool_(false), gpu_from_pool_(false),
+        prefer_pinned_(false), cpu_pinned_(false), read_only_(false),
+        skip_zero_fill_(false),
+        h2d_count_(0), d2h_count_(0), gpu_device_(-1), offset_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), cpu_from_pool_(false), gpu_from_pool_(false),
+        prefer_pinned_(false), cpu_pinned_(false), read_only_(false),
+        skip_zero_fill_(false),
+        h2d_count_(0), d2h_count_(0), gpu_device_(-1), offset_(0) {}
+  // A view of size bytes into base at a byte offset. A view allocates
+  // nothing itself: every access delegates to the base, so the whole
+  // arena allocates and synchronizes as one unit.
+  SyncedMemory(const shared_ptr<SyncedMemory>& base, const size_t offset,
+      const size_t size)
+      : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
+        own_cpu_data_(false), cpu_from_pool_(false), gpu_from_pool_(false),
+        prefer_pinned_(false), cpu_pinned_(false), read_only_(false),
+        skip_zero_fill_(false),
+        h2d_count_(0), d2h_count_(0), gpu_device_(-1), base_(base),
+        offset_(offset) {
+    CHECK(base);
+    CHECK_LE(offset + size, base->size());
+  }
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -52,17 +136,111 @@ class SyncedMemory {
   void* mutable_cpu_data();
   void* mutable_gpu_data();
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
-  SyncedHead head() { return head_; }
+  SyncedHead head() { return base_ ? base_->head() : head_; }
   size_t size() { return size_; }
+  // Request page-locked (pinned) host memory for this buffer so that
+  // host-to-device copies can be asynchronous. Must be called before the
+  // host memory is first allocated. Pinned buffers bypass the MemoryPool.
+  void set_prefer_pinned(bool prefer_pinned) {
+    CHECK(!base_) << "set_prefer_pinned called on a view";
+    CHECK(cpu_ptr_ == NULL) << "set_prefer_pinned called after allocation";
+    prefer_pinned_ = prefer_pinned;
+  }
+  bool cpu_pinned() const { return cpu_pinned_; }
+  // Skip the zero fill normally performed when this buffer is first
+  // touched. For scratch the owner guarantees to fully overwrite before
+  // reading (conv col buffers, layer tops), the clear is pure wasted
+  // bandwidth -- on big nets, seconds of it at startup. Only the first
+  // touch is affected, so calling this after allocation is a no-op.
+  // With Caffe::poison_skipped_fills() the skipped clear becomes an
+  // all-ones poison fill (NaN as float or double) to catch misuse.
+  void set_skip_zero_fill() {
+    CHECK(!base_) << "set_skip_zero_fill called on a view";
+    skip_zero_fill_ = true;
+  }
+  bool skip_zero_fill() const { return skip_zero_fill_; }
+  // Transfer instrumentation: how many host-to-device / device-to-host
+  // copies synchronizing this buffer has cost so far, and the bytes they
+  // moved. Views report their base's counters, since the base performs
+  // the copies for the whole arena.
+  int h2d_count() const { return base_ ? base_->h2d_count() : h2d_count_; }
+  int d2h_count() const { return base_ ? base_->d2h_count() : d2h_count_; }
+  size_t h2d_bytes() const {
+    return base_ ? base_->h2d_bytes() : h2d_count_ * size_;
+  }
+  size_t d2h_bytes() const {
+    return base_ ? base_->d2h_bytes() : d2h_count_ * size_;
+  }
+  // Mark this buffer immutable: further mutable_cpu_data,
+  // mutable_gpu_data, or set_cpu_data calls fail a CHECK. Used for
+  // parameter storage shared read-only across serving replicas
+  // (Net::CreateReplica), where a stray write through any net would
+  // corrupt all of them at once. On a view the whole underlying arena
+  // is frozen. There is deliberately no way back; read-only is for
+  // buffers whose contents are final.
+  void set_read_only() {
+    if (base_) { base_->set_read_only(); } else { read_only_ = true; }
+  }
+  bool read_only() const { return base_ ? base_->read_only() : read_only_; }
+  // Name reported when a transfer of this buffer is logged, e.g.
+  // "conv1 data"; Net registers its blobs after Init so stray syncs can
+  // be attributed. Transfers of an arena are logged under the arena
+  // base's name.
+  void set_debug_name(const string& name) { debug_name_ = name; }
+  const string& debug_name() const { return debug_name_; }
+#ifndef CPU_ONLY
+  // Offload support (see Net's activation offload scheduler). StartOffload
+  // begins copying device data into the host buffer on stream; once the
+  // caller knows the copy completed, DropDeviceData marks the host copy
+  // current and releases the device buffer. StartPrefetch begins the
+  // reverse upload; the caller must order consuming kernels after it
+  // (e.g. with an event). All three are no-ops when there is nothing to
+  // move, and return whether work was queued (or a drop is worthwhile).
+  bool StartOffload(cudaStream_t stream);
+  void DropDeviceData();
+  bool StartPrefetch(cudaStream_t stream);
+#endif
 
  private:
   void to_cpu();
   void to_gpu();
+  // Warn (with a backtrace) about a device-to-host sync happening inside
+  // a region marked GPU-hot; see Caffe::BeginHotRegion.
+  void LogHotRegionSync() const;
+  // Allocate size_ bytes for cpu_ptr_/gpu_ptr_, from the MemoryPool when it
+  // is enabled and straight from the system otherwise.
+  void MallocHostData();
+#ifndef CPU_ONLY
+  void MallocDeviceData();
+#endif
   void* cpu_ptr_;
   void* gpu_ptr_;
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  // Whether each pointer was drawn from the caching MemoryPool, so it can
+  // be returned there even if the pool is toggled off in the meantime.
+  bool cpu_from_pool_;
+  bool gpu_from_pool_;
+  // Whether pinned host memory was requested, and whether cpu_ptr_ actually
+  // is pinned (so the matching free is used).
+  bool prefer_pinned_;
+  bool cpu_pinned_;
+  // Whether mutable access has been forbidden (see set_read_only).
+  bool read_only_;
+  // Whether the first-touch zero fill is elided (see set_skip_zero_fill).
+  bool skip_zero_fill_;
+  // Synchronizing copies performed so far, and the name they are
+  // attributed to in logs.
+  int h2d_count_;
+  int d2h_count_;
+  string debug_name_;
+  // Device gpu_ptr_ was allocated on, for the accounting at free time.
+  int gpu_device_;
+  // Set for views only: the backing memory and the view's byte offset
+  // into it.
+  shared_ptr<SyncedMemory> base_;
+  size_t offset_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
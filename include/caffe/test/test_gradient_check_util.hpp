@@ -80,17 +80,24 @@ void GradientChecker<Dtype>::CheckGradientSingle(Layer<Dtype>* layer,
       CHECK_EQ(top_count, (*bottom)[blob_id]->count());
     }
   }
-  // First, figure out what blobs we need to check against.
+  // First, figure out what blobs we need to check against, and zero init
+  // parameter blobs (layers accumulate parameter gradients).
+  // check_bottom selects the bottoms: -1 checks all of them, a
+  // non-negative index checks just that one, and -2 checks none -- only
+  // the parameter blobs -- for layers whose inputs are not
+  // differentiable (e.g. the ids fed to an EmbedLayer).
   vector<Blob<Dtype>*> blobs_to_check;
-  vector<bool> propagate_down(bottom->size(), check_bottom < 0);
+  vector<bool> propagate_down(bottom->size(), check_bottom == -1);
   for (int i = 0; i < layer->blobs().size(); ++i) {
-    blobs_to_check.push_back(layer->blobs()[i].get());
+    Blob<Dtype>* blob = layer->blobs()[i].get();
+    caffe_set(blob->count(), static_cast<Dtype>(0), blob->mutable_cpu_diff());
+    blobs_to_check.push_back(blob);
   }
-  if (check_bottom < 0) {
+  if (check_bottom == -1) {
     for (int i = 0; i < bottom->size(); ++i) {
       blobs_to_check.push_back((*bottom)[i]);
     }
-  } else {
+  } else if (check_bottom >= 0) {
     CHECK_LT(check_bottom, bottom->size());
     blobs_to_check.push_back((*bottom)[check_bottom]);
     propagate_down[check_bottom] = true;
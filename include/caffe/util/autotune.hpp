@@ -0,0 +1,25 @@
+#ifndef CAFFE_UTIL_AUTOTUNE_H_
+#define CAFFE_UTIL_AUTOTUNE_H_
+
+#include <string>
+
+namespace caffe {
+
+// Process-wide engine autotune cache, shared across layers and nets and
+// safe to use from concurrently set-up data-parallel replicas. Cache
+// files hold one "<shape key> <engine name>" line per tuned shape and are
+// loaded once per distinct path.
+
+// Look up the cached engine choice for a shape key, loading cache_file
+// (if any) on first use. Returns false if the shape has not been tuned.
+bool AutotuneLookup(const std::string& cache_file, const std::string& key,
+    std::string* engine);
+
+// Record the engine choice for a shape key, appending it to cache_file
+// unless the path is empty.
+void AutotuneStore(const std::string& cache_file, const std::string& key,
+    const std::string& engine);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_AUTOTUNE_H_
@@ -1,6 +1,8 @@
 #ifndef CAFFE_UTIL_BENCHMARK_H_
 #define CAFFE_UTIL_BENCHMARK_H_
 
+#include <stdint.h>
+
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "caffe/util/device_alternate.hpp"
@@ -11,9 +13,10 @@ class Timer {
  public:
   Timer();
   virtual ~Timer();
-  void Start();
-  void Stop();
-  float MilliSeconds();
+  virtual void Start();
+  virtual void Stop();
+  virtual float MilliSeconds();
+  virtual float MicroSeconds();
   float Seconds();
 
   inline bool initted() { return initted_; }
@@ -33,6 +36,69 @@ class Timer {
   boost::posix_time::ptime start_cpu_;
   boost::posix_time::ptime stop_cpu_;
   float elapsed_milliseconds_;
+  float elapsed_microseconds_;
+};
+
+// A Timer that always uses the wall clock, even in GPU mode. The prefetch
+// and decode threads use it to time host-side work without synchronizing
+// the device.
+class CPUTimer : public Timer {
+ public:
+  CPUTimer();
+  virtual ~CPUTimer() {}
+  virtual void Start();
+  virtual void Stop();
+  virtual float MilliSeconds();
+  virtual float MicroSeconds();
+};
+
+/**
+ * @brief Samples hardware performance counters around a region of host
+ *        code through the Linux perf_event interface.
+ *
+ * Wall time alone cannot tell a kernel that executes more instructions
+ * from one whose cache behavior changed; the cycle, instruction, LLC
+ * miss and stalled-cycle deltas can. The counters measure the calling
+ * thread only, so in GPU mode they see kernel-launch and host-side work
+ * rather than device execution -- this is a CPU analysis tool.
+ *
+ * Construction probes the kernel once; when perf_event is unavailable
+ * (non-Linux build, no PMU, or perf_event_paranoid forbids access)
+ * available() is false, Start/Stop are no-ops and every Value() is zero,
+ * so callers can always leave the sampling code in place.
+ */
+class PerfCounters {
+ public:
+  enum Counter {
+    CYCLES = 0,
+    INSTRUCTIONS = 1,
+    LLC_MISSES = 2,
+    STALLED_CYCLES = 3,
+    NUM_COUNTERS = 4
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  /// @brief Whether the kernel exposed at least the cycle and
+  ///        instruction counters.
+  bool available() const { return available_; }
+  /// @brief Human-readable name of a counter, for reports.
+  static const char* CounterName(const Counter counter);
+
+  /// @brief Zero the counters and start counting.
+  void Start();
+  /// @brief Stop counting and latch the values.
+  void Stop();
+  /// @brief One counter's value over the last Start/Stop interval; zero
+  ///        for counters the hardware or kernel does not expose.
+  uint64_t Value(const Counter counter) const { return values_[counter]; }
+
+ private:
+  int fds_[NUM_COUNTERS];
+  uint64_t values_[NUM_COUNTERS];
+  bool available_;
+  bool running_;
 };
 
 }  // namespace caffe
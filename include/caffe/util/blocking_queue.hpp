@@ -0,0 +1,46 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe FIFO queue used to hand prefetched batches between
+ *        the producer (prefetch) thread and the consumer (Forward) thread.
+ *
+ * The synchronization primitives are hidden behind a pimpl so that this
+ * header stays free of boost::thread includes and can be pulled into
+ * nvcc-compiled translation units.
+ */
+template<typename T>
+class BlockingQueue {
+ public:
+  explicit BlockingQueue();
+
+  void push(const T& t);
+
+  bool try_pop(T* t);
+
+  // This logs a message if the thread needs to be blocked.
+  T pop(const string& log_on_wait = "");
+
+  size_t size() const;
+
+ protected:
+  // The mutex and condition variable live behind this forward declaration;
+  // see the note in internal_thread.hpp for why boost::thread must not be
+  // included from headers that nvcc may compile.
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
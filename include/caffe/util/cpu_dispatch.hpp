@@ -0,0 +1,49 @@
+#ifndef CAFFE_UTIL_CPU_DISPATCH_H_
+#define CAFFE_UTIL_CPU_DISPATCH_H_
+
+#include <stdint.h>
+
+// Runtime CPU-feature dispatch for the hand-written kernels. The fleet
+// mixes SSE-only and AVX2 hosts, so instead of building the library per
+// ISA, the AVX2 variants below are compiled in their own translation
+// unit with the ISA enabled (see util/math_functions_avx2.cpp and the
+// CAFFE_X86_DISPATCH block in the Makefile) and callers pick a variant
+// after checking CaffeCpuHasAVX2. One artifact then runs optimally
+// everywhere.
+
+namespace caffe {
+
+// True if the host CPU supports AVX2 and FMA and the OS saves the ymm
+// state. Resolved with cpuid on the first call and cached.
+bool CaffeCpuHasAVX2();
+
+#ifdef CAFFE_X86_DISPATCH
+
+// AVX2/FMA kernel variants. Only call when CaffeCpuHasAVX2() is true;
+// the symbols exist only in x86 builds.
+
+// Vectorized float exp/log/powx in the Cephes/SVML style (the scalar
+// fallbacks live in mkl_alternate.hpp, which also dispatches here).
+void caffe_avx2_exp_ps(const int n, const float* a, float* y);
+void caffe_avx2_ln_ps(const int n, const float* a, float* y);
+void caffe_avx2_powx_ps(const int n, const float* a, const float b, float* y);
+
+// Hand-tiled small-matrix float GEMM (see caffe_small_gemm_nn in
+// math_functions.cpp for the contract).
+void caffe_avx2_small_gemm_nn(const int M, const int N, const int K,
+    const float alpha, const float* A, const float* B, const float beta,
+    float* C);
+
+// Fused softmax of one dense float vector: an online max/exp/sum sweep
+// followed by an exp-and-scale sweep (see caffe_cpu_softmax).
+void caffe_avx2_softmax_ps(const int n, const float* x, float* y);
+
+// Popcount of the XOR of two packed code rows of n 64-bit words.
+int caffe_avx2_hamming_popcnt(const int n, const uint64_t* a,
+    const uint64_t* b);
+
+#endif  // CAFFE_X86_DISPATCH
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CPU_DISPATCH_H_
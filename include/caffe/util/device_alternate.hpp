@@ -90,9 +90,40 @@ const char* curandGetErrorString(curandStatus_t error);
     const int CAFFE_CUDA_NUM_THREADS = 512;
 #endif
 
-// CUDA: number of blocks for threads.
+// CUDA: x-dimension grid limit of the current device, cached per device
+// after the first query.
+int CaffeMaxGridDim();
+
+// CUDA: number of blocks for threads. Clamped to the device's grid
+// limit; kernels are grid-stride loops (CUDA_KERNEL_LOOP), so a clamped
+// grid still covers every element.
 inline int CAFFE_GET_BLOCKS(const int N) {
-  return (N + CAFFE_CUDA_NUM_THREADS - 1) / CAFFE_CUDA_NUM_THREADS;
+  const int blocks = (N + CAFFE_CUDA_NUM_THREADS - 1) / CAFFE_CUDA_NUM_THREADS;
+  const int max_blocks = CaffeMaxGridDim();
+  return blocks < max_blocks ? blocks : max_blocks;
+}
+
+// CUDA: occupancy-chosen launch configuration.
+//
+// CAFFE_GET_BLOCKS assumes one element per thread at a fixed block size,
+// which under-occupies newer devices on small blobs and wastes resident
+// slots for kernels whose register use caps occupancy below the fixed
+// size. Grid-stride kernels can instead launch through
+// CaffeGetLaunchConfig, which asks the occupancy calculator (CUDA 6.5+)
+// for the block size that maximizes resident threads for that kernel
+// and caps the grid at the number of blocks the device can actually run
+// at once. The block size and grid cap are cached per (kernel, device)
+// after the first launch.
+struct CaffeLaunchConfig {
+  int blocks;
+  int threads;
+};
+
+CaffeLaunchConfig CaffeQueryLaunchConfig(const void* kernel, const int n);
+
+template <typename Kernel>
+inline CaffeLaunchConfig CaffeGetLaunchConfig(Kernel kernel, const int n) {
+  return CaffeQueryLaunchConfig(reinterpret_cast<const void*>(kernel), n);
 }
 
 }  // namespace caffe
@@ -0,0 +1,17 @@
+#ifndef _CAFFE_UTIL_FUSE_NEURON_LAYERS_HPP_
+#define _CAFFE_UTIL_FUSE_NEURON_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameter with runs of consecutive elementwise NeuronLayers
+// collapsed into single NEURON_CHAIN layers that execute one fused pass over
+// the activations. Only fuses in test-phase nets without force_backward,
+// since the fused layer does not implement Backward; otherwise the copy is
+// returned unchanged.
+void FuseNeuronLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_NEURON_LAYERS_HPP_
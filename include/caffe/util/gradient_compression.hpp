@@ -0,0 +1,85 @@
+#ifndef CAFFE_UTIL_GRADIENT_COMPRESSION_HPP_
+#define CAFFE_UTIL_GRADIENT_COMPRESSION_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Lossy gradient codec for the parameter-server push path.
+ *
+ * Compress turns a dense diff into a compact byte payload and
+ * Decompress restores a dense diff on the other side, so 20-100x fewer
+ * bytes cross the wire per push. Whatever a push leaves out stays in a
+ * local per-sender residual that is added to the next pass's diff
+ * (error feedback), so small gradients are delayed, never dropped.
+ * Compress therefore carries state and belongs to one sender;
+ * Decompress is stateless and one instance can serve every worker.
+ * Both ends must be configured with the same CompressionType.
+ */
+template <typename Dtype>
+class GradientCompressor {
+ public:
+  virtual ~GradientCompressor() {}
+  /**
+   * @brief Encode count diff entries, plus the carried residual, into
+   *        *out; resizes *out to the payload size. Every call must
+   *        pass the same count.
+   */
+  virtual void Compress(const Dtype* diff, int count,
+      vector<uint8_t>* out) = 0;
+  /// @brief Decode a payload produced by Compress back into a dense
+  ///        diff of count entries, overwriting it.
+  virtual void Decompress(const uint8_t* data, size_t size, int count,
+      Dtype* diff) = 0;
+  /// @brief Build the compressor gradient_compression selects, or NULL
+  ///        for COMPRESS_NONE. The caller owns the result.
+  static GradientCompressor<Dtype>* Create(const SolverParameter& param);
+};
+
+/**
+ * @brief Top-k sparsification: sends the k = topk_fraction * count
+ *        largest-magnitude entries as (index, value) pairs and folds
+ *        the rest into the residual.
+ */
+template <typename Dtype>
+class TopKGradientCompressor : public GradientCompressor<Dtype> {
+ public:
+  explicit TopKGradientCompressor(const Dtype fraction);
+  virtual void Compress(const Dtype* diff, int count,
+      vector<uint8_t>* out);
+  virtual void Decompress(const uint8_t* data, size_t size, int count,
+      Dtype* diff);
+
+ private:
+  Dtype fraction_;
+  vector<Dtype> residual_;
+  vector<Dtype> magnitudes_;  // selection scratch, kept across pushes
+};
+
+/**
+ * @brief 1-bit quantization: sends one sign bit per entry plus the mean
+ *        magnitude of each sign bucket as its scale, and folds the
+ *        quantization error into the residual.
+ */
+template <typename Dtype>
+class OneBitGradientCompressor : public GradientCompressor<Dtype> {
+ public:
+  OneBitGradientCompressor() {}
+  virtual void Compress(const Dtype* diff, int count,
+      vector<uint8_t>* out);
+  virtual void Decompress(const uint8_t* data, size_t size, int count,
+      Dtype* diff);
+
+ private:
+  vector<Dtype> residual_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_GRADIENT_COMPRESSION_HPP_
@@ -0,0 +1,100 @@
+#ifndef CAFFE_UTIL_HALF_H_
+#define CAFFE_UTIL_HALF_H_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace caffe {
+
+// Software IEEE 754 binary16 ("half") conversions, used to store
+// activations and weights at half size (see Blob::CompressDataToHalf).
+// Rounding is to nearest even, with the usual inf/nan and subnormal
+// handling.
+
+inline uint16_t caffe_float2half(const float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs = bits & 0x7fffffff;
+  if (abs >= 0x47800000) {  // overflows the half range, or inf/nan
+    if (abs > 0x7f800000) {
+      return sign | 0x7e00;  // nan
+    }
+    return sign | 0x7c00;  // +-inf
+  }
+  if (abs < 0x38800000) {  // maps to a subnormal half, or to zero
+    const uint32_t shift = 126 - (abs >> 23);
+    if (shift > 24) {
+      return sign;  // too small; rounds to +-0
+    }
+    const uint32_t mant = (abs & 0x7fffff) | 0x800000;
+    const uint32_t halfway = 1u << (shift - 1);
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    uint16_t half = mant >> shift;
+    // A carry out of the mantissa lands on the smallest normal half,
+    // whose encoding follows directly, so no special case is needed.
+    if (rem > halfway || (rem == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  // Normal half: drop 13 mantissa bits, rounding to nearest even. The
+  // carry can only push the result to the next representable half, up to
+  // and including infinity, so it needs no special case either.
+  const uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+  return sign | ((rounded - 0x38000000) >> 13);
+}
+
+inline float caffe_half2float(const uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mant = value & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    if (mant == 0) {
+      bits = sign;  // +-0
+    } else {
+      // Subnormal half: renormalize into the float format.
+      exponent = 113;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        --exponent;
+      }
+      bits = sign | (exponent << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mant << 13);  // +-inf or nan
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mant << 13);
+  }
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// Array conversions; double values go through float on the way to half.
+template <typename Dtype>
+void caffe_cpu_convert_to_half(const int n, const Dtype* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_convert_from_half(const int n, const uint16_t* x, Dtype* y);
+
+// y = alpha * x + beta * y with y stored in half precision, so
+// half-resident state (e.g. solver history) is updated in one pass:
+// the arithmetic runs in Dtype and only the loads and stores convert.
+template <typename Dtype>
+void caffe_cpu_axpby_half(const int n, const Dtype alpha, const Dtype* x,
+    const Dtype beta, uint16_t* y);
+
+// GPU counterparts, implemented in half.cu with the device conversion
+// intrinsics.
+template <typename Dtype>
+void caffe_gpu_convert_from_half(const int n, const uint16_t* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_gpu_axpby_half(const int n, const Dtype alpha, const Dtype* x,
+    const Dtype beta, uint16_t* y);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_HALF_H_
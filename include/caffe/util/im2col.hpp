@@ -27,6 +27,41 @@ void col2im_gpu(const Dtype* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, Dtype* data_im);
 
+// Strip variants covering only the output rows [h_col_begin, h_col_end):
+// data_col holds just that strip, so a fixed-size buffer can stream over
+// arbitrarily large planes. The col2im strips accumulate into data_im
+// without zeroing it first -- overlapping filter windows make adjacent
+// strips touch shared input rows, so the caller zeroes the image once
+// before the first strip.
+
+template <typename Dtype>
+void im2col_strip_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    Dtype* data_col);
+
+template <typename Dtype>
+void col2im_strip_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    Dtype* data_im);
+
+template <typename Dtype>
+void im2col_strip_gpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    Dtype* data_col);
+
+template <typename Dtype>
+void col2im_strip_gpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    Dtype* data_im);
+
 }  // namespace caffe
 
 #endif  // CAFFE_UTIL_IM2COL_HPP_
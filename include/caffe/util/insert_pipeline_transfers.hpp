@@ -0,0 +1,24 @@
+#ifndef _CAFFE_UTIL_INSERT_PIPELINE_TRANSFERS_HPP_
+#define _CAFFE_UTIL_INSERT_PIPELINE_TRANSFERS_HPP_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with PipelineTransferLayers added wherever a blob
+// produced in one pipeline stage is consumed in the next one, so each
+// stage reads device-local copies of its inputs. The transfers for a
+// stage are emitted as a contiguous block in front of the stage's first
+// layer; Net::ForwardPipelined relies on that layout to release the
+// upstream stage as soon as the copies are queued. Checks that layer
+// stages are non-decreasing and that no blob skips a stage.
+void InsertPipelineTransfers(const NetParameter& param,
+    NetParameter* param_transfer);
+
+string PipelineTransferLayerName(const string& blob_name, const int stage);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_INSERT_PIPELINE_TRANSFERS_HPP_
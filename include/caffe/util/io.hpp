@@ -89,6 +89,18 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Like WriteProtoToBinaryFile, but deflates the serialized message in
+// fixed-size blocks, compressed on all cores in parallel. Weight files
+// shrink ~2.5x, which matters when many jobs snapshot over one NFS link.
+// ReadProtoFromBinaryFile detects the container by its magic and inflates
+// transparently, so readers need no changes.
+void WriteProtoToCompressedBinaryFile(const Message& proto,
+    const char* filename);
+inline void WriteProtoToCompressedBinaryFile(
+    const Message& proto, const string& filename) {
+  WriteProtoToCompressedBinaryFile(proto, filename.c_str());
+}
+
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum);
 
@@ -102,8 +114,45 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, datum);
 }
 
+// Like ReadImageToDatum, but decodes the encoded image bytes (JPEG/PNG)
+// from an in-memory buffer instead of a file, e.g. a span of a packed
+// image archive.
+bool DecodeImageToDatum(const char* buffer, const size_t size,
+    const int label, const int height, const int width, const bool is_color,
+    Datum* datum);
+
+inline bool DecodeImageToDatum(const char* buffer, const size_t size,
+    const int label, const int height, const int width, Datum* datum) {
+  return DecodeImageToDatum(buffer, size, label, height, width, true, datum);
+}
+
+// Stores the raw bytes of the file (e.g. the original JPEG/PNG) in the
+// datum and marks it as encoded, without decoding the image.
+bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
+
+// Decodes an encoded datum in place, replacing the compressed bytes with
+// raw pixels as stored in the image (color images decode to 3 channels,
+// grayscale ones to 1). Returns false if the datum is not encoded.
+bool DecodeDatum(Datum* datum);
+
 leveldb::Options GetLevelDBOptions();
 
+// Faults a database's pages into the kernel page cache by reading every
+// regular file under path (a bare file, or the flat directory leveldb
+// and LMDB use) sequentially in large chunks. Run before (or concurrent
+// with) the first epoch after a reboot, the cursor walk then hits warm
+// pages instead of demand-faulting the map 4KB at a time. Returns the
+// number of bytes touched.
+size_t WarmPageCache(const string& path);
+
+// Pins the leading fraction (0..1) of every regular file under path in
+// physical memory with mlock, so the hot prefix survives page-cache
+// pressure from other jobs. The mappings are deliberately kept for the
+// life of the process -- exiting releases the locks -- and locking
+// beyond RLIMIT_MEMLOCK fails with a warning per file. Returns the
+// number of bytes locked.
+size_t MLockPath(const string& path, const double fraction);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -114,10 +163,25 @@ void hdf5_load_nd_dataset(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
   Blob<Dtype>* blob);
 
+// Reads rows [start_row, start_row + num_rows) of a dataset as a hyperslab,
+// reshaping the blob to num_rows along the first dimension.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+  hid_t file_id, const char* dataset_name_, hsize_t start_row,
+  hsize_t num_rows, Blob<Dtype>* blob);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
   const hid_t file_id, const string dataset_name, const Blob<Dtype>& blob);
 
+// Appends the blob as blob.num() new rows of an extensible chunked
+// dataset, creating the dataset on first use with one chunk per append;
+// a positive compression_level deflate-compresses the chunks.
+template <typename Dtype>
+void hdf5_append_nd_dataset(
+  const hid_t file_id, const string dataset_name, const Blob<Dtype>& blob,
+  const int compression_level);
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_IO_H_
@@ -20,6 +20,15 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// As above but with explicit (row-major) leading dimensions, for
+// operating on submatrices embedded in larger arrays, e.g. a strip of
+// output rows inside a full convolution top.
+template <typename Dtype>
+void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -52,6 +61,9 @@ void caffe_scal(const int N, const Dtype alpha, Dtype *X);
 template <typename Dtype>
 void caffe_sqr(const int N, const Dtype* a, Dtype* y);
 
+template <typename Dtype>
+void caffe_sqrt(const int N, const Dtype* a, Dtype* y);
+
 template <typename Dtype>
 void caffe_add(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 
@@ -64,6 +76,20 @@ void caffe_mul(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 template <typename Dtype>
 void caffe_div(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 
+// Fused n-ary sum: y = \sum_i coeffs[i] * inputs[i], over num_inputs
+// equally sized vectors in a single pass over the data instead of one
+// binary op (and one traversal of y) per input. Pass coeffs == NULL for
+// an unweighted sum.
+template <typename Dtype>
+void caffe_sum(const int N, const int num_inputs, const Dtype* const* inputs,
+    const Dtype* coeffs, Dtype* y);
+
+// Fused n-ary elementwise product: y = \prod_i inputs[i], in a single
+// pass over the data.
+template <typename Dtype>
+void caffe_prod(const int N, const int num_inputs, const Dtype* const* inputs,
+    Dtype* y);
+
 template <typename Dtype>
 void caffe_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
 
@@ -85,9 +111,31 @@ void caffe_rng_bernoulli(const int n, const Dtype p, int* r);
 template <typename Dtype>
 void caffe_rng_bernoulli(const int n, const Dtype p, unsigned int* r);
 
+// Block Bernoulli generation: fills all n values by comparing raw generator
+// words against a fixed integer threshold, instead of synthesizing one real
+// per variate through bernoulli_distribution. Use this when the mask size
+// is known up front, e.g. dropout masks and sparse filler masks.
+template <typename Dtype>
+void caffe_rng_bernoulli_block(const int n, const Dtype p, int* r);
+
+template <typename Dtype>
+void caffe_rng_bernoulli_block(const int n, const Dtype p, unsigned int* r);
+
 template <typename Dtype>
 void caffe_exp(const int n, const Dtype* a, Dtype* y);
 
+// y = softmax(x) over one dense vector: max, exp and sum fused into a
+// single sweep of x (online max with sum rescaling) plus one
+// exp-and-scale sweep, instead of separate max, subtract, exp and
+// divide passes. Wide classifier outputs are memory-bound, so the
+// sweep count is what matters; SoftmaxLayer uses this for the common
+// single-spatial-location case.
+template <typename Dtype>
+void caffe_cpu_softmax(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_log(const int n, const Dtype* a, Dtype* y);
+
 template <typename Dtype>
 void caffe_abs(const int n, const Dtype* a, Dtype* y);
 
@@ -101,10 +149,54 @@ Dtype caffe_cpu_strided_dot(const int n, const Dtype* x, const int incx,
 template <typename Dtype>
 int caffe_cpu_hamming_distance(const int n, const Dtype* x, const Dtype* y);
 
+// Fills out (n x m) with the Hamming distances between every row of
+// x (n x dim) and y (m x dim). The codes are packed into 64-bit words
+// once up front and the distance loop is tiled so a block of y stays
+// cache-resident, which is much faster than n*m calls to
+// caffe_cpu_hamming_distance.
+template <typename Dtype>
+void caffe_cpu_hamming_distance_matrix(const int n, const int m,
+    const int dim, const Dtype* x, const Dtype* y, int* out);
+
 // Returns the sum of the absolute values of the elements of vector x
 template <typename Dtype>
 Dtype caffe_cpu_asum(const int n, const Dtype* x);
 
+// Strided reductions over every incx-th element of x starting at x[0];
+// n is the number of elements read, not the length of x. A sparse
+// stride keeps the pass cheap, which is what the sampled debug-info
+// statistics rely on.
+template <typename Dtype>
+Dtype caffe_cpu_strided_asum(const int n, const Dtype* x, const int incx);
+
+// The largest absolute value among the same sample.
+template <typename Dtype>
+Dtype caffe_cpu_strided_amax(const int n, const Dtype* x, const int incx);
+
+// Fast approximate replacements for the forward kernels of the
+// transcendental neuron layers: tanh(x), 1 / (1 + exp(-x)), and
+// log(1 + exp(x)) respectively. They are built on a branch-free
+// Cephes-style polynomial expf/logf (see math_functions.cpp) so the
+// per-element loop vectorizes instead of calling libm; both precisions
+// evaluate in single precision internally. Selected by the FAST engine
+// of the corresponding layer or globally by Caffe::set_fast_math.
+template <typename Dtype>
+void caffe_cpu_fast_tanh(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_cpu_fast_sigmoid(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_cpu_fast_bnll(const int n, const Dtype* x, Dtype* y);
+
+// Maximum absolute error of each fast kernel against the exact
+// expression, measured densely over [-30, 30] (observed: 1.4e-7 for
+// tanh, 9e-8 for sigmoid, 1.1e-6 for bnll, stated with headroom).
+// Caffe::set_fast_math_verify CHECKs every fast forward against these.
+const float kFastTanHMaxError = 1e-6;
+const float kFastSigmoidMaxError = 1e-6;
+const float kFastBNLLMaxError = 5e-6;
+
 // the branchless, type-safe version from
 // http://stackoverflow.com/questions/1903954/is-there-a-standard-sign-function-signum-sgn-in-c-c
 template<typename Dtype>
@@ -147,6 +239,41 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// INT8 inference path. Quantize maps x to round(x * scale) clamped to
+// [-127, 127]; dequantize maps int32 accumulators back with y = x * scale.
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y);
+
+template <typename Dtype>
+void caffe_cpu_dequantize(const int n, const int32_t* x, const Dtype scale,
+    Dtype* y);
+
+// C = A * B with int8 inputs and int32 accumulation. A is M x K row-major
+// and never transposed; B is K x N (CblasNoTrans) or N x K (CblasTrans).
+// Only the plain product is computed (alpha = 1, beta = 0), which is all
+// the quantized forward passes need.
+void caffe_cpu_igemm(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int32_t* C);
+
+// y[m] = scale[m] * (A[m, :] . x) over the M rows of A, an M x K
+// row-major int8 matrix with one dequantization scale per row. Fused
+// GEMV for the weights-only quantized inner product: each weight is
+// expanded in-register, so the pass streams the int8 footprint instead
+// of a dense Dtype copy, while x and y stay full precision.
+template <typename Dtype>
+void caffe_cpu_gemv_int8(const int M, const int K, const int8_t* A,
+    const Dtype* scale, const Dtype* x, Dtype* y);
+
+// C = A * B^T where B is sparse in compressed sparse row form: A is
+// M x K row-major dense, B is N x K with nonzeros B_val at column
+// indices B_col and per-row extents B_ptr (size N + 1), and C is M x N
+// row-major. Used by the SPARSE inner product engine, where work scales
+// with the number of nonzero weights instead of N * K.
+template <typename Dtype>
+void caffe_cpu_csrmm(const int M, const int N, const int K, const Dtype* A,
+    const Dtype* B_val, const int* B_col, const int* B_ptr, Dtype* C);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -158,6 +285,24 @@ void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// As above but with explicit (row-major) leading dimensions, for
+// operating on submatrices embedded in larger arrays.
+template <typename Dtype>
+void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
+// Batched variant: computes C[i] = alpha * A[i] * B[i] + beta * C[i] for
+// batch_size problems of identical shape in one call, amortizing the
+// launch overhead of many small multiplications (e.g. convolution
+// groups). The pointer arrays must reside in device memory.
+template <typename Dtype>
+void caffe_gpu_gemm_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype** A, const Dtype** B, const Dtype beta,
+    Dtype** C, const int batch_size);
+
 template <typename Dtype>
 void caffe_gpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -202,12 +347,26 @@ void caffe_gpu_mul(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_div(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 
+// Device versions of the fused n-ary sum and product; see caffe_sum and
+// caffe_prod. inputs is a host-side array of device pointers (it is
+// captured by value at launch, so it need not outlive the call).
+template <typename Dtype>
+void caffe_gpu_sum(const int N, const int num_inputs,
+    const Dtype* const* inputs, const Dtype* coeffs, Dtype* y);
+
+template <typename Dtype>
+void caffe_gpu_prod(const int N, const int num_inputs,
+    const Dtype* const* inputs, Dtype* y);
+
 template <typename Dtype>
 void caffe_gpu_abs(const int n, const Dtype* a, Dtype* y);
 
 template <typename Dtype>
 void caffe_gpu_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_sqrt(const int n, const Dtype* a, Dtype* y);
+
 // caffe_gpu_rng_uniform with two arguments generates integers in the range
 // [0, UINT_MAX].
 void caffe_gpu_rng_uniform(const int n, unsigned int* r);
@@ -234,9 +393,25 @@ template <typename Dtype>
 uint32_t caffe_gpu_hamming_distance(const int n, const Dtype* x,
                                     const Dtype* y);
 
+// GPU counterpart of caffe_cpu_hamming_distance_matrix; out is a
+// device pointer holding n * m ints, one thread per output entry.
+template <typename Dtype>
+void caffe_gpu_hamming_distance_matrix(const int n, const int m,
+    const int dim, const Dtype* x, const Dtype* y, int* out);
+
 template <typename Dtype>
 void caffe_gpu_asum(const int n, const Dtype* x, Dtype* y);
 
+// GPU counterparts of the strided sample reductions; the data stays on
+// the device and only the scalar result comes back.
+template <typename Dtype>
+void caffe_gpu_strided_asum(const int n, const Dtype* x, const int incx,
+    Dtype* y);
+
+template <typename Dtype>
+void caffe_gpu_strided_amax(const int n, const Dtype* x, const int incx,
+    Dtype* y);
+
 template<typename Dtype>
 void caffe_gpu_sign(const int n, const Dtype* x, Dtype* y);
 
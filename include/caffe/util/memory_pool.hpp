@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_MEMORY_POOL_HPP_
+#define CAFFE_UTIL_MEMORY_POOL_HPP_
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A size-bucketed caching allocator for host and device memory.
+ *
+ * Freed blocks are kept in per-bucket free lists (buckets are powers of two)
+ * and handed back on the next request of the same bucket, so repeated
+ * Blob::Reshape cycles do not churn malloc or the CUDA allocator. The pool
+ * is only consulted when Caffe::memory_pool_enabled() is set; SyncedMemory
+ * remembers per allocation whether it came from the pool.
+ */
+class MemoryPool {
+ public:
+  static MemoryPool& Get();
+
+  void* MallocHost(size_t size);
+  void FreeHost(void* ptr);
+#ifndef CPU_ONLY
+  void* MallocDevice(size_t size);
+  void FreeDevice(void* ptr);
+#endif
+
+  /// @brief Release all cached (not outstanding) blocks back to the system.
+  void Clear();
+  /// @brief Log cached and outstanding block counts and byte totals.
+  void DumpStats();
+
+ private:
+  MemoryPool();
+
+  // Per-side bookkeeping: free lists keyed by bucket size, plus the bucket
+  // size of every outstanding block so Free can return it to the right list.
+  struct PoolState {
+    PoolState() : cached_bytes(0), outstanding_bytes(0) {}
+    map<size_t, vector<void*> > free_blocks;
+    map<void*, size_t> in_use;
+    size_t cached_bytes;
+    size_t outstanding_bytes;
+  };
+
+  static size_t BucketSize(size_t size);
+
+  // The mutex lives behind this forward declaration so that this header
+  // stays free of boost::thread includes (see internal_thread.hpp).
+  class sync;
+
+  PoolState host_;
+  PoolState device_;
+  shared_ptr<sync> sync_;
+
+  static shared_ptr<MemoryPool> singleton_;
+
+  DISABLE_COPY_AND_ASSIGN(MemoryPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMORY_POOL_HPP_
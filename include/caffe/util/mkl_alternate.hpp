@@ -31,8 +31,59 @@ extern "C" {
     v##name<double>(n, a, y); \
   }
 
+#ifdef CAFFE_X86_DISPATCH
+
+#include "caffe/util/cpu_dispatch.hpp"
+
+template <typename Dtype>
+void vExp(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void vLn(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void vPowx(const int n, const Dtype* a, const Dtype b, Dtype* y);
+
+// Float specializations dispatched by cpuid at runtime: AVX2 hosts take
+// the Cephes/SVML-style 8-lane kernels in math_functions_avx2.cpp, so
+// builds without MKL keep up on the transcendental-heavy layers
+// (softmax, sigmoid, power) with one binary for the whole fleet.
+
+template <>
+inline void vExp<float>(const int n, const float* a, float* y) {
+  CHECK_GT(n, 0); CHECK(a); CHECK(y);
+  if (caffe::CaffeCpuHasAVX2()) {
+    caffe::caffe_avx2_exp_ps(n, a, y);
+    return;
+  }
+  for (int i = 0; i < n; ++i) { y[i] = exp(a[i]); }
+}
+
+template <>
+inline void vLn<float>(const int n, const float* a, float* y) {
+  CHECK_GT(n, 0); CHECK(a); CHECK(y);
+  if (caffe::CaffeCpuHasAVX2()) {
+    caffe::caffe_avx2_ln_ps(n, a, y);
+    return;
+  }
+  for (int i = 0; i < n; ++i) { y[i] = log(a[i]); }
+}
+
+template <>
+inline void vPowx<float>(const int n, const float* a, const float b,
+    float* y) {
+  CHECK_GT(n, 0); CHECK(a); CHECK(y);
+  if (caffe::CaffeCpuHasAVX2()) {
+    caffe::caffe_avx2_powx_ps(n, a, b, y);
+    return;
+  }
+  for (int i = 0; i < n; ++i) { y[i] = pow(a[i], b); }
+}
+
+#endif  // CAFFE_X86_DISPATCH
+
 DEFINE_VSL_UNARY_FUNC(Sqr, y[i] = a[i] * a[i]);
+DEFINE_VSL_UNARY_FUNC(Sqrt, y[i] = sqrt(a[i]));
 DEFINE_VSL_UNARY_FUNC(Exp, y[i] = exp(a[i]));
+DEFINE_VSL_UNARY_FUNC(Ln, y[i] = log(a[i]));
 DEFINE_VSL_UNARY_FUNC(Abs, y[i] = fabs(a[i]));
 
 // A simple way to define the vsl unary functions with singular parameter b.
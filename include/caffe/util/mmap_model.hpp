@@ -0,0 +1,107 @@
+#ifndef CAFFE_UTIL_MMAP_MODEL_HPP_
+#define CAFFE_UTIL_MMAP_MODEL_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// A fixed-layout, memory-mappable model container. Unlike a .caffemodel,
+// which must be parsed into heap memory in full before any weight can be
+// read, this format keeps the parameter payloads as raw, page-aligned
+// arrays that a net can use in place: startup only parses the small index,
+// and the payload pages are shared read-only between processes mapping the
+// same file.
+//
+// Layout:
+//   MMapModelHeader
+//   serialized NetParameter index (layer names and blob shapes, no data)
+//   per-blob payloads in layer order, each aligned to kMMapModelAlignment
+const uint32_t kMMapModelMagic = 0x43424d4d;  // "MMBC"
+// Page alignment, so payload pages can be shared across processes.
+const uint32_t kMMapModelAlignment = 4096;
+
+struct MMapModelHeader {
+  uint32_t magic;
+  uint32_t element_size;
+  uint64_t index_size;
+};
+
+// Writes net_param (e.g. read from a .caffemodel) into the container at
+// filename, with float payloads.
+void WriteNetParamsToMMapFile(const NetParameter& net_param,
+    const string& filename);
+
+/**
+ * @brief Read-only mapping of a model container written by
+ *        WriteNetParamsToMMapFile; keeps the mapping alive for as long as
+ *        any net points into it.
+ */
+template <typename Dtype>
+class MMapModel {
+ public:
+  explicit MMapModel(const string& filename);
+  ~MMapModel();
+
+  /// @brief The parsed index: layer names and blob shapes, without data.
+  const NetParameter& index() const { return index_; }
+  /// @brief Payload of the i-th parameter blob, in layer order.
+  Dtype* blob_data(const int i) const;
+
+ private:
+  NetParameter index_;
+  void* mapping_;
+  size_t mapping_size_;
+  vector<size_t> blob_offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(MMapModel);
+};
+
+// The same container idea applied to a SolverState: the scalar fields and
+// history shapes live in a small serialized index, the history payloads in
+// aligned raw sections. Resuming then costs one parse of the index plus a
+// mmap, instead of deserializing every history element; the solver adopts
+// the mapped pages directly and copy-on-write isolates its updates.
+const uint32_t kMMapStateMagic = 0x53424d4d;  // "MMBS"
+
+/// @brief True if the file starts with the solver-state container magic.
+bool IsMMapSolverStateFile(const string& filename);
+
+// Writes state (as filled by SnapshotSolverState) into the container at
+// filename, with float payloads taken from the history blobs.
+void WriteSolverStateToMMapFile(const SolverState& state,
+    const string& filename);
+
+/**
+ * @brief Read-only mapping of a solver-state container written by
+ *        WriteSolverStateToMMapFile; keeps the mapping alive for as long
+ *        as any solver's history points into it.
+ */
+template <typename Dtype>
+class MMapSolverState {
+ public:
+  explicit MMapSolverState(const string& filename);
+  ~MMapSolverState();
+
+  /// @brief The parsed index: iter, learned_net, history shapes, no data.
+  const SolverState& index() const { return index_; }
+  /// @brief Payload of the i-th history blob.
+  Dtype* blob_data(const int i) const;
+
+ private:
+  SolverState index_;
+  void* mapping_;
+  size_t mapping_size_;
+  vector<size_t> blob_offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(MMapSolverState);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MMAP_MODEL_HPP_
@@ -0,0 +1,34 @@
+#ifndef CAFFE_UTIL_NVTX_HPP_
+#define CAFFE_UTIL_NVTX_HPP_
+
+// Optional NVTX range annotations, so nvprof/nvvp timelines show named
+// regions (layer names, solver phases) instead of an undifferentiated
+// kernel soup. Build with USE_NVTX := 1 (links nvToolsExt) to enable;
+// otherwise the macro compiles away entirely.
+//
+// CAFFE_NVTX_RANGE(name) opens a range that closes when the enclosing
+// scope ends; name is a const char*.
+
+#ifdef USE_NVTX
+
+#include <nvToolsExt.h>
+
+namespace caffe {
+
+class NvtxRange {
+ public:
+  explicit NvtxRange(const char* name) { nvtxRangePushA(name); }
+  ~NvtxRange() { nvtxRangePop(); }
+};
+
+}  // namespace caffe
+
+#define CAFFE_NVTX_RANGE(name) ::caffe::NvtxRange nvtx_range_scope(name)
+
+#else
+
+#define CAFFE_NVTX_RANGE(name)
+
+#endif  // USE_NVTX
+
+#endif   // CAFFE_UTIL_NVTX_HPP_
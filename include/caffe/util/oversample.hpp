@@ -0,0 +1,38 @@
+#ifndef _CAFFE_UTIL_OVERSAMPLE_HPP_
+#define _CAFFE_UTIL_OVERSAMPLE_HPP_
+
+namespace caffe {
+
+// Multi-crop ("10-crop") oversampling for accuracy-critical inference.
+// oversample expands each input image into its four corner crops, the
+// center crop and the mirrored version of each, laid out along the batch
+// dimension of the output: image n fills output images [n * 10,
+// n * 10 + 10), unmirrored crops first. oversample_mean averages the
+// per-crop predictions back down to one row per input image. Together
+// they turn 10-crop evaluation into one batched Forward instead of ten
+// separately cropped passes.
+
+// Number of crops oversample produces per input image.
+const int kOversampleCrops = 10;
+
+template <typename Dtype>
+void oversample_cpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int crop_size, Dtype* data_crops);
+
+// predictions holds (num * kOversampleCrops) rows of dim values; means
+// receives num rows, each the mean over the image's crops.
+template <typename Dtype>
+void oversample_mean_cpu(const Dtype* predictions, const int num,
+    const int dim, Dtype* means);
+
+template <typename Dtype>
+void oversample_gpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int crop_size, Dtype* data_crops);
+
+template <typename Dtype>
+void oversample_mean_gpu(const Dtype* predictions, const int num,
+    const int dim, Dtype* means);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_OVERSAMPLE_HPP_
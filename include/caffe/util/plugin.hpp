@@ -0,0 +1,53 @@
+#ifndef CAFFE_UTIL_PLUGIN_H_
+#define CAFFE_UTIL_PLUGIN_H_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+template <typename Dtype> class Layer;
+
+// Registry of layer implementations contributed by shared-object plugins.
+// A plugin .so registers replacements for existing layer types with
+// REGISTER_LAYER_PLUGIN at load time; GetLayer() consults the registry
+// before the built-in factory, so a registered type overrides the
+// compiled-in implementation. Plugins are loaded from the paths in
+// NetParameter.layer_plugin when a net is initialized.
+
+// dlopen a plugin shared object so its registrars run. Paths already
+// loaded by this process are skipped; a failed load is fatal.
+void LoadLayerPlugin(const std::string& path);
+
+// Return a new layer from the plugin registry, or NULL if no plugin has
+// registered this layer type. Instantiated for float and double.
+template <typename Dtype>
+Layer<Dtype>* CreatePluginLayer(const LayerParameter& param);
+
+// Registers a pair of layer creators (one per Dtype) for a layer type;
+// constructed by REGISTER_LAYER_PLUGIN from static initializers, so
+// registration happens as a side effect of dlopen.
+class PluginLayerRegistrar {
+ public:
+  PluginLayerRegistrar(LayerParameter_LayerType type,
+      Layer<float>* (*float_creator)(const LayerParameter&),
+      Layer<double>* (*double_creator)(const LayerParameter&));
+};
+
+}  // namespace caffe
+
+// Place in a plugin translation unit to register ClassName<Dtype> for
+// LayerParameter_LayerType_<type>, e.g.
+//   REGISTER_LAYER_PLUGIN(POOLING, AVXPoolingLayer);
+#define REGISTER_LAYER_PLUGIN(type, ClassName) \
+  template <typename Dtype> \
+  ::caffe::Layer<Dtype>* PluginCreator_##ClassName( \
+      const ::caffe::LayerParameter& param) { \
+    return new ClassName<Dtype>(param); \
+  } \
+  static ::caffe::PluginLayerRegistrar g_plugin_registrar_##ClassName( \
+      ::caffe::LayerParameter_LayerType_##type, \
+      PluginCreator_##ClassName<float>, PluginCreator_##ClassName<double>)
+
+#endif   // CAFFE_UTIL_PLUGIN_H_
@@ -0,0 +1,119 @@
+#ifndef CAFFE_UTIL_RDMA_TRANSPORT_HPP_
+#define CAFFE_UTIL_RDMA_TRANSPORT_HPP_
+
+#ifdef USE_RDMA
+
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+
+namespace caffe {
+
+/**
+ * @brief ParamTransport over InfiniBand/RoCE verbs (rdma://host:port).
+ *
+ * Small messages -- the protocol headers -- travel as eager sends
+ * through a ring of pre-registered bounce buffers. Large payloads are
+ * written directly into the receiver's memory: the sender announces the
+ * transfer, the receiver registers its destination buffer and answers
+ * with its address and remote key, and the sender RDMA-writes into it,
+ * finishing with an immediate so the receiver knows the data landed.
+ * Registrations are cached by (address, size), so the parameter blobs
+ * exchanged every round register once and then move with no host copy
+ * at either end.
+ *
+ * ibv_reg_mr accepts device pointers when the nv_peer_mem module is
+ * loaded, in which case the writes go NIC-to-GPU without touching a
+ * SyncedMemory host buffer (GPUDirect); supports_device_memory() tells
+ * the protocol layer it may hand this transport gpu_data pointers.
+ *
+ * Like the socket transport this carries a byte stream with one caveat:
+ * a Send must not straddle the peer's Recv boundaries (several Sends
+ * per Recv are fine). The parameter-server protocol satisfies this --
+ * the per-blob pushes all land inside the server's one payload Recv.
+ */
+class RdmaTransport : public ParamTransport {
+ public:
+  /// @brief Resolve and connect to a listening peer; used by workers.
+  static shared_ptr<ParamTransport> Connect(const string& host,
+      const int port);
+  /// @brief Adopt a connection-manager id whose connection the caller
+  ///        establishes (see Connect and RdmaListener::Accept).
+  explicit RdmaTransport(struct rdma_cm_id* id, const bool owns_channel);
+  virtual ~RdmaTransport();
+  virtual void Send(const void* data, size_t size);
+  virtual bool Recv(void* data, size_t size);
+  virtual int poll_fd() const { return recv_channel_->fd; }
+  virtual bool supports_device_memory() const { return true; }
+
+ private:
+  /// One cached memory registration; device notes whether the buffer
+  /// lives on the GPU, so eager bytes bound for it go through cudaMemcpy.
+  struct Region {
+    struct ibv_mr* mr;
+    bool device;
+  };
+
+  Region GetRegion(void* addr, size_t size);
+  void PostEagerRecv(const int index);
+  /// @brief Eager-send one control word plus an optional inline payload.
+  void SendEager(const uint32_t kind, const uint64_t bytes,
+      const uint64_t addr, const uint32_t rkey, const void* payload,
+      const size_t payload_size);
+  /// @brief Block until one receive-side completion; false when the
+  ///        queue pair was flushed because the peer disconnected.
+  bool WaitRecvCompletion(struct ibv_wc* wc);
+  void WaitSendCompletion();
+
+  struct rdma_cm_id* id_;
+  const bool owns_channel_;
+  struct ibv_pd* pd_;
+  struct ibv_comp_channel* recv_channel_;
+  struct ibv_cq* send_cq_;
+  struct ibv_cq* recv_cq_;
+  /// The eager ring: kEagerRing recv slots and one send slot, one
+  /// registration for the whole slab.
+  char* eager_slab_;
+  struct ibv_mr* eager_mr_;
+  /// Receive completions drained from the queue ahead of their Recv.
+  std::deque<struct ibv_wc> pending_wc_;
+  std::map<std::pair<uint64_t, size_t>, Region> regions_;
+
+  DISABLE_COPY_AND_ASSIGN(RdmaTransport);
+};
+
+/**
+ * @brief Server-side RDMA listener; the parameter server selects on
+ *        poll_fd() alongside its TCP socket and calls Accept when it
+ *        becomes readable.
+ */
+class RdmaListener {
+ public:
+  explicit RdmaListener(const int port);
+  ~RdmaListener();
+  /// @brief Connection-manager event channel, for select().
+  int poll_fd() const { return channel_->fd; }
+  /// @brief Consume one connection-manager event; returns the accepted
+  ///        transport, or an empty pointer for events that carry no new
+  ///        connection (e.g. ESTABLISHED, DISCONNECTED).
+  shared_ptr<ParamTransport> Accept();
+
+ private:
+  struct rdma_event_channel* channel_;
+  struct rdma_cm_id* listen_id_;
+
+  DISABLE_COPY_AND_ASSIGN(RdmaListener);
+};
+
+}  // namespace caffe
+
+#endif  // USE_RDMA
+
+#endif  // CAFFE_UTIL_RDMA_TRANSPORT_HPP_
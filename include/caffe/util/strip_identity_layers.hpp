@@ -0,0 +1,19 @@
+#ifndef _CAFFE_UTIL_STRIP_IDENTITY_LAYERS_HPP_
+#define _CAFFE_UTIL_STRIP_IDENTITY_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameter with layers that are identities in the test phase
+// removed: Dropout (a pass-through at test time), single-top Split layers,
+// and Power layers with default parameters. Bottoms of later layers are
+// rewired to the stripped layer's bottom blob; the common in-place deploy
+// pattern (e.g. dropout with bottom and top 'fc6') keeps every blob name.
+// Only strips in test-phase nets; otherwise the copy is returned unchanged.
+void StripIdentityLayers(const NetParameter& param,
+    NetParameter* param_stripped);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_STRIP_IDENTITY_LAYERS_HPP_
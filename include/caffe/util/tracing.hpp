@@ -0,0 +1,106 @@
+#ifndef CAFFE_UTIL_TRACING_HPP_
+#define CAFFE_UTIL_TRACING_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Events per thread; the ring wraps, keeping the most recent events.
+const size_t kTraceRingCapacity = 1 << 16;
+
+/**
+ * @brief Collects named, timestamped durations from every thread and writes
+ *        them out as Chrome trace-event JSON (load in about:tracing).
+ *
+ * Each thread appends into its own fixed-size ring, so recording takes no
+ * lock and costs two clock reads plus a store. The resulting timeline shows
+ * the prefetch thread, the solver loop and per-layer work side by side,
+ * which is how pipeline bubbles (e.g. the GPU idling during batch handoff)
+ * become visible.
+ *
+ * Event names are kept as const char* and are not copied; callers must pass
+ * strings that outlive the tracer (string literals and Net::layer_names()
+ * entries qualify).
+ */
+class Tracer {
+ public:
+  static Tracer& Get();
+
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  /// @brief Append one complete event to the calling thread's ring.
+  void RecordEvent(const char* name, uint64_t start_us, uint64_t end_us);
+  /// @brief Microseconds on the shared trace clock.
+  static uint64_t NowMicroseconds();
+
+  /// @brief Write everything recorded so far as Chrome trace-event JSON.
+  void WriteTraceFile(const string& filename);
+  /// @brief Drop all recorded events; thread rings stay registered.
+  void Clear();
+
+ private:
+  Tracer();
+
+  struct TraceEvent {
+    const char* name;
+    uint64_t start_us;
+    uint64_t dur_us;
+  };
+  // One ring per thread, created on the thread's first event and kept for
+  // the life of the process so WriteTraceFile can read it after the thread
+  // has exited (prefetch threads are joined before the solver flushes).
+  struct ThreadBuffer {
+    ThreadBuffer() : tid(0), next(0), wrapped(false) {}
+    int tid;
+    vector<TraceEvent> events;
+    size_t next;
+    bool wrapped;
+  };
+
+  ThreadBuffer* GetThreadBuffer();
+
+  // The mutex and the thread-specific ring pointer live behind this forward
+  // declaration so that this header stays free of boost::thread includes
+  // (see internal_thread.hpp).
+  class sync;
+
+  bool enabled_;
+  vector<ThreadBuffer*> buffers_;
+  shared_ptr<sync> sync_;
+
+  static shared_ptr<Tracer> singleton_;
+
+  DISABLE_COPY_AND_ASSIGN(Tracer);
+};
+
+/// @brief Records the enclosing scope as one trace event, if tracing is on.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name)
+      : name_(name), active_(Tracer::Get().enabled()),
+        start_us_(active_ ? Tracer::NowMicroseconds() : 0) {}
+  ~TraceScope() {
+    if (active_) {
+      Tracer::Get().RecordEvent(name_, start_us_, Tracer::NowMicroseconds());
+    }
+  }
+
+ private:
+  const char* name_;
+  const bool active_;
+  const uint64_t start_us_;
+
+  DISABLE_COPY_AND_ASSIGN(TraceScope);
+};
+
+#define CAFFE_TRACE_SCOPE(name) ::caffe::TraceScope trace_scope(name)
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TRACING_HPP_
@@ -50,6 +50,17 @@ void ReadNetParamsFromTextFileOrDie(const string& param_file,
 void ReadNetParamsFromBinaryFileOrDie(const string& param_file,
                                       NetParameter* param);
 
+// Like ReadNetParamsFromTextFileOrDie, but maintain a compiled binary
+// cache of the upgraded NetParameter at "<param_file>.compiled". When the
+// cache matches the current source text (and compiled-format version),
+// the net is loaded from it directly, skipping the text parse and upgrade
+// scan; otherwise the source is compiled as usual and the cache rewritten
+// (best effort -- an unwritable directory just means no cache). Phase
+// filtering and split insertion stay in Net::Init as they depend on the
+// instantiating NetState.
+void ReadNetParamsFromCompiledCacheOrDie(const string& param_file,
+                                         NetParameter* param);
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_UPGRADE_PROTO_H_
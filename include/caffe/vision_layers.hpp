@@ -1,6 +1,8 @@
 #ifndef CAFFE_VISION_LAYERS_HPP_
 #define CAFFE_VISION_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -64,7 +66,7 @@ class ConvolutionLayer : public Layer<Dtype> {
    *    kernels + stream parallelism) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), col_cache_images_(0), bias_multiplier_(NULL) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -73,6 +75,9 @@ class ConvolutionLayer : public Layer<Dtype> {
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_CONVOLUTION;
   }
+  virtual size_t WorkspaceSize() const;
+  virtual void SetWorkspace(const shared_ptr<SyncedMemory>& data,
+      const shared_ptr<SyncedMemory>& diff);
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
@@ -97,6 +102,13 @@ class ConvolutionLayer : public Layer<Dtype> {
   int num_output_;
   int height_out_, width_out_;
   bool bias_term_;
+  /// For 1x1 stride-1 unpadded filters im2col is the identity, so the
+  /// GEMMs read the input directly and col_buffer_ stays unallocated.
+  bool is_1x1_;
+  /// With group == channels every output channel reads a single input
+  /// channel and the per-group GEMMs degenerate to K = kernel area, so
+  /// forward runs as a direct convolution instead.
+  bool is_depthwise_;
 
   /// M_ is the channel dimension of the output for a single group, which is the
   /// leading dimension of the filter matrix.
@@ -107,8 +119,201 @@ class ConvolutionLayer : public Layer<Dtype> {
   /// N_ is the spatial dimension of the output, the H x W, which are the last
   /// dimensions of the data and filter matrices.
   int N_;
+  /// Output rows unrolled per im2col call. Equal to height_out_ unless
+  /// col_buffer_max_size caps the column buffer, in which case forward
+  /// and backward stream over strips of this many rows.
+  int col_strip_rows_;
   Blob<Dtype> col_buffer_;
-  Blob<Dtype> bias_multiplier_;
+  /// Cache of forward column matrices for backward (see
+  /// col_buffer_cache_size): the first col_cache_images_ images of the
+  /// batch, in bottom-major order, unroll into slots here during forward
+  /// and backward reuses them instead of re-running im2col.
+  Blob<Dtype> col_cache_;
+  int col_cache_images_;
+  /// Shared all-ones blob for adding biases by BLAS, handed out by the
+  /// singleton's constant cache; NULL until Reshape runs with a bias.
+  const Blob<Dtype>* bias_multiplier_;
+  /// Device array of per-group A/B/C pointers for batched GEMM; only
+  /// allocated when group > 1 so all group products go out in one call.
+  shared_ptr<SyncedMemory> gemm_ptrs_;
+
+  /// INT8 inference path (see QuantizationParameter in caffe.proto).
+  /// Weights are quantized once, the first time Forward_cpu runs.
+  void SetUpQuantization();
+  bool quantize_;
+  Dtype input_scale_;
+  Dtype weight_scale_;
+  vector<int8_t> int8_weight_;
+  vector<int8_t> int8_col_;
+  vector<int32_t> int32_top_;
+
+ private:
+  /// @brief Point col_buffer_ at the shared workspace when it fits.
+  void ApplyWorkspace();
+  shared_ptr<SyncedMemory> workspace_data_, workspace_diff_;
+};
+
+/**
+ * @brief Convolution fused with an in-place ReLU rectification (and the
+ *        usual optional bias).
+ *
+ * Computationally equivalent to a CONVOLUTION layer followed by a RELU
+ * layer, but the rectification is applied in place right after the GEMM
+ * (and its derivative is folded into the top diff before the convolution
+ * backward), saving one intermediate blob and one full read-modify-write
+ * pass over the output. The optional negative slope is read from
+ * relu_param, as in ReLULayer.
+ */
+template <typename Dtype>
+class ConvolutionReLULayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit ConvolutionReLULayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_CONVOLUTION_RELU;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+};
+
+/**
+ * @brief Winograd F(2x2,3x3) implementation of ConvolutionLayer
+ *        (engine: WINOGRAD) for 3x3 stride-1 filters.
+ *
+ * Implements the minimal filtering algorithm of Lavin & Gray, "Fast
+ * Algorithms for Convolutional Neural Networks": the input is cut into
+ * 4x4 tiles overlapping by two, tiles and filters are moved into the
+ * Winograd domain, the per-tile products collapse into 16 GEMMs over all
+ * tiles and channels, and each result transforms back to a 2x2 output
+ * patch -- about 2.25x fewer multiplications than im2col+GEMM on these
+ * shapes. The filter transform is cached across forward passes and
+ * invalidated by Backward. Only the CPU forward uses Winograd; GPU
+ * forward and both backwards fall back to the base class.
+ *
+ * With engine AUTOTUNE (in builds without cuDNN) the layer benchmarks the
+ * Winograd and dense CPU forwards for the actual blob shape and keeps the
+ * faster one, caching the choice like the cuDNN autotuner.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), weight_transformed_(false),
+        use_winograd_(true) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// @brief Move the filters into the Winograd domain.
+  void TransformWeights();
+  /**
+   * @brief With engine AUTOTUNE, benchmark the Winograd and dense CPU
+   *        forwards for the current shape and keep the faster one. The
+   *        choice is cached per shape, optionally on disk
+   *        (ConvolutionParameter.autotune_cache).
+   */
+  void AutotuneEngine(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  /// Tile grid covering the output plane; each tile yields a 2x2 patch.
+  int tiles_h_, tiles_w_, num_tiles_;
+  /// Whether weight_wino_ matches the current filter weights.
+  bool weight_transformed_;
+  /// Engine picked by AutotuneEngine; true outside AUTOTUNE.
+  bool use_winograd_;
+  /// Shape key the engine choice was tuned for.
+  string tuned_key_;
+  /// One matrix per Winograd-domain coordinate (and group for the
+  /// filters): filters are (output channels x input channels) per group,
+  /// inputs (input channels x tiles), products (output channels x tiles).
+  Blob<Dtype> weight_wino_;
+  Blob<Dtype> input_wino_;
+  Blob<Dtype> prod_wino_;
+};
+
+/**
+ * @brief Convolves the input in the frequency domain, for large filters.
+ *
+ * Both the input channels and the (reversed, zero-padded) filters are
+ * moved into the frequency domain with a radix-2 FFT over planes padded
+ * to the next power of two, the per-pixel products collapse into one
+ * complex multiply-accumulate per output channel over the group's input
+ * channels, and a single inverse transform per output channel yields the
+ * full correlation, from which the strided output samples are read off.
+ * For an 11x11 conv1 filter this replaces the kernel-area factor in the
+ * im2col+GEMM FLOP count with a few log-sized passes. The FFT plans
+ * (bit-reversal tables and twiddle factors) are cached at Reshape and
+ * the filter transforms across forward passes, invalidated by Backward.
+ * Only the CPU forward uses the FFT; GPU forward and both backwards fall
+ * back to the base class. The transformed filters take
+ * 2 * num_output * (channels / group) * fft_h * fft_w values, so this
+ * engine trades memory for arithmetic.
+ *
+ * With engine AUTOTUNE (in builds without cuDNN) the layer benchmarks the
+ * FFT and dense CPU forwards for the actual blob shape and keeps the
+ * faster one, caching the choice like the cuDNN autotuner.
+ */
+template <typename Dtype>
+class FFTConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit FFTConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), fft_h_(0), fft_w_(0),
+        weight_transformed_(false), use_fft_(true) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// @brief Move the filters into the frequency domain.
+  void TransformWeights();
+  /**
+   * @brief With engine AUTOTUNE, benchmark the FFT and dense CPU
+   *        forwards for the current shape and keep the faster one. The
+   *        choice is cached per shape, optionally on disk
+   *        (ConvolutionParameter.autotune_cache).
+   */
+  void AutotuneEngine(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  /// Transform sizes: input plus filter overhang, padded to powers of two.
+  int fft_h_, fft_w_;
+  /// Whether weight_fft_ matches the current filter weights.
+  bool weight_transformed_;
+  /// Engine picked by AutotuneEngine; true outside AUTOTUNE.
+  bool use_fft_;
+  /// Shape key the engine choice was tuned for.
+  string tuned_key_;
+  /// Cached FFT plans: bit-reversal permutations and twiddle factors for
+  /// the row and column transforms.
+  vector<int> bitrev_h_, bitrev_w_;
+  vector<Dtype> twiddle_h_, twiddle_w_;
+  /// Interleaved-complex fft_h_ x fft_w_ planes: one per filter plane,
+  /// one per input channel, and one accumulator.
+  Blob<Dtype> weight_fft_;
+  Blob<Dtype> input_fft_;
+  Blob<Dtype> accum_fft_;
 };
 
 #ifdef USE_CUDNN
@@ -130,7 +335,7 @@ template <typename Dtype>
 class CuDNNConvolutionLayer : public ConvolutionLayer<Dtype> {
  public:
   explicit CuDNNConvolutionLayer(const LayerParameter& param)
-      : ConvolutionLayer<Dtype>(param) {}
+      : ConvolutionLayer<Dtype>(param), use_caffe_engine_(false) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -142,7 +347,17 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Dtype> {
       vector<Blob<Dtype>*>* top);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  /**
+   * @brief With engine AUTOTUNE, benchmark the CAFFE and cuDNN paths for
+   *        the current shapes and keep the faster; choices are cached per
+   *        shape, optionally on disk (ConvolutionParameter.autotune_cache),
+   *        so repeated launches skip retuning.
+   */
+  void AutotuneEngine(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
+  // Views into the singleton's shared handle/stream pool (one entry per
+  // group and stream), not owned by the layer.
   cudnnHandle_t* handle_;
   cudaStream_t*  stream_;
   vector<cudnnTensor4dDescriptor_t> bottom_descs_, top_descs_;
@@ -150,6 +365,10 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Dtype> {
   cudnnFilterDescriptor_t      filter_desc_;
   vector<cudnnConvolutionDescriptor_t> conv_descs_;
   int bottom_offset_, top_offset_, weight_offset_, bias_offset_;
+  // When autotuning picked the CAFFE kernels for the current shape,
+  // Forward_gpu and Backward_gpu fall through to the base class.
+  bool use_caffe_engine_;
+  string tuned_key_;
 };
 #endif
 
@@ -193,10 +412,6 @@ class Im2colLayer : public Layer<Dtype> {
   int pad_h_, pad_w_;
 };
 
-// Forward declare PoolingLayer and SplitLayer for use in LRNLayer.
-template <typename Dtype> class PoolingLayer;
-template <typename Dtype> class SplitLayer;
-
 /**
  * @brief Normalize the input in a local region across or within feature maps.
  *
@@ -232,13 +447,17 @@ class LRNLayer : public Layer<Dtype> {
       vector<Blob<Dtype>*>* top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
-  virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
+  virtual void WithinChannelForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void WithinChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void CrossChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
-  virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
+  virtual void WithinChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void WithinChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
   int size_;
@@ -250,27 +469,9 @@ class LRNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
-  // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // scale_ stores the per-element normalization denominators computed in
+  // the forward pass, for either normalization region.
   Blob<Dtype> scale_;
-
-  // Fields used for normalization WITHIN_CHANNEL
-  shared_ptr<SplitLayer<Dtype> > split_layer_;
-  vector<Blob<Dtype>*> split_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > square_layer_;
-  Blob<Dtype> square_input_;
-  Blob<Dtype> square_output_;
-  vector<Blob<Dtype>*> square_bottom_vec_;
-  vector<Blob<Dtype>*> square_top_vec_;
-  shared_ptr<PoolingLayer<Dtype> > pool_layer_;
-  Blob<Dtype> pool_output_;
-  vector<Blob<Dtype>*> pool_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > power_layer_;
-  Blob<Dtype> power_output_;
-  vector<Blob<Dtype>*> power_top_vec_;
-  shared_ptr<EltwiseLayer<Dtype> > product_layer_;
-  Blob<Dtype> product_input_;
-  vector<Blob<Dtype>*> product_bottom_vec_;
 };
 
 
@@ -317,6 +518,9 @@ class PoolingLayer : public Layer<Dtype> {
   int channels_;
   int height_, width_;
   int pooled_height_, pooled_width_;
+  /// Pool the whole plane to 1x1; the kernel size follows the bottom
+  /// shape at Reshape and the forward uses flat per-channel reductions.
+  bool global_pooling_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
 };
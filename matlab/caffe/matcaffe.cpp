@@ -96,6 +96,142 @@ static mxArray* do_forward(const mxArray* const bottom) {
   return mx_out;
 }
 
+// Copy one blob into a caller-provided host buffer, from whichever side
+// currently holds the data.
+static void copy_blob_to_buffer(Blob<float>* blob, float* data_ptr) {
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    caffe_copy(blob->count(), blob->cpu_data(), data_ptr);
+    break;
+  case Caffe::GPU:
+    caffe_copy(blob->count(), blob->gpu_data(), data_ptr);
+    break;
+  default:
+    LOG(FATAL) << "Unknown Caffe mode.";
+  }  // switch (Caffe::mode())
+}
+
+// Run one forward pass reading the inputs straight from the caller's host
+// buffers. In CPU mode the input blobs are mapped onto the buffers without
+// copying (the caller must drop the mapping with ReleaseData before the
+// buffers go away); in GPU mode the upload is the single unavoidable copy.
+static void forward_from_ptrs(const vector<const float*>& input_ptrs) {
+  vector<Blob<float>*>& input_blobs = net_->input_blobs();
+  for (unsigned int i = 0; i < input_blobs.size(); ++i) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      input_blobs[i]->set_cpu_data(const_cast<float*>(input_ptrs[i]));
+      break;
+    case Caffe::GPU:
+      caffe_copy(input_blobs[i]->count(), input_ptrs[i],
+          input_blobs[i]->mutable_gpu_data());
+      break;
+    default:
+      LOG(FATAL) << "Unknown Caffe mode.";
+    }  // switch (Caffe::mode())
+  }
+  net_->ForwardPrefilled();
+}
+
+// Give the input blobs their own memory back after forward_from_ptrs; the
+// MATLAB arrays they were mapped onto are reclaimed when the MEX call
+// returns, and a stale pointer would outlive them.
+static void unmap_input_blobs() {
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  vector<Blob<float>*>& input_blobs = net_->input_blobs();
+  for (unsigned int i = 0; i < input_blobs.size(); ++i) {
+    input_blobs[i]->ReleaseData();
+  }
+}
+
+// Like do_forward, but without the input-side copy: the net reads the
+// caller's arrays in place (CPU mode). Outputs still make exactly one copy
+// into freshly allocated mxArrays -- MATLAB owns everything in plhs, so
+// handing it a view of blob memory is not an option.
+static mxArray* do_forward_inplace(const mxArray* const bottom) {
+  vector<Blob<float>*>& input_blobs = net_->input_blobs();
+  CHECK_EQ(static_cast<unsigned int>(mxGetDimensions(bottom)[0]),
+      input_blobs.size());
+  vector<const float*> input_ptrs(input_blobs.size());
+  for (unsigned int i = 0; i < input_blobs.size(); ++i) {
+    const mxArray* const elem = mxGetCell(bottom, i);
+    CHECK(mxIsSingle(elem))
+        << "MatCaffe require single-precision float point data";
+    CHECK_EQ(mxGetNumberOfElements(elem), input_blobs[i]->count())
+        << "MatCaffe input size does not match the input size of the network";
+    input_ptrs[i] = reinterpret_cast<const float*>(mxGetPr(elem));
+  }
+  forward_from_ptrs(input_ptrs);
+  const vector<Blob<float>*>& output_blobs = net_->output_blobs();
+  mxArray* mx_out = mxCreateCellMatrix(output_blobs.size(), 1);
+  for (unsigned int i = 0; i < output_blobs.size(); ++i) {
+    // internally data is stored as (width, height, channels, num)
+    // where width is the fastest dimension
+    mwSize dims[4] = {output_blobs[i]->width(), output_blobs[i]->height(),
+      output_blobs[i]->channels(), output_blobs[i]->num()};
+    mxArray* mx_blob =  mxCreateNumericArray(4, dims, mxSINGLE_CLASS, mxREAL);
+    mxSetCell(mx_out, i, mx_blob);
+    copy_blob_to_buffer(output_blobs[i],
+        reinterpret_cast<float*>(mxGetPr(mx_blob)));
+  }
+  unmap_input_blobs();
+  return mx_out;
+}
+
+// Run several forward passes in one MEX call. Each input carries its
+// passes concatenated along the fourth dimension; the outputs come back
+// the same way, allocated once for the whole batch. This amortizes both
+// the per-call MEX dispatch and the per-pass output allocations, and each
+// pass reads its input slice in place (CPU mode) like do_forward_inplace.
+static mxArray* do_forward_batched(const mxArray* const bottom) {
+  vector<Blob<float>*>& input_blobs = net_->input_blobs();
+  CHECK_EQ(static_cast<unsigned int>(mxGetDimensions(bottom)[0]),
+      input_blobs.size());
+  int num_passes = 0;
+  vector<const float*> input_bases(input_blobs.size());
+  for (unsigned int i = 0; i < input_blobs.size(); ++i) {
+    const mxArray* const elem = mxGetCell(bottom, i);
+    CHECK(mxIsSingle(elem))
+        << "MatCaffe require single-precision float point data";
+    const int count = input_blobs[i]->count();
+    CHECK_EQ(mxGetNumberOfElements(elem) % count, 0)
+        << "MatCaffe batched input must be a whole number of net batches";
+    const int passes = mxGetNumberOfElements(elem) / count;
+    if (i == 0) {
+      num_passes = passes;
+      CHECK_GT(num_passes, 0) << "MatCaffe batched input is empty";
+    } else {
+      CHECK_EQ(passes, num_passes)
+          << "MatCaffe batched inputs disagree on the number of passes";
+    }
+    input_bases[i] = reinterpret_cast<const float*>(mxGetPr(elem));
+  }
+  const vector<Blob<float>*>& output_blobs = net_->output_blobs();
+  mxArray* mx_out = mxCreateCellMatrix(output_blobs.size(), 1);
+  vector<float*> output_bases(output_blobs.size());
+  for (unsigned int i = 0; i < output_blobs.size(); ++i) {
+    mwSize dims[4] = {output_blobs[i]->width(), output_blobs[i]->height(),
+      output_blobs[i]->channels(), output_blobs[i]->num() * num_passes};
+    mxArray* mx_blob =  mxCreateNumericArray(4, dims, mxSINGLE_CLASS, mxREAL);
+    mxSetCell(mx_out, i, mx_blob);
+    output_bases[i] = reinterpret_cast<float*>(mxGetPr(mx_blob));
+  }
+  vector<const float*> input_ptrs(input_blobs.size());
+  for (int pass = 0; pass < num_passes; ++pass) {
+    for (unsigned int i = 0; i < input_blobs.size(); ++i) {
+      input_ptrs[i] = input_bases[i] +
+          static_cast<size_t>(pass) * input_blobs[i]->count();
+    }
+    forward_from_ptrs(input_ptrs);
+    for (unsigned int i = 0; i < output_blobs.size(); ++i) {
+      copy_blob_to_buffer(output_blobs[i], output_bases[i] +
+          static_cast<size_t>(pass) * output_blobs[i]->count());
+    }
+  }
+  unmap_input_blobs();
+  return mx_out;
+}
+
 static mxArray* do_backward(const mxArray* const top_diff) {
   vector<Blob<float>*>& output_blobs = net_->output_blobs();
   vector<Blob<float>*>& input_blobs = net_->input_blobs();
@@ -298,6 +434,24 @@ static void forward(MEX_ARGS) {
   plhs[0] = do_forward(prhs[0]);
 }
 
+static void forward_inplace(MEX_ARGS) {
+  if (nrhs != 1) {
+    LOG(ERROR) << "Only given " << nrhs << " arguments";
+    mexErrMsgTxt("Wrong number of arguments");
+  }
+
+  plhs[0] = do_forward_inplace(prhs[0]);
+}
+
+static void forward_batched(MEX_ARGS) {
+  if (nrhs != 1) {
+    LOG(ERROR) << "Only given " << nrhs << " arguments";
+    mexErrMsgTxt("Wrong number of arguments");
+  }
+
+  plhs[0] = do_forward_batched(prhs[0]);
+}
+
 static void backward(MEX_ARGS) {
   if (nrhs != 1) {
     LOG(ERROR) << "Only given " << nrhs << " arguments";
@@ -351,6 +505,8 @@ struct handler_registry {
 static handler_registry handlers[] = {
   // Public API functions
   { "forward",            forward         },
+  { "forward_inplace",    forward_inplace },
+  { "forward_batched",    forward_batched },
   { "backward",           backward        },
   { "init",               init            },
   { "is_initialized",     is_initialized  },
@@ -138,6 +138,7 @@ PySGDSolver::PySGDSolver(const string& param_file) {
 
 void PySGDSolver::SolveResume(const string& resume_file) {
   CheckFile(resume_file);
+  PyGILRelease release;
   return solver_->Solve(resume_file);
 }
 
@@ -198,6 +199,9 @@ BOOST_PYTHON_MODULE(_caffe) {
   bp::class_<vector<string> >("StringVec")
       .def(bp::vector_indexing_suite<vector<string> >());
 
+  // Forward/Backward/solve release the GIL while they run (PyGILRelease);
+  // make sure the GIL machinery exists before any thread tries to take it.
+  PyEval_InitThreads();
   import_array();
 }
 
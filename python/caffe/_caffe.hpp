@@ -18,6 +18,20 @@ using boost::shared_ptr;
 
 namespace caffe {
 
+// Releases the GIL for the lifetime of the object, so that other Python
+// threads can run (e.g. pre/post-processing for the next request) while a
+// long C++ call is in flight. Only safe around code that never touches
+// Python state, which holds for Net's passes: no layer calls back into
+// the interpreter.
+class PyGILRelease {
+ public:
+  PyGILRelease() : state_(PyEval_SaveThread()) {}
+  ~PyGILRelease() { PyEval_RestoreThread(state_); }
+
+ private:
+  PyThreadState* state_;
+};
+
 // wrap shared_ptr<Blob> in a class that we construct in C++ and pass
 // to Python
 template <typename Dtype>
@@ -96,8 +110,14 @@ class PyNet {
   inline void check_contiguous_array(PyArrayObject* arr, string name,
       int channels, int height, int width);
 
-  void Forward(int start, int end) { net_->ForwardFromTo(start, end); }
-  void Backward(int start, int end) { net_->BackwardFromTo(start, end); }
+  void Forward(int start, int end) {
+    PyGILRelease release;
+    net_->ForwardFromTo(start, end);
+  }
+  void Backward(int start, int end) {
+    PyGILRelease release;
+    net_->BackwardFromTo(start, end);
+  }
   void Reshape() { net_->Reshape(); }
 
   void set_input_arrays(bp::object data_obj, bp::object labels_obj);
@@ -165,7 +185,10 @@ class PySGDSolver {
   explicit PySGDSolver(const string& param_file);
 
   shared_ptr<PyNet> net() { return net_; }
-  void Solve() { return solver_->Solve(); }
+  void Solve() {
+    PyGILRelease release;
+    return solver_->Solve();
+  }
   void SolveResume(const string& resume_file);
 
  protected:
@@ -48,7 +48,11 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
     end: optional name of layer at which to finish the forward pass (inclusive)
 
     Give
-    outs: {blob name: blob ndarray} dict.
+    outs: {blob name: blob ndarray} dict. The arrays are zero-copy views
+          of the net's own blob memory: they cost nothing to return, but
+          the next forward pass overwrites them, so copy() anything you
+          keep. The C++ pass runs with the GIL released, so other threads
+          can pre/post-process concurrently.
     """
     if blobs is None:
         blobs = []
@@ -95,7 +99,9 @@ def _Net_backward(self, diffs=None, start=None, end=None, **kwargs):
     end: optional name of layer at which to finish the backward pass (inclusive)
 
     Give
-    outs: {blob name: diff ndarray} dict.
+    outs: {blob name: diff ndarray} dict. As in forward(), these are
+          zero-copy views into the net's diff memory, overwritten by the
+          next backward pass.
     """
     if diffs is None:
         diffs = []
@@ -0,0 +1,142 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/batching.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class NetBatcher<Dtype>::sync {
+ public:
+  boost::mutex mutex;
+  boost::condition_variable pending;  // wakes the collector: item or stop
+  boost::condition_variable served;   // wakes submitters: batch finished
+};
+
+template <typename Dtype>
+void NetBatcherWorker<Dtype>::InternalThreadEntry() {
+  parent_->CollectorEntry();
+}
+
+template <typename Dtype>
+NetBatcher<Dtype>::NetBatcher(shared_ptr<Net<Dtype> > net,
+    const int max_delay_ms)
+    : net_(net), max_delay_ms_(max_delay_ms), must_stop_(false),
+      batches_run_(0), items_served_(0) {
+  CHECK_EQ(net_->num_inputs(), 1)
+      << "NetBatcher needs a net with a single input blob";
+  CHECK_GE(max_delay_ms_, 0);
+  const Blob<Dtype>* input = net_->input_blobs()[0];
+  max_batch_ = input->num();
+  item_count_ = input->count() / input->num();
+  mode_ = Caffe::mode();
+  device_ = 0;
+  if (mode_ == Caffe::GPU) {
+    CUDA_CHECK(cudaGetDevice(&device_));
+  }
+  sync_.reset(new sync());
+  collector_.reset(new NetBatcherWorker<Dtype>(this));
+  CHECK(collector_->StartInternalThread())
+      << "NetBatcher collector start failed";
+}
+
+template <typename Dtype>
+NetBatcher<Dtype>::~NetBatcher() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    must_stop_ = true;
+    sync_->pending.notify_all();
+  }
+  collector_->WaitForInternalThreadToExit();
+}
+
+template <typename Dtype>
+void NetBatcher<Dtype>::Forward(const Dtype* input,
+    vector<shared_ptr<Blob<Dtype> > >* outputs) {
+  Request request;
+  request.input = input;
+  request.outputs = outputs;
+  request.done = false;
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  CHECK(!must_stop_) << "NetBatcher is shutting down";
+  queue_.push_back(&request);
+  sync_->pending.notify_all();
+  while (!request.done) {
+    sync_->served.wait(lock);
+  }
+}
+
+template <typename Dtype>
+int NetBatcher<Dtype>::queue_depth() {
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  return queue_.size();
+}
+
+template <typename Dtype>
+void NetBatcher<Dtype>::CollectorEntry() {
+  // The Caffe singleton is thread local, so the collector has to match
+  // the mode and device the net was handed over in.
+  Caffe::set_mode(mode_);
+  if (mode_ == Caffe::GPU) {
+    Caffe::SetDevice(device_);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  Blob<Dtype>* input = net_->input_blobs()[0];
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  while (true) {
+    while (queue_.empty() && !must_stop_) {
+      sync_->pending.wait(lock);
+    }
+    if (queue_.empty()) {  // stopping with nothing left to serve
+      return;
+    }
+    // Batch window: launch when the batch is full, when the delay runs
+    // out, or right away when shutting down.
+    const boost::system_time deadline = boost::get_system_time() +
+        boost::posix_time::milliseconds(max_delay_ms_);
+    while (static_cast<int>(queue_.size()) < max_batch_ && !must_stop_ &&
+           sync_->pending.timed_wait(lock, deadline)) {}
+    const int batch = std::min(static_cast<int>(queue_.size()), max_batch_);
+    vector<Request*> taken(queue_.begin(), queue_.begin() + batch);
+    queue_.erase(queue_.begin(), queue_.begin() + batch);
+    Dtype* input_data = input->mutable_cpu_data();
+    for (int i = 0; i < batch; ++i) {
+      caffe_copy(item_count_, taken[i]->input, input_data + i * item_count_);
+    }
+    if (batch < max_batch_) {
+      caffe_set((max_batch_ - batch) * item_count_, Dtype(0),
+          input_data + batch * item_count_);
+    }
+    // The taken requests belong to the collector until done is set, so
+    // the net can run unlocked and new items keep queueing meanwhile.
+    lock.unlock();
+    const vector<Blob<Dtype>*>& result = net_->ForwardPrefilled();
+    for (int i = 0; i < batch; ++i) {
+      vector<shared_ptr<Blob<Dtype> > >* outputs = taken[i]->outputs;
+      outputs->resize(result.size());
+      for (int j = 0; j < result.size(); ++j) {
+        const Blob<Dtype>* out = result[j];
+        const int out_count = out->count() / out->num();
+        (*outputs)[j].reset(new Blob<Dtype>(
+            1, out->channels(), out->height(), out->width()));
+        caffe_copy(out_count, out->cpu_data() + i * out_count,
+            (*outputs)[j]->mutable_cpu_data());
+      }
+    }
+    lock.lock();
+    for (int i = 0; i < batch; ++i) {
+      taken[i]->done = true;
+    }
+    ++batches_run_;
+    items_served_ += batch;
+    sync_->served.notify_all();
+  }
+}
+
+INSTANTIATE_CLASS(NetBatcher);
+INSTANTIATE_CLASS(NetBatcherWorker);
+
+}  // namespace caffe
@@ -0,0 +1,171 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/bench/bench_caffe_main.hpp"
+
+namespace caffe {
+
+static vector<std::pair<std::string, BenchFunction> >* g_benchmarks = NULL;
+static vector<std::pair<std::string, float> >* g_results = NULL;
+
+bool RegisterBenchmark(const char* name, BenchFunction function) {
+  if (g_benchmarks == NULL) {
+    g_benchmarks = new vector<std::pair<std::string, BenchFunction> >();
+  }
+  g_benchmarks->push_back(std::make_pair(std::string(name), function));
+  return true;
+}
+
+void RunAllBenchmarks() {
+  if (g_benchmarks == NULL) { return; }
+  for (int i = 0; i < g_benchmarks->size(); ++i) {
+    (*g_benchmarks)[i].second();
+  }
+}
+
+void ReportBenchmark(const std::string& name, const float ms_per_call,
+    const double flops, const double bytes) {
+  printf("%-48s %10.4f ms", name.c_str(), ms_per_call);
+  if (flops > 0) {
+    printf(" %9.2f GFLOP/s", flops / (ms_per_call * 1e6));
+  }
+  if (bytes > 0) {
+    printf(" %9.2f GB/s", bytes / (ms_per_call * 1e6));
+  }
+  printf("\n");
+  fflush(stdout);
+  if (g_results == NULL) {
+    g_results = new vector<std::pair<std::string, float> >();
+  }
+  g_results->push_back(std::make_pair(name, ms_per_call));
+}
+
+std::string BenchMachineTag() {
+  char hostname[256];
+  if (gethostname(hostname, sizeof(hostname)) != 0) {
+    snprintf(hostname, sizeof(hostname), "unknown");
+  }
+  hostname[sizeof(hostname) - 1] = '\0';
+  return std::string(hostname) +
+      (Caffe::mode() == Caffe::GPU ? " GPU" : " CPU");
+}
+
+static void WriteBaseline(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot write baseline file %s\n", path.c_str());
+    return;
+  }
+  fprintf(file, "# caffe bench baseline\n");
+  fprintf(file, "# machine: %s\n", BenchMachineTag().c_str());
+  for (int i = 0; i < g_results->size(); ++i) {
+    fprintf(file, "%.6f\t%s\n", (*g_results)[i].second,
+        (*g_results)[i].first.c_str());
+  }
+  fclose(file);
+  printf("Recorded baseline for %zu workloads to %s\n",
+      g_results->size(), path.c_str());
+}
+
+int CheckBenchmarkBaseline(const std::string& path, const float threshold) {
+  if (g_results == NULL) { return 0; }
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    WriteBaseline(path);
+    return 0;
+  }
+  // Parse the header and the "ms<tab>name" result lines.
+  std::string tag;
+  vector<std::pair<std::string, float> > baseline;
+  char line[512];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char* newline = strchr(line, '\n');
+    if (newline != NULL) { *newline = '\0'; }
+    if (strncmp(line, "# machine: ", 11) == 0) {
+      tag = line + 11;
+      continue;
+    }
+    if (line[0] == '#' || line[0] == '\0') { continue; }
+    float ms;
+    int name_offset;
+    if (sscanf(line, "%f\t%n", &ms, &name_offset) == 1) {
+      baseline.push_back(std::make_pair(std::string(line + name_offset), ms));
+    }
+  }
+  fclose(file);
+  if (tag != BenchMachineTag()) {
+    printf("Baseline %s is from '%s', this run is '%s'; re-recording\n",
+        path.c_str(), tag.c_str(), BenchMachineTag().c_str());
+    WriteBaseline(path);
+    return 0;
+  }
+  // Report each workload against the baseline; new workloads (with no
+  // baseline entry) pass and older entries that no longer run are ignored.
+  printf("\nComparing against baseline %s (threshold %+.0f%%)\n",
+      path.c_str(), threshold * 100);
+  int regressions = 0;
+  for (int i = 0; i < g_results->size(); ++i) {
+    const std::string& name = (*g_results)[i].first;
+    const float ms = (*g_results)[i].second;
+    float base_ms = 0;
+    for (int j = 0; j < baseline.size(); ++j) {
+      if (baseline[j].first == name) {
+        base_ms = baseline[j].second;
+        break;
+      }
+    }
+    if (base_ms <= 0) {
+      printf("%-48s %10.4f ms  (no baseline)\n", name.c_str(), ms);
+      continue;
+    }
+    const float delta = (ms - base_ms) / base_ms;
+    const bool regressed = delta > threshold;
+    printf("%-48s %10.4f ms %+7.1f%%%s\n", name.c_str(), ms, delta * 100,
+        regressed ? "  REGRESSED" : "");
+    if (regressed) { ++regressions; }
+  }
+  if (regressions > 0) {
+    printf("%d workload(s) regressed beyond %.0f%%\n",
+        regressions, threshold * 100);
+  }
+  fflush(stdout);
+  return regressions;
+}
+
+}  // namespace caffe
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  std::string baseline;
+  float threshold = 0.15;
+  bool gpu = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--baseline=", 11) == 0) {
+      baseline = argv[i] + 11;
+    } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+      threshold = atof(argv[i] + 12);
+    } else {
+      // Use the given device, as the test main does.
+      const int device = atoi(argv[i]);
+      caffe::Caffe::SetDevice(device);
+      caffe::Caffe::set_mode(caffe::Caffe::GPU);
+      printf("Running benchmarks with GPU device %d\n", device);
+      gpu = true;
+    }
+  }
+  if (!gpu) {
+    caffe::Caffe::set_mode(caffe::Caffe::CPU);
+    printf("Running CPU benchmarks; pass a device id to add the GPU ones\n");
+  }
+  caffe::RunAllBenchmarks();
+  if (!baseline.empty()) {
+    return caffe::CheckBenchmarkBaseline(baseline, threshold) > 0;
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <vector>
+
+#include "caffe/bench/bench_caffe_main.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+namespace {
+
+// The input shapes of the convolution layers in our production nets.
+struct Im2colShape { int channels, height, width, kernel, pad, stride; };
+const Im2colShape kIm2colShapes[] = {
+  { 3, 227, 227, 11, 0, 4 },
+  { 96, 27, 27, 5, 2, 1 },
+  { 256, 13, 13, 3, 1, 1 },
+};
+const int kNumIm2colShapes = sizeof(kIm2colShapes) / sizeof(kIm2colShapes[0]);
+
+int ColCount(const Im2colShape& s) {
+  const int height_out = (s.height + 2 * s.pad - s.kernel) / s.stride + 1;
+  const int width_out = (s.width + 2 * s.pad - s.kernel) / s.stride + 1;
+  return s.channels * s.kernel * s.kernel * height_out * width_out;
+}
+
+void BenchIm2colCpu() {
+  for (int i = 0; i < kNumIm2colShapes; ++i) {
+    const Im2colShape& s = kIm2colShapes[i];
+    std::vector<float> im(s.channels * s.height * s.width);
+    std::vector<float> col(ColCount(s));
+    caffe_rng_uniform<float>(im.size(), -1, 1, &im[0]);
+    const int repeats = 20;
+    im2col_cpu(&im[0], s.channels, s.height, s.width, s.kernel, s.kernel,
+        s.pad, s.pad, s.stride, s.stride, &col[0]);
+    Timer timer;
+    timer.Start();
+    for (int r = 0; r < repeats; ++r) {
+      im2col_cpu(&im[0], s.channels, s.height, s.width, s.kernel, s.kernel,
+          s.pad, s.pad, s.stride, s.stride, &col[0]);
+    }
+    timer.Stop();
+    char name[64];
+    snprintf(name, sizeof(name), "im2col_cpu %dx%dx%d k%d s%d",
+        s.channels, s.height, s.width, s.kernel, s.stride);
+    ReportBenchmark(name, timer.MilliSeconds() / repeats, 0,
+        sizeof(float) * (im.size() + col.size()));
+  }
+}
+REGISTER_BENCHMARK(BenchIm2colCpu);
+
+void BenchIm2colGpu() {
+  if (Caffe::mode() != Caffe::GPU) {
+    return;
+  }
+  for (int i = 0; i < kNumIm2colShapes; ++i) {
+    const Im2colShape& s = kIm2colShapes[i];
+    const int im_count = s.channels * s.height * s.width;
+    const int col_count = ColCount(s);
+    SyncedMemory im(im_count * sizeof(float));
+    SyncedMemory col(col_count * sizeof(float));
+    caffe_rng_uniform<float>(im_count, -1, 1,
+        static_cast<float*>(im.mutable_cpu_data()));
+    const float* im_gpu = static_cast<const float*>(im.gpu_data());
+    float* col_gpu = static_cast<float*>(col.mutable_gpu_data());
+    const int repeats = 100;
+    im2col_gpu(im_gpu, s.channels, s.height, s.width, s.kernel, s.kernel,
+        s.pad, s.pad, s.stride, s.stride, col_gpu);
+    // The event-based Timer brackets all the queued kernels and
+    // synchronizes on Stop.
+    Timer timer;
+    timer.Start();
+    for (int r = 0; r < repeats; ++r) {
+      im2col_gpu(im_gpu, s.channels, s.height, s.width, s.kernel, s.kernel,
+          s.pad, s.pad, s.stride, s.stride, col_gpu);
+    }
+    timer.Stop();
+    char name[64];
+    snprintf(name, sizeof(name), "im2col_gpu %dx%dx%d k%d s%d",
+        s.channels, s.height, s.width, s.kernel, s.stride);
+    ReportBenchmark(name, timer.MilliSeconds() / repeats, 0,
+        sizeof(float) * (1.0 * im_count + col_count));
+  }
+}
+REGISTER_BENCHMARK(BenchIm2colGpu);
+
+}  // namespace
+}  // namespace caffe
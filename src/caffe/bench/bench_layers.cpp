@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <vector>
+
+#include "caffe/bench/bench_caffe_main.hpp"
+#include "caffe/blob.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+namespace {
+
+// Times repeated Forward (and optionally Backward) calls of a set-up
+// layer; the first call of each is discarded as warmup. Reports one row
+// per direction so a regression pins down which pass got slower.
+void BenchLayer(const char* name, Layer<float>* layer,
+    vector<Blob<float>*>* bottom, vector<Blob<float>*>* top,
+    const int repeats, const double flops, const bool backward) {
+  layer->SetUp(*bottom, top);
+  layer->Forward(*bottom, top);
+  Timer timer;
+  timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    layer->Forward(*bottom, top);
+  }
+  timer.Stop();
+  char row[64];
+  snprintf(row, sizeof(row), "%s forward", name);
+  ReportBenchmark(row, timer.MilliSeconds() / repeats, flops, 0);
+  if (!backward) { return; }
+  vector<bool> propagate_down(bottom->size(), true);
+  layer->Backward(*top, propagate_down, bottom);
+  timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    layer->Backward(*top, propagate_down, bottom);
+  }
+  timer.Stop();
+  snprintf(row, sizeof(row), "%s backward", name);
+  // Backward computes the bottom and the weight gradients: two GEMMs of
+  // the forward shape.
+  ReportBenchmark(row, timer.MilliSeconds() / repeats, 2 * flops, 0);
+}
+
+void FillUniform(Blob<float>* blob) {
+  FillerParameter filler_param;
+  filler_param.set_min(-1);
+  filler_param.set_max(1);
+  UniformFiller<float> filler(filler_param);
+  filler.Fill(blob);
+}
+
+// The first and a middle convolution of our production nets, at a
+// serving-sized batch.
+void BenchConvolutionLayer() {
+  struct ConvShape {
+    const char* name;
+    int channels, height, width, num_output, kernel, pad, stride;
+  };
+  const ConvShape shapes[] = {
+    { "conv 3x227x227 o96 k11 s4", 3, 227, 227, 96, 11, 0, 4 },
+    { "conv 256x13x13 o384 k3 s1", 256, 13, 13, 384, 3, 1, 1 },
+  };
+  const int num_shapes = sizeof(shapes) / sizeof(shapes[0]);
+  const int num = 8;
+  for (int i = 0; i < num_shapes; ++i) {
+    const ConvShape& s = shapes[i];
+    Blob<float> bottom_blob(num, s.channels, s.height, s.width);
+    Blob<float> top_blob;
+    FillUniform(&bottom_blob);
+    vector<Blob<float>*> bottom(1, &bottom_blob);
+    vector<Blob<float>*> top(1, &top_blob);
+    LayerParameter layer_param;
+    ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+    conv_param->set_num_output(s.num_output);
+    conv_param->set_kernel_size(s.kernel);
+    conv_param->set_pad(s.pad);
+    conv_param->set_stride(s.stride);
+    conv_param->mutable_weight_filler()->set_type("uniform");
+    conv_param->mutable_weight_filler()->set_min(-1);
+    conv_param->mutable_weight_filler()->set_max(1);
+    ConvolutionLayer<float> layer(layer_param);
+    const int height_out = (s.height + 2 * s.pad - s.kernel) / s.stride + 1;
+    const int width_out = (s.width + 2 * s.pad - s.kernel) / s.stride + 1;
+    const double flops = 2.0 * num * s.num_output * height_out * width_out *
+        s.channels * s.kernel * s.kernel;
+    BenchLayer(s.name, &layer, &bottom, &top, 10, flops, true);
+  }
+}
+REGISTER_BENCHMARK(BenchConvolutionLayer);
+
+void BenchPoolingLayer() {
+  const int num = 8;
+  Blob<float> bottom_blob(num, 96, 55, 55);
+  Blob<float> top_blob;
+  FillUniform(&bottom_blob);
+  vector<Blob<float>*> bottom(1, &bottom_blob);
+  vector<Blob<float>*> top(1, &top_blob);
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  PoolingLayer<float> layer(layer_param);
+  BenchLayer("max_pool 96x55x55 k3 s2", &layer, &bottom, &top, 20, 0, false);
+}
+REGISTER_BENCHMARK(BenchPoolingLayer);
+
+void BenchInnerProductLayer() {
+  const int num = 8;
+  Blob<float> bottom_blob(num, 256, 6, 6);
+  Blob<float> top_blob;
+  FillUniform(&bottom_blob);
+  vector<Blob<float>*> bottom(1, &bottom_blob);
+  vector<Blob<float>*> top(1, &top_blob);
+  LayerParameter layer_param;
+  InnerProductParameter* ip_param = layer_param.mutable_inner_product_param();
+  ip_param->set_num_output(4096);
+  ip_param->mutable_weight_filler()->set_type("uniform");
+  ip_param->mutable_weight_filler()->set_min(-1);
+  ip_param->mutable_weight_filler()->set_max(1);
+  InnerProductLayer<float> layer(layer_param);
+  const double flops = 2.0 * num * 4096 * 256 * 6 * 6;
+  BenchLayer("inner_product 9216x4096", &layer, &bottom, &top, 10,
+      flops, true);
+}
+REGISTER_BENCHMARK(BenchInnerProductLayer);
+
+}  // namespace
+}  // namespace caffe
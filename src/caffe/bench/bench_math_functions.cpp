@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <vector>
+
+#include "caffe/bench/bench_caffe_main.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+namespace {
+
+// GEMM shapes from our production nets: the first and a middle im2col
+// convolution GEMM, and a batched classifier inner product.
+struct GemmShape { int m, n, k; };
+const GemmShape kGemmShapes[] = {
+  { 96, 3025, 363 },
+  { 256, 729, 1152 },
+  { 1000, 128, 4096 },
+};
+const int kNumGemmShapes = sizeof(kGemmShapes) / sizeof(kGemmShapes[0]);
+
+void BenchCpuGemm() {
+  for (int s = 0; s < kNumGemmShapes; ++s) {
+    const int m = kGemmShapes[s].m;
+    const int n = kGemmShapes[s].n;
+    const int k = kGemmShapes[s].k;
+    std::vector<float> a(m * k), b(k * n), c(m * n);
+    caffe_rng_uniform<float>(a.size(), -1, 1, &a[0]);
+    caffe_rng_uniform<float>(b.size(), -1, 1, &b[0]);
+    const int repeats = 10;
+    // One unmeasured call warms the caches and the BLAS thread pool.
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.,
+        &a[0], &b[0], 0., &c[0]);
+    Timer timer;
+    timer.Start();
+    for (int r = 0; r < repeats; ++r) {
+      caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.,
+          &a[0], &b[0], 0., &c[0]);
+    }
+    timer.Stop();
+    char name[64];
+    snprintf(name, sizeof(name), "caffe_cpu_gemm %dx%dx%d", m, n, k);
+    ReportBenchmark(name, timer.MilliSeconds() / repeats, 2.0 * m * n * k,
+        sizeof(float) * (1.0 * m * k + 1.0 * k * n + 2.0 * m * n));
+  }
+}
+REGISTER_BENCHMARK(BenchCpuGemm);
+
+void BenchAxpy() {
+  const int count = 1 << 22;
+  std::vector<float> x(count), y(count);
+  caffe_rng_uniform<float>(count, -1, 1, &x[0]);
+  caffe_set(count, 0.f, &y[0]);
+  const int repeats = 100;
+  caffe_axpy<float>(count, 0.5, &x[0], &y[0]);
+  Timer timer;
+  timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    caffe_axpy<float>(count, 0.5, &x[0], &y[0]);
+  }
+  timer.Stop();
+  char name[64];
+  snprintf(name, sizeof(name), "caffe_axpy %d", count);
+  // Reads x and y and writes y back: three streams of count floats.
+  ReportBenchmark(name, timer.MilliSeconds() / repeats, 2.0 * count,
+      3.0 * sizeof(float) * count);
+}
+REGISTER_BENCHMARK(BenchAxpy);
+
+void BenchExp() {
+  const int count = 1 << 22;
+  std::vector<float> x(count), y(count);
+  caffe_rng_uniform<float>(count, -1, 1, &x[0]);
+  const int repeats = 20;
+  caffe_exp<float>(count, &x[0], &y[0]);
+  Timer timer;
+  timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    caffe_exp<float>(count, &x[0], &y[0]);
+  }
+  timer.Stop();
+  char name[64];
+  snprintf(name, sizeof(name), "caffe_exp %d", count);
+  ReportBenchmark(name, timer.MilliSeconds() / repeats, 1.0 * count,
+      2.0 * sizeof(float) * count);
+}
+REGISTER_BENCHMARK(BenchExp);
+
+}  // namespace
+}  // namespace caffe
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "caffe/bench/bench_caffe_main.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+namespace {
+
+// A scaled-down version of our production conv net: one conv/pool stage
+// into a classifier, driven by dummy data so the workload is pure compute.
+// An end-to-end pass catches regressions that live between the layers
+// (blob syncing, net bookkeeping) which the layer workloads cannot see.
+const char* const kBenchNetProto =
+    "name: 'BenchNet' "
+    "layers: { "
+    "  name: 'data' "
+    "  type: DUMMY_DATA "
+    "  dummy_data_param { "
+    "    num: 8 "
+    "    channels: 3 "
+    "    height: 56 "
+    "    width: 56 "
+    "    num: 8 "
+    "    channels: 1 "
+    "    height: 1 "
+    "    width: 1 "
+    "    data_filler { "
+    "      type: 'uniform' "
+    "      min: -1 "
+    "      max: 1 "
+    "    } "
+    "  } "
+    "  top: 'data' "
+    "  top: 'label' "
+    "} "
+    "layers: { "
+    "  name: 'conv1' "
+    "  type: CONVOLUTION "
+    "  convolution_param { "
+    "    num_output: 64 "
+    "    kernel_size: 5 "
+    "    stride: 1 "
+    "    pad: 2 "
+    "    weight_filler { "
+    "      type: 'gaussian' "
+    "      std: 0.01 "
+    "    } "
+    "  } "
+    "  bottom: 'data' "
+    "  top: 'conv1' "
+    "} "
+    "layers: { "
+    "  name: 'relu1' "
+    "  type: RELU "
+    "  bottom: 'conv1' "
+    "  top: 'conv1' "
+    "} "
+    "layers: { "
+    "  name: 'pool1' "
+    "  type: POOLING "
+    "  pooling_param { "
+    "    pool: MAX "
+    "    kernel_size: 3 "
+    "    stride: 2 "
+    "  } "
+    "  bottom: 'conv1' "
+    "  top: 'pool1' "
+    "} "
+    "layers: { "
+    "  name: 'ip1' "
+    "  type: INNER_PRODUCT "
+    "  inner_product_param { "
+    "    num_output: 100 "
+    "    weight_filler { "
+    "      type: 'gaussian' "
+    "      std: 0.01 "
+    "    } "
+    "  } "
+    "  bottom: 'pool1' "
+    "  top: 'ip1' "
+    "} "
+    "layers: { "
+    "  name: 'loss' "
+    "  type: SOFTMAX_LOSS "
+    "  bottom: 'ip1' "
+    "  bottom: 'label' "
+    "  top: 'loss' "
+    "} ";
+
+void BenchNetForwardBackward() {
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(kBenchNetProto, &param));
+  Net<float> net(param);
+  net.ForwardPrefilled();
+  net.Backward();
+  const int repeats = 10;
+  Timer forward_timer;
+  forward_timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    net.ForwardPrefilled();
+  }
+  forward_timer.Stop();
+  ReportBenchmark("bench_net forward",
+      forward_timer.MilliSeconds() / repeats, 0, 0);
+  Timer backward_timer;
+  backward_timer.Start();
+  for (int r = 0; r < repeats; ++r) {
+    net.Backward();
+  }
+  backward_timer.Stop();
+  ReportBenchmark("bench_net backward",
+      backward_timer.MilliSeconds() / repeats, 0, 0);
+}
+REGISTER_BENCHMARK(BenchNetForwardBackward);
+
+}  // namespace
+}  // namespace caffe
@@ -1,6 +1,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -8,15 +9,26 @@ namespace caffe {
 template <typename Dtype>
 void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
     const int width) {
+  ReshapePitched(num, channels, height, width, width);
+}
+
+template <typename Dtype>
+void Blob<Dtype>::ReshapePitched(const int num, const int channels,
+    const int height, const int width, const int pitch) {
   CHECK_GE(num, 0);
   CHECK_GE(channels, 0);
   CHECK_GE(height, 0);
   CHECK_GE(width, 0);
+  CHECK_GE(pitch, width);
   num_ = num;
   channels_ = channels;
   height_ = height;
   width_ = width;
-  count_ = num_ * channels_ * height_ * width_;
+  width_pitch_ = pitch;
+  // count_ covers the padding lanes, so blanket elementwise operations
+  // (Update, asum_*) stay consistent: padding starts at zero and zero
+  // diffs leave it there.
+  count_ = num_ * channels_ * height_ * width_pitch_;
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
@@ -33,7 +45,7 @@ template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : data_compressed_(false), capacity_(0) {
   Reshape(num, channels, height, width);
 }
 
@@ -97,12 +109,64 @@ void Blob<Dtype>::ShareData(const Blob& other) {
   data_ = other.data();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareData(const shared_ptr<SyncedMemory>& data) {
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::ReleaseData() {
+  data_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
+}
+
 template <typename Dtype>
 void Blob<Dtype>::ShareDiff(const Blob& other) {
   CHECK_EQ(count_, other.count());
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDiff(const shared_ptr<SyncedMemory>& diff) {
+  CHECK_GE(diff->size(), count_ * sizeof(Dtype));
+  diff_ = diff;
+}
+
+// Half precision storage only makes sense for the float point types.
+template <> void Blob<unsigned int>::CompressDataToHalf() { NOT_IMPLEMENTED; }
+template <> void Blob<int>::CompressDataToHalf() { NOT_IMPLEMENTED; }
+template <> void Blob<unsigned int>::DecompressDataFromHalf() {
+  NOT_IMPLEMENTED;
+}
+template <> void Blob<int>::DecompressDataFromHalf() { NOT_IMPLEMENTED; }
+
+template <typename Dtype>
+void Blob<Dtype>::CompressDataToHalf() {
+  if (data_compressed_ || count_ == 0) {
+    return;
+  }
+  if (!half_data_ || half_data_->size() < count_ * sizeof(uint16_t)) {
+    half_data_.reset(new SyncedMemory(count_ * sizeof(uint16_t)));
+  }
+  caffe_cpu_convert_to_half(count_, cpu_data(),
+      static_cast<uint16_t*>(half_data_->mutable_cpu_data()));
+  // Dropping the SyncedMemory releases the full precision pages; the
+  // replacement allocates lazily, on decompression at the earliest.
+  data_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
+  data_compressed_ = true;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::DecompressDataFromHalf() {
+  if (!data_compressed_) {
+    return;
+  }
+  caffe_cpu_convert_from_half(count_,
+      static_cast<const uint16_t*>(half_data_->cpu_data()),
+      static_cast<Dtype*>(data_->mutable_cpu_data()));
+  data_compressed_ = false;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -205,6 +269,158 @@ Dtype Blob<Dtype>::asum_diff() const {
   return 0;
 }
 
+template <> unsigned int Blob<unsigned int>::sampled_asum_data(
+    const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <> int Blob<int>::sampled_asum_data(const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <typename Dtype>
+Dtype Blob<Dtype>::sampled_asum_data(const int stride) const {
+  CHECK_GE(stride, 1);
+  if (!data_) { return 0; }
+  const int sample = (count_ + stride - 1) / stride;
+  switch (data_->head()) {
+  case SyncedMemory::HEAD_AT_CPU:
+    return caffe_cpu_strided_asum(sample, cpu_data(), stride);
+  case SyncedMemory::HEAD_AT_GPU:
+  case SyncedMemory::SYNCED:
+#ifndef CPU_ONLY
+  {
+    Dtype asum;
+    caffe_gpu_strided_asum(sample, gpu_data(), stride, &asum);
+    return asum;
+  }
+#else
+    NO_GPU;
+#endif
+  case SyncedMemory::UNINITIALIZED:
+    return 0;
+  default:
+    LOG(FATAL) << "Unknown SyncedMemory head state: " << data_->head();
+  }
+  return 0;
+}
+
+template <> unsigned int Blob<unsigned int>::sampled_asum_diff(
+    const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <> int Blob<int>::sampled_asum_diff(const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <typename Dtype>
+Dtype Blob<Dtype>::sampled_asum_diff(const int stride) const {
+  CHECK_GE(stride, 1);
+  if (!diff_) { return 0; }
+  const int sample = (count_ + stride - 1) / stride;
+  switch (diff_->head()) {
+  case SyncedMemory::HEAD_AT_CPU:
+    return caffe_cpu_strided_asum(sample, cpu_diff(), stride);
+  case SyncedMemory::HEAD_AT_GPU:
+  case SyncedMemory::SYNCED:
+#ifndef CPU_ONLY
+  {
+    Dtype asum;
+    caffe_gpu_strided_asum(sample, gpu_diff(), stride, &asum);
+    return asum;
+  }
+#else
+    NO_GPU;
+#endif
+  case SyncedMemory::UNINITIALIZED:
+    return 0;
+  default:
+    LOG(FATAL) << "Unknown SyncedMemory head state: " << diff_->head();
+  }
+  return 0;
+}
+
+template <> unsigned int Blob<unsigned int>::sampled_amax_data(
+    const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <> int Blob<int>::sampled_amax_data(const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <typename Dtype>
+Dtype Blob<Dtype>::sampled_amax_data(const int stride) const {
+  CHECK_GE(stride, 1);
+  if (!data_) { return 0; }
+  const int sample = (count_ + stride - 1) / stride;
+  switch (data_->head()) {
+  case SyncedMemory::HEAD_AT_CPU:
+    return caffe_cpu_strided_amax(sample, cpu_data(), stride);
+  case SyncedMemory::HEAD_AT_GPU:
+  case SyncedMemory::SYNCED:
+#ifndef CPU_ONLY
+  {
+    Dtype amax;
+    caffe_gpu_strided_amax(sample, gpu_data(), stride, &amax);
+    return amax;
+  }
+#else
+    NO_GPU;
+#endif
+  case SyncedMemory::UNINITIALIZED:
+    return 0;
+  default:
+    LOG(FATAL) << "Unknown SyncedMemory head state: " << data_->head();
+  }
+  return 0;
+}
+
+template <> unsigned int Blob<unsigned int>::sampled_amax_diff(
+    const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <> int Blob<int>::sampled_amax_diff(const int stride) const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+template <typename Dtype>
+Dtype Blob<Dtype>::sampled_amax_diff(const int stride) const {
+  CHECK_GE(stride, 1);
+  if (!diff_) { return 0; }
+  const int sample = (count_ + stride - 1) / stride;
+  switch (diff_->head()) {
+  case SyncedMemory::HEAD_AT_CPU:
+    return caffe_cpu_strided_amax(sample, cpu_diff(), stride);
+  case SyncedMemory::HEAD_AT_GPU:
+  case SyncedMemory::SYNCED:
+#ifndef CPU_ONLY
+  {
+    Dtype amax;
+    caffe_gpu_strided_amax(sample, gpu_diff(), stride, &amax);
+    return amax;
+  }
+#else
+    NO_GPU;
+#endif
+  case SyncedMemory::UNINITIALIZED:
+    return 0;
+  default:
+    LOG(FATAL) << "Unknown SyncedMemory head state: " << diff_->head();
+  }
+  return 0;
+}
+
 template <typename Dtype>
 void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   if (num_ != source.num() || channels_ != source.channels() ||
@@ -215,6 +431,9 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
       LOG(FATAL) << "Trying to copy blobs of different sizes.";
     }
   }
+  // A flat copy of count_ elements only lines up if the rows do.
+  CHECK_EQ(width_pitch_, source.width_pitch())
+      << "Trying to copy blobs of different row pitches.";
   switch (Caffe::mode()) {
   case Caffe::GPU:
     if (copy_diff) {
@@ -239,15 +458,49 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   }
 }
 
+// Bulk-copies a raw snapshot field into the blob. The bytes hold the
+// writing net's element type, recovered from the byte count, so a float
+// net can restore a double snapshot and vice versa.
+template <typename Dtype>
+static void CopyRawToBlob(const string& raw, const int count, Dtype* out) {
+  if (raw.size() == count * sizeof(uint16_t)) {
+    // A two-byte element can only be a half payload (see ToProto's
+    // write_half); up-convert transparently.
+    caffe_cpu_convert_from_half(count,
+        reinterpret_cast<const uint16_t*>(raw.data()), out);
+  } else if (raw.size() == count * sizeof(Dtype)) {
+    caffe_copy(count, reinterpret_cast<const Dtype*>(raw.data()), out);
+  } else if (raw.size() == count * sizeof(float)) {
+    const float* in = reinterpret_cast<const float*>(raw.data());
+    for (int i = 0; i < count; ++i) {
+      out[i] = in[i];
+    }
+  } else if (raw.size() == count * sizeof(double)) {
+    const double* in = reinterpret_cast<const double*>(raw.data());
+    for (int i = 0; i < count; ++i) {
+      out[i] = in[i];
+    }
+  } else {
+    LOG(FATAL) << "Incorrect raw field size " << raw.size() << " for "
+        << count << " elements";
+  }
+}
+
 template <typename Dtype>
 void Blob<Dtype>::FromProto(const BlobProto& proto) {
   Reshape(proto.num(), proto.channels(), proto.height(), proto.width());
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    data_vec[i] = proto.data(i);
+  if (proto.has_raw_data()) {
+    CopyRawToBlob(proto.raw_data(), count_, data_vec);
+  } else {
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = proto.data(i);
+    }
   }
-  if (proto.diff_size() > 0) {
+  if (proto.has_raw_diff()) {
+    CopyRawToBlob(proto.raw_diff(), count_, mutable_cpu_diff());
+  } else if (proto.diff_size() > 0) {
     Dtype* diff_vec = mutable_cpu_diff();
     for (int i = 0; i < count_; ++i) {
       diff_vec[i] = proto.diff(i);
@@ -256,22 +509,32 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
 }
 
 template <typename Dtype>
-void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
+void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff,
+    bool write_half) const {
+  CHECK(!has_pitch()) << "Pitched blobs cannot be serialized.";
   proto->set_num(num_);
   proto->set_channels(channels_);
   proto->set_height(height_);
   proto->set_width(width_);
   proto->clear_data();
   proto->clear_diff();
+  proto->clear_raw_diff();
+  // One bulk copy instead of an add_data call per element. FromProto
+  // accepts both representations, so snapshots that predate the raw
+  // fields still load.
   const Dtype* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
+  if (write_half) {
+    // Half the payload at half-precision rounding; the diff below stays
+    // full precision (see the declaration).
+    vector<uint16_t> half_vec(count_ > 0 ? count_ : 1);
+    caffe_cpu_convert_to_half(count_, data_vec, &half_vec[0]);
+    proto->set_raw_data(&half_vec[0], count_ * sizeof(uint16_t));
+  } else {
+    proto->set_raw_data(data_vec, count_ * sizeof(Dtype));
   }
   if (write_diff) {
     const Dtype* diff_vec = cpu_diff();
-    for (int i = 0; i < count_; ++i) {
-      proto->add_diff(diff_vec[i]);
-    }
+    proto->set_raw_diff(diff_vec, count_ * sizeof(Dtype));
   }
 }
 
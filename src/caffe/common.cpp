@@ -1,13 +1,34 @@
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include <glog/logging.h>
+#ifdef USE_NUMA
+#include <numa.h>
+#endif
+
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <ctime>
+#include <map>
+#include <utility>
 
+#include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
-shared_ptr<Caffe> Caffe::singleton_;
+// Make sure each thread can have different values.
+static boost::thread_specific_ptr<Caffe> thread_instance_;
+
+Caffe& Caffe::Get() {
+  if (!thread_instance_.get()) {
+    thread_instance_.reset(new Caffe());
+  }
+  return *(thread_instance_.get());
+}
 
 // random seeding
 int64_t cluster_seedgen(void) {
@@ -37,14 +58,234 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InitGoogleLogging(*(pargv)[0]);
 }
 
+// Process-wide NUMA node preference (-1: unset). Written once up front by
+// SetNumaNode and read by threads started afterwards.
+static int numa_node_ = -1;
+
+void Caffe::SetNumaNode(const int node) {
+  numa_node_ = node;
+  PinToNumaNode();
+}
+
+int Caffe::numa_node() {
+  return numa_node_;
+}
+
+void Caffe::PinToNumaNode() {
+  if (numa_node_ < 0) {
+    return;
+  }
+#ifdef USE_NUMA
+  if (numa_available() < 0) {
+    LOG(WARNING) << "Kernel reports no NUMA support; thread not pinned.";
+    return;
+  }
+  CHECK_LE(numa_node_, numa_max_node())
+      << "No such NUMA node: " << numa_node_;
+  if (numa_run_on_node(numa_node_) != 0) {
+    LOG(WARNING) << "Could not pin thread to NUMA node " << numa_node_;
+  }
+  // First-touch pages allocated by this thread now come from the node's
+  // memory, so CaffeMallocHost buffers are node-local automatically.
+  numa_set_preferred(numa_node_);
+#else
+  LOG(WARNING) << "SetNumaNode has no effect without a USE_NUMA build.";
+#endif
+}
+
+void Caffe::LogNumaStats() {
+  for (int node = 0; ; ++node) {
+    ostringstream path;
+    path << "/sys/devices/system/node/node" << node << "/numastat";
+    std::ifstream file(path.str().c_str());
+    if (!file) {
+      break;
+    }
+    string name;
+    unsigned long long value;  // NOLINT(runtime/int)
+    ostringstream stats;
+    while (file >> name >> value) {
+      stats << " " << name << "=" << value;
+    }
+    LOG(INFO) << "NUMA node " << node << stats.str();
+  }
+}
+
+// Thread-budget coordinator state (process-wide; see common.hpp). The
+// decode count is read by the prefetch threads every batch, hence the
+// mutex.
+static boost::mutex thread_budget_mutex_;
+static int thread_budget_ = 0;
+static int blas_threads_ = 0;
+static int decode_threads_ = 0;
+// Hill-climb state: the direction of the last shift (+1 moved a thread
+// to decode, -1 back to BLAS) and the throughput of the window that
+// prompted it.
+static int last_shift_ = 0;
+static double last_images_per_second_ = 0;
+
+// Runtime BLAS thread control. MKL and OpenBLAS both take a runtime
+// thread count; the OpenBLAS entry point is declared weak so ATLAS
+// builds (whose pool is fixed at build time) still link, with the
+// coordinator then only steering the decode side.
+#ifdef USE_MKL
+extern "C" void mkl_set_num_threads(int num_threads);
+#else
+extern "C" void openblas_set_num_threads(int num_threads)
+    __attribute__((weak));
+#endif
+
+static void ApplyBlasThreads(const int num_threads) {
+#ifdef USE_MKL
+  mkl_set_num_threads(num_threads);
+#else
+  if (openblas_set_num_threads != NULL) {
+    openblas_set_num_threads(num_threads);
+  }
+#endif
+}
+
+void Caffe::SetThreadBudget(const int budget) {
+  boost::mutex::scoped_lock lock(thread_budget_mutex_);
+  int cores = budget;
+  if (cores <= 0) {
+    cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  }
+  CHECK_GE(cores, 2) << "The thread budget needs at least two threads";
+  thread_budget_ = cores;
+  // Start compute-heavy: most models are GEMM-bound, and the balancer
+  // hands threads back to decode within a few windows when they are not.
+  decode_threads_ = std::max(1, cores / 4);
+  blas_threads_ = cores - decode_threads_;
+  last_shift_ = 0;
+  last_images_per_second_ = 0;
+  ApplyBlasThreads(blas_threads_);
+  LOG(INFO) << "Thread budget: " << cores << " cores (" << blas_threads_
+      << " BLAS, " << decode_threads_ << " decode).";
+}
+
+int Caffe::blas_threads() {
+  boost::mutex::scoped_lock lock(thread_budget_mutex_);
+  return blas_threads_;
+}
+
+int Caffe::decode_threads() {
+  boost::mutex::scoped_lock lock(thread_budget_mutex_);
+  return decode_threads_;
+}
+
+void Caffe::BalanceThreads(const double data_wait_fraction,
+    const double images_per_second) {
+  boost::mutex::scoped_lock lock(thread_budget_mutex_);
+  if (thread_budget_ == 0) {
+    return;
+  }
+  // A shift that cost throughput gets taken back: keeping it would walk
+  // away from the plateau the climb is looking for.
+  if (last_shift_ != 0 && last_images_per_second_ > 0 &&
+      images_per_second < 0.98 * last_images_per_second_) {
+    blas_threads_ += last_shift_;
+    decode_threads_ -= last_shift_;
+    ApplyBlasThreads(blas_threads_);
+    LOG(INFO) << "Thread budget: reverted to " << blas_threads_
+        << " BLAS, " << decode_threads_ << " decode (images/s dropped to "
+        << images_per_second << ").";
+    last_shift_ = 0;
+    last_images_per_second_ = images_per_second;
+    return;
+  }
+  // The dead band between the thresholds is the plateau: once the
+  // forwards neither starve for data nor leave the decoders idle, the
+  // split stops moving.
+  int shift = 0;
+  if (data_wait_fraction > 0.10 && blas_threads_ > 1) {
+    shift = 1;  // the forwards starve for data: feed the decoders
+  } else if (data_wait_fraction < 0.02 && decode_threads_ > 1) {
+    shift = -1;  // data keeps up comfortably: give compute the thread
+  }
+  if (shift != 0) {
+    blas_threads_ -= shift;
+    decode_threads_ += shift;
+    ApplyBlasThreads(blas_threads_);
+    LOG(INFO) << "Thread budget: " << blas_threads_ << " BLAS, "
+        << decode_threads_ << " decode (data_wait="
+        << data_wait_fraction << ").";
+  }
+  last_shift_ = shift;
+  last_images_per_second_ = images_per_second;
+}
+
+// Process-wide master random seed that per-thread RNG streams derive from
+// (-1: not set yet). Worker threads read it while starting up, hence the
+// mutex.
+static boost::mutex random_seed_mutex_;
+static int64_t random_seed_ = -1;
+
+unsigned int Caffe::random_seed() {
+  boost::mutex::scoped_lock lock(random_seed_mutex_);
+  if (random_seed_ < 0) {
+    random_seed_ = static_cast<unsigned int>(cluster_seedgen());
+  }
+  return static_cast<unsigned int>(random_seed_);
+}
+
+unsigned int Caffe::rng_stream_seed(const unsigned int stream_id) {
+  // Knuth's multiplicative hash spreads consecutive ids over the seed
+  // space; the + 1 keeps every stream distinct from the master stream.
+  return random_seed() ^ ((stream_id + 1) * 2654435761U);
+}
+
+void Caffe::set_rng_stream(const unsigned int stream_id) {
+  Get().random_generator_.reset(new RNG(rng_stream_seed(stream_id)));
+}
+
+template <typename Dtype>
+const Blob<Dtype>& Caffe::ones(const int count) {
+  CHECK_GT(count, 0);
+  shared_ptr<void>& cached =
+      Get().ones_blobs_[sizeof(Dtype) == sizeof(double)][count];
+  if (!cached) {
+    Blob<Dtype>* blob = new Blob<Dtype>(1, 1, 1, count);
+    caffe_set(count, Dtype(1), blob->mutable_cpu_data());
+    cached.reset(blob);
+  }
+  return *static_cast<Blob<Dtype>*>(cached.get());
+}
+
+template <typename Dtype>
+const Blob<Dtype>& Caffe::zeros(const int count) {
+  CHECK_GT(count, 0);
+  shared_ptr<void>& cached =
+      Get().zeros_blobs_[sizeof(Dtype) == sizeof(double)][count];
+  if (!cached) {
+    // No fill: SyncedMemory zero-fills on first access, so the zeros
+    // materialize directly on whichever side reads them first.
+    cached.reset(new Blob<Dtype>(1, 1, 1, count));
+  }
+  return *static_cast<Blob<Dtype>*>(cached.get());
+}
+
+template const Blob<float>& Caffe::ones<float>(const int count);
+template const Blob<double>& Caffe::ones<double>(const int count);
+template const Blob<float>& Caffe::zeros<float>(const int count);
+template const Blob<double>& Caffe::zeros<double>(const int count);
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
+    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN),
+    memory_pool_enabled_(false), huge_pages_enabled_(false),
+    fast_math_(false), fast_math_verify_(false),
+    poison_skipped_fills_(false), hot_region_depth_(0) { }
 
 Caffe::~Caffe() { }
 
 void Caffe::set_random_seed(const unsigned int seed) {
+  // Record the master seed that derived per-thread streams start from.
+  {
+    boost::mutex::scoped_lock lock(random_seed_mutex_);
+    random_seed_ = seed;
+  }
   // RNG seed
   Get().random_generator_.reset(new RNG(seed));
 }
@@ -83,19 +324,56 @@ void* Caffe::RNG::generator() {
 #else  // Normal GPU + CPU Caffe.
 
 Caffe::Caffe()
-    : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), phase_(Caffe::TRAIN) {
+    : cublas_handle_(NULL), curand_generator_(NULL), cuda_stream_(NULL),
+    cublas_tried_(false), curand_tried_(false), cuda_stream_tried_(false),
+    random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN),
+    memory_pool_enabled_(false), huge_pages_enabled_(false),
+    fast_math_(false), fast_math_verify_(false),
+    poison_skipped_fills_(false), hot_region_depth_(0) {
+  // Deliberately does not touch the device: the first CUDA call brings
+  // up the driver context, which takes seconds, so handle creation is
+  // deferred to the accessors (InitCudaStream and friends below) and
+  // CPU-mode runs never pay for it.
+}
+
+void Caffe::InitCudaStream() {
+  Get().cuda_stream_tried_ = true;
+  // Give this thread its own stream, so Nets running concurrently in
+  // different threads do not serialize their cublas/curand work on the
+  // default stream. Created as a (legacy-)blocking stream, so kernels
+  // still launched on the default stream order correctly against it.
+  if (cudaStreamCreate(&Get().cuda_stream_) != cudaSuccess) {
+    LOG(ERROR) << "Cannot create CUDA stream. Using the default stream.";
+    Get().cuda_stream_ = NULL;
+  }
+}
+
+void Caffe::InitCublas() {
+  Get().cublas_tried_ = true;
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
-  if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
+  if (cublasCreate(&Get().cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
     LOG(ERROR) << "Cannot create Cublas handle. Cublas won't be available.";
+    Get().cublas_handle_ = NULL;
+  } else if (cuda_stream()) {
+    CUBLAS_CHECK(cublasSetStream(Get().cublas_handle_, Get().cuda_stream_));
   }
-  // Try to create a curand handler.
-  if (curandCreateGenerator(&curand_generator_, CURAND_RNG_PSEUDO_DEFAULT)
-      != CURAND_STATUS_SUCCESS ||
-      curandSetPseudoRandomGeneratorSeed(curand_generator_, cluster_seedgen())
-      != CURAND_STATUS_SUCCESS) {
+}
+
+void Caffe::InitCurand() {
+  Get().curand_tried_ = true;
+  // Try to create a curand handler. Seeding happens here rather than at
+  // startup: random_seed() returns whatever set_random_seed recorded
+  // earlier, or draws a fresh seed, so a seed set before the generator
+  // existed still takes effect.
+  if (curandCreateGenerator(&Get().curand_generator_,
+      CURAND_RNG_PSEUDO_DEFAULT) != CURAND_STATUS_SUCCESS ||
+      curandSetPseudoRandomGeneratorSeed(Get().curand_generator_,
+      random_seed()) != CURAND_STATUS_SUCCESS) {
     LOG(ERROR) << "Cannot create Curand generator. Curand won't be available.";
+    Get().curand_generator_ = NULL;
+  } else if (cuda_stream()) {
+    CURAND_CHECK(curandSetStream(Get().curand_generator_, Get().cuda_stream_));
   }
 }
 
@@ -104,16 +382,53 @@ Caffe::~Caffe() {
   if (curand_generator_) {
     CURAND_CHECK(curandDestroyGenerator(curand_generator_));
   }
+  if (cuda_stream_) CUDA_CHECK(cudaStreamDestroy(cuda_stream_));
+#ifdef USE_CUDNN
+  for (int i = 0; i < cudnn_handles_.size(); ++i) {
+    cudnnDestroy(cudnn_handles_[i]);
+    cudaStreamDestroy(cudnn_streams_[i]);
+  }
+#endif
+}
+
+#ifdef USE_CUDNN
+cudnnHandle_t Caffe::cudnn_handle(const int index) {
+  CHECK_GE(index, 0);
+  vector<cudnnHandle_t>& handles = Get().cudnn_handles_;
+  vector<cudaStream_t>& streams = Get().cudnn_streams_;
+  while (static_cast<int>(handles.size()) <= index) {
+    cudaStream_t stream;
+    cudnnHandle_t handle;
+    CUDA_CHECK(cudaStreamCreate(&stream));
+    CUDNN_CHECK(cudnnCreate(&handle));
+    CUDNN_CHECK(cudnnSetStream(handle, stream));
+    streams.push_back(stream);
+    handles.push_back(handle);
+  }
+  return handles[index];
 }
 
+cudaStream_t Caffe::cudnn_stream(const int index) {
+  cudnn_handle(index);  // Grow the pool if needed.
+  return Get().cudnn_streams_[index];
+}
+#endif
+
 void Caffe::set_random_seed(const unsigned int seed) {
-  // Curand seed
+  // Record the master seed that derived per-thread streams start from.
+  {
+    boost::mutex::scoped_lock lock(random_seed_mutex_);
+    random_seed_ = seed;
+  }
+  // Curand seed. A generator that has not been created yet is left
+  // alone: it picks the recorded master seed up in InitCurand when (and
+  // if) something first asks for it.
   static bool g_curand_availability_logged = false;
   if (Get().curand_generator_) {
     CURAND_CHECK(curandSetPseudoRandomGeneratorSeed(curand_generator(),
         seed));
     CURAND_CHECK(curandSetGeneratorOffset(curand_generator(), 0));
-  } else {
+  } else if (Get().curand_tried_) {
     if (!g_curand_availability_logged) {
         LOG(ERROR) <<
             "Curand not available. Skipping setting the curand seed.";
@@ -130,6 +445,23 @@ void Caffe::SetDevice(const int device_id) {
   if (current_device == device_id) {
     return;
   }
+  // The cached constant blobs hold memory on the old device; drop them
+  // while its context is still current. The handles the Get here may
+  // initialize are torn down and rebuilt below anyway.
+  for (int i = 0; i < 2; ++i) {
+    Get().ones_blobs_[i].clear();
+    Get().zeros_blobs_[i].clear();
+  }
+#ifdef USE_CUDNN
+  // The pooled cuDNN handles are likewise bound to the old device; the
+  // pool regrows lazily against the new one.
+  for (int i = 0; i < Get().cudnn_handles_.size(); ++i) {
+    CUDNN_CHECK(cudnnDestroy(Get().cudnn_handles_[i]));
+    CUDA_CHECK(cudaStreamDestroy(Get().cudnn_streams_[i]));
+  }
+  Get().cudnn_handles_.clear();
+  Get().cudnn_streams_.clear();
+#endif
   // The call to cudaSetDevice must come before any calls to Get, which
   // may perform initialization using the GPU.
   CUDA_CHECK(cudaSetDevice(device_id));
@@ -137,11 +469,16 @@ void Caffe::SetDevice(const int device_id) {
   if (Get().curand_generator_) {
     CURAND_CHECK(curandDestroyGenerator(Get().curand_generator_));
   }
-  CUBLAS_CHECK(cublasCreate(&Get().cublas_handle_));
-  CURAND_CHECK(curandCreateGenerator(&Get().curand_generator_,
-      CURAND_RNG_PSEUDO_DEFAULT));
-  CURAND_CHECK(curandSetPseudoRandomGeneratorSeed(Get().curand_generator_,
-      cluster_seedgen()));
+  if (Get().cuda_stream_) CUDA_CHECK(cudaStreamDestroy(Get().cuda_stream_));
+  // Do not recreate anything here: resetting the tried flags makes the
+  // lazy accessors rebuild each handle against the new device on first
+  // use, and never if it goes unused.
+  Get().cublas_handle_ = NULL;
+  Get().curand_generator_ = NULL;
+  Get().cuda_stream_ = NULL;
+  Get().cublas_tried_ = false;
+  Get().curand_tried_ = false;
+  Get().cuda_stream_tried_ = false;
 }
 
 void Caffe::DeviceQuery() {
@@ -179,6 +516,93 @@ void Caffe::DeviceQuery() {
   return;
 }
 
+// Launch bounds cached by CaffeMaxGridDim and CaffeQueryLaunchConfig.
+// Kernels and devices are few, so mutex-guarded maps are plenty.
+static boost::mutex launch_config_mutex_;
+// device -> maxGridSize[0]
+static std::map<int, int> max_grid_dim_;
+// (kernel, device) -> chosen block size, with the grid cap (the number
+// of blocks the device can keep resident) stored in the blocks field.
+static std::map<std::pair<const void*, int>, CaffeLaunchConfig>
+    launch_bounds_;
+
+int CaffeMaxGridDim() {
+  int device;
+  CUDA_CHECK(cudaGetDevice(&device));
+  boost::mutex::scoped_lock lock(launch_config_mutex_);
+  std::map<int, int>::const_iterator it = max_grid_dim_.find(device);
+  if (it != max_grid_dim_.end()) {
+    return it->second;
+  }
+  cudaDeviceProp prop;
+  CUDA_CHECK(cudaGetDeviceProperties(&prop, device));
+  max_grid_dim_[device] = prop.maxGridSize[0];
+  return prop.maxGridSize[0];
+}
+
+CaffeLaunchConfig CaffeQueryLaunchConfig(const void* kernel, const int n) {
+  int device;
+  CUDA_CHECK(cudaGetDevice(&device));
+  const std::pair<const void*, int> key = std::make_pair(kernel, device);
+  CaffeLaunchConfig bounds;
+  bool cached = false;
+  {
+    boost::mutex::scoped_lock lock(launch_config_mutex_);
+    std::map<std::pair<const void*, int>, CaffeLaunchConfig>::const_iterator
+        it = launch_bounds_.find(key);
+    if (it != launch_bounds_.end()) {
+      bounds = it->second;
+      cached = true;
+    }
+  }
+  if (!cached) {
+    cudaDeviceProp prop;
+    CUDA_CHECK(cudaGetDeviceProperties(&prop, device));
+    // Fallback if the occupancy calculator is unavailable: the fixed
+    // block size, with enough blocks for every resident thread slot.
+    bounds.threads = CAFFE_CUDA_NUM_THREADS;
+    bounds.blocks = prop.maxThreadsPerMultiProcessor /
+        CAFFE_CUDA_NUM_THREADS * prop.multiProcessorCount;
+#if CUDA_VERSION >= 6050
+    // Of the block sizes reaching peak occupancy for this kernel, prefer
+    // the smallest: the same resident threads in more, smaller blocks
+    // shorten the tail when the last wave is partial.
+    int best_resident = 0;
+    for (int threads = prop.maxThreadsPerBlock;
+         threads >= 4 * prop.warpSize; threads /= 2) {
+      int blocks_per_sm = 0;
+      if (cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+              &blocks_per_sm, kernel, threads, 0) != cudaSuccess) {
+        cudaGetLastError();  // clear; keep the fixed-size fallback
+        break;
+      }
+      if (blocks_per_sm * threads >= best_resident) {
+        best_resident = blocks_per_sm * threads;
+        bounds.threads = threads;
+        bounds.blocks = blocks_per_sm * prop.multiProcessorCount;
+      }
+    }
+#endif
+    if (bounds.blocks < 1) {
+      bounds.blocks = 1;
+    }
+    if (bounds.blocks > prop.maxGridSize[0]) {
+      bounds.blocks = prop.maxGridSize[0];
+    }
+    boost::mutex::scoped_lock lock(launch_config_mutex_);
+    launch_bounds_[key] = bounds;
+  }
+  CaffeLaunchConfig config;
+  config.threads = bounds.threads;
+  config.blocks = (n + bounds.threads - 1) / bounds.threads;
+  if (config.blocks > bounds.blocks) {
+    config.blocks = bounds.blocks;
+  }
+  if (config.blocks < 1) {
+    config.blocks = 1;
+  }
+  return config;
+}
 
 class Caffe::RNG::Generator {
  public:
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <string>
 
 #include "caffe/data_transformer.hpp"
@@ -6,16 +7,103 @@
 
 namespace caffe {
 
+// Row kernels for the hot per-pixel transform. Hoisting the mirror branch
+// out of the inner loop and walking the row with unit stride lets the
+// compiler vectorize the uint8 -> Dtype conversion, mean subtraction and
+// scaling, instead of re-deriving indices per pixel.
+template <typename Dtype>
+inline void TransformRow(const char* data, const Dtype* mean,
+    const Dtype scale, const int width, Dtype* transformed_row) {
+  for (int w = 0; w < width; ++w) {
+    const Dtype datum_element =
+        static_cast<Dtype>(static_cast<uint8_t>(data[w]));
+    transformed_row[w] = (datum_element - mean[w]) * scale;
+  }
+}
+
+// Same as TransformRow, but writes the output row reversed. Reading
+// forward and storing backward keeps the loads contiguous.
+template <typename Dtype>
+inline void TransformRowMirror(const char* data, const Dtype* mean,
+    const Dtype scale, const int width, Dtype* transformed_row) {
+  for (int w = 0; w < width; ++w) {
+    const Dtype datum_element =
+        static_cast<Dtype>(static_cast<uint8_t>(data[w]));
+    transformed_row[width - 1 - w] = (datum_element - mean[w]) * scale;
+  }
+}
+
+// Scalar-mean variants of the row kernels: the per-channel constant stays
+// in a register, so only the image itself is streamed.
+template <typename Dtype>
+inline void TransformRowScalarMean(const char* data, const Dtype mean,
+    const Dtype scale, const int width, Dtype* transformed_row) {
+  for (int w = 0; w < width; ++w) {
+    const Dtype datum_element =
+        static_cast<Dtype>(static_cast<uint8_t>(data[w]));
+    transformed_row[w] = (datum_element - mean) * scale;
+  }
+}
+
+template <typename Dtype>
+inline void TransformRowMirrorScalarMean(const char* data, const Dtype mean,
+    const Dtype scale, const int width, Dtype* transformed_row) {
+  for (int w = 0; w < width; ++w) {
+    const Dtype datum_element =
+        static_cast<Dtype>(static_cast<uint8_t>(data[w]));
+    transformed_row[width - 1 - w] = (datum_element - mean) * scale;
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const int batch_item_id,
                                        const Datum& datum,
                                        const Dtype* mean,
                                        Dtype* transformed_data) {
-  const string& data = datum.data();
   const int channels = datum.channels();
   const int height = datum.height();
   const int width = datum.width();
-  const int size = datum.channels() * datum.height() * datum.width();
+  const int size = channels * height * width;
+
+  // we will prefer to use data() first, and then try float_data()
+  if (datum.data().size()) {
+    Transform(batch_item_id, datum.data().data(), channels, height, width,
+        mean, transformed_data);
+    return;
+  }
+
+  CHECK_EQ(param_.crop_size(), 0) << "Image cropping only support uint8 data";
+  const Dtype scale = param_.scale();
+  if (!mean_values_.empty()) {
+    CHECK(mean_values_.size() == 1 ||
+        mean_values_.size() == static_cast<size_t>(channels))
+        << "mean_value must give one value or one value per channel.";
+    const int plane = height * width;
+    Dtype* transformed_item = transformed_data + batch_item_id * size;
+    for (int c = 0; c < channels; ++c) {
+      const Dtype mean_c = mean_values_[mean_values_.size() == 1 ? 0 : c];
+      for (int p = 0; p < plane; ++p) {
+        transformed_item[c * plane + p] =
+            (datum.float_data(c * plane + p) - mean_c) * scale;
+      }
+    }
+  } else {
+    for (int j = 0; j < size; ++j) {
+      transformed_data[j + batch_item_id * size] =
+          (datum.float_data(j) - mean[j]) * scale;
+    }
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const char* data,
+                                       const int channels,
+                                       const int height,
+                                       const int width,
+                                       const Dtype* mean,
+                                       Dtype* transformed_data) {
+  const int size = channels * height * width;
 
   const int crop_size = param_.crop_size();
   const bool mirror = param_.mirror();
@@ -26,8 +114,14 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
                << "set at the same time.";
   }
 
+  const bool has_mean_values = !mean_values_.empty();
+  if (has_mean_values) {
+    CHECK(mean_values_.size() == 1 ||
+        mean_values_.size() == static_cast<size_t>(channels))
+        << "mean_value must give one value or one value per channel.";
+  }
+
   if (crop_size) {
-    CHECK(data.size()) << "Image cropping only support uint8 data";
     int h_off, w_off;
     // We only do random crop when we do training.
     if (phase_ == Caffe::TRAIN) {
@@ -37,53 +131,98 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
       h_off = (height - crop_size) / 2;
       w_off = (width - crop_size) / 2;
     }
-    if (mirror && Rand() % 2) {
-      // Copy mirrored version
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + (crop_size - 1 - w);
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
-          }
-        }
-      }
-    } else {
-      // Normal copy
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + w;
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
+    const bool do_mirror = mirror && Rand() % 2;
+    for (int c = 0; c < channels; ++c) {
+      const Dtype mean_c = has_mean_values ?
+          mean_values_[mean_values_.size() == 1 ? 0 : c] : Dtype(0);
+      for (int h = 0; h < crop_size; ++h) {
+        const int data_index = (c * height + h + h_off) * width + w_off;
+        const int top_index = ((batch_item_id * channels + c) * crop_size + h)
+            * crop_size;
+        if (has_mean_values) {
+          if (do_mirror) {
+            TransformRowMirrorScalarMean(data + data_index, mean_c,
+                scale, crop_size, transformed_data + top_index);
+          } else {
+            TransformRowScalarMean(data + data_index, mean_c,
+                scale, crop_size, transformed_data + top_index);
           }
+        } else if (do_mirror) {
+          // Copy mirrored version
+          TransformRowMirror(data + data_index, mean + data_index,
+              scale, crop_size, transformed_data + top_index);
+        } else {
+          // Normal copy
+          TransformRow(data + data_index, mean + data_index,
+              scale, crop_size, transformed_data + top_index);
         }
       }
     }
+  } else if (has_mean_values) {
+    // Per-channel sweep so the scalar mean stays in a register for the
+    // whole plane.
+    const int plane = height * width;
+    Dtype* transformed_item = transformed_data + batch_item_id * size;
+    for (int c = 0; c < channels; ++c) {
+      const Dtype mean_c =
+          mean_values_[mean_values_.size() == 1 ? 0 : c];
+      TransformRowScalarMean(data + c * plane, mean_c, scale,
+          plane, transformed_item + c * plane);
+    }
   } else {
-    // we will prefer to use data() first, and then try float_data()
-    if (data.size()) {
-      for (int j = 0; j < size; ++j) {
-        Dtype datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[j]));
-        transformed_data[j + batch_item_id * size] =
-            (datum_element - mean[j]) * scale;
-      }
+    TransformRow(data, mean, scale, size,
+        transformed_data + batch_item_id * size);
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Fill(const int batch_item_id,
+                                  const Datum& datum,
+                                  uint8_t* raw_data,
+                                  int* transform_params) {
+  const string& data = datum.data();
+  const int height = datum.height();
+  const int width = datum.width();
+  const int size = datum.channels() * datum.height() * datum.width();
+
+  CHECK(data.size()) << "GPU transform requires uint8 data";
+  CHECK_EQ(data.size(), size);
+  FillParams(batch_item_id, height, width, transform_params);
+
+  // Stage the packed pixels; the device kernel crops out of the full image.
+  memcpy(raw_data + batch_item_id * size, data.data(), size);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::FillParams(const int batch_item_id,
+                                        const int height,
+                                        const int width,
+                                        int* transform_params) {
+  const int crop_size = param_.crop_size();
+  const bool mirror = param_.mirror();
+
+  if (mirror && crop_size == 0) {
+    LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
+               << "set at the same time.";
+  }
+
+  // Draw the same per-image parameters as the CPU Transform would.
+  int h_off = 0, w_off = 0;
+  bool do_mirror = false;
+  if (crop_size) {
+    // We only do random crop when we do training.
+    if (phase_ == Caffe::TRAIN) {
+      h_off = Rand() % (height - crop_size);
+      w_off = Rand() % (width - crop_size);
     } else {
-      for (int j = 0; j < size; ++j) {
-        transformed_data[j + batch_item_id * size] =
-            (datum.float_data(j) - mean[j]) * scale;
-      }
+      h_off = (height - crop_size) / 2;
+      w_off = (width - crop_size) / 2;
     }
+    do_mirror = mirror && Rand() % 2;
   }
+  transform_params[batch_item_id * 3] = h_off;
+  transform_params[batch_item_id * 3 + 1] = w_off;
+  transform_params[batch_item_id * 3 + 2] = do_mirror;
 }
 
 template <typename Dtype>
@@ -91,13 +230,17 @@ void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = (phase_ == Caffe::TRAIN) &&
       (param_.mirror() || param_.crop_size());
   if (needs_rand) {
-    const unsigned int rng_seed = caffe_rng_rand();
-    rng_.reset(new Caffe::RNG(rng_seed));
+    InitRand(caffe_rng_rand());
   } else {
     rng_.reset();
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(const unsigned int seed) {
+  rng_.reset(new Caffe::RNG(seed));
+}
+
 template <typename Dtype>
 unsigned int DataTransformer<Dtype>::Rand() {
   CHECK(rng_);
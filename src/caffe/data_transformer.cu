@@ -0,0 +1,129 @@
+#include "caffe/data_transformer.hpp"
+
+namespace caffe {
+
+// Fused crop + mirror + mean-subtract + scale over a packed uint8 batch.
+// One thread per output element; the per-image crop offsets and mirror
+// flag were drawn on the host by Fill (3 ints per image). The mean is
+// indexed at the source coordinates, matching the CPU Transform. With a
+// non-NULL indices array, item n gathers its pixels from example
+// indices[n] of raw_data (the on-GPU dataset cache) instead of slot n.
+template <typename Dtype>
+__global__ void TransformKernel(const int count, const uint8_t* raw_data,
+    const int* indices, const int* transform_params, const Dtype* mean,
+    const Dtype scale, const int channels, const int height, const int width,
+    const int out_height, const int out_width, Dtype* transformed_data) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int w = index % out_width;
+    const int h = (index / out_width) % out_height;
+    const int c = (index / out_width / out_height) % channels;
+    const int n = index / out_width / out_height / channels;
+    const int src = indices ? indices[n] : n;
+    const int h_off = transform_params[n * 3];
+    const int w_off = transform_params[n * 3 + 1];
+    const bool do_mirror = transform_params[n * 3 + 2];
+    const int w_src = do_mirror ? (out_width - 1 - w) : w;
+    const int data_index =
+        (c * height + h + h_off) * width + w_off + w_src;
+    const Dtype datum_element = static_cast<Dtype>(
+        raw_data[src * channels * height * width + data_index]);
+    transformed_data[index] = (datum_element - mean[data_index]) * scale;
+  }
+}
+
+// Same as TransformKernel, but subtracting a per-channel scalar mean.
+// The handful of constants stays resident in cache instead of streaming
+// a full mean plane per image.
+template <typename Dtype>
+__global__ void TransformMeanValueKernel(const int count,
+    const uint8_t* raw_data, const int* indices,
+    const int* transform_params, const Dtype* mean_values,
+    const Dtype scale, const int channels, const int height,
+    const int width, const int out_height, const int out_width,
+    Dtype* transformed_data) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int w = index % out_width;
+    const int h = (index / out_width) % out_height;
+    const int c = (index / out_width / out_height) % channels;
+    const int n = index / out_width / out_height / channels;
+    const int src = indices ? indices[n] : n;
+    const int h_off = transform_params[n * 3];
+    const int w_off = transform_params[n * 3 + 1];
+    const bool do_mirror = transform_params[n * 3 + 2];
+    const int w_src = do_mirror ? (out_width - 1 - w) : w;
+    const int data_index =
+        (c * height + h + h_off) * width + w_off + w_src;
+    const Dtype datum_element = static_cast<Dtype>(
+        raw_data[src * channels * height * width + data_index]);
+    transformed_data[index] = (datum_element - mean_values[c]) * scale;
+  }
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::TransformGPU(const int num, const int channels,
+    const int height, const int width, const uint8_t* raw_data,
+    const int* indices, const int* transform_params, const Dtype* mean,
+    Dtype* transformed_data) {
+  const int crop_size = param_.crop_size();
+  const Dtype scale = param_.scale();
+  const int out_height = crop_size ? crop_size : height;
+  const int out_width = crop_size ? crop_size : width;
+  const int count = num * channels * out_height * out_width;
+  if (!mean_values_.empty()) {
+    if (!mean_values_mem_) {
+      CHECK(mean_values_.size() == 1 ||
+          mean_values_.size() == static_cast<size_t>(channels))
+          << "mean_value must give one value or one value per channel.";
+      // Expand to one entry per channel so the kernel indexes uniformly.
+      mean_values_mem_.reset(new SyncedMemory(channels * sizeof(Dtype)));
+      Dtype* values =
+          static_cast<Dtype*>(mean_values_mem_->mutable_cpu_data());
+      for (int c = 0; c < channels; ++c) {
+        values[c] = mean_values_[mean_values_.size() == 1 ? 0 : c];
+      }
+    }
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    TransformMeanValueKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(
+        count, raw_data, indices, transform_params,
+        static_cast<const Dtype*>(mean_values_mem_->gpu_data()), scale,
+        channels, height, width, out_height, out_width, transformed_data);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    TransformKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(
+        count, raw_data, indices, transform_params, mean, scale, channels,
+        height, width, out_height, out_width, transformed_data);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::TransformGPU(const int num, const int channels,
+    const int height, const int width, const uint8_t* raw_data,
+    const int* transform_params, const Dtype* mean,
+    Dtype* transformed_data) {
+  TransformGPU(num, channels, height, width, raw_data,
+      static_cast<const int*>(NULL), transform_params, mean,
+      transformed_data);
+}
+
+template void DataTransformer<float>::TransformGPU(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* raw_data, const int* indices,
+    const int* transform_params, const float* mean, float* transformed_data);
+template void DataTransformer<double>::TransformGPU(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* raw_data, const int* indices,
+    const int* transform_params, const double* mean,
+    double* transformed_data);
+template void DataTransformer<float>::TransformGPU(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* raw_data, const int* transform_params, const float* mean,
+    float* transformed_data);
+template void DataTransformer<double>::TransformGPU(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* raw_data, const int* transform_params, const double* mean,
+    double* transformed_data);
+
+}  // namespace caffe
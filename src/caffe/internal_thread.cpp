@@ -1,38 +1,106 @@
-#include "caffe/internal_thread.hpp"
+#include <boost/thread.hpp>
 
-#include "caffe/util/thread.hpp"
+#include "caffe/internal_thread.hpp"
 
 namespace caffe {
 
+// The persistent worker. Its thread parks on the condition variable
+// until the owner posts a run, executes one InternalThreadEntry, then
+// parks again; the thread itself is only torn down in the destructor.
+class InternalThread::Worker {
+ public:
+  explicit Worker(InternalThread* owner)
+      : owner_(owner), run_pending_(false), run_done_(true), exiting_(false),
+        thread_(&Worker::Loop, this) {}
+
+  ~Worker() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      exiting_ = true;
+      cond_.notify_all();
+    }
+    thread_.join();
+  }
+
+  // Post one execution of InternalThreadEntry, waiting out any run that
+  // is still in flight first (the previous implementation joined the
+  // old thread before spawning a new one).
+  void Start() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!run_done_) {
+      cond_.wait(lock);
+    }
+    run_pending_ = true;
+    run_done_ = false;
+    cond_.notify_all();
+  }
+
+  // Block until the posted run has finished.
+  void Wait() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!run_done_) {
+      cond_.wait(lock);
+    }
+  }
+
+ private:
+  void Loop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) {
+      while (!run_pending_ && !exiting_) {
+        cond_.wait(lock);
+      }
+      if (exiting_) {
+        return;
+      }
+      run_pending_ = false;
+      lock.unlock();
+      owner_->InternalThreadEntry();
+      lock.lock();
+      run_done_ = true;
+      cond_.notify_all();
+    }
+  }
+
+  InternalThread* const owner_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  bool run_pending_;
+  bool run_done_;
+  bool exiting_;
+  boost::thread thread_;
+};
+
 InternalThread::~InternalThread() {
-  WaitForInternalThreadToExit();
-  if (thread_ != NULL) {
-    delete thread_;
+  if (worker_ != NULL) {
+    WaitForInternalThreadToExit();
+    delete worker_;
   }
 }
 
 bool InternalThread::StartInternalThread() {
-  if (!WaitForInternalThreadToExit()) {
-    return false;
-  }
-  try {
-    thread_ = new caffe::Thread
-        (&InternalThread::InternalThreadEntry, this);
-  } catch (...) {
-    return false;
+  if (worker_ == NULL) {
+    try {
+      worker_ = new Worker(this);
+    } catch (...) {
+      return false;
+    }
   }
+  worker_->Start();
+  started_ = true;
   return true;
 }
 
 /** Will not return until the internal thread has exited. */
 bool InternalThread::WaitForInternalThreadToExit() {
-  if (is_started()) {
+  if (worker_ != NULL) {
     try {
-      thread_->join();
+      worker_->Wait();
     } catch (...) {
       return false;
     }
   }
+  started_ = false;
   return true;
 }
 
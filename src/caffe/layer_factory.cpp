@@ -2,6 +2,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/plugin.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -20,10 +21,53 @@ ConvolutionLayer<Dtype>* GetConvolutionLayer(const string& name,
     engine = ConvolutionParameter_Engine_CUDNN;
 #endif
   }
+#ifndef USE_CUDNN
+  if (engine == ConvolutionParameter_Engine_AUTOTUNE) {
+    // Without cuDNN the candidates are the dense, Winograd, and FFT CPU
+    // paths. The Winograd and FFT layers benchmark themselves against
+    // the dense forward per shape and fall back when they lose; shapes
+    // their transforms cannot handle go straight to CAFFE.
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    const int kernel_h = conv_param.has_kernel_size() ?
+        conv_param.kernel_size() : conv_param.kernel_h();
+    const int kernel_w = conv_param.has_kernel_size() ?
+        conv_param.kernel_size() : conv_param.kernel_w();
+    const int pad_h = conv_param.has_pad_h() ?
+        conv_param.pad_h() : conv_param.pad();
+    const int pad_w = conv_param.has_pad_w() ?
+        conv_param.pad_w() : conv_param.pad();
+    const bool quantize = param.quantization_param().quantize();
+    const bool winograd_eligible =
+        kernel_h == 3 && kernel_w == 3 &&
+        (conv_param.has_stride_h() ?
+         conv_param.stride_h() == 1 && conv_param.stride_w() == 1 :
+         conv_param.stride() == 1) &&
+        !quantize;
+    // Below ~7x7 the transform overhead outweighs the saved kernel-area
+    // factor, so only large filters are worth benchmarking against FFT.
+    const int kFftKernelArea = 49;
+    const bool fft_eligible =
+        kernel_h * kernel_w >= kFftKernelArea &&
+        pad_h < kernel_h && pad_w < kernel_w && !quantize;
+    if (winograd_eligible) {
+      return new WinogradConvolutionLayer<Dtype>(param);
+    } else if (fft_eligible) {
+      return new FFTConvolutionLayer<Dtype>(param);
+    }
+    engine = ConvolutionParameter_Engine_CAFFE;
+  }
+#endif
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return new ConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return new WinogradConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_FFT) {
+    return new FFTConvolutionLayer<Dtype>(param);
 #ifdef USE_CUDNN
-  } else if (engine == ConvolutionParameter_Engine_CUDNN) {
+  } else if (engine == ConvolutionParameter_Engine_CUDNN ||
+             engine == ConvolutionParameter_Engine_AUTOTUNE) {
+    // The cuDNN layer handles AUTOTUNE itself, since it can fall back to
+    // the CAFFE kernels per shape after benchmarking both.
     return new CuDNNConvolutionLayer<Dtype>(param);
 #endif
   } else {
@@ -36,6 +80,33 @@ template ConvolutionLayer<float>* GetConvolutionLayer(const string& name,
 template ConvolutionLayer<double>* GetConvolutionLayer(const string& name,
     const LayerParameter& param);
 
+// Get inner product layer according to engine.
+template <typename Dtype>
+InnerProductLayer<Dtype>* GetInnerProductLayer(const string& name,
+    const LayerParameter& param) {
+  InnerProductParameter_Engine engine = param.inner_product_param().engine();
+  if (engine == InnerProductParameter_Engine_DEFAULT) {
+    engine = InnerProductParameter_Engine_CAFFE;
+  }
+  if (param.inner_product_param().shard_device_size() > 0) {
+    CHECK_NE(engine, InnerProductParameter_Engine_SPARSE)
+        << "Layer " << name << ": SPARSE engine cannot be sharded.";
+    return new ShardedInnerProductLayer<Dtype>(param);
+  }
+  if (engine == InnerProductParameter_Engine_CAFFE) {
+    return new InnerProductLayer<Dtype>(param);
+  } else if (engine == InnerProductParameter_Engine_SPARSE) {
+    return new SparseInnerProductLayer<Dtype>(param);
+  } else {
+    LOG(FATAL) << "Layer " << name << " has unknown engine.";
+  }
+}
+
+template InnerProductLayer<float>* GetInnerProductLayer(const string& name,
+    const LayerParameter& param);
+template InnerProductLayer<double>* GetInnerProductLayer(const string& name,
+    const LayerParameter& param);
+
 // Get pooling layer according to engine.
 template <typename Dtype>
 PoolingLayer<Dtype>* GetPoolingLayer(const string& name,
@@ -44,7 +115,11 @@ PoolingLayer<Dtype>* GetPoolingLayer(const string& name,
   if (engine == PoolingParameter_Engine_DEFAULT) {
     engine = PoolingParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
-    engine = PoolingParameter_Engine_CUDNN;
+    // cuDNN fixes the pooling window at setup time, but a global pooling
+    // window follows the bottom shape, so it stays on the Caffe engine.
+    if (!param.pooling_param().global_pooling()) {
+      engine = PoolingParameter_Engine_CUDNN;
+    }
 #endif
   }
   if (engine == PoolingParameter_Engine_CAFFE) {
@@ -178,6 +253,12 @@ template <typename Dtype>
 Layer<Dtype>* GetLayer(const LayerParameter& param) {
   const string& name = param.name();
   const LayerParameter_LayerType& type = param.type();
+  // Implementations registered by loaded plugins override the built-in
+  // factory for their layer type.
+  Layer<Dtype>* plugin_layer = CreatePluginLayer<Dtype>(param);
+  if (plugin_layer) {
+    return plugin_layer;
+  }
   switch (type) {
   case LayerParameter_LayerType_ACCURACY:
     return new AccuracyLayer<Dtype>(param);
@@ -193,6 +274,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new ContrastiveLossLayer<Dtype>(param);
   case LayerParameter_LayerType_CONVOLUTION:
     return GetConvolutionLayer<Dtype>(name, param);
+  case LayerParameter_LayerType_CONVOLUTION_RELU:
+    return new ConvolutionReLULayer<Dtype>(param);
   case LayerParameter_LayerType_DATA:
     return new DataLayer<Dtype>(param);
   case LayerParameter_LayerType_DROPOUT:
@@ -203,6 +286,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new EuclideanLossLayer<Dtype>(param);
   case LayerParameter_LayerType_ELTWISE:
     return new EltwiseLayer<Dtype>(param);
+  case LayerParameter_LayerType_EMBED:
+    return new EmbedLayer<Dtype>(param);
   case LayerParameter_LayerType_FLATTEN:
     return new FlattenLayer<Dtype>(param);
   case LayerParameter_LayerType_HDF5_DATA:
@@ -218,7 +303,7 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
   case LayerParameter_LayerType_INFOGAIN_LOSS:
     return new InfogainLossLayer<Dtype>(param);
   case LayerParameter_LayerType_INNER_PRODUCT:
-    return new InnerProductLayer<Dtype>(param);
+    return GetInnerProductLayer<Dtype>(name, param);
   case LayerParameter_LayerType_LRN:
     return new LRNLayer<Dtype>(param);
   case LayerParameter_LayerType_MEMORY_DATA:
@@ -227,12 +312,18 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new MVNLayer<Dtype>(param);
   case LayerParameter_LayerType_MULTINOMIAL_LOGISTIC_LOSS:
     return new MultinomialLogisticLossLayer<Dtype>(param);
+  case LayerParameter_LayerType_NEURON_CHAIN:
+    return new NeuronChainLayer<Dtype>(param);
+  case LayerParameter_LayerType_PIPELINE_TRANSFER:
+    return new PipelineTransferLayer<Dtype>(param);
   case LayerParameter_LayerType_POOLING:
     return GetPoolingLayer<Dtype>(name, param);
   case LayerParameter_LayerType_POWER:
     return new PowerLayer<Dtype>(param);
   case LayerParameter_LayerType_RELU:
     return GetReLULayer<Dtype>(name, param);
+  case LayerParameter_LayerType_SAMPLED_SOFTMAX_LOSS:
+    return new SampledSoftmaxLossLayer<Dtype>(param);
   case LayerParameter_LayerType_SILENCE:
     return new SilenceLayer<Dtype>(param);
   case LayerParameter_LayerType_SIGMOID:
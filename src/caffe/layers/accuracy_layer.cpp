@@ -27,6 +27,7 @@ void AccuracyLayer<Dtype>::Reshape(
   CHECK_EQ(bottom[1]->height(), 1);
   CHECK_EQ(bottom[1]->width(), 1);
   (*top)[0]->Reshape(1, 1, 1, 1);
+  correct_.Reshape(bottom[0]->num(), 1, 1, 1);
 }
 
 template <typename Dtype>
@@ -63,6 +64,10 @@ void AccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   // Accuracy layer should not be used as a loss function.
 }
 
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(AccuracyLayer, Forward);
+#endif
+
 INSTANTIATE_CLASS(AccuracyLayer);
 
 }  // namespace caffe
@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per image. The label is in the top k iff fewer than k other
+// classes outrank it; ties break toward the larger index, matching the
+// pair ordering used by the CPU partial_sort.
+template <typename Dtype>
+__global__ void AccuracyForward(const int num, const int dim, const int top_k,
+    const Dtype* bottom_data, const Dtype* label, Dtype* correct) {
+  CUDA_KERNEL_LOOP(index, num) {
+    const Dtype* data = bottom_data + index * dim;
+    const int label_value = static_cast<int>(label[index]);
+    const Dtype label_score = data[label_value];
+    int rank = 0;
+    for (int j = 0; j < dim; ++j) {
+      if (data[j] > label_score ||
+          (data[j] == label_score && j > label_value)) {
+        ++rank;
+      }
+    }
+    correct[index] = rank < top_k ? 1 : 0;
+  }
+}
+
+template <typename Dtype>
+void AccuracyLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  const Dtype* bottom_label = bottom[1]->gpu_data();
+  int num = bottom[0]->num();
+  int dim = bottom[0]->count() / num;
+  Dtype* correct_data = correct_.mutable_gpu_data();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  AccuracyForward<Dtype><<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS>>>(
+      num, dim, top_k_, bottom_data, bottom_label, correct_data);
+  CUDA_POST_KERNEL_CHECK;
+  // Only the scalar accuracy crosses back to the host.
+  Dtype accuracy;
+  caffe_gpu_asum(num, correct_data, &accuracy);
+  (*top)[0]->mutable_cpu_data()[0] = accuracy / num;
+}
+
+INSTANTIATE_CLASS(AccuracyLayer);
+
+}  // namespace caffe
@@ -0,0 +1,58 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per image: k selection passes, each finding the best value
+// strictly below the previous pick. Ties rank the larger index first,
+// matching the pair ordering used by the CPU partial_sort.
+template <typename Dtype>
+__global__ void ArgMaxForward(const int num, const int dim, const int top_k,
+    const bool out_max_val, const Dtype* bottom_data, Dtype* top_data) {
+  CUDA_KERNEL_LOOP(index, num) {
+    const Dtype* data = bottom_data + index * dim;
+    const int channels = out_max_val ? 2 : 1;
+    Dtype prev_val = 0;
+    int prev_idx = -1;
+    for (int k = 0; k < top_k; ++k) {
+      Dtype best_val = 0;
+      int best_idx = -1;
+      for (int j = 0; j < dim; ++j) {
+        if (k > 0 && !(data[j] < prev_val ||
+            (data[j] == prev_val && j < prev_idx))) {
+          continue;  // already ranked in an earlier pass
+        }
+        if (best_idx < 0 || data[j] > best_val ||
+            (data[j] == best_val && j > best_idx)) {
+          best_val = data[j];
+          best_idx = j;
+        }
+      }
+      top_data[(index * channels) * top_k + k] = best_idx;
+      if (out_max_val) {
+        top_data[(index * channels + 1) * top_k + k] = best_val;
+      }
+      prev_val = best_val;
+      prev_idx = best_idx;
+    }
+  }
+}
+
+template <typename Dtype>
+void ArgMaxLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  int num = bottom[0]->num();
+  int dim = bottom[0]->count() / num;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ArgMaxForward<Dtype><<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS>>>(
+      num, dim, top_k_, out_max_val_, bottom_data, top_data);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_CLASS(ArgMaxLayer);
+
+}  // namespace caffe
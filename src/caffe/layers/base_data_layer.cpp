@@ -3,6 +3,7 @@
 
 #include "caffe/data_layers.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/tracing.hpp"
 
 namespace caffe {
 
@@ -32,6 +33,8 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // check if we want to have mean
   if (transform_param_.has_mean_file()) {
+    CHECK_EQ(transform_param_.mean_value_size(), 0)
+        << "Specify either mean_file or mean_value, not both.";
     const string& mean_file = transform_param_.mean_file();
     LOG(INFO) << "Loading mean file from" << mean_file;
     BlobProto blob_proto;
@@ -42,7 +45,14 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GE(data_mean_.height(), datum_height_);
     CHECK_GE(data_mean_.width(), datum_width_);
   } else {
-    // Simply initialize an all-empty mean.
+    // Fail on a channel mismatch here rather than mid-prefetch; a single
+    // mean_value applies to every channel.
+    if (transform_param_.mean_value_size() > 1) {
+      CHECK_EQ(transform_param_.mean_value_size(), datum_channels_)
+          << "mean_value must give one value or one value per channel.";
+    }
+    // Simply initialize an all-empty mean. The transformer ignores it
+    // when mean_value is configured.
     data_mean_.Reshape(1, datum_channels_, datum_height_, datum_width_);
   }
   mean_ = data_mean_.cpu_data();
@@ -53,45 +63,178 @@ template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  // Build the batch ring from the shapes that DataLayerSetUp settled on.
+  // Before starting the prefetch thread, we make mutable_cpu_data calls so
+  // that the prefetch thread does not accidentally make simultaneous
+  // cudaMalloc calls when the main thread is running. In some GPUs this
+  // seems to cause failures if we do not so.
+  const int prefetch_count = this->layer_param_.data_param().prefetch();
+  CHECK_GT(prefetch_count, 0) << "prefetch count must be positive";
+  prefetch_.resize(prefetch_count);
+  // In GPU mode, back the ring with pinned host memory so that Forward_gpu
+  // can upload batches with asynchronous DMA copies.
+  const bool use_pinned = (Caffe::mode() == Caffe::GPU);
+  use_gpu_transform_ = this->transform_param_.use_gpu_transform() &&
+      Caffe::mode() == Caffe::GPU;
+  if (use_gpu_transform_) {
+    LOG(INFO) << "Transforming data on the GPU.";
+  }
+  gpu_cache_ = this->layer_param_.data_param().gpu_cache();
+  if (gpu_cache_) {
+    // The cached examples are served through the fused transform kernel,
+    // so the staging that use_gpu_transform sets up is a prerequisite.
+    CHECK(use_gpu_transform_)
+        << "gpu_cache requires use_gpu_transform and GPU mode";
+    LOG(INFO) << "Caching the dataset on the GPU after the first epoch.";
+  }
+  const int batch_size = this->prefetch_data_.num();
+  const size_t raw_size = static_cast<size_t>(batch_size) *
+      this->datum_channels_ * this->datum_height_ * this->datum_width_;
+  for (int i = 0; i < prefetch_count; ++i) {
+    prefetch_[i].reset(new Batch<Dtype>());
+    prefetch_[i]->data_.ReshapeLike(this->prefetch_data_);
+    if (use_pinned) {
+      prefetch_[i]->data_.data()->set_prefer_pinned(true);
+    }
+    prefetch_[i]->data_.mutable_cpu_data();
+    if (use_gpu_transform_) {
+      // The GPU path stages the raw uint8 pixels and the per-image
+      // crop/mirror draws instead of filling data_.
+      prefetch_[i]->raw_data_.reset(new SyncedMemory(raw_size));
+      prefetch_[i]->raw_data_->set_prefer_pinned(true);
+      prefetch_[i]->raw_data_->mutable_cpu_data();
+      prefetch_[i]->transform_params_.reset(
+          new SyncedMemory(3 * batch_size * sizeof(int)));
+      prefetch_[i]->transform_params_->set_prefer_pinned(true);
+      prefetch_[i]->transform_params_->mutable_cpu_data();
+    }
+    if (this->output_labels_) {
+      prefetch_[i]->label_.ReshapeLike(this->prefetch_label_);
+      if (use_pinned) {
+        prefetch_[i]->label_.data()->set_prefer_pinned(true);
+      }
+      prefetch_[i]->label_.mutable_cpu_data();
+    }
   }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
   DLOG(INFO) << "Prefetch initialized.";
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::CacheExample(const uint8_t* pixels,
+    const Dtype label) {
+  // Appends one example to the host staging area, which ActivateGpuCache
+  // later uploads wholesale. Growth is amortized; for CIFAR-sized sets
+  // the whole vector is a few hundred MB.
+  cache_staging_.insert(cache_staging_.end(), pixels,
+      pixels + this->datum_size_);
+  cache_labels_.push_back(label);
+  ++cache_num_;
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
   this->phase_ = Caffe::phase();
   this->data_transformer_.InitRand();
+  must_stop_prefetch_ = false;
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_free_.push(prefetch_[i].get());
+  }
   CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
+  if (is_started()) {
+    must_stop_prefetch_ = true;
+    // Unblock the producer if it is waiting for a free batch.
+    prefetch_free_.push(static_cast<Batch<Dtype>*>(NULL));
+  }
   CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  // Drain the queues so a subsequent CreatePrefetchThread starts clean.
+  Batch<Dtype>* batch;
+  while (prefetch_free_.try_pop(&batch)) {}
+  while (prefetch_full_.try_pop(&batch)) {}
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  // Keep prefetch (and the decode workers it spawns, which inherit the
+  // mask and memory policy) on the same socket as the compute threads.
+  Caffe::PinToNumaNode();
+  while (!must_stop_prefetch_) {
+    Batch<Dtype>* batch = prefetch_free_.pop();
+    if (batch == NULL) {
+      break;
+    }
+    {
+      CAFFE_TRACE_SCOPE("prefetch");
+      CPUTimer timer;
+      timer.Start();
+      LoadBatch(batch);
+      timer.Stop();
+      const double busy_ms = timer.MilliSeconds();
+      prefetch_busy_ms_ += busy_ms;
+      window_busy_ms_ += busy_ms;
+    }
+    if (collect_timing_) {
+      ++batches_timed_;
+    }
+    prefetch_full_.push(batch);
+  }
+}
+
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::DequeueBatch() {
+  // The time between consecutive Forward arrivals here is the consumer's
+  // iteration period as seen from this layer; the blocked time below
+  // over that period is the pipeline bubble (see PrefetchTiming).
+  if (prefetch_period_started_) {
+    prefetch_period_timer_.Stop();
+    const double period_ms = prefetch_period_timer_.MilliSeconds();
+    prefetch_period_ms_ += period_ms;
+    window_period_ms_ += period_ms;
+  }
+  prefetch_period_timer_.Start();
+  prefetch_period_started_ = true;
+  CPUTimer timer;
+  timer.Start();
+  Batch<Dtype>* batch;
+  {
+    // On the timeline this is the batch handoff: wide events here mean
+    // the consumer outran the prefetch thread.
+    CAFFE_TRACE_SCOPE("batch_wait");
+    batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  }
+  timer.Stop();
+  const double wait_ms = timer.MilliSeconds();
+  prefetch_wait_ms_ += wait_ms;
+  window_wait_ms_ += wait_ms;
+  // Consuming the batch makes its successor's start key the layer's
+  // resume point (see data_cursor_key).
+  if (!batch->cursor_key_.empty()) {
+    consumed_cursor_key_ = batch->cursor_key_;
+  }
+  return batch;
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
+  Batch<Dtype>* batch = DequeueBatch();
+  // The GPU path stages raw pixels instead of filling data_, so it cannot
+  // serve a CPU forward (only possible if the mode changed after setup).
+  CHECK(!use_gpu_transform_) << "use_gpu_transform requires GPU mode";
   // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
+  caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
              (*top)[0]->mutable_cpu_data());
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
+    caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
                (*top)[1]->mutable_cpu_data());
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  // Hand the batch back to the producer for refilling.
+  prefetch_free_.push(batch);
 }
 
 #ifdef CPU_ONLY
@@ -1,23 +1,127 @@
 #include <vector>
 
 #include "caffe/data_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/tracing.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ActivateGpuCache() {
+  // The prefetch pipeline has done its job: one full pass is staged. Shut
+  // it down and release the batch ring's pinned buffers before the upload
+  // doubles the footprint.
+  JoinPrefetchThread();
+  prefetch_.clear();
+  CHECK_GT(cache_num_, 0) << "GPU dataset cache is empty";
+  const size_t bytes = cache_staging_.size();
+  cache_data_.reset(new SyncedMemory(bytes));
+  memcpy(cache_data_->mutable_cpu_data(), &cache_staging_[0], bytes);
+  cache_data_->gpu_data();
+  vector<uint8_t>().swap(cache_staging_);
+  // Per-batch staging: the drawn example indices, their crop/mirror draws
+  // and their labels. Pinned so the uploads are asynchronous DMA copies.
+  const int batch_size = prefetch_data_.num();
+  cache_batch_indices_.reset(new SyncedMemory(batch_size * sizeof(int)));
+  cache_batch_indices_->set_prefer_pinned(true);
+  cache_batch_params_.reset(new SyncedMemory(3 * batch_size * sizeof(int)));
+  cache_batch_params_->set_prefer_pinned(true);
+  if (this->output_labels_) {
+    cache_batch_labels_.reset(new SyncedMemory(batch_size * sizeof(Dtype)));
+    cache_batch_labels_->set_prefer_pinned(true);
+  }
+  // Drawn on the consuming thread from here on (the prefetch thread and
+  // its RNG are gone); seeded here so a fixed caffe seed reproduces the
+  // same example sequence.
+  cache_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+  cache_active_ = true;
+  LOG(INFO) << "Serving from the GPU dataset cache: " << cache_num_
+      << " examples, " << bytes / (1024 * 1024) << " MB of device memory.";
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ForwardCachedBatch(
+    vector<Blob<Dtype>*>* top) {
+  const int batch_size = prefetch_data_.num();
+  int* indices =
+      static_cast<int*>(cache_batch_indices_->mutable_cpu_data());
+  int* transform_params =
+      static_cast<int*>(cache_batch_params_->mutable_cpu_data());
+  Dtype* labels = this->output_labels_ ?
+      static_cast<Dtype*>(cache_batch_labels_->mutable_cpu_data()) : NULL;
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(cache_rng_->generator());
+  for (int i = 0; i < batch_size; ++i) {
+    const int n = (*rng)() % cache_num_;
+    indices[i] = n;
+    this->data_transformer_.FillParams(i, this->datum_height_,
+        this->datum_width_, transform_params);
+    if (labels) {
+      labels[i] = cache_labels_[n];
+    }
+  }
+  // The gather variant of the fused transform kernel pulls the drawn
+  // examples straight out of the device-resident cache; the gpu_data()
+  // calls upload only the per-batch draws made above.
+  this->data_transformer_.TransformGPU(batch_size, this->datum_channels_,
+      this->datum_height_, this->datum_width_,
+      static_cast<const uint8_t*>(cache_data_->gpu_data()),
+      static_cast<const int*>(cache_batch_indices_->gpu_data()),
+      static_cast<const int*>(cache_batch_params_->gpu_data()),
+      this->data_mean_.gpu_data(), (*top)[0]->mutable_gpu_data());
+  if (this->output_labels_) {
+    CUDA_CHECK(cudaMemcpyAsync((*top)[1]->mutable_gpu_data(), labels,
+        batch_size * sizeof(Dtype), cudaMemcpyHostToDevice,
+        cudaStreamDefault));
+    // The staging buffer is rewritten on the next Forward, so wait for
+    // the copy to land first.
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-      (*top)[0]->mutable_gpu_data());
+  if (gpu_cache_) {
+    if (cache_complete_ && !cache_active_) {
+      ActivateGpuCache();
+    }
+    if (cache_active_) {
+      ForwardCachedBatch(top);
+      return;
+    }
+  }
+  Batch<Dtype>* batch = this->DequeueBatch();
+  if (use_gpu_transform_) {
+    // Upload the packed uint8 pixels and the per-image crop/mirror draws
+    // (a quarter of the bytes of the expanded float batch), then run the
+    // fused transform kernel straight into the top blob.
+    const uint8_t* raw_data =
+        static_cast<const uint8_t*>(batch->raw_data_->gpu_data());
+    const int* transform_params =
+        static_cast<const int*>(batch->transform_params_->gpu_data());
+    this->data_transformer_.TransformGPU(this->prefetch_data_.num(),
+        this->datum_channels_, this->datum_height_, this->datum_width_,
+        raw_data, transform_params, this->data_mean_.gpu_data(),
+        (*top)[0]->mutable_gpu_data());
+  } else {
+    // Copy the data. The batch blobs are pinned (see LayerSetUp), so these
+    // copies are true asynchronous DMA transfers on the default stream;
+    // subsequent kernels on the stream order after them automatically.
+    CUDA_CHECK(cudaMemcpyAsync((*top)[0]->mutable_gpu_data(),
+        batch->data_.cpu_data(), batch->data_.count() * sizeof(Dtype),
+        cudaMemcpyHostToDevice, cudaStreamDefault));
+  }
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-        (*top)[1]->mutable_gpu_data());
+    CUDA_CHECK(cudaMemcpyAsync((*top)[1]->mutable_gpu_data(),
+        batch->label_.cpu_data(), batch->label_.count() * sizeof(Dtype),
+        cudaMemcpyHostToDevice, cudaStreamDefault));
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  // The producer may overwrite the host buffers as soon as we hand the
+  // batch back, so wait for the copies to land first.
+  CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+  // Hand the batch back to the producer for refilling.
+  prefetch_free_.push(batch);
 }
 
 INSTANTIATE_CLASS(BasePrefetchingDataLayer);
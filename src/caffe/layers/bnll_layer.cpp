@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -14,6 +16,28 @@ void BNLLLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
+  BNLLParameter_Engine engine = this->layer_param_.bnll_param().engine();
+  if (engine == BNLLParameter_Engine_DEFAULT && Caffe::fast_math()) {
+    engine = BNLLParameter_Engine_FAST;
+  }
+  if (engine == BNLLParameter_Engine_FAST) {
+    caffe_cpu_fast_bnll(count, bottom_data, top_data);
+    if (Caffe::fast_math_verify()) {
+      Dtype max_error = 0;
+      for (int i = 0; i < count; ++i) {
+        const Dtype exact = bottom_data[i] > 0 ?
+            bottom_data[i] + log(1. + exp(-bottom_data[i])) :
+            log(1. + exp(bottom_data[i]));
+        max_error = std::max(max_error, std::fabs(top_data[i] - exact));
+      }
+      CHECK_LE(max_error, kFastBNLLMaxError)
+          << "fast bnll exceeded its error bound in layer "
+          << this->layer_param_.name();
+      LOG(INFO) << "Layer " << this->layer_param_.name()
+          << " fast bnll max error " << max_error;
+    }
+    return;
+  }
   for (int i = 0; i < count; ++i) {
     top_data[i] = bottom_data[i] > 0 ?
         bottom_data[i] + log(1. + exp(-bottom_data[i])) :
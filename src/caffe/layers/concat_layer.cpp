@@ -39,11 +39,56 @@ void ConcatLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   (*top)[0]->Reshape(num_, channels_, height_, width_);
   CHECK_EQ(count_, (*top)[0]->count());
+  // In-place concatenation needs each bottom to map to a contiguous slice
+  // of the top: always true along num, and along channels only with a
+  // single image per batch.
+  in_place_ = this->layer_param_.concat_param().in_place() &&
+      (concat_dim_ == 0 || num_ == 1);
+  if (!in_place_) {
+    return;
+  }
+  // Rebuild the slice views whenever the top's backing memory changes or
+  // the slice layout does (a blob that shrinks keeps its allocation, so
+  // the bases alone do not tell).
+  bool rebuild = (*top)[0]->data() != data_base_ ||
+      (*top)[0]->diff() != diff_base_ ||
+      bottom_data_views_.size() != bottom.size();
+  for (int i = 0; !rebuild && i < bottom.size(); ++i) {
+    rebuild = bottom_data_views_[i]->size() !=
+        bottom[i]->count() * sizeof(Dtype);
+  }
+  if (rebuild) {
+    data_base_ = (*top)[0]->data();
+    diff_base_ = (*top)[0]->diff();
+    bottom_data_views_.resize(bottom.size());
+    bottom_diff_views_.resize(bottom.size());
+    size_t offset = 0;
+    for (int i = 0; i < bottom.size(); ++i) {
+      const size_t bytes = bottom[i]->count() * sizeof(Dtype);
+      bottom_data_views_[i].reset(new SyncedMemory(data_base_, offset, bytes));
+      bottom_diff_views_[i].reset(new SyncedMemory(diff_base_, offset, bytes));
+      offset += bytes;
+    }
+  }
 }
 
 template <typename Dtype>
 void ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (in_place_) {
+    for (int i = 0; i < bottom.size(); ++i) {
+      if (bottom[i]->data() == bottom_data_views_[i]) {
+        continue;  // the producer wrote straight into the top's slice
+      }
+      // First pass, or the producer re-pointed its top elsewhere: copy
+      // the slice, then alias the bottom into the top so the next pass
+      // skips the copy.
+      caffe_copy(bottom[i]->count(), bottom[i]->cpu_data(),
+          static_cast<Dtype*>(bottom_data_views_[i]->mutable_cpu_data()));
+      bottom[i]->ShareData(bottom_data_views_[i]);
+    }
+    return;
+  }
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   if (concat_dim_== 0) {
     int offset_num = 0;
@@ -71,6 +116,20 @@ void ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (in_place_) {
+    for (int i = 0; i < bottom->size(); ++i) {
+      if (!propagate_down[i]) { continue; }
+      Blob<Dtype>* blob = (*bottom)[i];
+      if (blob->diff() == bottom_diff_views_[i]) {
+        continue;  // the producer already reads its slice of the top diff
+      }
+      caffe_copy(blob->count(),
+          static_cast<const Dtype*>(bottom_diff_views_[i]->cpu_data()),
+          blob->mutable_cpu_diff());
+      blob->ShareDiff(bottom_diff_views_[i]);
+    }
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   if (concat_dim_ == 0) {
     int offset_num = 0;
@@ -9,6 +9,20 @@ namespace caffe {
 template <typename Dtype>
 void ConcatLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (in_place_) {
+    for (int i = 0; i < bottom.size(); ++i) {
+      if (bottom[i]->data() == bottom_data_views_[i]) {
+        continue;  // the producer wrote straight into the top's slice
+      }
+      // First pass, or the producer re-pointed its top elsewhere: copy
+      // the slice, then alias the bottom into the top so the next pass
+      // skips the copy.
+      caffe_copy(bottom[i]->count(), bottom[i]->gpu_data(),
+          static_cast<Dtype*>(bottom_data_views_[i]->mutable_gpu_data()));
+      bottom[i]->ShareData(bottom_data_views_[i]);
+    }
+    return;
+  }
   Dtype* top_data = (*top)[0]->mutable_gpu_data();
   if (concat_dim_ == 0) {
     int offset_num = 0;
@@ -39,6 +53,20 @@ void ConcatLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConcatLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (in_place_) {
+    for (int i = 0; i < bottom->size(); ++i) {
+      if (!propagate_down[i]) { continue; }
+      Blob<Dtype>* blob = (*bottom)[i];
+      if (blob->diff() == bottom_diff_views_[i]) {
+        continue;  // the producer already reads its slice of the top diff
+      }
+      caffe_copy(blob->count(),
+          static_cast<const Dtype*>(bottom_diff_views_[i]->gpu_data()),
+          blob->mutable_gpu_diff());
+      blob->ShareDiff(bottom_diff_views_[i]);
+    }
+    return;
+  }
   const Dtype* top_diff = top[0]->gpu_diff();
   if (concat_dim_ == 0) {
     int offset_num = 0;
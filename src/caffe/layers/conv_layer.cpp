@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
@@ -83,8 +89,23 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       bias_filler->Fill(this->blobs_[1].get());
     }
   }
+  is_1x1_ = kernel_h_ == 1 && kernel_w_ == 1
+      && stride_h_ == 1 && stride_w_ == 1 && pad_h_ == 0 && pad_w_ == 0;
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // INT8 inference path.
+  quantize_ = this->layer_param_.quantization_param().quantize();
+  if (quantize_) {
+    const Dtype input_range = this->layer_param_.quantization_param()
+        .input_range();
+    CHECK_GT(input_range, 0)
+        << "quantize requires a calibrated input_range; run calibrate_net.";
+    input_scale_ = Dtype(127) / input_range;
+  }
+  // Depthwise layers (group == channels) would run as group_ GEMMs whose
+  // inner dimension is just the kernel area, far below BLAS peak, so
+  // forward uses the direct kernels in this file and conv_layer.cu.
+  is_depthwise_ = (group_ > 1) && (group_ == channels_) && !quantize_;
 }
 
 template <typename Dtype>
@@ -118,48 +139,290 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   K_ = channels_ * kernel_h_ * kernel_w_ / group_;
   N_ = height_out_ * width_out_;
   // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage.
-  col_buffer_.Reshape(
-      1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  // overly large memory usage. For 1x1 stride-1 unpadded convolution the
+  // unrolling is the identity, so the buffer is skipped entirely and the
+  // GEMMs read the input in place. When even one image's unrolled plane
+  // exceeds col_buffer_max_size (e.g. high-resolution inference), the
+  // buffer holds only a strip of output rows and forward/backward stream
+  // over the strips. The quantized path keeps the full plane: its int8
+  // GEMMs assume contiguous group matrices.
+  col_strip_rows_ = height_out_;
+  const size_t max_col_bytes = static_cast<size_t>(
+      this->layer_param_.convolution_param().col_buffer_max_size());
+  if (max_col_bytes > 0 && !is_1x1_ && !quantize_) {
+    const size_t row_bytes = static_cast<size_t>(channels_) * kernel_h_ *
+        kernel_w_ * width_out_ * sizeof(Dtype);
+    const size_t max_rows = std::max(max_col_bytes / row_bytes,
+        static_cast<size_t>(1));
+    if (max_rows < static_cast<size_t>(height_out_)) {
+      col_strip_rows_ = max_rows;
+    }
+  }
+  if (!is_1x1_) {
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, col_strip_rows_, width_out_);
+    ApplyWorkspace();
+    // Pure scratch: im2col (forward) and the beta = 0 GEMMs (backward)
+    // fully rewrite it before anything reads, so first touch can skip
+    // SyncedMemory's zero fill.
+    col_buffer_.data()->set_skip_zero_fill();
+    col_buffer_.diff()->set_skip_zero_fill();
+  }
+  // Size the forward-to-backward column cache (see
+  // col_buffer_cache_size): whole leading images only, and only on the
+  // full-plane path, since the strip, quantized and depthwise forwards
+  // never materialize the per-image matrix the cache would keep.
+  col_cache_images_ = 0;
+  const size_t cache_bytes = static_cast<size_t>(
+      this->layer_param_.convolution_param().col_buffer_cache_size());
+  if (cache_bytes > 0 && !is_1x1_ && !quantize_ && !is_depthwise_ &&
+      col_strip_rows_ == height_out_) {
+    const size_t image_bytes = static_cast<size_t>(K_) * group_ * N_ *
+        sizeof(Dtype);
+    const size_t total_images = static_cast<size_t>(num_) * bottom.size();
+    col_cache_images_ = static_cast<int>(
+        std::min(total_images, cache_bytes / image_bytes));
+    if (col_cache_images_ > 0) {
+      col_cache_.Reshape(col_cache_images_,
+          channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+      // Each cached slot is written by forward's im2col before backward
+      // reads it, so the zero fill is elidable here too.
+      col_cache_.data()->set_skip_zero_fill();
+    }
+  }
+  if (quantize_) {
+    int8_col_.resize(group_ * K_ * N_);
+    int32_top_.resize(M_ * N_);
+  }
+  // Staging area for the weight/col/top pointer arrays consumed by the
+  // batched GEMM path on the GPU (one slot per group and operand).
+  if (group_ > 1 && !gemm_ptrs_) {
+    gemm_ptrs_.reset(new SyncedMemory(3 * group_ * sizeof(Dtype*)));
+  }
   for (int top_id = 0; top_id < top->size(); ++top_id) {
     (*top)[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
+    // Forward writes every top element (bias pre-broadcast or beta = 0
+    // GEMM), so its first-touch zero fill would be overwritten anyway.
+    (*top)[top_id]->data()->set_skip_zero_fill();
   }
-  // Set up the all ones "bias multiplier" for adding biases by BLAS
+  // Point at the shared all ones "bias multiplier" for adding biases by
+  // BLAS; the cache spares every layer its own allocation and fill.
   if (bias_term_) {
-    bias_multiplier_.Reshape(1, 1, 1, N_);
-    caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    bias_multiplier_ = &Caffe::ones<Dtype>(N_);
+  }
+}
+
+template <typename Dtype>
+size_t ConvolutionLayer<Dtype>::WorkspaceSize() const {
+  return col_buffer_.count() * sizeof(Dtype);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::SetWorkspace(
+    const shared_ptr<SyncedMemory>& data,
+    const shared_ptr<SyncedMemory>& diff) {
+  workspace_data_ = data;
+  workspace_diff_ = diff;
+  ApplyWorkspace();
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ApplyWorkspace() {
+  if (!workspace_data_ || is_1x1_) {
+    return;
+  }
+  const size_t required = col_buffer_.count() * sizeof(Dtype);
+  // If a later Reshape outgrows the arena, Blob::Reshape has already given
+  // the buffer private storage, so just leave it private.
+  if (required <= workspace_data_->size()) {
+    col_buffer_.ShareData(workspace_data_);
+    col_buffer_.ShareDiff(workspace_diff_);
+    // The shared arena is scratch with the same full-overwrite guarantee
+    // as a private col buffer.
+    workspace_data_->set_skip_zero_fill();
+    workspace_diff_->set_skip_zero_fill();
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::SetUpQuantization() {
+  // Symmetric per-layer weight quantization. Done once: the quantized
+  // inference path is for deployed nets whose weights no longer change.
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int count = this->blobs_[0]->count();
+  Dtype max_abs = 0;
+  for (int i = 0; i < count; ++i) {
+    max_abs = std::max(max_abs, std::fabs(weight[i]));
+  }
+  weight_scale_ = max_abs > 0 ? Dtype(127) / max_abs : Dtype(1);
+  int8_weight_.resize(count);
+  caffe_cpu_quantize(count, weight, weight_scale_, &int8_weight_[0]);
+}
+
+// Direct depthwise convolution of one image: with group == channels each
+// output channel depends on a single input channel, so there is nothing
+// to gain from im2col. Per tap (kh, kw), the contribution to a whole
+// output row is a scaled copy of an input row slice, so the innermost
+// loop has unit stride on both sides for stride-1 layers and the
+// compiler can vectorize it.
+template <typename Dtype>
+void DepthwiseConvForwardCpu(const Dtype* bottom, const Dtype* weight,
+    const Dtype* bias, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int multiplier,
+    const int height_out, const int width_out, Dtype* top) {
+  const int num_output = channels * multiplier;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int o = 0; o < num_output; ++o) {
+    const Dtype* in = bottom + (o / multiplier) * height * width;
+    const Dtype* kernel = weight + o * kernel_h * kernel_w;
+    Dtype* out = top + o * height_out * width_out;
+    // Seeding the plane with the bias folds the bias addition into the
+    // accumulation, sparing the separate pass over the output.
+    caffe_set(height_out * width_out, bias ? bias[o] : Dtype(0), out);
+    for (int kh = 0; kh < kernel_h; ++kh) {
+      for (int kw = 0; kw < kernel_w; ++kw) {
+        const Dtype tap = kernel[kh * kernel_w + kw];
+        // The range of output columns whose tap (kh, kw) lands inside
+        // the input row.
+        int wo_begin = 0;
+        if (pad_w > kw) {
+          wo_begin = (pad_w - kw + stride_w - 1) / stride_w;
+        }
+        const int last_wi = width - 1 + pad_w - kw;
+        if (last_wi < 0) {
+          continue;
+        }
+        const int wo_end = std::min(width_out, last_wi / stride_w + 1);
+        for (int ho = 0; ho < height_out; ++ho) {
+          const int hi = ho * stride_h - pad_h + kh;
+          if (hi < 0 || hi >= height) {
+            continue;
+          }
+          const Dtype* in_row = in + hi * width - pad_w + kw;
+          Dtype* out_row = out + ho * width_out;
+          if (stride_w == 1) {
+            for (int wo = wo_begin; wo < wo_end; ++wo) {
+              out_row[wo] += tap * in_row[wo];
+            }
+          } else {
+            for (int wo = wo_begin; wo < wo_end; ++wo) {
+              out_row[wo] += tap * in_row[wo * stride_w];
+            }
+          }
+        }
+      }
+    }
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (quantize_ && int8_weight_.empty()) {
+    SetUpQuantization();
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    Dtype* col_data = col_buffer_.mutable_cpu_data();
     const Dtype* weight = this->blobs_[0]->cpu_data();
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    if (is_depthwise_) {
+      const int multiplier = num_output_ / group_;
+      for (int n = 0; n < num_; ++n) {
+        DepthwiseConvForwardCpu(bottom_data + bottom[i]->offset(n), weight,
+            bias, channels_, height_, width_, kernel_h_, kernel_w_,
+            pad_h_, pad_w_, stride_h_, stride_w_, multiplier,
+            height_out_, width_out_, top_data + (*top)[i]->offset(n));
+      }
+      continue;
+    }
+    Dtype* col_buff = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
     int weight_offset = M_ * K_;  // number of filter parameters in a group
     int col_offset = K_ * N_;  // number of values in an input region / column
     int top_offset = M_ * N_;  // number of values in an output region / column
     for (int n = 0; n < num_; ++n) {
+      // Broadcast the bias into the output first -- a cheap strided
+      // fill -- and let the main GEMMs add onto it with beta = 1. The
+      // old rank-1 bias GEMM epilogue cost an extra full read + write
+      // pass over the output after the main multiplication.
+      if (bias && !quantize_) {
+        for (int c = 0; c < num_output_; ++c) {
+          caffe_set(N_, bias[c],
+              top_data + (*top)[i]->offset(n) + c * N_);
+        }
+      }
+      const Dtype beta = (bias && !quantize_) ? Dtype(1) : Dtype(0);
+      if (col_strip_rows_ < height_out_) {
+        // The capped column buffer holds only col_strip_rows_ output
+        // rows, so stream over strips; each strip is a narrower GEMM
+        // writing straight into its rows of the top.
+        for (int h0 = 0; h0 < height_out_; h0 += col_strip_rows_) {
+          const int h1 = std::min(height_out_, h0 + col_strip_rows_);
+          const int strip_n = (h1 - h0) * width_out_;
+          im2col_strip_cpu(bottom_data + bottom[i]->offset(n), channels_,
+              height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              stride_h_, stride_w_, h0, h1, col_buff);
+          for (int g = 0; g < group_; ++g) {
+            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, strip_n,
+                K_, (Dtype)1., weight + weight_offset * g, K_,
+                col_buff + K_ * strip_n * g, strip_n, beta,
+                top_data + (*top)[i]->offset(n) + top_offset * g
+                + h0 * width_out_, N_);
+          }
+        }
+        continue;
+      }
       // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      im2col_cpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
-      // Take inner products for groups.
-      for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+      // into column matrix for multplication. For 1x1 convolution the
+      // input already is that matrix, so it feeds the GEMMs directly.
+      // Images with a cache slot unroll into it so that backward can
+      // consume the matrix instead of redoing the im2col.
+      const Dtype* col_data = bottom_data + bottom[i]->offset(n);
+      if (!is_1x1_) {
+        const int cache_index = i * num_ + n;
+        Dtype* col_target = cache_index < col_cache_images_ ?
+            col_cache_.mutable_cpu_data() + col_cache_.offset(cache_index) :
+            col_buff;
+        im2col_cpu(col_data, channels_, height_,
+            width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+            col_target);
+        col_data = col_target;
       }
-      // Add bias.
-      if (bias_term_) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-            N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-            bias_multiplier_.cpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+      // Take inner products for groups.
+      if (quantize_) {
+        // int8 GEMM with int32 accumulation; the combined scale undoes
+        // both quantizations on the way back to Dtype.
+        caffe_cpu_quantize(col_offset * group_, col_data, input_scale_,
+            &int8_col_[0]);
+        const Dtype dequant_scale = Dtype(1) / (input_scale_ * weight_scale_);
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_igemm(CblasNoTrans, M_, N_, K_,
+              &int8_weight_[weight_offset * g], &int8_col_[col_offset * g],
+              &int32_top_[0]);
+          caffe_cpu_dequantize(M_ * N_, &int32_top_[0], dequant_scale,
+              top_data + (*top)[i]->offset(n) + top_offset * g);
+        }
+        // The dequantization overwrites the top, so the bias cannot be
+        // pre-broadcast; add it with the rank-1 GEMM as before.
+        if (bias) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+              N_, 1, (Dtype)1., bias, bias_multiplier_->cpu_data(),
+              (Dtype)1., top_data + (*top)[i]->offset(n));
+        }
+      } else {
+        // Each group reads and writes a disjoint slice, so the small
+        // per-group multiplications can be dispatched in parallel.
+#ifdef _OPENMP
+#pragma omp parallel for if (group_ > 1)
+#endif
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+            (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
+            beta, top_data + (*top)[i]->offset(n) + top_offset * g);
+        }
       }
     }
   }
@@ -173,12 +436,10 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (this->param_propagate_down_[0]) {
     weight = this->blobs_[0]->cpu_data();
     weight_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
   }
   Dtype* bias_diff = NULL;
   if (bias_term_ && this->param_propagate_down_[1]) {
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   const int weight_offset = M_ * K_;
   const int col_offset = K_ * N_;
@@ -191,7 +452,7 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       for (int n = 0; n < num_; ++n) {
         caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
             1., top_diff + top[0]->offset(n),
-            bias_multiplier_.cpu_data(), 1.,
+            bias_multiplier_->cpu_data(), 1.,
             bias_diff);
       }
     }
@@ -199,18 +460,168 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->cpu_diff();
       }
-      Dtype* col_data = col_buffer_.mutable_cpu_data();
-      Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+      Dtype* col_buff_data = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
+      Dtype* col_buff_diff = is_1x1_ ? NULL : col_buffer_.mutable_cpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->cpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
+#ifdef _OPENMP
+      // With private col buffers the images in the batch are independent,
+      // so spread the batch loop across threads instead of the (usually
+      // much smaller) group loop. With a capped column buffer the
+      // per-thread full-plane scratch would defeat the cap, so the strip
+      // loop below runs instead.
+      const int batch_threads = col_strip_rows_ < height_out_ ? 1 :
+          std::min(num_, omp_get_max_threads());
+#else
+      const int batch_threads = 1;
+#endif
+      if (batch_threads > 1) {
+#ifdef _OPENMP
+        if (propagate_down[i] && weight == NULL) {
+          weight = this->blobs_[0]->cpu_data();
+        }
+        // Weight gradients for the whole batch accumulate into one blob, so
+        // every thread past the first gets a private, zero-initialized
+        // scratch diff that is reduced into the shared diff after the loop.
+        const int weight_count = this->blobs_[0]->count();
+        vector<Dtype> weight_diff_scratch;
+        if (this->param_propagate_down_[0]) {
+          weight_diff_scratch.resize(
+              static_cast<size_t>(batch_threads - 1) * weight_count, Dtype(0));
+        }
+        const size_t col_count = static_cast<size_t>(col_offset) * group_;
+        vector<Dtype> col_data_scratch;
+        vector<Dtype> col_diff_scratch;
+        if (!is_1x1_) {
+          col_data_scratch.resize(batch_threads * col_count);
+          if (propagate_down[i]) {
+            col_diff_scratch.resize(batch_threads * col_count);
+          }
+        }
+#pragma omp parallel for num_threads(batch_threads)
+        for (int n = 0; n < num_; ++n) {
+          const int tid = omp_get_thread_num();
+          const Dtype* col_data = bottom_data + (*bottom)[i]->offset(n);
+          Dtype* col_diff = bottom_diff + (*bottom)[i]->offset(n);
+          if (!is_1x1_) {
+            const int cache_index = i * num_ + n;
+            if (cache_index < col_cache_images_) {
+              // The forward pass cached this image's col matrix.
+              col_data =
+                  col_cache_.cpu_data() + col_cache_.offset(cache_index);
+            } else {
+              Dtype* col_buff = &col_data_scratch[tid * col_count];
+              im2col_cpu(col_data, channels_, height_,
+                         width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                         stride_h_, stride_w_, col_buff);
+              col_data = col_buff;
+            }
+            if (propagate_down[i]) {
+              col_diff = &col_diff_scratch[tid * col_count];
+            }
+          }
+          // gradient w.r.t. weight. Thread 0 accumulates into the shared
+          // diff directly; the rest into their scratch buffers.
+          if (this->param_propagate_down_[0]) {
+            Dtype* diff_target = tid == 0 ? weight_diff :
+                &weight_diff_scratch[
+                    static_cast<size_t>(tid - 1) * weight_count];
+            for (int g = 0; g < group_; ++g) {
+              caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+                  (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
+                  col_data + col_offset * g, (Dtype)1.,
+                  diff_target + weight_offset * g);
+            }
+          }
+          // gradient w.r.t. bottom data, if necessary.
+          if (propagate_down[i]) {
+            for (int g = 0; g < group_; ++g) {
+              caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+                  (Dtype)1., weight + weight_offset * g,
+                  top_diff + top[i]->offset(n) + top_offset * g,
+                  (Dtype)0., col_diff + col_offset * g);
+            }
+            if (!is_1x1_) {
+              col2im_cpu(col_diff, channels_, height_, width_,
+                  kernel_h_, kernel_w_, pad_h_, pad_w_,
+                  stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
+            }
+          }
+        }
+        if (this->param_propagate_down_[0]) {
+          for (int t = 0; t < batch_threads - 1; ++t) {
+            caffe_axpy<Dtype>(weight_count, Dtype(1),
+                &weight_diff_scratch[static_cast<size_t>(t) * weight_count],
+                weight_diff);
+          }
+        }
+#endif  // _OPENMP
+        continue;
+      }
+      if (propagate_down[i] && weight == NULL) {
+        weight = this->blobs_[0]->cpu_data();
+      }
       for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        im2col_cpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+        if (col_strip_rows_ < height_out_) {
+          // Stream over output-row strips with the capped column buffer.
+          // The strips' filter windows overlap on the input, so the
+          // bottom diff is zeroed once and every strip accumulates.
+          if (propagate_down[i]) {
+            caffe_set(channels_ * height_ * width_, Dtype(0),
+                bottom_diff + (*bottom)[i]->offset(n));
+          }
+          for (int h0 = 0; h0 < height_out_; h0 += col_strip_rows_) {
+            const int h1 = std::min(height_out_, h0 + col_strip_rows_);
+            const int strip_n = (h1 - h0) * width_out_;
+            const Dtype* strip_top_diff = top_diff + top[i]->offset(n)
+                + h0 * width_out_;
+            im2col_strip_cpu(bottom_data + (*bottom)[i]->offset(n),
+                channels_, height_, width_, kernel_h_, kernel_w_, pad_h_,
+                pad_w_, stride_h_, stride_w_, h0, h1, col_buff_data);
+            if (this->param_propagate_down_[0]) {
+              for (int g = 0; g < group_; ++g) {
+                caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_,
+                    strip_n, (Dtype)1., strip_top_diff + top_offset * g,
+                    N_, col_buff_data + K_ * strip_n * g, strip_n,
+                    (Dtype)1., weight_diff + weight_offset * g, K_);
+              }
+            }
+            if (propagate_down[i]) {
+              for (int g = 0; g < group_; ++g) {
+                caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_,
+                    strip_n, M_, (Dtype)1., weight + weight_offset * g, K_,
+                    strip_top_diff + top_offset * g, N_, (Dtype)0.,
+                    col_buff_diff + K_ * strip_n * g, strip_n);
+              }
+              col2im_strip_cpu(col_buff_diff, channels_, height_, width_,
+                  kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+                  stride_w_, h0, h1, bottom_diff + (*bottom)[i]->offset(n));
+            }
+          }
+          continue;
+        }
+        // Images the forward pass cached keep their col matrix; the rest
+        // saved the memory and recompute it here. For 1x1 convolution
+        // the col matrices alias the bottom data and diff directly.
+        const Dtype* col_data = bottom_data + (*bottom)[i]->offset(n);
+        Dtype* col_diff = bottom_diff + (*bottom)[i]->offset(n);
+        if (!is_1x1_) {
+          const int cache_index = i * num_ + n;
+          if (cache_index < col_cache_images_) {
+            col_data = col_cache_.cpu_data() + col_cache_.offset(cache_index);
+          } else {
+            im2col_cpu(col_data, channels_, height_,
+                       width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                       stride_h_, stride_w_, col_buff_data);
+            col_data = col_buff_data;
+          }
+          col_diff = col_buff_diff;
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
+#ifdef _OPENMP
+#pragma omp parallel for if (group_ > 1)
+#endif
           for (int g = 0; g < group_; ++g) {
             caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
                 (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
@@ -223,6 +634,9 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
           if (weight == NULL) {
             weight = this->blobs_[0]->cpu_data();
           }
+#ifdef _OPENMP
+#pragma omp parallel for if (group_ > 1)
+#endif
           for (int g = 0; g < group_; ++g) {
             caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
                 (Dtype)1., weight + weight_offset * g,
@@ -230,9 +644,11 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                 (Dtype)0., col_diff + col_offset * g);
           }
           // col2im back to the data
-          col2im_cpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_,
-              stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
+          if (!is_1x1_) {
+            col2im_cpu(col_diff, channels_, height_, width_,
+                kernel_h_, kernel_w_, pad_h_, pad_w_,
+                stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
+          }
         }
       }
     }
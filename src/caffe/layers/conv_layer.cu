@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -8,6 +9,76 @@
 
 namespace caffe {
 
+// Stage the per-group operand pointers in ptrs ([A | B | C], one slot per
+// group) and issue a single batched GEMM covering all groups, replacing
+// group separate launches of small multiplications.
+template <typename Dtype>
+void gpu_gemm_grouped(SyncedMemory* ptrs, const int groups,
+    const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+    const int M, const int N, const int K, const Dtype alpha,
+    const Dtype* A, const int A_stride, const Dtype* B, const int B_stride,
+    const Dtype beta, Dtype* C, const int C_stride) {
+  const Dtype** cpu_ptrs = static_cast<const Dtype**>(ptrs->mutable_cpu_data());
+  for (int g = 0; g < groups; ++g) {
+    cpu_ptrs[g] = A + A_stride * g;
+    cpu_ptrs[groups + g] = B + B_stride * g;
+    cpu_ptrs[2 * groups + g] = C + C_stride * g;
+  }
+  const Dtype** gpu_ptrs = reinterpret_cast<const Dtype**>(
+      const_cast<void*>(ptrs->gpu_data()));
+  caffe_gpu_gemm_batched<Dtype>(TransA, TransB, M, N, K, alpha,
+      gpu_ptrs, gpu_ptrs + groups, beta,
+      const_cast<Dtype**>(gpu_ptrs + 2 * groups), groups);
+}
+
+// Direct depthwise convolution, one thread per output element; a single
+// launch covers every image and channel of the batch, replacing the
+// per-group GEMMs whose inner dimension is just the kernel area.
+template <typename Dtype>
+__global__ void DepthwiseConvForward(const int n, const Dtype* bottom_data,
+    const Dtype* weight, const Dtype* bias, const int channels,
+    const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int multiplier, const int height_out,
+    const int width_out, Dtype* top_data) {
+  const int num_output = channels * multiplier;
+  CUDA_KERNEL_LOOP(index, n) {
+    const int wo = index % width_out;
+    const int ho = (index / width_out) % height_out;
+    const int o = (index / width_out / height_out) % num_output;
+    const int im = index / width_out / height_out / num_output;
+    const Dtype* in = bottom_data +
+        (im * channels + o / multiplier) * height * width;
+    const Dtype* kernel = weight + o * kernel_h * kernel_w;
+    const int h_base = ho * stride_h - pad_h;
+    const int w_base = wo * stride_w - pad_w;
+    // Seeding the accumulator with the bias folds the bias addition into
+    // this launch, sparing the per-image rank-1 GEMMs over the output.
+    Dtype value = bias ? bias[o] : Dtype(0);
+    for (int kh = 0; kh < kernel_h; ++kh) {
+      const int hi = h_base + kh;
+      if (hi < 0 || hi >= height) { continue; }
+      for (int kw = 0; kw < kernel_w; ++kw) {
+        const int wi = w_base + kw;
+        if (wi < 0 || wi >= width) { continue; }
+        value += kernel[kh * kernel_w + kw] * in[hi * width + wi];
+      }
+    }
+    top_data[index] = value;
+  }
+}
+
+// Broadcast the bias over the whole batch's output so the main GEMMs can
+// run with beta = 1, replacing the rank-1 bias GEMMs that reread and
+// rewrote the full output afterwards.
+template <typename Dtype>
+__global__ void BiasFillKernel(const int n, const Dtype* bias,
+    const int num_output, const int spatial_dim, Dtype* top_data) {
+  CUDA_KERNEL_LOOP(index, n) {
+    top_data[index] = bias[(index / spatial_dim) % num_output];
+  }
+}
+
 /// @brief refer to CPU forward -- the BLAS implementation is the same.
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
@@ -15,29 +86,79 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* top_data = (*top)[i]->mutable_gpu_data();
-    Dtype* col_data = col_buffer_.mutable_gpu_data();
     const Dtype* weight = this->blobs_[0]->gpu_data();
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->gpu_data() : NULL;
+    if (is_depthwise_) {
+      const int multiplier = num_output_ / group_;
+      const int count = (*top)[i]->count();
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      DepthwiseConvForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(count, bottom_data, weight, bias,
+          channels_, height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+          stride_h_, stride_w_, multiplier, height_out_, width_out_,
+          top_data);
+      CUDA_POST_KERNEL_CHECK;
+      continue;
+    }
+    if (bias) {
+      const int count = (*top)[i]->count();
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      BiasFillKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(count, bias, num_output_, N_, top_data);
+      CUDA_POST_KERNEL_CHECK;
+    }
+    const Dtype beta = bias ? (Dtype)1. : (Dtype)0.;
+    Dtype* col_buff = is_1x1_ ? NULL : col_buffer_.mutable_gpu_data();
     int weight_offset = M_ * K_;
     int col_offset = K_ * N_;
     int top_offset = M_ * N_;
     for (int n = 0; n < num_; ++n) {
+      if (col_strip_rows_ < height_out_) {
+        // The capped column buffer holds only col_strip_rows_ output
+        // rows, so stream over strips; each strip is a narrower GEMM
+        // writing straight into its rows of the top.
+        for (int h0 = 0; h0 < height_out_; h0 += col_strip_rows_) {
+          const int h1 = std::min(height_out_, h0 + col_strip_rows_);
+          const int strip_n = (h1 - h0) * width_out_;
+          im2col_strip_gpu(bottom_data + bottom[i]->offset(n), channels_,
+              height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              stride_h_, stride_w_, h0, h1, col_buff);
+          for (int g = 0; g < group_; ++g) {
+            caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, strip_n,
+                K_, (Dtype)1., weight + weight_offset * g, K_,
+                col_buff + K_ * strip_n * g, strip_n, beta,
+                top_data + (*top)[i]->offset(n) + top_offset * g
+                + h0 * width_out_, N_);
+          }
+        }
+        continue;
+      }
       // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      im2col_gpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
+      // into column matrix for multplication. For 1x1 convolution the
+      // input already is that matrix, so it feeds the GEMMs directly.
+      // Images with a cache slot unroll into it so that backward can
+      // consume the matrix instead of redoing the im2col.
+      const Dtype* col_data = bottom_data + bottom[i]->offset(n);
+      if (!is_1x1_) {
+        const int cache_index = i * num_ + n;
+        Dtype* col_target = cache_index < col_cache_images_ ?
+            col_cache_.mutable_gpu_data() + col_cache_.offset(cache_index) :
+            col_buff;
+        im2col_gpu(col_data, channels_, height_,
+            width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+            col_target);
+        col_data = col_target;
+      }
       // Take inner products for groups.
-      for (int g = 0; g < group_; ++g) {
+      if (group_ > 1) {
+        gpu_gemm_grouped<Dtype>(gemm_ptrs_.get(), group_,
+            CblasNoTrans, CblasNoTrans, M_, N_, K_,
+            (Dtype)1., weight, weight_offset, col_data, col_offset,
+            beta, top_data + (*top)[i]->offset(n), top_offset);
+      } else {
         caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-      }
-      // Add bias.
-      if (bias_term_) {
-        caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-            N_, 1, (Dtype)1., this->blobs_[1]->gpu_data(),
-            bias_multiplier_.gpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+          (Dtype)1., weight, col_data,
+          beta, top_data + (*top)[i]->offset(n));
       }
     }
   }
@@ -52,12 +173,10 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   if (this->param_propagate_down_[0]) {
     weight = this->blobs_[0]->gpu_data();
     weight_diff = this->blobs_[0]->mutable_gpu_diff();
-    caffe_gpu_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
   }
   Dtype* bias_diff = NULL;
   if (bias_term_ && this->param_propagate_down_[1]) {
     bias_diff = this->blobs_[1]->mutable_gpu_diff();
-    caffe_gpu_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   const int weight_offset = M_ * K_;
   const int col_offset = K_ * N_;
@@ -70,7 +189,7 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       for (int n = 0; n < num_; ++n) {
         caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
             1., top_diff + top[0]->offset(n),
-            bias_multiplier_.gpu_data(), 1.,
+            bias_multiplier_->gpu_data(), 1.,
             bias_diff);
       }
     }
@@ -78,23 +197,80 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->gpu_diff();
       }
-      Dtype* col_data = col_buffer_.mutable_gpu_data();
-      Dtype* col_diff = col_buffer_.mutable_gpu_diff();
+      Dtype* col_buff_data = is_1x1_ ? NULL : col_buffer_.mutable_gpu_data();
+      Dtype* col_buff_diff = is_1x1_ ? NULL : col_buffer_.mutable_gpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->gpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_gpu_diff();
+      if (propagate_down[i] && weight == NULL) {
+        weight = this->blobs_[0]->gpu_data();
+      }
       for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        im2col_gpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+        if (col_strip_rows_ < height_out_) {
+          // Stream over output-row strips with the capped column buffer.
+          // The strips' filter windows overlap on the input, so the
+          // bottom diff is zeroed once and every strip accumulates.
+          if (propagate_down[i]) {
+            caffe_gpu_set(channels_ * height_ * width_, Dtype(0),
+                bottom_diff + (*bottom)[i]->offset(n));
+          }
+          for (int h0 = 0; h0 < height_out_; h0 += col_strip_rows_) {
+            const int h1 = std::min(height_out_, h0 + col_strip_rows_);
+            const int strip_n = (h1 - h0) * width_out_;
+            const Dtype* strip_top_diff = top_diff + top[i]->offset(n)
+                + h0 * width_out_;
+            im2col_strip_gpu(bottom_data + (*bottom)[i]->offset(n),
+                channels_, height_, width_, kernel_h_, kernel_w_, pad_h_,
+                pad_w_, stride_h_, stride_w_, h0, h1, col_buff_data);
+            if (this->param_propagate_down_[0]) {
+              for (int g = 0; g < group_; ++g) {
+                caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_,
+                    strip_n, (Dtype)1., strip_top_diff + top_offset * g,
+                    N_, col_buff_data + K_ * strip_n * g, strip_n,
+                    (Dtype)1., weight_diff + weight_offset * g, K_);
+              }
+            }
+            if (propagate_down[i]) {
+              for (int g = 0; g < group_; ++g) {
+                caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_,
+                    strip_n, M_, (Dtype)1., weight + weight_offset * g, K_,
+                    strip_top_diff + top_offset * g, N_, (Dtype)0.,
+                    col_buff_diff + K_ * strip_n * g, strip_n);
+              }
+              col2im_strip_gpu(col_buff_diff, channels_, height_, width_,
+                  kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+                  stride_w_, h0, h1, bottom_diff + (*bottom)[i]->offset(n));
+            }
+          }
+          continue;
+        }
+        // Images the forward pass cached keep their col matrix; the rest
+        // saved the memory and recompute it here. For 1x1 convolution
+        // the col matrices alias the bottom data and diff directly.
+        const Dtype* col_data = bottom_data + (*bottom)[i]->offset(n);
+        Dtype* col_diff = bottom_diff + (*bottom)[i]->offset(n);
+        if (!is_1x1_) {
+          const int cache_index = i * num_ + n;
+          if (cache_index < col_cache_images_) {
+            col_data = col_cache_.gpu_data() + col_cache_.offset(cache_index);
+          } else {
+            im2col_gpu(col_data, channels_, height_,
+                       width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                       stride_h_, stride_w_, col_buff_data);
+            col_data = col_buff_data;
+          }
+          col_diff = col_buff_diff;
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          for (int g = 0; g < group_; ++g) {
+          if (group_ > 1) {
+            gpu_gemm_grouped<Dtype>(gemm_ptrs_.get(), group_,
+                CblasNoTrans, CblasTrans, M_, K_, N_,
+                (Dtype)1., top_diff + top[i]->offset(n), top_offset,
+                col_data, col_offset, (Dtype)1., weight_diff, weight_offset);
+          } else {
             caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_data + col_offset * g, (Dtype)1.,
-                weight_diff + weight_offset * g);
+                (Dtype)1., top_diff + top[i]->offset(n),
+                col_data, (Dtype)1., weight_diff);
           }
         }
         // gradient w.r.t. bottom data, if necessary
@@ -102,16 +278,23 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
           if (weight == NULL) {
             weight = this->blobs_[0]->gpu_data();
           }
-          for (int g = 0; g < group_; ++g) {
+          if (group_ > 1) {
+            gpu_gemm_grouped<Dtype>(gemm_ptrs_.get(), group_,
+                CblasTrans, CblasNoTrans, K_, N_, M_,
+                (Dtype)1., weight, weight_offset,
+                top_diff + top[i]->offset(n), top_offset,
+                (Dtype)0., col_diff, col_offset);
+          } else {
             caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
+                (Dtype)1., weight, top_diff + top[i]->offset(n),
+                (Dtype)0., col_diff);
           }
           // col2im back to the data
-          col2im_gpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-              bottom_diff + (*bottom)[i]->offset(n));
+          if (!is_1x1_) {
+            col2im_gpu(col_diff, channels_, height_, width_,
+                kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+                bottom_diff + (*bottom)[i]->offset(n));
+          }
         }
       }
     }
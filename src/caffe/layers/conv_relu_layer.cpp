@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ConvolutionReLULayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+  // Rectify in place while the output is still warm in cache, instead of
+  // paying a separate layer's read-modify-write pass.
+  const Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+  for (int i = 0; i < top->size(); ++i) {
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    const int count = (*top)[i]->count();
+    for (int j = 0; j < count; ++j) {
+      top_data[j] = std::max(top_data[j], Dtype(0))
+          + negative_slope * std::min(top_data[j], Dtype(0));
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  // Fold the rectification derivative into the top diff in place, then let
+  // the convolution backward pass run unchanged. The sign of the rectified
+  // output determines the ReLU gradient, so the pre-activation values need
+  // not be kept around.
+  const Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_data = top[i]->cpu_data();
+    Dtype* top_diff = top[i]->mutable_cpu_diff();
+    const int count = top[i]->count();
+    for (int j = 0; j < count; ++j) {
+      top_diff[j] *= (top_data[j] > 0)
+          + (top_data[j] <= 0) * negative_slope;
+    }
+  }
+  ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(ConvolutionReLULayer);
+#endif
+
+INSTANTIATE_CLASS(ConvolutionReLULayer);
+
+}  // namespace caffe
@@ -0,0 +1,58 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__global__ void ConvReLUForward(const int n, Dtype* data,
+    Dtype negative_slope) {
+  CUDA_KERNEL_LOOP(index, n) {
+    data[index] = data[index] > 0 ? data[index]
+        : data[index] * negative_slope;
+  }
+}
+
+template <typename Dtype>
+__global__ void ConvReLUBackward(const int n, const Dtype* data, Dtype* diff,
+    Dtype negative_slope) {
+  CUDA_KERNEL_LOOP(index, n) {
+    diff[index] *= (data[index] > 0) + (data[index] <= 0) * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionReLULayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Forward_gpu(bottom, top);
+  const Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+  for (int i = 0; i < top->size(); ++i) {
+    Dtype* top_data = (*top)[i]->mutable_gpu_data();
+    const int count = (*top)[i]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ConvReLUForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, top_data, negative_slope);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionReLULayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_data = top[i]->gpu_data();
+    Dtype* top_diff = top[i]->mutable_gpu_diff();
+    const int count = top[i]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ConvReLUBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, top_data, top_diff, negative_slope);
+    CUDA_POST_KERNEL_CHECK;
+  }
+  ConvolutionLayer<Dtype>::Backward_gpu(top, propagate_down, bottom);
+}
+
+INSTANTIATE_CLASS(ConvolutionReLULayer);
+
+}  // namespace caffe
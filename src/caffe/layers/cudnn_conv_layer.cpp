@@ -1,8 +1,12 @@
 #ifdef USE_CUDNN
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -21,14 +25,18 @@ template <typename Dtype>
 void CuDNNConvolutionLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
-  // Initialize CUDA streams and cuDNN.
+  // Borrow CUDA streams and cuDNN handles from the singleton's shared
+  // pool. Handle creation is expensive, and every convolution layer in
+  // the net wanting the same indices means the whole net pays for at
+  // most max(group_) * CUDNN_STREAMS_PER_GROUP creations instead of one
+  // set per layer. Sharing is safe: layers on a thread run one at a
+  // time, and the streams keep the intra-layer parallelism.
   stream_         = new cudaStream_t[this->group_ * CUDNN_STREAMS_PER_GROUP];
   handle_         = new cudnnHandle_t[this->group_ * CUDNN_STREAMS_PER_GROUP];
 
   for (int g = 0; g < this->group_ * CUDNN_STREAMS_PER_GROUP; g++) {
-    CUDA_CHECK(cudaStreamCreate(&stream_[g]));
-    CUDNN_CHECK(cudnnCreate(&handle_[g]));
-    CUDNN_CHECK(cudnnSetStream(handle_[g], stream_[g]));
+    handle_[g] = Caffe::cudnn_handle(g);
+    stream_[g] = Caffe::cudnn_stream(g);
   }
 
   // Set the indexing parameters.
@@ -94,6 +102,63 @@ void CuDNNConvolutionLayer<Dtype>::Reshape(
     cudnn::setTensor4dDesc<Dtype>(&bias_desc_,
         1, this->num_output_ / this->group_, 1, 1);
   }
+
+  if (this->layer_param_.convolution_param().engine() ==
+      ConvolutionParameter_Engine_AUTOTUNE) {
+    AutotuneEngine(bottom, top);
+  }
+}
+
+template <typename Dtype>
+void CuDNNConvolutionLayer<Dtype>::AutotuneEngine(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (Caffe::mode() != Caffe::GPU) {
+    return;
+  }
+  std::ostringstream key_stream;
+  key_stream << "conv_n" << this->num_ << "_c" << this->channels_
+      << "_h" << this->height_ << "_w" << this->width_
+      << "_o" << this->num_output_
+      << "_k" << this->kernel_h_ << "x" << this->kernel_w_
+      << "_s" << this->stride_h_ << "x" << this->stride_w_
+      << "_p" << this->pad_h_ << "x" << this->pad_w_
+      << "_g" << this->group_ << "_e" << sizeof(Dtype);
+  const string key = key_stream.str();
+  if (key == tuned_key_) {
+    return;
+  }
+  const string& cache_file =
+      this->layer_param_.convolution_param().autotune_cache();
+  string cached_engine;
+  if (AutotuneLookup(cache_file, key, &cached_engine)) {
+    use_caffe_engine_ = (cached_engine == "caffe");
+    tuned_key_ = key;
+    return;
+  }
+  // Time a few forward passes with each engine on the freshly reshaped
+  // blobs; the buffer contents do not matter for the timing. The Timer
+  // brackets the runs with CUDA events, so no explicit sync is needed.
+  const int kWarmupRuns = 1;
+  const int kTimedRuns = 3;
+  Timer timer;
+  float engine_time[2];
+  for (int e = 0; e < 2; ++e) {
+    use_caffe_engine_ = (e == 0);
+    for (int i = 0; i < kWarmupRuns + kTimedRuns; ++i) {
+      if (i == kWarmupRuns) {
+        timer.Start();
+      }
+      Forward_gpu(bottom, top);
+    }
+    timer.Stop();
+    engine_time[e] = timer.MilliSeconds();
+  }
+  use_caffe_engine_ = engine_time[0] < engine_time[1];
+  tuned_key_ = key;
+  LOG(INFO) << "Autotuned " << key << ": caffe " << engine_time[0]
+      << " ms, cudnn " << engine_time[1] << " ms; using "
+      << (use_caffe_engine_ ? "caffe" : "cudnn");
+  AutotuneStore(cache_file, key, use_caffe_engine_ ? "caffe" : "cudnn");
 }
 
 template <typename Dtype>
@@ -108,11 +173,8 @@ CuDNNConvolutionLayer<Dtype>::~CuDNNConvolutionLayer() {
   }
   cudnnDestroyFilterDescriptor(filter_desc_);
 
-  for (int g = 0; g < this->group_ * CUDNN_STREAMS_PER_GROUP; g++) {
-    cudaStreamDestroy(stream_[g]);
-    cudnnDestroy(handle_[g]);
-  }
-
+  // The handles and streams belong to the singleton's pool, which
+  // outlives the layer; only the index arrays are ours.
   delete [] stream_;
   delete [] handle_;
 }
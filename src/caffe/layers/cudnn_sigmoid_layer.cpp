@@ -11,8 +11,8 @@ template <typename Dtype>
 void CuDNNSigmoidLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   SigmoidLayer<Dtype>::LayerSetUp(bottom, top);
-  // initialize cuDNN
-  CUDNN_CHECK(cudnnCreate(&handle_));
+  // initialize cuDNN (the handle is borrowed from the singleton pool)
+  handle_ = Caffe::cudnn_handle(0);
   cudnn::createTensor4dDesc<Dtype>(&bottom_desc_);
   cudnn::createTensor4dDesc<Dtype>(&top_desc_);
 }
@@ -33,7 +33,6 @@ template <typename Dtype>
 CuDNNSigmoidLayer<Dtype>::~CuDNNSigmoidLayer() {
   cudnnDestroyTensor4dDescriptor(this->bottom_desc_);
   cudnnDestroyTensor4dDescriptor(this->top_desc_);
-  cudnnDestroy(this->handle_);
 }
 
 INSTANTIATE_CLASS(CuDNNSigmoidLayer);
@@ -15,8 +15,8 @@ template <typename Dtype>
 void CuDNNSoftmaxLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   SoftmaxLayer<Dtype>::LayerSetUp(bottom, top);
-  // Initialize CUDNN.
-  CUDNN_CHECK(cudnnCreate(&handle_));
+  // Initialize CUDNN with a handle borrowed from the singleton pool.
+  handle_ = Caffe::cudnn_handle(0);
   cudnn::createTensor4dDesc<Dtype>(&bottom_desc_);
   cudnn::createTensor4dDesc<Dtype>(&top_desc_);
 }
@@ -37,7 +37,6 @@ template <typename Dtype>
 CuDNNSoftmaxLayer<Dtype>::~CuDNNSoftmaxLayer() {
   cudnnDestroyTensor4dDescriptor(bottom_desc_);
   cudnnDestroyTensor4dDescriptor(top_desc_);
-  cudnnDestroy(handle_);
 }
 
 INSTANTIATE_CLASS(CuDNNSoftmaxLayer);
@@ -1,6 +1,15 @@
+#include <boost/thread.hpp>
+#include <ctype.h>
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
 #include <stdint.h>
+#include <stdio.h>
 
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -8,14 +17,34 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+namespace {
+
+// Entry of the background page-cache warmup thread (see warm_page_cache
+// in DataParameter). Owns its copy of the source paths, so it never
+// races the layer's own state.
+void WarmupEntry(const vector<string> sources) {
+  size_t bytes = 0;
+  for (int i = 0; i < sources.size(); ++i) {
+    bytes += WarmPageCache(sources[i]);
+  }
+  LOG(INFO) << "Page-cache warmup touched "
+      << bytes / (1024 * 1024) << " MB.";
+}
+
+}  // namespace
+
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
+  if (warmup_thread_) {
+    warmup_thread_->join();
+  }
   this->JoinPrefetchThread();
   // clean up the database resources
   switch (this->layer_param_.data_param().backend()) {
@@ -26,6 +55,12 @@ DataLayer<Dtype>::~DataLayer<Dtype>() {
     mdb_close(mdb_env_, mdb_dbi_);
     mdb_txn_abort(mdb_txn_);
     mdb_env_close(mdb_env_);
+    for (int i = 0; i < extra_mdb_envs_.size(); ++i) {
+      mdb_cursor_close(extra_mdb_cursors_[i]);
+      mdb_close(extra_mdb_envs_[i], extra_mdb_dbis_[i]);
+      mdb_txn_abort(extra_mdb_txns_[i]);
+      mdb_env_close(extra_mdb_envs_[i]);
+    }
     break;
   default:
     LOG(FATAL) << "Unknown database backend";
@@ -42,6 +77,16 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     leveldb::DB* db_temp;
     leveldb::Options options = GetLevelDBOptions();
     options.create_if_missing = false;
+    if (this->layer_param_.data_param().leveldb_cache_size() > 0) {
+      leveldb_cache_.reset(leveldb::NewLRUCache(
+          this->layer_param_.data_param().leveldb_cache_size()));
+      options.block_cache = leveldb_cache_.get();
+    }
+    if (this->layer_param_.data_param().leveldb_bloom_bits() > 0) {
+      leveldb_filter_.reset(leveldb::NewBloomFilterPolicy(
+          this->layer_param_.data_param().leveldb_bloom_bits()));
+      options.filter_policy = leveldb_filter_.get();
+    }
     LOG(INFO) << "Opening leveldb " << this->layer_param_.data_param().source();
     leveldb::Status status = leveldb::DB::Open(
         options, this->layer_param_.data_param().source(), &db_temp);
@@ -49,16 +94,33 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
                        << this->layer_param_.data_param().source() << std::endl
                        << status.ToString();
     db_.reset(db_temp);
-    iter_.reset(db_->NewIterator(leveldb::ReadOptions()));
+    leveldb::ReadOptions read_options;
+    // With fill_cache off a sequential scan leaves the block cache to
+    // the Seek traffic instead of churning through it.
+    read_options.fill_cache =
+        this->layer_param_.data_param().leveldb_fill_cache();
+    iter_.reset(db_->NewIterator(read_options));
     iter_->SeekToFirst();
     }
     break;
   case DataParameter_DB_LMDB:
     CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_set_mapsize(mdb_env_,
+             this->layer_param_.data_param().map_size()), MDB_SUCCESS);
+    if (this->layer_param_.data_param().max_readers() > 0) {
+      CHECK_EQ(mdb_env_set_maxreaders(mdb_env_,
+               this->layer_param_.data_param().max_readers()), MDB_SUCCESS)
+          << "mdb_env_set_maxreaders failed";
+    }
+    // MDB_NOTLS unties read transactions from threads, so the decode
+    // workers in LoadBatch can each open their own transaction over
+    // this shared environment.
     CHECK_EQ(mdb_env_open(mdb_env_,
              this->layer_param_.data_param().source().c_str(),
-             MDB_RDONLY|MDB_NOTLS, 0664), MDB_SUCCESS) << "mdb_env_open failed";
+             MDB_RDONLY | MDB_NOTLS |
+             (this->layer_param_.data_param().no_readahead() ?
+                 MDB_NORDAHEAD : 0),
+             0664), MDB_SUCCESS) << "mdb_env_open failed";
     CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_), MDB_SUCCESS)
         << "mdb_txn_begin failed";
     CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
@@ -73,31 +135,194 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL) << "Unknown database backend";
   }
 
-  // Check if we would need to randomly skip a few data points
-  if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
-    LOG(INFO) << "Skipping first " << skip << " data points.";
-    while (skip-- > 0) {
+  // Open any additional weighted sources (see extra_source in the proto)
+  // and build the cumulative sampling distribution over all sources.
+  const int num_extra = this->layer_param_.data_param().extra_source_size();
+  if (num_extra > 0) {
+    CHECK_EQ(this->layer_param_.data_param().num_shards(), 1)
+        << "extra_source cannot be combined with sharding";
+    CHECK_EQ(this->layer_param_.data_param().rand_skip(), 0)
+        << "extra_source cannot be combined with rand_skip";
+    CHECK_EQ(this->layer_param_.data_param().shuffle_chunks(), 0)
+        << "extra_source cannot be combined with shuffle_chunks";
+    for (int i = 0; i < num_extra; ++i) {
+      const string& source = this->layer_param_.data_param().extra_source(i);
+      switch (this->layer_param_.data_param().backend()) {
+      case DataParameter_DB_LEVELDB: {
+        leveldb::DB* db_temp;
+        leveldb::Options options = GetLevelDBOptions();
+        options.create_if_missing = false;
+        // The block cache and bloom filters configured above are shared
+        // across all sources, so the configured budget is a total.
+        options.block_cache = leveldb_cache_.get();
+        options.filter_policy = leveldb_filter_.get();
+        LOG(INFO) << "Opening leveldb " << source;
+        leveldb::Status status = leveldb::DB::Open(options, source, &db_temp);
+        CHECK(status.ok()) << "Failed to open leveldb " << source
+                           << std::endl << status.ToString();
+        extra_dbs_.push_back(shared_ptr<leveldb::DB>(db_temp));
+        leveldb::ReadOptions read_options;
+        read_options.fill_cache =
+            this->layer_param_.data_param().leveldb_fill_cache();
+        extra_iters_.push_back(shared_ptr<leveldb::Iterator>(
+            db_temp->NewIterator(read_options)));
+        extra_iters_[i]->SeekToFirst();
+        CHECK(extra_iters_[i]->Valid()) << "Empty database " << source;
+        break;
+      }
+      case DataParameter_DB_LMDB: {
+        MDB_env* env;
+        MDB_dbi dbi;
+        MDB_txn* txn;
+        MDB_cursor* cursor;
+        MDB_val key, value;
+        CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
+        CHECK_EQ(mdb_env_set_mapsize(env,
+                 this->layer_param_.data_param().map_size()), MDB_SUCCESS);
+        if (this->layer_param_.data_param().max_readers() > 0) {
+          CHECK_EQ(mdb_env_set_maxreaders(env,
+                   this->layer_param_.data_param().max_readers()), MDB_SUCCESS)
+              << "mdb_env_set_maxreaders failed";
+        }
+        CHECK_EQ(mdb_env_open(env, source.c_str(),
+                 MDB_RDONLY | MDB_NOTLS |
+                 (this->layer_param_.data_param().no_readahead() ?
+                     MDB_NORDAHEAD : 0),
+                 0664), MDB_SUCCESS) << "mdb_env_open failed";
+        CHECK_EQ(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn), MDB_SUCCESS)
+            << "mdb_txn_begin failed";
+        CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS)
+            << "mdb_open failed";
+        CHECK_EQ(mdb_cursor_open(txn, dbi, &cursor), MDB_SUCCESS)
+            << "mdb_cursor_open failed";
+        LOG(INFO) << "Opening lmdb " << source;
+        CHECK_EQ(mdb_cursor_get(cursor, &key, &value, MDB_FIRST),
+            MDB_SUCCESS) << "mdb_cursor_get failed";
+        extra_mdb_envs_.push_back(env);
+        extra_mdb_dbis_.push_back(dbi);
+        extra_mdb_txns_.push_back(txn);
+        extra_mdb_cursors_.push_back(cursor);
+        break;
+      }
+      default:
+        LOG(FATAL) << "Unknown database backend";
+      }
+    }
+    const int num_sources = num_extra + 1;
+    const int num_weights =
+        this->layer_param_.data_param().source_weight_size();
+    if (num_weights > 0) {
+      CHECK_EQ(num_weights, num_sources)
+          << "source_weight needs one entry per source (the primary "
+          << "source is entry 0), or none for uniform sampling";
+    }
+    source_cdf_.resize(num_sources);
+    double total = 0;
+    for (int i = 0; i < num_sources; ++i) {
+      const float weight = num_weights > 0 ?
+          this->layer_param_.data_param().source_weight(i) : 1;
+      CHECK_GE(weight, 0) << "source_weight must be non-negative";
+      total += weight;
+      source_cdf_[i] = total;
+    }
+    CHECK_GT(total, 0) << "at least one source_weight must be positive";
+    // Drawn on the prefetch thread; seeded here so a fixed caffe seed
+    // reproduces the same source sequence.
+    source_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+    LOG(INFO) << "Weighted sampling across " << num_sources << " sources.";
+  }
+
+  // The GPU dataset cache needs the first pass to visit each record of
+  // this layer's stripe exactly once, so the read patterns that skip or
+  // reorder records are out (and random sampling with replacement makes
+  // no sense for deterministic test passes).
+  if (this->layer_param_.data_param().gpu_cache()) {
+    CHECK_EQ(Caffe::phase(), Caffe::TRAIN)
+        << "gpu_cache draws examples at random and is train-only";
+    CHECK_EQ(this->layer_param_.data_param().rand_skip(), 0)
+        << "gpu_cache cannot be combined with rand_skip";
+    CHECK_EQ(this->layer_param_.data_param().shuffle_chunks(), 0)
+        << "gpu_cache cannot be combined with shuffle_chunks";
+    CHECK_EQ(num_extra, 0)
+        << "gpu_cache cannot be combined with extra_source";
+  }
+
+  // The example cache keys entries by record, which the chunk-shuffle
+  // buffer does not track for leveldb and which would collide across
+  // extra sources; and behind gpu_cache it would only duplicate the
+  // first epoch in host memory.
+  if (this->layer_param_.data_param().example_cache_size() > 0) {
+    CHECK(!this->layer_param_.data_param().gpu_cache())
+        << "example_cache_size cannot be combined with gpu_cache";
+    CHECK_EQ(this->layer_param_.data_param().shuffle_chunks(), 0)
+        << "example_cache_size cannot be combined with shuffle_chunks";
+    CHECK_EQ(num_extra, 0)
+        << "example_cache_size cannot be combined with extra_source";
+    LOG(INFO) << "Caching decoded examples in up to "
+        << this->layer_param_.data_param().example_cache_size() /
+           (1024 * 1024) << " MB of host RAM.";
+  }
+
+  // Kick off the background page-cache warmup: it reads the database
+  // files sequentially ahead of the cursor, so a cold first epoch after
+  // a reboot runs near warm-cache speed instead of demand-faulting the
+  // map page by page.
+  if (this->layer_param_.data_param().warm_page_cache()) {
+    vector<string> sources(1, this->layer_param_.data_param().source());
+    for (int i = 0; i < num_extra; ++i) {
+      sources.push_back(this->layer_param_.data_param().extra_source(i));
+    }
+    LOG(INFO) << "Starting page-cache warmup over " << sources.size()
+        << " database(s).";
+    warmup_thread_.reset(new boost::thread(&WarmupEntry, sources));
+  }
+
+  // With sharding, start shard_id records in; Next() then strides the
+  // cursor by num_shards so this layer only visits its own stripe.
+  const unsigned int shard_id = this->layer_param_.data_param().shard_id();
+  const unsigned int num_shards = this->layer_param_.data_param().num_shards();
+  CHECK_GE(num_shards, 1) << "num_shards must be positive";
+  CHECK_LT(shard_id, num_shards) << "shard_id must be less than num_shards";
+  if (shard_id > 0) {
+    LOG(INFO) << "Reading shard " << shard_id << " of " << num_shards << ".";
+    for (unsigned int i = 0; i < shard_id; ++i) {
       switch (this->layer_param_.data_param().backend()) {
       case DataParameter_DB_LEVELDB:
         iter_->Next();
-        if (!iter_->Valid()) {
-          iter_->SeekToFirst();
-        }
+        CHECK(iter_->Valid()) << "Not enough records to seek to shard";
         break;
       case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
-          CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
-                   MDB_FIRST), MDB_SUCCESS);
-        }
+        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+                 MDB_NEXT), MDB_SUCCESS)
+            << "Not enough records to seek to shard";
         break;
       default:
         LOG(FATAL) << "Unknown database backend";
       }
     }
   }
+
+  // Check if we would need to randomly skip a few data points
+  if (this->layer_param_.data_param().rand_skip()) {
+    unsigned int skip = caffe_rng_rand() %
+                        this->layer_param_.data_param().rand_skip();
+    LOG(INFO) << "Skipping first " << skip << " data points.";
+    // Databases written by our conversion tools key each record with a
+    // zero-padded numeric index, so the start offset is one keyed seek
+    // away; for a skip of millions of records the linear fallback below
+    // takes minutes before any training starts.
+    if (!SeekToRecord(shard_id + skip * num_shards)) {
+      while (skip-- > 0) {
+        Next();
+      }
+    }
+  }
+  // Chunk-shuffled reading replaces the cursor walk in LoadBatch; set up
+  // the chunk order (and leave the cursor on the first record for the
+  // shape probe below).
+  if (this->layer_param_.data_param().shuffle_chunks() > 0) {
+    SetUpChunkShuffle();
+  }
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
   switch (this->layer_param_.data_param().backend()) {
@@ -110,6 +335,9 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   default:
     LOG(FATAL) << "Unknown database backend";
   }
+  if (datum.encoded()) {
+    CHECK(DecodeDatum(&datum));
+  }
 
   // image
   int crop_size = this->layer_param_.transform_param().crop_size();
@@ -141,66 +369,854 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
+void DataLayer<Dtype>::Next() {
+  // If the database size is not a multiple of num_shards, wrapping to the
+  // first record rotates the stripe a little each epoch, so no record is
+  // permanently skipped.
+  const int num_shards = std::max(
+      1, static_cast<int>(this->layer_param_.data_param().num_shards()));
+  for (int i = 0; i < num_shards; ++i) {
+    switch (this->layer_param_.data_param().backend()) {
+    case DataParameter_DB_LEVELDB:
+      iter_->Next();
+      if (!iter_->Valid()) {
+        // We have reached the end. Restart from the first.
+        DLOG(INFO) << "Restarting data prefetching from start.";
+        iter_->SeekToFirst();
+        wrapped_ = true;
+      }
+      break;
+    case DataParameter_DB_LMDB:
+      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
+              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
+        // We have reached the end. Restart from the first.
+        DLOG(INFO) << "Restarting data prefetching from start.";
+        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
+        wrapped_ = true;
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown database backend";
+    }
+  }
+}
+
+template <typename Dtype>
+int DataLayer<Dtype>::PickSource() {
+  if (source_cdf_.empty()) {
+    return 0;
+  }
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(source_rng_->generator());
+  // Map one 32-bit draw onto [0, total weight) and walk the cumulative
+  // distribution; a handful of sources does not warrant a binary search.
+  const double u = static_cast<double>((*rng)()) / 4294967296. *
+      source_cdf_.back();
+  int source = 0;
+  while (source + 1 < static_cast<int>(source_cdf_.size()) &&
+      u >= source_cdf_[source]) {
+    ++source;
+  }
+  return source;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ReadExtraSource(const int index, string* value,
+    const void** data, size_t* size) {
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB: {
+    leveldb::Iterator* iter = extra_iters_[index].get();
+    CHECK(iter->Valid());
+    value->assign(iter->value().data(), iter->value().size());
+    *data = value->data();
+    *size = value->size();
+    iter->Next();
+    if (!iter->Valid()) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      iter->SeekToFirst();
+    }
+    break;
+  }
+  case DataParameter_DB_LMDB: {
+    MDB_cursor* cursor = extra_mdb_cursors_[index];
+    MDB_val mdb_key, mdb_value;
+    CHECK_EQ(mdb_cursor_get(cursor, &mdb_key, &mdb_value, MDB_GET_CURRENT),
+        MDB_SUCCESS) << "mdb_cursor_get failed";
+    // Aliases the source's read-only memory map, pinned by its own
+    // transaction for the layer's lifetime like the primary source.
+    *data = mdb_value.mv_data;
+    *size = mdb_value.mv_size;
+    if (mdb_cursor_get(cursor, &mdb_key, &mdb_value, MDB_NEXT)
+        != MDB_SUCCESS) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      CHECK_EQ(mdb_cursor_get(cursor, &mdb_key, &mdb_value, MDB_FIRST),
+          MDB_SUCCESS);
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+const CachedExample<Dtype>* DataLayer<Dtype>::LookupCachedExample(
+    const string& key) {
+  typename std::map<string,
+      typename std::list<CachedExample<Dtype> >::iterator>::iterator it =
+      example_cache_index_.find(key);
+  if (it == example_cache_index_.end()) {
+    return NULL;
+  }
+  // Refresh the entry's LRU position; splicing moves the node without
+  // invalidating the iterator the index holds.
+  example_cache_.splice(example_cache_.begin(), example_cache_, it->second);
+  return &*it->second;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::InsertCachedExample(const string& key,
+    const char* pixels, const size_t size, const Dtype label) {
+  if (example_cache_index_.find(key) != example_cache_index_.end()) {
+    // Already present: a batch that wrapped past the end of a small
+    // database revisits keys it inserted moments ago.
+    return;
+  }
+  const size_t budget = this->layer_param_.data_param().example_cache_size();
+  while (!example_cache_.empty() && example_cache_bytes_ + size > budget) {
+    // Evict from the cold end of the list.
+    example_cache_bytes_ -= example_cache_.back().pixels.size();
+    example_cache_index_.erase(example_cache_.back().key);
+    example_cache_.pop_back();
+  }
+  if (example_cache_bytes_ + size > budget) {
+    // A single example exceeds the whole budget.
+    return;
+  }
+  example_cache_.push_front(CachedExample<Dtype>());
+  CachedExample<Dtype>& entry = example_cache_.front();
+  entry.key = key;
+  entry.pixels.assign(pixels, size);
+  entry.label = label;
+  example_cache_index_[key] = example_cache_.begin();
+  example_cache_bytes_ += size;
+}
+
+template <typename Dtype>
+bool DataLayer<Dtype>::SeekToRecord(unsigned int record) {
+  // Our conversion tools key each record with an 8-digit zero-padded index
+  // ("%08d_filename"), which both backends keep sorted, so any offset can
+  // be reached with one keyed seek. Probe the current key first: if this
+  // database is keyed differently, bail out before moving the cursor so
+  // the caller can fall back to linear stepping.
+  const int kIndexDigits = 8;
+  const char* current_key = NULL;
+  size_t current_size = 0;
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    current_key = iter_->key().data();
+    current_size = iter_->key().size();
+    break;
+  case DataParameter_DB_LMDB:
+    current_key = static_cast<const char*>(mdb_key_.mv_data);
+    current_size = mdb_key_.mv_size;
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  if (current_size < kIndexDigits) {
+    return false;
+  }
+  for (int i = 0; i < kIndexDigits; ++i) {
+    if (!isdigit(current_key[i])) {
+      return false;
+    }
+  }
+
+  char key_cstr[16];
+  const int key_length = snprintf(key_cstr, sizeof(key_cstr), "%08u", record);
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->Seek(leveldb::Slice(key_cstr, key_length));
+    if (!iter_->Valid()) {
+      // Past the last record; wrap like Next() does.
+      iter_->SeekToFirst();
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    mdb_key_.mv_size = key_length;
+    mdb_key_.mv_data = key_cstr;
+    if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_SET_RANGE)
+        != MDB_SUCCESS) {
+      // Past the last record; wrap like Next() does.
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+              MDB_FIRST), MDB_SUCCESS);
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return true;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::RestoreDataCursor(const string& key) {
+  if (key.empty()) {
+    return;
+  }
+  if (this->layer_param_.data_param().shuffle_chunks() > 0 ||
+      this->layer_param_.data_param().extra_source_size() > 0 ||
+      this->gpu_cache_) {
+    LOG(WARNING) << "Layer " << this->layer_param_.name()
+        << ": randomized read order, leaving the data cursor alone";
+    return;
+  }
+  // The prefetch pipeline has been reading from the position
+  // DataLayerSetUp chose; park it, reposition the cursor with one keyed
+  // seek, and restart clean so the next batch begins at the key.
+  this->JoinPrefetchThread();
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->Seek(leveldb::Slice(key.data(), key.size()));
+    if (!iter_->Valid()) {
+      // Past the last record; wrap like Next() does.
+      iter_->SeekToFirst();
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    mdb_key_.mv_size = key.size();
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_SET_RANGE)
+        != MDB_SUCCESS) {
+      // Past the last record; wrap like Next() does.
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+              MDB_FIRST), MDB_SUCCESS);
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  LOG(INFO) << "Layer " << this->layer_param_.name()
+      << ": data cursor restored to the snapshotted position";
+  this->CreatePrefetchThread();
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::SetUpChunkShuffle() {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const unsigned int chunk_size = data_param.shuffle_chunk_size();
+  CHECK_GT(chunk_size, 0) << "shuffle_chunk_size must be positive";
+  // The record count comes from the last key: our conversion tools key
+  // each record with an 8-digit zero-padded index, which is also what
+  // StreamChunk's keyed seeks rely on.
+  const int kIndexDigits = 8;
+  const char* last_key = NULL;
+  size_t last_size = 0;
+  switch (data_param.backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->SeekToLast();
+    CHECK(iter_->Valid()) << "Empty database";
+    last_key = iter_->key().data();
+    last_size = iter_->key().size();
+    break;
+  case DataParameter_DB_LMDB:
+    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_LAST),
+        MDB_SUCCESS) << "mdb_cursor_get failed";
+    last_key = static_cast<const char*>(mdb_key_.mv_data);
+    last_size = mdb_key_.mv_size;
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  unsigned int last_record = 0;
+  CHECK_GE(last_size, kIndexDigits)
+      << "shuffle_chunks requires the zero-padded numeric record keys "
+      << "written by our conversion tools";
+  for (int i = 0; i < kIndexDigits; ++i) {
+    CHECK(isdigit(last_key[i]))
+        << "shuffle_chunks requires the zero-padded numeric record keys "
+        << "written by our conversion tools";
+    last_record = last_record * 10 + (last_key[i] - '0');
+  }
+  num_records_ = last_record + 1;
+  const unsigned int num_chunks = (num_records_ + chunk_size - 1)
+      / chunk_size;
+  // With sharding, each reader takes a disjoint subset of the chunks
+  // rather than striding record by record inside them.
+  const unsigned int shard_id = data_param.shard_id();
+  const unsigned int num_shards = data_param.num_shards();
+  chunk_order_.clear();
+  for (unsigned int c = shard_id; c < num_chunks; c += num_shards) {
+    chunk_order_.push_back(c);
+  }
+  CHECK(!chunk_order_.empty())
+      << "Fewer chunks than shards; lower shuffle_chunk_size";
+  // The chunk order is drawn on the prefetch thread, whose RNG is seeded
+  // here so a fixed caffe seed reproduces the same stream.
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  shuffle(chunk_order_.begin(), chunk_order_.end(),
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator()));
+  next_chunk_ = 0;
+  LOG(INFO) << "Chunk-shuffled reading: " << num_records_ << " records in "
+      << num_chunks << " chunks of " << chunk_size << "; buffering "
+      << data_param.shuffle_chunks() << " chunks.";
+  // Put the cursor back on the first record for the callers that probe it.
+  switch (data_param.backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->SeekToFirst();
+    break;
+  case DataParameter_DB_LMDB:
+    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST),
+        MDB_SUCCESS) << "mdb_cursor_get failed";
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+size_t DataLayer<Dtype>::ShuffleBufferSize() const {
+  return this->layer_param_.data_param().backend() == DataParameter_DB_LMDB ?
+      buffer_data_.size() : buffer_values_.size();
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::StreamChunk() {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const unsigned int chunk_size = data_param.shuffle_chunk_size();
+  if (next_chunk_ == chunk_order_.size()) {
+    // Every chunk has been streamed once: draw a fresh order.
+    DLOG(INFO) << "Restarting chunk-shuffled prefetching from start.";
+    shuffle(chunk_order_.begin(), chunk_order_.end(),
+        static_cast<caffe::rng_t*>(prefetch_rng_->generator()));
+    next_chunk_ = 0;
+  }
+  const unsigned int start = chunk_order_[next_chunk_++] * chunk_size;
+  const unsigned int end = std::min(start + chunk_size, num_records_);
+  CHECK(SeekToRecord(start)) << "database lost its numeric keys?";
+  for (unsigned int r = start; r < end; ++r) {
+    switch (data_param.backend()) {
+    case DataParameter_DB_LEVELDB:
+      // The keys are a dense numeric index, so every record of the
+      // (clamped) range exists.
+      CHECK(iter_->Valid()) << "ran off the end of the database";
+      buffer_values_.push_back(iter_->value().ToString());
+      iter_->Next();
+      break;
+    case DataParameter_DB_LMDB:
+      // The buffered value aliases the read-only memory map, which stays
+      // valid for the layer's lifetime under the pinned transaction, so
+      // nothing is copied; streaming it here is what faults the chunk's
+      // pages in sequentially.
+      buffer_keys_.push_back(string(
+          static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size));
+      buffer_data_.push_back(mdb_value_.mv_data);
+      buffer_sizes_.push_back(mdb_value_.mv_size);
+      if (r + 1 < end) {
+        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+                MDB_NEXT), MDB_SUCCESS) << "mdb_cursor_get failed";
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown database backend";
+    }
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::DrawShuffledRecord(string* key, string* value,
+    const void** data, size_t* size) {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB: {
+    const size_t r = (*rng)() % buffer_values_.size();
+    buffer_values_[r].swap(buffer_values_.back());
+    value->swap(buffer_values_.back());
+    buffer_values_.pop_back();
+    *data = value->data();
+    *size = value->size();
+    break;
+  }
+  case DataParameter_DB_LMDB: {
+    const size_t r = (*rng)() % buffer_data_.size();
+    std::swap(buffer_data_[r], buffer_data_.back());
+    std::swap(buffer_sizes_[r], buffer_sizes_.back());
+    buffer_keys_[r].swap(buffer_keys_.back());
+    *data = buffer_data_.back();
+    *size = buffer_sizes_.back();
+    if (key) {
+      key->swap(buffer_keys_.back());
+    }
+    buffer_data_.pop_back();
+    buffer_sizes_.pop_back();
+    buffer_keys_.pop_back();
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+// One staged item: a pointer/size pair that either aliases the LMDB memory
+// map directly (zero-copy) or a string staged from leveldb.
+struct DataLayerRawValue {
+  const void* data;
+  size_t size;
+};
+
+// Context handed to one decode worker: the worker owns the strided slice
+// {first, first + stride, first + 2 * stride, ...} of the staged batch.
+template <typename Dtype>
+struct DataLayerDecodeContext {
+  const vector<DataLayerRawValue>* raw_values;
+  // Non-NULL for LMDB: the worker opens its own read transaction and
+  // cursor over this shared environment and fetches its slice of the
+  // batch by key, so workers fault in disjoint key ranges concurrently
+  // instead of funneling through the layer's cursor.
+  MDB_env* mdb_env;
+  MDB_dbi mdb_dbi;
+  const vector<string>* keys;
+  int first;
+  int stride;
+  const Dtype* mean;
+  Dtype* top_data;
+  Dtype* top_label;
+  // Non-NULL when the host example cache is on: per-item hits to serve
+  // without parsing or decoding, and (CPU transform path only) per-item
+  // staging that keeps each miss's decoded pixels for insertion after
+  // the workers are joined. The datum dimensions let hits be transformed
+  // without a Datum in hand.
+  const vector<const CachedExample<Dtype>*>* cached;
+  vector<string>* decoded;
+  int datum_channels;
+  int datum_height;
+  int datum_width;
+  // Non-NULL when the GPU transform path is active: workers stage the raw
+  // pixels and crop/mirror draws instead of transforming into top_data.
+  uint8_t* raw_data;
+  int* transform_params;
+  DataTransformer<Dtype>* transformer;
+  // Per-worker stage times, filled when the layer collects timing and
+  // summed into the layer's counters after the workers are joined.
+  bool collect_timing;
+  double decode_us;
+  double transform_us;
+};
+
+// Parses and transforms the items assigned to one decode worker. Each worker
+// uses its own DataTransformer so that the random crop/mirror draws do not
+// race on a shared RNG.
+template <typename Dtype>
+void DataLayerDecodeEntry(DataLayerDecodeContext<Dtype>* context) {
   Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
+  CPUTimer timer;
+  MDB_txn* mdb_txn = NULL;
+  MDB_cursor* mdb_cursor = NULL;
+  if (context->mdb_env) {
+    CHECK_EQ(mdb_txn_begin(context->mdb_env, NULL, MDB_RDONLY, &mdb_txn),
+        MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_cursor_open(mdb_txn, context->mdb_dbi, &mdb_cursor),
+        MDB_SUCCESS) << "mdb_cursor_open failed";
+  }
+  const int batch_size = context->raw_values->size();
+  for (int item_id = context->first; item_id < batch_size;
+       item_id += context->stride) {
+    const CachedExample<Dtype>* entry =
+        context->cached ? (*context->cached)[item_id] : NULL;
+    if (entry) {
+      // Cache hit: the decoded pixels are already in host RAM; neither
+      // the database value nor the datum bytes are touched.
+      if (context->collect_timing) {
+        timer.Start();
+      }
+      if (context->raw_data) {
+        memcpy(context->raw_data + item_id * entry->pixels.size(),
+            entry->pixels.data(), entry->pixels.size());
+        context->transformer->FillParams(item_id, context->datum_height,
+            context->datum_width, context->transform_params);
+      } else {
+        context->transformer->Transform(item_id, entry->pixels.data(),
+            context->datum_channels, context->datum_height,
+            context->datum_width, context->mean, context->top_data);
+      }
+      if (context->collect_timing) {
+        timer.Stop();
+        context->transform_us += timer.MicroSeconds();
+      }
+      if (context->top_label) {
+        context->top_label[item_id] = entry->label;
+      }
+      continue;
+    }
+    DataLayerRawValue value = (*context->raw_values)[item_id];
+    if (context->collect_timing) {
+      timer.Start();
+    }
+    if (mdb_cursor) {
+      const string& key = (*context->keys)[item_id];
+      MDB_val mdb_key, mdb_value;
+      mdb_key.mv_data = const_cast<char*>(key.data());
+      mdb_key.mv_size = key.size();
+      CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_SET),
+          MDB_SUCCESS) << "mdb_cursor_get failed";
+      value.data = mdb_value.mv_data;
+      value.size = mdb_value.mv_size;
+    }
+    CHECK(datum.ParseFromArray(value.data, value.size));
+    if (datum.encoded()) {
+      DecodeDatum(&datum);
+    }
+    if (context->collect_timing) {
+      timer.Stop();
+      context->decode_us += timer.MicroSeconds();
+      timer.Start();
+    }
+    if (context->raw_data) {
+      context->transformer->Fill(item_id, datum, context->raw_data,
+          context->transform_params);
+    } else {
+      context->transformer->Transform(item_id, datum, context->mean,
+          context->top_data);
+    }
+    if (context->collect_timing) {
+      timer.Stop();
+      context->transform_us += timer.MicroSeconds();
+    }
+    if (context->top_label) {
+      context->top_label[item_id] = datum.label();
+    }
+    if (context->decoded && datum.data().size()) {
+      // Keep the decoded pixels for cache insertion after the join;
+      // ParseFromArray re-fills the field on the next iteration.
+      (*context->decoded)[item_id].swap(*datum.mutable_data());
+    }
+  }
+  if (mdb_cursor) {
+    mdb_cursor_close(mdb_cursor);
+    mdb_txn_abort(mdb_txn);
+  }
+}
+
+// This function is called on the prefetch thread to fill one batch.
+template <typename Dtype>
+void DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = NULL;
+  uint8_t* raw_data = NULL;
+  int* transform_params = NULL;
+  if (this->use_gpu_transform_) {
+    raw_data = static_cast<uint8_t*>(batch->raw_data_->mutable_cpu_data());
+    transform_params =
+        static_cast<int*>(batch->transform_params_->mutable_cpu_data());
+  } else {
+    top_data = batch->data_.mutable_cpu_data();
+  }
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
   if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
+    top_label = batch->label_.mutable_cpu_data();
   }
   const int batch_size = this->layer_param_.data_param().batch_size();
 
+  // First walk the database cursor serially: neither the leveldb iterator
+  // nor the LMDB cursor may be advanced from multiple threads, so we only
+  // stage the raw values here and leave decoding to the workers below.
+  //
+  // For LMDB the values live in the read-only memory map and our MDB_RDONLY
+  // transaction pins a consistent snapshot, so the staged entries alias the
+  // mapped pages directly and no bytes are copied before parsing. leveldb
+  // invalidates the value slice on Next(), so its values are still staged
+  // through leveldb_values.
+  const bool collect_timing = this->collect_timing_;
+  CPUTimer timer;
+  if (collect_timing) {
+    timer.Start();
+  }
+  // The thread-budget coordinator, when active, overrides the layer's
+  // own decode_threads setting (see Caffe::SetThreadBudget); the count
+  // is re-read every batch so rebalancing takes effect immediately.
+  const int configured_threads = Caffe::decode_threads() > 0 ?
+      Caffe::decode_threads() :
+      static_cast<int>(this->layer_param_.data_param().decode_threads());
+  const int decode_threads = std::min(batch_size,
+      std::max(1, configured_threads));
+  // With several workers and LMDB, the serial walk only records the keys
+  // of the batch; each worker then opens its own read transaction over
+  // the shared environment and fetches its slice by key, so the page
+  // faults for disjoint key ranges are taken concurrently.
+  // With several sources the batch's keys span different environments,
+  // so the per-key refetch cannot be used; the staged values still
+  // alias each source's pinned memory map, so nothing is copied.
+  const bool parallel_lmdb = decode_threads > 1 &&
+      this->layer_param_.data_param().backend() == DataParameter_DB_LMDB &&
+      this->layer_param_.data_param().extra_source_size() == 0;
+  // Host example cache: each staged item is first looked up by its
+  // record key; hits skip the value read here and the parse/decode
+  // below, and misses are inserted once the whole batch is decoded.
+  const bool use_cache =
+      this->layer_param_.data_param().example_cache_size() > 0;
+  vector<DataLayerRawValue> raw_values(batch_size);
+  vector<string> leveldb_values(batch_size);
+  vector<string> keys((parallel_lmdb || use_cache) ? batch_size : 0);
+  vector<const CachedExample<Dtype>*> cached(batch_size,
+      static_cast<const CachedExample<Dtype>*>(NULL));
+  vector<string> decoded((use_cache && !raw_data) ? batch_size : 0);
+  // Chunk-shuffled reading: top the buffer up whenever it falls to the
+  // low-water mark (one chunk consumed), then draw the batch's records
+  // from it at random instead of walking the cursor.
+  const bool chunk_shuffle =
+      this->layer_param_.data_param().shuffle_chunks() > 0;
+  const size_t shuffle_low_water = chunk_shuffle ?
+      static_cast<size_t>(
+          this->layer_param_.data_param().shuffle_chunks() - 1) *
+      this->layer_param_.data_param().shuffle_chunk_size() : 0;
+  // While the GPU dataset cache is filling, track where (if anywhere) in
+  // this batch the cursor wraps: items up to the wrap are the tail of the
+  // first pass and are cached after decoding below, items past it re-read
+  // the start of the database and must not be cached twice.
+  const bool caching = this->caching();
+  int fresh_items = batch_size;
+  if (caching) {
+    wrapped_ = false;
+  }
   for (int item_id = 0; item_id < batch_size; ++item_id) {
+    if (chunk_shuffle) {
+      while (ShuffleBufferSize() <= shuffle_low_water) {
+        StreamChunk();
+      }
+      DrawShuffledRecord(parallel_lmdb ? &keys[item_id] : NULL,
+          &leveldb_values[item_id], &raw_values[item_id].data,
+          &raw_values[item_id].size);
+      continue;
+    }
+    // With weighted extra sources, draw which database supplies this
+    // record; source 0 falls through to the primary cursor below.
+    const int source = PickSource();
+    if (source > 0) {
+      ReadExtraSource(source - 1, &leveldb_values[item_id],
+          &raw_values[item_id].data, &raw_values[item_id].size);
+      continue;
+    }
     // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       CHECK(iter_);
       CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      if (use_cache) {
+        keys[item_id].assign(iter_->key().data(), iter_->key().size());
+        cached[item_id] = LookupCachedExample(keys[item_id]);
+      }
+      if (!cached[item_id]) {
+        leveldb_values[item_id].assign(iter_->value().data(),
+            iter_->value().size());
+        raw_values[item_id].data = leveldb_values[item_id].data();
+        raw_values[item_id].size = leveldb_values[item_id].size();
+      }
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      if (parallel_lmdb || use_cache) {
+        keys[item_id].assign(static_cast<const char*>(mdb_key_.mv_data),
+            mdb_key_.mv_size);
+      }
+      if (use_cache) {
+        cached[item_id] = LookupCachedExample(keys[item_id]);
+      }
+      // On a hit nothing dereferences this alias, so the mapped value
+      // pages are never faulted in.
+      raw_values[item_id].data = mdb_value_.mv_data;
+      raw_values[item_id].size = mdb_value_.mv_size;
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
 
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+    // go to the next iter
+    Next();
+    if (caching && wrapped_ && fresh_items == batch_size) {
+      fresh_items = item_id + 1;
     }
+  }
+  if (collect_timing) {
+    timer.Stop();
+    this->read_time_ms_ += timer.MicroSeconds() / 1000.;
+  }
 
-    // go to the next iter
+  // Remember where the next batch starts, so a snapshot taken once this
+  // batch is consumed can resume the cursor there (see
+  // Layer::data_cursor_key). Randomized read orders have no meaningful
+  // cursor to save.
+  if (!chunk_shuffle && !this->gpu_cache_ &&
+      this->layer_param_.data_param().extra_source_size() == 0) {
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
-      iter_->Next();
-      if (!iter_->Valid()) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        iter_->SeekToFirst();
-      }
+      batch->cursor_key_.assign(iter_->key().data(), iter_->key().size());
       break;
     case DataParameter_DB_LMDB:
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-      }
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
+      batch->cursor_key_.assign(
+          static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size);
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
   }
+
+  // Now decode and transform the staged batch, either serially or across a
+  // pool of worker threads.
+  if (decode_threads == 1) {
+    Datum datum;
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      const CachedExample<Dtype>* entry = cached[item_id];
+      if (entry) {
+        // Cache hit: the decoded pixels are already in host RAM.
+        if (collect_timing) {
+          timer.Start();
+        }
+        if (raw_data) {
+          memcpy(raw_data + item_id * entry->pixels.size(),
+              entry->pixels.data(), entry->pixels.size());
+          this->data_transformer_.FillParams(item_id, this->datum_height_,
+              this->datum_width_, transform_params);
+        } else {
+          this->data_transformer_.Transform(item_id, entry->pixels.data(),
+              this->datum_channels_, this->datum_height_,
+              this->datum_width_, this->mean_, top_data);
+        }
+        if (collect_timing) {
+          timer.Stop();
+          this->transform_time_ms_ += timer.MicroSeconds() / 1000.;
+        }
+        if (this->output_labels_) {
+          top_label[item_id] = entry->label;
+        }
+        continue;
+      }
+      if (collect_timing) {
+        timer.Start();
+      }
+      CHECK(datum.ParseFromArray(raw_values[item_id].data,
+          raw_values[item_id].size));
+      if (datum.encoded()) {
+        DecodeDatum(&datum);
+      }
+      if (collect_timing) {
+        timer.Stop();
+        this->decode_time_ms_ += timer.MicroSeconds() / 1000.;
+        timer.Start();
+      }
+      // Apply data transformations (mirror, scale, crop...), or only stage
+      // the raw pixels when the transform runs on the GPU.
+      if (raw_data) {
+        this->data_transformer_.Fill(item_id, datum, raw_data,
+            transform_params);
+      } else {
+        this->data_transformer_.Transform(item_id, datum, this->mean_,
+            top_data);
+      }
+      if (collect_timing) {
+        timer.Stop();
+        this->transform_time_ms_ += timer.MicroSeconds() / 1000.;
+      }
+      if (this->output_labels_) {
+        top_label[item_id] = datum.label();
+      }
+      if (use_cache && !raw_data && datum.data().size()) {
+        // Keep the decoded pixels for cache insertion below;
+        // ParseFromArray re-fills the field on the next iteration.
+        decoded[item_id].swap(*datum.mutable_data());
+      }
+    }
+  } else {
+    // Grown on demand, so a rebalance toward decode gets its extra
+    // transformers; worker i keeps RNG stream i either way.
+    if (static_cast<int>(decode_transformers_.size()) < decode_threads) {
+      const int first_new = decode_transformers_.size();
+      decode_transformers_.resize(decode_threads);
+      for (int i = first_new; i < decode_threads; ++i) {
+        decode_transformers_[i].reset(
+            new DataTransformer<Dtype>(this->transform_param_));
+        decode_transformers_[i]->set_phase(this->phase_);
+        // Deterministic per-worker streams: worker i's crop/mirror draws
+        // depend only on the master seed and i, however the batch's
+        // threads happen to interleave.
+        decode_transformers_[i]->InitRand(Caffe::rng_stream_seed(i));
+      }
+    }
+    vector<DataLayerDecodeContext<Dtype> > contexts(decode_threads);
+    vector<shared_ptr<boost::thread> > threads(decode_threads);
+    for (int i = 0; i < decode_threads; ++i) {
+      contexts[i].raw_values = &raw_values;
+      contexts[i].mdb_env = parallel_lmdb ? mdb_env_ : NULL;
+      contexts[i].mdb_dbi = mdb_dbi_;
+      contexts[i].keys = &keys;
+      contexts[i].first = i;
+      contexts[i].stride = decode_threads;
+      contexts[i].mean = this->mean_;
+      contexts[i].top_data = top_data;
+      contexts[i].top_label = top_label;
+      contexts[i].cached = use_cache ? &cached : NULL;
+      contexts[i].decoded = (use_cache && !raw_data) ? &decoded : NULL;
+      contexts[i].datum_channels = this->datum_channels_;
+      contexts[i].datum_height = this->datum_height_;
+      contexts[i].datum_width = this->datum_width_;
+      contexts[i].raw_data = raw_data;
+      contexts[i].transform_params = transform_params;
+      contexts[i].transformer = decode_transformers_[i].get();
+      contexts[i].collect_timing = collect_timing;
+      contexts[i].decode_us = 0;
+      contexts[i].transform_us = 0;
+      threads[i].reset(new boost::thread(&DataLayerDecodeEntry<Dtype>,
+          &contexts[i]));
+    }
+    for (int i = 0; i < decode_threads; ++i) {
+      threads[i]->join();
+    }
+    if (collect_timing) {
+      for (int i = 0; i < decode_threads; ++i) {
+        this->decode_time_ms_ += contexts[i].decode_us / 1000.;
+        this->transform_time_ms_ += contexts[i].transform_us / 1000.;
+      }
+    }
+  }
+
+  // Insert this batch's misses into the example cache only now that
+  // every hit has been consumed: an earlier insertion could evict an
+  // entry that a later item of the same batch still points at.
+  if (use_cache) {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      if (cached[item_id]) {
+        continue;
+      }
+      const Dtype label = top_label ? top_label[item_id] : Dtype(0);
+      if (raw_data) {
+        InsertCachedExample(keys[item_id],
+            reinterpret_cast<const char*>(raw_data) +
+            item_id * this->datum_size_, this->datum_size_, label);
+      } else if (decoded[item_id].size()) {
+        // Float-data records leave their staging empty and stay uncached.
+        InsertCachedExample(keys[item_id], decoded[item_id].data(),
+            decoded[item_id].size(), label);
+      }
+    }
+  }
+
+  // Hand the first pass's examples -- decoded into the raw staging area
+  // above (gpu_cache requires use_gpu_transform, so raw_data is set) --
+  // to the GPU dataset cache. Once the cursor has wrapped, the next
+  // Forward_gpu uploads the cache and takes over from the prefetcher.
+  if (caching) {
+    for (int item_id = 0; item_id < fresh_items; ++item_id) {
+      this->CacheExample(raw_data + item_id * this->datum_size_,
+          top_label ? top_label[item_id] : Dtype(0));
+    }
+    if (wrapped_) {
+      this->set_cache_complete();
+    }
+  }
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -57,19 +57,18 @@ void EltwiseLayer<Dtype>::Forward_cpu(
   const Dtype* bottom_data_b = NULL;
   const int count = (*top)[0]->count();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  // Gathered once for the fused n-ary ops, which make a single pass over
+  // the data instead of one binary op per bottom.
+  vector<const Dtype*> bottom_datas(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_datas[i] = bottom[i]->cpu_data();
+  }
   switch (op_) {
   case EltwiseParameter_EltwiseOp_PROD:
-    caffe_mul(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(), top_data);
-    for (int i = 2; i < bottom.size(); ++i) {
-      caffe_mul(count, top_data, bottom[i]->cpu_data(), top_data);
-    }
+    caffe_prod(count, bottom.size(), &bottom_datas[0], top_data);
     break;
   case EltwiseParameter_EltwiseOp_SUM:
-    caffe_set(count, Dtype(0), top_data);
-    // TODO(shelhamer) does BLAS optimize to sum for coeff = 1?
-    for (int i = 0; i < bottom.size(); ++i) {
-      caffe_axpy(count, coeffs_[i], bottom[i]->cpu_data(), top_data);
-    }
+    caffe_sum(count, bottom.size(), &bottom_datas[0], &coeffs_[0], top_data);
     break;
   case EltwiseParameter_EltwiseOp_MAX:
     // Initialize
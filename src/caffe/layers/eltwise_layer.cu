@@ -37,20 +37,19 @@ void EltwiseLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   int* mask = NULL;
   const int count = (*top)[0]->count();
   Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  // Gathered once for the fused n-ary ops, which make a single kernel
+  // launch (per eight bottoms) instead of one binary op per bottom.
+  vector<const Dtype*> bottom_datas(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_datas[i] = bottom[i]->gpu_data();
+  }
   switch (op_) {
   case EltwiseParameter_EltwiseOp_PROD:
-    caffe_gpu_mul(count, bottom[0]->gpu_data(), bottom[1]->gpu_data(),
-        top_data);
-    for (int i = 2; i < bottom.size(); ++i) {
-      caffe_gpu_mul(count, top_data, bottom[i]->gpu_data(), top_data);
-    }
+    caffe_gpu_prod(count, bottom.size(), &bottom_datas[0], top_data);
     break;
   case EltwiseParameter_EltwiseOp_SUM:
-    caffe_gpu_set(count, Dtype(0.), top_data);
-    // TODO(shelhamer) does cuBLAS optimize to sum for coeff = 1?
-    for (int i = 0; i < bottom.size(); ++i) {
-      caffe_gpu_axpy(count, coeffs_[i], bottom[i]->gpu_data(), top_data);
-    }
+    caffe_gpu_sum(count, bottom.size(), &bottom_datas[0], &coeffs_[0],
+        top_data);
     break;
   case EltwiseParameter_EltwiseOp_MAX:
     mask = max_idx_.mutable_gpu_data();
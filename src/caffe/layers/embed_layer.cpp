@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void EmbedLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const EmbedParameter& param = this->layer_param_.embed_param();
+  CHECK(param.has_num_output()) << "embed_param.num_output is required.";
+  CHECK(param.has_input_dim()) << "embed_param.input_dim is required.";
+  N_ = param.num_output();
+  K_ = param.input_dim();
+  CHECK_GT(N_, 0);
+  CHECK_GT(K_, 0);
+  bias_term_ = param.bias_term();
+  // Check if we need to set up the weights
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+  } else {
+    if (bias_term_) {
+      this->blobs_.resize(2);
+    } else {
+      this->blobs_.resize(1);
+    }
+    // One embedding row per id.
+    this->blobs_[0].reset(new Blob<Dtype>(1, 1, K_, N_));
+    shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
+        param.weight_filler()));
+    weight_filler->Fill(this->blobs_[0].get());
+    if (bias_term_) {
+      this->blobs_[1].reset(new Blob<Dtype>(1, 1, 1, N_));
+      shared_ptr<Filler<Dtype> > bias_filler(GetFiller<Dtype>(
+          param.bias_filler()));
+      bias_filler->Fill(this->blobs_[1].get());
+    }
+  }  // parameter initialization
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Dtype>
+void EmbedLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  M_ = bottom[0]->count();
+  // Each id expands to its N_-wide row; ids beyond the first channel
+  // concatenate along the channel dimension.
+  (*top)[0]->Reshape(bottom[0]->num(),
+      M_ / bottom[0]->num() * N_, 1, 1);
+}
+
+template <typename Dtype>
+void EmbedLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  for (int i = 0; i < M_; ++i) {
+    const int id = static_cast<int>(bottom_data[i]);
+    CHECK_GE(id, 0);
+    CHECK_LT(id, K_);
+    caffe_copy(N_, weight + id * N_, top_data + i * N_);
+  }
+  if (bias_term_) {
+    const Dtype* bias = this->blobs_[1]->cpu_data();
+    for (int i = 0; i < M_; ++i) {
+      caffe_axpy(N_, Dtype(1), bias, top_data + i * N_);
+    }
+  }
+}
+
+template <typename Dtype>
+void EmbedLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  CHECK(!propagate_down[0]) << this->type_name()
+      << " Layer cannot backpropagate to id inputs.";
+  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  touched_rows_.clear();
+  if (this->param_propagate_down_[0]) {
+    // Scatter each output gradient into its id's weight row; only rows
+    // looked up in this batch are written. Note that we accumulate
+    // diffs, matching the other layers.
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    touched_rows_.reserve(M_);
+    for (int i = 0; i < M_; ++i) {
+      const int id = static_cast<int>(bottom_data[i]);
+      caffe_axpy(N_, Dtype(1), top_diff + i * N_, weight_diff + id * N_);
+      touched_rows_.push_back(id);
+    }
+    std::sort(touched_rows_.begin(), touched_rows_.end());
+    touched_rows_.erase(
+        std::unique(touched_rows_.begin(), touched_rows_.end()),
+        touched_rows_.end());
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+    for (int i = 0; i < M_; ++i) {
+      caffe_axpy(N_, Dtype(1), top_diff + i * N_, bias_diff);
+    }
+  }
+}
+
+INSTANTIATE_CLASS(EmbedLayer);
+
+}  // namespace caffe
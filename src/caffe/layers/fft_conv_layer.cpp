@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The transforms below are plain iterative radix-2 FFTs over planes of
+// interleaved complex values; plane sizes are padded to powers of two so
+// no other radix is needed. Keeping the FFT self-contained avoids an
+// FFTW or cuFFT build dependency for a CPU-only engine.
+
+inline int NextPowerOfTwo(int n) {
+  int p = 1;
+  while (p < n) { p <<= 1; }
+  return p;
+}
+
+// Fill the bit-reversal permutation and the n/2 interleaved complex
+// roots of unity exp(-2*pi*i*k/n) for a transform of length n.
+template <typename Dtype>
+void FftPlan(const int n, vector<int>* bitrev, vector<Dtype>* twiddle) {
+  bitrev->resize(n);
+  (*bitrev)[0] = 0;
+  for (int i = 1; i < n; ++i) {
+    (*bitrev)[i] = ((*bitrev)[i >> 1] >> 1) | ((i & 1) ? (n >> 1) : 0);
+  }
+  twiddle->resize(n);
+  for (int k = 0; k < n / 2; ++k) {
+    const double angle = -2.0 * M_PI * k / n;
+    (*twiddle)[2 * k] = cos(angle);
+    (*twiddle)[2 * k + 1] = sin(angle);
+  }
+}
+
+// In-place FFT of n interleaved complex values spaced stride elements
+// apart; the inverse applies conjugate twiddles and leaves the 1/n
+// scale to the caller.
+template <typename Dtype>
+void FftTransform(Dtype* data, const int n, const int stride,
+    const vector<int>& bitrev, const vector<Dtype>& twiddle,
+    const bool inverse) {
+  for (int i = 0; i < n; ++i) {
+    const int j = bitrev[i];
+    if (j > i) {
+      std::swap(data[2 * stride * i], data[2 * stride * j]);
+      std::swap(data[2 * stride * i + 1], data[2 * stride * j + 1]);
+    }
+  }
+  for (int len = 2; len <= n; len <<= 1) {
+    const int half = len >> 1;
+    const int step = n / len;
+    for (int base = 0; base < n; base += len) {
+      for (int k = 0; k < half; ++k) {
+        const Dtype wr = twiddle[2 * k * step];
+        const Dtype wi = inverse ?
+            -twiddle[2 * k * step + 1] : twiddle[2 * k * step + 1];
+        Dtype* a = data + 2 * stride * (base + k);
+        Dtype* b = data + 2 * stride * (base + k + half);
+        const Dtype tr = b[0] * wr - b[1] * wi;
+        const Dtype ti = b[0] * wi + b[1] * wr;
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+}
+
+// 2D transform of one fft_h x fft_w interleaved complex plane, as a row
+// pass followed by a (strided) column pass.
+template <typename Dtype>
+void Fft2D(Dtype* plane, const int fft_h, const int fft_w,
+    const vector<int>& bitrev_h, const vector<Dtype>& twiddle_h,
+    const vector<int>& bitrev_w, const vector<Dtype>& twiddle_w,
+    const bool inverse) {
+  for (int h = 0; h < fft_h; ++h) {
+    FftTransform(plane + 2 * h * fft_w, fft_w, 1, bitrev_w, twiddle_w,
+        inverse);
+  }
+  for (int w = 0; w < fft_w; ++w) {
+    FftTransform(plane + 2 * w, fft_h, fft_w, bitrev_h, twiddle_h, inverse);
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  // Outputs below pad - (kernel - 1) read only padding; the circular
+  // transform would wrap them onto the far edge instead of zero.
+  CHECK_LT(this->pad_h_, this->kernel_h_)
+      << "FFT engine requires pad < kernel.";
+  CHECK_LT(this->pad_w_, this->kernel_w_)
+      << "FFT engine requires pad < kernel.";
+  CHECK(!this->quantize_)
+      << "FFT engine does not support quantized inference.";
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  const int fft_h = NextPowerOfTwo(this->height_ + this->kernel_h_ - 1);
+  const int fft_w = NextPowerOfTwo(this->width_ + this->kernel_w_ - 1);
+  if (fft_h != fft_h_ || fft_w != fft_w_) {
+    fft_h_ = fft_h;
+    fft_w_ = fft_w;
+    FftPlan(fft_h_, &bitrev_h_, &twiddle_h_);
+    FftPlan(fft_w_, &bitrev_w_, &twiddle_w_);
+    weight_transformed_ = false;
+  }
+  const int input_channels = this->channels_ / this->group_;
+  weight_fft_.Reshape(this->num_output_, input_channels, fft_h_, 2 * fft_w_);
+  input_fft_.Reshape(1, this->channels_, fft_h_, 2 * fft_w_);
+  accum_fft_.Reshape(1, 1, fft_h_, 2 * fft_w_);
+  if (this->layer_param_.convolution_param().engine() ==
+      ConvolutionParameter_Engine_AUTOTUNE) {
+    AutotuneEngine(bottom, top);
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::AutotuneEngine(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // in GPU mode this layer forwards through the base class
+  }
+  std::ostringstream key_stream;
+  key_stream << "conv_cpu_n" << this->num_ << "_c" << this->channels_
+      << "_h" << this->height_ << "_w" << this->width_
+      << "_o" << this->num_output_
+      << "_k" << this->kernel_h_ << "x" << this->kernel_w_
+      << "_s" << this->stride_h_ << "x" << this->stride_w_
+      << "_p" << this->pad_h_ << "x" << this->pad_w_
+      << "_g" << this->group_ << "_e" << sizeof(Dtype);
+  const string key = key_stream.str();
+  if (key == tuned_key_) {
+    return;
+  }
+  const string& cache_file =
+      this->layer_param_.convolution_param().autotune_cache();
+  string cached_engine;
+  if (AutotuneLookup(cache_file, key, &cached_engine)) {
+    use_fft_ = (cached_engine == "fft");
+    tuned_key_ = key;
+    return;
+  }
+  // Time a few forward passes with each engine on the freshly reshaped
+  // blobs; the buffer contents do not matter for the timing.
+  const int kWarmupRuns = 1;
+  const int kTimedRuns = 3;
+  CPUTimer timer;
+  float engine_time[2];
+  for (int e = 0; e < 2; ++e) {
+    use_fft_ = (e == 1);
+    for (int i = 0; i < kWarmupRuns + kTimedRuns; ++i) {
+      if (i == kWarmupRuns) {
+        timer.Start();
+      }
+      Forward_cpu(bottom, top);
+    }
+    timer.Stop();
+    engine_time[e] = timer.MilliSeconds();
+  }
+  use_fft_ = engine_time[1] < engine_time[0];
+  tuned_key_ = key;
+  LOG(INFO) << "Autotuned " << key << ": caffe " << engine_time[0]
+      << " ms, fft " << engine_time[1] << " ms; using "
+      << (use_fft_ ? "fft" : "caffe");
+  AutotuneStore(cache_file, key, use_fft_ ? "fft" : "caffe");
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::TransformWeights() {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* transformed = weight_fft_.mutable_cpu_data();
+  const int input_channels = this->channels_ / this->group_;
+  const int plane = fft_h_ * fft_w_;
+  caffe_set(weight_fft_.count(), Dtype(0), transformed);
+  for (int m = 0; m < this->num_output_; ++m) {
+    for (int c = 0; c < input_channels; ++c) {
+      // The kernel is laid out reversed (circularly) so the frequency-
+      // domain product computes the correlation the dense path uses.
+      Dtype* wp = transformed + (m * input_channels + c) * 2 * plane;
+      const Dtype* kernel = weight +
+          (m * input_channels + c) * this->kernel_h_ * this->kernel_w_;
+      for (int kh = 0; kh < this->kernel_h_; ++kh) {
+        for (int kw = 0; kw < this->kernel_w_; ++kw) {
+          const int h = (fft_h_ - kh) % fft_h_;
+          const int w = (fft_w_ - kw) % fft_w_;
+          wp[2 * (h * fft_w_ + w)] = kernel[kh * this->kernel_w_ + kw];
+        }
+      }
+      Fft2D(wp, fft_h_, fft_w_, bitrev_h_, twiddle_h_, bitrev_w_, twiddle_w_,
+          false);
+    }
+  }
+  weight_transformed_ = true;
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (!use_fft_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  if (!weight_transformed_) {
+    TransformWeights();
+  }
+  const int input_channels = this->channels_ / this->group_;
+  const int plane = fft_h_ * fft_w_;
+  const Dtype scale = Dtype(1) / (Dtype(fft_h_) * Dtype(fft_w_));
+  const Dtype* transformed = weight_fft_.cpu_data();
+  Dtype* input_fft = input_fft_.mutable_cpu_data();
+  Dtype* accum = accum_fft_.mutable_cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      // Move each zero-padded input channel into the frequency domain.
+      const Dtype* input = bottom_data + bottom[i]->offset(n);
+      caffe_set(input_fft_.count(), Dtype(0), input_fft);
+      for (int c = 0; c < this->channels_; ++c) {
+        Dtype* ip = input_fft + c * 2 * plane;
+        const Dtype* input_c = input + c * this->height_ * this->width_;
+        for (int h = 0; h < this->height_; ++h) {
+          for (int w = 0; w < this->width_; ++w) {
+            ip[2 * (h * fft_w_ + w)] = input_c[h * this->width_ + w];
+          }
+        }
+        Fft2D(ip, fft_h_, fft_w_, bitrev_h_, twiddle_h_, bitrev_w_,
+            twiddle_w_, false);
+      }
+      // Per output channel: complex multiply-accumulate over the group's
+      // input channels, one inverse transform, then read the strided
+      // output samples out of the full correlation.
+      Dtype* output = top_data + (*top)[i]->offset(n);
+      for (int m = 0; m < this->num_output_; ++m) {
+        const int g = m / this->M_;
+        caffe_set(accum_fft_.count(), Dtype(0), accum);
+        for (int c = 0; c < input_channels; ++c) {
+          const Dtype* wp = transformed + (m * input_channels + c) * 2
+              * plane;
+          const Dtype* ip = input_fft + (g * input_channels + c) * 2
+              * plane;
+          for (int x = 0; x < plane; ++x) {
+            accum[2 * x] += wp[2 * x] * ip[2 * x] -
+                wp[2 * x + 1] * ip[2 * x + 1];
+            accum[2 * x + 1] += wp[2 * x] * ip[2 * x + 1] +
+                wp[2 * x + 1] * ip[2 * x];
+          }
+        }
+        Fft2D(accum, fft_h_, fft_w_, bitrev_h_, twiddle_h_, bitrev_w_,
+            twiddle_w_, true);
+        Dtype* output_m = output + m * this->N_;
+        for (int ho = 0; ho < this->height_out_; ++ho) {
+          const int h = (ho * this->stride_h_ - this->pad_h_ + fft_h_)
+              % fft_h_;
+          for (int wo = 0; wo < this->width_out_; ++wo) {
+            const int w = (wo * this->stride_w_ - this->pad_w_ + fft_w_)
+                % fft_w_;
+            output_m[ho * this->width_out_ + wo] =
+                accum[2 * (h * fft_w_ + w)] * scale;
+          }
+        }
+      }
+      // Add bias.
+      if (this->bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+            this->N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            this->bias_multiplier_->cpu_data(), (Dtype)1., output);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+  // The weights are about to be updated; retransform on the next forward.
+  weight_transformed_ = false;
+}
+
+INSTANTIATE_CLASS(FFTConvolutionLayer);
+
+}  // namespace caffe
@@ -1,11 +1,11 @@
 /*
 TODO:
-- load file in a separate thread ("prefetch")
 - can be smarter about the memcpy call instead of doing it row-by-row
   :: use util functions caffe_copy, and Blob->offset()
   :: don't forget to update hdf5_daa_layer.cu accordingly
 - add ability to shuffle filenames if flag is set
 */
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -21,37 +21,16 @@ TODO:
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
-
-// Load data and label from HDF5 filename into the class property blobs.
-template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  LOG(INFO) << "Loading HDF5 file" << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(ERROR) << "Failed opening HDF5 file" << filename;
-    return;
-  }
-
-  const int MIN_DATA_DIM = 2;
-  const int MAX_DATA_DIM = 4;
-  hdf5_load_nd_dataset(
-    file_id, "data",  MIN_DATA_DIM, MAX_DATA_DIM, &data_blob_);
-
-  const int MIN_LABEL_DIM = 1;
-  const int MAX_LABEL_DIM = 2;
-  hdf5_load_nd_dataset(
-    file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, &label_blob_);
-
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file " << filename;
-  CHECK_EQ(data_blob_.num(), label_blob_.num());
-  LOG(INFO) << "Successully loaded " << data_blob_.num() << " rows";
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  JoinPrefetchThread();
 }
 
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  // Stop a previous prefetch thread, in case SetUp is run more than once.
+  JoinPrefetchThread();
+
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading filename from " << source;
@@ -67,22 +46,121 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   num_files_ = hdf_filenames_.size();
   current_file_ = 0;
   LOG(INFO) << "Number of files: " << num_files_;
+  CHECK_GE(num_files_, 1) << "Source must list at least one HDF5 file";
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
+  // Read the shapes (but not the data) of the first file to size the tops.
+  hid_t file_id = H5Fopen(
+      hdf_filenames_[0].c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  CHECK_GE(file_id, 0) << "Failed opening HDF5 file " << hdf_filenames_[0];
+  const int MIN_DATA_DIM = 2;
+  const int MAX_DATA_DIM = 4;
+  Blob<Dtype> data_shape;
+  hdf5_load_nd_dataset_helper(
+    file_id, "data", MIN_DATA_DIM, MAX_DATA_DIM, &data_shape);
+  const int MIN_LABEL_DIM = 1;
+  const int MAX_LABEL_DIM = 2;
+  Blob<Dtype> label_shape;
+  hdf5_load_nd_dataset_helper(
+    file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, &label_shape);
+  herr_t status = H5Fclose(file_id);
+  CHECK_GE(status, 0) << "Failed to close HDF5 file " << hdf_filenames_[0];
+  CHECK_EQ(data_shape.num(), label_shape.num());
+
+  // Build the chunk ring and start the prefetch thread.
+  chunk_rows_ = this->layer_param_.hdf5_data_param().chunk_size();
+  const int prefetch_count = this->layer_param_.hdf5_data_param().prefetch();
+  CHECK_GT(prefetch_count, 0) << "prefetch count must be positive";
+  chunks_.clear();
+  chunks_.resize(prefetch_count);
+  current_chunk_ = NULL;
   current_row_ = 0;
+  must_stop_prefetch_ = false;
+  for (int i = 0; i < prefetch_count; ++i) {
+    chunks_[i].reset(new HDF5Chunk<Dtype>());
+    free_chunks_.push(chunks_[i].get());
+  }
+  CHECK(StartInternalThread()) << "Thread execution failed";
 
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  (*top)[0]->Reshape(batch_size, data_blob_.channels(),
-                     data_blob_.height(), data_blob_.width());
-  (*top)[1]->Reshape(batch_size, label_blob_.channels(),
-                     label_blob_.height(), label_blob_.width());
+  (*top)[0]->Reshape(batch_size, data_shape.channels(),
+                     data_shape.height(), data_shape.width());
+  (*top)[1]->Reshape(batch_size, label_shape.channels(),
+                     label_shape.height(), label_shape.width());
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
 }
 
+// Walks the file list in order; every chunk_rows_ rows of a file become one
+// staged chunk, read as a hyperslab, so the layer never holds more than the
+// ring's worth of rows in memory and the next file starts loading while the
+// tail of the current one is still being consumed.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  while (!must_stop_prefetch_) {
+    const string& filename = hdf_filenames_[current_file_];
+    hid_t file_id = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    CHECK_GE(file_id, 0) << "Failed opening HDF5 file " << filename;
+    hsize_t file_rows = 0;
+    {
+      hid_t dataset = H5Dopen2(file_id, "data", H5P_DEFAULT);
+      CHECK_GE(dataset, 0) << "Failed to open dataset data in " << filename;
+      hid_t file_space = H5Dget_space(dataset);
+      std::vector<hsize_t> dims(H5Sget_simple_extent_ndims(file_space));
+      H5Sget_simple_extent_dims(file_space, dims.data(), NULL);
+      file_rows = dims[0];
+      H5Sclose(file_space);
+      H5Dclose(dataset);
+    }
+    hsize_t row = 0;
+    while (row < file_rows && !must_stop_prefetch_) {
+      HDF5Chunk<Dtype>* chunk = free_chunks_.pop();
+      if (chunk == NULL) {
+        break;
+      }
+      const hsize_t rows = chunk_rows_ > 0 ?
+          std::min(chunk_rows_, file_rows - row) : file_rows;
+      hdf5_load_nd_dataset_rows(file_id, "data", row, rows, &chunk->data_);
+      hdf5_load_nd_dataset_rows(file_id, "label", row, rows, &chunk->label_);
+      CHECK_EQ(chunk->data_.num(), chunk->label_.num());
+      row += rows;
+      full_chunks_.push(chunk);
+    }
+    herr_t status = H5Fclose(file_id);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file " << filename;
+    current_file_ += 1;
+    if (current_file_ == num_files_) {
+      current_file_ = 0;
+      DLOG(INFO) << "Looping around to first file";
+    }
+  }
+}
+
+template <typename Dtype>
+HDF5Chunk<Dtype>* HDF5DataLayer<Dtype>::NextChunk() {
+  if (current_chunk_) {
+    free_chunks_.push(current_chunk_);
+  }
+  current_chunk_ = full_chunks_.pop("HDF5 prefetch queue empty");
+  current_row_ = 0;
+  return current_chunk_;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::JoinPrefetchThread() {
+  if (is_started()) {
+    must_stop_prefetch_ = true;
+    // Unblock the producer if it is waiting for a free chunk.
+    free_chunks_.push(static_cast<HDF5Chunk<Dtype>*>(NULL));
+  }
+  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  // Drain the queues so a subsequent SetUp starts clean.
+  HDF5Chunk<Dtype>* chunk;
+  while (free_chunks_.try_pop(&chunk)) {}
+  while (full_chunks_.try_pop(&chunk)) {}
+}
+
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -91,22 +169,15 @@ void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
 
   for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blob_.num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-      }
-      current_row_ = 0;
+    if (current_chunk_ == NULL || current_row_ == current_chunk_->data_.num()) {
+      NextChunk();
     }
-    caffe_copy(data_count, &data_blob_.cpu_data()[current_row_ * data_count],
-               &(*top)[0]->mutable_cpu_data()[i * data_count]);
+    caffe_copy(data_count,
+        &current_chunk_->data_.cpu_data()[current_row_ * data_count],
+        &(*top)[0]->mutable_cpu_data()[i * data_count]);
     caffe_copy(label_data_count,
-               &label_blob_.cpu_data()[current_row_ * label_data_count],
-               &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
+        &current_chunk_->label_.cpu_data()[current_row_ * label_data_count],
+        &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
   }
 }
 
@@ -1,8 +1,3 @@
-/*
-TODO:
-- only load parts of the file, in accordance with a prototxt param "max_mem"
-*/
-
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -24,24 +19,14 @@ void HDF5DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
 
   for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blob_.num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-      }
-      current_row_ = 0;
+    if (current_chunk_ == NULL || current_row_ == current_chunk_->data_.num()) {
+      NextChunk();
     }
     caffe_copy(data_count,
-        &data_blob_.cpu_data()[current_row_ * data_count],
+        &current_chunk_->data_.cpu_data()[current_row_ * data_count],
         &(*top)[0]->mutable_gpu_data()[i * data_count]);
     caffe_copy(label_data_count,
-        &label_blob_.cpu_data()[current_row_ * label_data_count],
+        &current_chunk_->label_.cpu_data()[current_row_ * label_data_count],
         &(*top)[1]->mutable_gpu_data()[i * label_data_count]);
   }
 }
@@ -14,19 +14,80 @@ namespace caffe {
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
-      file_name_(param.hdf5_output_param().file_name()) {
+      file_name_(param.hdf5_output_param().file_name()),
+      staging_batches_(param.hdf5_output_param().staging_batches()),
+      compression_level_(param.hdf5_output_param().compression_level()) {
   /* create a HDF5 file */
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
+  if (staging_batches_ > 0) {
+    CHECK_LE(compression_level_, 9)
+        << "compression_level must be a deflate level in [0, 9]";
+    staged_.resize(staging_batches_);
+    for (int i = 0; i < staging_batches_; ++i) {
+      staged_[i].reset(new HDF5Chunk<Dtype>());
+      free_batches_.push(staged_[i].get());
+    }
+    CHECK(StartInternalThread()) << "Failed to start HDF5 writer thread";
+  }
 }
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  if (staging_batches_ > 0) {
+    // Wake the writer with the sentinel and let it drain what is staged.
+    full_batches_.push(NULL);
+    WaitForInternalThreadToExit();
+  }
   herr_t status = H5Fclose(file_id_);
   CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
 }
 
+// The writer thread. Appending is the only place that touches the file
+// while it runs; the destructor joins it before closing the file.
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::InternalThreadEntry() {
+  while (true) {
+    HDF5Chunk<Dtype>* batch = full_batches_.pop();
+    if (batch == NULL) {
+      return;
+    }
+    hdf5_append_nd_dataset(file_id_, HDF5_DATA_DATASET_NAME, batch->data_,
+        compression_level_);
+    hdf5_append_nd_dataset(file_id_, HDF5_DATA_LABEL_NAME, batch->label_,
+        compression_level_);
+    free_batches_.push(batch);
+  }
+}
+
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::StageBlobs(const vector<Blob<Dtype>*>& bottom,
+    const bool use_gpu) {
+  HDF5Chunk<Dtype>* batch =
+      free_batches_.pop("Waiting on the HDF5 writer thread");
+  batch->data_.ReshapeLike(*bottom[0]);
+  batch->label_.ReshapeLike(*bottom[1]);
+  const int data_count = bottom[0]->count();
+  const int label_count = bottom[1]->count();
+  if (use_gpu) {
+#ifndef CPU_ONLY
+    caffe_copy(data_count, bottom[0]->gpu_data(),
+        batch->data_.mutable_cpu_data());
+    caffe_copy(label_count, bottom[1]->gpu_data(),
+        batch->label_.mutable_cpu_data());
+#else
+    NO_GPU;
+#endif
+  } else {
+    caffe_copy(data_count, bottom[0]->cpu_data(),
+        batch->data_.mutable_cpu_data());
+    caffe_copy(label_count, bottom[1]->cpu_data(),
+        batch->label_.mutable_cpu_data());
+  }
+  full_batches_.push(batch);
+}
+
 template <typename Dtype>
 void HDF5OutputLayer<Dtype>::SaveBlobs() {
   // TODO: no limit on the number of blobs
@@ -43,6 +104,10 @@ void HDF5OutputLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   CHECK_GE(bottom.size(), 2);
   CHECK_EQ(bottom[0]->num(), bottom[1]->num());
+  if (staging_batches_ > 0) {
+    StageBlobs(bottom, false);
+    return;
+  }
   data_blob_.Reshape(bottom[0]->num(), bottom[0]->channels(),
                      bottom[0]->height(), bottom[0]->width());
   label_blob_.Reshape(bottom[1]->num(), bottom[1]->channels(),
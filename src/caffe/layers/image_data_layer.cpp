@@ -1,3 +1,9 @@
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -6,6 +12,7 @@
 
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -15,6 +22,29 @@ namespace caffe {
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
   this->JoinPrefetchThread();
+  if (archive_fd_ >= 0) {
+    close(archive_fd_);
+  }
+}
+
+// Reads the byte span of one archive entry into the (reused) buffer.
+// pread carries its own file offset, so concurrent decode workers can
+// share the archive file descriptor without seeking under each other.
+static bool ReadArchiveSpan(const int fd, const ImageArchiveEntry& entry,
+    vector<char>* buffer) {
+  buffer->resize(entry.size);
+  size_t total = 0;
+  while (total < entry.size) {
+    const ssize_t count = pread(fd, &(*buffer)[total], entry.size - total,
+        entry.offset + total);
+    if (count <= 0) {
+      LOG(ERROR) << "Could not read archived image " << entry.filename
+          << " (offset " << entry.offset << ", size " << entry.size << ")";
+      return false;
+    }
+    total += count;
+  }
+  return true;
 }
 
 template <typename Dtype>
@@ -32,10 +62,32 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   std::ifstream infile(source.c_str());
   CHECK(infile.good())
       << "Could not open image list (filename: \""+ source + "\")";
-  string filename;
-  int label;
-  while (infile >> filename >> label) {
-    lines_.push_back(std::make_pair(filename, label));
+  const string& archive = this->layer_param_.image_data_param().archive();
+  if (archive.empty()) {
+    string filename;
+    int label;
+    while (infile >> filename >> label) {
+      lines_.push_back(std::make_pair(filename, label));
+    }
+  } else {
+    // source is the index of a packed archive: each line carries the byte
+    // span of one encoded image within the archive file.
+    ImageArchiveEntry entry;
+    while (infile >> entry.filename >> entry.label >> entry.offset
+           >> entry.size) {
+      archive_entries_.push_back(entry);
+    }
+    LOG(INFO) << "Opening archive " << archive;
+    archive_fd_ = open(archive.c_str(), O_RDONLY);
+    CHECK_GE(archive_fd_, 0)
+        << "Could not open image archive (filename: \"" + archive + "\")";
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (!this->layer_param_.image_data_param().shuffle()) {
+      // Without shuffling, the archive is consumed front to back; ask the
+      // kernel for aggressive readahead so reads stream from disk.
+      posix_fadvise(archive_fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
   }
 
   if (this->layer_param_.image_data_param().shuffle()) {
@@ -45,7 +97,9 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
     ShuffleImages();
   }
-  LOG(INFO) << "A total of " << lines_.size() << " images.";
+  const size_t num_images =
+      archive.empty() ? lines_.size() : archive_entries_.size();
+  LOG(INFO) << "A total of " << num_images << " images.";
 
   lines_id_ = 0;
   // Check if we would need to randomly skip a few data points
@@ -53,15 +107,23 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     unsigned int skip = caffe_rng_rand() %
         this->layer_param_.image_data_param().rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
-    CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
+    CHECK_GT(num_images, skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
-  CHECK(!lines_.empty())
+  CHECK_GT(num_images, 0)
       << "Image list is empty (filename: \"" + source + "\")";
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
-  CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
-                         new_height, new_width, &datum));
+  if (archive_fd_ >= 0) {
+    const ImageArchiveEntry& entry = archive_entries_[lines_id_];
+    vector<char> buffer;
+    CHECK(ReadArchiveSpan(archive_fd_, entry, &buffer));
+    CHECK(DecodeImageToDatum(&buffer[0], entry.size, entry.label,
+                             new_height, new_width, &datum));
+  } else {
+    CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
+                           new_height, new_width, &datum));
+  }
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const int batch_size = this->layer_param_.image_data_param().batch_size();
@@ -92,36 +154,138 @@ template <typename Dtype>
 void ImageDataLayer<Dtype>::ShuffleImages() {
   caffe::rng_t* prefetch_rng =
       static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+  if (archive_entries_.empty()) {
+    shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+  } else {
+    shuffle(archive_entries_.begin(), archive_entries_.end(), prefetch_rng);
+  }
 }
 
-// This function is used to create a thread that prefetches the data.
+// Context handed to one decode worker: the worker owns the strided slice
+// {first, first + stride, first + 2 * stride, ...} of the staged batch, so
+// several files are open and decoding at once.
+template <typename Dtype>
+struct ImageDataDecodeContext {
+  const vector<std::pair<std::string, int> >* items;
+  // Archive mode: when archive_fd is non-negative the workers read the
+  // byte spans staged in entries from it instead of opening items' files.
+  int archive_fd;
+  const vector<ImageArchiveEntry>* entries;
+  int first;
+  int stride;
+  int new_height;
+  int new_width;
+  const Dtype* mean;
+  Dtype* top_data;
+  Dtype* top_label;
+  // Non-NULL when the GPU transform path is active: workers stage the raw
+  // pixels and crop/mirror draws instead of transforming into top_data.
+  uint8_t* raw_data;
+  int* transform_params;
+  DataTransformer<Dtype>* transformer;
+  // Per-worker stage times, filled when the layer collects timing and
+  // summed into the layer's counters after the workers are joined.
+  bool collect_timing;
+  double decode_us;
+  double transform_us;
+};
+
+// Reads, decodes and transforms the images assigned to one worker. Each
+// worker uses its own DataTransformer so that the random crop/mirror draws
+// do not race on a shared RNG, and reuses one Datum across its images so
+// the decoded pixel buffer is not reallocated per file.
 template <typename Dtype>
-void ImageDataLayer<Dtype>::InternalThreadEntry() {
+void ImageDataDecodeEntry(ImageDataDecodeContext<Dtype>* context) {
   Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
+  vector<char> buffer;
+  CPUTimer timer;
+  const int batch_size = context->items->size();
+  for (int item_id = context->first; item_id < batch_size;
+       item_id += context->stride) {
+    const std::pair<std::string, int>& item = (*context->items)[item_id];
+    if (context->collect_timing) {
+      timer.Start();
+    }
+    bool read_ok;
+    if (context->archive_fd >= 0) {
+      const ImageArchiveEntry& entry = (*context->entries)[item_id];
+      read_ok = ReadArchiveSpan(context->archive_fd, entry, &buffer) &&
+          DecodeImageToDatum(&buffer[0], entry.size, entry.label,
+              context->new_height, context->new_width, &datum);
+    } else {
+      read_ok = ReadImageToDatum(item.first, item.second,
+          context->new_height, context->new_width, &datum);
+    }
+    if (context->collect_timing) {
+      // ReadImageToDatum both reads the file and decodes it; we charge it
+      // to decode since the page cache usually hides the read.
+      timer.Stop();
+      context->decode_us += timer.MicroSeconds();
+    }
+    if (!read_ok) {
+      continue;
+    }
+    if (context->collect_timing) {
+      timer.Start();
+    }
+    if (context->raw_data) {
+      context->transformer->Fill(item_id, datum, context->raw_data,
+          context->transform_params);
+    } else {
+      context->transformer->Transform(item_id, datum, context->mean,
+          context->top_data);
+    }
+    if (context->collect_timing) {
+      timer.Stop();
+      context->transform_us += timer.MicroSeconds();
+    }
+    context->top_label[item_id] = datum.label();
+  }
+}
+
+// This function is called on the prefetch thread to fill one batch.
+template <typename Dtype>
+void ImageDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = NULL;
+  uint8_t* raw_data = NULL;
+  int* transform_params = NULL;
+  if (this->use_gpu_transform_) {
+    raw_data = static_cast<uint8_t*>(batch->raw_data_->mutable_cpu_data());
+    transform_params =
+        static_cast<int*>(batch->transform_params_->mutable_cpu_data());
+  } else {
+    top_data = batch->data_.mutable_cpu_data();
+  }
+  Dtype* top_label = batch->label_.mutable_cpu_data();
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
   const int batch_size = image_data_param.batch_size();
   const int new_height = image_data_param.new_height();
   const int new_width = image_data_param.new_width();
 
-  // datum scales
-  const int lines_size = lines_.size();
+  const bool collect_timing = this->collect_timing_;
+  CPUTimer timer;
+
+  // First walk the line list serially, staging the filenames and labels of
+  // this batch; advancing lines_id_ and the end-of-epoch reshuffle stay on
+  // this thread, so the workers below only ever read their slice.
+  const bool from_archive = (archive_fd_ >= 0);
+  const int lines_size =
+      from_archive ? archive_entries_.size() : lines_.size();
+  vector<std::pair<std::string, int> > items(batch_size);
+  vector<ImageArchiveEntry> entries;
+  if (from_archive) {
+    entries.resize(batch_size);
+  }
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
     CHECK_GT(lines_size, lines_id_);
-    if (!ReadImageToDatum(lines_[lines_id_].first,
-          lines_[lines_id_].second,
-          new_height, new_width, &datum)) {
-      continue;
+    if (from_archive) {
+      entries[item_id] = archive_entries_[lines_id_];
+      items[item_id] = std::make_pair(entries[item_id].filename,
+          entries[item_id].label);
+    } else {
+      items[item_id] = lines_[lines_id_];
     }
-
-    // Apply transformations (mirror, crop...) to the data
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    top_label[item_id] = datum.label();
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
@@ -133,6 +297,95 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
       }
     }
   }
+
+  // Now read, decode and transform the staged filenames, either serially or
+  // across a pool of worker threads with several files in flight.
+  const int decode_threads = std::min(batch_size,
+      std::max(1, static_cast<int>(image_data_param.decode_threads())));
+  if (decode_threads == 1) {
+    Datum datum;
+    vector<char> buffer;
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      if (collect_timing) {
+        timer.Start();
+      }
+      bool read_ok;
+      if (from_archive) {
+        const ImageArchiveEntry& entry = entries[item_id];
+        read_ok = ReadArchiveSpan(archive_fd_, entry, &buffer) &&
+            DecodeImageToDatum(&buffer[0], entry.size, entry.label,
+                new_height, new_width, &datum);
+      } else {
+        read_ok = ReadImageToDatum(items[item_id].first,
+              items[item_id].second,
+              new_height, new_width, &datum);
+      }
+      if (collect_timing) {
+        // ReadImageToDatum both reads the file and decodes it; we charge it
+        // to decode since the page cache usually hides the read.
+        timer.Stop();
+        this->decode_time_ms_ += timer.MicroSeconds() / 1000.;
+      }
+      if (!read_ok) {
+        continue;
+      }
+
+      // Apply transformations (mirror, crop...) to the data, or only stage
+      // the raw pixels when the transform runs on the GPU.
+      if (collect_timing) {
+        timer.Start();
+      }
+      if (raw_data) {
+        this->data_transformer_.Fill(item_id, datum, raw_data,
+            transform_params);
+      } else {
+        this->data_transformer_.Transform(item_id, datum, this->mean_,
+            top_data);
+      }
+      if (collect_timing) {
+        timer.Stop();
+        this->transform_time_ms_ += timer.MicroSeconds() / 1000.;
+      }
+
+      top_label[item_id] = datum.label();
+    }
+  } else {
+    vector<shared_ptr<DataTransformer<Dtype> > > transformers(decode_threads);
+    vector<ImageDataDecodeContext<Dtype> > contexts(decode_threads);
+    vector<shared_ptr<boost::thread> > threads(decode_threads);
+    for (int i = 0; i < decode_threads; ++i) {
+      transformers[i].reset(new DataTransformer<Dtype>(this->transform_param_));
+      transformers[i]->set_phase(this->phase_);
+      transformers[i]->InitRand();
+      contexts[i].items = &items;
+      contexts[i].archive_fd = from_archive ? archive_fd_ : -1;
+      contexts[i].entries = &entries;
+      contexts[i].first = i;
+      contexts[i].stride = decode_threads;
+      contexts[i].new_height = new_height;
+      contexts[i].new_width = new_width;
+      contexts[i].mean = this->mean_;
+      contexts[i].top_data = top_data;
+      contexts[i].top_label = top_label;
+      contexts[i].raw_data = raw_data;
+      contexts[i].transform_params = transform_params;
+      contexts[i].transformer = transformers[i].get();
+      contexts[i].collect_timing = collect_timing;
+      contexts[i].decode_us = 0;
+      contexts[i].transform_us = 0;
+      threads[i].reset(new boost::thread(&ImageDataDecodeEntry<Dtype>,
+          &contexts[i]));
+    }
+    for (int i = 0; i < decode_threads; ++i) {
+      threads[i]->join();
+    }
+    if (collect_timing) {
+      for (int i = 0; i < decode_threads; ++i) {
+        this->decode_time_ms_ += contexts[i].decode_us / 1000.;
+        this->transform_time_ms_ += contexts[i].transform_us / 1000.;
+      }
+    }
+  }
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
@@ -43,6 +43,7 @@ void InfogainLossLayer<Dtype>::Reshape(
   CHECK_EQ(infogain->channels(), 1);
   CHECK_EQ(infogain->height(), dim);
   CHECK_EQ(infogain->width(), dim);
+  log_prob_.ReshapeLike(*bottom[0]);
 }
 
 
@@ -59,13 +60,21 @@ void InfogainLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
   int num = bottom[0]->num();
   int dim = bottom[0]->count() / bottom[0]->num();
+  // Clamp and take the log of all probabilities in one vectorized pass,
+  // then reduce each sample to a single BLAS dot against the infogain
+  // row its label selects. This replaces the old scalar loop, whose
+  // per-element log calls dominated for large dim.
+  const int count = bottom[0]->count();
+  Dtype* log_prob = log_prob_.mutable_cpu_data();
+  for (int i = 0; i < count; ++i) {
+    log_prob[i] = std::max(bottom_data[i], Dtype(kLOG_THRESHOLD));
+  }
+  caffe_log(count, log_prob, log_prob);
   Dtype loss = 0;
   for (int i = 0; i < num; ++i) {
     int label = static_cast<int>(bottom_label[i]);
-    for (int j = 0; j < dim; ++j) {
-      Dtype prob = std::max(bottom_data[i * dim + j], Dtype(kLOG_THRESHOLD));
-      loss -= infogain_mat[label * dim + j] * log(prob);
-    }
+    loss -= caffe_cpu_dot(dim, infogain_mat + label * dim,
+                          log_prob + i * dim);
   }
   (*top)[0]->mutable_cpu_data()[0] = loss / num;
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -14,6 +16,7 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
+  transpose_ = this->layer_param_.inner_product_param().transpose();
   N_ = num_output;
   K_ = bottom[0]->count() / bottom[0]->num();
   // Check if we need to set up the weights
@@ -25,8 +28,14 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     } else {
       this->blobs_.resize(1);
     }
-    // Intialize the weight
-    this->blobs_[0].reset(new Blob<Dtype>(1, 1, N_, K_));
+    // Intialize the weight. With transpose the weight is stored K x N so
+    // the forward GEMM runs without CblasTrans and BLAS skips re-packing
+    // the static weight matrix on every batch.
+    if (transpose_) {
+      this->blobs_[0].reset(new Blob<Dtype>(1, 1, K_, N_));
+    } else {
+      this->blobs_[0].reset(new Blob<Dtype>(1, 1, N_, K_));
+    }
     // fill the weights
     shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
         this->layer_param_.inner_product_param().weight_filler()));
@@ -40,6 +49,29 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // INT8 inference path.
+  quantize_ = this->layer_param_.quantization_param().quantize();
+  if (quantize_) {
+    CHECK(!transpose_)
+        << "quantize assumes the standard N x K weight layout.";
+    const Dtype input_range = this->layer_param_.quantization_param()
+        .input_range();
+    CHECK_GT(input_range, 0)
+        << "quantize requires a calibrated input_range; run calibrate_net.";
+    input_scale_ = Dtype(127) / input_range;
+  }
+  // Weights-only INT8 path.
+  quantize_weights_ = this->layer_param_.quantization_param()
+      .quantize_weights();
+  if (quantize_weights_) {
+    CHECK(!quantize_)
+        << "quantize and quantize_weights are mutually exclusive.";
+    CHECK(!transpose_)
+        << "quantize_weights assumes the standard N x K weight layout.";
+    CHECK_EQ(Caffe::phase(), Caffe::TEST)
+        << "quantize_weights drops the full precision weights and is for "
+        << "forward-only deployment nets.";
+  }
 }
 
 template <typename Dtype>
@@ -50,11 +82,53 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   CHECK_EQ(bottom[0]->count() / bottom[0]->num(), K_) << "Input size "
     "incompatible with inner product parameters.";
   (*top)[0]->Reshape(bottom[0]->num(), N_, 1, 1);
-  // Set up the bias multiplier
+  // Point at the shared all-ones "bias multiplier"; the cache spares
+  // every layer its own allocation and fill.
   if (bias_term_) {
-    bias_multiplier_.Reshape(1, 1, 1, M_);
-    caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    bias_multiplier_ = &Caffe::ones<Dtype>(M_);
+  }
+  if (quantize_) {
+    int8_bottom_.resize(M_ * K_);
+    int32_top_.resize(M_ * N_);
+  }
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::SetUpQuantization() {
+  // Symmetric per-layer weight quantization. Done once: the quantized
+  // inference path is for deployed nets whose weights no longer change.
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int count = this->blobs_[0]->count();
+  Dtype max_abs = 0;
+  for (int i = 0; i < count; ++i) {
+    max_abs = std::max(max_abs, std::fabs(weight[i]));
+  }
+  weight_scale_ = max_abs > 0 ? Dtype(127) / max_abs : Dtype(1);
+  int8_weight_.resize(count);
+  caffe_cpu_quantize(count, weight, weight_scale_, &int8_weight_[0]);
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::SetUpWeightQuantization() {
+  // Symmetric per-row quantization: each output's weights get their own
+  // scale, so small-magnitude rows keep their resolution. Done once, the
+  // first time the layer runs.
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  int8_weight_.resize(N_ * K_);
+  weight_row_scale_.resize(N_);
+  for (int n = 0; n < N_; ++n) {
+    const Dtype* row = weight + n * K_;
+    Dtype max_abs = 0;
+    for (int k = 0; k < K_; ++k) {
+      max_abs = std::max(max_abs, std::fabs(row[k]));
+    }
+    const Dtype scale = max_abs > 0 ? Dtype(127) / max_abs : Dtype(1);
+    caffe_cpu_quantize(K_, row, scale, &int8_weight_[n * K_]);
+    weight_row_scale_[n] = Dtype(1) / scale;
   }
+  // Serving keeps only the int8 copy, a quarter of the footprint; the
+  // blob reallocates (zeroed) lazily if anything touches it again.
+  this->blobs_[0]->ReleaseData();
 }
 
 template <typename Dtype>
@@ -62,12 +136,39 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (quantize_) {
+    // int8 GEMM with int32 accumulation; the combined scale undoes both
+    // quantizations on the way back to Dtype.
+    if (int8_weight_.empty()) {
+      SetUpQuantization();
+    }
+    caffe_cpu_quantize(M_ * K_, bottom_data, input_scale_, &int8_bottom_[0]);
+    caffe_cpu_igemm(CblasTrans, M_, N_, K_, &int8_bottom_[0], &int8_weight_[0],
+        &int32_top_[0]);
+    caffe_cpu_dequantize(M_ * N_, &int32_top_[0],
+        Dtype(1) / (input_scale_ * weight_scale_), top_data);
+  } else if (quantize_weights_) {
+    // Weights-only int8: the fused GEMV dequantizes each weight in
+    // registers, so a request streams a quarter of the weight bytes
+    // while the activations stay full precision.
+    if (int8_weight_.empty()) {
+      SetUpWeightQuantization();
+    }
+    for (int m = 0; m < M_; ++m) {
+      caffe_cpu_gemv_int8(N_, K_, &int8_weight_[0], &weight_row_scale_[0],
+          bottom_data + m * K_, top_data + m * N_);
+    }
+  } else {
+    // The released weight blob must not be touched in the quantized
+    // paths above, so the pointer is only taken here.
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans,
+        transpose_ ? CblasNoTrans : CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, weight, (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
-        bias_multiplier_.cpu_data(),
+        bias_multiplier_->cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
 }
@@ -79,21 +180,29 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = (*bottom)[0]->cpu_data();
-    // Gradient with respect to weight
-    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
-        top_diff, bottom_data, (Dtype)0., this->blobs_[0]->mutable_cpu_diff());
+    // Gradient with respect to weight. Note that we accumulate diffs.
+    if (transpose_) {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_, (Dtype)1.,
+          bottom_data, top_diff, (Dtype)1.,
+          this->blobs_[0]->mutable_cpu_diff());
+    } else {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
+          top_diff, bottom_data, (Dtype)1.,
+          this->blobs_[0]->mutable_cpu_diff());
+    }
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
     const Dtype* top_diff = top[0]->cpu_diff();
-    // Gradient with respect to bias
+    // Gradient with respect to bias. Note that we accumulate diffs.
     caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
-        bias_multiplier_.cpu_data(), (Dtype)0.,
+        bias_multiplier_->cpu_data(), (Dtype)1.,
         this->blobs_[1]->mutable_cpu_diff());
   }
   if (propagate_down[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     // Gradient with respect to bottom data
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_, (Dtype)1.,
+    caffe_cpu_gemm<Dtype>(CblasNoTrans,
+        transpose_ ? CblasTrans : CblasNoTrans, M_, K_, N_, (Dtype)1.,
         top_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
         (*bottom)[0]->mutable_cpu_diff());
   }
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -14,55 +15,6 @@ void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   pre_pad_ = (size_ - 1) / 2;
   alpha_ = this->layer_param_.lrn_param().alpha();
   beta_ = this->layer_param_.lrn_param().beta();
-  if (this->layer_param_.lrn_param().norm_region() ==
-      LRNParameter_NormRegion_WITHIN_CHANNEL) {
-    // Set up split_layer_ to use inputs in the numerator and denominator.
-    split_top_vec_.clear();
-    split_top_vec_.push_back(&product_input_);
-    split_top_vec_.push_back(&square_input_);
-    LayerParameter split_param;
-    split_layer_.reset(new SplitLayer<Dtype>(split_param));
-    split_layer_->SetUp(bottom, &split_top_vec_);
-    // Set up square_layer_ to square the inputs.
-    square_bottom_vec_.clear();
-    square_top_vec_.clear();
-    square_bottom_vec_.push_back(&square_input_);
-    square_top_vec_.push_back(&square_output_);
-    LayerParameter square_param;
-    square_param.mutable_power_param()->set_power(Dtype(2));
-    square_layer_.reset(new PowerLayer<Dtype>(square_param));
-    square_layer_->SetUp(square_bottom_vec_, &square_top_vec_);
-    // Set up pool_layer_ to sum over square neighborhoods of the input.
-    pool_top_vec_.clear();
-    pool_top_vec_.push_back(&pool_output_);
-    LayerParameter pool_param;
-    pool_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_AVE);
-    pool_param.mutable_pooling_param()->set_pad(pre_pad_);
-    pool_param.mutable_pooling_param()->set_kernel_size(size_);
-    pool_layer_.reset(new PoolingLayer<Dtype>(pool_param));
-    pool_layer_->SetUp(square_top_vec_, &pool_top_vec_);
-    // Set up power_layer_ to compute (1 + alpha_/N^2 s)^-beta_, where s is
-    // the sum of a squared neighborhood (the output of pool_layer_).
-    power_top_vec_.clear();
-    power_top_vec_.push_back(&power_output_);
-    LayerParameter power_param;
-    power_param.mutable_power_param()->set_power(-beta_);
-    power_param.mutable_power_param()->set_scale(alpha_);
-    power_param.mutable_power_param()->set_shift(Dtype(1));
-    power_layer_.reset(new PowerLayer<Dtype>(power_param));
-    power_layer_->SetUp(pool_top_vec_, &power_top_vec_);
-    // Set up a product_layer_ to compute outputs by multiplying inputs by the
-    // inverse demoninator computed by the power layer.
-    product_bottom_vec_.clear();
-    product_bottom_vec_.push_back(&product_input_);
-    product_bottom_vec_.push_back(&power_output_);
-    LayerParameter product_param;
-    EltwiseParameter* eltwise_param = product_param.mutable_eltwise_param();
-    eltwise_param->set_operation(EltwiseParameter_EltwiseOp_PROD);
-    product_layer_.reset(new EltwiseLayer<Dtype>(product_param));
-    product_layer_->SetUp(product_bottom_vec_, top);
-  }
 }
 
 template <typename Dtype>
@@ -72,19 +24,8 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
-  switch (this->layer_param_.lrn_param().norm_region()) {
-  case LRNParameter_NormRegion_ACROSS_CHANNELS:
-    (*top)[0]->Reshape(num_, channels_, height_, width_);
-    scale_.Reshape(num_, channels_, height_, width_);
-    break;
-  case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    split_layer_->Reshape(bottom, &split_top_vec_);
-    square_layer_->Reshape(square_bottom_vec_, &square_top_vec_);
-    pool_layer_->Reshape(square_top_vec_, &pool_top_vec_);
-    power_layer_->Reshape(pool_top_vec_, &power_top_vec_);
-    product_layer_->Reshape(product_bottom_vec_, top);
-    break;
-  }
+  (*top)[0]->Reshape(num_, channels_, height_, width_);
+  scale_.Reshape(num_, channels_, height_, width_);
 }
 
 template <typename Dtype>
@@ -95,7 +36,7 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_cpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_cpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -108,55 +49,126 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = 1.;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
+  const int spatial = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / size_;
+  // The squared window sum slides over the channels one row at a time,
+  // with one running slot per pixel; scale and output come out of the
+  // same pass, so each value is touched once instead of the blob-wide
+  // powx and mul passes.
+  Blob<Dtype> window(1, 1, height_, width_);
+  Dtype* window_data = window.mutable_cpu_data();
   for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+    const Dtype* bottom_n = bottom_data + bottom[0]->offset(n);
+    caffe_set(spatial, Dtype(0), window_data);
+    for (int c = 0; c <= pre_pad_ && c < channels_; ++c) {
+      const Dtype* x = bottom_n + c * spatial;
+      for (int p = 0; p < spatial; ++p) {
+        window_data[p] += x[p] * x[p];
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      const Dtype* x = bottom_n + c * spatial;
+      Dtype* s = scale_data + scale_.offset(n, c);
+      Dtype* y = top_data + (*top)[0]->offset(n, c);
+      for (int p = 0; p < spatial; ++p) {
+        const Dtype scale = Dtype(1) + alpha_over_size * window_data[p];
+        s[p] = scale;
+        y[p] = x[p] * std::pow(scale, -beta_);
+      }
+      // slide the window: add the head channel, drop the tail
+      const int head = c + pre_pad_ + 1;
+      if (head < channels_) {
+        const Dtype* xh = bottom_n + head * spatial;
+        for (int p = 0; p < spatial; ++p) {
+          window_data[p] += xh[p] * xh[p];
+        }
+      }
+      const int tail = c - pre_pad_;
+      if (tail >= 0) {
+        const Dtype* xt = bottom_n + tail * spatial;
+        for (int p = 0; p < spatial; ++p) {
+          window_data[p] -= xt[p] * xt[p];
+        }
+      }
     }
   }
+}
 
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+// Sliding 2D window sum over one height x width plane: col[w] holds the
+// column's sum over the current row window and a scalar sum slides along
+// each row, so every element is added and removed a constant number of
+// times regardless of the window size.
+template <typename Dtype>
+static void WindowSumPlane(const Dtype* src, const int height,
+    const int width, const int pre_pad, Dtype* col, Dtype* dst) {
+  caffe_set(width, Dtype(0), col);
+  for (int h = 0; h <= pre_pad && h < height; ++h) {
+    const Dtype* row = src + h * width;
+    for (int w = 0; w < width; ++w) {
+      col[w] += row[w];
+    }
+  }
+  for (int h = 0; h < height; ++h) {
+    Dtype run = 0;
+    for (int w = 0; w <= pre_pad && w < width; ++w) {
+      run += col[w];
+    }
+    Dtype* out = dst + h * width;
+    for (int w = 0; w < width; ++w) {
+      out[w] = run;
+      // slide the column window: add the head column, drop the tail
+      const int head_w = w + pre_pad + 1;
+      if (head_w < width) { run += col[head_w]; }
+      const int tail_w = w - pre_pad;
+      if (tail_w >= 0) { run -= col[tail_w]; }
+    }
+    // slide the row window: add the head row, drop the tail
+    const int head_h = h + pre_pad + 1;
+    if (head_h < height) {
+      const Dtype* row = src + head_h * width;
+      for (int w = 0; w < width; ++w) {
+        col[w] += row[w];
+      }
+    }
+    const int tail_h = h - pre_pad;
+    if (tail_h >= 0) {
+      const Dtype* row = src + tail_h * width;
+      for (int w = 0; w < width; ++w) {
+        col[w] -= row[w];
+      }
+    }
+  }
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelForward(
+void LRNLayer<Dtype>::WithinChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  split_layer_->Forward(bottom, &split_top_vec_);
-  square_layer_->Forward(square_bottom_vec_, &square_top_vec_);
-  pool_layer_->Forward(square_top_vec_, &pool_top_vec_);
-  power_layer_->Forward(pool_top_vec_, &power_top_vec_);
-  product_layer_->Forward(product_bottom_vec_, top);
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  const int spatial = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / (size_ * size_);
+  // Each plane is normalized independently: square it into a plane-sized
+  // buffer, window-sum with running sums, and write scale and output in
+  // one sweep. Only cache-sized plane buffers are materialized, where
+  // the former sub-layer composition made four blob-wide passes.
+  Blob<Dtype> sq(1, 1, height_, width_);
+  Blob<Dtype> sums(1, 1, height_, width_);
+  Blob<Dtype> col(1, 1, 1, width_);
+  Dtype* sq_data = sq.mutable_cpu_data();
+  Dtype* sums_data = sums.mutable_cpu_data();
+  Dtype* col_data = col.mutable_cpu_data();
+  for (int i = 0; i < num_ * channels_; ++i) {
+    const Dtype* x = bottom_data + i * spatial;
+    Dtype* s = scale_data + i * spatial;
+    Dtype* y = top_data + i * spatial;
+    caffe_sqr(spatial, x, sq_data);
+    WindowSumPlane(sq_data, height_, width_, pre_pad_, col_data, sums_data);
+    for (int p = 0; p < spatial; ++p) {
+      s[p] = Dtype(1) + alpha_over_size * sums_data[p];
+      y[p] = x[p] * std::pow(s[p], -beta_);
+    }
+  }
 }
 
 template <typename Dtype>
@@ -167,7 +179,7 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_cpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_cpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -183,64 +195,85 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
+  const int spatial = height_ * width_;
+  const Dtype cache_ratio = 2. * alpha_ * beta_ / size_;
+  // ratio_c = diff_c * y_c / s_c for one image at a time; its window sum
+  // slides over the channels just as in the forward pass, and the bottom
+  // diff comes out of the same pass.
+  Blob<Dtype> ratio(1, channels_, height_, width_);
+  Blob<Dtype> window(1, 1, height_, width_);
+  Dtype* ratio_data = ratio.mutable_cpu_data();
+  Dtype* window_data = window.mutable_cpu_data();
   for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+    const int offset = scale_.offset(n);
+    caffe_mul<Dtype>(channels_ * spatial, top_diff + offset,
+        top_data + offset, ratio_data);
+    caffe_div<Dtype>(channels_ * spatial, ratio_data, scale_data + offset,
+        ratio_data);
+    caffe_set(spatial, Dtype(0), window_data);
+    for (int c = 0; c <= pre_pad_ && c < channels_; ++c) {
+      caffe_axpy<Dtype>(spatial, Dtype(1), ratio_data + c * spatial,
+          window_data);
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      const Dtype* x = bottom_data + offset + c * spatial;
+      const Dtype* dy = top_diff + offset + c * spatial;
+      const Dtype* s = scale_data + offset + c * spatial;
+      Dtype* dx = bottom_diff + offset + c * spatial;
+      for (int p = 0; p < spatial; ++p) {
+        dx[p] = dy[p] * std::pow(s[p], -beta_)
+            - cache_ratio * x[p] * window_data[p];
+      }
+      // slide the window: add the head channel, drop the tail
+      const int head = c + pre_pad_ + 1;
+      if (head < channels_) {
+        caffe_axpy<Dtype>(spatial, Dtype(1), ratio_data + head * spatial,
+            window_data);
+      }
+      const int tail = c - pre_pad_;
+      if (tail >= 0) {
+        caffe_axpy<Dtype>(spatial, Dtype(-1), ratio_data + tail * spatial,
+            window_data);
+      }
     }
   }
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelBackward(
+void LRNLayer<Dtype>::WithinChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     vector<Blob<Dtype>*>* bottom) {
-  if (propagate_down[0]) {
-    vector<bool> product_propagate_down(2, true);
-    product_layer_->Backward(top, product_propagate_down, &product_bottom_vec_);
-    power_layer_->Backward(power_top_vec_, propagate_down, &pool_top_vec_);
-    pool_layer_->Backward(pool_top_vec_, propagate_down, &square_top_vec_);
-    square_layer_->Backward(square_top_vec_, propagate_down,
-                            &square_bottom_vec_);
-    split_layer_->Backward(split_top_vec_, propagate_down, bottom);
+  if (!propagate_down[0]) { return; }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+  const Dtype* scale_data = scale_.cpu_data();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  const int spatial = height_ * width_;
+  const Dtype cache_ratio = 2. * alpha_ * beta_ / (size_ * size_);
+  // The chain rule mirrors the cross-channel backward: with
+  // ratio = dy * y / s, the gradient of x through its neighbors'
+  // denominators is the window sum of ratio, scaled by cache_ratio.
+  Blob<Dtype> ratio(1, 1, height_, width_);
+  Blob<Dtype> sums(1, 1, height_, width_);
+  Blob<Dtype> col(1, 1, 1, width_);
+  Dtype* ratio_data = ratio.mutable_cpu_data();
+  Dtype* sums_data = sums.mutable_cpu_data();
+  Dtype* col_data = col.mutable_cpu_data();
+  for (int i = 0; i < num_ * channels_; ++i) {
+    const Dtype* x = bottom_data + i * spatial;
+    const Dtype* dy = top_diff + i * spatial;
+    const Dtype* yv = top_data + i * spatial;
+    const Dtype* s = scale_data + i * spatial;
+    Dtype* dx = bottom_diff + i * spatial;
+    caffe_mul(spatial, dy, yv, ratio_data);
+    caffe_div(spatial, ratio_data, s, ratio_data);
+    WindowSumPlane(ratio_data, height_, width_, pre_pad_, col_data,
+        sums_data);
+    for (int p = 0; p < spatial; ++p) {
+      dx[p] = dy[p] * std::pow(s[p], -beta_)
+          - cache_ratio * x[p] * sums_data[p];
+    }
   }
 }
 
@@ -248,6 +281,8 @@ void LRNLayer<Dtype>::WithinChannelBackward(
 STUB_GPU(LRNLayer);
 STUB_GPU_FORWARD(LRNLayer, CrossChannelForward);
 STUB_GPU_BACKWARD(LRNLayer, CrossChannelBackward);
+STUB_GPU_FORWARD(LRNLayer, WithinChannelForward);
+STUB_GPU_BACKWARD(LRNLayer, WithinChannelBackward);
 #endif
 
 INSTANTIATE_CLASS(LRNLayer);
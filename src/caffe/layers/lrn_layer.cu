@@ -6,11 +6,14 @@
 
 namespace caffe {
 
+// Computes the scale and the normalized output together in a single pass
+// over the channels, so each input value is read once and the scale never
+// has to be re-read from global memory.
 template <typename Dtype>
-__global__ void LRNFillScale(const int nthreads, const Dtype* in,
+__global__ void LRNFillScaleComputeOutput(const int nthreads, const Dtype* in,
     const int num, const int channels, const int height,
     const int width, const int size, const Dtype alpha_over_size,
-    Dtype* scale) {
+    const Dtype negative_beta, Dtype* scale, Dtype* out) {
   CUDA_KERNEL_LOOP(index, nthreads) {
     // find out the local offset
     int w = index % width;
@@ -20,11 +23,12 @@ __global__ void LRNFillScale(const int nthreads, const Dtype* in,
     int step = height * width;
     in += offset;
     scale += offset;
+    out += offset;
     int head = 0;
     int pre_pad = (size - 1) / 2;
     int post_pad = size - pre_pad - 1;
     Dtype accum_scale = 0;
-    // fill the scale at [n, :, h, w]
+    // fill the scale and output at [n, :, h, w]
     // accumulate values
     while (head < post_pad) {
       accum_scale += in[head * step] * in[head * step];
@@ -33,20 +37,29 @@ __global__ void LRNFillScale(const int nthreads, const Dtype* in,
     // until we reach size, nothing needs to be subtracted
     while (head < size) {
       accum_scale += in[head * step] * in[head * step];
-      scale[(head - post_pad) * step] = 1. + accum_scale * alpha_over_size;
+      Dtype scale_val = 1. + accum_scale * alpha_over_size;
+      scale[(head - post_pad) * step] = scale_val;
+      out[(head - post_pad) * step] =
+          in[(head - post_pad) * step] * pow(scale_val, negative_beta);
       ++head;
     }
     // both add and subtract
     while (head < channels) {
       accum_scale += in[head * step] * in[head * step];
       accum_scale -= in[(head - size) * step] * in[(head - size) * step];
-      scale[(head - post_pad) * step] = 1. + accum_scale * alpha_over_size;
+      Dtype scale_val = 1. + accum_scale * alpha_over_size;
+      scale[(head - post_pad) * step] = scale_val;
+      out[(head - post_pad) * step] =
+          in[(head - post_pad) * step] * pow(scale_val, negative_beta);
       ++head;
     }
     // subtract only
     while (head < channels + post_pad) {
       accum_scale -= in[(head - size) * step] * in[(head - size) * step];
-      scale[(head - post_pad) * step] = 1. + accum_scale * alpha_over_size;
+      Dtype scale_val = 1. + accum_scale * alpha_over_size;
+      scale[(head - post_pad) * step] = scale_val;
+      out[(head - post_pad) * step] =
+          in[(head - post_pad) * step] * pow(scale_val, negative_beta);
       ++head;
     }
   }
@@ -61,41 +74,72 @@ void LRNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_gpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_gpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
   }
 }
 
-// TODO: check if it would be faster to just put it into the previous kernel.
+// One thread per output element: sums the squared spatial window
+// directly (the windows are small) and writes scale and output
+// together, replacing the former split/square/pool/power/product
+// sub-layer chain and its four intermediate blobs.
 template <typename Dtype>
-__global__ void LRNComputeOutput(const int nthreads, const Dtype* in,
-    const Dtype* scale, const Dtype negative_beta, Dtype* out) {
+__global__ void LRNWithinChannelFillScaleComputeOutput(const int nthreads,
+    const Dtype* in, const int height, const int width, const int size,
+    const Dtype alpha_over_size, const Dtype negative_beta, Dtype* scale,
+    Dtype* out) {
   CUDA_KERNEL_LOOP(index, nthreads) {
-    out[index] = in[index] * pow(scale[index], negative_beta);
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int plane = index / width / height;  // n * channels + c
+    const Dtype* in_plane = in + plane * height * width;
+    const int pre_pad = (size - 1) / 2;
+    const int hstart = max(h - pre_pad, 0);
+    const int hend = min(h - pre_pad + size, height);
+    const int wstart = max(w - pre_pad, 0);
+    const int wend = min(w - pre_pad + size, width);
+    Dtype accum = 0;
+    for (int nh = hstart; nh < hend; ++nh) {
+      for (int nw = wstart; nw < wend; ++nw) {
+        const Dtype value = in_plane[nh * width + nw];
+        accum += value * value;
+      }
+    }
+    const Dtype scale_val = 1. + accum * alpha_over_size;
+    scale[index] = scale_val;
+    out[index] = in[index] * pow(scale_val, negative_beta);
   }
 }
 
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelForward_gpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const int n_threads = num_ * channels_ * height_ * width_;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelFillScaleComputeOutput<<<CAFFE_GET_BLOCKS(n_threads),
+                                           CAFFE_CUDA_NUM_THREADS>>>(
+      n_threads, bottom[0]->gpu_data(), height_, width_, size_,
+      alpha_ / (size_ * size_), -beta_, scale_.mutable_gpu_data(),
+      (*top)[0]->mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, compute scale
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = (*top)[0]->mutable_gpu_data();
   Dtype* scale_data = scale_.mutable_gpu_data();
   // We will launch one kernel for each pixel location, and have the kernel
-  // go through all the channels.
+  // go through all the channels, computing scale and output as it goes.
   int n_threads = num_ * height_ * width_;
   // NOLINT_NEXT_LINE(whitespace/operators)
-  LRNFillScale<<<CAFFE_GET_BLOCKS(n_threads), CAFFE_CUDA_NUM_THREADS>>>(
+  LRNFillScaleComputeOutput<<<CAFFE_GET_BLOCKS(n_threads),
+                              CAFFE_CUDA_NUM_THREADS>>>(
       n_threads, bottom_data, num_, channels_, height_, width_, size_,
-      alpha_ / size_, scale_data);
-  CUDA_POST_KERNEL_CHECK;
-  n_threads = bottom[0]->count();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  LRNComputeOutput<<<CAFFE_GET_BLOCKS(n_threads), CAFFE_CUDA_NUM_THREADS>>>(
-      n_threads, bottom_data, scale_data, -beta_, top_data);
+      alpha_ / size_, -beta_, scale_data, top_data);
   CUDA_POST_KERNEL_CHECK;
 }
 
@@ -108,13 +152,59 @@ void LRNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_gpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_gpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
   }
 }
 
+// One thread per bottom element: accumulates ratio = dy * y / s over the
+// spatial window (the gradient through the neighbors' denominators) and
+// combines it with the direct term in one pass.
+template <typename Dtype>
+__global__ void LRNWithinChannelComputeDiff(const int nthreads,
+    const Dtype* bottom_data, const Dtype* top_data, const Dtype* scale,
+    const Dtype* top_diff, const int height, const int width, const int size,
+    const Dtype negative_beta, const Dtype cache_ratio, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int plane = index / width / height;  // n * channels + c
+    const int plane_offset = plane * height * width;
+    const int pre_pad = (size - 1) / 2;
+    const int hstart = max(h - pre_pad, 0);
+    const int hend = min(h - pre_pad + size, height);
+    const int wstart = max(w - pre_pad, 0);
+    const int wend = min(w - pre_pad + size, width);
+    Dtype accum_ratio = 0;
+    for (int nh = hstart; nh < hend; ++nh) {
+      for (int nw = wstart; nw < wend; ++nw) {
+        const int q = plane_offset + nh * width + nw;
+        accum_ratio += top_diff[q] * top_data[q] / scale[q];
+      }
+    }
+    bottom_diff[index] = top_diff[index] * pow(scale[index], negative_beta)
+        - cache_ratio * bottom_data[index] * accum_ratio;
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelBackward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  if (!propagate_down[0]) { return; }
+  const int n_threads = num_ * channels_ * height_ * width_;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelComputeDiff<<<CAFFE_GET_BLOCKS(n_threads),
+                                CAFFE_CUDA_NUM_THREADS>>>(
+      n_threads, (*bottom)[0]->gpu_data(), top[0]->gpu_data(),
+      scale_.gpu_data(), top[0]->gpu_diff(), height_, width_, size_,
+      -beta_, Dtype(2. * alpha_ * beta_ / (size_ * size_)),
+      (*bottom)[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template <typename Dtype>
 __global__ void LRNComputeDiff(const int nthreads, const Dtype* bottom_data,
     const Dtype* top_data, const Dtype* scale, const Dtype* top_diff,
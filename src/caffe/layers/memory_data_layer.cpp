@@ -1,3 +1,5 @@
+#include <boost/thread.hpp>
+
 #include <vector>
 
 #include "caffe/data_layers.hpp"
@@ -6,6 +8,30 @@
 
 namespace caffe {
 
+// The batch-slot ring follows the classic bounded queue of Vyukov,
+// restricted to a single consumer (Forward). Each slot carries a sequence
+// number, initialized to the slot index: a producer whose claim cursor is
+// h owns slot h % ring_slots_ once its sequence equals h, and publishes
+// the filled slot by storing h + 1; the consumer at cursor t waits for
+// sequence t + 1 and recycles the slot by storing t + ring_slots_ after
+// the net is done with the batch. The compare-and-swap on the claim
+// cursor is the only contended operation, so producers never take a lock
+// and never block the consumer.
+//
+// The loads and stores go through volatile accesses paired with
+// __sync_synchronize() fences; this predates std::atomic but is the
+// portable idiom for the gcc-compatible compilers the Makefile supports.
+static inline unsigned int seq_load(const unsigned int* p) {
+  const unsigned int v = *const_cast<const volatile unsigned int*>(p);
+  __sync_synchronize();
+  return v;
+}
+
+static inline void seq_store(unsigned int* p, const unsigned int v) {
+  __sync_synchronize();
+  *const_cast<volatile unsigned int*>(p) = v;
+}
+
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
      vector<Blob<Dtype>*>* top) {
@@ -28,33 +54,105 @@ void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   labels_ = NULL;
   added_data_.cpu_data();
   added_label_.cpu_data();
+  ring_slots_ = this->layer_param_.memory_data_param().ring_slots();
+  if (ring_slots_ > 0) {
+    // Allocate the batch slots up front; in GPU mode they are backed by
+    // pinned host memory so uploads of consumed batches can use DMA.
+    const bool use_pinned = (Caffe::mode() == Caffe::GPU);
+    slot_data_.resize(ring_slots_);
+    slot_label_.resize(ring_slots_);
+    slot_seq_.resize(ring_slots_);
+    for (int i = 0; i < ring_slots_; ++i) {
+      slot_data_[i].reset(new Blob<Dtype>(batch_size_, this->datum_channels_,
+          this->datum_height_, this->datum_width_));
+      slot_label_[i].reset(new Blob<Dtype>(batch_size_, 1, 1, 1));
+      if (use_pinned) {
+        slot_data_[i]->data()->set_prefer_pinned(true);
+        slot_label_[i]->data()->set_prefer_pinned(true);
+      }
+      slot_data_[i]->mutable_cpu_data();
+      slot_label_[i]->mutable_cpu_data();
+      slot_seq_[i] = i;
+    }
+    ring_head_ = 0;
+    ring_tail_ = 0;
+    ring_busy_ = false;
+  }
 }
 
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::AddDatumVector(const vector<Datum>& datum_vector) {
-  CHECK(!has_new_data_) <<
-      "Can't add Datum when earlier ones haven't been consumed"
-      << " by the upper layers";
   size_t num = datum_vector.size();
   CHECK_GT(num, 0) << "There is no datum to add";
   CHECK_LE(num, batch_size_) <<
       "The number of added datum must be no greater than the batch size";
 
-  Dtype* top_data = added_data_.mutable_cpu_data();
-  Dtype* top_label = added_label_.mutable_cpu_data();
+  Dtype* top_data = NULL;
+  Dtype* top_label = NULL;
+  unsigned int slot = 0;
+  if (ring_slots_ > 0) {
+    // Spin until a slot frees up: this convenience path keeps the
+    // blocking behavior of the legacy API, while direct producers can
+    // call ClaimBatchSlot themselves and handle a full ring.
+    while (!ClaimBatchSlot(&top_data, &top_label, &slot)) {
+      boost::this_thread::yield();
+    }
+  } else {
+    CHECK(!has_new_data_) <<
+        "Can't add Datum when earlier ones haven't been consumed"
+        << " by the upper layers";
+    top_data = added_data_.mutable_cpu_data();
+    top_label = added_label_.mutable_cpu_data();
+  }
   for (int batch_item_id = 0; batch_item_id < num; ++batch_item_id) {
     // Apply data transformations (mirror, scale, crop...)
     this->data_transformer_.Transform(
         batch_item_id, datum_vector[batch_item_id], this->mean_, top_data);
     top_label[batch_item_id] = datum_vector[batch_item_id].label();
   }
-  // num_images == batch_size_
-  Reset(top_data, top_label, batch_size_);
-  has_new_data_ = true;
+  if (ring_slots_ > 0) {
+    CommitBatchSlot(slot);
+  } else {
+    // num_images == batch_size_
+    Reset(top_data, top_label, batch_size_);
+    has_new_data_ = true;
+  }
+}
+
+template <typename Dtype>
+bool MemoryDataLayer<Dtype>::ClaimBatchSlot(Dtype** data, Dtype** labels,
+    unsigned int* slot) {
+  CHECK_GT(ring_slots_, 0)
+      << "ClaimBatchSlot requires memory_data_param.ring_slots";
+  while (true) {
+    const unsigned int h = seq_load(&ring_head_);
+    const unsigned int seq = seq_load(&slot_seq_[h % ring_slots_]);
+    if (seq == h) {
+      if (__sync_bool_compare_and_swap(&ring_head_, h, h + 1)) {
+        *data = slot_data_[h % ring_slots_]->mutable_cpu_data();
+        *labels = slot_label_[h % ring_slots_]->mutable_cpu_data();
+        *slot = h;
+        return true;
+      }
+    } else if (static_cast<int>(seq - h) < 0) {
+      // The slot h lands on has not been recycled yet: the ring is full.
+      return false;
+    }
+    // Another producer claimed h between the two loads; retry.
+  }
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::CommitBatchSlot(const unsigned int slot) {
+  CHECK_GT(ring_slots_, 0)
+      << "CommitBatchSlot requires memory_data_param.ring_slots";
+  seq_store(&slot_seq_[slot % ring_slots_], slot + 1);
 }
 
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::Reset(Dtype* data, Dtype* labels, int n) {
+  CHECK_EQ(ring_slots_, 0)
+      << "Reset cannot be combined with memory_data_param.ring_slots";
   CHECK(data);
   CHECK(labels);
   CHECK_EQ(n % batch_size_, 0) << "n must be a multiple of batch size";
@@ -67,6 +165,26 @@ void MemoryDataLayer<Dtype>::Reset(Dtype* data, Dtype* labels, int n) {
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (ring_slots_ > 0) {
+    // Recycle the slot served by the previous Forward now that the net is
+    // done with its batch.
+    if (ring_busy_) {
+      const unsigned int done = ring_tail_ - 1;
+      seq_store(&slot_seq_[done % ring_slots_], done + ring_slots_);
+    }
+    // The producers are lock-free, but the consumer still has to wait
+    // when no batch has been published yet.
+    const unsigned int t = ring_tail_;
+    while (seq_load(&slot_seq_[t % ring_slots_]) != t + 1) {
+      boost::this_thread::yield();
+    }
+    (*top)[0]->set_cpu_data(slot_data_[t % ring_slots_]->mutable_cpu_data());
+    (*top)[1]->set_cpu_data(slot_label_[t % ring_slots_]->mutable_cpu_data());
+    // Single consumer: nobody else reads or writes the tail cursor.
+    ring_tail_ = t + 1;
+    ring_busy_ = true;
+    return;
+  }
   CHECK(data_) << "MemoryDataLayer needs to be initalized by calling Reset";
   (*top)[0]->set_cpu_data(data_ + pos_ * this->datum_size_);
   (*top)[1]->set_cpu_data(labels_ + pos_);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/common_layers.hpp"
@@ -39,50 +40,45 @@ void MVNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype eps = 1e-10;
 
   if (this->layer_param_.mvn_param().normalize_variance()) {
-    // put the squares of bottom into temp_
-    caffe_powx(bottom[0]->count(), bottom_data, Dtype(2),
-        temp_.mutable_cpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());  // EX
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.cpu_data(),
-        sum_multiplier_.cpu_data(), 0.,
-        variance_.mutable_cpu_data());  // E(X^2)
-    caffe_powx(mean_.count(), mean_.cpu_data(), Dtype(2),
-        temp_.mutable_cpu_data());  // (EX)^2
-    caffe_sub(mean_.count(), variance_.cpu_data(), temp_.cpu_data(),
-        variance_.mutable_cpu_data());  // variance
-
-    // do mean and variance normalization
-    // subtract mean
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-            temp_.mutable_cpu_data());
-
-    caffe_add(temp_.count(), bottom_data, temp_.cpu_data(), top_data);
-
-    // normalize variance
-    caffe_powx(variance_.count(), variance_.cpu_data(), Dtype(0.5),
-          variance_.mutable_cpu_data());
-
-    caffe_add_scalar(variance_.count(), eps, variance_.mutable_cpu_data());
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          variance_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-          temp_.mutable_cpu_data());
-
-    caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
+    // Welford's online update gives both moments from a single read of
+    // each row, and a second read-modify-write applies them -- two
+    // sweeps over the blob instead of five, and no cancellation in
+    // E(X^2) - (EX)^2.
+    Dtype* mean_data = mean_.mutable_cpu_data();
+    Dtype* variance_data = variance_.mutable_cpu_data();
+    for (int i = 0; i < num; ++i) {
+      const Dtype* x = bottom_data + i * dim;
+      Dtype* y = top_data + i * dim;
+      Dtype mean = 0;
+      Dtype m2 = 0;
+      for (int j = 0; j < dim; ++j) {
+        const Dtype delta = x[j] - mean;
+        mean += delta / (j + 1);
+        m2 += delta * (x[j] - mean);
+      }
+      const Dtype stddev = sqrt(m2 / dim) + eps;
+      mean_data[i] = mean;
+      variance_data[i] = stddev;
+      const Dtype inv_std = Dtype(1) / stddev;
+      for (int j = 0; j < dim; ++j) {
+        y[j] = (x[j] - mean) * inv_std;
+      }
+    }
   } else {
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-            sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());  // EX
-
-    // subtract mean
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-            temp_.mutable_cpu_data());
-
-    caffe_add(temp_.count(), bottom_data, temp_.cpu_data(), top_data);
+    Dtype* mean_data = mean_.mutable_cpu_data();
+    for (int i = 0; i < num; ++i) {
+      const Dtype* x = bottom_data + i * dim;
+      Dtype* y = top_data + i * dim;
+      Dtype sum = 0;
+      for (int j = 0; j < dim; ++j) {
+        sum += x[j];
+      }
+      const Dtype mean = sum / dim;
+      mean_data[i] = mean;
+      for (int j = 0; j < dim; ++j) {
+        y[j] = x[j] - mean;
+      }
+    }
   }
 }
 
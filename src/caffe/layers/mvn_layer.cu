@@ -7,6 +7,58 @@
 
 namespace caffe {
 
+// One block per row: each thread runs Welford's update over a strided
+// slice, the partial (count, mean, M2) triples are merged pairwise in
+// shared memory, and the same kernel writes the normalized output, so
+// the row is read twice and written once in a single launch.
+template <typename Dtype>
+__global__ void MVNForward(const int dim, const Dtype* bottom_data,
+    const bool normalize_variance, const Dtype eps, Dtype* mean_data,
+    Dtype* variance_data, Dtype* top_data) {
+  __shared__ Dtype mean_s[CAFFE_CUDA_NUM_THREADS];
+  __shared__ Dtype m2_s[CAFFE_CUDA_NUM_THREADS];
+  __shared__ Dtype count_s[CAFFE_CUDA_NUM_THREADS];
+  const Dtype* x = bottom_data + blockIdx.x * dim;
+  Dtype* y = top_data + blockIdx.x * dim;
+  Dtype mean = 0;
+  Dtype m2 = 0;
+  Dtype n = 0;
+  for (int j = threadIdx.x; j < dim; j += blockDim.x) {
+    n += 1;
+    const Dtype delta = x[j] - mean;
+    mean += delta / n;
+    m2 += delta * (x[j] - mean);
+  }
+  mean_s[threadIdx.x] = mean;
+  m2_s[threadIdx.x] = m2;
+  count_s[threadIdx.x] = n;
+  __syncthreads();
+  for (int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (threadIdx.x < s && count_s[threadIdx.x + s] > 0) {
+      const Dtype n_a = count_s[threadIdx.x];
+      const Dtype n_b = count_s[threadIdx.x + s];
+      const Dtype delta = mean_s[threadIdx.x + s] - mean_s[threadIdx.x];
+      mean_s[threadIdx.x] += delta * n_b / (n_a + n_b);
+      m2_s[threadIdx.x] += m2_s[threadIdx.x + s] +
+          delta * delta * n_a * n_b / (n_a + n_b);
+      count_s[threadIdx.x] = n_a + n_b;
+    }
+    __syncthreads();
+  }
+  const Dtype row_mean = mean_s[0];
+  Dtype inv_std = 1;
+  if (normalize_variance) {
+    inv_std = Dtype(1) / (sqrt(m2_s[0] / dim) + eps);
+  }
+  if (threadIdx.x == 0) {
+    mean_data[blockIdx.x] = row_mean;
+    variance_data[blockIdx.x] = Dtype(1) / inv_std;
+  }
+  for (int j = threadIdx.x; j < dim; j += blockDim.x) {
+    y[j] = (x[j] - row_mean) * inv_std;
+  }
+}
+
 template <typename Dtype>
 void MVNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
@@ -19,55 +71,15 @@ void MVNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     num = bottom[0]->num() * bottom[0]->channels();
 
   int dim = bottom[0]->count() / num;
+  Dtype eps = 1e-10;
 
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    // put the squares of bottom into temp_
-    caffe_gpu_powx(bottom[0]->count(), bottom_data, Dtype(2),
-        temp_.mutable_gpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());  // EX
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.gpu_data(),
-        sum_multiplier_.gpu_data(), 0.,
-        variance_.mutable_gpu_data());  // E(X^2)
-    caffe_gpu_powx(mean_.count(), mean_.gpu_data(), Dtype(2),
-        temp_.mutable_gpu_data());  // (EX)^2
-    caffe_gpu_sub(mean_.count(), variance_.gpu_data(), temp_.gpu_data(),
-        variance_.mutable_gpu_data());  // variance
-
-    Dtype eps = 1e-10;
-
-    // do mean and variance normalization
-    // subtract mean
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-            temp_.mutable_gpu_data());
-
-    caffe_gpu_add(temp_.count(), bottom_data, temp_.gpu_data(), top_data);
-
-    // normalize variance
-    caffe_gpu_powx(variance_.count(), variance_.gpu_data(), Dtype(0.5),
-          variance_.mutable_gpu_data());
-
-    caffe_gpu_add_scalar(variance_.count(), eps, variance_.mutable_gpu_data());
-
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          variance_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-          temp_.mutable_gpu_data());
-
-    caffe_gpu_div(temp_.count(), top_data, temp_.gpu_data(), top_data);
-  } else {
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-            sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());  // EX
-
-    // subtract mean
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-            temp_.mutable_gpu_data());
-
-    caffe_gpu_add(temp_.count(), bottom_data, temp_.gpu_data(), top_data);
-  }
+  const bool normalize_variance =
+      this->layer_param_.mvn_param().normalize_variance();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNForward<Dtype><<<num, CAFFE_CUDA_NUM_THREADS>>>(dim, bottom_data,
+      normalize_variance, eps, mean_.mutable_gpu_data(),
+      variance_.mutable_gpu_data(), top_data);
+  CUDA_POST_KERNEL_CHECK;
 }
 
 template <typename Dtype>
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/neuron_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void NeuronChainLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const NeuronChainParameter& chain = this->layer_param_.neuron_chain_param();
+  CHECK_GT(chain.op_size(), 0)
+      << "NeuronChainLayer needs at least one op to fuse.";
+  ops_.reset(new SyncedMemory(chain.op_size() * kOpFields * sizeof(Dtype)));
+  Dtype* rec = static_cast<Dtype*>(ops_->mutable_cpu_data());
+  caffe_set(chain.op_size() * kOpFields, Dtype(0), rec);
+  num_ops_ = 0;
+  for (int i = 0; i < chain.op_size(); ++i) {
+    const LayerParameter& op = chain.op(i);
+    switch (op.type()) {
+    case LayerParameter_LayerType_ABSVAL:
+      rec[0] = OP_ABSVAL;
+      break;
+    case LayerParameter_LayerType_BNLL:
+      rec[0] = OP_BNLL;
+      break;
+    case LayerParameter_LayerType_DROPOUT:
+      // Dropout is the identity at test time and contributes no op.
+      CHECK_EQ(Caffe::phase(), Caffe::TEST)
+          << "Dropout can only be fused at test time.";
+      continue;
+    case LayerParameter_LayerType_POWER:
+      rec[0] = OP_POWER;
+      rec[1] = op.power_param().power();
+      rec[2] = op.power_param().scale();
+      rec[3] = op.power_param().shift();
+      break;
+    case LayerParameter_LayerType_RELU:
+      rec[0] = OP_RELU;
+      rec[1] = op.relu_param().negative_slope();
+      break;
+    case LayerParameter_LayerType_SIGMOID:
+      rec[0] = OP_SIGMOID;
+      break;
+    case LayerParameter_LayerType_TANH:
+      rec[0] = OP_TANH;
+      break;
+    case LayerParameter_LayerType_THRESHOLD:
+      rec[0] = OP_THRESHOLD;
+      rec[1] = op.threshold_param().threshold();
+      break;
+    default:
+      LOG(FATAL) << "Cannot fuse layer type "
+          << LayerParameter_LayerType_Name(op.type());
+    }
+    ++num_ops_;
+    rec += kOpFields;
+  }
+}
+
+template <typename Dtype>
+void NeuronChainLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const Dtype* ops = static_cast<const Dtype*>(ops_->cpu_data());
+  const int count = bottom[0]->count();
+  for (int i = 0; i < count; ++i) {
+    Dtype x = bottom_data[i];
+    for (int op = 0; op < num_ops_; ++op) {
+      const Dtype* rec = ops + op * kOpFields;
+      switch (static_cast<int>(rec[0])) {
+      case OP_RELU:
+        x = std::max(x, Dtype(0)) + rec[1] * std::min(x, Dtype(0));
+        break;
+      case OP_SIGMOID:
+        x = 1. / (1. + exp(-x));
+        break;
+      case OP_TANH: {
+        const Dtype exp2x = exp(2 * x);
+        x = (exp2x - Dtype(1)) / (exp2x + Dtype(1));
+        break;
+      }
+      case OP_POWER:
+        x = pow(rec[3] + rec[2] * x, rec[1]);
+        break;
+      case OP_BNLL:
+        x = x > 0 ? x + log(1. + exp(-x)) : log(1. + exp(x));
+        break;
+      case OP_ABSVAL:
+        x = fabs(x);
+        break;
+      case OP_THRESHOLD:
+        x = (x > rec[1]) ? Dtype(1) : Dtype(0);
+        break;
+      }
+    }
+    top_data[i] = x;
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(NeuronChainLayer, Forward);
+#endif
+
+INSTANTIATE_CLASS(NeuronChainLayer);
+
+}  // namespace caffe
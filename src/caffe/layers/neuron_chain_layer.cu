@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/neuron_layers.hpp"
+
+namespace caffe {
+
+// Interprets the opcode program once per element, so the whole chain costs a
+// single read and write of the activation blob regardless of its length. The
+// per-op formulas match the standalone kernels in the per-layer .cu files.
+template <typename Dtype>
+__global__ void NeuronChainForward(const int n, const int num_ops,
+    const Dtype* ops, const Dtype* in, Dtype* out) {
+  CUDA_KERNEL_LOOP(index, n) {
+    Dtype x = in[index];
+    for (int op = 0; op < num_ops; ++op) {
+      const Dtype* rec = ops + op * NeuronChainLayer<Dtype>::kOpFields;
+      switch (static_cast<int>(rec[0])) {
+      case NeuronChainLayer<Dtype>::OP_RELU:
+        x = x > 0 ? x : x * rec[1];
+        break;
+      case NeuronChainLayer<Dtype>::OP_SIGMOID:
+        x = 1. / (1. + exp(-x));
+        break;
+      case NeuronChainLayer<Dtype>::OP_TANH: {
+        const Dtype exp2x = exp(2 * x);
+        x = (exp2x - Dtype(1)) / (exp2x + Dtype(1));
+        break;
+      }
+      case NeuronChainLayer<Dtype>::OP_POWER:
+        x = pow(rec[3] + rec[2] * x, rec[1]);
+        break;
+      case NeuronChainLayer<Dtype>::OP_BNLL:
+        x = x > 0 ? x + log(1. + exp(-x)) : log(1. + exp(x));
+        break;
+      case NeuronChainLayer<Dtype>::OP_ABSVAL:
+        x = abs(x);
+        break;
+      case NeuronChainLayer<Dtype>::OP_THRESHOLD:
+        x = (x > rec[1]) ? Dtype(1) : Dtype(0);
+        break;
+      }
+    }
+    out[index] = x;
+  }
+}
+
+template <typename Dtype>
+void NeuronChainLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  const Dtype* ops = static_cast<const Dtype*>(ops_->gpu_data());
+  const int count = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  NeuronChainForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+      CAFFE_CUDA_NUM_THREADS>>>(count, num_ops_, ops, bottom_data, top_data);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_CLASS(NeuronChainLayer);
+
+}  // namespace caffe
@@ -0,0 +1,40 @@
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void PipelineTransferLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // The whole point is a separate, stage-local copy of the blob.
+  CHECK_NE((*top)[0], bottom[0]) << this->type_name() << " Layer does not "
+      "allow in-place computation.";
+  count_ = bottom[0]->count();
+  (*top)[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
+                     bottom[0]->height(), bottom[0]->width());
+}
+
+template <typename Dtype>
+void PipelineTransferLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  caffe_copy(count_, bottom[0]->cpu_data(), (*top)[0]->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void PipelineTransferLayer<Dtype>::Backward_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      vector<Blob<Dtype>*>* bottom) {
+  if (!propagate_down[0]) { return; }
+  caffe_copy(count_, top[0]->cpu_diff(), (*bottom)[0]->mutable_cpu_diff());
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(PipelineTransferLayer);
+#endif
+
+INSTANTIATE_CLASS(PipelineTransferLayer);
+
+}  // namespace caffe
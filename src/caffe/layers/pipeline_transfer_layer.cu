@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Copies count elements from src to dst with a peer-to-peer transfer when
+// the pointers live on different devices, falling back to a plain
+// device-to-device copy otherwise. Issued on the calling thread's legacy
+// default stream, so it orders correctly behind the consuming stage's
+// queued work.
+template <typename Dtype>
+static void pipeline_peer_copy(const int count, const Dtype* src,
+    Dtype* dst) {
+  cudaPointerAttributes src_attr, dst_attr;
+  CUDA_CHECK(cudaPointerGetAttributes(&src_attr, src));
+  CUDA_CHECK(cudaPointerGetAttributes(&dst_attr, dst));
+  const size_t bytes = count * sizeof(Dtype);
+  if (src_attr.device != dst_attr.device) {
+    CUDA_CHECK(cudaMemcpyPeerAsync(dst, dst_attr.device, src,
+        src_attr.device, bytes, 0));
+  } else {
+    CUDA_CHECK(cudaMemcpyAsync(dst, src, bytes, cudaMemcpyDeviceToDevice,
+        0));
+  }
+}
+
+template <typename Dtype>
+void PipelineTransferLayer<Dtype>::Forward_gpu(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  // Take the destination pointer first: this layer runs in the consuming
+  // stage's thread, so a first-touch allocation lands on that device.
+  Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  pipeline_peer_copy(count_, bottom[0]->gpu_data(), top_data);
+}
+
+template <typename Dtype>
+void PipelineTransferLayer<Dtype>::Backward_gpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      vector<Blob<Dtype>*>* bottom) {
+  if (!propagate_down[0]) { return; }
+  Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
+  pipeline_peer_copy(count_, top[0]->gpu_diff(), bottom_diff);
+}
+
+INSTANTIATE_CLASS(PipelineTransferLayer);
+
+}  // namespace caffe
@@ -13,16 +13,71 @@ namespace caffe {
 using std::min;
 using std::max;
 
+// Max-pools the output columns [pw_lo, pw_hi) of one pooled row, all of
+// whose windows lie inside the image horizontally. Each (h, kw) pass is a
+// branch-structured strided sweep over the output columns with no loop
+// dependence, so the compiler can vectorize it and if-convert the mask
+// update; this is the hot path for the common 3x3/s2 and 2x2/s2 layers.
+// Mtype is int for the internal max index and Dtype for an explicit mask.
+template <typename Dtype, typename Mtype>
+inline void MaxPoolRowFast(const Dtype* bottom_slice, const int width,
+    const int hstart, const int hend, const int pad_w, const int kernel_w,
+    const int stride_w, const int pw_lo, const int pw_hi,
+    Dtype* top_row, Mtype* mask_row) {
+  for (int h = hstart; h < hend; ++h) {
+    for (int kw = 0; kw < kernel_w; ++kw) {
+      const int offset = h * width - pad_w + kw;
+      const Dtype* const bottom_row = bottom_slice + offset;
+      for (int pw = pw_lo; pw < pw_hi; ++pw) {
+        const Dtype value = bottom_row[pw * stride_w];
+        if (value > top_row[pw]) {
+          top_row[pw] = value;
+          mask_row[pw] = static_cast<Mtype>(offset + pw * stride_w);
+        }
+      }
+    }
+  }
+}
+
+// Average-pools the unclamped output columns [pw_lo, pw_hi) of one pooled
+// row; inside the image the horizontal pool extent is always kernel_w, so
+// the division folds into one constant scale per row.
+template <typename Dtype>
+inline void AvePoolRowFast(const Dtype* bottom_slice, const int width,
+    const int hstart, const int hend, const int pad_w, const int kernel_w,
+    const int stride_w, const int pw_lo, const int pw_hi, const Dtype scale,
+    Dtype* top_row) {
+  for (int h = hstart; h < hend; ++h) {
+    for (int kw = 0; kw < kernel_w; ++kw) {
+      const Dtype* const bottom_row = bottom_slice + h * width - pad_w + kw;
+      for (int pw = pw_lo; pw < pw_hi; ++pw) {
+        top_row[pw] += bottom_row[pw * stride_w];
+      }
+    }
+  }
+  for (int pw = pw_lo; pw < pw_hi; ++pw) {
+    top_row[pw] *= scale;
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   PoolingParameter pool_param = this->layer_param_.pooling_param();
-  CHECK(!pool_param.has_kernel_size() !=
-      !(pool_param.has_kernel_h() && pool_param.has_kernel_w()))
-      << "Filter size is kernel_size OR kernel_h and kernel_w; not both";
-  CHECK(pool_param.has_kernel_size() ||
-      (pool_param.has_kernel_h() && pool_param.has_kernel_w()))
-      << "For non-square filters both kernel_h and kernel_w are required.";
+  global_pooling_ = pool_param.global_pooling();
+  if (global_pooling_) {
+    // The kernel follows the bottom shape, set at each Reshape.
+    CHECK(!(pool_param.has_kernel_size() ||
+        pool_param.has_kernel_h() || pool_param.has_kernel_w()))
+        << "With global_pooling: true filter size cannot be specified.";
+  } else {
+    CHECK(!pool_param.has_kernel_size() !=
+        !(pool_param.has_kernel_h() && pool_param.has_kernel_w()))
+        << "Filter size is kernel_size OR kernel_h and kernel_w; not both";
+    CHECK(pool_param.has_kernel_size() ||
+        (pool_param.has_kernel_h() && pool_param.has_kernel_w()))
+        << "For non-square filters both kernel_h and kernel_w are required.";
+  }
   CHECK((!pool_param.has_pad() && pool_param.has_pad_h()
       && pool_param.has_pad_w())
       || (!pool_param.has_pad_h() && !pool_param.has_pad_w()))
@@ -31,14 +86,16 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       && pool_param.has_stride_w())
       || (!pool_param.has_stride_h() && !pool_param.has_stride_w()))
       << "Stride is stride OR stride_h and stride_w are required.";
-  if (pool_param.has_kernel_size()) {
-    kernel_h_ = kernel_w_ = pool_param.kernel_size();
-  } else {
-    kernel_h_ = pool_param.kernel_h();
-    kernel_w_ = pool_param.kernel_w();
+  if (!global_pooling_) {
+    if (pool_param.has_kernel_size()) {
+      kernel_h_ = kernel_w_ = pool_param.kernel_size();
+    } else {
+      kernel_h_ = pool_param.kernel_h();
+      kernel_w_ = pool_param.kernel_w();
+    }
+    CHECK_GT(kernel_h_, 0) << "Filter dimensions cannot be zero.";
+    CHECK_GT(kernel_w_, 0) << "Filter dimensions cannot be zero.";
   }
-  CHECK_GT(kernel_h_, 0) << "Filter dimensions cannot be zero.";
-  CHECK_GT(kernel_w_, 0) << "Filter dimensions cannot be zero.";
   if (!pool_param.has_pad_h()) {
     pad_h_ = pad_w_ = pool_param.pad();
   } else {
@@ -51,6 +108,10 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     stride_h_ = pool_param.stride_h();
     stride_w_ = pool_param.stride_w();
   }
+  if (global_pooling_) {
+    CHECK(pad_h_ == 0 && pad_w_ == 0 && stride_h_ == 1 && stride_w_ == 1)
+        << "With global_pooling: true pad and stride cannot be specified.";
+  }
   if (pad_h_ != 0 || pad_w_ != 0) {
     CHECK(this->layer_param_.pooling_param().pool()
         == PoolingParameter_PoolMethod_AVE
@@ -68,6 +129,10 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
+  if (global_pooling_) {
+    kernel_h_ = height_;
+    kernel_w_ = width_;
+  }
   pooled_height_ = static_cast<int>(ceil(static_cast<float>(
       height_ + 2 * pad_h_ - kernel_h_) / stride_h_)) + 1;
   pooled_width_ = static_cast<int>(ceil(static_cast<float>(
@@ -128,76 +193,157 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       caffe_set(top_count, -1, mask);
     }
     caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
+    if (global_pooling_) {
+      // One flat pass per (image, channel) slice: no window or boundary
+      // arithmetic, just a running max over the height * width plane.
+      const int num = bottom[0]->num();
+      const int dim = height_ * width_;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int nc = 0; nc < num * channels_; ++nc) {
+        const Dtype* const bottom_slice = bottom_data + nc * dim;
+        Dtype maxval = bottom_slice[0];
+        int maxidx = 0;
+        for (int i = 1; i < dim; ++i) {
+          if (bottom_slice[i] > maxval) {
+            maxval = bottom_slice[i];
+            maxidx = i;
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += (*top)[0]->offset(0, 1);
+        top_data[nc] = maxval;
+        if (use_top_mask) {
+          top_mask[nc] = static_cast<Dtype>(maxidx);
+        } else {
+          mask[nc] = maxidx;
+        }
+      }
+      break;
+    }
+    {
+    // Output columns in [pw_lo, pw_hi) need no horizontal clamping and go
+    // through the fast row kernel; only the borders take the generic path.
+    const int pw_lo = min((pad_w_ + stride_w_ - 1) / stride_w_,
+        pooled_width_);
+    const int pw_hi = max(min(pooled_width_,
+        (width_ + pad_w_ - kernel_w_) / stride_w_ + 1), pw_lo);
+    const int num = bottom[0]->num();
+    // The main loop: each (image, channel) slice is independent.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int nc = 0; nc < num * channels_; ++nc) {
+      const Dtype* const bottom_slice = bottom_data + nc * height_ * width_;
+      Dtype* const top_slice = top_data + nc * pooled_height_ * pooled_width_;
+      Dtype* const top_mask_slice = use_top_mask ?
+          top_mask + nc * pooled_height_ * pooled_width_ : NULL;
+      int* const mask_slice = use_top_mask ?
+          NULL : mask + nc * pooled_height_ * pooled_width_;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        const int hstart = max(ph * stride_h_ - pad_h_, 0);
+        const int hend = min(ph * stride_h_ - pad_h_ + kernel_h_, height_);
+        Dtype* const top_row = top_slice + ph * pooled_width_;
         if (use_top_mask) {
-          top_mask += (*top)[0]->offset(0, 1);
+          MaxPoolRowFast(bottom_slice, width_, hstart, hend, pad_w_,
+              kernel_w_, stride_w_, pw_lo, pw_hi, top_row,
+              top_mask_slice + ph * pooled_width_);
         } else {
-          mask += (*top)[0]->offset(0, 1);
+          MaxPoolRowFast(bottom_slice, width_, hstart, hend, pad_w_,
+              kernel_w_, stride_w_, pw_lo, pw_hi, top_row,
+              mask_slice + ph * pooled_width_);
+        }
+        // Border columns with horizontal clamping.
+        const int num_border = pw_lo + pooled_width_ - pw_hi;
+        for (int b = 0; b < num_border; ++b) {
+          const int pw = b < pw_lo ? b : b - pw_lo + pw_hi;
+          int wstart = pw * stride_w_ - pad_w_;
+          const int wend = min(wstart + kernel_w_, width_);
+          wstart = max(wstart, 0);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              const int index = h * width_ + w;
+              if (bottom_slice[index] > top_row[pw]) {
+                top_row[pw] = bottom_slice[index];
+                if (use_top_mask) {
+                  top_mask_slice[ph * pooled_width_ + pw] =
+                      static_cast<Dtype>(index);
+                } else {
+                  mask_slice[ph * pooled_width_ + pw] = index;
+                }
+              }
+            }
+          }
         }
       }
     }
+    }
     break;
   case PoolingParameter_PoolMethod_AVE:
+    if (global_pooling_) {
+      // One flat accumulation per (image, channel) slice.
+      const int num = bottom[0]->num();
+      const int dim = height_ * width_;
+      const Dtype scale = Dtype(1) / dim;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int nc = 0; nc < num * channels_; ++nc) {
+        const Dtype* const bottom_slice = bottom_data + nc * dim;
+        Dtype sum = 0;
+        for (int i = 0; i < dim; ++i) {
+          sum += bottom_slice[i];
+        }
+        top_data[nc] = sum * scale;
+      }
+      break;
+    }
     for (int i = 0; i < top_count; ++i) {
       top_data[i] = 0;
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
+    {
+    const int pw_lo = min((pad_w_ + stride_w_ - 1) / stride_w_,
+        pooled_width_);
+    const int pw_hi = max(min(pooled_width_,
+        (width_ + pad_w_ - kernel_w_) / stride_w_ + 1), pw_lo);
+    const int num = bottom[0]->num();
+    // The main loop: each (image, channel) slice is independent.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int nc = 0; nc < num * channels_; ++nc) {
+      const Dtype* const bottom_slice = bottom_data + nc * height_ * width_;
+      Dtype* const top_slice = top_data + nc * pooled_height_ * pooled_width_;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        // The pool size counts the padded area, so compute the vertical
+        // extent before clamping to the image.
+        const int hstart_raw = ph * stride_h_ - pad_h_;
+        const int pool_h =
+            min(hstart_raw + kernel_h_, height_ + pad_h_) - hstart_raw;
+        const int hstart = max(hstart_raw, 0);
+        const int hend = min(hstart_raw + kernel_h_, height_);
+        Dtype* const top_row = top_slice + ph * pooled_width_;
+        AvePoolRowFast(bottom_slice, width_, hstart, hend, pad_w_, kernel_w_,
+            stride_w_, pw_lo, pw_hi, Dtype(1) / (pool_h * kernel_w_),
+            top_row);
+        // Border columns with horizontal clamping.
+        const int num_border = pw_lo + pooled_width_ - pw_hi;
+        for (int b = 0; b < num_border; ++b) {
+          const int pw = b < pw_lo ? b : b - pw_lo + pw_hi;
+          int wstart = pw * stride_w_ - pad_w_;
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          const int pool_size = pool_h * (wend - wstart);
+          wstart = max(wstart, 0);
+          wend = min(wend, width_);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              top_row[pw] += bottom_slice[h * width_ + w];
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
+          top_row[pw] /= pool_size;
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += (*top)[0]->offset(0, 1);
       }
     }
+    }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
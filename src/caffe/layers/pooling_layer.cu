@@ -46,6 +46,66 @@ __global__ void MaxPoolForward(const int nthreads, const Dtype* bottom_data,
   }
 }
 
+// Global pooling: one thread block per (image, channel) slice. The
+// threads stride over the plane and the partial results collapse in a
+// shared-memory tree reduction, instead of a single thread walking the
+// whole plane as the windowed kernel would for a 1x1 output.
+template <typename Dtype>
+__global__ void GlobalMaxPoolForward(const int dim, const Dtype* bottom_data,
+    Dtype* top_data, int* mask, Dtype* top_mask) {
+  __shared__ Dtype maxval[CAFFE_CUDA_NUM_THREADS];
+  __shared__ int maxidx[CAFFE_CUDA_NUM_THREADS];
+  const Dtype* const bottom_slice = bottom_data + blockIdx.x * dim;
+  Dtype val = -FLT_MAX;
+  int idx = -1;
+  for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+    if (bottom_slice[i] > val) {
+      val = bottom_slice[i];
+      idx = i;
+    }
+  }
+  maxval[threadIdx.x] = val;
+  maxidx[threadIdx.x] = idx;
+  __syncthreads();
+  for (int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (threadIdx.x < s && maxval[threadIdx.x + s] > maxval[threadIdx.x]) {
+      maxval[threadIdx.x] = maxval[threadIdx.x + s];
+      maxidx[threadIdx.x] = maxidx[threadIdx.x + s];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    top_data[blockIdx.x] = maxval[0];
+    if (mask) {
+      mask[blockIdx.x] = maxidx[0];
+    } else {
+      top_mask[blockIdx.x] = maxidx[0];
+    }
+  }
+}
+
+template <typename Dtype>
+__global__ void GlobalAvePoolForward(const int dim, const Dtype* bottom_data,
+    Dtype* top_data) {
+  __shared__ Dtype sum[CAFFE_CUDA_NUM_THREADS];
+  const Dtype* const bottom_slice = bottom_data + blockIdx.x * dim;
+  Dtype val = 0;
+  for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+    val += bottom_slice[i];
+  }
+  sum[threadIdx.x] = val;
+  __syncthreads();
+  for (int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (threadIdx.x < s) {
+      sum[threadIdx.x] += sum[threadIdx.x + s];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    top_data[blockIdx.x] = sum[0] / dim;
+  }
+}
+
 template <typename Dtype>
 __global__ void AvePoolForward(const int nthreads, const Dtype* bottom_data,
     const int num, const int channels, const int height,
@@ -167,6 +227,13 @@ void PoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     } else {
       mask = max_idx_.mutable_gpu_data();
     }
+    if (global_pooling_) {
+      // One block per output value reduces its whole plane cooperatively.
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      GlobalMaxPoolForward<Dtype><<<count, CAFFE_CUDA_NUM_THREADS>>>(
+          height_ * width_, bottom_data, top_data, mask, top_mask);
+      break;
+    }
     // NOLINT_NEXT_LINE(whitespace/operators)
     MaxPoolForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
         count, bottom_data, bottom[0]->num(), channels_,
@@ -175,6 +242,12 @@ void PoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         mask, top_mask);
     break;
   case PoolingParameter_PoolMethod_AVE:
+    if (global_pooling_) {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      GlobalAvePoolForward<Dtype><<<count, CAFFE_CUDA_NUM_THREADS>>>(
+          height_ * width_, bottom_data, top_data);
+      break;
+    }
     // NOLINT_NEXT_LINE(whitespace/operators)
     AvePoolForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
         count, bottom_data, bottom[0]->num(), channels_,
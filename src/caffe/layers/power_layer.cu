@@ -26,7 +26,14 @@ void PowerLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   if (shift_ != Dtype(0)) {
     caffe_gpu_add_scalar(count, shift_, top_data);
   }
-  if (power_ != Dtype(1)) {
+  // Specialize the common exponents as in Forward_cpu: square and
+  // square root skip the generic pow kernel; power 1 needs no
+  // exponentiation at all.
+  if (power_ == Dtype(2)) {
+    caffe_gpu_mul(count, top_data, top_data, top_data);
+  } else if (power_ == Dtype(0.5)) {
+    caffe_gpu_sqrt(count, top_data, top_data);
+  } else if (power_ != Dtype(1)) {
     caffe_gpu_powx(count, top_data, power_, top_data);
   }
 }
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void SampledSoftmaxLossLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  LossLayer<Dtype>::LayerSetUp(bottom, top);
+  const SampledSoftmaxParameter& param =
+      this->layer_param_.sampled_softmax_param();
+  CHECK(param.has_num_classes())
+      << "sampled_softmax_param.num_classes is required.";
+  num_classes_ = param.num_classes();
+  num_samples_ = param.num_samples();
+  CHECK_GE(num_classes_, 2);
+  CHECK_GE(num_samples_, 1);
+  bias_term_ = param.bias_term();
+  K_ = bottom[0]->count() / bottom[0]->num();
+  // Check if we need to set up the weights
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+  } else {
+    if (bias_term_) {
+      this->blobs_.resize(2);
+    } else {
+      this->blobs_.resize(1);
+    }
+    this->blobs_[0].reset(new Blob<Dtype>(1, 1, num_classes_, K_));
+    shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
+        param.weight_filler()));
+    weight_filler->Fill(this->blobs_[0].get());
+    if (bias_term_) {
+      this->blobs_[1].reset(new Blob<Dtype>(1, 1, 1, num_classes_));
+      shared_ptr<Filler<Dtype> > bias_filler(GetFiller<Dtype>(
+          param.bias_filler()));
+      bias_filler->Fill(this->blobs_[1].get());
+    }
+  }  // parameter initialization
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Dtype>
+void SampledSoftmaxLossLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  LossLayer<Dtype>::Reshape(bottom, top);
+  M_ = bottom[0]->num();
+  CHECK_EQ(bottom[0]->count() / M_, K_) << "Input size "
+    "incompatible with sampled softmax parameters.";
+  CHECK_EQ(bottom[1]->count(), M_) << "Labels must be one per image.";
+  sample_ids_.Reshape(M_, num_samples_ + 1, 1, 1);
+  prob_.Reshape(M_, num_samples_ + 1, 1, 1);
+}
+
+template <typename Dtype>
+int SampledSoftmaxLossLayer<Dtype>::SampleClass() {
+  switch (this->layer_param_.sampled_softmax_param().sampler()) {
+  case SampledSoftmaxParameter_Sampler_UNIFORM:
+    return caffe_rng_rand() % num_classes_;
+  case SampledSoftmaxParameter_Sampler_LOG_UNIFORM: {
+    // Inverse CDF of P(k) = (log(k + 2) - log(k + 1)) / log(V + 1):
+    // k = floor(exp(u * log(V + 1))) - 1 for uniform u in [0, 1).
+    Dtype u;
+    caffe_rng_uniform(1, Dtype(0), Dtype(1), &u);
+    const int id = static_cast<int>(exp(u * log(Dtype(num_classes_ + 1))))
+        - 1;
+    return std::min(id, num_classes_ - 1);
+  }
+  default:
+    LOG(FATAL) << "Unknown sampler.";
+    return 0;
+  }
+}
+
+template <typename Dtype>
+Dtype SampledSoftmaxLossLayer<Dtype>::LogExpectedCount(const int id) const {
+  switch (this->layer_param_.sampled_softmax_param().sampler()) {
+  case SampledSoftmaxParameter_Sampler_UNIFORM:
+    return log(Dtype(num_samples_) / num_classes_);
+  case SampledSoftmaxParameter_Sampler_LOG_UNIFORM:
+    return log(num_samples_ *
+        (log(Dtype(id + 2)) - log(Dtype(id + 1))) /
+        log(Dtype(num_classes_ + 1)));
+  default:
+    LOG(FATAL) << "Unknown sampler.";
+    return 0;
+  }
+}
+
+template <typename Dtype>
+void SampledSoftmaxLossLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Dtype* data = bottom[0]->cpu_data();
+  const Dtype* label = bottom[1]->cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  int* ids = sample_ids_.mutable_cpu_data();
+  Dtype* prob = prob_.mutable_cpu_data();
+  const int dim = num_samples_ + 1;
+  // Draw all the negatives up front: the thread-local RNG must be used
+  // serially, while the scoring below is free to parallelize.
+  for (int n = 0; n < M_; ++n) {
+    const int label_value = static_cast<int>(label[n]);
+    CHECK_GE(label_value, 0);
+    CHECK_LT(label_value, num_classes_);
+    ids[n * dim] = label_value;
+    for (int j = 1; j < dim; ++j) {
+      int id;
+      do {
+        id = SampleClass();
+      } while (id == label_value);
+      ids[n * dim + j] = id;
+    }
+  }
+  Dtype loss = 0;
+  for (int n = 0; n < M_; ++n) {
+    const Dtype* x = data + n * K_;
+    Dtype* z = prob + n * dim;
+    // Logits for the label and the drawn negatives only; the other
+    // num_classes - dim rows of the weight matrix are never touched.
+    // Sampled logits carry the -log(expected count) importance
+    // correction; the label is always scored, so it carries none.
+    for (int j = 0; j < dim; ++j) {
+      const int id = ids[n * dim + j];
+      z[j] = caffe_cpu_dot(K_, weight + id * K_, x)
+          + (bias ? bias[id] : Dtype(0))
+          - (j > 0 ? LogExpectedCount(id) : Dtype(0));
+    }
+    // Softmax over the dim logits, kept for Backward.
+    Dtype maxval = -FLT_MAX;
+    for (int j = 0; j < dim; ++j) {
+      maxval = std::max(maxval, z[j]);
+    }
+    Dtype sum = 0;
+    for (int j = 0; j < dim; ++j) {
+      z[j] = exp(z[j] - maxval);
+      sum += z[j];
+    }
+    for (int j = 0; j < dim; ++j) {
+      z[j] /= sum;
+    }
+    loss -= log(std::max(z[0], Dtype(FLT_MIN)));
+  }
+  (*top)[0]->mutable_cpu_data()[0] = loss / M_;
+}
+
+template <typename Dtype>
+void SampledSoftmaxLossLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type_name()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  const Dtype* data = (*bottom)[0]->cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* prob = prob_.cpu_data();
+  const int* ids = sample_ids_.cpu_data();
+  const int dim = num_samples_ + 1;
+  const Dtype scale = top[0]->cpu_diff()[0] / M_;
+  Dtype* bottom_diff = NULL;
+  if (propagate_down[0]) {
+    bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+    caffe_set((*bottom)[0]->count(), Dtype(0), bottom_diff);
+  }
+  Dtype* weight_diff = this->param_propagate_down_[0] ?
+      this->blobs_[0]->mutable_cpu_diff() : NULL;
+  Dtype* bias_diff = bias_term_ && this->param_propagate_down_[1] ?
+      this->blobs_[1]->mutable_cpu_diff() : NULL;
+  // Softmax-minus-indicator over the sampled logits; everything stays
+  // sparse, so only the dim scored weight rows per image receive any
+  // gradient. Serial: different images can draw the same class, so the
+  // weight row accumulations would race. Note that we accumulate
+  // parameter diffs, matching the other layers.
+  for (int n = 0; n < M_; ++n) {
+    const Dtype* x = data + n * K_;
+    for (int j = 0; j < dim; ++j) {
+      const int id = ids[n * dim + j];
+      const Dtype dz = scale * (prob[n * dim + j] - (j == 0 ? 1 : 0));
+      if (bottom_diff) {
+        caffe_axpy(K_, dz, weight + id * K_, bottom_diff + n * K_);
+      }
+      if (weight_diff) {
+        caffe_axpy(K_, dz, x, weight_diff + id * K_);
+      }
+      if (bias_diff) {
+        bias_diff[id] += dz;
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(SampledSoftmaxLossLayer);
+
+}  // namespace caffe
@@ -0,0 +1,328 @@
+#include <vector>
+
+#ifndef CPU_ONLY
+#include <boost/thread.hpp>
+#endif
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const InnerProductParameter& ip_param =
+      this->layer_param_.inner_product_param();
+  const int num_shards = ip_param.shard_device_size();
+  CHECK_GE(num_shards, 1);
+  CHECK(!ip_param.transpose())
+      << "shard_device assumes the standard N x K weight layout.";
+  CHECK(!this->layer_param_.quantization_param().quantize() &&
+        !this->layer_param_.quantization_param().quantize_weights())
+      << "quantization is not supported for sharded inner products.";
+  this->transpose_ = false;
+  this->quantize_ = false;
+  this->quantize_weights_ = false;
+  this->bias_term_ = ip_param.bias_term();
+  this->N_ = ip_param.num_output();
+  this->K_ = bottom[0]->count() / bottom[0]->num();
+  CHECK_GE(this->N_, num_shards)
+      << "cannot split " << this->N_ << " outputs over " << num_shards
+      << " shards.";
+  // Near-equal column split; the first N % S shards take one extra output.
+  shard_outputs_.resize(num_shards);
+  first_output_.resize(num_shards);
+  int offset = 0;
+  for (int s = 0; s < num_shards; ++s) {
+    shard_outputs_[s] = this->N_ / num_shards + (s < this->N_ % num_shards);
+    first_output_[s] = offset;
+    offset += shard_outputs_[s];
+  }
+  const int blobs_per_shard = this->bias_term_ ? 2 : 1;
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+    CHECK_EQ(this->blobs_.size(), num_shards * blobs_per_shard)
+        << "sharded layers store one weight (and bias) blob per shard.";
+  } else {
+    this->blobs_.resize(num_shards * blobs_per_shard);
+    shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
+        ip_param.weight_filler()));
+    shared_ptr<Filler<Dtype> > bias_filler(this->bias_term_ ?
+        GetFiller<Dtype>(ip_param.bias_filler()) :
+        static_cast<Filler<Dtype>*>(NULL));
+    for (int s = 0; s < num_shards; ++s) {
+      this->blobs_[s * blobs_per_shard].reset(
+          new Blob<Dtype>(1, 1, shard_outputs_[s], this->K_));
+      weight_filler->Fill(this->blobs_[s * blobs_per_shard].get());
+      if (this->bias_term_) {
+        this->blobs_[s * blobs_per_shard + 1].reset(
+            new Blob<Dtype>(1, 1, 1, shard_outputs_[s]));
+        bias_filler->Fill(this->blobs_[s * blobs_per_shard + 1].get());
+      }
+    }
+  }  // parameter initialization
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+  shard_bottom_.resize(num_shards);
+  shard_top_.resize(num_shards);
+  shard_ones_.resize(num_shards);
+  for (int s = 0; s < num_shards; ++s) {
+    shard_bottom_[s].reset(new Blob<Dtype>());
+    shard_top_[s].reset(new Blob<Dtype>());
+    shard_ones_[s].reset(new Blob<Dtype>());
+  }
+#ifndef CPU_ONLY
+  // The solver updates every shard's parameter blob from the caller's
+  // device, so map the shard devices into this device's address space
+  // where the hardware allows it.
+  if (Caffe::mode() == Caffe::GPU) {
+    int current_device;
+    CUDA_CHECK(cudaGetDevice(&current_device));
+    for (int s = 0; s < num_shards; ++s) {
+      const int peer = ip_param.shard_device(s);
+      if (peer == current_device) { continue; }
+      int can_access = 0;
+      CUDA_CHECK(cudaDeviceCanAccessPeer(&can_access, current_device, peer));
+      if (can_access) {
+        cudaError_t err = cudaDeviceEnablePeerAccess(peer, 0);
+        if (err != cudaSuccess && err != cudaErrorPeerAccessAlreadyEnabled) {
+          CUDA_CHECK(err);
+        }
+        cudaGetLastError();  // clear the harmless already-enabled status
+      } else {
+        LOG(WARNING) << "Layer " << this->layer_param_.name()
+            << ": no peer access from device " << current_device
+            << " to shard device " << peer
+            << "; forward works, but solver updates will not.";
+      }
+    }
+  }
+#endif
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  InnerProductLayer<Dtype>::Reshape(bottom, top);
+  // Shard-local buffers; allocation is lazy, so memory lands on a
+  // shard's device only when its worker thread first touches it.
+  for (int s = 0; s < shard_outputs_.size(); ++s) {
+    shard_bottom_[s]->Reshape(1, 1, this->M_, this->K_);
+    shard_top_[s]->Reshape(1, 1, this->M_, shard_outputs_[s]);
+    if (this->bias_term_) {
+      shard_ones_[s]->Reshape(1, 1, 1, this->M_);
+      caffe_set(this->M_, Dtype(1), shard_ones_[s]->mutable_cpu_data());
+    }
+  }
+  shard_scratch_.Reshape(1, 1, this->M_, this->K_);
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  // On the CPU the shards share one memory, so each writes its strip of
+  // the top in place through the strided GEMM.
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const int blobs_per_shard = this->bias_term_ ? 2 : 1;
+  for (int s = 0; s < shard_outputs_.size(); ++s) {
+    const int num_output = shard_outputs_[s];
+    Dtype* top_strip = top_data + first_output_[s];
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, this->M_, num_output,
+        this->K_, (Dtype)1., bottom_data, this->K_,
+        this->blobs_[s * blobs_per_shard]->cpu_data(), this->K_,
+        (Dtype)0., top_strip, this->N_);
+    if (this->bias_term_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_,
+          num_output, 1, (Dtype)1., this->bias_multiplier_->cpu_data(), 1,
+          this->blobs_[s * blobs_per_shard + 1]->cpu_data(), num_output,
+          (Dtype)1., top_strip, this->N_);
+    }
+  }
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const int blobs_per_shard = this->bias_term_ ? 2 : 1;
+  for (int s = 0; s < shard_outputs_.size(); ++s) {
+    const int num_output = shard_outputs_[s];
+    const Dtype* top_diff_strip = top_diff + first_output_[s];
+    if (this->param_propagate_down_[s * blobs_per_shard]) {
+      // Gradient with respect to this shard's weight slice (accumulated).
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_output, this->K_,
+          this->M_, (Dtype)1., top_diff_strip, this->N_,
+          (*bottom)[0]->cpu_data(), this->K_, (Dtype)1.,
+          this->blobs_[s * blobs_per_shard]->mutable_cpu_diff(), this->K_);
+    }
+    if (this->bias_term_ &&
+        this->param_propagate_down_[s * blobs_per_shard + 1]) {
+      // Column sums of the strip, as a strided GEMM since the gemv
+      // wrapper has no leading-dimension form.
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_output, 1,
+          this->M_, (Dtype)1., top_diff_strip, this->N_,
+          this->bias_multiplier_->cpu_data(), 1, (Dtype)1.,
+          this->blobs_[s * blobs_per_shard + 1]->mutable_cpu_diff(), 1);
+    }
+    if (propagate_down[0]) {
+      // Each shard contributes a partial bottom gradient; the first
+      // write clears last iteration's values, the rest accumulate.
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, this->K_,
+          num_output, (Dtype)1., top_diff_strip, this->N_,
+          this->blobs_[s * blobs_per_shard]->cpu_data(), this->K_,
+          s == 0 ? (Dtype)0. : (Dtype)1.,
+          (*bottom)[0]->mutable_cpu_diff(), this->K_);
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(ShardedInnerProductLayer);
+#else
+
+// Binds the calling worker thread to the shard's device. Each thread has
+// its own Caffe singleton, so SetDevice rebuilds that thread's handles
+// without touching the caller's.
+static void BindShardDevice(const int device) {
+  Caffe::set_mode(Caffe::GPU);
+  int current_device;
+  CUDA_CHECK(cudaGetDevice(&current_device));
+  if (current_device != device) {
+    Caffe::SetDevice(device);
+  }
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::ForwardShard(const int s,
+    const Dtype* bottom_data) {
+  BindShardDevice(this->layer_param_.inner_product_param().shard_device(s));
+  const int num_output = shard_outputs_[s];
+  const int blobs_per_shard = this->bias_term_ ? 2 : 1;
+  // First touch from this thread, so the allocation lands on the shard's
+  // device; likewise the parameter blobs below on their first forward.
+  Dtype* local_bottom = shard_bottom_[s]->mutable_gpu_data();
+  CUDA_CHECK(cudaMemcpyAsync(local_bottom, bottom_data,
+      this->M_ * this->K_ * sizeof(Dtype), cudaMemcpyDefault, 0));
+  caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, this->M_, num_output,
+      this->K_, (Dtype)1., local_bottom,
+      this->blobs_[s * blobs_per_shard]->gpu_data(), (Dtype)0.,
+      shard_top_[s]->mutable_gpu_data());
+  if (this->bias_term_) {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, num_output,
+        1, (Dtype)1., shard_ones_[s]->gpu_data(),
+        this->blobs_[s * blobs_per_shard + 1]->gpu_data(), (Dtype)1.,
+        shard_top_[s]->mutable_gpu_data());
+  }
+  CUDA_CHECK(cudaDeviceSynchronize());
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  // The shard threads read the bottom from this device, so whatever was
+  // queued to produce it must have landed first.
+  CUDA_CHECK(cudaDeviceSynchronize());
+  const int num_shards = shard_outputs_.size();
+  vector<shared_ptr<boost::thread> > workers(num_shards);
+  for (int s = 0; s < num_shards; ++s) {
+    workers[s].reset(new boost::thread(
+        &ShardedInnerProductLayer<Dtype>::ForwardShard, this, s,
+        bottom_data));
+  }
+  for (int s = 0; s < num_shards; ++s) {
+    workers[s]->join();
+  }
+  // Gather the strips. Each shard drained its device before exiting, so
+  // these reads see finished results, and the copies queue on this
+  // thread's stream ahead of any consumer of the top blob.
+  for (int s = 0; s < num_shards; ++s) {
+    CUDA_CHECK(cudaMemcpy2DAsync(top_data + first_output_[s],
+        this->N_ * sizeof(Dtype), shard_top_[s]->gpu_data(),
+        shard_outputs_[s] * sizeof(Dtype),
+        shard_outputs_[s] * sizeof(Dtype), this->M_, cudaMemcpyDefault, 0));
+  }
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::BackwardShard(const int s,
+    const Dtype* top_diff, const bool propagate_down) {
+  BindShardDevice(this->layer_param_.inner_product_param().shard_device(s));
+  const int num_output = shard_outputs_[s];
+  const int blobs_per_shard = this->bias_term_ ? 2 : 1;
+  // Pull this shard's strip of the top diff into local memory; the
+  // bottom copy is still resident from the forward pass.
+  Dtype* local_top_diff = shard_top_[s]->mutable_gpu_diff();
+  CUDA_CHECK(cudaMemcpy2DAsync(local_top_diff, num_output * sizeof(Dtype),
+      top_diff + first_output_[s], this->N_ * sizeof(Dtype),
+      num_output * sizeof(Dtype), this->M_, cudaMemcpyDefault, 0));
+  if (this->param_propagate_down_[s * blobs_per_shard]) {
+    caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_output, this->K_,
+        this->M_, (Dtype)1., local_top_diff, shard_bottom_[s]->gpu_data(),
+        (Dtype)1., this->blobs_[s * blobs_per_shard]->mutable_gpu_diff());
+  }
+  if (this->bias_term_ &&
+      this->param_propagate_down_[s * blobs_per_shard + 1]) {
+    caffe_gpu_gemv<Dtype>(CblasTrans, this->M_, num_output, (Dtype)1.,
+        local_top_diff, shard_ones_[s]->gpu_data(), (Dtype)1.,
+        this->blobs_[s * blobs_per_shard + 1]->mutable_gpu_diff());
+  }
+  if (propagate_down) {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, this->K_,
+        num_output, (Dtype)1., local_top_diff,
+        this->blobs_[s * blobs_per_shard]->gpu_data(), (Dtype)0.,
+        shard_bottom_[s]->mutable_gpu_diff());
+  }
+  CUDA_CHECK(cudaDeviceSynchronize());
+}
+
+template <typename Dtype>
+void ShardedInnerProductLayer<Dtype>::Backward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  const Dtype* top_diff = top[0]->gpu_diff();
+  CUDA_CHECK(cudaDeviceSynchronize());
+  const int num_shards = shard_outputs_.size();
+  vector<shared_ptr<boost::thread> > workers(num_shards);
+  for (int s = 0; s < num_shards; ++s) {
+    workers[s].reset(new boost::thread(
+        &ShardedInnerProductLayer<Dtype>::BackwardShard, this, s, top_diff,
+        propagate_down[0]));
+  }
+  for (int s = 0; s < num_shards; ++s) {
+    workers[s]->join();
+  }
+  if (propagate_down[0]) {
+    // Reduce the per-shard partials into the bottom diff here, staging
+    // each remote partial through a buffer on this device; the stream
+    // orders the copies against the axpys.
+    Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
+    const int count = (*bottom)[0]->count();
+    for (int s = 0; s < num_shards; ++s) {
+      if (s == 0) {
+        CUDA_CHECK(cudaMemcpyAsync(bottom_diff,
+            shard_bottom_[s]->gpu_diff(), count * sizeof(Dtype),
+            cudaMemcpyDefault, 0));
+      } else {
+        CUDA_CHECK(cudaMemcpyAsync(shard_scratch_.mutable_gpu_data(),
+            shard_bottom_[s]->gpu_diff(), count * sizeof(Dtype),
+            cudaMemcpyDefault, 0));
+        caffe_gpu_axpy<Dtype>(count, Dtype(1), shard_scratch_.gpu_data(),
+            bottom_diff);
+      }
+    }
+  }
+}
+
+#endif  // CPU_ONLY
+
+INSTANTIATE_CLASS(ShardedInnerProductLayer);
+
+}  // namespace caffe
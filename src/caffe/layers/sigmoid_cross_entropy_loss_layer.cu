@@ -8,23 +8,35 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void SigmoidCrossEntropyLossForward(const int nthreads,
+    const Dtype* input_data, const Dtype* target, Dtype* loss_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    // Stable version of loss computation from input data
+    const Dtype x = input_data[index];
+    loss_data[index] = -(x * (target[index] - (x >= 0)) -
+        log(1 + exp(x - 2 * x * (x >= 0))));
+  }
+}
+
 template <typename Dtype>
 void SigmoidCrossEntropyLossLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   // The forward pass computes the sigmoid outputs.
   sigmoid_bottom_vec_[0] = bottom[0];
   sigmoid_layer_->Forward(sigmoid_bottom_vec_, &sigmoid_top_vec_);
-  // Compute the loss (negative log likelihood)
+  // Compute the loss (negative log likelihood) on the device so the
+  // logits never round-trip through the host.
   const int count = bottom[0]->count();
   const int num = bottom[0]->num();
-  // Stable version of loss computation from input data
-  const Dtype* input_data = bottom[0]->cpu_data();
-  const Dtype* target = bottom[1]->cpu_data();
-  Dtype loss = 0;
-  for (int i = 0; i < count; ++i) {
-    loss -= input_data[i] * (target[i] - (input_data[i] >= 0)) -
-        log(1 + exp(input_data[i] - 2 * input_data[i] * (input_data[i] >= 0)));
-  }
+  const Dtype* input_data = bottom[0]->gpu_data();
+  const Dtype* target = bottom[1]->gpu_data();
+  Dtype* loss_data = loss_buffer_.mutable_gpu_data();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SigmoidCrossEntropyLossForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+      CAFFE_CUDA_NUM_THREADS>>>(count, input_data, target, loss_data);
+  Dtype loss;
+  caffe_gpu_asum(count, loss_data, &loss);
   (*top)[0]->mutable_cpu_data()[0] = loss / num;
 }
 
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -18,6 +19,26 @@ void SigmoidLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
+  SigmoidParameter_Engine engine = this->layer_param_.sigmoid_param().engine();
+  if (engine == SigmoidParameter_Engine_DEFAULT && Caffe::fast_math()) {
+    engine = SigmoidParameter_Engine_FAST;
+  }
+  if (engine == SigmoidParameter_Engine_FAST) {
+    caffe_cpu_fast_sigmoid(count, bottom_data, top_data);
+    if (Caffe::fast_math_verify()) {
+      Dtype max_error = 0;
+      for (int i = 0; i < count; ++i) {
+        max_error = std::max(max_error,
+            std::fabs(top_data[i] - sigmoid(bottom_data[i])));
+      }
+      CHECK_LE(max_error, kFastSigmoidMaxError)
+          << "fast sigmoid exceeded its error bound in layer "
+          << this->layer_param_.name();
+      LOG(INFO) << "Layer " << this->layer_param_.name()
+          << " fast sigmoid max error " << max_error;
+    }
+    return;
+  }
   for (int i = 0; i < count; ++i) {
     top_data[i] = sigmoid(bottom_data[i]);
   }
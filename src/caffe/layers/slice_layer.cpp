@@ -73,11 +73,50 @@ void SliceLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     }
   }
   CHECK_EQ(count_, bottom[0]->count());
+  // Zero-copy slicing is only possible along num, where each top is a
+  // contiguous sub-range of the bottom.
+  in_place_ = this->layer_param_.slice_param().in_place() && slice_dim_ == 0;
+  if (!in_place_) {
+    return;
+  }
+  // Rebuild the slice views whenever the bottom's backing memory changes
+  // or the slice layout does (a blob that shrinks keeps its allocation,
+  // so the bases alone do not tell).
+  bool rebuild = bottom[0]->data() != data_base_ ||
+      bottom[0]->diff() != diff_base_ ||
+      top_data_views_.size() != top->size();
+  for (int i = 0; !rebuild && i < top->size(); ++i) {
+    rebuild = top_data_views_[i]->size() !=
+        (*top)[i]->count() * sizeof(Dtype);
+  }
+  if (rebuild) {
+    data_base_ = bottom[0]->data();
+    diff_base_ = bottom[0]->diff();
+    top_data_views_.resize(top->size());
+    top_diff_views_.resize(top->size());
+    size_t offset = 0;
+    for (int i = 0; i < top->size(); ++i) {
+      const size_t bytes = (*top)[i]->count() * sizeof(Dtype);
+      top_data_views_[i].reset(new SyncedMemory(data_base_, offset, bytes));
+      top_diff_views_[i].reset(new SyncedMemory(diff_base_, offset, bytes));
+      offset += bytes;
+    }
+  }
 }
 
 template <typename Dtype>
 void SliceLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (in_place_) {
+    // The bottom already holds every slice; just point the tops at their
+    // sub-ranges.
+    for (int i = 0; i < top->size(); ++i) {
+      if ((*top)[i]->data() != top_data_views_[i]) {
+        (*top)[i]->ShareData(top_data_views_[i]);
+      }
+    }
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->mutable_cpu_data();
   if (slice_dim_ == 0) {
     int offset_num = 0;
@@ -107,6 +146,20 @@ template <typename Dtype>
 void SliceLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
   if (!propagate_down[0]) { return; }
+  if (in_place_) {
+    for (int i = 0; i < top.size(); ++i) {
+      if (top[i]->diff() == top_diff_views_[i]) {
+        continue;  // the consumer wrote straight into the bottom's diff
+      }
+      // First pass: the consumer wrote the top's own diff storage. Copy
+      // it into the bottom's slice, then alias the top so the next pass
+      // skips the copy.
+      caffe_copy(top[i]->count(), top[i]->cpu_diff(),
+          static_cast<Dtype*>(top_diff_views_[i]->mutable_cpu_data()));
+      top[i]->ShareDiff(top_diff_views_[i]);
+    }
+    return;
+  }
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
   if (slice_dim_ == 0) {
     int offset_num = 0;
@@ -6,10 +6,44 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void SliceForward(const int nthreads, const Dtype* bottom_data,
+    const int bottom_slice_dim, const int top_slice_dim,
+    const int offset_slice_dim, Dtype* top_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / top_slice_dim;
+    const int d = index % top_slice_dim;
+    top_data[index] =
+        bottom_data[n * bottom_slice_dim + offset_slice_dim + d];
+  }
+}
+
+template <typename Dtype>
+__global__ void SliceBackward(const int nthreads, const Dtype* top_diff,
+    const int bottom_slice_dim, const int top_slice_dim,
+    const int offset_slice_dim, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / top_slice_dim;
+    const int d = index % top_slice_dim;
+    bottom_diff[n * bottom_slice_dim + offset_slice_dim + d] =
+        top_diff[index];
+  }
+}
+
 template <typename Dtype>
 void SliceLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  const Dtype* bottom_data = bottom[0]->mutable_gpu_data();
+  if (in_place_) {
+    // The bottom already holds every slice; just point the tops at their
+    // sub-ranges.
+    for (int i = 0; i < top->size(); ++i) {
+      if ((*top)[i]->data() != top_data_views_[i]) {
+        (*top)[i]->ShareData(top_data_views_[i]);
+      }
+    }
+    return;
+  }
+  const Dtype* bottom_data = bottom[0]->gpu_data();
   if (slice_dim_ == 0) {
     int offset_num = 0;
     for (int i = 0; i < top->size(); ++i) {
@@ -20,16 +54,19 @@ void SliceLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       offset_num += blob->num();
     }
   } else if (slice_dim_ == 1) {
-    int offset_channel = 0;
+    // One strided-copy kernel per top instead of one memcpy per image.
+    const int bottom_slice_dim = bottom[0]->count() / bottom[0]->num();
+    int offset_slice_dim = 0;
     for (int i = 0; i < top->size(); ++i) {
       Blob<Dtype>* blob = (*top)[i];
       Dtype* top_data = blob->mutable_gpu_data();
-      const int num_elem = blob->channels() * blob->height() * blob->width();
-      for (int n = 0; n < num_; ++n) {
-        caffe_copy(num_elem, bottom_data + bottom[0]->offset(n, offset_channel),
-                   top_data + blob->offset(n));
-      }
-      offset_channel += blob->channels();
+      const int top_slice_dim = blob->count() / blob->num();
+      const int nthreads = blob->count();
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      SliceForward<Dtype><<<CAFFE_GET_BLOCKS(nthreads),
+          CAFFE_CUDA_NUM_THREADS>>>(nthreads, bottom_data, bottom_slice_dim,
+          top_slice_dim, offset_slice_dim, top_data);
+      offset_slice_dim += top_slice_dim;
     }
   }  // slice_dim_ is guaranteed to be 0 or 1 by SetUp.
 }
@@ -38,6 +75,20 @@ template <typename Dtype>
 void SliceLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
   if (!propagate_down[0]) { return; }
+  if (in_place_) {
+    for (int i = 0; i < top.size(); ++i) {
+      if (top[i]->diff() == top_diff_views_[i]) {
+        continue;  // the consumer wrote straight into the bottom's diff
+      }
+      // First pass: the consumer wrote the top's own diff storage. Copy
+      // it into the bottom's slice, then alias the top so the next pass
+      // skips the copy.
+      caffe_copy(top[i]->count(), top[i]->gpu_diff(),
+          static_cast<Dtype*>(top_diff_views_[i]->mutable_gpu_data()));
+      top[i]->ShareDiff(top_diff_views_[i]);
+    }
+    return;
+  }
   Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
   if (slice_dim_ == 0) {
     int offset_num = 0;
@@ -49,16 +100,19 @@ void SliceLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       offset_num += blob->num();
     }
   } else if (slice_dim_ == 1) {
-    int offset_channel = 0;
+    // One strided-copy kernel per top instead of one memcpy per image.
+    const int bottom_slice_dim = (*bottom)[0]->count() / (*bottom)[0]->num();
+    int offset_slice_dim = 0;
     for (int i = 0; i < top.size(); ++i) {
       Blob<Dtype>* blob = top[i];
       const Dtype* top_diff = blob->gpu_diff();
-      const int num_elem = blob->channels() * blob->height() * blob->width();
-      for (int n = 0; n < num_; ++n) {
-        caffe_copy(num_elem, top_diff + blob->offset(n),
-                   bottom_diff +  (*bottom)[0]->offset(n, offset_channel));
-      }
-      offset_channel += blob->channels();
+      const int top_slice_dim = blob->count() / blob->num();
+      const int nthreads = blob->count();
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      SliceBackward<Dtype><<<CAFFE_GET_BLOCKS(nthreads),
+          CAFFE_CUDA_NUM_THREADS>>>(nthreads, top_diff, bottom_slice_dim,
+          top_slice_dim, offset_slice_dim, bottom_diff);
+      offset_slice_dim += top_slice_dim;
     }
   }  // slice_dim_ is guaranteed to be 0 or 1 by SetUp.
 }
@@ -30,6 +30,16 @@ void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   int channels = bottom[0]->channels();
   int dim = bottom[0]->count() / bottom[0]->num();
   int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  // The common classifier shape has a single spatial location, where
+  // the generic path below costs four full sweeps of the blob (max,
+  // broadcast subtract, exp, divide) -- all memory-bound for wide class
+  // vectors. Take the fused two-sweep path instead.
+  if (spatial_dim == 1) {
+    for (int i = 0; i < num; ++i) {
+      caffe_cpu_softmax(channels, bottom_data + i * dim, top_data + i * dim);
+    }
+    return;
+  }
   caffe_copy(bottom[0]->count(), bottom_data, top_data);
   // We need to subtract the max to avoid numerical issues, compute the exp,
   // and then normalize.
@@ -28,11 +28,58 @@ void SoftmaxWithLossLayer<Dtype>::Reshape(
     // softmax output
     (*top)[1]->ReshapeLike(*bottom[0]);
   }
+  fused_ = top->size() < 2;
+  if (fused_) {
+    fused_max_.Reshape(bottom[0]->num(), 1, bottom[0]->height(),
+                       bottom[0]->width());
+    fused_sum_.Reshape(bottom[0]->num(), 1, bottom[0]->height(),
+                       bottom[0]->width());
+    fused_loss_.Reshape(bottom[0]->num(), 1, bottom[0]->height(),
+                        bottom[0]->width());
+  }
 }
 
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (fused_) {
+    // Single pass over the predictions: the max, the sum of
+    // exponentials and the label's log-probability come out of the same
+    // sweep, and the probability blob is never formed. The per-position
+    // max and sum are kept so Backward can reconstruct each softmax
+    // value on the fly.
+    const Dtype* bottom_data = bottom[0]->cpu_data();
+    const Dtype* label = bottom[1]->cpu_data();
+    int num = bottom[0]->num();
+    int dim = bottom[0]->count() / num;
+    int spatial_dim = bottom[0]->height() * bottom[0]->width();
+    int channels = dim / spatial_dim;
+    Dtype* max_data = fused_max_.mutable_cpu_data();
+    Dtype* sum_data = fused_sum_.mutable_cpu_data();
+    Dtype loss = 0;
+    for (int i = 0; i < num; ++i) {
+      for (int j = 0; j < spatial_dim; j++) {
+        const Dtype* x = bottom_data + i * dim + j;
+        Dtype maxval = -FLT_MAX;
+        for (int c = 0; c < channels; ++c) {
+          maxval = std::max(maxval, x[c * spatial_dim]);
+        }
+        Dtype sum = 0;
+        for (int c = 0; c < channels; ++c) {
+          sum += exp(x[c * spatial_dim] - maxval);
+        }
+        max_data[i * spatial_dim + j] = maxval;
+        sum_data[i * spatial_dim + j] = sum;
+        const int label_value = static_cast<int>(label[i * spatial_dim + j]);
+        // Clamp the log-probability at log(FLT_MIN) to match the
+        // unfused path's log(max(prob, FLT_MIN)).
+        loss -= std::max(x[label_value * spatial_dim] - maxval - log(sum),
+                         Dtype(log(FLT_MIN)));
+      }
+    }
+    (*top)[0]->mutable_cpu_data()[0] = loss / num / spatial_dim;
+    return;
+  }
   // The forward pass computes the softmax prob values.
   softmax_layer_->Forward(softmax_bottom_vec_, &softmax_top_vec_);
   const Dtype* prob_data = prob_.cpu_data();
@@ -63,6 +110,36 @@ void SoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
+    if (fused_) {
+      // Rebuild each softmax value from the cached per-position max and
+      // sum and write softmax-minus-indicator directly, so the gradient
+      // too gets by without the probability blob.
+      Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+      const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+      const Dtype* label = (*bottom)[1]->cpu_data();
+      const Dtype* max_data = fused_max_.cpu_data();
+      const Dtype* sum_data = fused_sum_.cpu_data();
+      int num = (*bottom)[0]->num();
+      int dim = (*bottom)[0]->count() / num;
+      int spatial_dim = (*bottom)[0]->height() * (*bottom)[0]->width();
+      int channels = dim / spatial_dim;
+      for (int i = 0; i < num; ++i) {
+        for (int j = 0; j < spatial_dim; ++j) {
+          const int pos = i * spatial_dim + j;
+          const int label_value = static_cast<int>(label[pos]);
+          for (int c = 0; c < channels; ++c) {
+            const int index = i * dim + c * spatial_dim + j;
+            bottom_diff[index] =
+                exp(bottom_data[index] - max_data[pos]) / sum_data[pos] -
+                (c == label_value ? 1 : 0);
+          }
+        }
+      }
+      const Dtype loss_weight = top[0]->cpu_diff()[0];
+      caffe_scal((*bottom)[0]->count(), loss_weight / num / spatial_dim,
+                 bottom_diff);
+      return;
+    }
     Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
     caffe_copy(prob_.count(), prob_data, bottom_diff);
@@ -8,17 +8,103 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void FusedSoftmaxLossForward(const int nthreads,
+    const Dtype* bottom_data, const Dtype* label, const int channels,
+    const int spatial_dim, const int dim, Dtype* max_data, Dtype* sum_data,
+    Dtype* loss_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int i = index / spatial_dim;
+    const int j = index % spatial_dim;
+    const Dtype* x = bottom_data + i * dim + j;
+    Dtype maxval = -FLT_MAX;
+    for (int c = 0; c < channels; ++c) {
+      maxval = max(maxval, x[c * spatial_dim]);
+    }
+    Dtype sum = 0;
+    for (int c = 0; c < channels; ++c) {
+      sum += exp(x[c * spatial_dim] - maxval);
+    }
+    max_data[index] = maxval;
+    sum_data[index] = sum;
+    const int label_value = static_cast<int>(label[index]);
+    // Clamp the log-probability at log(FLT_MIN) to match the unfused
+    // path's log(max(prob, FLT_MIN)).
+    loss_data[index] = -max(x[label_value * spatial_dim] - maxval - log(sum),
+                            log(Dtype(FLT_MIN)));
+  }
+}
+
+template <typename Dtype>
+__global__ void FusedSoftmaxLossBackward(const int nthreads,
+    const Dtype* bottom_data, const Dtype* label, const Dtype* max_data,
+    const Dtype* sum_data, const int channels, const int spatial_dim,
+    const int dim, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int i = index / dim;
+    const int c = (index / spatial_dim) % channels;
+    const int j = index % spatial_dim;
+    const int pos = i * spatial_dim + j;
+    bottom_diff[index] =
+        exp(bottom_data[index] - max_data[pos]) / sum_data[pos] -
+        (c == static_cast<int>(label[pos]) ? Dtype(1) : Dtype(0));
+  }
+}
+
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  Forward_cpu(bottom, top);
+  if (!fused_) {
+    // The two-top path still materializes the full softmax output on
+    // the host.
+    Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  const Dtype* label = bottom[1]->gpu_data();
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int channels = dim / spatial_dim;
+  const int nthreads = num * spatial_dim;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  FusedSoftmaxLossForward<Dtype><<<CAFFE_GET_BLOCKS(nthreads),
+      CAFFE_CUDA_NUM_THREADS>>>(nthreads, bottom_data, label, channels,
+      spatial_dim, dim, fused_max_.mutable_gpu_data(),
+      fused_sum_.mutable_gpu_data(), fused_loss_.mutable_gpu_data());
+  Dtype loss;
+  caffe_gpu_asum(nthreads, fused_loss_.gpu_data(), &loss);
+  (*top)[0]->mutable_cpu_data()[0] = loss / num / spatial_dim;
 }
 
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  // TODO(Yangqing): implement the GPU version of softmax.
-  Backward_cpu(top, propagate_down, bottom);
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type_name()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (propagate_down[0]) {
+    if (!fused_) {
+      Backward_cpu(top, propagate_down, bottom);
+      return;
+    }
+    Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
+    const Dtype* bottom_data = (*bottom)[0]->gpu_data();
+    const Dtype* label = (*bottom)[1]->gpu_data();
+    const int num = (*bottom)[0]->num();
+    const int count = (*bottom)[0]->count();
+    const int dim = count / num;
+    const int spatial_dim = (*bottom)[0]->height() * (*bottom)[0]->width();
+    const int channels = dim / spatial_dim;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedSoftmaxLossBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, bottom_data, label,
+        fused_max_.gpu_data(), fused_sum_.gpu_data(), channels, spatial_dim,
+        dim, bottom_diff);
+    const Dtype loss_weight = top[0]->cpu_diff()[0];
+    caffe_gpu_scal(count, loss_weight / num / spatial_dim, bottom_diff);
+  }
 }
 
 INSTANTIATE_CLASS(SoftmaxWithLossLayer);
@@ -0,0 +1,77 @@
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  InnerProductLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK(!this->quantize_)
+      << "SPARSE engine does not support quantized inference.";
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::BuildSparseWeight() {
+  // Conversion waits for the first forward so that pruned weights loaded
+  // by CopyTrainedLayersFrom (which runs after layer setup) are the ones
+  // compressed.
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  csr_val_.clear();
+  csr_col_.clear();
+  csr_ptr_.clear();
+  csr_ptr_.push_back(0);
+  for (int n = 0; n < this->N_; ++n) {
+    for (int k = 0; k < this->K_; ++k) {
+      const Dtype value = weight[n * this->K_ + k];
+      if (value != Dtype(0)) {
+        csr_val_.push_back(value);
+        csr_col_.push_back(k);
+      }
+    }
+    csr_ptr_.push_back(csr_val_.size());
+  }
+  csr_built_ = true;
+  LOG(INFO) << "Sparse inner product " << this->layer_param_.name() << ": "
+      << csr_val_.size() << " / " << this->blobs_[0]->count()
+      << " weights are nonzero";
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (!csr_built_) {
+    BuildSparseWeight();
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  if (csr_val_.empty()) {
+    caffe_set(this->M_ * this->N_, Dtype(0), top_data);
+  } else {
+    caffe_cpu_csrmm(this->M_, this->N_, this->K_, bottom_data,
+        &csr_val_[0], &csr_col_[0], &csr_ptr_[0], top_data);
+  }
+  if (this->bias_term_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, this->N_, 1,
+        (Dtype)1., this->bias_multiplier_->cpu_data(),
+        this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
+  }
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  InnerProductLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+  // The weights are about to be updated; recompress on the next forward.
+  csr_built_ = false;
+}
+
+INSTANTIATE_CLASS(SparseInnerProductLayer);
+
+}  // namespace caffe
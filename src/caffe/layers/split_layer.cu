@@ -22,14 +22,15 @@ void SplitLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     caffe_copy(count_, top[0]->gpu_diff(), (*bottom)[0]->mutable_gpu_diff());
     return;
   }
-  caffe_gpu_add(count_, top[0]->gpu_diff(), top[1]->gpu_diff(),
-                (*bottom)[0]->mutable_gpu_diff());
-  // Add remaining top blob diffs.
-  for (int i = 2; i < top.size(); ++i) {
-    const Dtype* top_diff = top[i]->gpu_diff();
-    Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
-    caffe_gpu_axpy(count_, Dtype(1.), top_diff, bottom_diff);
+  // Sum all the top diffs in one kernel instead of one binary op (and one
+  // traversal of the blob) per top.
+  vector<const Dtype*> top_diffs(top.size());
+  for (int i = 0; i < top.size(); ++i) {
+    top_diffs[i] = top[i]->gpu_diff();
   }
+  caffe_gpu_sum(count_, top.size(), &top_diffs[0],
+                static_cast<const Dtype*>(NULL),
+                (*bottom)[0]->mutable_gpu_diff());
 }
 
 
@@ -2,9 +2,11 @@
 // Adapted from ReLU layer code written by Yangqing Jia
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -16,6 +18,27 @@ void TanHLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   Dtype exp2x;
   const int count = bottom[0]->count();
+  TanHParameter_Engine engine = this->layer_param_.tanh_param().engine();
+  if (engine == TanHParameter_Engine_DEFAULT && Caffe::fast_math()) {
+    engine = TanHParameter_Engine_FAST;
+  }
+  if (engine == TanHParameter_Engine_FAST) {
+    caffe_cpu_fast_tanh(count, bottom_data, top_data);
+    if (Caffe::fast_math_verify()) {
+      Dtype max_error = 0;
+      for (int i = 0; i < count; ++i) {
+        exp2x = exp(2 * bottom_data[i]);
+        const Dtype exact = (exp2x - Dtype(1)) / (exp2x + Dtype(1));
+        max_error = std::max(max_error, std::fabs(top_data[i] - exact));
+      }
+      CHECK_LE(max_error, kFastTanHMaxError)
+          << "fast tanh exceeded its error bound in layer "
+          << this->layer_param_.name();
+      LOG(INFO) << "Layer " << this->layer_param_.name()
+          << " fast tanh max error " << max_error;
+    }
+    return;
+  }
   for (int i = 0; i < count; ++i) {
     exp2x = exp(2 * bottom_data[i]);
     top_data[i] = (exp2x - Dtype(1)) / (exp2x + Dtype(1));
@@ -1,6 +1,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -13,6 +14,7 @@
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -23,6 +25,51 @@
 
 namespace caffe {
 
+// Byte-budgeted LRU cache of decoded source images, so sampling many
+// windows from the same image decodes its JPEG only once. It is only
+// touched by the prefetch thread, so no locking is needed.
+class WindowImageCache {
+ public:
+  explicit WindowImageCache(const size_t byte_budget)
+      : byte_budget_(byte_budget), bytes_used_(0) {}
+
+  // Returns the decoded image, reading it from disk on a miss. Failed
+  // reads return an empty image and are not cached. cv::Mat is a
+  // reference-counted header, so returning by value does not copy pixels.
+  cv::Mat Get(const string& path) {
+    map<string, CacheList::iterator>::iterator it = index_.find(path);
+    if (it != index_.end()) {
+      // Move to the front of the recency list.
+      images_.splice(images_.begin(), images_, it->second);
+      return images_.begin()->second;
+    }
+    cv::Mat cv_img = cv::imread(path, CV_LOAD_IMAGE_COLOR);
+    if (!cv_img.data) {
+      return cv_img;
+    }
+    images_.push_front(std::make_pair(path, cv_img));
+    index_[path] = images_.begin();
+    bytes_used_ += cv_img.total() * cv_img.elemSize();
+    // Evict from the cold end, but always keep the image just decoded.
+    while (bytes_used_ > byte_budget_ && images_.size() > 1) {
+      const cv::Mat& victim = images_.back().second;
+      bytes_used_ -= victim.total() * victim.elemSize();
+      index_.erase(images_.back().first);
+      images_.pop_back();
+    }
+    return cv_img;
+  }
+
+ private:
+  typedef std::list<std::pair<string, cv::Mat> > CacheList;
+  const size_t byte_budget_;
+  size_t bytes_used_;
+  CacheList images_;  // most recently used first
+  map<string, CacheList::iterator> index_;
+
+  DISABLE_COPY_AND_ASSIGN(WindowImageCache);
+};
+
 template <typename Dtype>
 WindowDataLayer<Dtype>::~WindowDataLayer<Dtype>() {
   this->JoinPrefetchThread();
@@ -148,6 +195,13 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   LOG(INFO) << "Crop mode: "
       << this->layer_param_.window_data_param().crop_mode();
 
+  const uint64_t cache_bytes =
+      this->layer_param_.window_data_param().cache_images_bytes();
+  if (cache_bytes > 0) {
+    LOG(INFO) << "Decoded image cache budget: " << cache_bytes << " bytes";
+    image_cache_.reset(new WindowImageCache(cache_bytes));
+  }
+
   // image
   const int crop_size = this->transform_param_.crop_size();
   CHECK_GT(crop_size, 0);
@@ -177,14 +231,14 @@ unsigned int WindowDataLayer<Dtype>::PrefetchRand() {
   return (*prefetch_rng)();
 }
 
-// Thread fetching the data
+// Called on the prefetch thread to fill one batch.
 template <typename Dtype>
-void WindowDataLayer<Dtype>::InternalThreadEntry() {
+void WindowDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
   // At each iteration, sample N windows where N*p are foreground (object)
   // windows and N*(1-p) are background (non-object) windows
 
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
   const Dtype scale = this->layer_param_.window_data_param().scale();
   const int batch_size = this->layer_param_.window_data_param().batch_size();
   const int context_pad = this->layer_param_.window_data_param().context_pad();
@@ -202,37 +256,71 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
   bool use_square = (crop_mode == "square") ? true : false;
 
   // zero out batch
-  caffe_set(this->prefetch_data_.count(), Dtype(0), top_data);
+  caffe_set(batch->data_.count(), Dtype(0), top_data);
 
   const int num_fg = static_cast<int>(static_cast<float>(batch_size)
       * fg_fraction);
   const int num_samples[2] = { batch_size - num_fg, num_fg };
 
+  // Sample every window for the batch up front, then group the crops by
+  // source image so each image is fetched (and, on a cache miss, decoded)
+  // at most once per batch.
+  vector<vector<float> > windows(batch_size);
+  vector<bool> mirrors(batch_size, false);
+  map<int, vector<int> > items_by_image;
   int item_id = 0;
   // sample from bg set then fg set
   for (int is_fg = 0; is_fg < 2; ++is_fg) {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
       // sample a window
       const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
+      windows[item_id] = (is_fg) ?
           fg_windows_[rand_index % fg_windows_.size()] :
           bg_windows_[rand_index % bg_windows_.size()];
-
-      bool do_mirror = false;
       if (mirror && PrefetchRand() % 2) {
-        do_mirror = true;
+        mirrors[item_id] = true;
       }
+      items_by_image[windows[item_id][WindowDataLayer<Dtype>::IMAGE_INDEX]]
+          .push_back(item_id);
+      ++item_id;
+    }
+  }
 
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
+  const bool collect_timing = this->collect_timing_;
+  CPUTimer timer;
 
-      cv::Mat cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-      if (!cv_img.data) {
-        LOG(ERROR) << "Could not open or find file " << image.first;
-        return;
-      }
-      const int channels = cv_img.channels();
+  for (map<int, vector<int> >::const_iterator image_it =
+      items_by_image.begin(); image_it != items_by_image.end(); ++image_it) {
+    // load the image containing the windows
+    pair<std::string, vector<int> > image = image_database_[image_it->first];
+    if (collect_timing) {
+      timer.Start();
+    }
+    cv::Mat cv_img;
+    if (image_cache_) {
+      cv_img = image_cache_->Get(image.first);
+    } else {
+      cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
+    }
+    if (collect_timing) {
+      // The read and the JPEG decode are one call (and cache hits cost
+      // nearly nothing), so the whole fetch is charged to decode.
+      timer.Stop();
+      this->decode_time_ms_ += timer.MicroSeconds() / 1000.;
+    }
+    if (!cv_img.data) {
+      LOG(ERROR) << "Could not open or find file " << image.first;
+      return;
+    }
+    const int channels = cv_img.channels();
+
+    if (collect_timing) {
+      timer.Start();
+    }
+    for (int i = 0; i < image_it->second.size(); ++i) {
+      item_id = image_it->second[i];
+      const vector<float>& window = windows[item_id];
+      const bool do_mirror = mirrors[item_id];
 
       // crop window out of image and warp it
       int x1 = window[WindowDataLayer<Dtype>::X1];
@@ -385,8 +473,10 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
       }
       top_data_file.close();
       #endif
-
-      item_id++;
+    }
+    if (collect_timing) {
+      timer.Stop();
+      this->transform_time_ms_ += timer.MicroSeconds() / 1000.;
     }
   }
 }
@@ -0,0 +1,283 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The F(2x2,3x3) transform matrices (Lavin & Gray) are small and fixed:
+//   B^T = [1  0 -1  0;  0 1 1 0;  0 -1 1 0;  0 1 0 -1]
+//   G   = [1 0 0;  1/2 1/2 1/2;  1/2 -1/2 1/2;  0 0 1]
+//   A^T = [1 1 1 0;  0 1 -1 -1]
+// so the products below are written out as additions instead of GEMMs.
+
+// u = G g G^T for one 3x3 filter g, row-major 4x4 output.
+template <typename Dtype>
+inline void WinogradFilter(const Dtype* g, Dtype* u) {
+  Dtype t[12];
+  for (int s = 0; s < 3; ++s) {
+    t[0 * 3 + s] = g[s];
+    t[1 * 3 + s] = (g[s] + g[3 + s] + g[6 + s]) * Dtype(0.5);
+    t[2 * 3 + s] = (g[s] - g[3 + s] + g[6 + s]) * Dtype(0.5);
+    t[3 * 3 + s] = g[6 + s];
+  }
+  for (int r = 0; r < 4; ++r) {
+    const Dtype a = t[3 * r], b = t[3 * r + 1], c = t[3 * r + 2];
+    u[4 * r + 0] = a;
+    u[4 * r + 1] = (a + b + c) * Dtype(0.5);
+    u[4 * r + 2] = (a - b + c) * Dtype(0.5);
+    u[4 * r + 3] = c;
+  }
+}
+
+// v = B^T d B for one 4x4 input tile d, row-major 4x4 output.
+template <typename Dtype>
+inline void WinogradInput(const Dtype* d, Dtype* v) {
+  Dtype t[16];
+  for (int s = 0; s < 4; ++s) {
+    t[0 * 4 + s] = d[0 * 4 + s] - d[2 * 4 + s];
+    t[1 * 4 + s] = d[1 * 4 + s] + d[2 * 4 + s];
+    t[2 * 4 + s] = d[2 * 4 + s] - d[1 * 4 + s];
+    t[3 * 4 + s] = d[1 * 4 + s] - d[3 * 4 + s];
+  }
+  for (int r = 0; r < 4; ++r) {
+    v[4 * r + 0] = t[4 * r + 0] - t[4 * r + 2];
+    v[4 * r + 1] = t[4 * r + 1] + t[4 * r + 2];
+    v[4 * r + 2] = t[4 * r + 2] - t[4 * r + 1];
+    v[4 * r + 3] = t[4 * r + 1] - t[4 * r + 3];
+  }
+}
+
+// y = A^T m A for one 4x4 product tile m, row-major 2x2 output.
+template <typename Dtype>
+inline void WinogradOutput(const Dtype* m, Dtype* y) {
+  Dtype t[8];
+  for (int s = 0; s < 4; ++s) {
+    t[0 * 4 + s] = m[0 * 4 + s] + m[1 * 4 + s] + m[2 * 4 + s];
+    t[1 * 4 + s] = m[1 * 4 + s] - m[2 * 4 + s] - m[3 * 4 + s];
+  }
+  y[0] = t[0] + t[1] + t[2];
+  y[1] = t[1] - t[2] - t[3];
+  y[2] = t[4] + t[5] + t[6];
+  y[3] = t[5] - t[6] - t[7];
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK_EQ(this->kernel_h_, 3) << "WINOGRAD engine requires 3x3 filters.";
+  CHECK_EQ(this->kernel_w_, 3) << "WINOGRAD engine requires 3x3 filters.";
+  CHECK_EQ(this->stride_h_, 1) << "WINOGRAD engine requires stride 1.";
+  CHECK_EQ(this->stride_w_, 1) << "WINOGRAD engine requires stride 1.";
+  CHECK(!this->quantize_)
+      << "WINOGRAD engine does not support quantized inference.";
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  tiles_h_ = (this->height_out_ + 1) / 2;
+  tiles_w_ = (this->width_out_ + 1) / 2;
+  num_tiles_ = tiles_h_ * tiles_w_;
+  const int input_channels = this->channels_ / this->group_;
+  weight_wino_.Reshape(this->group_, 16, this->M_, input_channels);
+  input_wino_.Reshape(1, 16, this->channels_, num_tiles_);
+  prod_wino_.Reshape(1, 16, this->num_output_, num_tiles_);
+  if (this->layer_param_.convolution_param().engine() ==
+      ConvolutionParameter_Engine_AUTOTUNE) {
+    AutotuneEngine(bottom, top);
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::AutotuneEngine(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // in GPU mode this layer forwards through the base class
+  }
+  std::ostringstream key_stream;
+  key_stream << "conv_cpu_n" << this->num_ << "_c" << this->channels_
+      << "_h" << this->height_ << "_w" << this->width_
+      << "_o" << this->num_output_
+      << "_k" << this->kernel_h_ << "x" << this->kernel_w_
+      << "_s" << this->stride_h_ << "x" << this->stride_w_
+      << "_p" << this->pad_h_ << "x" << this->pad_w_
+      << "_g" << this->group_ << "_e" << sizeof(Dtype);
+  const string key = key_stream.str();
+  if (key == tuned_key_) {
+    return;
+  }
+  const string& cache_file =
+      this->layer_param_.convolution_param().autotune_cache();
+  string cached_engine;
+  if (AutotuneLookup(cache_file, key, &cached_engine)) {
+    use_winograd_ = (cached_engine == "winograd");
+    tuned_key_ = key;
+    return;
+  }
+  // Time a few forward passes with each engine on the freshly reshaped
+  // blobs; the buffer contents do not matter for the timing.
+  const int kWarmupRuns = 1;
+  const int kTimedRuns = 3;
+  CPUTimer timer;
+  float engine_time[2];
+  for (int e = 0; e < 2; ++e) {
+    use_winograd_ = (e == 1);
+    for (int i = 0; i < kWarmupRuns + kTimedRuns; ++i) {
+      if (i == kWarmupRuns) {
+        timer.Start();
+      }
+      Forward_cpu(bottom, top);
+    }
+    timer.Stop();
+    engine_time[e] = timer.MilliSeconds();
+  }
+  use_winograd_ = engine_time[1] < engine_time[0];
+  tuned_key_ = key;
+  LOG(INFO) << "Autotuned " << key << ": caffe " << engine_time[0]
+      << " ms, winograd " << engine_time[1] << " ms; using "
+      << (use_winograd_ ? "winograd" : "caffe");
+  AutotuneStore(cache_file, key, use_winograd_ ? "winograd" : "caffe");
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::TransformWeights() {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* transformed = weight_wino_.mutable_cpu_data();
+  const int input_channels = this->channels_ / this->group_;
+  for (int m = 0; m < this->num_output_; ++m) {
+    const int g = m / this->M_;
+    const int m_in_group = m % this->M_;
+    for (int c = 0; c < input_channels; ++c) {
+      Dtype u[16];
+      WinogradFilter(weight + (m * input_channels + c) * 9, u);
+      for (int xi = 0; xi < 16; ++xi) {
+        transformed[((g * 16 + xi) * this->M_ + m_in_group) * input_channels
+            + c] = u[xi];
+      }
+    }
+  }
+  weight_transformed_ = true;
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  if (!weight_transformed_) {
+    TransformWeights();
+  }
+  const int input_channels = this->channels_ / this->group_;
+  const Dtype* transformed = weight_wino_.cpu_data();
+  Dtype* input_wino = input_wino_.mutable_cpu_data();
+  Dtype* prod_wino = prod_wino_.mutable_cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      // Move each 4x4 input tile (overlapping by two, padding with zero)
+      // into the Winograd domain, scattered so each of the 16 domain
+      // coordinates forms a contiguous channels x tiles matrix.
+      const Dtype* input = bottom_data + bottom[i]->offset(n);
+      for (int c = 0; c < this->channels_; ++c) {
+        const Dtype* input_c = input + c * this->height_ * this->width_;
+        for (int ty = 0; ty < tiles_h_; ++ty) {
+          for (int tx = 0; tx < tiles_w_; ++tx) {
+            Dtype d[16];
+            const int h0 = ty * 2 - this->pad_h_;
+            const int w0 = tx * 2 - this->pad_w_;
+            for (int r = 0; r < 4; ++r) {
+              for (int s = 0; s < 4; ++s) {
+                const int h = h0 + r;
+                const int w = w0 + s;
+                d[4 * r + s] =
+                    (h >= 0 && h < this->height_ && w >= 0 && w < this->width_)
+                    ? input_c[h * this->width_ + w] : Dtype(0);
+              }
+            }
+            Dtype v[16];
+            WinogradInput(d, v);
+            const int tile = ty * tiles_w_ + tx;
+            for (int xi = 0; xi < 16; ++xi) {
+              input_wino[(xi * this->channels_ + c) * num_tiles_ + tile] =
+                  v[xi];
+            }
+          }
+        }
+      }
+      // The per-tile elementwise products collapse into one GEMM per
+      // domain coordinate and group, across all tiles and channels.
+      for (int g = 0; g < this->group_; ++g) {
+        for (int xi = 0; xi < 16; ++xi) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
+              this->M_, num_tiles_, input_channels, (Dtype)1.,
+              transformed + ((g * 16 + xi) * this->M_) * input_channels,
+              input_wino + (xi * this->channels_ + g * input_channels)
+                  * num_tiles_,
+              (Dtype)0.,
+              prod_wino + (xi * this->num_output_ + g * this->M_)
+                  * num_tiles_);
+        }
+      }
+      // Transform each product tile back to a 2x2 output patch; the
+      // right/bottom edges of an odd-sized output discard the overhang.
+      Dtype* output = top_data + (*top)[i]->offset(n);
+      for (int m = 0; m < this->num_output_; ++m) {
+        Dtype* output_m = output + m * this->N_;
+        for (int ty = 0; ty < tiles_h_; ++ty) {
+          for (int tx = 0; tx < tiles_w_; ++tx) {
+            const int tile = ty * tiles_w_ + tx;
+            Dtype prod[16];
+            for (int xi = 0; xi < 16; ++xi) {
+              prod[xi] =
+                  prod_wino[(xi * this->num_output_ + m) * num_tiles_ + tile];
+            }
+            Dtype y[4];
+            WinogradOutput(prod, y);
+            const int h = ty * 2;
+            const int w = tx * 2;
+            output_m[h * this->width_out_ + w] = y[0];
+            if (w + 1 < this->width_out_) {
+              output_m[h * this->width_out_ + w + 1] = y[1];
+            }
+            if (h + 1 < this->height_out_) {
+              output_m[(h + 1) * this->width_out_ + w] = y[2];
+              if (w + 1 < this->width_out_) {
+                output_m[(h + 1) * this->width_out_ + w + 1] = y[3];
+              }
+            }
+          }
+        }
+      }
+      // Add bias.
+      if (this->bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+            this->N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            this->bias_multiplier_->cpu_data(), (Dtype)1., output);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+  // The weights are about to be updated; retransform on the next forward.
+  weight_transformed_ = false;
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
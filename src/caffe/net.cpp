@@ -1,4 +1,15 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
 #include <algorithm>
+#include <iomanip>
 #include <map>
 #include <set>
 #include <string>
@@ -9,15 +20,27 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/fuse_neuron_layers.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/insert_pipeline_transfers.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/tracing.hpp"
+#include "caffe/util/plugin.hpp"
+#include "caffe/util/strip_identity_layers.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
 namespace caffe {
 
+// Nets larger than this log a one-line summary during Init instead of
+// their full text rendering.
+const int kMaxPrintableNetLayers = 100;
+
 template <typename Dtype>
 Net<Dtype>::Net(const NetParameter& param) {
   Init(param);
@@ -30,24 +53,117 @@ Net<Dtype>::Net(const string& param_file) {
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::~Net() {
+#ifndef CPU_ONLY
+  if (async_events_created_) {
+    cudaEventDestroy(forward_start_);
+    cudaEventDestroy(forward_done_);
+  }
+  if (offload_resources_created_) {
+    cudaStreamDestroy(offload_stream_);
+    for (int i = 0; i < offload_events_.size(); ++i) {
+      if (offload_events_[i]) {
+        cudaEventDestroy(offload_events_[i]);
+      }
+    }
+  }
+  for (int i = 0; i < readback_events_.size(); ++i) {
+    cudaEventDestroy(readback_events_[i]);
+    for (int j = 0; j < readback_buffers_[i].size(); ++j) {
+      if (readback_buffers_[i][j]) {
+        cudaFreeHost(readback_buffers_[i][j]);
+      }
+    }
+  }
+#endif
+}
+
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
+  // Load any layer plugins before the layers are created, so their
+  // registered implementations are visible to the factory.
+  for (int i = 0; i < in_param.layer_plugin_size(); ++i) {
+    LoadLayerPlugin(in_param.layer_plugin(i));
+  }
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
-  LOG(INFO) << "Initializing net from parameters: " << std::endl
-            << filtered_param.DebugString();
+  // Strip layers that are identities at test time if requested, before
+  // fusion so the fusion pass sees the smaller graph.
+  if (filtered_param.strip_identity_layers()) {
+    NetParameter stripped_param;
+    StripIdentityLayers(filtered_param, &stripped_param);
+    filtered_param.Swap(&stripped_param);
+  }
+  // Collapse runs of consecutive elementwise neuron layers if requested.
+  if (filtered_param.fuse_neuron_layers()) {
+    NetParameter fused_param;
+    FuseNeuronLayers(filtered_param, &fused_param);
+    filtered_param.Swap(&fused_param);
+  }
+  if (filtered_param.layers_size() <= kMaxPrintableNetLayers) {
+    LOG(INFO) << "Initializing net from parameters: " << std::endl
+              << filtered_param.DebugString();
+  } else {
+    // Rendering a generated net of thousands of layers to text can take
+    // longer than building it; log a one-line summary instead.
+    LOG(INFO) << "Initializing net " << filtered_param.name() << " ("
+              << filtered_param.layers_size() << " layers)";
+  }
+  // Insert transfer layers at pipeline stage boundaries. This runs
+  // before the split insertion below so that a transferred copy read by
+  // several layers of its stage still gets a split (and with it correct
+  // diff accumulation in Backward).
+  if (filtered_param.pipeline_device_size() > 0) {
+    NetParameter piped_param;
+    InsertPipelineTransfers(filtered_param, &piped_param);
+    filtered_param.Swap(&piped_param);
+  }
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
+  // Keep the fully transformed structure so CreateReplica can build an
+  // identical net without redoing the rewrite passes (which are no-ops
+  // on their own output); weights are not part of it.
+  replica_param_ = param;
+  for (int i = 0; i < replica_param_.layers_size(); ++i) {
+    replica_param_.mutable_layers(i)->clear_blobs();
+  }
   // Basically, build all the layers and set up its connections.
   name_ = param.name();
-  map<string, int> blob_name_to_idx;
-  set<string> available_blobs;
+  // Size everything the construction loop grows in one pre-pass: with
+  // thousands of layers, incremental vector reallocation and tree-based
+  // name lookups otherwise dominate startup. The top count is a lower
+  // bound (anonymous auto tops are not in the proto), which only costs
+  // the rare extra rehash.
+  const int num_layers = param.layers_size();
+  int num_tops = param.input_size();
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    num_tops += param.layers(layer_id).top_size();
+  }
+  boost::unordered_map<string, int> blob_name_to_idx(num_tops);
+  boost::unordered_set<string> available_blobs(num_tops);
+  layers_.reserve(num_layers);
+  layer_names_.reserve(num_layers);
+  layer_need_backward_.reserve(num_layers);
+  blobs_.reserve(num_tops);
+  blob_names_.reserve(num_tops);
+  blob_need_backward_.reserve(num_tops);
+  blob_loss_weights_.reserve(num_tops);
   CHECK_EQ(param.input_size() * 4, param.input_dim_size())
       << "Incorrect input blob dimension specifications.";
   memory_used_ = 0;
+  recomputing_ = false;
+  gradient_reducer_ = NULL;
+  reducer_bucket_size_ = 0;
+#ifndef CPU_ONLY
+  async_events_created_ = false;
+  offload_stream_ = NULL;
+  offload_resources_created_ = false;
+  readback_next_ticket_ = 0;
+#endif
   // set the input blobs
   for (int input_id = 0; input_id < param.input_size(); ++input_id) {
     const int layer_id = -1;  // inputs have fake layer ID -1
@@ -128,7 +244,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       // catch: if a layer param does not specify blobs_lr, we should assume the
       // learning rate to be 1. Thus we will need to perform backward.
       need_backward = true;
-      for (int param_id = 0; param_id < blobs_lr_size; ++param_id) {
+      for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
         layers_[layer_id]->set_param_propagate_down(param_id, true);
       }
     }
@@ -154,7 +270,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // Go through the net backwards to determine which blobs contribute to the
   // loss.  We can skip backward computation for blobs that don't contribute
   // to the loss.
-  set<string> blobs_under_loss;
+  boost::unordered_set<string> blobs_under_loss(blob_names_.size());
   for (int layer_id = layers_.size() - 1; layer_id >= 0; --layer_id) {
     bool layer_contributes_loss = false;
     for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
@@ -202,24 +318,275 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       }
     }
   }
-  // In the end, all remaining blobs are considered output blobs.
-  for (set<string>::iterator it = available_blobs.begin();
-      it != available_blobs.end(); ++it) {
-    LOG(INFO) << "This network produces output " << *it;
-    net_output_blobs_.push_back(blobs_[blob_name_to_idx[*it]].get());
-    net_output_blob_indices_.push_back(blob_name_to_idx[*it]);
+  // Finetuning with zero learning rates on the early layers freezes a
+  // prefix of the net: every layer below the deepest one that still
+  // needs gradients has nothing to compute. Record that truncation
+  // point so Backward can stop there instead of walking (and skipping)
+  // the frozen layers one by one.
+  first_backward_layer_ = layers_.size();
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layer_need_backward_[layer_id]) {
+      first_backward_layer_ = layer_id;
+      break;
+    }
+  }
+  if (first_backward_layer_ > 0 && first_backward_layer_ < layers_.size()) {
+    LOG(INFO) << "Backward truncated at " << layer_names_[first_backward_layer_]
+        << "; the " << first_backward_layer_
+        << " layer(s) below it need no gradient computation.";
+  }
+  // In the end, all remaining blobs are considered output blobs. Sort
+  // the names so the output order stays what it was when available_blobs
+  // was an ordered set.
+  vector<string> output_names(available_blobs.begin(),
+                              available_blobs.end());
+  std::sort(output_names.begin(), output_names.end());
+  for (int i = 0; i < output_names.size(); ++i) {
+    const int blob_id = blob_name_to_idx[output_names[i]];
+    LOG(INFO) << "This network produces output " << output_names[i];
+    net_output_blobs_.push_back(blobs_[blob_id].get());
+    net_output_blob_indices_.push_back(blob_id);
   }
+  blob_names_index_.rehash(blob_names_.size());
   for (size_t blob_id = 0; blob_id < blob_names_.size(); ++blob_id) {
     blob_names_index_[blob_names_[blob_id]] = blob_id;
   }
+  layer_names_index_.rehash(layer_names_.size());
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  // Register blob names with their buffers, so the transfer
+  // instrumentation (SyncedMemory counters, hot-region warnings) can say
+  // which blob a stray synchronization belongs to.
+  for (size_t blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count()) {
+      blobs_[blob_id]->data()->set_debug_name(blob_names_[blob_id] + " data");
+      blobs_[blob_id]->diff()->set_debug_name(blob_names_[blob_id] + " diff");
+    }
+  }
   GetLearningRateAndWeightDecay();
+  MakeParamsContiguous();
+  if (net_input_blobs_.size()) {
+    // The shape the net was set up with is warm from the start.
+    warmed_shapes_.insert(InputShapeKey());
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
-  // Don't display debug info by default.
+  if (layers_.size() <= kMaxPrintableNetLayers) {
+    LOG(INFO) << memory_report();
+  }
+  // Don't display debug info by default, and read every element when
+  // it is on.
   debug_info_ = false;
+  debug_info_sample_stride_ = 1;
+  activation_cache_boundary_ = -1;
+  activation_cache_blob_ = -1;
+  activation_cache_key_ = 0;
+  timing_ = false;
+  ResetTiming();
+  dag_forward_ = param.dag_forward();
+  dag_forward_threads_ = param.dag_forward_threads();
+  if (dag_forward_) {
+    BuildForwardDag();
+  }
+  // Share one scratch arena between layers that want workspace (e.g. the
+  // im2col buffers): under sequential execution only one is live at a
+  // time. DAG-scheduled forward runs layers concurrently, so there each
+  // layer keeps its own buffer.
+  if (!dag_forward_) {
+    size_t max_workspace = 0;
+    size_t total_workspace = 0;
+    for (int i = 0; i < layers_.size(); ++i) {
+      const size_t workspace = layers_[i]->WorkspaceSize();
+      max_workspace = std::max(max_workspace, workspace);
+      total_workspace += workspace;
+    }
+    if (max_workspace > 0) {
+      shared_ptr<SyncedMemory> data(new SyncedMemory(max_workspace));
+      shared_ptr<SyncedMemory> diff(new SyncedMemory(max_workspace));
+      for (int i = 0; i < layers_.size(); ++i) {
+        if (layers_[i]->WorkspaceSize() > 0) {
+          layers_[i]->SetWorkspace(data, diff);
+        }
+      }
+      LOG(INFO) << "Shared layer workspace: " << max_workspace
+          << " bytes (layers requested " << total_workspace
+          << " bytes in total)";
+    }
+  }
+  if (param.optimize_memory()) {
+    CHECK(!param.force_backward())
+        << "optimize_memory is only valid for forward-only nets";
+    PlanMemory();
+  }
+  half_activations_ = param.half_activations();
+  if (half_activations_) {
+    CHECK(!param.force_backward())
+        << "half_activations is only valid for forward-only nets";
+    CHECK(!param.optimize_memory())
+        << "half_activations cannot be combined with optimize_memory: "
+        << "compression would release the shared arenas";
+    blob_half_eligible_.resize(blobs_.size(), true);
+    for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+      blob_half_eligible_[net_input_blob_indices_[i]] = false;
+    }
+    for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+      blob_half_eligible_[net_output_blob_indices_[i]] = false;
+    }
+    LOG(INFO) << "Storing intermediate activations in half precision";
+  }
+  offload_activations_ = param.offload_activations();
+  if (offload_activations_) {
+    CHECK(!param.optimize_memory())
+        << "offload_activations cannot be combined with optimize_memory: "
+        << "offloading would drop pieces of the shared arenas";
+#ifndef CPU_ONLY
+    BuildOffloadPlan();
+#else
+    LOG(WARNING) << "offload_activations has no effect in CPU-only builds.";
+#endif
+  }
+  checkpoint_interval_ = param.checkpoint_interval();
+  if (checkpoint_interval_ > 1) {
+    CHECK(!param.optimize_memory())
+        << "checkpoint_interval cannot be combined with optimize_memory: "
+        << "freeing a blob would release pieces of the shared arenas";
+    CHECK(!offload_activations_)
+        << "checkpoint_interval cannot be combined with offload_activations: "
+        << "the schedulers would free each other's buffers";
+    BuildCheckpointPlan();
+  }
+  pipeline_device_.assign(param.pipeline_device().begin(),
+                          param.pipeline_device().end());
+  if (!pipeline_device_.empty()) {
+    CHECK(!dag_forward_)
+        << "pipeline_device cannot be combined with dag_forward: "
+        << "the two schedulers would both thread the net";
+    CHECK(!param.optimize_memory())
+        << "pipeline_device cannot be combined with optimize_memory: "
+        << "the shared arenas assume sequential execution";
+    CHECK(!half_activations_)
+        << "pipeline_device cannot be combined with half_activations: "
+        << "a stage could compress a blob its neighbour is reading";
+    CHECK(!offload_activations_)
+        << "pipeline_device cannot be combined with offload_activations";
+    CHECK_LE(checkpoint_interval_, 1)
+        << "pipeline_device cannot be combined with checkpoint_interval";
+    BuildPipelinePlan();
+  }
+  // Resolve the early-exit branches to their producing layers once, so
+  // ForwardEarlyExit only walks layer segments.
+  early_exit_threshold_ = param.early_exit_threshold();
+  early_exit_layers_.clear();
+  early_exit_blobs_.clear();
+  for (int i = 0; i < param.early_exit_blob_size(); ++i) {
+    const string& blob_name = param.early_exit_blob(i);
+    CHECK(has_blob(blob_name)) << "Unknown early_exit_blob " << blob_name;
+    const int blob_id = blob_names_index_[blob_name];
+    int producer = -1;
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+        if (top_id_vecs_[layer_id][top_id] == blob_id) {
+          producer = layer_id;
+        }
+      }
+    }
+    CHECK_GE(producer, 0)
+        << "No layer produces early_exit_blob " << blob_name;
+    if (!early_exit_layers_.empty()) {
+      CHECK_GT(producer, early_exit_layers_.back())
+          << "early_exit_blob entries must be listed shallowest first";
+    }
+    early_exit_layers_.push_back(producer);
+    early_exit_blobs_.push_back(blob_id);
+  }
+  if (!early_exit_layers_.empty()) {
+    LOG(INFO) << "Early-exit inference with " << early_exit_layers_.size()
+        << " classifier branches, threshold " << early_exit_threshold_;
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  // A blob is live from the layer producing it until the last layer reading
+  // it; blobs whose live ranges do not overlap can occupy the same memory.
+  // Find the last reader of each blob. In-place layers reuse the bottom blob
+  // id as their top id, so chains of in-place layers extend the live range
+  // of the one underlying blob.
+  vector<int> last_use(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      last_use[bottom_id_vecs_[layer_id][i]] = layer_id;
+    }
+  }
+  // Net inputs are filled by the caller and net outputs are read after
+  // Forward returns, so both keep their own storage.
+  vector<bool> shareable(blobs_.size(), true);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    shareable[net_input_blob_indices_[i]] = false;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    shareable[net_output_blob_indices_[i]] = false;
+  }
+  // Walk the layers in forward order, greedily assigning each newly produced
+  // blob to a free arena slot (or opening a new slot), and releasing a
+  // blob's slot after its last reader. Bottoms are released only after the
+  // layer's tops are placed, so a top can never alias a bottom the layer is
+  // still reading.
+  vector<int> assigned_slot(blobs_.size(), -1);
+  vector<size_t> slot_bytes;
+  vector<bool> slot_free;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      if (!shareable[blob_id] || assigned_slot[blob_id] >= 0) {
+        continue;
+      }
+      const size_t bytes = blobs_[blob_id]->count() * sizeof(Dtype);
+      int slot = -1;
+      for (int s = 0; s < slot_bytes.size(); ++s) {
+        if (slot_free[s]) {
+          slot = s;
+          break;
+        }
+      }
+      if (slot < 0) {
+        slot = slot_bytes.size();
+        slot_bytes.push_back(0);
+        slot_free.push_back(false);
+      }
+      slot_free[slot] = false;
+      slot_bytes[slot] = std::max(slot_bytes[slot], bytes);
+      assigned_slot[blob_id] = slot;
+    }
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = bottom_id_vecs_[layer_id][i];
+      if (assigned_slot[blob_id] >= 0 && last_use[blob_id] == layer_id) {
+        slot_free[assigned_slot[blob_id]] = true;
+      }
+    }
+  }
+  // Build the arenas and point the planned blobs into them.
+  vector<shared_ptr<SyncedMemory> > arenas(slot_bytes.size());
+  for (int s = 0; s < slot_bytes.size(); ++s) {
+    arenas[s].reset(new SyncedMemory(slot_bytes[s]));
+  }
+  size_t naive_bytes = 0;
+  size_t planned_bytes = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    naive_bytes += blobs_[blob_id]->count() * sizeof(Dtype);
+    if (assigned_slot[blob_id] >= 0) {
+      blobs_[blob_id]->ShareData(arenas[assigned_slot[blob_id]]);
+    } else {
+      planned_bytes += blobs_[blob_id]->count() * sizeof(Dtype);
+    }
+  }
+  for (int s = 0; s < slot_bytes.size(); ++s) {
+    planned_bytes += slot_bytes[s];
+  }
+  LOG(INFO) << "Memory plan: " << slot_bytes.size() << " arenas, activations "
+      << planned_bytes << " bytes planned vs " << naive_bytes
+      << " bytes naive";
 }
 
 template <typename Dtype>
@@ -331,10 +698,10 @@ bool Net<Dtype>::StateMeetsRule(const NetState& state,
 // layer_id == -1, tops have layer_id >= 0.)
 template <typename Dtype>
 void Net<Dtype>::AppendTop(const NetParameter& param, const int layer_id,
-                           const int top_id, set<string>* available_blobs,
-                           map<string, int>* blob_name_to_idx) {
-  shared_ptr<LayerParameter> layer_param((layer_id >= 0) ?
-    (new LayerParameter(param.layers(layer_id))) : NULL);
+    const int top_id, boost::unordered_set<string>* available_blobs,
+    boost::unordered_map<string, int>* blob_name_to_idx) {
+  const LayerParameter* layer_param =
+      (layer_id >= 0) ? &param.layers(layer_id) : NULL;
   const string& blob_name = layer_param ?
       (layer_param->top_size() > top_id ?
           layer_param->top(top_id) : "(automatic)") : param.input(top_id);
@@ -343,8 +710,9 @@ void Net<Dtype>::AppendTop(const NetParameter& param, const int layer_id,
       blob_name == layer_param->bottom(top_id)) {
     // In-place computation
     LOG(INFO) << layer_param->name() << " -> " << blob_name << " (in-place)";
-    top_vecs_[layer_id].push_back(blobs_[(*blob_name_to_idx)[blob_name]].get());
-    top_id_vecs_[layer_id].push_back((*blob_name_to_idx)[blob_name]);
+    const int blob_id = (*blob_name_to_idx)[blob_name];
+    top_vecs_[layer_id].push_back(blobs_[blob_id].get());
+    top_id_vecs_[layer_id].push_back(blob_id);
   } else if (blob_name_to_idx &&
              blob_name_to_idx->find(blob_name) != blob_name_to_idx->end()) {
     // If we are not doing in-place computation but have duplicated blobs,
@@ -383,7 +751,8 @@ void Net<Dtype>::AppendTop(const NetParameter& param, const int layer_id,
 template <typename Dtype>
 int Net<Dtype>::AppendBottom(const NetParameter& param,
     const int layer_id, const int bottom_id,
-    set<string>* available_blobs, map<string, int>* blob_name_to_idx) {
+    boost::unordered_set<string>* available_blobs,
+    boost::unordered_map<string, int>* blob_name_to_idx) {
   const LayerParameter& layer_param = param.layers(layer_id);
   const string& blob_name = layer_param.bottom(bottom_id);
   if (available_blobs->find(blob_name) == available_blobs->end()) {
@@ -495,180 +864,1477 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
       }
     }
   }
+  // Precompute the params the update loops must visit: those with a
+  // non-zero learning rate, plus frozen owners whose diff accumulates a
+  // learnable sharer's gradient (visiting the owner keeps its own raw
+  // gradient from leaking into the shared update). Frozen blobs then
+  // cost nothing per iteration.
+  learnable_param_ids_.clear();
+  for (int i = 0; i < params_lr_.size(); ++i) {
+    bool learnable = params_lr_[i] != 0;
+    for (int j = 0; !learnable && j < param_owners_.size(); ++j) {
+      learnable = param_owners_[j] == i && params_lr_[j] != 0;
+    }
+    if (learnable) {
+      learnable_param_ids_.push_back(i);
+    }
+  }
 }
 
 template <typename Dtype>
-Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
-  CHECK_GE(start, 0);
-  CHECK_LT(end, layers_.size());
-  Dtype loss = 0;
-  for (int i = start; i <= end; ++i) {
-    // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
-    loss += layer_loss;
-    if (debug_info_) { ForwardDebugInfo(i); }
+void Net<Dtype>::MakeParamsContiguous() {
+  params_total_count_ = 0;
+  params_data_arena_.reset();
+  params_diff_arena_.reset();
+  for (int i = 0; i < param_owners_.size(); ++i) {
+    if (param_owners_[i] >= 0) {
+      LOG(INFO) << "Parameters are shared; leaving them non-contiguous.";
+      return;
+    }
   }
-  return loss;
+  size_t total = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    total += params_[i]->count();
+  }
+  if (total == 0) {
+    return;
+  }
+  params_data_arena_.reset(new SyncedMemory(total * sizeof(Dtype)));
+  params_diff_arena_.reset(new SyncedMemory(total * sizeof(Dtype)));
+  size_t offset = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    const int count = params_[i]->count();
+    shared_ptr<SyncedMemory> data_view(new SyncedMemory(params_data_arena_,
+        offset * sizeof(Dtype), count * sizeof(Dtype)));
+    // Preserve the freshly filled weights before rebasing the blob.
+    caffe_copy(count, params_[i]->cpu_data(),
+        static_cast<Dtype*>(data_view->mutable_cpu_data()));
+    params_[i]->ShareData(data_view);
+    shared_ptr<SyncedMemory> diff_view(new SyncedMemory(params_diff_arena_,
+        offset * sizeof(Dtype), count * sizeof(Dtype)));
+    params_[i]->ShareDiff(diff_view);
+    offset += count;
+  }
+  params_total_count_ = total;
+  LOG(INFO) << "Made " << params_.size() << " parameter blobs contiguous ("
+      << total << " values)";
 }
 
 template <typename Dtype>
-Dtype Net<Dtype>::ForwardFrom(int start) {
-  return ForwardFromTo(start, layers_.size() - 1);
+void Net<Dtype>::BuildForwardDag() {
+  const int num_layers = layers_.size();
+  layer_num_dependencies_.assign(num_layers, 0);
+  layer_dependents_.assign(num_layers, vector<int>());
+  // Track, per blob, the last layer that wrote it and the layers that have
+  // read it since: a reader depends on the last writer, and an in-place
+  // writer depends on every earlier reader so it cannot overwrite a blob
+  // another layer is still consuming.
+  vector<int> last_writer(blobs_.size(), -1);
+  vector<vector<int> > readers_since_write(blobs_.size());
+  set<pair<int, int> > edges;
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = bottom_id_vecs_[layer_id][i];
+      if (last_writer[blob_id] >= 0) {
+        edges.insert(make_pair(last_writer[blob_id], layer_id));
+      }
+      readers_since_write[blob_id].push_back(layer_id);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      for (int r = 0; r < readers_since_write[blob_id].size(); ++r) {
+        if (readers_since_write[blob_id][r] != layer_id) {
+          edges.insert(make_pair(readers_since_write[blob_id][r], layer_id));
+        }
+      }
+      readers_since_write[blob_id].clear();
+      last_writer[blob_id] = layer_id;
+    }
+  }
+  for (set<pair<int, int> >::iterator it = edges.begin(); it != edges.end();
+       ++it) {
+    layer_dependents_[it->first].push_back(it->second);
+    ++layer_num_dependencies_[it->second];
+  }
 }
 
+// Shared state of one DAG-scheduled forward pass. Workers pull ready layer
+// ids off a stack; finishing a layer decrements its dependents' counts and
+// pushes the ones that became ready.
 template <typename Dtype>
-Dtype Net<Dtype>::ForwardTo(int end) {
-  return ForwardFromTo(0, end);
-}
+class DagForwardRun {
+ public:
+  DagForwardRun(const vector<shared_ptr<Layer<Dtype> > >* layers,
+      vector<vector<Blob<Dtype>*> >* bottom_vecs,
+      vector<vector<Blob<Dtype>*> >* top_vecs,
+      const vector<vector<int> >* dependents,
+      const vector<int>& num_dependencies)
+      : layers_(layers), bottom_vecs_(bottom_vecs), top_vecs_(top_vecs),
+        dependents_(dependents), pending_(num_dependencies),
+        remaining_(layers->size()), loss_(0) {
+    for (int i = 0; i < pending_.size(); ++i) {
+      if (pending_[i] == 0) {
+        ready_.push_back(i);
+      }
+    }
+  }
 
-template <typename Dtype>
-const vector<Blob<Dtype>*>& Net<Dtype>::ForwardPrefilled(Dtype* loss) {
-  if (loss != NULL) {
-    *loss = ForwardFromTo(0, layers_.size() - 1);
-  } else {
-    ForwardFromTo(0, layers_.size() - 1);
+  void Work() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+      while (ready_.empty() && remaining_ > 0) {
+        cond_.wait(lock);
+      }
+      if (ready_.empty()) {
+        break;
+      }
+      const int layer_id = ready_.back();
+      ready_.pop_back();
+      lock.unlock();
+      (*layers_)[layer_id]->Reshape((*bottom_vecs_)[layer_id],
+          &(*top_vecs_)[layer_id]);
+      const Dtype layer_loss = (*layers_)[layer_id]->Forward(
+          (*bottom_vecs_)[layer_id], &(*top_vecs_)[layer_id]);
+      lock.lock();
+      loss_ += layer_loss;
+      --remaining_;
+      const vector<int>& dependents = (*dependents_)[layer_id];
+      for (int i = 0; i < dependents.size(); ++i) {
+        if (--pending_[dependents[i]] == 0) {
+          ready_.push_back(dependents[i]);
+        }
+      }
+      cond_.notify_all();
+    }
+    cond_.notify_all();
   }
-  return net_output_blobs_;
-}
+
+  Dtype loss() const { return loss_; }
+
+ private:
+  const vector<shared_ptr<Layer<Dtype> > >* layers_;
+  vector<vector<Blob<Dtype>*> >* bottom_vecs_;
+  vector<vector<Blob<Dtype>*> >* top_vecs_;
+  const vector<vector<int> >* dependents_;
+  vector<int> pending_;
+  vector<int> ready_;
+  int remaining_;
+  Dtype loss_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+};
 
 template <typename Dtype>
-const vector<Blob<Dtype>*>& Net<Dtype>::Forward(
-    const vector<Blob<Dtype>*> & bottom, Dtype* loss) {
-  // Copy bottom to internal bottom
-  for (int i = 0; i < bottom.size(); ++i) {
-    net_input_blobs_[i]->CopyFrom(*bottom[i]);
+Dtype Net<Dtype>::ForwardDag() {
+  DagForwardRun<Dtype> run(&layers_, &bottom_vecs_, &top_vecs_,
+      &layer_dependents_, layer_num_dependencies_);
+  int num_threads = dag_forward_threads_ > 0 ? dag_forward_threads_ :
+      boost::thread::hardware_concurrency();
+  num_threads = std::min(num_threads, static_cast<int>(layers_.size()));
+  // The calling thread works too, so start one thread fewer.
+  vector<shared_ptr<boost::thread> > threads;
+  for (int i = 0; i < num_threads - 1; ++i) {
+    threads.push_back(shared_ptr<boost::thread>(
+        new boost::thread(&DagForwardRun<Dtype>::Work, &run)));
   }
-  return ForwardPrefilled(loss);
+  run.Work();
+  for (int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+  return run.loss();
 }
 
 template <typename Dtype>
-string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
-  BlobProtoVector blob_proto_vec;
-  if (net_input_blobs_.size()) {
-    blob_proto_vec.ParseFromString(input_blob_protos);
-    CHECK_EQ(blob_proto_vec.blobs_size(), net_input_blobs_.size())
-        << "Incorrect input size.";
-    for (int i = 0; i < blob_proto_vec.blobs_size(); ++i) {
-      net_input_blobs_[i]->FromProto(blob_proto_vec.blobs(i));
+void Net<Dtype>::BuildPipelinePlan() {
+  pipeline_stage_first_.clear();
+  pipeline_stage_last_.clear();
+  pipeline_stage_transfers_.clear();
+  int prev_stage = -1;
+  for (int i = 0; i < layers_.size(); ++i) {
+    const int stage = layers_[i]->layer_param().pipeline_stage();
+    if (stage != prev_stage) {
+      CHECK_EQ(stage, prev_stage + 1)
+          << "Pipeline stages must be contiguous: stage " << prev_stage + 1
+          << " has no layers";
+      prev_stage = stage;
+      pipeline_stage_first_.push_back(i);
+      pipeline_stage_last_.push_back(i);
+      pipeline_stage_transfers_.push_back(0);
+    }
+    pipeline_stage_last_.back() = i;
+    // The insertion pass puts a stage's transfers in one block at its
+    // front; count them so ForwardPipelined can release the upstream
+    // stage right after they have run.
+    if (layers_[i]->type() == LayerParameter_LayerType_PIPELINE_TRANSFER &&
+        i - pipeline_stage_first_.back() ==
+            pipeline_stage_transfers_.back()) {
+      ++pipeline_stage_transfers_.back();
     }
   }
-  ForwardPrefilled(loss);
-  blob_proto_vec.Clear();
-  for (int i = 0; i < net_output_blobs_.size(); ++i) {
-    net_output_blobs_[i]->ToProto(blob_proto_vec.add_blobs());
+  CHECK_LE(pipeline_stage_first_.size(), pipeline_device_.size())
+      << "pipeline_device lists fewer devices than the net has stages";
+  for (int s = 0; s < pipeline_stage_first_.size(); ++s) {
+    LOG(INFO) << "Pipeline stage " << s << " on device "
+        << pipeline_device_[s] << ": layers " << pipeline_stage_first_[s]
+        << " to " << pipeline_stage_last_[s] << " ("
+        << pipeline_stage_transfers_[s] << " transfers)";
   }
-  string output;
-  blob_proto_vec.SerializeToString(&output);
-  return output;
 }
 
-template <typename Dtype>
-void Net<Dtype>::BackwardFromTo(int start, int end) {
-  CHECK_GE(end, 0);
-  CHECK_LT(start, layers_.size());
-  for (int i = start; i >= end; --i) {
-    if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], &bottom_vecs_[i]);
-      if (debug_info_) { BackwardDebugInfo(i); }
+// One hand-off slot between two adjacent pipeline stages: a counting
+// semaphore for the host-side ordering, plus one event per direction
+// that extends it to the devices' streams. The forward event is
+// recorded by the upstream stage and the backward event by the
+// downstream one, so each is created on its recording device.
+struct PipelineChannel {
+  PipelineChannel() : count_(0) {}
+  void Signal() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ++count_;
+    cond_.notify_one();
+  }
+  void Wait() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (count_ == 0) {
+      cond_.wait(lock);
     }
+    --count_;
   }
-}
+  int count_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+#ifndef CPU_ONLY
+  cudaEvent_t fwd_event_;
+  cudaEvent_t bwd_event_;
+#endif
+};
 
+// Shared state of one pipelined pass over the stages. Stage s runs in
+// worker thread s (stage 0 in the caller's); per micro-batch it takes a
+// credit from its downstream channel (so at most one micro-batch is in
+// flight per boundary blob), waits for the upstream hand-off, runs its
+// transfer block, releases the upstream stage, runs the rest of its
+// layers and hands over downstream. The channel events repeat the same
+// ordering on the devices' legacy default streams, so kernels of
+// different micro-batches overlap across devices while the host threads
+// only pace the launches.
 template <typename Dtype>
-void Net<Dtype>::ForwardDebugInfo(const int layer_id) {
-  for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
-    const Blob<Dtype>& blob = *top_vecs_[layer_id][top_id];
-    const string& blob_name = blob_names_[top_id_vecs_[layer_id][top_id]];
-    const Dtype data_abs_val_mean = blob.asum_data() / blob.count();
-    LOG(INFO) << "    [Forward] "
-       << "Layer " << layer_names_[layer_id] << ", top blob " << blob_name
-       << " data: " << data_abs_val_mean;
+class PipelineRun {
+ public:
+  PipelineRun(Net<Dtype>* net, const vector<int>& device,
+      const vector<int>& first, const vector<int>& last,
+      const vector<int>& transfers, const int micro_batches)
+      : net_(net), device_(device), first_(first), last_(last),
+        transfers_(transfers), micro_batches_(micro_batches),
+        mode_(Caffe::mode()), phase_(Caffe::phase()),
+        loss_(first.size(), 0) {
+    for (int b = 0; b + 1 < first_.size(); ++b) {
+      data_.push_back(shared_ptr<PipelineChannel>(new PipelineChannel()));
+      credit_.push_back(shared_ptr<PipelineChannel>(new PipelineChannel()));
+      // The downstream stage has consumed nothing yet; let the first
+      // micro-batch through each boundary.
+      credit_[b]->Signal();
+    }
+#ifndef CPU_ONLY
+    if (mode_ == Caffe::GPU) {
+      int saved_device;
+      CUDA_CHECK(cudaGetDevice(&saved_device));
+      for (int b = 0; b < data_.size(); ++b) {
+        CUDA_CHECK(cudaSetDevice(device_[b]));
+        CUDA_CHECK(cudaEventCreateWithFlags(&data_[b]->fwd_event_,
+            cudaEventDisableTiming));
+        CUDA_CHECK(cudaEventCreateWithFlags(&credit_[b]->bwd_event_,
+            cudaEventDisableTiming));
+        CUDA_CHECK(cudaSetDevice(device_[b + 1]));
+        CUDA_CHECK(cudaEventCreateWithFlags(&data_[b]->bwd_event_,
+            cudaEventDisableTiming));
+        CUDA_CHECK(cudaEventCreateWithFlags(&credit_[b]->fwd_event_,
+            cudaEventDisableTiming));
+      }
+      CUDA_CHECK(cudaSetDevice(saved_device));
+    }
+#endif
   }
-}
 
-template <typename Dtype>
-void Net<Dtype>::BackwardDebugInfo(const int layer_id) {
-  const vector<Blob<Dtype>*>& bottom_vec = bottom_vecs_[layer_id];
-  for (int bottom_id = 0; bottom_id < bottom_vec.size(); ++bottom_id) {
-    if (!bottom_need_backward_[layer_id][bottom_id]) { continue; }
-    const Blob<Dtype>& blob = *bottom_vec[bottom_id];
-    const string& blob_name = blob_names_[bottom_id_vecs_[layer_id][bottom_id]];
-    const Dtype diff_abs_val_mean = blob.asum_diff() / blob.count();
-    LOG(INFO) << "    [Backward] "
-        << "Layer " << layer_names_[layer_id] << ", bottom blob " << blob_name
-        << " diff: " << diff_abs_val_mean;
-  }
-  for (int param_id = 0; param_id < layers_[layer_id]->blobs().size();
-       ++param_id) {
-    if (!layers_[layer_id]->param_propagate_down(param_id)) { continue; }
-    const Blob<Dtype>& blob = *layers_[layer_id]->blobs()[param_id];
-    const Dtype diff_abs_val_mean = blob.asum_diff() / blob.count();
-    LOG(INFO) << "    [Backward] "
-        << "Layer " << layer_names_[layer_id] << ", param blob " << param_id
-        << " diff: " << diff_abs_val_mean;
+  ~PipelineRun() {
+#ifndef CPU_ONLY
+    if (mode_ == Caffe::GPU) {
+      for (int b = 0; b < data_.size(); ++b) {
+        cudaEventDestroy(data_[b]->fwd_event_);
+        cudaEventDestroy(data_[b]->bwd_event_);
+        cudaEventDestroy(credit_[b]->fwd_event_);
+        cudaEventDestroy(credit_[b]->bwd_event_);
+      }
+    }
+#endif
   }
-}
 
-template <typename Dtype>
-void Net<Dtype>::UpdateDebugInfo(const int param_id) {
-  const Blob<Dtype>& blob = *params_[param_id];
-  const int param_owner = param_owners_[param_id];
-  const string& layer_name = layer_names_[param_layer_indices_[param_id].first];
-  const string& param_display_name = param_display_names_[param_id];
-  const Dtype diff_abs_val_mean = blob.asum_diff() / blob.count();
-  if (param_owner < 0) {
-    const Dtype data_abs_val_mean = blob.asum_data() / blob.count();
-    LOG(INFO) << "    [Update] Layer " << layer_name
-        << ", param " << param_display_name
-        << " data: " << data_abs_val_mean << "; diff: " << diff_abs_val_mean;
-  } else {
-    const string& owner_layer_name =
-        layer_names_[param_layer_indices_[param_owner].first];
-    LOG(INFO) << "    [Update] Layer " << layer_name
-        << ", param blob " << param_display_name
-        << " (owned by layer " << owner_layer_name << ", "
-        << "param " << param_display_names_[param_owners_[param_id]] << ")"
-        << " diff: " << diff_abs_val_mean;
+  void WorkForward(const int stage) {
+    BindThread(stage);
+    const int num_stages = first_.size();
+    for (int m = 0; m < micro_batches_; ++m) {
+      // A boundary blob may be rewritten anywhere in this stage's range,
+      // so take the credit before running any of it.
+      if (stage + 1 < num_stages) {
+        credit_[stage]->Wait();
+        StreamWait(credit_[stage].get(), true);
+      }
+      int start = first_[stage];
+      if (stage > 0) {
+        data_[stage - 1]->Wait();
+        StreamWait(data_[stage - 1].get(), true);
+        // Run the transfer block, then release the upstream stage: its
+        // next micro-batch is ordered behind the copies by the event.
+        if (transfers_[stage] > 0) {
+          loss_[stage] += net_->ForwardFromTo(start,
+              start + transfers_[stage] - 1);
+          start += transfers_[stage];
+        }
+        Record(credit_[stage - 1].get(), true);
+        credit_[stage - 1]->Signal();
+      }
+      if (start <= last_[stage]) {
+        loss_[stage] += net_->ForwardFromTo(start, last_[stage]);
+      }
+      if (stage + 1 < num_stages) {
+        Record(data_[stage].get(), true);
+        data_[stage]->Signal();
+      }
+    }
+    Drain();
   }
-}
 
-template <typename Dtype>
-void Net<Dtype>::ShareTrainedLayersWith(Net* other) {
-  int num_source_layers = other->layers().size();
-  for (int i = 0; i < num_source_layers; ++i) {
-    Layer<Dtype>* source_layer = other->layers()[i].get();
-    const string& source_layer_name = other->layer_names()[i];
-    int target_layer_id = 0;
-    while (target_layer_id != layer_names_.size() &&
-        layer_names_[target_layer_id] != source_layer_name) {
-      ++target_layer_id;
+  void WorkBackward(const int stage) {
+    BindThread(stage);
+    const int num_stages = first_.size();
+    if (stage + 1 < num_stages) {
+      data_[stage]->Wait();
+      StreamWait(data_[stage].get(), false);
     }
-    if (target_layer_id == layer_names_.size()) {
-      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
-      continue;
+    net_->BackwardFromTo(last_[stage], first_[stage]);
+    if (stage > 0) {
+      Record(data_[stage - 1].get(), false);
+      data_[stage - 1]->Signal();
     }
-    DLOG(INFO) << "Copying source layer " << source_layer_name;
-    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
-        layers_[target_layer_id]->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer->blobs().size())
-        << "Incompatible number of blobs for layer " << source_layer_name;
-    for (int j = 0; j < target_blobs.size(); ++j) {
-      Blob<Dtype>* source_blob = source_layer->blobs()[j].get();
-      CHECK_EQ(target_blobs[j]->num(), source_blob->num());
-      CHECK_EQ(target_blobs[j]->channels(), source_blob->channels());
-      CHECK_EQ(target_blobs[j]->height(), source_blob->height());
-      CHECK_EQ(target_blobs[j]->width(), source_blob->width());
-      target_blobs[j]->ShareData(*source_blob);
+    Drain();
+  }
+
+  Dtype loss() const {
+    Dtype total = 0;
+    for (int s = 0; s < loss_.size(); ++s) {
+      total += loss_[s];
     }
+    return total;
   }
-}
 
-template <typename Dtype>
-void Net<Dtype>::BackwardFrom(int start) {
-  BackwardFromTo(start, 0);
-}
+ private:
+  // Worker threads start with a fresh thread-local Caffe; inherit the
+  // caller's configuration and move to the stage's device.
+  void BindThread(const int stage) {
+    Caffe::set_mode(mode_);
+    Caffe::set_phase(phase_);
+#ifndef CPU_ONLY
+    if (mode_ == Caffe::GPU) {
+      int current_device;
+      CUDA_CHECK(cudaGetDevice(&current_device));
+      if (current_device != device_[stage]) {
+        Caffe::SetDevice(device_[stage]);
+      }
+    }
+#endif
+  }
+
+  // The event helpers operate on the calling thread's legacy default
+  // stream; waiting on a never-recorded event completes immediately, so
+  // the first micro-batch needs no special casing.
+  void Record(PipelineChannel* channel, const bool forward) {
+#ifndef CPU_ONLY
+    if (mode_ == Caffe::GPU) {
+      CUDA_CHECK(cudaEventRecord(
+          forward ? channel->fwd_event_ : channel->bwd_event_, 0));
+    }
+#endif
+  }
+  void StreamWait(PipelineChannel* channel, const bool forward) {
+#ifndef CPU_ONLY
+    if (mode_ == Caffe::GPU) {
+      CUDA_CHECK(cudaStreamWaitEvent(0,
+          forward ? channel->fwd_event_ : channel->bwd_event_, 0));
+    }
+#endif
+  }
+
+  void Drain() {
+#ifndef CPU_ONLY
+    // Leave the stage's device idle before the join, so the caller may
+    // read any blob right after.
+    if (mode_ == Caffe::GPU) {
+      CUDA_CHECK(cudaDeviceSynchronize());
+    }
+#endif
+  }
+
+  Net<Dtype>* const net_;
+  const vector<int>& device_;
+  const vector<int>& first_;
+  const vector<int>& last_;
+  const vector<int>& transfers_;
+  const int micro_batches_;
+  const Caffe::Brew mode_;
+  const Caffe::Phase phase_;
+  vector<shared_ptr<PipelineChannel> > data_;
+  vector<shared_ptr<PipelineChannel> > credit_;
+  vector<Dtype> loss_;
+};
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardPipelined(const int micro_batches) {
+  CHECK(!pipeline_device_.empty())
+      << "ForwardPipelined requires NetParameter.pipeline_device";
+  CHECK_GT(micro_batches, 0);
+  const int num_stages = pipeline_stage_first_.size();
+  if (num_stages == 1) {
+    Dtype loss = 0;
+    for (int m = 0; m < micro_batches; ++m) {
+      loss += ForwardFromTo(0, layers_.size() - 1);
+    }
+    return loss / micro_batches;
+  }
+  PipelineRun<Dtype> run(this, pipeline_device_, pipeline_stage_first_,
+      pipeline_stage_last_, pipeline_stage_transfers_, micro_batches);
+  vector<shared_ptr<boost::thread> > threads;
+  for (int s = 1; s < num_stages; ++s) {
+    threads.push_back(shared_ptr<boost::thread>(
+        new boost::thread(&PipelineRun<Dtype>::WorkForward, &run, s)));
+  }
+  run.WorkForward(0);
+  for (int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+  return run.loss() / micro_batches;
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardPipelined() {
+  CHECK(!pipeline_device_.empty())
+      << "BackwardPipelined requires NetParameter.pipeline_device";
+  const int num_stages = pipeline_stage_first_.size();
+  if (num_stages == 1) {
+    Backward();
+    return;
+  }
+  CHECK(gradient_reducer_ == NULL)
+      << "BackwardPipelined does not support a gradient reducer: "
+      << "buckets would arrive from several threads at once";
+  const int kOneBatch = 1;
+  PipelineRun<Dtype> run(this, pipeline_device_, pipeline_stage_first_,
+      pipeline_stage_last_, pipeline_stage_transfers_, kOneBatch);
+  vector<shared_ptr<boost::thread> > threads;
+  for (int s = 1; s < num_stages; ++s) {
+    threads.push_back(shared_ptr<boost::thread>(
+        new boost::thread(&PipelineRun<Dtype>::WorkBackward, &run, s)));
+  }
+  run.WorkBackward(0);
+  for (int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::BuildCheckpointPlan() {
+  const int num_layers = layers_.size();
+  checkpoint_segment_start_.resize(num_layers);
+  checkpoint_recompute_.resize(num_layers, false);
+  drop_after_layer_.clear();
+  drop_after_layer_.resize(num_layers);
+  // Cut the net into segments of checkpoint_interval_ layers. A layer
+  // whose forward is stateful -- a data layer consuming a dataset, or
+  // dropout redrawing its mask -- cannot be re-run without changing the
+  // result, so it is fenced off into a single-layer segment.
+  bool prev_stateful = false;
+  int seg_start = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    const bool stateful = bottom_id_vecs_[i].empty() ||
+        layers_[i]->layer_param().type() == LayerParameter_LayerType_DROPOUT;
+    if (i > 0 && (stateful || prev_stateful ||
+        i - seg_start >= checkpoint_interval_)) {
+      seg_start = i;
+    }
+    checkpoint_segment_start_[i] = seg_start;
+    prev_stateful = stateful;
+  }
+  // A segment is re-run during Backward if it has interior layers to
+  // regenerate. The last segment is left intact: its backward follows the
+  // forward immediately, so recomputing it would be pure overhead.
+  for (int i = 0; i < num_layers; ++i) {
+    const int s = checkpoint_segment_start_[i];
+    checkpoint_recompute_[i] =
+        checkpoint_segment_start_[num_layers - 1] != s &&
+        (i > s || (i + 1 < num_layers && checkpoint_segment_start_[i + 1] == s));
+  }
+  // A blob may be freed after Forward when every layer producing or
+  // reading it lies in one recomputable segment; the rerun regenerates it
+  // before Backward reads it. In-place chains share one blob id, so all
+  // their layers must sit in the segment. Net inputs and outputs keep
+  // their storage for the caller.
+  vector<int> blob_segment(blobs_.size(), -1);
+  vector<bool> droppable(blobs_.size(), true);
+  vector<int> last_use(blobs_.size(), -1);
+  for (int i = 0; i < num_layers; ++i) {
+    for (int j = 0; j < top_id_vecs_[i].size() + bottom_id_vecs_[i].size();
+        ++j) {
+      const int blob_id = j < top_id_vecs_[i].size() ?
+          top_id_vecs_[i][j] : bottom_id_vecs_[i][j - top_id_vecs_[i].size()];
+      if (blob_segment[blob_id] < 0) {
+        blob_segment[blob_id] = checkpoint_segment_start_[i];
+      } else if (blob_segment[blob_id] != checkpoint_segment_start_[i]) {
+        droppable[blob_id] = false;
+      }
+      last_use[blob_id] = i;
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    droppable[net_input_blob_indices_[i]] = false;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    droppable[net_output_blob_indices_[i]] = false;
+  }
+  size_t planned_bytes = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_segment[blob_id] < 0 || !droppable[blob_id] ||
+        !checkpoint_recompute_[last_use[blob_id]]) {
+      continue;
+    }
+    drop_after_layer_[last_use[blob_id]].push_back(blob_id);
+    planned_bytes += blobs_[blob_id]->count() * sizeof(Dtype);
+  }
+  LOG(INFO) << "Checkpointing frees " << planned_bytes
+      << " bytes of activations after each forward pass.";
+}
+
+#ifndef CPU_ONLY
+
+// Activations smaller than this stay on the GPU: the launch and
+// synchronization overhead of the copies would outweigh the freed bytes.
+static const size_t kMinOffloadBytes = 1 << 20;
+
+template <typename Dtype>
+void Net<Dtype>::BuildOffloadPlan() {
+  const int num_layers = layers_.size();
+  offload_after_layer_.clear();
+  offload_after_layer_.resize(num_layers);
+  offload_bottom_ids_.clear();
+  offload_bottom_ids_.resize(num_layers);
+  // A blob is worth offloading if some layer that runs backward reads it
+  // as a bottom: its data is dead from its last forward read until that
+  // layer's backward. In-place chains share one blob id, so the last
+  // reader is the last layer of the chain.
+  vector<int> last_read(blobs_.size(), -1);
+  vector<bool> read_by_backward(blobs_.size(), false);
+  for (int i = 0; i < num_layers; ++i) {
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      const int blob_id = bottom_id_vecs_[i][j];
+      last_read[blob_id] = i;
+      if (layer_need_backward_[i]) {
+        read_by_backward[blob_id] = true;
+      }
+    }
+  }
+  vector<bool> offloaded(blobs_.size(), false);
+  size_t planned_bytes = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (!read_by_backward[blob_id] || last_read[blob_id] < 0) {
+      continue;
+    }
+    const size_t bytes = blobs_[blob_id]->count() * sizeof(Dtype);
+    if (bytes < kMinOffloadBytes) {
+      continue;
+    }
+    // Prefer pinned host staging so the copies really run asynchronously;
+    // only possible while the blob has no host allocation yet.
+    if (blobs_[blob_id]->data()->head() == SyncedMemory::UNINITIALIZED) {
+      blobs_[blob_id]->data()->set_prefer_pinned(true);
+    }
+    offload_after_layer_[last_read[blob_id]].push_back(blob_id);
+    offloaded[blob_id] = true;
+    planned_bytes += bytes;
+  }
+  // Net inputs and outputs keep their own storage for the caller.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    offloaded[net_input_blob_indices_[i]] = false;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    offloaded[net_output_blob_indices_[i]] = false;
+  }
+  for (int i = 0; i < num_layers; ++i) {
+    vector<int>& after = offload_after_layer_[i];
+    for (int j = after.size() - 1; j >= 0; --j) {
+      if (!offloaded[after[j]]) {
+        after.erase(after.begin() + j);
+      }
+    }
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      if (offloaded[bottom_id_vecs_[i][j]]) {
+        offload_bottom_ids_[i].push_back(bottom_id_vecs_[i][j]);
+      }
+    }
+  }
+  LOG(INFO) << "Offloading up to " << planned_bytes
+      << " bytes of activations to host memory.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::StartActivationOffloads(const int layer_id) {
+  const vector<int>& blob_ids = offload_after_layer_[layer_id];
+  if (blob_ids.empty()) {
+    return;
+  }
+  if (!offload_resources_created_) {
+    // A non-blocking stream: the copies must overlap the legacy default
+    // stream the layers compute on, so ordering is done with events only.
+    CUDA_CHECK(cudaStreamCreateWithFlags(&offload_stream_,
+        cudaStreamNonBlocking));
+    offload_events_.resize(blobs_.size(), (cudaEvent_t)NULL);
+    offload_resources_created_ = true;
+  }
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    const int blob_id = blob_ids[i];
+    if (!offload_events_[blob_id]) {
+      CUDA_CHECK(cudaEventCreateWithFlags(&offload_events_[blob_id],
+          cudaEventDisableTiming));
+    }
+    // Order the copy after the producing kernels, then mark its
+    // completion so PollActivationOffloads can free the device buffer.
+    CUDA_CHECK(cudaEventRecord(offload_events_[blob_id], 0));
+    CUDA_CHECK(cudaStreamWaitEvent(offload_stream_,
+        offload_events_[blob_id], 0));
+    if (blobs_[blob_id]->data()->StartOffload(offload_stream_)) {
+      CUDA_CHECK(cudaEventRecord(offload_events_[blob_id], offload_stream_));
+      pending_offloads_.push_back(blob_id);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PollActivationOffloads(const bool drain) {
+  for (int i = pending_offloads_.size() - 1; i >= 0; --i) {
+    const int blob_id = pending_offloads_[i];
+    if (drain) {
+      CUDA_CHECK(cudaEventSynchronize(offload_events_[blob_id]));
+    } else if (cudaEventQuery(offload_events_[blob_id]) != cudaSuccess) {
+      continue;
+    }
+    blobs_[blob_id]->data()->DropDeviceData();
+    pending_offloads_.erase(pending_offloads_.begin() + i);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PrefetchActivations(const int layer_id) {
+  if (!offload_resources_created_) {
+    return;  // nothing has been offloaded yet
+  }
+  const vector<int>& blob_ids = offload_bottom_ids_[layer_id];
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    const int blob_id = blob_ids[i];
+    if (blobs_[blob_id]->data()->StartPrefetch(offload_stream_)) {
+      // Kernels subsequently launched on the default stream must wait for
+      // the upload.
+      CUDA_CHECK(cudaEventRecord(offload_events_[blob_id], offload_stream_));
+      CUDA_CHECK(cudaStreamWaitEvent(0, offload_events_[blob_id], 0));
+    }
+  }
+}
+
+#endif  // CPU_ONLY
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
+  CHECK_GE(start, 0);
+  CHECK_LT(end, layers_.size());
+  // The DAG scheduler only handles full CPU passes; timing and debug info
+  // want the deterministic sequential order.
+  if (dag_forward_ && start == 0 && end == layers_.size() - 1 &&
+      Caffe::mode() == Caffe::CPU && !timing_ && !debug_info_) {
+    return ForwardDag();
+  }
+  Dtype loss = 0;
+  Timer timer;
+  // The conversions in the half precision activation store work on host
+  // memory, so it only engages in CPU mode.
+  const bool compress = half_activations_ && Caffe::mode() == Caffe::CPU;
+#ifndef CPU_ONLY
+  // Offloading pays off only when a backward pass will reread the
+  // activations, so it stays out of test-phase forwards.
+  const bool offload = offload_activations_ &&
+      Caffe::mode() == Caffe::GPU && Caffe::phase() == Caffe::TRAIN;
+#endif
+  // Freeing is suppressed while a segment's forward is being re-run for
+  // Backward -- that rerun exists to bring the blobs back.
+  const bool drop = checkpoint_interval_ > 1 && !recomputing_ &&
+      Caffe::phase() == Caffe::TRAIN;
+  for (int i = start; i <= end; ++i) {
+    // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    CAFFE_NVTX_RANGE(layer_names_[i].c_str());
+    CAFFE_TRACE_SCOPE(layer_names_[i].c_str());
+    if (compress) {
+      for (int j = 0; j < bottom_vecs_[i].size(); ++j) {
+        bottom_vecs_[i][j]->DecompressDataFromHalf();
+      }
+    }
+    if (timing_) {
+      timer.Start();
+      if (perf_counters_) { perf_counters_->Start(); }
+    }
+    layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
+    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
+    if (timing_) {
+      // Counters stop before the timer so that the event synchronization
+      // inside Timer::Stop (GPU mode) is not attributed to the layer.
+      if (perf_counters_) {
+        perf_counters_->Stop();
+        AccumulateCounters(i, &forward_counters_per_layer_);
+      }
+      timer.Stop();
+      forward_time_per_layer_[i] += timer.MilliSeconds();
+      ++forward_timing_passes_;
+    }
+    loss += layer_loss;
+    if (debug_info_) { ForwardDebugInfo(i); }
+    if (compress) {
+      // Store the layer's inputs and outputs in half until the next
+      // reader needs them; only the running layer's blobs stay at full
+      // precision. The first compression of a blob rounds it; later
+      // round trips reproduce the same values exactly.
+      for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+        if (blob_half_eligible_[bottom_id_vecs_[i][j]]) {
+          bottom_vecs_[i][j]->CompressDataToHalf();
+        }
+      }
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        if (blob_half_eligible_[top_id_vecs_[i][j]]) {
+          top_vecs_[i][j]->CompressDataToHalf();
+        }
+      }
+    }
+#ifndef CPU_ONLY
+    if (offload) {
+      // Start copying out blobs this layer read for the last time, and
+      // release the device buffers of copies that have finished.
+      StartActivationOffloads(i);
+      PollActivationOffloads(false);
+    }
+#endif
+    if (drop) {
+      // Free blobs whose forward life ended at this layer and whose
+      // segment will be recomputed.
+      const vector<int>& drop_ids = drop_after_layer_[i];
+      for (int j = 0; j < drop_ids.size(); ++j) {
+        blobs_[drop_ids[j]]->ReleaseData();
+      }
+    }
+  }
+#ifndef CPU_ONLY
+  if (offload) {
+    PollActivationOffloads(true);
+  }
+#endif
+  return loss;
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardFrom(int start) {
+  return ForwardFromTo(start, layers_.size() - 1);
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardTo(int end) {
+  return ForwardFromTo(0, end);
+}
+
+template <typename Dtype>
+const vector<Blob<Dtype>*>& Net<Dtype>::ForwardPrefilled(Dtype* loss) {
+  Dtype loss_value;
+  if (activation_cache_boundary_ >= 0) {
+    loss_value = ForwardWithActivationCache();
+  } else {
+    loss_value = ForwardFromTo(0, layers_.size() - 1);
+  }
+  if (loss != NULL) {
+    *loss = loss_value;
+  }
+  return net_output_blobs_;
+}
+
+template <typename Dtype>
+const Blob<Dtype>* Net<Dtype>::ForwardEarlyExit(int* exit_index,
+    Dtype* confidence) {
+  CHECK(!early_exit_layers_.empty())
+      << "ForwardEarlyExit needs early_exit_blob entries in the net";
+  int start = 0;
+  for (int exit = 0; exit < early_exit_layers_.size(); ++exit) {
+    ForwardFromTo(start, early_exit_layers_[exit]);
+    start = early_exit_layers_[exit] + 1;
+    const Blob<Dtype>* prob = blobs_[early_exit_blobs_[exit]].get();
+    // The confidence is the top class probability, minimized over the
+    // batch: the whole batch must be easy before the rest is skipped.
+    const Dtype* data = prob->cpu_data();
+    const int dim = prob->count() / prob->num();
+    Dtype batch_min = 0;
+    for (int n = 0; n < prob->num(); ++n) {
+      Dtype top = data[n * dim];
+      for (int c = 1; c < dim; ++c) {
+        top = std::max(top, data[n * dim + c]);
+      }
+      batch_min = (n == 0) ? top : std::min(batch_min, top);
+    }
+    if (exit_index) { *exit_index = exit; }
+    if (confidence) { *confidence = batch_min; }
+    if (exit + 1 == early_exit_layers_.size() ||
+        batch_min >= early_exit_threshold_) {
+      return prob;
+    }
+  }
+  LOG(FATAL) << "unreachable";
+  return NULL;
+}
+
+template <typename Dtype>
+void Net<Dtype>::EnableActivationCache(const string& prefix,
+    const string& boundary_blob) {
+  CHECK(has_blob(boundary_blob))
+      << "Unknown activation cache boundary blob " << boundary_blob;
+  const int blob_id = blob_names_index_[boundary_blob];
+  int producer = -1;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      if (top_id_vecs_[layer_id][top_id] == blob_id) {
+        producer = layer_id;
+      }
+    }
+  }
+  CHECK_GE(producer, 0)
+      << boundary_blob << " is not produced by any layer";
+  CHECK_LT(producer, first_backward_layer_)
+      << "Activation cache boundary " << boundary_blob
+      << " must lie inside the frozen prefix";
+  activation_cache_prefix_ = prefix;
+  activation_cache_blob_ = blob_id;
+  activation_cache_boundary_ = producer;
+  activation_cache_key_ = 0;
+  LOG(INFO) << "Caching " << boundary_blob << " (output of "
+      << layer_names_[producer] << ") under " << prefix;
+}
+
+template <typename Dtype>
+string Net<Dtype>::ActivationCacheFile(const int64_t key) const {
+  ostringstream filename;
+  filename << activation_cache_prefix_ << "_" << key << ".blobproto";
+  return filename.str();
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardWithActivationCache() {
+  const int boundary = activation_cache_boundary_;
+  const string& filename = ActivationCacheFile(activation_cache_key_);
+  ++activation_cache_key_;
+  Dtype loss = 0;
+  if (access(filename.c_str(), R_OK) == 0) {
+    // Hit: run only the source layers of the prefix (data layers have
+    // no bottoms), so labels and the dataset position stay in step,
+    // then resume above the boundary with the cached features.
+    for (int i = 0; i <= boundary; ++i) {
+      if (bottom_vecs_[i].empty()) {
+        loss += ForwardFromTo(i, i);
+      }
+    }
+    BlobProto proto;
+    ReadProtoFromBinaryFileOrDie(filename, &proto);
+    blobs_[activation_cache_blob_]->FromProto(proto);
+    loss += ForwardFromTo(boundary + 1, layers_.size() - 1);
+  } else {
+    loss = ForwardFromTo(0, layers_.size() - 1);
+    BlobProto proto;
+    blobs_[activation_cache_blob_]->ToProto(&proto);
+    WriteProtoToBinaryFile(proto, filename);
+  }
+  return loss;
+}
+
+#ifndef CPU_ONLY
+template <typename Dtype>
+void Net<Dtype>::ForwardAsync(cudaStream_t stream) {
+  CHECK_EQ(Caffe::mode(), Caffe::GPU)
+      << "ForwardAsync is only meaningful in GPU mode.";
+  if (!async_events_created_) {
+    CUDA_CHECK(cudaEventCreateWithFlags(&forward_start_,
+        cudaEventDisableTiming));
+    CUDA_CHECK(cudaEventCreateWithFlags(&forward_done_,
+        cudaEventDisableTiming));
+    async_events_created_ = true;
+  }
+  // The layer launches go to the legacy default stream; order them after the
+  // work already queued on the caller's stream.
+  if (stream != 0) {
+    CUDA_CHECK(cudaEventRecord(forward_start_, stream));
+    CUDA_CHECK(cudaStreamWaitEvent(0, forward_start_, 0));
+  }
+  ForwardFromTo(0, layers_.size() - 1);
+  // Publish completion: the caller's stream resumes only once the pass has
+  // drained, and Synchronize()/ForwardComplete() watch the same event.
+  CUDA_CHECK(cudaEventRecord(forward_done_, 0));
+  if (stream != 0) {
+    CUDA_CHECK(cudaStreamWaitEvent(stream, forward_done_, 0));
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::Synchronize() {
+  if (!async_events_created_) { return; }
+  CUDA_CHECK(cudaEventSynchronize(forward_done_));
+}
+
+template <typename Dtype>
+bool Net<Dtype>::ForwardComplete() {
+  if (!async_events_created_) { return true; }
+  const cudaError_t status = cudaEventQuery(forward_done_);
+  if (status == cudaErrorNotReady) { return false; }
+  CUDA_CHECK(status);
+  return true;
+}
+
+// Depth of the pinned output-readback ring: two slots let the caller
+// post-process request N while request N+1's forward and copies run.
+static const int kOutputReadbackSlots = 2;
+
+template <typename Dtype>
+int Net<Dtype>::BeginOutputReadback() {
+  CHECK_EQ(Caffe::mode(), Caffe::GPU)
+      << "BeginOutputReadback is only meaningful in GPU mode.";
+  CHECK_GT(net_output_blobs_.size(), 0)
+      << "The net has no output blobs to read back";
+  if (readback_events_.empty()) {
+    readback_events_.resize(kOutputReadbackSlots);
+    readback_buffers_.assign(kOutputReadbackSlots,
+        vector<Dtype*>(net_output_blobs_.size(), NULL));
+    readback_capacity_.assign(kOutputReadbackSlots,
+        vector<size_t>(net_output_blobs_.size(), 0));
+    readback_views_.assign(kOutputReadbackSlots,
+        vector<const Dtype*>(net_output_blobs_.size(), NULL));
+    for (int i = 0; i < kOutputReadbackSlots; ++i) {
+      CUDA_CHECK(cudaEventCreateWithFlags(&readback_events_[i],
+          cudaEventDisableTiming | cudaEventBlockingSync));
+    }
+  }
+  const int ticket = readback_next_ticket_++;
+  const int slot = ticket % kOutputReadbackSlots;
+  // Wait out the copies of the request that last used this slot (a
+  // never-recorded event reports complete), so the ring cannot clobber
+  // a transfer still in flight.
+  CUDA_CHECK(cudaEventSynchronize(readback_events_[slot]));
+  for (int i = 0; i < net_output_blobs_.size(); ++i) {
+    Blob<Dtype>* output = net_output_blobs_[i];
+    const size_t count = output->count();
+    if (readback_capacity_[slot][i] < count) {
+      if (readback_buffers_[slot][i]) {
+        CUDA_CHECK(cudaFreeHost(readback_buffers_[slot][i]));
+      }
+      void* buffer = NULL;
+      CUDA_CHECK(cudaMallocHost(&buffer, count * sizeof(Dtype)));
+      readback_buffers_[slot][i] = static_cast<Dtype*>(buffer);
+      readback_capacity_[slot][i] = count;
+    }
+    // Queued on the legacy default stream behind the forward pass that
+    // produced the outputs; the pinned destination keeps the copy
+    // asynchronous, so this returns as soon as it is enqueued.
+    CUDA_CHECK(cudaMemcpyAsync(readback_buffers_[slot][i],
+        output->gpu_data(), count * sizeof(Dtype),
+        cudaMemcpyDeviceToHost, 0));
+    readback_views_[slot][i] = readback_buffers_[slot][i];
+  }
+  CUDA_CHECK(cudaEventRecord(readback_events_[slot], 0));
+  return ticket;
+}
+
+template <typename Dtype>
+const vector<const Dtype*>& Net<Dtype>::WaitOutputReadback(
+    const int ticket) {
+  CHECK_GE(ticket, 0);
+  CHECK_LT(ticket, readback_next_ticket_) << "Unknown readback ticket";
+  CHECK_GE(ticket, readback_next_ticket_ - kOutputReadbackSlots)
+      << "Readback slot already reused; wait before issuing "
+      << kOutputReadbackSlots << " further tickets";
+  const int slot = ticket % kOutputReadbackSlots;
+  CUDA_CHECK(cudaEventSynchronize(readback_events_[slot]));
+  return readback_views_[slot];
+}
+#endif
+
+template <typename Dtype>
+const vector<Blob<Dtype>*>& Net<Dtype>::Forward(
+    const vector<Blob<Dtype>*> & bottom, Dtype* loss) {
+  // Copy bottom to internal bottom
+  for (int i = 0; i < bottom.size(); ++i) {
+    net_input_blobs_[i]->CopyFrom(*bottom[i]);
+  }
+  return ForwardPrefilled(loss);
+}
+
+template <typename Dtype>
+const vector<Blob<Dtype>*>& Net<Dtype>::ForwardZeroCopy(
+    const vector<Dtype*>& inputs, Dtype* loss) {
+  CHECK_EQ(inputs.size(), net_input_blobs_.size()) << "Incorrect input size.";
+  for (int i = 0; i < inputs.size(); ++i) {
+    Blob<Dtype>* input = net_input_blobs_[i];
+    CHECK(Blob<Dtype>::IsAligned(inputs[i]))
+        << "Input buffer " << i << " is not 64-byte aligned.";
+    // Adopting a flat buffer only lines up with unpadded rows; net
+    // inputs are reshaped without padding, so this never fires for
+    // nets fed through input fields.
+    CHECK_EQ(input->width_pitch(), input->width())
+        << "Input blob " << i << " has padded rows.";
+    input->set_cpu_data(inputs[i]);
+  }
+  return ForwardPrefilled(loss);
+}
+
+template <typename Dtype>
+void Net<Dtype>::WarmUp(const int iterations) {
+  CHECK_GT(iterations, 0);
+  bool any_backward = false;
+  for (int i = 0; i < layer_need_backward_.size(); ++i) {
+    any_backward |= layer_need_backward_[i];
+  }
+  for (int i = 0; i < iterations; ++i) {
+    ForwardPrefilled();
+    if (any_backward) { Backward(); }
+  }
+  if (any_backward) {
+    // The dummy gradients must not leak into the first real update.
+    ClearParamDiffs();
+  }
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    // Drain the device so "warmed up" means the kernels actually ran,
+    // not just that they were queued.
+    CUDA_CHECK(cudaDeviceSynchronize());
+  }
+#endif
+}
+
+template <typename Dtype>
+string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
+  BlobProtoVector blob_proto_vec;
+  if (net_input_blobs_.size()) {
+    blob_proto_vec.ParseFromString(input_blob_protos);
+    CHECK_EQ(blob_proto_vec.blobs_size(), net_input_blobs_.size())
+        << "Incorrect input size.";
+    for (int i = 0; i < blob_proto_vec.blobs_size(); ++i) {
+      net_input_blobs_[i]->FromProto(blob_proto_vec.blobs(i));
+    }
+  }
+  ForwardPrefilled(loss);
+  blob_proto_vec.Clear();
+  for (int i = 0; i < net_output_blobs_.size(); ++i) {
+    net_output_blobs_[i]->ToProto(blob_proto_vec.add_blobs());
+  }
+  string output;
+  blob_proto_vec.SerializeToString(&output);
+  return output;
+}
+
+template <typename Dtype>
+void Net<Dtype>::set_gradient_reducer(GradientReducer<Dtype>* reducer,
+    const size_t bucket_size) {
+  gradient_reducer_ = reducer;
+  reducer_bucket_size_ = bucket_size;
+  reduce_params_per_layer_.clear();
+  reduce_param_sharers_.clear();
+  if (!reducer) { return; }
+  CHECK_GT(bucket_size, 0) << "Reducer bucket size cannot be zero.";
+  reduce_params_per_layer_.resize(layers_.size());
+  reduce_param_sharers_.resize(params_.size());
+  // An owned parameter's diff is final once the lowest-indexed layer
+  // touching it has run its backward step; a shared parameter thus
+  // waits for all of its sharers.
+  vector<int> final_layer(params_.size(), -1);
+  for (int i = 0; i < params_.size(); ++i) {
+    const int owner = param_owners_[i] < 0 ? i : param_owners_[i];
+    const int layer_id = param_layer_indices_[i].first;
+    if (final_layer[owner] < 0 || layer_id < final_layer[owner]) {
+      final_layer[owner] = layer_id;
+    }
+    if (param_owners_[i] >= 0) {
+      reduce_param_sharers_[owner].push_back(i);
+    }
+  }
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] < 0) {
+      reduce_params_per_layer_[final_layer[i]].push_back(i);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::FoldSharedDiff(const int param_id) {
+  const int owner = param_owners_[param_id];
+  CHECK_GE(owner, 0);
+  const int count = params_[param_id]->count();
+  switch (Caffe::mode()) {
+  case Caffe::CPU: {
+    Dtype* owner_diff = params_[owner]->mutable_cpu_diff();
+    caffe_add(count, params_[param_id]->cpu_diff(), owner_diff, owner_diff);
+    caffe_set(count, Dtype(0), params_[param_id]->mutable_cpu_diff());
+    break;
+  }
+#ifndef CPU_ONLY
+  case Caffe::GPU: {
+    Dtype* owner_diff = params_[owner]->mutable_gpu_diff();
+    caffe_gpu_add(count, params_[param_id]->gpu_diff(), owner_diff,
+        owner_diff);
+    caffe_gpu_set(count, Dtype(0), params_[param_id]->mutable_gpu_diff());
+    break;
+  }
+#else
+    NO_GPU;
+#endif
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardFromTo(int start, int end) {
+  CHECK_GE(end, 0);
+  CHECK_LT(start, layers_.size());
+  // Stop above the frozen prefix: the layers below first_backward_layer_
+  // would all be skipped anyway. With a gradient reducer attached the
+  // walk continues, since those layers' params still hand off their
+  // (zero) diffs to keep the collective exchange symmetric.
+  if (!gradient_reducer_ && end < first_backward_layer_) {
+    end = first_backward_layer_;
+  }
+  Timer timer;
+#ifndef CPU_ONLY
+  const bool offload = offload_activations_ && Caffe::mode() == Caffe::GPU;
+#endif
+  const bool checkpoint = checkpoint_interval_ > 1 &&
+      Caffe::phase() == Caffe::TRAIN;
+  // Layers at and above this index already have their activations in
+  // place, either kept from Forward or regenerated below.
+  int recomputed_from = layers_.size();
+  // Finished parameter gradients waiting to fill a reducer bucket.
+  vector<Blob<Dtype>*> bucket;
+  size_t bucket_count = 0;
+  CAFFE_NVTX_RANGE("caffe::backward");
+  for (int i = start; i >= end; --i) {
+    CAFFE_NVTX_RANGE(layer_names_[i].c_str());
+    CAFFE_TRACE_SCOPE(layer_names_[i].c_str());
+    if (layer_need_backward_[i]) {
+      if (checkpoint && checkpoint_recompute_[i] && i < recomputed_from) {
+        // Re-run this segment's forward to regenerate the activations
+        // freed after the original pass.
+        recomputing_ = true;
+        ForwardFromTo(checkpoint_segment_start_[i], i);
+        recomputing_ = false;
+        recomputed_from = checkpoint_segment_start_[i];
+      }
+#ifndef CPU_ONLY
+      if (offload) {
+        // Bring this layer's offloaded bottoms back (usually already in
+        // flight) and start the fetch for the next layer down, so its
+        // upload overlaps this layer's kernels.
+        PrefetchActivations(i);
+        if (i - 1 >= end) {
+          PrefetchActivations(i - 1);
+        }
+      }
+#endif
+      if (timing_) {
+        timer.Start();
+        if (perf_counters_) { perf_counters_->Start(); }
+      }
+      layers_[i]->Backward(
+          top_vecs_[i], bottom_need_backward_[i], &bottom_vecs_[i]);
+      if (timing_) {
+        if (perf_counters_) {
+          perf_counters_->Stop();
+          AccumulateCounters(i, &backward_counters_per_layer_);
+        }
+        timer.Stop();
+        backward_time_per_layer_[i] += timer.MilliSeconds();
+        ++backward_timing_passes_;
+      }
+      if (debug_info_) { BackwardDebugInfo(i); }
+    }
+    if (gradient_reducer_) {
+      // Hand this layer's finished diffs over, so their exchange
+      // overlaps the backward compute of the layers below. Layers whose
+      // backward was skipped still hand off: every rank must contribute
+      // the same parameter set to a collective exchange.
+      const vector<int>& ready = reduce_params_per_layer_[i];
+      for (int j = 0; j < ready.size(); ++j) {
+        const int param_id = ready[j];
+        // Fold shared copies in (and zero them) first, so the handed
+        // diff is complete and the accumulation in Update cannot
+        // double-count it.
+        const vector<int>& sharers = reduce_param_sharers_[param_id];
+        for (int k = 0; k < sharers.size(); ++k) {
+          FoldSharedDiff(sharers[k]);
+        }
+        bucket.push_back(params_[param_id].get());
+        bucket_count += params_[param_id]->count();
+      }
+      if (bucket_count >= reducer_bucket_size_ && !bucket.empty()) {
+        gradient_reducer_->Reduce(bucket);
+        bucket.clear();
+        bucket_count = 0;
+      }
+    }
+  }
+  if (gradient_reducer_ && !bucket.empty()) {
+    gradient_reducer_->Reduce(bucket);
+  }
+}
+
+template <typename Dtype>
+string Net<Dtype>::DebugStats(const Blob<Dtype>& blob,
+    const bool use_diff) const {
+  const int stride = debug_info_sample_stride_;
+  // Number of elements a strided pass reads; equal to count() when the
+  // stride is 1, where the sampled reductions degenerate to the full
+  // ones and the output format stays exactly as it always was.
+  const int sampled = (blob.count() + stride - 1) / stride;
+  const Dtype asum = use_diff ? blob.sampled_asum_diff(stride)
+                              : blob.sampled_asum_data(stride);
+  ostringstream stats;
+  stats << (sampled ? asum / sampled : Dtype(0));
+  if (stride > 1) {
+    stats << " (sampled 1/" << stride << "; max "
+        << (use_diff ? blob.sampled_amax_diff(stride)
+                     : blob.sampled_amax_data(stride)) << ")";
+  }
+  return stats.str();
+}
+
+template <typename Dtype>
+void Net<Dtype>::ForwardDebugInfo(const int layer_id) {
+  for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+    const Blob<Dtype>& blob = *top_vecs_[layer_id][top_id];
+    const string& blob_name = blob_names_[top_id_vecs_[layer_id][top_id]];
+    LOG(INFO) << "    [Forward] "
+       << "Layer " << layer_names_[layer_id] << ", top blob " << blob_name
+       << " data: " << DebugStats(blob, false);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardDebugInfo(const int layer_id) {
+  const vector<Blob<Dtype>*>& bottom_vec = bottom_vecs_[layer_id];
+  for (int bottom_id = 0; bottom_id < bottom_vec.size(); ++bottom_id) {
+    if (!bottom_need_backward_[layer_id][bottom_id]) { continue; }
+    const Blob<Dtype>& blob = *bottom_vec[bottom_id];
+    const string& blob_name = blob_names_[bottom_id_vecs_[layer_id][bottom_id]];
+    LOG(INFO) << "    [Backward] "
+        << "Layer " << layer_names_[layer_id] << ", bottom blob " << blob_name
+        << " diff: " << DebugStats(blob, true);
+  }
+  for (int param_id = 0; param_id < layers_[layer_id]->blobs().size();
+       ++param_id) {
+    if (!layers_[layer_id]->param_propagate_down(param_id)) { continue; }
+    const Blob<Dtype>& blob = *layers_[layer_id]->blobs()[param_id];
+    LOG(INFO) << "    [Backward] "
+        << "Layer " << layer_names_[layer_id] << ", param blob " << param_id
+        << " diff: " << DebugStats(blob, true);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::UpdateDebugInfo(const int param_id) {
+  const Blob<Dtype>& blob = *params_[param_id];
+  const int param_owner = param_owners_[param_id];
+  const string& layer_name = layer_names_[param_layer_indices_[param_id].first];
+  const string& param_display_name = param_display_names_[param_id];
+  const string diff_stats = DebugStats(blob, true);
+  if (param_owner < 0) {
+    LOG(INFO) << "    [Update] Layer " << layer_name
+        << ", param " << param_display_name
+        << " data: " << DebugStats(blob, false)
+        << "; diff: " << diff_stats;
+  } else {
+    const string& owner_layer_name =
+        layer_names_[param_layer_indices_[param_owner].first];
+    LOG(INFO) << "    [Update] Layer " << layer_name
+        << ", param blob " << param_display_name
+        << " (owned by layer " << owner_layer_name << ", "
+        << "param " << param_display_names_[param_owners_[param_id]] << ")"
+        << " diff: " << diff_stats;
+  }
+}
+
+template <typename Dtype>
+shared_ptr<Net<Dtype> > Net<Dtype>::CreateReplica() {
+  shared_ptr<Net<Dtype> > replica(new Net<Dtype>(replica_param_));
+  replica->ShareTrainedLayersWith(this);
+  // Freeze the now-shared parameter storage: the bytes back every
+  // replica plus this net, so a mutable access through any of them
+  // now fails a CHECK instead of silently corrupting the rest.
+  for (int i = 0; i < params_.size(); ++i) {
+    params_[i]->data()->set_read_only();
+  }
+  return replica;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareTrainedLayersWith(Net* other) {
+  int num_source_layers = other->layers().size();
+  for (int i = 0; i < num_source_layers; ++i) {
+    Layer<Dtype>* source_layer = other->layers()[i].get();
+    const string& source_layer_name = other->layer_names()[i];
+    int target_layer_id = 0;
+    while (target_layer_id != layer_names_.size() &&
+        layer_names_[target_layer_id] != source_layer_name) {
+      ++target_layer_id;
+    }
+    if (target_layer_id == layer_names_.size()) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    DLOG(INFO) << "Copying source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer->blobs().size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      Blob<Dtype>* source_blob = source_layer->blobs()[j].get();
+      CHECK_EQ(target_blobs[j]->num(), source_blob->num());
+      CHECK_EQ(target_blobs[j]->channels(), source_blob->channels());
+      CHECK_EQ(target_blobs[j]->height(), source_blob->height());
+      CHECK_EQ(target_blobs[j]->width(), source_blob->width());
+      target_blobs[j]->ShareData(*source_blob);
+    }
+  }
+  // The shared blobs now alias the source net's memory, so this net's
+  // contiguous data arena (if any) no longer backs them; drop it so the
+  // bulk-update fast path cannot write to stale storage. The diff arena
+  // still backs the (unshared) diffs and stays usable for bulk clears.
+  params_data_arena_.reset();
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareActivationsWith(Net* other) {
+  int shared = 0;
+  size_t shared_bytes = 0;
+  for (int i = 0; i < blobs_.size(); ++i) {
+    if (!other->has_blob(blob_names_[i])) { continue; }
+    const shared_ptr<Blob<Dtype> > donor = other->blob_by_name(blob_names_[i]);
+    const size_t bytes = blobs_[i]->count() * sizeof(Dtype);
+    if (donor->data()->size() < bytes) { continue; }
+    blobs_[i]->ShareData(donor->data());
+    ++shared;
+    shared_bytes += bytes;
+  }
+  LOG(INFO) << "Shared activations with donor net: " << shared << " of "
+      << blobs_.size() << " blobs, " << shared_bytes << " bytes";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ResetTiming() {
+  forward_time_per_layer_.assign(layers_.size(), 0.);
+  backward_time_per_layer_.assign(layers_.size(), 0.);
+  forward_timing_passes_ = 0;
+  backward_timing_passes_ = 0;
+  forward_counters_per_layer_.assign(
+      layers_.size() * PerfCounters::NUM_COUNTERS, 0);
+  backward_counters_per_layer_.assign(
+      layers_.size() * PerfCounters::NUM_COUNTERS, 0);
+}
+
+template <typename Dtype>
+void Net<Dtype>::set_timing_counters(const bool value) {
+  if (!value) {
+    perf_counters_.reset();
+    return;
+  }
+  if (perf_counters_) { return; }
+  perf_counters_.reset(new PerfCounters());
+  if (!perf_counters_->available()) {
+    // The PerfCounters constructor has already logged why; timing falls
+    // back to wall clock only.
+    perf_counters_.reset();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::AccumulateCounters(const int layer_id,
+    vector<uint64_t>* accumulator) {
+  for (int c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+    (*accumulator)[layer_id * PerfCounters::NUM_COUNTERS + c] +=
+        perf_counters_->Value(static_cast<PerfCounters::Counter>(c));
+  }
+}
+
+// Formats one direction's accumulated counter deltas for a layer as a
+// report line: per-pass cycles and LLC misses, plus the instruction and
+// stall rates (which are ratios, so pass counts cancel out).
+static string PerfCounterSummary(const vector<uint64_t>& counters,
+    const int layer_id, const int passes) {
+  const uint64_t* values = &counters[layer_id * PerfCounters::NUM_COUNTERS];
+  const uint64_t cycles = values[PerfCounters::CYCLES];
+  ostringstream stream;
+  stream << cycles / passes << " cycles";
+  if (cycles > 0) {
+    stream << ", " << std::setprecision(3)
+        << static_cast<double>(values[PerfCounters::INSTRUCTIONS]) / cycles
+        << " insn/cycle";
+    stream << ", " << values[PerfCounters::LLC_MISSES] / passes
+        << " LLC misses";
+    stream << ", " << std::setprecision(3)
+        << 100. * values[PerfCounters::STALLED_CYCLES] / cycles
+        << "% stalled";
+  }
+  return stream.str();
+}
+
+template <typename Dtype>
+void Net<Dtype>::PrintTimingInfo() {
+  // Passes are counted per layer visit; convert to whole-net passes so the
+  // averages below are per-iteration numbers.
+  const int forward_passes = layers_.size() ?
+      forward_timing_passes_ / layers_.size() : 0;
+  if (!timing_ || forward_passes == 0) {
+    LOG(INFO) << "No timing information collected; call set_timing(true) "
+              << "and run Forward/Backward first.";
+    return;
+  }
+  double forward_total = 0.;
+  double backward_total = 0.;
+  LOG(INFO) << "Average time per layer over " << forward_passes << " passes:";
+  for (int i = 0; i < layers_.size(); ++i) {
+    forward_total += forward_time_per_layer_[i];
+    backward_total += backward_time_per_layer_[i];
+    LOG(INFO) << "  " << layer_names_[i] << "\tforward: "
+        << forward_time_per_layer_[i] / forward_passes << " ms\tbackward: "
+        << backward_time_per_layer_[i] / forward_passes << " ms";
+    if (perf_counters_) {
+      LOG(INFO) << "    forward: "
+          << PerfCounterSummary(forward_counters_per_layer_, i,
+                                forward_passes);
+      if (backward_time_per_layer_[i] > 0) {
+        LOG(INFO) << "    backward: "
+            << PerfCounterSummary(backward_counters_per_layer_, i,
+                                  forward_passes);
+      }
+    }
+  }
+  LOG(INFO) << "Total forward: " << forward_total / forward_passes
+      << " ms, total backward: " << backward_total / forward_passes << " ms";
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardFrom(int start) {
+  BackwardFromTo(start, 0);
+}
 
 template <typename Dtype>
 void Net<Dtype>::BackwardTo(int end) {
@@ -687,6 +2353,38 @@ void Net<Dtype>::Reshape() {
   }
 }
 
+template <typename Dtype>
+string Net<Dtype>::InputShapeKey() const {
+  ostringstream key;
+  for (int i = 0; i < net_input_blobs_.size(); ++i) {
+    const Blob<Dtype>* blob = net_input_blobs_[i];
+    key << blob->num() << "x" << blob->channels() << "x"
+        << blob->height() << "x" << blob->width() << ";";
+  }
+  return key.str();
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReshapeInput(const int input_id, const int num,
+    const int channels, const int height, const int width) {
+  CHECK_GE(input_id, 0);
+  CHECK_LT(input_id, net_input_blobs_.size());
+  Blob<Dtype>* input = net_input_blobs_[input_id];
+  if (input->num() == num && input->channels() == channels &&
+      input->height() == height && input->width() == width) {
+    return;
+  }
+  input->Reshape(num, channels, height, width);
+  Reshape();
+  if (warmed_shapes_.insert(InputShapeKey()).second) {
+    // First visit: the walk above grew blob capacities where needed.
+    // Capacity never shrinks, so later switches back to this shape (or
+    // any other warmed one) perform no allocation.
+    DLOG(INFO) << "Warmed input shape " << InputShapeKey()
+        << " for net " << name_;
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layers_size();
@@ -725,7 +2423,44 @@ void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
 }
 
 template <typename Dtype>
-void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) {
+void Net<Dtype>::MapTrainedLayersFrom(const string& mmap_filename) {
+  mmap_model_.reset(new MMapModel<Dtype>(mmap_filename));
+  const NetParameter& index = mmap_model_->index();
+  // Walk the index like CopyTrainedLayersFrom walks a NetParameter, but
+  // alias the mapped payloads instead of copying them.
+  int source_blob_id = 0;
+  for (int i = 0; i < index.layers_size(); ++i) {
+    const LayerParameter& source_layer = index.layers(i);
+    const string& source_layer_name = source_layer.name();
+    int target_layer_id = 0;
+    while (target_layer_id != layer_names_.size() &&
+        layer_names_[target_layer_id] != source_layer_name) {
+      ++target_layer_id;
+    }
+    if (target_layer_id == layer_names_.size()) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      source_blob_id += source_layer.blobs_size();
+      continue;
+    }
+    DLOG(INFO) << "Mapping source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      CHECK_EQ(target_blobs[j]->num(), source_layer.blobs(j).num());
+      CHECK_EQ(target_blobs[j]->channels(), source_layer.blobs(j).channels());
+      CHECK_EQ(target_blobs[j]->height(), source_layer.blobs(j).height());
+      CHECK_EQ(target_blobs[j]->width(), source_layer.blobs(j).width());
+      target_blobs[j]->set_cpu_data(mmap_model_->blob_data(source_blob_id));
+      ++source_blob_id;
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ToProto(NetParameter* param, bool write_diff,
+    bool write_half) {
   param->Clear();
   param->set_name(name_);
   // Add bottom and top
@@ -741,10 +2476,116 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) {
     for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
       layer_param->add_top(blob_names_[top_id_vecs_[i][j]]);
     }
-    layers_[i]->ToProto(layer_param, write_diff);
+    layers_[i]->ToProto(layer_param, write_diff, write_half);
   }
 }
 
+namespace {
+
+// Wire tags of the fields ToBinaryFile streams around the staged
+// metadata: (field number << 3) | 2 for length-delimited fields.
+const uint32_t kNetLayersTag = (2 << 3) | 2;       // NetParameter.layers
+const uint32_t kLayerBlobsTag = (6 << 3) | 2;      // LayerParameter.blobs
+const uint32_t kBlobRawDataTag = (7 << 3) | 2;     // BlobProto.raw_data
+const uint32_t kBlobRawDiffTag = (8 << 3) | 2;     // BlobProto.raw_diff
+
+// Protobuf caps any one message at 2 GB on the wire.
+const int64_t kMaxLayerMessageBytes = 1LL << 31;
+
+// Wire size of one length-delimited field: its one-byte tag, the
+// length varint, and the payload.
+int64_t DelimitedFieldBytes(const int64_t payload) {
+  return 1 + google::protobuf::io::CodedOutputStream::VarintSize64(payload) +
+      payload;
+}
+
+}  // namespace
+
+template <typename Dtype>
+void Net<Dtype>::ToBinaryFile(const string& filename,
+    const bool write_diff, const bool write_half) {
+  using google::protobuf::io::CodedOutputStream;
+  const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_GE(fd, 0) << "Could not open " << filename << " for writing";
+  {
+    google::protobuf::io::FileOutputStream raw_output(fd);
+    CodedOutputStream output(&raw_output);
+    // The envelope: every NetParameter field but the layers, which
+    // follow one at a time. Wire field order is irrelevant to parsers.
+    NetParameter envelope;
+    envelope.set_name(name_);
+    for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+      envelope.add_input(blob_names_[net_input_blob_indices_[i]]);
+    }
+    envelope.ByteSize();
+    envelope.SerializeWithCachedSizes(&output);
+    DLOG(INFO) << "Streaming " << layers_.size() << " layers";
+    for (int i = 0; i < layers_.size(); ++i) {
+      // The layer's metadata exactly as ToProto stages it: its
+      // LayerParameter without the blobs, which are streamed below.
+      LayerParameter meta;
+      meta.CopyFrom(layers_[i]->layer_param());
+      meta.clear_blobs();
+      const vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i]->blobs();
+      // Size the layers entry without materializing it: the metadata
+      // plus each blob's shape header and raw payload fields.
+      vector<BlobProto> shapes(blobs.size());
+      vector<int64_t> blob_bytes(blobs.size());
+      int64_t layer_bytes = meta.ByteSize();
+      for (int j = 0; j < blobs.size(); ++j) {
+        CHECK(!blobs[j]->has_pitch())
+            << "Pitched blobs cannot be serialized.";
+        shapes[j].set_num(blobs[j]->num());
+        shapes[j].set_channels(blobs[j]->channels());
+        shapes[j].set_height(blobs[j]->height());
+        shapes[j].set_width(blobs[j]->width());
+        const int64_t data_bytes = static_cast<int64_t>(blobs[j]->count())
+            * (write_half ? sizeof(uint16_t) : sizeof(Dtype));
+        int64_t bytes = shapes[j].ByteSize()
+            + DelimitedFieldBytes(data_bytes);
+        if (write_diff) {
+          bytes += DelimitedFieldBytes(
+              static_cast<int64_t>(blobs[j]->count()) * sizeof(Dtype));
+        }
+        blob_bytes[j] = bytes;
+        layer_bytes += DelimitedFieldBytes(bytes);
+      }
+      CHECK_LT(layer_bytes, kMaxLayerMessageBytes)
+          << "Layer " << layer_names_[i] << " exceeds the 2 GB message "
+          << "limit; it cannot be serialized.";
+      output.WriteTag(kNetLayersTag);
+      output.WriteVarint64(layer_bytes);
+      meta.SerializeWithCachedSizes(&output);
+      for (int j = 0; j < blobs.size(); ++j) {
+        output.WriteTag(kLayerBlobsTag);
+        output.WriteVarint64(blob_bytes[j]);
+        shapes[j].SerializeWithCachedSizes(&output);
+        const int count = blobs[j]->count();
+        output.WriteTag(kBlobRawDataTag);
+        if (write_half) {
+          // The only staged payload: one blob's half conversion.
+          vector<uint16_t> half_vec(count > 0 ? count : 1);
+          caffe_cpu_convert_to_half(count, blobs[j]->cpu_data(),
+              &half_vec[0]);
+          output.WriteVarint64(count * sizeof(uint16_t));
+          output.WriteRaw(&half_vec[0], count * sizeof(uint16_t));
+        } else {
+          // Straight from the blob's host mirror, no staging copy.
+          output.WriteVarint64(count * sizeof(Dtype));
+          output.WriteRaw(blobs[j]->cpu_data(), count * sizeof(Dtype));
+        }
+        if (write_diff) {
+          output.WriteTag(kBlobRawDiffTag);
+          output.WriteVarint64(count * sizeof(Dtype));
+          output.WriteRaw(blobs[j]->cpu_diff(), count * sizeof(Dtype));
+        }
+      }
+    }
+    CHECK(!output.HadError()) << "Failed writing " << filename;
+  }
+  close(fd);
+}
+
 template <typename Dtype>
 void Net<Dtype>::Update() {
   // First, accumulate the diffs of any shared parameters into their owner's
@@ -752,6 +2593,9 @@ void Net<Dtype>::Update() {
   // accounted for in the current diff.)
   for (int i = 0; i < params_.size(); ++i) {
     if (param_owners_[i] < 0) { continue; }
+    // A frozen sharer's diff was never scaled by the solver; it must not
+    // leak into the owner's update.
+    if (params_lr_[i] == 0) { continue; }
     if (debug_info_) { UpdateDebugInfo(i); }
     const int count = params_[i]->count();
     const Dtype* this_diff;
@@ -775,11 +2619,136 @@ void Net<Dtype>::Update() {
       LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
     }
   }
-  // Now, update the owned parameters.
-  for (int i = 0; i < params_.size(); ++i) {
-    if (param_owners_[i] >= 0) { continue; }
-    if (debug_info_) { UpdateDebugInfo(i); }
-    params_[i]->Update();
+  // Now, update the owned parameters. With the contiguous arenas (which
+  // exist only when nothing is shared) the whole net updates in a single
+  // axpy instead of one per blob -- unless some params are frozen, whose
+  // unscaled diffs must not be applied.
+  if (params_data_arena_ &&
+      learnable_param_ids_.size() == params_.size()) {
+    if (debug_info_) {
+      for (int i = 0; i < params_.size(); ++i) { UpdateDebugInfo(i); }
+    }
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_axpy<Dtype>(params_total_count_, Dtype(-1),
+          static_cast<const Dtype*>(params_diff_arena_->cpu_data()),
+          static_cast<Dtype*>(params_data_arena_->mutable_cpu_data()));
+      break;
+#ifndef CPU_ONLY
+    case Caffe::GPU:
+      caffe_gpu_axpy<Dtype>(params_total_count_, Dtype(-1),
+          static_cast<const Dtype*>(params_diff_arena_->gpu_data()),
+          static_cast<Dtype*>(params_data_arena_->mutable_gpu_data()));
+      break;
+#else
+      NO_GPU;
+#endif
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+    return;
+  }
+  for (int i = 0; i < learnable_param_ids_.size(); ++i) {
+    const int param_id = learnable_param_ids_[i];
+    if (param_owners_[param_id] >= 0) { continue; }
+    if (debug_info_) { UpdateDebugInfo(param_id); }
+    params_[param_id]->Update();
+  }
+}
+
+template <typename Dtype>
+const vector<int>* Net<Dtype>::sparse_param_rows(const int param_id) const {
+  // A shared parameter's diff holds contributions from every sharer, so
+  // no single layer can vouch for which rows are live.
+  if (param_owners_[param_id] >= 0) { return NULL; }
+  for (int i = 0; i < param_owners_.size(); ++i) {
+    if (param_owners_[i] == param_id) { return NULL; }
+  }
+  const pair<int, int>& index = param_layer_indices_[param_id];
+  return layers_[index.first]->sparse_param_rows(index.second);
+}
+
+template <typename Dtype>
+bool Net<Dtype>::PrefetchTiming(const bool window, double* wait_ms,
+    double* busy_ms, double* period_ms) {
+  *wait_ms = 0;
+  *busy_ms = 0;
+  *period_ms = 0;
+  bool found = false;
+  for (int i = 0; i < layers_.size(); ++i) {
+    found |= layers_[i]->PrefetchTiming(window, wait_ms, busy_ms,
+        period_ms);
+  }
+  return found;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ClearParamDiffs() {
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    if (params_diff_arena_) {
+      caffe_set<Dtype>(params_total_count_, Dtype(0),
+          static_cast<Dtype*>(params_diff_arena_->mutable_cpu_data()));
+      return;
+    }
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_set(params_[i]->count(), Dtype(0),
+          params_[i]->mutable_cpu_diff());
+    }
+    break;
+#ifndef CPU_ONLY
+  case Caffe::GPU:
+    if (params_diff_arena_) {
+      caffe_gpu_set<Dtype>(params_total_count_, Dtype(0),
+          static_cast<Dtype*>(params_diff_arena_->mutable_gpu_data()));
+      return;
+    }
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_gpu_set(params_[i]->count(), Dtype(0),
+          params_[i]->mutable_gpu_diff());
+    }
+    break;
+#else
+    NO_GPU;
+#endif
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ScaleParamDiffs(const Dtype scale) {
+  // Scaling every diff (owned and shared alike) is correct, since the
+  // shared diffs are only folded into their owner later in Update.
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    if (params_diff_arena_) {
+      caffe_scal<Dtype>(params_total_count_, scale,
+          static_cast<Dtype*>(params_diff_arena_->mutable_cpu_data()));
+      return;
+    }
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_scal(params_[i]->count(), scale,
+          params_[i]->mutable_cpu_diff());
+    }
+    break;
+#ifndef CPU_ONLY
+  case Caffe::GPU:
+    if (params_diff_arena_) {
+      caffe_gpu_scal<Dtype>(params_total_count_, scale,
+          static_cast<Dtype*>(params_diff_arena_->mutable_gpu_data()));
+      return;
+    }
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_gpu_scal(params_[i]->count(), scale,
+          params_[i]->mutable_gpu_diff());
+    }
+    break;
+#else
+    NO_GPU;
+#endif
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
   }
 }
 
@@ -819,6 +2788,63 @@ const shared_ptr<Layer<Dtype> > Net<Dtype>::layer_by_name(
   return layer_ptr;
 }
 
+template <typename Dtype>
+string Net<Dtype>::memory_report() const {
+  ostringstream report;
+  const size_t value_size = sizeof(Dtype);
+  size_t activation_bytes = 0;
+  size_t param_bytes = 0;
+  int net_param_id = 0;
+  boost::unordered_set<int> counted_blobs;
+  report << "Memory report for net '" << name_ << "'" << std::endl;
+  // Input blobs have no producing layer; report them first.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    const int blob_id = net_input_blob_indices_[i];
+    const size_t bytes = 2 * blobs_[blob_id]->count() * value_size;
+    counted_blobs.insert(blob_id);
+    activation_bytes += bytes;
+    report << "  (input) " << blob_names_[blob_id] << ": activations "
+        << bytes << std::endl;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    size_t layer_activation_bytes = 0;
+    size_t layer_param_bytes = 0;
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int blob_id = top_id_vecs_[layer_id][top_id];
+      // In-place tops reuse a blob counted at its producer.
+      if (counted_blobs.insert(blob_id).second) {
+        // Data and diff are allocated together.
+        layer_activation_bytes += 2 * blobs_[blob_id]->count() * value_size;
+      }
+    }
+    const int num_param_blobs = layers_[layer_id]->blobs().size();
+    for (int param_id = 0; param_id < num_param_blobs;
+         ++param_id, ++net_param_id) {
+      // Shared parameters alias their owner's storage; count them there.
+      if (param_owners_[net_param_id] < 0) {
+        layer_param_bytes +=
+            2 * layers_[layer_id]->blobs()[param_id]->count() * value_size;
+      }
+    }
+    activation_bytes += layer_activation_bytes;
+    param_bytes += layer_param_bytes;
+    report << "  " << layer_names_[layer_id] << ": activations "
+        << layer_activation_bytes << " params " << layer_param_bytes
+        << std::endl;
+  }
+  report << "  total: activations " << activation_bytes << " params "
+      << param_bytes << std::endl;
+  // The process-wide picture; the difference to the totals above is what
+  // lives outside this net's named blobs (col buffers, prefetch batches,
+  // other nets in the process).
+  MemoryAccounting accounting;
+  CaffeMemoryAccounting(&accounting);
+  report << "  process: host " << accounting.host_bytes << " (peak "
+      << accounting.host_bytes_peak << ") device " << accounting.device_bytes
+      << " (peak " << accounting.device_bytes_peak << ")";
+  return report.str();
+}
+
 INSTANTIATE_CLASS(Net);
 
 }  // namespace caffe
@@ -0,0 +1,678 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "caffe/parallel.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/gradient_compression.hpp"
+#include "caffe/util/math_functions.hpp"
+#ifdef USE_RDMA
+#include "caffe/util/rdma_transport.hpp"
+#endif
+
+namespace caffe {
+
+template <typename Dtype>
+class DataParallel<Dtype>::sync {
+ public:
+  explicit sync(unsigned int count)
+      : init_(count), start_(count), done_(count), params_(count) {}
+  boost::barrier init_;
+  boost::barrier start_;
+  boost::barrier done_;
+  boost::barrier params_;
+};
+
+template <typename Dtype>
+void DataParallelWorker<Dtype>::InternalThreadEntry() {
+  parent_->WorkerEntry(index_);
+}
+
+template <typename Dtype>
+DataParallel<Dtype>::DataParallel(shared_ptr<Net<Dtype> > root_net,
+    const vector<int>& gpus)
+    : root_net_(root_net), gpus_(gpus), must_stop_(false) {
+  CHECK_GE(gpus_.size(), 2) << "DataParallel needs at least two GPUs";
+  CHECK_EQ(Caffe::mode(), Caffe::GPU)
+      << "DataParallel requires GPU mode";
+  // Serialize the root net (weights included) so each worker can build and
+  // initialize its replica on its own thread and device.
+  root_net_->ToProto(&net_param_, false);
+  const int replicas = gpus_.size();
+  replica_nets_.resize(replicas, static_cast<Net<Dtype>*>(NULL));
+  losses_.resize(replicas, Dtype(0));
+  sync_.reset(new sync(replicas));
+  workers_.resize(replicas);
+  for (int i = 1; i < replicas; ++i) {
+    workers_[i].reset(new DataParallelWorker<Dtype>(this, i));
+    CHECK(workers_[i]->StartInternalThread())
+        << "DataParallel worker start failed";
+  }
+  // Wait until every worker has built its replica.
+  sync_->init_.wait();
+  LOG(INFO) << "Data-parallel training on " << replicas << " GPUs";
+}
+
+template <typename Dtype>
+DataParallel<Dtype>::~DataParallel() {
+  // Workers idle at the start barrier; release them into their exit path.
+  must_stop_ = true;
+  sync_->start_.wait();
+  for (int i = 1; i < workers_.size(); ++i) {
+    workers_[i]->WaitForInternalThreadToExit();
+  }
+}
+
+template <typename Dtype>
+void DataParallel<Dtype>::WorkerEntry(int index) {
+  Caffe::SetDevice(gpus_[index]);
+  Caffe::set_mode(Caffe::GPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  // Build this replica on the worker's own device and load the root's
+  // starting weights.
+  Net<Dtype> net(net_param_);
+  net.CopyTrainedLayersFrom(net_param_);
+  replica_nets_[index] = &net;
+  const vector<shared_ptr<Blob<Dtype> > >& params = net.params();
+  const vector<shared_ptr<Blob<Dtype> > >& root_params = root_net_->params();
+  vector<Blob<Dtype>*> bottom_vec;
+  sync_->init_.wait();
+  while (true) {
+    sync_->start_.wait();
+    if (must_stop_) {
+      break;
+    }
+    // Layers accumulate parameter gradients, so each pass starts from zero.
+    net.ClearParamDiffs();
+    losses_[index] = net.ForwardBackward(bottom_vec);
+    // Stage the gradients host-side on this thread, so the root can read
+    // them without touching this replica's device context.
+    for (int i = 0; i < params.size(); ++i) {
+      params[i]->cpu_diff();
+    }
+    sync_->done_.wait();
+    // The root averages gradients and applies the solver update between
+    // these two barriers.
+    sync_->params_.wait();
+    for (int i = 0; i < params.size(); ++i) {
+      caffe_copy(params[i]->count(), root_params[i]->cpu_data(),
+          params[i]->mutable_cpu_data());
+    }
+  }
+  replica_nets_[index] = NULL;
+}
+
+template <typename Dtype>
+Dtype DataParallel<Dtype>::ForwardBackward(
+    const vector<Blob<Dtype>*>& bottom) {
+  sync_->start_.wait();
+  Dtype loss = root_net_->ForwardBackward(bottom);
+  sync_->done_.wait();
+  // Average gradients (and losses) over replicas through the host staging
+  // copies the workers just made.
+  const vector<shared_ptr<Blob<Dtype> > >& params = root_net_->params();
+  const Dtype scale = Dtype(1) / gpus_.size();
+  for (int i = 0; i < params.size(); ++i) {
+    Dtype* root_diff = params[i]->mutable_cpu_diff();
+    for (int r = 1; r < replica_nets_.size(); ++r) {
+      caffe_axpy(params[i]->count(), Dtype(1),
+          replica_nets_[r]->params()[i]->cpu_diff(), root_diff);
+    }
+    caffe_scal(params[i]->count(), scale, root_diff);
+  }
+  for (int r = 1; r < losses_.size(); ++r) {
+    loss += losses_[r];
+  }
+  return loss * scale;
+}
+
+template <typename Dtype>
+void DataParallel<Dtype>::BroadcastParams() {
+  // Stage the updated weights host-side, then let the workers pull them in.
+  // The workers finish copying before they re-enter the start barrier, so
+  // the staged data cannot be mutated underneath them.
+  const vector<shared_ptr<Blob<Dtype> > >& params = root_net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    params[i]->cpu_data();
+  }
+  sync_->params_.wait();
+}
+
+INSTANTIATE_CLASS(DataParallel);
+INSTANTIATE_CLASS(DataParallelWorker);
+
+template <typename Dtype>
+void AsyncParallelWorker<Dtype>::InternalThreadEntry() {
+  parent_->WorkerEntry(index_);
+}
+
+template <typename Dtype>
+AsyncParallel<Dtype>::AsyncParallel(shared_ptr<Net<Dtype> > root_net,
+    const SolverParameter& param)
+    : root_net_(root_net), param_(param) {
+  const int threads = param_.async_threads();
+  CHECK_GE(threads, 2) << "AsyncParallel needs at least two threads";
+  CHECK_EQ(Caffe::mode(), Caffe::CPU)
+      << "Hogwild training shares host memory and requires CPU mode";
+  workers_.resize(threads);
+  for (int i = 1; i < threads; ++i) {
+    workers_[i].reset(new AsyncParallelWorker<Dtype>(this, i));
+    CHECK(workers_[i]->StartInternalThread())
+        << "AsyncParallel worker start failed";
+  }
+  LOG(INFO) << "Asynchronous (Hogwild) training on " << threads
+      << " CPU threads";
+}
+
+template <typename Dtype>
+void AsyncParallel<Dtype>::Join() {
+  for (int i = 1; i < workers_.size(); ++i) {
+    workers_[i]->WaitForInternalThreadToExit();
+  }
+  workers_.clear();
+}
+
+template <typename Dtype>
+void AsyncParallel<Dtype>::WorkerEntry(int index) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  // The root solver owns display, testing and snapshotting; the workers
+  // train quietly.
+  SolverParameter worker_param = param_;
+  worker_param.set_display(0);
+  worker_param.clear_test_net();
+  worker_param.clear_test_net_param();
+  worker_param.clear_test_iter();
+  worker_param.clear_test_state();
+  worker_param.set_test_interval(0);
+  worker_param.set_test_initialization(false);
+  worker_param.set_snapshot(0);
+  worker_param.set_snapshot_after_train(false);
+  worker_param.clear_async_threads();
+  if (worker_param.random_seed() >= 0) {
+    // Decorrelate the workers' samplers while keeping runs repeatable.
+    worker_param.set_random_seed(worker_param.random_seed() + index);
+  }
+  shared_ptr<Solver<Dtype> > solver(GetSolver<Dtype>(worker_param));
+  // Hogwild: alias the replica's weights onto the root net's memory so
+  // this solver's updates land on the shared model.
+  solver->net()->ShareTrainedLayersWith(root_net_.get());
+  solver->Solve();
+}
+
+INSTANTIATE_CLASS(AsyncParallel);
+INSTANTIATE_CLASS(AsyncParallelWorker);
+
+namespace {
+
+// Wire format of one parameter-server message: this fixed header,
+// followed by `bytes` of raw blob payload. Workers and the server are
+// assumed to agree on Dtype and endianness.
+const uint32_t kParamMsgMagic = 0x0caffe50;
+enum ParamMsgType {
+  PARAM_MSG_HELLO = 0,   // worker -> server: request the current weights
+  PARAM_MSG_PUSH = 1,    // worker -> server: update values, weights wanted
+  PARAM_MSG_PARAMS = 2,  // server -> worker: current weights
+  PARAM_MSG_BYE = 3,     // worker -> server: orderly leave
+  // worker -> server: like PUSH, but the payload is a gradient codec
+  // message (util/gradient_compression.hpp), not a dense diff
+  PARAM_MSG_PUSH_COMPRESSED = 4
+};
+struct ParamMsgHeader {
+  uint32_t magic;
+  uint32_t type;
+  int64_t round;   // server clock on PARAMS; last seen clock on PUSH
+  uint64_t bytes;  // payload size following the header
+};
+
+// Total element count across a net's parameter blobs.
+template <typename Dtype>
+size_t TotalParamCount(const vector<shared_ptr<Blob<Dtype> > >& params) {
+  size_t count = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    count += params[i]->count();
+  }
+  return count;
+}
+
+}  // namespace
+
+SocketTransport::SocketTransport(int fd) : fd_(fd) {
+  // Push/pull round trips are latency bound; never delay the segments.
+  // Fails harmlessly on non-TCP descriptors such as test socketpairs.
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+SocketTransport::~SocketTransport() {
+  close(fd_);
+}
+
+void SocketTransport::Send(const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(fd_, ptr, size, MSG_NOSIGNAL);
+    CHECK_GT(sent, 0) << "Parameter-server send failed: " << strerror(errno);
+    ptr += sent;
+    size -= sent;
+  }
+}
+
+bool SocketTransport::Recv(void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  bool first = true;
+  while (size > 0) {
+    const ssize_t got = recv(fd_, ptr, size, 0);
+    if (got == 0 && first) {
+      return false;  // orderly shutdown between messages
+    }
+    CHECK_GT(got, 0) << "Parameter-server recv failed: "
+        << (got ? strerror(errno) : "peer closed mid-message");
+    ptr += got;
+    size -= got;
+    first = false;
+  }
+  return true;
+}
+
+namespace {
+const char kRdmaScheme[] = "rdma://";
+const size_t kRdmaSchemeLen = sizeof(kRdmaScheme) - 1;
+}  // namespace
+
+bool ParamServerUsesRdma(const string& address) {
+  return address.compare(0, kRdmaSchemeLen, kRdmaScheme) == 0;
+}
+
+string ParamServerHost(const string& address) {
+  const string stripped = ParamServerUsesRdma(address) ?
+      address.substr(kRdmaSchemeLen) : address;
+  const size_t colon = stripped.rfind(':');
+  CHECK_NE(colon, string::npos)
+      << "param_server must be host:port, got " << address;
+  return stripped.substr(0, colon);
+}
+
+int ParamServerPort(const string& address) {
+  const string stripped = ParamServerUsesRdma(address) ?
+      address.substr(kRdmaSchemeLen) : address;
+  const size_t colon = stripped.rfind(':');
+  CHECK_NE(colon, string::npos)
+      << "param_server must be host:port, got " << address;
+  const int port = atoi(stripped.substr(colon + 1).c_str());
+  CHECK_GT(port, 0) << "Invalid parameter-server port in " << address;
+  return port;
+}
+
+template <typename Dtype>
+ParamServer<Dtype>::ParamServer(
+    const vector<shared_ptr<Blob<Dtype> > >& params,
+    const SolverParameter& param, const int port)
+    : params_(params), param_(param), count_(TotalParamCount(params)),
+      round_(0), dropped_(0), pending_(0) {
+  CHECK_GE(param_.sync_workers(), 0);
+  CHECK_GE(param_.max_staleness(), 0);
+  recv_buffer_.resize(count_);
+  if (param_.sync_workers() > 0) {
+    sum_.resize(count_, Dtype(0));
+  }
+  compressor_.reset(GradientCompressor<Dtype>::Create(param_));
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd_, 0)
+      << "Parameter-server socket failed: " << strerror(errno);
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  CHECK_GE(bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr),
+      sizeof(addr)), 0)
+      << "Parameter server could not bind port " << port << ": "
+      << strerror(errno);
+  CHECK_GE(listen(listen_fd_, 64), 0)
+      << "Parameter-server listen failed: " << strerror(errno);
+  socklen_t addr_len = sizeof(addr);
+  CHECK_GE(getsockname(listen_fd_,
+      reinterpret_cast<struct sockaddr*>(&addr), &addr_len), 0)
+      << "Parameter-server getsockname failed: " << strerror(errno);
+  port_ = ntohs(addr.sin_port);
+#ifdef USE_RDMA
+  // RDMA_PS_TCP is its own port space, so the verbs listener can share
+  // the port number; workers pick the fabric with an rdma:// address.
+  rdma_listener_.reset(new RdmaListener(port_));
+#endif
+  LOG(INFO) << "Parameter server listening on port " << port_ << " with "
+      << count_ << " parameters, "
+      << (param_.sync_workers() > 0 ? "synchronous" : "asynchronous")
+      << " updates";
+}
+
+template <typename Dtype>
+ParamServer<Dtype>::~ParamServer() {
+  close(listen_fd_);
+}
+
+template <typename Dtype>
+void ParamServer<Dtype>::Run() {
+  bool served = false;
+  while (!served || !connections_.empty()) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listen_fd_, &readable);
+    int max_fd = listen_fd_;
+#ifdef USE_RDMA
+    if (rdma_listener_) {
+      FD_SET(rdma_listener_->poll_fd(), &readable);
+      max_fd = std::max(max_fd, rdma_listener_->poll_fd());
+    }
+#endif
+    for (int i = 0; i < connections_.size(); ++i) {
+      const int fd = connections_[i].transport->poll_fd();
+      FD_SET(fd, &readable);
+      max_fd = std::max(max_fd, fd);
+    }
+    const int ready = select(max_fd + 1, &readable, NULL, NULL, NULL);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GE(ready, 0)
+        << "Parameter-server select failed: " << strerror(errno);
+    if (FD_ISSET(listen_fd_, &readable)) {
+      const int fd = accept(listen_fd_, NULL, NULL);
+      CHECK_GE(fd, 0)
+          << "Parameter-server accept failed: " << strerror(errno);
+      Connection conn;
+      conn.transport.reset(new SocketTransport(fd));
+      conn.waiting = false;
+      connections_.push_back(conn);
+      served = true;
+      LOG(INFO) << "Parameter server: worker connected ("
+          << connections_.size() << " active)";
+    }
+#ifdef USE_RDMA
+    if (rdma_listener_ &&
+        FD_ISSET(rdma_listener_->poll_fd(), &readable)) {
+      shared_ptr<ParamTransport> transport = rdma_listener_->Accept();
+      if (transport) {
+        Connection conn;
+        conn.transport = transport;
+        conn.waiting = false;
+        connections_.push_back(conn);
+        served = true;
+        LOG(INFO) << "Parameter server: worker connected over RDMA ("
+            << connections_.size() << " active)";
+      }
+    }
+#endif
+    // Iterate backwards so dropped connections can be erased in place.
+    for (int i = connections_.size() - 1; i >= 0; --i) {
+      if (!FD_ISSET(connections_[i].transport->poll_fd(), &readable)) {
+        continue;
+      }
+      if (!HandleMessage(i)) {
+        if (connections_[i].waiting) {
+          LOG(WARNING) << "Parameter server: worker left mid-round; the "
+              << "synchronous round keeps its pushed update";
+        }
+        connections_.erase(connections_.begin() + i);
+        LOG(INFO) << "Parameter server: worker disconnected ("
+            << connections_.size() << " active)";
+      }
+    }
+  }
+  LOG(INFO) << "Parameter server done after " << round_ << " rounds ("
+      << dropped_ << " stale pushes dropped)";
+}
+
+template <typename Dtype>
+bool ParamServer<Dtype>::HandleMessage(const int index) {
+  Connection& conn = connections_[index];
+  ParamMsgHeader header;
+  if (!conn.transport->Recv(&header, sizeof(header))) {
+    return false;
+  }
+  CHECK_EQ(header.magic, kParamMsgMagic)
+      << "Corrupt parameter-server message";
+  switch (header.type) {
+  case PARAM_MSG_HELLO:
+    SendParams(conn);
+    break;
+  case PARAM_MSG_BYE:
+    return false;
+  case PARAM_MSG_PUSH:
+  case PARAM_MSG_PUSH_COMPRESSED:
+    RecvPush(conn, header.bytes,
+        header.type == PARAM_MSG_PUSH_COMPRESSED);
+    if (param_.sync_workers() > 0) {
+      // Gather this round's pushes; apply their average when complete.
+      caffe_axpy(static_cast<int>(count_), Dtype(1), &recv_buffer_[0],
+          &sum_[0]);
+      conn.waiting = true;
+      if (++pending_ == param_.sync_workers()) {
+        ApplyDiff(&sum_[0], Dtype(1) / param_.sync_workers());
+        caffe_set(static_cast<int>(count_), Dtype(0), &sum_[0]);
+        pending_ = 0;
+        ++round_;
+        for (int i = 0; i < connections_.size(); ++i) {
+          if (connections_[i].waiting) {
+            connections_[i].waiting = false;
+            SendParams(connections_[i]);
+          }
+        }
+      }
+    } else {
+      if (round_ - header.round > param_.max_staleness()) {
+        // Computed against weights too many rounds old; do not let it
+        // drag the master copy backwards.
+        ++dropped_;
+      } else {
+        ApplyDiff(&recv_buffer_[0], Dtype(1));
+        ++round_;
+      }
+      SendParams(conn);
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown parameter-server message type " << header.type;
+  }
+  return true;
+}
+
+template <typename Dtype>
+void ParamServer<Dtype>::RecvPush(const Connection& conn,
+    const uint64_t bytes, const bool compressed) {
+  if (compressed) {
+    CHECK(compressor_) << "Worker pushed compressed gradients but this "
+        << "server runs with gradient_compression COMPRESS_NONE";
+    CHECK_GT(bytes, 0) << "Empty compressed push";
+    payload_.resize(bytes);
+    CHECK(conn.transport->Recv(&payload_[0], bytes))
+        << "Worker closed the connection mid-push";
+    compressor_->Decompress(&payload_[0], bytes,
+        static_cast<int>(count_), &recv_buffer_[0]);
+  } else {
+    CHECK_EQ(bytes, count_ * sizeof(Dtype))
+        << "Worker pushed a diff of the wrong size";
+    CHECK(conn.transport->Recv(&recv_buffer_[0], bytes))
+        << "Worker closed the connection mid-push";
+  }
+}
+
+template <typename Dtype>
+void ParamServer<Dtype>::SendParams(const Connection& conn) {
+  ParamMsgHeader header;
+  header.magic = kParamMsgMagic;
+  header.type = PARAM_MSG_PARAMS;
+  header.round = round_;
+  header.bytes = count_ * sizeof(Dtype);
+  conn.transport->Send(&header, sizeof(header));
+  for (int i = 0; i < params_.size(); ++i) {
+    conn.transport->Send(params_[i]->cpu_data(),
+        params_[i]->count() * sizeof(Dtype));
+  }
+}
+
+template <typename Dtype>
+void ParamServer<Dtype>::ApplyDiff(const Dtype* diff, const Dtype scale) {
+  size_t offset = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    // Mirror Blob::Update: weights -= update values.
+    caffe_axpy(params_[i]->count(), -scale, diff + offset,
+        params_[i]->mutable_cpu_data());
+    offset += params_[i]->count();
+  }
+}
+
+template <typename Dtype>
+ParamServerClient<Dtype>::ParamServerClient(const string& address,
+    const vector<shared_ptr<Blob<Dtype> > >& params,
+    const SolverParameter& solver_param)
+    : params_(params), count_(TotalParamCount(params)), round_(0) {
+  compressor_.reset(GradientCompressor<Dtype>::Create(solver_param));
+  const string host = ParamServerHost(address);
+  if (ParamServerUsesRdma(address)) {
+#ifdef USE_RDMA
+    transport_ = RdmaTransport::Connect(host, ParamServerPort(address));
+    LOG(INFO) << "Connected to parameter server " << address;
+    return;
+#else
+    LOG(FATAL) << "Cannot reach " << address
+        << ": this build has no RDMA support (set USE_RDMA)";
+#endif
+  }
+  const string port = address.substr(address.rfind(':') + 1);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = NULL;
+  const int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+  CHECK_EQ(error, 0) << "Could not resolve parameter server " << address
+      << ": " << gai_strerror(error);
+  const int fd = socket(result->ai_family, result->ai_socktype,
+      result->ai_protocol);
+  CHECK_GE(fd, 0)
+      << "Parameter-server socket failed: " << strerror(errno);
+  CHECK_GE(connect(fd, result->ai_addr, result->ai_addrlen), 0)
+      << "Could not connect to parameter server " << address << ": "
+      << strerror(errno);
+  freeaddrinfo(result);
+  transport_.reset(new SocketTransport(fd));
+  LOG(INFO) << "Connected to parameter server " << address;
+}
+
+template <typename Dtype>
+ParamServerClient<Dtype>::ParamServerClient(
+    shared_ptr<ParamTransport> transport,
+    const vector<shared_ptr<Blob<Dtype> > >& params,
+    const SolverParameter& solver_param)
+    : transport_(transport), params_(params),
+      count_(TotalParamCount(params)), round_(0) {
+  compressor_.reset(GradientCompressor<Dtype>::Create(solver_param));
+}
+
+template <typename Dtype>
+ParamServerClient<Dtype>::~ParamServerClient() {
+  ParamMsgHeader header;
+  header.magic = kParamMsgMagic;
+  header.type = PARAM_MSG_BYE;
+  header.round = round_;
+  header.bytes = 0;
+  transport_->Send(&header, sizeof(header));
+}
+
+template <typename Dtype>
+void ParamServerClient<Dtype>::PullParams() {
+  ParamMsgHeader header;
+  header.magic = kParamMsgMagic;
+  header.type = PARAM_MSG_HELLO;
+  header.round = round_;
+  header.bytes = 0;
+  transport_->Send(&header, sizeof(header));
+  ReceiveParams();
+}
+
+template <typename Dtype>
+void ParamServerClient<Dtype>::PushPull() {
+  ParamMsgHeader header;
+  header.magic = kParamMsgMagic;
+  header.round = round_;
+  if (compressor_) {
+    // Gather the diffs dense and push the encoded payload instead. The
+    // codec runs on the host, so this path always stages through the
+    // CPU mirrors; the bytes saved on the wire dwarf the gather cost.
+    send_buffer_.resize(count_);
+    size_t offset = 0;
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_copy(params_[i]->count(), params_[i]->cpu_diff(),
+          &send_buffer_[offset]);
+      offset += params_[i]->count();
+    }
+    compressor_->Compress(&send_buffer_[0], static_cast<int>(count_),
+        &payload_);
+    header.type = PARAM_MSG_PUSH_COMPRESSED;
+    header.bytes = payload_.size();
+    transport_->Send(&header, sizeof(header));
+    transport_->Send(&payload_[0], payload_.size());
+    ReceiveParams();
+    return;
+  }
+  header.type = PARAM_MSG_PUSH;
+  header.bytes = count_ * sizeof(Dtype);
+  transport_->Send(&header, sizeof(header));
+  // A transport that registers device memory (RDMA with GPUDirect) can
+  // take the diffs straight from the GPU, NIC-to-device; otherwise go
+  // through the host mirror as usual.
+  const bool device = transport_->supports_device_memory() &&
+      Caffe::mode() == Caffe::GPU;
+  for (int i = 0; i < params_.size(); ++i) {
+    transport_->Send(
+        device ? params_[i]->gpu_diff() : params_[i]->cpu_diff(),
+        params_[i]->count() * sizeof(Dtype));
+  }
+  ReceiveParams();
+}
+
+template <typename Dtype>
+void ParamServerClient<Dtype>::ReceiveParams() {
+  ParamMsgHeader header;
+  CHECK(transport_->Recv(&header, sizeof(header)))
+      << "Parameter server closed the connection";
+  CHECK_EQ(header.magic, kParamMsgMagic)
+      << "Corrupt parameter-server message";
+  CHECK_EQ(header.type, PARAM_MSG_PARAMS)
+      << "Unexpected parameter-server message type " << header.type;
+  CHECK_EQ(header.bytes, count_ * sizeof(Dtype))
+      << "Parameter count mismatch with the server";
+  const bool device = transport_->supports_device_memory() &&
+      Caffe::mode() == Caffe::GPU;
+  for (int i = 0; i < params_.size(); ++i) {
+    CHECK(transport_->Recv(
+        device ? params_[i]->mutable_gpu_data()
+               : params_[i]->mutable_cpu_data(),
+        params_[i]->count() * sizeof(Dtype)))
+        << "Parameter server closed the connection mid-reply";
+  }
+  round_ = header.round;
+}
+
+INSTANTIATE_CLASS(ParamServer);
+INSTANTIATE_CLASS(ParamServerClient);
+
+}  // namespace caffe
@@ -1,3 +1,6 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <cstdio>
 
 #include <algorithm>
@@ -7,8 +10,13 @@
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/mmap_model.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/tracing.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -32,6 +40,8 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   LOG(INFO) << "Initializing solver from parameters: " << std::endl
             << param.DebugString();
   param_ = param;
+  telemetry_window_images_ = 0;
+  deltas_since_base_ = 0;
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed());
   }
@@ -151,7 +161,103 @@ void Solver<Dtype>::InitTestNets() {
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     test_nets_[i].reset(new Net<Dtype>(net_params[i]));
+    if (!param_.test_async()) {
+      // Inline testing alternates with training on one thread, so each
+      // test net can permanently alias the training net's parameter
+      // memory and run inside its activation buffers: a test forward
+      // scribbles over activations the next training iteration
+      // recomputes anyway. Asynchronous testing runs concurrently with
+      // training and must keep private storage; TestAll stages a deep
+      // weight copy into it instead.
+      test_nets_[i]->ShareTrainedLayersWith(net_.get());
+      test_nets_[i]->ShareActivationsWith(net_.get());
+    }
+  }
+}
+
+template <typename Dtype>
+Dtype Solver<Dtype>::ForwardBackward(const vector<Blob<Dtype>*>& bottom) {
+  if (data_parallel_) {
+    return data_parallel_->ForwardBackward(bottom);
+  }
+  return net_->ForwardBackward(bottom);
+}
+
+// Smoothing factor of the telemetry moving averages: each iteration
+// contributes 5%, so the averages settle over a few dozen iterations but
+// still track sustained shifts.
+const double kTelemetryEmaWeight = 0.05;
+
+template <typename Dtype>
+void Solver<Dtype>::UpdateTelemetry(const float data_ms,
+    const float forward_ms, const float backward_ms, const float update_ms,
+    const int images) {
+  const double total_ms = data_ms + forward_ms + backward_ms + update_ms;
+  if (telemetry_.iterations == 0) {
+    telemetry_.data_ms = data_ms;
+    telemetry_.forward_ms = forward_ms;
+    telemetry_.backward_ms = backward_ms;
+    telemetry_.update_ms = update_ms;
+    telemetry_.iteration_ms = total_ms;
+  } else {
+    const double w = kTelemetryEmaWeight;
+    telemetry_.data_ms += w * (data_ms - telemetry_.data_ms);
+    telemetry_.forward_ms += w * (forward_ms - telemetry_.forward_ms);
+    telemetry_.backward_ms += w * (backward_ms - telemetry_.backward_ms);
+    telemetry_.update_ms += w * (update_ms - telemetry_.update_ms);
+    telemetry_.iteration_ms += w * (total_ms - telemetry_.iteration_ms);
   }
+  ++telemetry_.iterations;
+  telemetry_window_ms_.push_back(total_ms);
+  telemetry_window_images_ += images;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::LogTelemetry() {
+  if (telemetry_window_ms_.empty()) { return; }
+  vector<float> sorted(telemetry_window_ms_);
+  std::sort(sorted.begin(), sorted.end());
+  const int n = sorted.size();
+  telemetry_.iteration_ms_p50 = sorted[n / 2];
+  telemetry_.iteration_ms_p90 = sorted[std::min(n - 1, (n * 9) / 10)];
+  telemetry_.iteration_ms_max = sorted[n - 1];
+  double window_ms = 0;
+  for (int i = 0; i < n; ++i) {
+    window_ms += sorted[i];
+  }
+  telemetry_.images_per_second = window_ms > 0 ?
+      1000.0 * telemetry_window_images_ / window_ms : 0;
+  // The data layers' own window: the fraction of the interval the
+  // forwards spent blocked waiting for a batch ("idle waiting for
+  // data"), and how loaded the prefetch threads were.
+  double wait_ms = 0, busy_ms = 0, period_ms = 0;
+  if (net_->PrefetchTiming(true, &wait_ms, &busy_ms, &period_ms) &&
+      period_ms > 0) {
+    telemetry_.data_wait_fraction = wait_ms / period_ms;
+    telemetry_.prefetch_load_fraction = busy_ms / period_ms;
+  } else {
+    telemetry_.data_wait_fraction = 0;
+    telemetry_.prefetch_load_fraction = 0;
+  }
+  // One greppable key=value line per window, for dashboards to scrape.
+  LOG(INFO) << "Telemetry iter=" << iter_
+      << " images_per_s=" << telemetry_.images_per_second
+      << " data_ms=" << telemetry_.data_ms
+      << " forward_ms=" << telemetry_.forward_ms
+      << " backward_ms=" << telemetry_.backward_ms
+      << " update_ms=" << telemetry_.update_ms
+      << " iter_ms=" << telemetry_.iteration_ms
+      << " iter_ms_p50=" << telemetry_.iteration_ms_p50
+      << " iter_ms_p90=" << telemetry_.iteration_ms_p90
+      << " iter_ms_max=" << telemetry_.iteration_ms_max
+      << " data_wait=" << telemetry_.data_wait_fraction
+      << " prefetch_load=" << telemetry_.prefetch_load_fraction;
+  // Hand the window's measurements to the thread-budget coordinator
+  // (a no-op unless thread_budget is set).
+  Caffe::BalanceThreads(telemetry_.data_wait_fraction,
+      telemetry_.images_per_second);
+  telemetry_window_ms_.clear();
+  telemetry_window_images_ = 0;
 }
 
 template <typename Dtype>
@@ -159,6 +265,20 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   Caffe::set_phase(Caffe::TRAIN);
   LOG(INFO) << "Solving " << net_->name();
   LOG(INFO) << "Learning Rate Policy: " << param_.lr_policy();
+  if (param_.thread_budget() != 0) {
+    CHECK_GT(param_.telemetry_interval(), 0)
+        << "thread_budget balances on the telemetry windows; "
+        << "set telemetry_interval > 0";
+    Caffe::SetThreadBudget(param_.thread_budget());
+  }
+  if (param_.snapshot_stream()) {
+    // Streaming serializes the live weights on the training thread and
+    // writes plain NetParameter wire format.
+    CHECK(!param_.snapshot_async())
+        << "snapshot_stream does not compose with snapshot_async";
+    CHECK(!param_.snapshot_compress())
+        << "snapshot_stream does not compose with snapshot_compress";
+  }
   PreSolve();
 
   iter_ = 0;
@@ -178,10 +298,58 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   vector<Dtype> losses;
   Dtype smoothed_loss = 0;
 
+  // Spin up the data-parallel replica group if several GPUs are configured.
+  if (param_.gpu_size() > 1) {
+    CHECK_EQ(Caffe::mode(), Caffe::GPU)
+        << "Multi-GPU training requires GPU mode";
+    // DataParallel averages the replica gradients into the root diff every
+    // pass, which does not compose with accumulating over several passes.
+    CHECK_EQ(param_.iter_size(), 1)
+        << "iter_size > 1 is not supported with multi-GPU training";
+    vector<int> gpus(param_.gpu().begin(), param_.gpu().end());
+    data_parallel_.reset(new DataParallel<Dtype>(net_, gpus));
+  }
+
+  // Attach to the parameter server when one is configured. Training then
+  // starts from the master weights, not this worker's own initialization,
+  // so every worker optimizes the same model.
+  if (param_.has_param_server()) {
+    param_client_.reset(new ParamServerClient<Dtype>(param_.param_server(),
+        net_->params(), param_));
+    param_client_->PullParams();
+  }
+
+  // Start the Hogwild worker solvers; this thread acts as worker 0 and
+  // runs the ordinary loop below against the shared weights.
+  if (param_.async_threads() > 1) {
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "Asynchronous training requires CPU mode";
+    // PushPull overwrites the shared weights with the master copy, which
+    // would silently discard the other workers' concurrent updates.
+    CHECK(!param_.has_param_server())
+        << "async_threads does not compose with param_server; run one "
+        << "worker process per thread instead";
+    async_parallel_.reset(new AsyncParallel<Dtype>(net_, param_));
+  }
+
+  // Turn on the cross-thread timeline recorder; every CAFFE_TRACE_SCOPE
+  // hit from here on (layers, prefetch, updates) lands in the trace file.
+  if (param_.has_trace_filename()) {
+    Tracer::Get().set_enabled(true);
+  }
+  const bool telemetry = param_.telemetry_interval() > 0;
+  telemetry_ = SolverTelemetry();
+  telemetry_window_ms_.clear();
+  telemetry_window_images_ = 0;
+
   // For a network that is trained by the solver, no bottom or top vecs
   // should be given, and we will just provide dummy vecs.
   vector<Blob<Dtype>*> bottom_vec;
   for (; iter_ < param_.max_iter(); ++iter_) {
+    CAFFE_TRACE_SCOPE("iteration");
+    for (int i = 0; i < callbacks_.size(); ++i) {
+      callbacks_[i]->on_iteration_start(iter_);
+    }
     // Save a snapshot if needed.
     if (param_.snapshot() && iter_ > start_iter &&
         iter_ % param_.snapshot() == 0) {
@@ -195,7 +363,59 @@ void Solver<Dtype>::Solve(const char* resume_file) {
 
     const bool display = param_.display() && iter_ % param_.display() == 0;
     net_->set_debug_info(display && param_.debug_info());
-    Dtype loss = net_->ForwardBackward(bottom_vec);
+    net_->set_debug_info_sample_stride(param_.debug_info_sample_stride());
+    // Accumulate gradients (and average the loss) over iter_size passes,
+    // for an effective batch of iter_size x batch_size.
+    net_->ClearParamDiffs();
+    Dtype loss = 0;
+    float data_ms = 0, forward_ms = 0, backward_ms = 0, update_ms = 0;
+    if (telemetry && !data_parallel_) {
+      // Split the pass so the breakdown can tell a starved input pipeline
+      // from slow math: an empty prefetch queue blocks in the data
+      // layer's forward, measured here separately from the rest.
+      Timer timer;
+      const int last_layer = net_->layers().size() - 1;
+      for (int i = 0; i < param_.iter_size(); ++i) {
+        timer.Start();
+        {
+          CAFFE_NVTX_RANGE("caffe::data_wait");
+          loss += net_->ForwardFromTo(0, 0);
+        }
+        timer.Stop();
+        data_ms += timer.MicroSeconds() / 1000;
+        if (last_layer > 0) {
+          timer.Start();
+          loss += net_->ForwardFromTo(1, last_layer);
+          timer.Stop();
+          forward_ms += timer.MicroSeconds() / 1000;
+        }
+        timer.Start();
+        net_->Backward();
+        timer.Stop();
+        backward_ms += timer.MicroSeconds() / 1000;
+      }
+    } else if (telemetry) {
+      // The replica group runs forward and backward inside its workers;
+      // only the combined time is visible here.
+      Timer timer;
+      timer.Start();
+      for (int i = 0; i < param_.iter_size(); ++i) {
+        loss += ForwardBackward(bottom_vec);
+      }
+      timer.Stop();
+      forward_ms = timer.MicroSeconds() / 1000;
+    } else {
+      for (int i = 0; i < param_.iter_size(); ++i) {
+        loss += ForwardBackward(bottom_vec);
+      }
+    }
+    loss /= param_.iter_size();
+    for (int i = 0; i < callbacks_.size(); ++i) {
+      callbacks_[i]->on_forward_done(iter_, loss);
+    }
+    if (param_.iter_size() > 1) {
+      net_->ScaleParamDiffs(Dtype(1) / param_.iter_size());
+    }
     if (losses.size() < average_loss) {
       losses.push_back(loss);
       int size = losses.size();
@@ -228,9 +448,49 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       }
     }
 
-    ComputeUpdateValue();
-    net_->Update();
+    Timer update_timer;
+    if (telemetry) { update_timer.Start(); }
+    {
+      CAFFE_NVTX_RANGE("caffe::update");
+      CAFFE_TRACE_SCOPE("update");
+      ComputeUpdateValue();
+      if (param_client_) {
+        // The master applies this worker's update values and sends back the
+        // refreshed weights; nothing is applied locally.
+        param_client_->PushPull();
+      } else {
+        net_->Update();
+      }
+      if (data_parallel_) {
+        data_parallel_->BroadcastParams();
+      }
+    }
+    for (int i = 0; i < callbacks_.size(); ++i) {
+      callbacks_[i]->on_update_done(iter_);
+    }
+    if (telemetry) {
+      update_timer.Stop();
+      update_ms = update_timer.MicroSeconds() / 1000;
+      // Images per pass: the data layer's first top is the image batch.
+      const int batch = net_->top_vecs()[0].empty() ? 0 :
+          net_->top_vecs()[0][0]->num();
+      UpdateTelemetry(data_ms, forward_ms, backward_ms, update_ms,
+          batch * param_.iter_size());
+      if ((iter_ + 1) % param_.telemetry_interval() == 0) {
+        LogTelemetry();
+      }
+    }
+    for (int i = 0; i < callbacks_.size(); ++i) {
+      callbacks_[i]->on_iteration_end(iter_, smoothed_loss);
+    }
   }
+  // Stop the replica threads and leave the parameter server before the
+  // final display passes below.
+  data_parallel_.reset();
+  param_client_.reset();
+  // Wait for the other Hogwild workers so the snapshot below captures
+  // their final updates too.
+  async_parallel_.reset();
   // Always save a snapshot after optimization, unless overridden by setting
   // snapshot_after_train := false.
   if (param_.snapshot_after_train()) { Snapshot(); }
@@ -248,25 +508,83 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  // The final evaluation has no training left to overlap with; wait for
+  // it to report before declaring the run done.
+  WaitForTest();
+  if (param_.has_trace_filename()) {
+    Tracer::Get().set_enabled(false);
+    Tracer::Get().WriteTraceFile(param_.trace_filename());
+  }
   LOG(INFO) << "Optimization Done.";
 }
 
 
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  if (param_.test_async()) {
+    // Only one evaluation may be in flight: it owns the test nets while
+    // it runs, and joining here keeps the result logs in iteration order.
+    WaitForTest();
+    // Stage the current weights into the test nets with a deep copy;
+    // training keeps mutating the live net while the evaluation runs, so
+    // the test nets cannot share its memory as on the inline path below.
+    NetParameter staged;
+    net_->ToProto(&staged, false);
+    for (int i = 0; i < test_nets_.size(); ++i) {
+      CHECK_NOTNULL(test_nets_[i].get())->CopyTrainedLayersFrom(staged);
+    }
+    int device = 0;
+    if (Caffe::mode() == Caffe::GPU) {
+      CUDA_CHECK(cudaGetDevice(&device));
+    }
+    test_thread_.reset(new boost::thread(&Solver<Dtype>::TestAllEntry,
+        this, iter_, Caffe::mode(), device));
+    return;
+  }
   for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
     Test(test_net_id);
   }
 }
 
+// Runs the staged test nets on the evaluation thread. The Caffe
+// singleton is thread local, so the mode, device and phase have to be
+// set up again here; the training thread's phase is untouched.
+template <typename Dtype>
+void Solver<Dtype>::TestAllEntry(const int iter, const Caffe::Brew mode,
+    const int device) {
+  Caffe::set_mode(mode);
+  if (mode == Caffe::GPU) {
+    Caffe::SetDevice(device);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
+    RunTest(test_net_id, iter);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForTest() {
+  if (test_thread_) {
+    test_thread_->join();
+    test_thread_.reset();
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Test(const int test_net_id) {
-  LOG(INFO) << "Iteration " << iter_
-            << ", Testing net (#" << test_net_id << ")";
-  // We need to set phase to test before running.
+  // We need to set phase to test before running. The test net already
+  // shares the training net's weights and activation memory; it was
+  // wired up that way in InitTestNets.
   Caffe::set_phase(Caffe::TEST);
-  CHECK_NOTNULL(test_nets_[test_net_id].get())->
-      ShareTrainedLayersWith(net_.get());
+  RunTest(test_net_id, iter_);
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::RunTest(const int test_net_id, const int iter) {
+  CAFFE_NVTX_RANGE("caffe::test");
+  LOG(INFO) << "Iteration " << iter
+            << ", Testing net (#" << test_net_id << ")";
   vector<Dtype> test_score;
   vector<int> test_score_output_id;
   vector<Blob<Dtype>*> bottom_vec;
@@ -315,46 +633,262 @@ void Solver<Dtype>::Test(const int test_net_id) {
     LOG(INFO) << "    Test net output #" << i << ": " << output_name << " = "
         << mean_score << loss_msg_stream.str();
   }
-  Caffe::set_phase(Caffe::TRAIN);
+  for (int i = 0; i < callbacks_.size(); ++i) {
+    callbacks_[i]->on_test_done(iter, test_net_id, loss);
+  }
 }
 
 
+// Writes one snapshot's model and state files; with snapshot_async this
+// runs on a background thread while training continues. At most one of
+// net_param and net_delta is set: the full weights, or the compact
+// delta written in their place (snapshot_deltas). Both are empty when
+// the model was already streamed to disk (snapshot_stream).
+static void WriteSnapshotFiles(shared_ptr<NetParameter> net_param,
+    shared_ptr<NetDelta> net_delta, const string model_filename,
+    shared_ptr<SolverState> state, const string snapshot_filename,
+    const bool compress, const bool state_mmap) {
+  if (net_delta) {
+    if (compress) {
+      WriteProtoToCompressedBinaryFile(*net_delta, model_filename.c_str());
+    } else {
+      WriteProtoToBinaryFile(*net_delta, model_filename.c_str());
+    }
+  } else if (net_param) {
+    if (compress) {
+      WriteProtoToCompressedBinaryFile(*net_param, model_filename.c_str());
+    } else {
+      WriteProtoToBinaryFile(*net_param, model_filename.c_str());
+    }
+  }
+  if (state_mmap) {
+    WriteSolverStateToMMapFile(*state, snapshot_filename);
+  } else if (compress) {
+    WriteProtoToCompressedBinaryFile(*state, snapshot_filename.c_str());
+  } else {
+    WriteProtoToBinaryFile(*state, snapshot_filename.c_str());
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
-  NetParameter net_param;
-  // For intermediate results, we will also dump the gradient values.
-  net_->ToProto(&net_param, param_.snapshot_diff());
+  CAFFE_NVTX_RANGE("caffe::snapshot");
+  // Only one snapshot may be in flight: its staging protos bound the extra
+  // memory, and joining here keeps snapshots ordered on disk.
+  WaitForSnapshot();
   string filename(param_.snapshot_prefix());
   string model_filename, snapshot_filename;
   const int kBufferSize = 20;
   char iter_str_buffer[kBufferSize];
   snprintf(iter_str_buffer, kBufferSize, "_iter_%d", iter_);
   filename += iter_str_buffer;
-  model_filename = filename + ".caffemodel";
-  LOG(INFO) << "Snapshotting to " << model_filename;
-  WriteProtoToBinaryFile(net_param, model_filename.c_str());
-  SolverState state;
-  SnapshotSolverState(&state);
-  state.set_iter(iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(current_step_);
+  // Write a compact delta against the last full base while the
+  // configured run of deltas lasts, a full snapshot otherwise.
+  shared_ptr<NetParameter> net_param;
+  shared_ptr<NetDelta> net_delta;
+  if (param_.snapshot_deltas() > 0 && !snapshot_base_filename_.empty() &&
+      deltas_since_base_ < param_.snapshot_deltas()) {
+    net_delta.reset(new NetDelta);
+    FillSnapshotDelta(net_delta.get());
+    ++deltas_since_base_;
+    model_filename = filename + ".caffedelta";
+  } else {
+    model_filename = filename + ".caffemodel";
+    if (param_.snapshot_stream()) {
+      // Stream the weights straight to disk, layer by layer; there is
+      // no staged copy to hand to a writer thread.
+      LOG(INFO) << "Streaming snapshot to " << model_filename;
+      net_->ToBinaryFile(model_filename, param_.snapshot_diff(),
+          param_.snapshot_half());
+    } else {
+      net_param.reset(new NetParameter);
+      // For intermediate results, we will also dump the gradient values.
+      net_->ToProto(net_param.get(), param_.snapshot_diff(),
+          param_.snapshot_half());
+    }
+    if (param_.snapshot_deltas() > 0) {
+      // This snapshot becomes the base the next deltas diff against.
+      const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+      snapshot_base_.clear();
+      for (int i = 0; i < params.size(); ++i) {
+        snapshot_base_.insert(snapshot_base_.end(), params[i]->cpu_data(),
+            params[i]->cpu_data() + params[i]->count());
+      }
+      snapshot_base_filename_ = model_filename;
+      deltas_since_base_ = 0;
+    }
+  }
+  shared_ptr<SolverState> state(new SolverState);
+  SnapshotSolverState(state.get());
+  state->set_iter(iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(current_step_);
+  // The data layers' read positions, so Restore can resume mid-epoch in
+  // the exact data order instead of replaying rand_skip stepping.
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+  for (int i = 0; i < layers.size(); ++i) {
+    const string key = layers[i]->data_cursor_key();
+    if (key.empty()) { continue; }
+    DataCursorState* cursor = state->add_data_cursor();
+    cursor->set_layer(net_->layer_names()[i]);
+    cursor->set_key(key);
+  }
   snapshot_filename = filename + ".solverstate";
-  LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  if (param_.snapshot_async()) {
+    // The weights and state are already staged into the protos above, so
+    // serialization and file I/O can proceed off the training thread.
+    LOG(INFO) << "Snapshotting asynchronously to " << model_filename
+        << " and " << snapshot_filename;
+    snapshot_thread_.reset(new boost::thread(&WriteSnapshotFiles,
+        net_param, net_delta, model_filename, state, snapshot_filename,
+        param_.snapshot_compress(), param_.snapshot_state_mmap()));
+  } else {
+    LOG(INFO) << "Snapshotting to " << model_filename;
+    LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
+    WriteSnapshotFiles(net_param, net_delta, model_filename, state,
+        snapshot_filename, param_.snapshot_compress(),
+        param_.snapshot_state_mmap());
+  }
+  for (int i = 0; i < callbacks_.size(); ++i) {
+    callbacks_[i]->on_snapshot(iter_, model_filename);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshot() {
+  if (snapshot_thread_) {
+    snapshot_thread_->join();
+    snapshot_thread_.reset();
+  }
+}
+
+// Granularity of the delta comparison, in elements. Small enough that
+// a layer with a few stale filters is not dragged in whole, large
+// enough that the per-block proto overhead stays negligible.
+static const int kDeltaBlockElements = 4096;
+
+template <typename Dtype>
+void Solver<Dtype>::FillSnapshotDelta(NetDelta* delta) {
+  delta->set_base(snapshot_base_filename_);
+  delta->set_iter(iter_);
+  delta->set_param_count(snapshot_base_.size());
+  const Dtype threshold = param_.snapshot_delta_threshold();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  // Scan the parameters block by block against the base copy; with the
+  // contiguous parameter arena this walks one flat array in order.
+  // Blocks restart at every blob so none straddles a boundary.
+  size_t offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    const Dtype* data = params[i]->cpu_data();
+    const int count = params[i]->count();
+    for (int start = 0; start < count; start += kDeltaBlockElements) {
+      const int length = std::min(kDeltaBlockElements, count - start);
+      const Dtype* base = &snapshot_base_[offset + start];
+      Dtype drift = 0;
+      for (int j = 0; j < length; ++j) {
+        drift = std::max(drift, std::abs(data[start + j] - base[j]));
+      }
+      if (drift <= threshold) { continue; }
+      NetDeltaBlock* block = delta->add_block();
+      block->set_offset(offset + start);
+      block->set_data(data + start, length * sizeof(Dtype));
+    }
+    offset += count;
+  }
+  CHECK_EQ(offset, snapshot_base_.size());
+}
+
+template <typename Dtype>
+void Solver<Dtype>::RestoreNet(const string& learned_net) {
+  NetParameter net_param;
+  const string kDeltaSuffix = ".caffedelta";
+  if (learned_net.size() > kDeltaSuffix.size() &&
+      learned_net.compare(learned_net.size() - kDeltaSuffix.size(),
+          kDeltaSuffix.size(), kDeltaSuffix) == 0) {
+    NetDelta delta;
+    ReadProtoFromBinaryFile(learned_net.c_str(), &delta);
+    ReadProtoFromBinaryFile(delta.base().c_str(), &net_param);
+    net_->CopyTrainedLayersFrom(net_param);
+    ApplyNetDelta(delta);
+    return;
+  }
+  ReadProtoFromBinaryFile(learned_net.c_str(), &net_param);
+  net_->CopyTrainedLayersFrom(net_param);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ApplyNetDelta(const NetDelta& delta) {
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  size_t total = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    total += params[i]->count();
+  }
+  CHECK_EQ(delta.param_count(), total)
+      << "Delta snapshot does not match this net's parameter count";
+  // Blocks arrive in offset order and never straddle a blob, so one
+  // forward walk over the blobs places each with a single copy.
+  int param_id = 0;
+  size_t param_start = 0;
+  for (int i = 0; i < delta.block_size(); ++i) {
+    const NetDeltaBlock& block = delta.block(i);
+    const size_t length = block.data().size() / sizeof(Dtype);
+    while (param_id < params.size() &&
+        param_start + params[param_id]->count() <= block.offset()) {
+      param_start += params[param_id]->count();
+      ++param_id;
+    }
+    CHECK_LT(param_id, params.size()) << "Delta block past the last blob";
+    CHECK_LE(block.offset() - param_start + length,
+        static_cast<size_t>(params[param_id]->count()))
+        << "Delta block straddles a blob boundary";
+    caffe_copy(static_cast<int>(length),
+        reinterpret_cast<const Dtype*>(block.data().data()),
+        params[param_id]->mutable_cpu_data() +
+            (block.offset() - param_start));
+  }
 }
 
 template <typename Dtype>
 void Solver<Dtype>::Restore(const char* state_file) {
+  if (IsMMapSolverStateFile(state_file)) {
+    // Mapped container: only the small index is parsed; the history
+    // payloads are adopted straight from the mapped pages.
+    shared_ptr<MMapSolverState<Dtype> > mmap_state(
+        new MMapSolverState<Dtype>(state_file));
+    const SolverState& state = mmap_state->index();
+    if (state.has_learned_net()) {
+      RestoreNet(state.learned_net());
+    }
+    iter_ = state.iter();
+    current_step_ = state.current_step();
+    RestoreSolverStateFromMMap(mmap_state);
+    RestoreDataCursors(state);
+    return;
+  }
   SolverState state;
-  NetParameter net_param;
   ReadProtoFromBinaryFile(state_file, &state);
   if (state.has_learned_net()) {
-    ReadProtoFromBinaryFile(state.learned_net().c_str(), &net_param);
-    net_->CopyTrainedLayersFrom(net_param);
+    RestoreNet(state.learned_net());
   }
   iter_ = state.iter();
   current_step_ = state.current_step();
   RestoreSolverState(state);
+  RestoreDataCursors(state);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::RestoreDataCursors(const SolverState& state) {
+  for (int i = 0; i < state.data_cursor_size(); ++i) {
+    const DataCursorState& cursor = state.data_cursor(i);
+    if (!net_->has_layer(cursor.layer())) {
+      // The net definition may have changed since the snapshot; resuming
+      // from the epoch start is still correct, just not bit-exact.
+      LOG(WARNING) << "Snapshot has a data cursor for layer "
+          << cursor.layer() << ", which this net does not have; ignoring.";
+      continue;
+    }
+    net_->layer_by_name(cursor.layer())->RestoreDataCursor(cursor.key());
+  }
 }
 
 
@@ -417,8 +951,26 @@ void SGDSolver<Dtype>::PreSolve() {
   // Initialize the history
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
   history_.clear();
+  history_half_.clear();
   update_.clear();
   temp_.clear();
+  history_arena_.reset();
+  update_arena_.reset();
+  temp_arena_.reset();
+  // With history_half, the momentum is stored as binary16 at half the
+  // size; the history blobs below then only carry shapes.
+  const bool half = this->param_.history_half();
+  // Mirror the net's contiguous parameter layout, so the update can run
+  // over all parameters at once.
+  if (this->net_->params_data_arena()) {
+    const size_t total_count = this->net_->params_total_count();
+    history_arena_.reset(new SyncedMemory(
+        total_count * (half ? sizeof(uint16_t) : sizeof(Dtype))));
+    update_arena_.reset(new SyncedMemory(total_count * sizeof(Dtype)));
+    temp_arena_.reset(new SyncedMemory(total_count * sizeof(Dtype)));
+  }
+  size_t offset = 0;
+  size_t half_offset = 0;
   for (int i = 0; i < net_params.size(); ++i) {
     const Blob<Dtype>* net_param = net_params[i].get();
     history_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(
@@ -430,15 +982,72 @@ void SGDSolver<Dtype>::PreSolve() {
     temp_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(
         net_param->num(), net_param->channels(), net_param->height(),
         net_param->width())));
+    if (half) {
+      const size_t half_bytes = net_param->count() * sizeof(uint16_t);
+      history_half_.push_back(shared_ptr<SyncedMemory>(history_arena_
+          ? new SyncedMemory(history_arena_, half_offset, half_bytes)
+          : new SyncedMemory(half_bytes)));
+      half_offset += half_bytes;
+    }
+    if (history_arena_) {
+      const size_t bytes = net_param->count() * sizeof(Dtype);
+      if (!half) {
+        history_.back()->ShareData(shared_ptr<SyncedMemory>(
+            new SyncedMemory(history_arena_, offset, bytes)));
+      }
+      update_.back()->ShareData(shared_ptr<SyncedMemory>(
+          new SyncedMemory(update_arena_, offset, bytes)));
+      temp_.back()->ShareData(shared_ptr<SyncedMemory>(
+          new SyncedMemory(temp_arena_, offset, bytes)));
+      offset += bytes;
+    }
   }
 }
 
 
+template <typename Dtype>
+void SGDSolver<Dtype>::SparseComputeUpdateValue(const int param_id,
+    const Dtype local_rate, const Dtype local_decay,
+    const vector<int>& rows) {
+  // Rows index the blob's height dimension (see Layer::sparse_param_rows).
+  // Regularization and the momentum decay only touch the rows seen this
+  // batch -- the standard lazy scheme for sparse features: an untouched
+  // row's history waits, un-decayed, until the row is next sampled. CPU
+  // only; in GPU mode the dense update runs instead.
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  const int row_size = param->width();
+  const Dtype momentum = this->param_.momentum();
+  const string& regularization_type = this->param_.regularization_type();
+  const Dtype* data = param->cpu_data();
+  Dtype* diff = param->mutable_cpu_diff();
+  Dtype* history = history_[param_id]->mutable_cpu_data();
+  for (int i = 0; i < rows.size(); ++i) {
+    const int offset = rows[i] * row_size;
+    if (local_decay) {
+      if (regularization_type == "L2") {
+        caffe_axpy(row_size, local_decay, data + offset, diff + offset);
+      } else if (regularization_type == "L1") {
+        Dtype* temp = temp_[param_id]->mutable_cpu_data();
+        caffe_cpu_sign(row_size, data + offset, temp + offset);
+        caffe_axpy(row_size, local_decay, temp + offset, diff + offset);
+      } else {
+        LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+      }
+    }
+    caffe_cpu_axpby(row_size, local_rate, diff + offset, momentum,
+        history + offset);
+    caffe_copy(row_size, history + offset, diff + offset);
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue() {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
   vector<float>& net_params_lr = this->net_->params_lr();
   vector<float>& net_params_weight_decay = this->net_->params_weight_decay();
+  // Frozen params (blobs_lr: 0) need no regularization, history, or
+  // update work; visit only the learnable ones.
+  const vector<int>& learnable = this->net_->learnable_param_ids();
   // get the learning rate
   Dtype rate = GetLearningRate();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
@@ -447,13 +1056,105 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   Dtype momentum = this->param_.momentum();
   Dtype weight_decay = this->param_.weight_decay();
   string regularization_type = this->param_.regularization_type();
+  // When the parameters and the history are contiguous and every blob has
+  // the same multipliers, the whole update collapses to a handful of
+  // operations over all parameters at once instead of a few per blob.
+  bool fused = history_arena_ && net_params.size() > 0 &&
+      learnable.size() == net_params.size();
+  for (int i = 1; fused && i < net_params.size(); ++i) {
+    fused = net_params_lr[i] == net_params_lr[0] &&
+        net_params_weight_decay[i] == net_params_weight_decay[0];
+  }
+  if (fused) {
+    const int count = this->net_->params_total_count();
+    const Dtype local_rate = rate * net_params_lr[0];
+    const Dtype local_decay = weight_decay * net_params_weight_decay[0];
+    switch (Caffe::mode()) {
+    case Caffe::CPU: {
+      const Dtype* data = static_cast<const Dtype*>(
+          this->net_->params_data_arena()->cpu_data());
+      Dtype* diff = static_cast<Dtype*>(
+          this->net_->params_diff_arena()->mutable_cpu_data());
+      if (local_decay) {
+        if (regularization_type == "L2") {
+          caffe_axpy(count, local_decay, data, diff);
+        } else if (regularization_type == "L1") {
+          Dtype* temp = static_cast<Dtype*>(temp_arena_->mutable_cpu_data());
+          caffe_cpu_sign(count, data, temp);
+          caffe_axpy(count, local_decay, temp, diff);
+        } else {
+          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+        }
+      }
+      if (this->param_.history_half()) {
+        uint16_t* history = static_cast<uint16_t*>(
+            history_arena_->mutable_cpu_data());
+        caffe_cpu_axpby_half(count, local_rate, diff, momentum, history);
+        caffe_cpu_convert_from_half(count, history, diff);
+      } else {
+        Dtype* history = static_cast<Dtype*>(
+            history_arena_->mutable_cpu_data());
+        caffe_cpu_axpby(count, local_rate, diff, momentum, history);
+        caffe_copy(count, history, diff);
+      }
+      break;
+    }
+#ifndef CPU_ONLY
+    case Caffe::GPU: {
+      const Dtype* data = static_cast<const Dtype*>(
+          this->net_->params_data_arena()->gpu_data());
+      Dtype* diff = static_cast<Dtype*>(
+          this->net_->params_diff_arena()->mutable_gpu_data());
+      if (local_decay) {
+        if (regularization_type == "L2") {
+          caffe_gpu_axpy(count, local_decay, data, diff);
+        } else if (regularization_type == "L1") {
+          Dtype* temp = static_cast<Dtype*>(temp_arena_->mutable_gpu_data());
+          caffe_gpu_sign(count, data, temp);
+          caffe_gpu_axpy(count, local_decay, temp, diff);
+        } else {
+          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+        }
+      }
+      if (this->param_.history_half()) {
+        uint16_t* history = static_cast<uint16_t*>(
+            history_arena_->mutable_gpu_data());
+        caffe_gpu_axpby_half(count, local_rate, diff, momentum, history);
+        caffe_gpu_convert_from_half(count, history, diff);
+      } else {
+        Dtype* history = static_cast<Dtype*>(
+            history_arena_->mutable_gpu_data());
+        caffe_gpu_axpby(count, local_rate, diff, momentum, history);
+        caffe_copy(count, history, diff);
+      }
+      break;
+    }
+#else
+      NO_GPU;
+#endif
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+    return;
+  }
   switch (Caffe::mode()) {
   case Caffe::CPU:
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
 
+      // Parameters with a sparse gradient (e.g. an embedding table where
+      // only the rows looked up this batch have any diff) get a row-wise
+      // update instead of full passes over the whole blob.
+      const vector<int>* sparse_rows = this->net_->sparse_param_rows(param_id);
+      if (sparse_rows && !this->param_.history_half()) {
+        SparseComputeUpdateValue(param_id, local_rate, local_decay,
+            *sparse_rows);
+        continue;
+      }
+
       if (local_decay) {
         if (regularization_type == "L2") {
           // add weight decay
@@ -474,18 +1175,28 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
         }
       }
 
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-                net_params[param_id]->cpu_diff(), momentum,
-                history_[param_id]->mutable_cpu_data());
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          history_[param_id]->cpu_data(),
-          net_params[param_id]->mutable_cpu_diff());
+      if (this->param_.history_half()) {
+        uint16_t* history = static_cast<uint16_t*>(
+            history_half_[param_id]->mutable_cpu_data());
+        caffe_cpu_axpby_half(net_params[param_id]->count(), local_rate,
+            net_params[param_id]->cpu_diff(), momentum, history);
+        caffe_cpu_convert_from_half(net_params[param_id]->count(), history,
+            net_params[param_id]->mutable_cpu_diff());
+      } else {
+        caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
+                  net_params[param_id]->cpu_diff(), momentum,
+                  history_[param_id]->mutable_cpu_data());
+        // copy
+        caffe_copy(net_params[param_id]->count(),
+            history_[param_id]->cpu_data(),
+            net_params[param_id]->mutable_cpu_diff());
+      }
     }
     break;
   case Caffe::GPU:
 #ifndef CPU_ONLY
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
@@ -510,13 +1221,22 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
         }
       }
 
-      caffe_gpu_axpby(net_params[param_id]->count(), local_rate,
-                net_params[param_id]->gpu_diff(), momentum,
-                history_[param_id]->mutable_gpu_data());
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          history_[param_id]->gpu_data(),
-          net_params[param_id]->mutable_gpu_diff());
+      if (this->param_.history_half()) {
+        uint16_t* history = static_cast<uint16_t*>(
+            history_half_[param_id]->mutable_gpu_data());
+        caffe_gpu_axpby_half(net_params[param_id]->count(), local_rate,
+            net_params[param_id]->gpu_diff(), momentum, history);
+        caffe_gpu_convert_from_half(net_params[param_id]->count(), history,
+            net_params[param_id]->mutable_gpu_diff());
+      } else {
+        caffe_gpu_axpby(net_params[param_id]->count(), local_rate,
+                  net_params[param_id]->gpu_diff(), momentum,
+                  history_[param_id]->mutable_gpu_data());
+        // copy
+        caffe_copy(net_params[param_id]->count(),
+            history_[param_id]->gpu_data(),
+            net_params[param_id]->mutable_gpu_diff());
+      }
     }
 #else
     NO_GPU;
@@ -533,7 +1253,25 @@ void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   for (int i = 0; i < history_.size(); ++i) {
     // Add history
     BlobProto* history_blob = state->add_history();
-    history_[i]->ToProto(history_blob);
+    if (this->param_.history_half()) {
+      // Snapshots stay full precision regardless of the storage option:
+      // expand through the update_ scratch, which is idle between
+      // iterations.
+      const int count = history_[i]->count();
+      Dtype* scratch = update_[i]->mutable_cpu_data();
+      caffe_cpu_convert_from_half(count,
+          static_cast<const uint16_t*>(history_half_[i]->cpu_data()),
+          scratch);
+      history_blob->set_num(history_[i]->num());
+      history_blob->set_channels(history_[i]->channels());
+      history_blob->set_height(history_[i]->height());
+      history_blob->set_width(history_[i]->width());
+      for (int k = 0; k < count; ++k) {
+        history_blob->add_data(scratch[k]);
+      }
+    } else {
+      history_[i]->ToProto(history_blob);
+    }
   }
 }
 
@@ -543,7 +1281,52 @@ void SGDSolver<Dtype>::RestoreSolverState(const SolverState& state) {
       << "Incorrect length of history blobs.";
   LOG(INFO) << "SGDSolver: restoring history";
   for (int i = 0; i < history_.size(); ++i) {
-    history_[i]->FromProto(state.history(i));
+    if (this->param_.history_half()) {
+      const BlobProto& proto = state.history(i);
+      const int count = history_[i]->count();
+      CHECK_EQ(proto.data_size(), count)
+          << "History blob " << i << " has the wrong size.";
+      Dtype* scratch = update_[i]->mutable_cpu_data();
+      for (int k = 0; k < count; ++k) {
+        scratch[k] = proto.data(k);
+      }
+      caffe_cpu_convert_to_half(count, scratch,
+          static_cast<uint16_t*>(history_half_[i]->mutable_cpu_data()));
+    } else {
+      history_[i]->FromProto(state.history(i));
+    }
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::RestoreSolverStateFromMMap(
+    shared_ptr<MMapSolverState<Dtype> > state) {
+  CHECK_EQ(state->index().history_size(), history_.size())
+      << "Incorrect length of history blobs.";
+  LOG(INFO) << "SGDSolver: adopting mapped history";
+  for (int i = 0; i < history_.size(); ++i) {
+    const BlobProto& shape = state->index().history(i);
+    const int count =
+        shape.num() * shape.channels() * shape.height() * shape.width();
+    CHECK_EQ(count, history_[i]->count())
+        << "History blob " << i << " has the wrong shape.";
+    if (this->param_.history_half()) {
+      // The mapped payloads are full precision; contract them into the
+      // half-sized storage.
+      caffe_cpu_convert_to_half(count, state->blob_data(i),
+          static_cast<uint16_t*>(history_half_[i]->mutable_cpu_data()));
+    } else if (history_arena_) {
+      // Contiguous histories are views into one arena and cannot alias
+      // foreign pages; a bulk copy from the mapping still skips the
+      // protobuf decode, which is where restores spend their time.
+      caffe_copy(count, state->blob_data(i),
+          history_[i]->mutable_cpu_data());
+    } else {
+      history_[i]->set_cpu_data(state->blob_data(i));
+    }
+  }
+  if (!history_arena_ && !this->param_.history_half()) {
+    mmap_state_ = state;
   }
 }
 
@@ -552,6 +1335,8 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
   vector<float>& net_params_lr = this->net_->params_lr();
   vector<float>& net_params_weight_decay = this->net_->params_weight_decay();
+  // Visit only the learnable params, as in SGDSolver.
+  const vector<int>& learnable = this->net_->learnable_param_ids();
   // get the learning rate
   Dtype rate = this->GetLearningRate();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
@@ -562,7 +1347,8 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   string regularization_type = this->param_.regularization_type();
   switch (Caffe::mode()) {
   case Caffe::CPU:
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       // save history momentum for stepping back
       caffe_copy(net_params[param_id]->count(),
           this->history_[param_id]->cpu_data(),
@@ -609,7 +1395,8 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
     break;
   case Caffe::GPU:
 #ifndef CPU_ONLY
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       // save history momentum for stepping back
       caffe_copy(net_params[param_id]->count(),
           this->history_[param_id]->gpu_data(),
@@ -667,6 +1454,8 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
   vector<float>& net_params_lr = this->net_->params_lr();
   vector<float>& net_params_weight_decay = this->net_->params_weight_decay();
+  // Visit only the learnable params, as in SGDSolver.
+  const vector<int>& learnable = this->net_->learnable_param_ids();
   // get the learning rate
   Dtype rate = this->GetLearningRate();
   Dtype delta = this->param_.delta();
@@ -677,7 +1466,8 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   string regularization_type = this->param_.regularization_type();
   switch (Caffe::mode()) {
   case Caffe::CPU:
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
 
@@ -733,7 +1523,8 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
     break;
   case Caffe::GPU:
 #ifndef CPU_ONLY
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    for (int i = 0; i < learnable.size(); ++i) {
+      const int param_id = learnable[i];
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
 
@@ -1,38 +1,251 @@
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include <boost/thread.hpp>
+
+#include <cstdlib>
 #include <cstring>
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 namespace caffe {
 
+// Counters for CaffeHugePageStats, shared across allocating threads.
+static boost::mutex huge_page_mutex_;
+static size_t huge_page_allocs_ = 0;
+static size_t huge_page_bytes_ = 0;
+
+void* CaffeMallocHuge(const size_t size) {
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, kHugePageSize, size) != 0) {
+    // Could not get a 2 MB boundary; still honor the cacheline alignment
+    // CaffeMallocHost promises before giving up entirely.
+    if (posix_memalign(&ptr, kCaffeHostAlignment, size) != 0) {
+      return malloc(size);
+    }
+    return ptr;
+  }
+#ifdef MADV_HUGEPAGE
+  // Advisory only: the kernel promotes the region to huge pages when
+  // transparent huge pages are enabled (at least in madvise mode).
+  if (madvise(ptr, size, MADV_HUGEPAGE) == 0) {
+    boost::mutex::scoped_lock lock(huge_page_mutex_);
+    ++huge_page_allocs_;
+    huge_page_bytes_ += size;
+  }
+#endif
+  return ptr;
+}
+
+void CaffeHugePageStats(size_t* allocs, size_t* bytes) {
+  boost::mutex::scoped_lock lock(huge_page_mutex_);
+  *allocs = huge_page_allocs_;
+  *bytes = huge_page_bytes_;
+}
+
+// Allocation accounting, shared across all SyncedMemory instances.
+static boost::mutex accounting_mutex_;
+static size_t host_bytes_current_ = 0;
+static size_t host_bytes_peak_ = 0;
+static size_t device_bytes_current_[kMaxAccountedDevices] = { 0 };
+static size_t device_bytes_peak_[kMaxAccountedDevices] = { 0 };
+
+static void AccountHostAlloc(const size_t size) {
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  host_bytes_current_ += size;
+  if (host_bytes_current_ > host_bytes_peak_) {
+    host_bytes_peak_ = host_bytes_current_;
+  }
+}
+
+static void AccountHostFree(const size_t size) {
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  host_bytes_current_ -= size;
+}
+
+static void AccountDeviceAlloc(const int device, const size_t size) {
+  CHECK_GE(device, 0);
+  CHECK_LT(device, kMaxAccountedDevices);
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  device_bytes_current_[device] += size;
+  if (device_bytes_current_[device] > device_bytes_peak_[device]) {
+    device_bytes_peak_[device] = device_bytes_current_[device];
+  }
+}
+
+static void AccountDeviceFree(const int device, const size_t size) {
+  CHECK_GE(device, 0);
+  CHECK_LT(device, kMaxAccountedDevices);
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  device_bytes_current_[device] -= size;
+}
+
+void CaffeMemoryAccounting(MemoryAccounting* accounting) {
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  accounting->host_bytes = host_bytes_current_;
+  accounting->host_bytes_peak = host_bytes_peak_;
+  accounting->device_bytes = 0;
+  accounting->device_bytes_peak = 0;
+  for (int i = 0; i < kMaxAccountedDevices; ++i) {
+    accounting->device_bytes += device_bytes_current_[i];
+    accounting->device_bytes_peak += device_bytes_peak_[i];
+  }
+}
+
+void CaffeDeviceMemoryAccounting(const int device, size_t* bytes,
+    size_t* peak) {
+  CHECK_GE(device, 0);
+  CHECK_LT(device, kMaxAccountedDevices);
+  boost::mutex::scoped_lock lock(accounting_mutex_);
+  *bytes = device_bytes_current_[device];
+  *peak = device_bytes_peak_[device];
+}
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    if (cpu_from_pool_) {
+      MemoryPool::Get().FreeHost(cpu_ptr_);
+    } else {
+      CaffeFreeHost(cpu_ptr_, cpu_pinned_);
+    }
+    AccountHostFree(size_);
   }
 
 #ifndef CPU_ONLY
   if (gpu_ptr_) {
+    if (gpu_from_pool_) {
+      MemoryPool::Get().FreeDevice(gpu_ptr_);
+    } else {
+      CUDA_CHECK(cudaFree(gpu_ptr_));
+    }
+    AccountDeviceFree(gpu_device_, size_);
+  }
+#endif  // CPU_ONLY
+}
+
+inline void SyncedMemory::MallocHostData() {
+  if (prefer_pinned_) {
+    // Pinned buffers bypass the pool: mixing pinned and pageable blocks in
+    // the same bucket would make the pinned property unpredictable.
+    CaffeMallocHost(&cpu_ptr_, size_, true);
+    cpu_pinned_ = true;
+    cpu_from_pool_ = false;
+    own_cpu_data_ = true;
+    AccountHostAlloc(size_);
+    return;
+  }
+  if (Caffe::memory_pool_enabled()) {
+    cpu_ptr_ = MemoryPool::Get().MallocHost(size_);
+    cpu_from_pool_ = true;
+  } else {
+    CaffeMallocHost(&cpu_ptr_, size_);
+    cpu_from_pool_ = false;
+  }
+  own_cpu_data_ = true;
+  AccountHostAlloc(size_);
+}
+
+#ifndef CPU_ONLY
+inline void SyncedMemory::MallocDeviceData() {
+  if (Caffe::memory_pool_enabled()) {
+    gpu_ptr_ = MemoryPool::Get().MallocDevice(size_);
+    gpu_from_pool_ = true;
+  } else {
+    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+    gpu_from_pool_ = false;
+  }
+  CUDA_CHECK(cudaGetDevice(&gpu_device_));
+  AccountDeviceAlloc(gpu_device_, size_);
+}
+
+bool SyncedMemory::StartOffload(cudaStream_t stream) {
+  if (base_ || gpu_ptr_ == NULL) {
+    return false;
+  }
+  if (head_ == HEAD_AT_GPU) {
+    if (cpu_ptr_ == NULL) {
+      MallocHostData();
+    }
+    CUDA_CHECK(cudaMemcpyAsync(cpu_ptr_, gpu_ptr_, size_,
+        cudaMemcpyDeviceToHost, stream));
+    return true;
+  }
+  // With SYNCED the host copy is already current; the device buffer can
+  // be dropped without a copy.
+  return head_ == SYNCED;
+}
+
+void SyncedMemory::DropDeviceData() {
+  if (base_ || gpu_ptr_ == NULL) {
+    return;
+  }
+  if (head_ == HEAD_AT_GPU || head_ == SYNCED) {
+    head_ = HEAD_AT_CPU;
+  }
+  if (gpu_from_pool_) {
+    MemoryPool::Get().FreeDevice(gpu_ptr_);
+  } else {
     CUDA_CHECK(cudaFree(gpu_ptr_));
   }
+  AccountDeviceFree(gpu_device_, size_);
+  gpu_ptr_ = NULL;
+}
+
+bool SyncedMemory::StartPrefetch(cudaStream_t stream) {
+  if (base_ || head_ != HEAD_AT_CPU || cpu_ptr_ == NULL) {
+    return false;
+  }
+  if (gpu_ptr_ == NULL) {
+    MallocDeviceData();
+  }
+  CUDA_CHECK(cudaMemcpyAsync(gpu_ptr_, cpu_ptr_, size_,
+      cudaMemcpyHostToDevice, stream));
+  head_ = SYNCED;
+  return true;
+}
 #endif  // CPU_ONLY
+
+void SyncedMemory::LogHotRegionSync() const {
+  LOG(WARNING) << "Device-to-host sync of " << size_ << " bytes"
+      << (debug_name_.empty() ? string() : " (" + debug_name_ + ")")
+      << " inside a GPU-hot region";
+  void* frames[32];
+  const int depth = backtrace(frames, 32);
+  char** symbols = backtrace_symbols(frames, depth);
+  if (symbols) {
+    for (int i = 0; i < depth; ++i) {
+      LOG(WARNING) << "  #" << i << " " << symbols[i];
+    }
+    free(symbols);
+  }
 }
 
 inline void SyncedMemory::to_cpu() {
   switch (head_) {
   case UNINITIALIZED:
-    CaffeMallocHost(&cpu_ptr_, size_);
-    caffe_memset(size_, 0, cpu_ptr_);
+    MallocHostData();
+    if (!skip_zero_fill_) {
+      caffe_memset(size_, 0, cpu_ptr_);
+    } else if (Caffe::poison_skipped_fills()) {
+      // All-ones bytes decode as NaN for float and double, so a read
+      // before the promised overwrite contaminates results visibly.
+      caffe_memset(size_, 0xFF, cpu_ptr_);
+    }
     head_ = HEAD_AT_CPU;
-    own_cpu_data_ = true;
     break;
   case HEAD_AT_GPU:
 #ifndef CPU_ONLY
     if (cpu_ptr_ == NULL) {
-      CaffeMallocHost(&cpu_ptr_, size_);
-      own_cpu_data_ = true;
+      MallocHostData();
     }
     caffe_gpu_memcpy(size_, gpu_ptr_, cpu_ptr_);
+    ++d2h_count_;
+    if (Caffe::in_hot_region()) {
+      LogHotRegionSync();
+    }
     head_ = SYNCED;
 #else
     NO_GPU;
@@ -48,15 +261,20 @@ inline void SyncedMemory::to_gpu() {
 #ifndef CPU_ONLY
   switch (head_) {
   case UNINITIALIZED:
-    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
-    caffe_gpu_memset(size_, 0, gpu_ptr_);
+    MallocDeviceData();
+    if (!skip_zero_fill_) {
+      caffe_gpu_memset(size_, 0, gpu_ptr_);
+    } else if (Caffe::poison_skipped_fills()) {
+      caffe_gpu_memset(size_, 0xFF, gpu_ptr_);
+    }
     head_ = HEAD_AT_GPU;
     break;
   case HEAD_AT_CPU:
     if (gpu_ptr_ == NULL) {
-      CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+      MallocDeviceData();
     }
     caffe_gpu_memcpy(size_, cpu_ptr_, gpu_ptr_);
+    ++h2d_count_;
     head_ = SYNCED;
     break;
   case HEAD_AT_GPU:
@@ -69,14 +287,26 @@ inline void SyncedMemory::to_gpu() {
 }
 
 const void* SyncedMemory::cpu_data() {
+  if (base_) {
+    return static_cast<const char*>(base_->cpu_data()) + offset_;
+  }
   to_cpu();
   return (const void*)cpu_ptr_;
 }
 
 void SyncedMemory::set_cpu_data(void* data) {
+  CHECK(!base_) << "set_cpu_data called on a view";
+  CHECK(!read_only_) << "Replacing read-only memory " << debug_name_;
   CHECK(data);
   if (own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    if (cpu_from_pool_) {
+      MemoryPool::Get().FreeHost(cpu_ptr_);
+      cpu_from_pool_ = false;
+    } else {
+      CaffeFreeHost(cpu_ptr_, cpu_pinned_);
+      cpu_pinned_ = false;
+    }
+    AccountHostFree(size_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
@@ -85,6 +315,9 @@ void SyncedMemory::set_cpu_data(void* data) {
 
 const void* SyncedMemory::gpu_data() {
 #ifndef CPU_ONLY
+  if (base_) {
+    return static_cast<const char*>(base_->gpu_data()) + offset_;
+  }
   to_gpu();
   return (const void*)gpu_ptr_;
 #else
@@ -93,6 +326,10 @@ const void* SyncedMemory::gpu_data() {
 }
 
 void* SyncedMemory::mutable_cpu_data() {
+  if (base_) {
+    return static_cast<char*>(base_->mutable_cpu_data()) + offset_;
+  }
+  CHECK(!read_only_) << "Mutable access to read-only memory " << debug_name_;
   to_cpu();
   head_ = HEAD_AT_CPU;
   return cpu_ptr_;
@@ -100,6 +337,10 @@ void* SyncedMemory::mutable_cpu_data() {
 
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
+  if (base_) {
+    return static_cast<char*>(base_->mutable_gpu_data()) + offset_;
+  }
+  CHECK(!read_only_) << "Mutable access to read-only memory " << debug_name_;
   to_gpu();
   head_ = HEAD_AT_GPU;
   return gpu_ptr_;
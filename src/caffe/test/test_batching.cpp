@@ -0,0 +1,145 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/batching.hpp"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Submits one two-value item from its own thread so several submitters
+// can fill a batch concurrently.
+template <typename Dtype>
+class BatcherClientThread : public InternalThread {
+ public:
+  BatcherClientThread(NetBatcher<Dtype>* batcher, const Dtype a,
+      const Dtype b)
+      : batcher_(batcher) {
+    input_[0] = a;
+    input_[1] = b;
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& outputs() const {
+    return outputs_;
+  }
+  const Dtype* input() const { return input_; }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    batcher_->Forward(input_, &outputs_);
+  }
+
+  NetBatcher<Dtype>* batcher_;
+  Dtype input_[2];
+  vector<shared_ptr<Blob<Dtype> > > outputs_;
+};
+
+template <typename Dtype>
+class NetBatcherTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // A four-item net computing 2x + 1, so every row of the output is
+    // determined by the submitted item alone.
+    const string& proto =
+        "name: 'TinyBatchNet' "
+        "input: 'data' "
+        "input_dim: 4 "
+        "input_dim: 2 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'power' "
+        "  type: POWER "
+        "  bottom: 'data' "
+        "  top: 'out' "
+        "  power_param { power: 1 scale: 2 shift: 1 } "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(NetBatcherTest, TestDtypes);
+
+TYPED_TEST(NetBatcherTest, TestSingleItemLaunchesOnDeadline) {
+  typedef TypeParam Dtype;
+  NetBatcher<Dtype> batcher(this->net_, 1);
+  EXPECT_EQ(4, batcher.max_batch());
+  EXPECT_EQ(2, batcher.input_item_count());
+  const Dtype input[2] = { 3, -2 };
+  vector<shared_ptr<Blob<Dtype> > > outputs;
+  batcher.Forward(input, &outputs);
+  ASSERT_EQ(1, outputs.size());
+  ASSERT_EQ(1, outputs[0]->num());
+  ASSERT_EQ(2, outputs[0]->channels());
+  EXPECT_EQ(7, outputs[0]->cpu_data()[0]);
+  EXPECT_EQ(-3, outputs[0]->cpu_data()[1]);
+  EXPECT_EQ(1, batcher.batches_run());
+  EXPECT_EQ(1, batcher.items_served());
+  EXPECT_EQ(0, batcher.queue_depth());
+}
+
+TYPED_TEST(NetBatcherTest, TestCoalescesFullBatch) {
+  typedef TypeParam Dtype;
+  // The window is far longer than the test, so one Forward means the
+  // batch launched because it filled up, not because time ran out.
+  NetBatcher<Dtype> batcher(this->net_, 10000);
+  vector<shared_ptr<BatcherClientThread<Dtype> > > clients;
+  for (int i = 0; i < 4; ++i) {
+    clients.push_back(shared_ptr<BatcherClientThread<Dtype> >(
+        new BatcherClientThread<Dtype>(&batcher, Dtype(i), Dtype(-i))));
+  }
+  for (int i = 0; i < 4; ++i) {
+    CHECK(clients[i]->StartInternalThread());
+  }
+  for (int i = 0; i < 4; ++i) {
+    CHECK(clients[i]->WaitForInternalThreadToExit());
+  }
+  EXPECT_EQ(1, batcher.batches_run());
+  EXPECT_EQ(4, batcher.items_served());
+  for (int i = 0; i < 4; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& outputs =
+        clients[i]->outputs();
+    ASSERT_EQ(1, outputs.size());
+    EXPECT_EQ(2 * clients[i]->input()[0] + 1, outputs[0]->cpu_data()[0]);
+    EXPECT_EQ(2 * clients[i]->input()[1] + 1, outputs[0]->cpu_data()[1]);
+  }
+}
+
+TYPED_TEST(NetBatcherTest, TestMoreItemsThanCapacity) {
+  typedef TypeParam Dtype;
+  NetBatcher<Dtype> batcher(this->net_, 5);
+  vector<shared_ptr<BatcherClientThread<Dtype> > > clients;
+  const int kClients = 6;
+  for (int i = 0; i < kClients; ++i) {
+    clients.push_back(shared_ptr<BatcherClientThread<Dtype> >(
+        new BatcherClientThread<Dtype>(&batcher, Dtype(i), Dtype(i + 1))));
+  }
+  for (int i = 0; i < kClients; ++i) {
+    CHECK(clients[i]->StartInternalThread());
+  }
+  for (int i = 0; i < kClients; ++i) {
+    CHECK(clients[i]->WaitForInternalThreadToExit());
+  }
+  EXPECT_EQ(kClients, batcher.items_served());
+  EXPECT_GE(batcher.batches_run(), 2);
+  for (int i = 0; i < kClients; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& outputs =
+        clients[i]->outputs();
+    ASSERT_EQ(1, outputs.size());
+    EXPECT_EQ(2 * clients[i]->input()[0] + 1, outputs[0]->cpu_data()[0]);
+    EXPECT_EQ(2 * clients[i]->input()[1] + 1, outputs[0]->cpu_data()[1]);
+  }
+}
+
+}  // namespace caffe
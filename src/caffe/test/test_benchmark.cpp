@@ -70,6 +70,56 @@ TYPED_TEST(BenchmarkTest, TestTimerMilliSeconds) {
   EXPECT_TRUE(timer.has_run_at_least_once());
 }
 
+TYPED_TEST(BenchmarkTest, TestTimerMicroSeconds) {
+  Timer timer;
+  EXPECT_EQ(timer.MicroSeconds(), 0);
+  EXPECT_TRUE(timer.initted());
+  EXPECT_FALSE(timer.running());
+  EXPECT_FALSE(timer.has_run_at_least_once());
+  timer.Start();
+  usleep(300 * 1000);
+  EXPECT_GE(timer.MicroSeconds(), 290 * 1000);
+  EXPECT_LE(timer.MicroSeconds(), 310 * 1000);
+  EXPECT_TRUE(timer.initted());
+  EXPECT_FALSE(timer.running());
+  EXPECT_TRUE(timer.has_run_at_least_once());
+}
+
+TYPED_TEST(BenchmarkTest, TestCPUTimerMilliSeconds) {
+  // The CPUTimer times the wall clock regardless of the mode.
+  CPUTimer timer;
+  EXPECT_EQ(timer.MilliSeconds(), 0);
+  EXPECT_FALSE(timer.running());
+  EXPECT_FALSE(timer.has_run_at_least_once());
+  timer.Start();
+  usleep(300 * 1000);
+  EXPECT_GE(timer.MilliSeconds(), 290);
+  EXPECT_LE(timer.MilliSeconds(), 310);
+  EXPECT_GE(timer.MicroSeconds(), 290 * 1000);
+  EXPECT_LE(timer.MicroSeconds(), 310 * 1000);
+  EXPECT_FALSE(timer.running());
+  EXPECT_TRUE(timer.has_run_at_least_once());
+}
+
+TYPED_TEST(BenchmarkTest, TestPerfCounters) {
+  // The interval API must be safe to call whether or not the kernel let
+  // us open the counters (no PMU, perf_event_paranoid, non-Linux).
+  PerfCounters counters;
+  counters.Start();
+  volatile double sum = 0;
+  for (int i = 0; i < 1000000; ++i) { sum += i; }
+  counters.Stop();
+  if (counters.available()) {
+    EXPECT_GT(counters.Value(PerfCounters::CYCLES), 0);
+    EXPECT_GT(counters.Value(PerfCounters::INSTRUCTIONS), 0);
+  } else {
+    for (int c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+      EXPECT_EQ(0,
+          counters.Value(static_cast<PerfCounters::Counter>(c)));
+    }
+  }
+}
+
 TYPED_TEST(BenchmarkTest, TestTimerSeconds) {
   Timer timer;
   EXPECT_EQ(timer.Seconds(), 0);
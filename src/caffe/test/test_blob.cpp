@@ -1,4 +1,6 @@
+#include <cmath>
 #include <cstring>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -54,4 +56,116 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestReshapePitched) {
+  typedef TypeParam Dtype;
+  const int pitch = Blob<Dtype>::AlignedPitch(5);
+  EXPECT_GE(pitch, 5);
+  EXPECT_EQ(pitch * sizeof(Dtype) % kCaffeHostAlignment, 0);
+  this->blob_->ReshapePitched(2, 3, 4, 5, pitch);
+  EXPECT_EQ(this->blob_->width(), 5);
+  EXPECT_EQ(this->blob_->width_pitch(), pitch);
+  EXPECT_EQ(this->blob_->count(), 2 * 3 * 4 * pitch);
+  // Rows are pitch elements apart, so every row starts aligned.
+  EXPECT_EQ(this->blob_->offset(0, 0, 1, 0), pitch);
+  EXPECT_EQ(this->blob_->offset(1, 2, 3, 4), (((1 * 3 + 2) * 4) + 3) * pitch
+      + 4);
+  // Padding lanes start out zero-filled.
+  const Dtype* data = this->blob_->cpu_data();
+  for (int w = 5; w < pitch; ++w) {
+    EXPECT_EQ(data[this->blob_->offset(0, 0, 0, 0) + w], 0);
+  }
+}
+
+TYPED_TEST(BlobSimpleTest, TestProtoRoundTrip) {
+  typedef TypeParam Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  const int count = this->blob_preshaped_->count();
+  Dtype* diff = this->blob_preshaped_->mutable_cpu_diff();
+  for (int i = 0; i < count; ++i) {
+    diff[i] = i;
+  }
+  BlobProto proto;
+  this->blob_preshaped_->ToProto(&proto, true);
+  // ToProto writes the bulk raw fields, not the repeated ones.
+  EXPECT_EQ(proto.data_size(), 0);
+  EXPECT_TRUE(proto.has_raw_data());
+  EXPECT_TRUE(proto.has_raw_diff());
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), count);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(this->blob_preshaped_->cpu_data()[i], this->blob_->cpu_data()[i]);
+    EXPECT_EQ(this->blob_preshaped_->cpu_diff()[i], this->blob_->cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(BlobSimpleTest, TestFromProtoRepeatedData) {
+  typedef TypeParam Dtype;
+  // Snapshots that predate the raw fields use the repeated fields.
+  BlobProto proto;
+  proto.set_num(1);
+  proto.set_channels(1);
+  proto.set_height(2);
+  proto.set_width(3);
+  for (int i = 0; i < 6; ++i) {
+    proto.add_data(i + 0.5);
+  }
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), 6);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(this->blob_->cpu_data()[i], Dtype(i + 0.5));
+  }
+}
+
+TYPED_TEST(BlobSimpleTest, TestToProtoHalf) {
+  typedef TypeParam Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  const int count = this->blob_preshaped_->count();
+  BlobProto proto;
+  this->blob_preshaped_->ToProto(&proto, false, true);
+  // The half payload is two bytes per element.
+  EXPECT_TRUE(proto.has_raw_data());
+  EXPECT_EQ(proto.raw_data().size(), count * sizeof(uint16_t));
+  // FromProto up-converts transparently; the values come back rounded
+  // to their nearest half (11 significand bits, ~1e-3 relative error).
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), count);
+  const Dtype* original = this->blob_preshaped_->cpu_data();
+  const Dtype* restored = this->blob_->cpu_data();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(original[i], restored[i], 1e-3 * std::fabs(original[i]));
+  }
+}
+
+TYPED_TEST(BlobSimpleTest, TestCompressDataToHalf) {
+  typedef TypeParam Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  const int count = this->blob_preshaped_->count();
+  vector<Dtype> original(this->blob_preshaped_->cpu_data(),
+      this->blob_preshaped_->cpu_data() + count);
+  // The first compression rounds to the nearest half...
+  this->blob_preshaped_->CompressDataToHalf();
+  EXPECT_TRUE(this->blob_preshaped_->data_compressed());
+  this->blob_preshaped_->DecompressDataFromHalf();
+  EXPECT_FALSE(this->blob_preshaped_->data_compressed());
+  const Dtype* data = this->blob_preshaped_->cpu_data();
+  vector<Dtype> rounded(data, data + count);
+  for (int i = 0; i < count; ++i) {
+    // Half has 11 significand bits, so ~1e-3 relative error at most.
+    EXPECT_NEAR(original[i], data[i], 1e-3 * std::fabs(original[i]));
+  }
+  // ...and further round trips are exact.
+  this->blob_preshaped_->CompressDataToHalf();
+  this->blob_preshaped_->DecompressDataFromHalf();
+  data = this->blob_preshaped_->cpu_data();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(rounded[i], data[i]);
+  }
+}
+
 }  // namespace caffe
@@ -2,6 +2,7 @@
 
 #include "gtest/gtest.h"
 
+#include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -51,6 +52,54 @@ TEST_F(CommonTest, TestRandSeedCPU) {
   }
 }
 
+TEST_F(CommonTest, TestRngStreamSeeds) {
+  Caffe::set_random_seed(1701);
+  EXPECT_EQ(1701, Caffe::random_seed());
+  const unsigned int s0 = Caffe::rng_stream_seed(0);
+  const unsigned int s1 = Caffe::rng_stream_seed(1);
+  // Streams differ from each other and never alias the master stream.
+  EXPECT_NE(s0, s1);
+  EXPECT_NE(1701, s0);
+  EXPECT_NE(1701, s1);
+  // Re-seeding with the same master seed re-derives the same streams.
+  Caffe::set_random_seed(1701);
+  EXPECT_EQ(s0, Caffe::rng_stream_seed(0));
+  EXPECT_EQ(s1, Caffe::rng_stream_seed(1));
+}
+
+TEST_F(CommonTest, TestRngStreamReproducible) {
+  SyncedMemory data_a(10 * sizeof(int));
+  SyncedMemory data_b(10 * sizeof(int));
+  Caffe::set_random_seed(1701);
+  Caffe::set_rng_stream(3);
+  caffe_rng_bernoulli(10, 0.5, static_cast<int*>(data_a.mutable_cpu_data()));
+
+  Caffe::set_rng_stream(3);
+  caffe_rng_bernoulli(10, 0.5, static_cast<int*>(data_b.mutable_cpu_data()));
+
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(static_cast<const int*>(data_a.cpu_data())[i],
+        static_cast<const int*>(data_b.cpu_data())[i]);
+  }
+}
+
+TEST_F(CommonTest, TestConstantBlobCache) {
+  const Blob<float>& ones = Caffe::ones<float>(7);
+  EXPECT_EQ(7, ones.count());
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(1, ones.cpu_data()[i]);
+  }
+  // Repeated requests for a size hand back the same cached blob.
+  EXPECT_EQ(&ones, &Caffe::ones<float>(7));
+  EXPECT_NE(&ones, &Caffe::ones<float>(8));
+  EXPECT_NE(static_cast<const void*>(&ones),
+      static_cast<const void*>(&Caffe::ones<double>(7)));
+  const Blob<float>& zeros = Caffe::zeros<float>(7);
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(0, zeros.cpu_data()[i]);
+  }
+}
+
 #ifndef CPU_ONLY  // GPU Caffe singleton test.
 
 TEST_F(CommonTest, TestRandSeedGPU) {
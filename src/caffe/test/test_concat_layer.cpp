@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -110,6 +111,57 @@ TYPED_TEST(ConcatLayerTest, TestNum) {
   }
 }
 
+TYPED_TEST(ConcatLayerTest, TestInPlaceNum) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_concat_param()->set_concat_dim(0);
+  layer_param.mutable_concat_param()->set_in_place(true);
+  ConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_1, &(this->blob_top_vec_));
+  // The first pass copies each bottom into its slice, then aliases the
+  // bottoms into the top's storage.
+  layer.Forward(this->blob_bottom_vec_1, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->cpu_data(), this->blob_bottom_0->cpu_data());
+  EXPECT_EQ(this->blob_top_->cpu_data() + this->blob_bottom_0->count(),
+      this->blob_bottom_2->cpu_data());
+  for (int i = 0; i < this->blob_bottom_0->count(); ++i) {
+    EXPECT_EQ(1, this->blob_top_->cpu_data()[i]);
+  }
+  for (int i = 0; i < this->blob_bottom_2->count(); ++i) {
+    EXPECT_EQ(3,
+        this->blob_top_->cpu_data()[this->blob_bottom_0->count() + i]);
+  }
+  // A producer writing the bottom now writes the top directly, and the
+  // next pass has nothing to copy.
+  caffe_set(this->blob_bottom_0->count(), Dtype(7),
+      this->blob_bottom_0->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_1, &(this->blob_top_vec_));
+  for (int i = 0; i < this->blob_bottom_0->count(); ++i) {
+    EXPECT_EQ(7, this->blob_top_->cpu_data()[i]);
+  }
+  // Backward aliases the diffs the same way.
+  caffe_set(this->blob_top_->count(), Dtype(2),
+      this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(2, true);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_1));
+  for (int i = 0; i < this->blob_bottom_2->count(); ++i) {
+    EXPECT_EQ(2, this->blob_bottom_2->cpu_diff()[i]);
+  }
+  EXPECT_EQ(this->blob_top_->cpu_diff(), this->blob_bottom_0->cpu_diff());
+}
+
+TYPED_TEST(ConcatLayerTest, TestInPlaceGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_concat_param()->set_concat_dim(0);
+  layer_param.mutable_concat_param()->set_in_place(true);
+  ConcatLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradient(&layer, &(this->blob_bottom_vec_1),
+    &(this->blob_top_vec_));
+}
+
 TYPED_TEST(ConcatLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
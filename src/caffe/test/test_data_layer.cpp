@@ -1,3 +1,4 @@
+#include <iomanip>
 #include <string>
 #include <vector>
 
@@ -35,20 +36,24 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
   // Fill the LevelDB with data: if unique_pixels, each pixel is unique but
   // all images are the same; else each image is unique but all pixels within
-  // an image are the same.
-  void FillLevelDB(const bool unique_pixels) {
+  // an image are the same. padded_keys writes the 8-digit zero-padded
+  // record keys our conversion tools use, which keyed seeks and
+  // chunk-shuffled reading require.
+  void FillLevelDB(const bool unique_pixels, const bool padded_keys = false,
+      const string& suffix = "", const int label_offset = 0) {
     backend_ = DataParameter_DB_LEVELDB;
-    LOG(INFO) << "Using temporary leveldb " << *filename_;
+    const string path = *filename_ + suffix;
+    LOG(INFO) << "Using temporary leveldb " << path;
     leveldb::DB* db;
     leveldb::Options options;
     options.error_if_exists = true;
     options.create_if_missing = true;
     leveldb::Status status =
-        leveldb::DB::Open(options, filename_->c_str(), &db);
+        leveldb::DB::Open(options, path.c_str(), &db);
     CHECK(status.ok());
     for (int i = 0; i < 5; ++i) {
       Datum datum;
-      datum.set_label(i);
+      datum.set_label(label_offset + i);
       datum.set_channels(2);
       datum.set_height(3);
       datum.set_width(4);
@@ -58,18 +63,24 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         data->push_back(static_cast<uint8_t>(datum));
       }
       stringstream ss;
-      ss << i;
+      if (padded_keys) {
+        ss << std::setw(8) << std::setfill('0') << i;
+      } else {
+        ss << i;
+      }
       db->Put(leveldb::WriteOptions(), ss.str(), datum.SerializeAsString());
     }
     delete db;
   }
 
   // Fill the LMDB with data: unique_pixels has same meaning as in FillLevelDB.
-  void FillLMDB(const bool unique_pixels) {
+  void FillLMDB(const bool unique_pixels, const bool padded_keys = false,
+      const string& suffix = "", const int label_offset = 0) {
     backend_ = DataParameter_DB_LMDB;
-    LOG(INFO) << "Using temporary lmdb " << *filename_;
-    CHECK_EQ(mkdir(filename_->c_str(), 0744), 0) << "mkdir " << filename_
-                                                 << "failed";
+    const string path = *filename_ + suffix;
+    LOG(INFO) << "Using temporary lmdb " << path;
+    CHECK_EQ(mkdir(path.c_str(), 0744), 0) << "mkdir " << path
+                                           << " failed";
     MDB_env *env;
     MDB_dbi dbi;
     MDB_val mdbkey, mdbdata;
@@ -77,7 +88,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
     CHECK_EQ(mdb_env_set_mapsize(env, 1099511627776), MDB_SUCCESS)  // 1TB
         << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(env, filename_->c_str(), 0, 0664), MDB_SUCCESS)
+    CHECK_EQ(mdb_env_open(env, path.c_str(), 0, 0664), MDB_SUCCESS)
         << "mdb_env_open failed";
     CHECK_EQ(mdb_txn_begin(env, NULL, 0, &txn), MDB_SUCCESS)
         << "mdb_txn_begin failed";
@@ -85,7 +96,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
     for (int i = 0; i < 5; ++i) {
       Datum datum;
-      datum.set_label(i);
+      datum.set_label(label_offset + i);
       datum.set_channels(2);
       datum.set_height(3);
       datum.set_width(4);
@@ -95,7 +106,11 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         data->push_back(static_cast<uint8_t>(datum));
       }
       stringstream ss;
-      ss << i;
+      if (padded_keys) {
+        ss << std::setw(8) << std::setfill('0') << i;
+      } else {
+        ss << i;
+      }
 
       string value;
       datum.SerializeToString(&value);
@@ -149,6 +164,146 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // As TestRead, but with the host example cache enabled: after the first
+  // pass every record is served from host RAM, or -- with a budget
+  // smaller than the dataset -- keeps churning through insertions and
+  // evictions. The output must be identical either way, serially and
+  // across decode workers.
+  void TestReadCached(const uint64_t cache_size, const int decode_threads) {
+    const Dtype scale = 3;
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_example_cache_size(cache_size);
+    data_param->set_decode_threads(decode_threads);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(scale);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+      }
+      for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(scale * i, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // Uses non-unique pixels (every pixel of image i has value i), so the
+  // expected output only depends on the image and the channel.
+  void TestReadMeanValues() {
+    const Dtype scale = 3;
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(scale);
+    transform_param->add_mean_value(10);
+    transform_param->add_mean_value(20);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        for (int c = 0; c < 2; ++c) {
+          const Dtype expected = scale * (i - (c ? 20 : 10));
+          for (int j = 0; j < 12; ++j) {
+            EXPECT_EQ(expected,
+                blob_top_data_->cpu_data()[(i * 2 + c) * 12 + j])
+                << "debug: iter " << iter << " i " << i << " c " << c
+                << " j " << j;
+          }
+        }
+      }
+    }
+  }
+
+  // Tests sharded reading: with num_shards 2 and shard_id 1 the layer
+  // starts one record in and strides the cursor by two, visiting records
+  // 1, 3, 0, 2, 4 (5 records do not divide evenly between 2 shards, so
+  // the wrap rotates the stripe onto the even records).
+  void TestReadShards() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_num_shards(2);
+    data_param->set_shard_id(1);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_label_->num(), 5);
+
+    const int kExpectedLabels[] = { 1, 3, 0, 2, 4 };
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(kExpectedLabels[i], blob_top_label_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
+  // Tests chunk-shuffled reading: records come back in a randomized
+  // order, but each keeps its data/label pairing and shows up with the
+  // same frequency over time.
+  void TestReadChunkShuffled() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    // Tiny chunks so even five records span several of them.
+    data_param->set_shuffle_chunks(2);
+    data_param->set_shuffle_chunk_size(2);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_label_->num(), 5);
+
+    vector<int> label_counts(5, 0);
+    const int kIters = 20;
+    for (int iter = 0; iter < kIters; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        const int label = static_cast<int>(blob_top_label_->cpu_data()[i]);
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        ++label_counts[label];
+        // With unique images every pixel equals the label, so this also
+        // checks that shuffling kept each record's data with its label.
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+    // Each record enters the shuffle buffer exactly once per pass over
+    // the chunks, so across 100 draws no record can drift from 20
+    // appearances by more than about one buffer's worth.
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_GE(label_counts[i], kIters - 5) << "label " << i;
+      EXPECT_LE(label_counts[i], kIters + 5) << "label " << i;
+    }
+  }
+
   void TestReadCrop() {
     const Dtype scale = 3;
     LayerParameter param;
@@ -312,6 +467,51 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads from the primary database plus a second one filled with
+  // labels offset by 100, so every record can be attributed to its
+  // source. With all sampling weight on the extra source, every label
+  // must come from it; with uniform weights, both sources must appear.
+  void TestReadMultiSource() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->add_extra_source(*filename_ + "_extra");
+    data_param->set_backend(backend_);
+    data_param->add_source_weight(0);
+    data_param->add_source_weight(1);
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+      for (int iter = 0; iter < 4; ++iter) {
+        layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_GE(blob_top_label_->cpu_data()[i], 100);
+        }
+      }
+    }
+    data_param->clear_source_weight();
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+      int num_primary = 0;
+      int num_extra = 0;
+      for (int iter = 0; iter < 4; ++iter) {
+        layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          if (blob_top_label_->cpu_data()[i] >= 100) {
+            ++num_extra;
+          } else {
+            ++num_primary;
+          }
+        }
+      }
+      // 20 uniform draws land on one source only with probability 2^-19.
+      EXPECT_GT(num_primary, 0);
+      EXPECT_GT(num_extra, 0);
+    }
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -331,6 +531,44 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadMeanValuesLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadMeanValues();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadChunkShuffledLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  const bool padded_keys = true;  // chunk shuffling needs keyed seeks
+  this->FillLevelDB(unique_pixels, padded_keys);
+  this->TestReadChunkShuffled();
+}
+
+TYPED_TEST(DataLayerTest, TestReadMultiSourceLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->FillLevelDB(unique_pixels, false, "_extra", 100);
+  this->TestReadMultiSource();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCached(1 << 20, 1);  // whole dataset fits; all hits
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedEvictingLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCached(64, 2);  // room for two examples; constant eviction
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLevelDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -369,6 +607,44 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadMeanValuesLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadMeanValues();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadChunkShuffledLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  const bool padded_keys = true;  // chunk shuffling needs keyed seeks
+  this->FillLMDB(unique_pixels, padded_keys);
+  this->TestReadChunkShuffled();
+}
+
+TYPED_TEST(DataLayerTest, TestReadMultiSourceLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->FillLMDB(unique_pixels, false, "_extra", 100);
+  this->TestReadMultiSource();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCached(1 << 20, 1);  // whole dataset fits; all hits
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedEvictingLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCached(64, 2);  // room for two examples; constant eviction
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
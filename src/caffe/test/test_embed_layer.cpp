@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class EmbedLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  EmbedLayerTest()
+      : blob_bottom_(new Blob<Dtype>(4, 1, 1, 1)),
+        blob_top_(new Blob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~EmbedLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+  void FillIds(const int input_dim) {
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      blob_bottom_->mutable_cpu_data()[i] = caffe_rng_rand() % input_dim;
+    }
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(EmbedLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(EmbedLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kInputDim = 10;
+  const int kNumOutput = 5;
+  LayerParameter layer_param;
+  EmbedParameter* param = layer_param.mutable_embed_param();
+  param->set_num_output(kNumOutput);
+  param->set_input_dim(kInputDim);
+  param->mutable_weight_filler()->set_type("uniform");
+  param->mutable_weight_filler()->set_min(-10);
+  param->mutable_weight_filler()->set_max(10);
+  this->FillIds(kInputDim);
+  EmbedLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 4);
+  EXPECT_EQ(this->blob_top_->channels(), kNumOutput);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // Each output row is exactly the looked-up weight row.
+  const Dtype* weight = layer.blobs()[0]->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    const int id = static_cast<int>(this->blob_bottom_->cpu_data()[i]);
+    for (int j = 0; j < kNumOutput; ++j) {
+      EXPECT_EQ(weight[id * kNumOutput + j],
+                this->blob_top_->cpu_data()[i * kNumOutput + j]);
+    }
+  }
+}
+
+TYPED_TEST(EmbedLayerTest, TestBackwardSparseRows) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kInputDim = 10;
+  const int kNumOutput = 3;
+  LayerParameter layer_param;
+  EmbedParameter* param = layer_param.mutable_embed_param();
+  param->set_num_output(kNumOutput);
+  param->set_input_dim(kInputDim);
+  param->mutable_weight_filler()->set_type("gaussian");
+  this->FillIds(kInputDim);
+  EmbedLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    this->blob_top_->mutable_cpu_diff()[i] = 1;
+  }
+  vector<bool> propagate_down(1, false);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+                 &(this->blob_bottom_vec_));
+  // The reported rows are exactly the distinct ids of the batch, and
+  // only those weight rows received gradient.
+  const vector<int>* rows = layer.sparse_param_rows(0);
+  ASSERT_TRUE(rows != NULL);
+  vector<int> expected;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    expected.push_back(static_cast<int>(this->blob_bottom_->cpu_data()[i]));
+  }
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()),
+                 expected.end());
+  ASSERT_EQ(expected.size(), rows->size());
+  for (int i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], (*rows)[i]);
+  }
+  const Dtype* weight_diff = layer.blobs()[0]->cpu_diff();
+  for (int id = 0; id < kInputDim; ++id) {
+    const bool touched =
+        std::find(expected.begin(), expected.end(), id) != expected.end();
+    for (int j = 0; j < kNumOutput; ++j) {
+      if (touched) {
+        EXPECT_NE(Dtype(0), weight_diff[id * kNumOutput + j]);
+      } else {
+        EXPECT_EQ(Dtype(0), weight_diff[id * kNumOutput + j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(EmbedLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  EmbedParameter* param = layer_param.mutable_embed_param();
+  param->set_num_output(5);
+  param->set_input_dim(10);
+  param->set_bias_term(true);
+  param->mutable_weight_filler()->set_type("gaussian");
+  param->mutable_bias_filler()->set_type("gaussian");
+  this->FillIds(10);
+  EmbedLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  // The ids are not differentiable: check the parameter blobs only.
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_), -2);
+}
+
+}  // namespace caffe
@@ -142,4 +142,26 @@ TYPED_TEST(GaussianFillerTest, TestFill) {
   EXPECT_LE(var, target_var * 5.);
 }
 
+TYPED_TEST(GaussianFillerTest, TestLargeFillReproducible) {
+  // Large enough to take the threaded fill path; the result must still
+  // be a function of the master seed alone.
+  Blob<TypeParam> blob_a((1 << 20) + 17, 1, 2, 1);
+  Blob<TypeParam> blob_b((1 << 20) + 17, 1, 2, 1);
+  Caffe::set_random_seed(1701);
+  this->filler_->Fill(&blob_a);
+  Caffe::set_random_seed(1701);
+  this->filler_->Fill(&blob_b);
+  const int count = blob_a.count();
+  const TypeParam* data_a = blob_a.cpu_data();
+  const TypeParam* data_b = blob_b.cpu_data();
+  TypeParam mean = 0.;
+  for (int i = 0; i < count; ++i) {
+    ASSERT_EQ(data_a[i], data_b[i]);
+    mean += data_a[i];
+  }
+  mean /= count;
+  EXPECT_GE(mean, this->filler_param_.mean() - this->filler_param_.std() * 5);
+  EXPECT_LE(mean, this->filler_param_.mean() + this->filler_param_.std() * 5);
+}
+
 }  // namespace caffe
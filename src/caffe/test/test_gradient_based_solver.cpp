@@ -23,11 +23,14 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 
  protected:
   GradientBasedSolverTest() :
-      seed_(1701), num_(5), channels_(3), height_(10), width_(10) {}
+      seed_(1701), num_(5), channels_(3), height_(10), width_(10),
+      history_half_(false) {}
 
   shared_ptr<SGDSolver<Dtype> > solver_;
   int seed_;
   int num_, channels_, height_, width_;
+  // Store the solver history in half precision (SGD only).
+  bool history_half_;
   Dtype delta_;  // Stability constant for AdaGrad.
 
   virtual SolverParameter_SolverType solver_type() = 0;
@@ -113,6 +116,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (history_half_) {
+      proto << "history_half: true ";
+    }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     this->solver_->Solve();
@@ -340,6 +346,17 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithWeightDecay) {
   this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay);
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithHalfHistory) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 1.0;
+  const Dtype kWeightDecay = 0.0;
+  const Dtype kMomentum = 0.5;
+  this->history_half_ = true;
+  // A single update from zero history: the binary16 rounding of the
+  // stored momentum stays well inside the checker's error margin.
+  this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, 0);
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithMomentum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 1.0;
@@ -120,4 +120,61 @@ TYPED_TEST(HDF5OutputLayerTest, TestForward) {
       this->output_file_name_;
 }
 
+TYPED_TEST(HDF5OutputLayerTest, TestForwardStaged) {
+  typedef typename TypeParam::Dtype Dtype;
+  hid_t file_id = H5Fopen(this->input_file_name_.c_str(), H5F_ACC_RDONLY,
+                          H5P_DEFAULT);
+  ASSERT_GE(file_id, 0) << "Failed to open HDF5 file" <<
+      this->input_file_name_;
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_DATASET_NAME, 0, 4,
+                       this->blob_data_);
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_LABEL_NAME, 0, 4,
+                       this->blob_label_);
+  herr_t status = H5Fclose(file_id);
+  EXPECT_GE(status, 0) << "Failed to close HDF5 file " <<
+      this->input_file_name_;
+  this->blob_bottom_vec_.push_back(this->blob_data_);
+  this->blob_bottom_vec_.push_back(this->blob_label_);
+
+  LayerParameter param;
+  param.mutable_hdf5_output_param()->set_file_name(this->output_file_name_);
+  param.mutable_hdf5_output_param()->set_staging_batches(2);
+  // The destructor joins the writer thread, so everything staged by the
+  // two Forwards below has been appended once the block exits.
+  {
+    HDF5OutputLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  }
+  file_id = H5Fopen(this->output_file_name_.c_str(), H5F_ACC_RDONLY,
+                          H5P_DEFAULT);
+  ASSERT_GE(file_id, 0) << "Failed to open HDF5 file" <<
+      this->output_file_name_;
+
+  Blob<Dtype> blob_data;
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_DATASET_NAME, 0, 4, &blob_data);
+  Blob<Dtype> blob_label;
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_LABEL_NAME, 0, 4, &blob_label);
+  // Both batches were appended to the extensible datasets in order.
+  ASSERT_EQ(2 * this->num_, blob_data.num());
+  ASSERT_EQ(2 * this->num_, blob_label.num());
+  const int data_dim = this->blob_data_->count() / this->num_;
+  const int label_dim = this->blob_label_->count() / this->num_;
+  for (int b = 0; b < 2; ++b) {
+    for (int i = 0; i < this->blob_data_->count(); ++i) {
+      EXPECT_EQ(this->blob_data_->cpu_data()[i],
+          blob_data.cpu_data()[b * this->num_ * data_dim + i]);
+    }
+    for (int i = 0; i < this->blob_label_->count(); ++i) {
+      EXPECT_EQ(this->blob_label_->cpu_data()[i],
+          blob_label.cpu_data()[b * this->num_ * label_dim + i]);
+    }
+  }
+
+  status = H5Fclose(file_id);
+  EXPECT_GE(status, 0) << "Failed to close HDF5 file " <<
+      this->output_file_name_;
+}
+
 }  // namespace caffe
@@ -121,4 +121,47 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Same data as TestRead, but prefetched in hyperslab chunks of 3 rows,
+  // which does not divide the 10 rows per file evenly, so batches span
+  // chunk and file boundaries.
+  LayerParameter param;
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_chunk_size(3);
+  int num_cols = 8;
+  int height = 6;
+  int width = 5;
+  const int data_size = num_cols * height * width;
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), batch_size);
+  EXPECT_EQ(this->blob_top_data_->channels(), num_cols);
+  EXPECT_EQ(this->blob_top_data_->height(), height);
+  EXPECT_EQ(this->blob_top_data_->width(), width);
+
+  for (int iter = 0; iter < 10; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    int label_offset = 1 + ((iter % 2 == 0) ? 0 : batch_size);
+    int data_offset = (iter % 2 == 0) ? 0 : batch_size * data_size;
+    int file_offset = (iter % 4 < 2) ? 0 : 2400;
+    for (int i = 0; i < batch_size; ++i) {
+      EXPECT_EQ(
+        label_offset + i,
+        this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < data_size; ++j) {
+        const int idx = i * data_size + j;
+        EXPECT_EQ(
+          file_offset + data_offset + idx,
+          this->blob_top_data_->cpu_data()[idx])
+          << "debug: i " << i << " j " << j << " iter " << iter;
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -107,6 +107,73 @@ TYPED_TEST(ImageDataLayerTest, TestResize) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestArchive) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Pack the list into an archive plus index, the same way
+  // tools/pack_image_archive would: the encoded file bytes concatenated,
+  // with one "filename label offset size" index line per image.
+  string archive_name;
+  string index_name;
+  MakeTempFilename(&archive_name);
+  MakeTempFilename(&index_name);
+  std::ifstream image(EXAMPLES_SOURCE_DIR "images/cat.jpg",
+      std::ios::in | std::ios::binary);
+  ASSERT_TRUE(image.good());
+  image.seekg(0, std::ios::end);
+  const size_t size = image.tellg();
+  image.seekg(0, std::ios::beg);
+  string bytes(size, ' ');
+  image.read(&bytes[0], size);
+  ASSERT_TRUE(image.good());
+  std::ofstream archive_file(archive_name.c_str(),
+      std::ios::out | std::ios::binary);
+  std::ofstream index_file(index_name.c_str());
+  for (int i = 0; i < 5; ++i) {
+    archive_file.write(bytes.data(), size);
+    index_file << "cat.jpg " << i << " " << i * size << " " << size << "\n";
+  }
+  archive_file.close();
+  index_file.close();
+
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(index_name.c_str());
+  image_data_param->set_archive(archive_name.c_str());
+  image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 360);
+  EXPECT_EQ(this->blob_top_data_->width(), 480);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+  }
+
+  // The archived images must decode to the same pixels as the per-file
+  // path produces.
+  Blob<Dtype> file_data;
+  Blob<Dtype> file_label;
+  vector<Blob<Dtype>*> file_top_vec;
+  file_top_vec.push_back(&file_data);
+  file_top_vec.push_back(&file_label);
+  LayerParameter file_param;
+  ImageDataParameter* file_image_data_param =
+      file_param.mutable_image_data_param();
+  file_image_data_param->set_batch_size(5);
+  file_image_data_param->set_source(this->filename_.c_str());
+  file_image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> file_layer(file_param);
+  file_layer.SetUp(this->blob_bottom_vec_, &file_top_vec);
+  file_layer.Forward(this->blob_bottom_vec_, &file_top_vec);
+  ASSERT_EQ(file_data.count(), this->blob_top_data_->count());
+  for (int i = 0; i < file_data.count(); ++i) {
+    EXPECT_EQ(file_data.cpu_data()[i], this->blob_top_data_->cpu_data()[i]);
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestShuffle) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
@@ -85,6 +85,264 @@ TYPED_TEST(InnerProductLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardTranspose) {
+  typedef typename TypeParam::Dtype Dtype;
+  bool IS_VALID_CUDA = false;
+#ifndef CPU_ONLY
+  IS_VALID_CUDA = CAFFE_TEST_CUDA_PROP.major >= 2;
+#endif
+  if (Caffe::mode() == Caffe::CPU ||
+      sizeof(Dtype) == 4 || IS_VALID_CUDA) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_min(1);
+    inner_product_param->mutable_bias_filler()->set_max(2);
+    // Reference with the standard N x K weight layout.
+    shared_ptr<InnerProductLayer<Dtype> > ref_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    ref_layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    ref_layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const int count = this->blob_top_->count();
+    vector<Dtype> reference(this->blob_top_->cpu_data(),
+        this->blob_top_->cpu_data() + count);
+    // Transposed layer with the same weights, copied element by element
+    // into the K x N layout.
+    inner_product_param->set_transpose(true);
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const int num_output = 10;
+    const int input_dim =
+        this->blob_bottom_->count() / this->blob_bottom_->num();
+    EXPECT_EQ(layer->blobs()[0]->height(), input_dim);
+    EXPECT_EQ(layer->blobs()[0]->width(), num_output);
+    const Dtype* ref_weight = ref_layer->blobs()[0]->cpu_data();
+    Dtype* weight = layer->blobs()[0]->mutable_cpu_data();
+    for (int n = 0; n < num_output; ++n) {
+      for (int k = 0; k < input_dim; ++k) {
+        weight[k * num_output + n] = ref_weight[n * input_dim + k];
+      }
+    }
+    layer->blobs()[1]->CopyFrom(*ref_layer->blobs()[1]);
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const Dtype* data = this->blob_top_->cpu_data();
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(reference[i], data[i], 1e-4);
+    }
+  } else {
+    LOG(ERROR) << "Skipping test due to old architecture.";
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantized) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // the int8 path only exists in Forward_cpu
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_min(1);
+  inner_product_param->mutable_bias_filler()->set_max(2);
+  // fp32 reference
+  shared_ptr<InnerProductLayer<Dtype> > ref_layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  ref_layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  ref_layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int count = this->blob_top_->count();
+  vector<Dtype> reference(this->blob_top_->cpu_data(),
+      this->blob_top_->cpu_data() + count);
+  // Quantized layer with the same weights. The bottom is uniform in
+  // [0, 1], so the calibrated input range is 1.
+  layer_param.mutable_quantization_param()->set_quantize(true);
+  layer_param.mutable_quantization_param()->set_input_range(1);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->blobs()[0]->CopyFrom(*ref_layer->blobs()[0]);
+  layer->blobs()[1]->CopyFrom(*ref_layer->blobs()[1]);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // Each of the K = 60 products carries at most ~1/254 quantization error
+  // per operand, so the accumulated error stays well below 0.5.
+  const Dtype* data = this->blob_top_->cpu_data();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(reference[i], data[i], 0.5);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantizedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // the weights-only int8 path only exists in Forward_cpu
+  }
+  Caffe::set_phase(Caffe::TEST);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_min(1);
+  inner_product_param->mutable_bias_filler()->set_max(2);
+  // fp32 reference
+  shared_ptr<InnerProductLayer<Dtype> > ref_layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  ref_layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  ref_layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int count = this->blob_top_->count();
+  vector<Dtype> reference(this->blob_top_->cpu_data(),
+      this->blob_top_->cpu_data() + count);
+  // Weights-only quantized layer with the same weights; no input
+  // calibration is involved.
+  layer_param.mutable_quantization_param()->set_quantize_weights(true);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->blobs()[0]->CopyFrom(*ref_layer->blobs()[0]);
+  layer->blobs()[1]->CopyFrom(*ref_layer->blobs()[1]);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // Only the weights are rounded: each of the K = 60 terms carries at
+  // most a ~1/254 weight error against inputs in [0, 1], so outputs
+  // stay within ~0.24 of the reference.
+  const Dtype* data = this->blob_top_->cpu_data();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(reference[i], data[i], 0.25);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparse) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // the CSR path only exists in Forward_cpu
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("uniform");
+  inner_product_param->mutable_weight_filler()->set_min(-1);
+  inner_product_param->mutable_weight_filler()->set_max(1);
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_min(1);
+  inner_product_param->mutable_bias_filler()->set_max(2);
+  // Dense reference with 90% of the weights pruned to zero.
+  shared_ptr<InnerProductLayer<Dtype> > ref_layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  ref_layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Dtype* weight = ref_layer->blobs()[0]->mutable_cpu_data();
+  for (int i = 0; i < ref_layer->blobs()[0]->count(); ++i) {
+    if (i % 10 != 0) {
+      weight[i] = 0;
+    }
+  }
+  ref_layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int count = this->blob_top_->count();
+  vector<Dtype> reference(this->blob_top_->cpu_data(),
+      this->blob_top_->cpu_data() + count);
+  // The SPARSE engine with the same weights must match.
+  inner_product_param->set_engine(InnerProductParameter_Engine_SPARSE);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new SparseInnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->blobs()[0]->CopyFrom(*ref_layer->blobs()[0]);
+  layer->blobs()[1]->CopyFrom(*ref_layer->blobs()[1]);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const Dtype* data = this->blob_top_->cpu_data();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(reference[i], data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSharded) {
+  typedef typename TypeParam::Dtype Dtype;
+  bool IS_VALID_CUDA = false;
+#ifndef CPU_ONLY
+  IS_VALID_CUDA = CAFFE_TEST_CUDA_PROP.major >= 2;
+#endif
+  if (Caffe::mode() == Caffe::CPU ||
+      sizeof(Dtype) == 4 || IS_VALID_CUDA) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_weight_filler()->set_min(-1);
+    inner_product_param->mutable_weight_filler()->set_max(1);
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_min(1);
+    inner_product_param->mutable_bias_filler()->set_max(2);
+    // Two shards on the same device: exercises the split and the gather
+    // without needing a second card.
+    inner_product_param->add_shard_device(0);
+    inner_product_param->add_shard_device(0);
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new ShardedInnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    // Dense reference assembled from the shard slices: shard s's weight
+    // blob holds rows [5s, 5s + 5) of the full 10 x 60 weight matrix.
+    inner_product_param->clear_shard_device();
+    shared_ptr<InnerProductLayer<Dtype> > ref_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    ref_layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    for (int s = 0; s < 2; ++s) {
+      caffe_copy(layer->blobs()[2 * s]->count(),
+          layer->blobs()[2 * s]->cpu_data(),
+          ref_layer->blobs()[0]->mutable_cpu_data() +
+          s * layer->blobs()[0]->count());
+      caffe_copy(layer->blobs()[2 * s + 1]->count(),
+          layer->blobs()[2 * s + 1]->cpu_data(),
+          ref_layer->blobs()[1]->mutable_cpu_data() +
+          s * layer->blobs()[1]->count());
+    }
+    ref_layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const int count = this->blob_top_->count();
+    vector<Dtype> reference(this->blob_top_->cpu_data(),
+        this->blob_top_->cpu_data() + count);
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const Dtype* data = this->blob_top_->cpu_data();
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(reference[i], data[i], 1e-4);
+    }
+  } else {
+    LOG(ERROR) << "Skipping test due to old architecture.";
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestGradientSharded) {
+  typedef typename TypeParam::Dtype Dtype;
+  bool IS_VALID_CUDA = false;
+#ifndef CPU_ONLY
+  IS_VALID_CUDA = CAFFE_TEST_CUDA_PROP.major >= 2;
+#endif
+  if (Caffe::mode() == Caffe::CPU ||
+      sizeof(Dtype) == 4 || IS_VALID_CUDA) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    // Three shards over ten outputs gives an uneven 4/3/3 split.
+    inner_product_param->add_shard_device(0);
+    inner_product_param->add_shard_device(0);
+    inner_product_param->add_shard_device(0);
+    ShardedInnerProductLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+        &(this->blob_top_vec_));
+  } else {
+    LOG(ERROR) << "Skipping test due to old architecture.";
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   bool IS_VALID_CUDA = false;
@@ -110,4 +368,30 @@ TYPED_TEST(InnerProductLayerTest, TestGradient) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestGradientTranspose) {
+  typedef typename TypeParam::Dtype Dtype;
+  bool IS_VALID_CUDA = false;
+#ifndef CPU_ONLY
+  IS_VALID_CUDA = CAFFE_TEST_CUDA_PROP.major >= 2;
+#endif
+  if (Caffe::mode() == Caffe::CPU ||
+      sizeof(Dtype) == 4 || IS_VALID_CUDA) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(true);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_min(1);
+    inner_product_param->mutable_bias_filler()->set_max(2);
+    InnerProductLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+        &(this->blob_top_vec_));
+  } else {
+    LOG(ERROR) << "Skipping test due to old architecture.";
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,66 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CompressedProtoTest : public ::testing::Test {
+ protected:
+  // A blob big enough to span several compression blocks, with varied
+  // but compressible contents.
+  virtual void SetUp() {
+    blob_.set_num(1);
+    blob_.set_channels(1);
+    blob_.set_height(1200);
+    blob_.set_width(2048);
+    unsigned int seed = 1701;
+    for (int i = 0; i < 1200 * 2048; ++i) {
+      seed = seed * 1103515245 + 12345;
+      blob_.add_data(static_cast<float>((seed >> 16) & 0xFF) / 256);
+    }
+  }
+
+  BlobProto blob_;
+};
+
+TEST_F(CompressedProtoTest, TestRoundTrip) {
+  string filename;
+  MakeTempFilename(&filename);
+  WriteProtoToCompressedBinaryFile(blob_, filename);
+  BlobProto read_back;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(filename, &read_back));
+  ASSERT_EQ(blob_.data_size(), read_back.data_size());
+  for (int i = 0; i < blob_.data_size(); i += 1000) {
+    EXPECT_EQ(blob_.data(i), read_back.data(i));
+  }
+}
+
+TEST_F(CompressedProtoTest, TestPlainFilesStillRead) {
+  string filename;
+  MakeTempFilename(&filename);
+  WriteProtoToBinaryFile(blob_, filename);
+  BlobProto read_back;
+  EXPECT_TRUE(ReadProtoFromBinaryFile(filename, &read_back));
+  EXPECT_EQ(blob_.data_size(), read_back.data_size());
+}
+
+TEST_F(CompressedProtoTest, TestCompressedIsSmaller) {
+  string plain_name, compressed_name;
+  MakeTempFilename(&plain_name);
+  MakeTempFilename(&compressed_name);
+  WriteProtoToBinaryFile(blob_, plain_name);
+  WriteProtoToCompressedBinaryFile(blob_, compressed_name);
+  std::ifstream plain(plain_name.c_str(), std::ios::binary | std::ios::ate);
+  std::ifstream compressed(compressed_name.c_str(),
+      std::ios::binary | std::ios::ate);
+  EXPECT_LT(compressed.tellg(), plain.tellg());
+}
+
+}  // namespace caffe
@@ -3,6 +3,7 @@
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -79,6 +80,32 @@ TYPED_TEST(MathFunctionsTest, TestHammingDistanceCPU) {
             caffe_cpu_hamming_distance<TypeParam>(n, x, y));
 }
 
+TYPED_TEST(MathFunctionsTest, TestHammingDistanceMatrixCPU) {
+  // An odd dim exercises the packed codes' partial last word; enough
+  // rows of y to span more than one tile.
+  const int n = 5;
+  const int m = 131;
+  const int dim = 9;
+  Blob<TypeParam> x_blob(n, dim, 1, 1);
+  Blob<TypeParam> y_blob(m, dim, 1, 1);
+  TypeParam* x = x_blob.mutable_cpu_data();
+  TypeParam* y = y_blob.mutable_cpu_data();
+  for (int i = 0; i < x_blob.count(); ++i) {
+    x[i] = caffe_rng_rand() % 4096;
+  }
+  for (int i = 0; i < y_blob.count(); ++i) {
+    y[i] = caffe_rng_rand() % 4096;
+  }
+  vector<int> out(n * m);
+  caffe_cpu_hamming_distance_matrix(n, m, dim, x, y, &out[0]);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < m; ++j) {
+      EXPECT_EQ(this->ReferenceHammingDistance(dim, x + i * dim, y + j * dim),
+                out[i * m + j]);
+    }
+  }
+}
+
 TYPED_TEST(MathFunctionsTest, TestAsumCPU) {
   int n = this->blob_bottom_->count();
   const TypeParam* x = this->blob_bottom_->cpu_data();
@@ -90,6 +117,73 @@ TYPED_TEST(MathFunctionsTest, TestAsumCPU) {
   EXPECT_LT((cpu_asum - std_asum) / std_asum, 1e-2);
 }
 
+TYPED_TEST(MathFunctionsTest, TestStridedAsumAmaxCPU) {
+  const int stride = 7;
+  const int count = this->blob_bottom_->count();
+  // An uneven tail checks the sample-count rounding.
+  const int n = (count + stride - 1) / stride;
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  TypeParam std_asum = 0;
+  TypeParam std_amax = 0;
+  for (int i = 0; i < count; i += stride) {
+    std_asum += std::fabs(x[i]);
+    std_amax = std::max(std_amax, TypeParam(std::fabs(x[i])));
+  }
+  const TypeParam asum = caffe_cpu_strided_asum<TypeParam>(n, x, stride);
+  EXPECT_LT(std::fabs(asum - std_asum) / std_asum, 1e-4);
+  EXPECT_EQ(std_amax, caffe_cpu_strided_amax<TypeParam>(n, x, stride));
+  EXPECT_EQ(caffe_cpu_strided_amax<TypeParam>(0, x, stride), TypeParam(0));
+}
+
+TYPED_TEST(MathFunctionsTest, TestLargeAsumDotCPU) {
+  // Big enough to take the threaded reduction path; an uneven length
+  // checks the last chunk's bounds.
+  const int n = (1 << 20) + 3;
+  Blob<TypeParam> x_blob(n, 1, 1, 1);
+  TypeParam* x = x_blob.mutable_cpu_data();
+  TypeParam std_asum = 0;
+  TypeParam std_dot = 0;
+  for (int i = 0; i < n; ++i) {
+    x[i] = (i % 7) - 3;
+    std_asum += std::fabs(x[i]);
+    std_dot += x[i] * x[i];
+  }
+  const TypeParam cpu_asum = caffe_cpu_asum<TypeParam>(n, x);
+  EXPECT_LT(std::fabs(cpu_asum - std_asum) / std_asum, 1e-4);
+  const TypeParam cpu_dot = caffe_cpu_dot<TypeParam>(n, x, x);
+  EXPECT_LT(std::fabs(cpu_dot - std_dot) / std_dot, 1e-4);
+}
+
+TYPED_TEST(MathFunctionsTest, TestExpLnPowxCPU) {
+  // Odd length exercises the vectorized implementations' scalar tails.
+  const int n = 259;
+  Blob<TypeParam> a_blob(n, 1, 1, 1);
+  Blob<TypeParam> y_blob(n, 1, 1, 1);
+  TypeParam* a = a_blob.mutable_cpu_data();
+  TypeParam* y = y_blob.mutable_cpu_data();
+  for (int i = 0; i < n; ++i) {
+    a[i] = TypeParam(-10) + TypeParam(20) * i / n;
+  }
+  caffe_exp(n, a, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(std::exp(a[i]), y[i], 1e-5 * std::exp(a[i]) + 1e-7);
+  }
+  for (int i = 0; i < n; ++i) {
+    a[i] = TypeParam(1e-4) + TypeParam(100) * i / n;
+  }
+  caffe_log(n, a, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(std::log(a[i]), y[i], 1e-5 * std::fabs(std::log(a[i])) + 1e-6);
+  }
+  for (int i = 0; i < n; ++i) {
+    a[i] = TypeParam(-5) + TypeParam(10) * i / n;  // mixed signs
+  }
+  caffe_powx(n, a, TypeParam(2), y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(a[i] * a[i], y[i], 1e-5 * a[i] * a[i] + 1e-6);
+  }
+}
+
 TYPED_TEST(MathFunctionsTest, TestSignCPU) {
   int n = this->blob_bottom_->count();
   const TypeParam* x = this->blob_bottom_->cpu_data();
@@ -144,6 +238,40 @@ TYPED_TEST(MathFunctionsTest, TestCopyCPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestSumCPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* y = this->blob_top_->cpu_data();
+  const TypeParam* inputs[3] = { x, y, x };
+  const TypeParam coeffs[3] = { 1, -2, 3 };
+  Blob<TypeParam> result(this->blob_bottom_->num(),
+      this->blob_bottom_->channels(), this->blob_bottom_->height(),
+      this->blob_bottom_->width());
+  caffe_sum(n, 3, inputs, static_cast<const TypeParam*>(NULL),
+      result.mutable_cpu_data());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(x[i] + y[i] + x[i], result.cpu_data()[i]);
+  }
+  caffe_sum(n, 3, inputs, coeffs, result.mutable_cpu_data());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(x[i] - 2 * y[i] + 3 * x[i], result.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestProdCPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* y = this->blob_top_->cpu_data();
+  const TypeParam* inputs[3] = { x, y, x };
+  Blob<TypeParam> result(this->blob_bottom_->num(),
+      this->blob_bottom_->channels(), this->blob_bottom_->height(),
+      this->blob_bottom_->width());
+  caffe_prod(n, 3, inputs, result.mutable_cpu_data());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(x[i] * y[i] * x[i], result.cpu_data()[i]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 // TODO: Fix caffe_gpu_hamming_distance and re-enable this test.
@@ -229,6 +357,50 @@ TYPED_TEST(MathFunctionsTest, TestCopyGPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestSumGPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x_gpu = this->blob_bottom_->gpu_data();
+  const TypeParam* y_gpu = this->blob_top_->gpu_data();
+  // Eleven inputs to exercise the chunked accumulation path as well.
+  const TypeParam* inputs[11] = { x_gpu, y_gpu, x_gpu, y_gpu, x_gpu, y_gpu,
+      x_gpu, y_gpu, x_gpu, y_gpu, x_gpu };
+  TypeParam coeffs[11];
+  for (int i = 0; i < 11; ++i) {
+    coeffs[i] = i + 1;
+  }
+  Blob<TypeParam> result(this->blob_bottom_->num(),
+      this->blob_bottom_->channels(), this->blob_bottom_->height(),
+      this->blob_bottom_->width());
+  caffe_gpu_sum(n, 11, inputs, coeffs, result.mutable_gpu_data());
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* y = this->blob_top_->cpu_data();
+  for (int i = 0; i < n; ++i) {
+    TypeParam expected = 0;
+    for (int j = 0; j < 11; ++j) {
+      expected += coeffs[j] * (j % 2 ? y[i] : x[i]);
+    }
+    // The device may contract the multiply-adds into FMAs, so the result
+    // is not bit-identical to the host reference.
+    EXPECT_NEAR(expected, result.cpu_data()[i], 1e-3);
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestProdGPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x_gpu = this->blob_bottom_->gpu_data();
+  const TypeParam* y_gpu = this->blob_top_->gpu_data();
+  const TypeParam* inputs[3] = { x_gpu, y_gpu, x_gpu };
+  Blob<TypeParam> result(this->blob_bottom_->num(),
+      this->blob_bottom_->channels(), this->blob_bottom_->height(),
+      this->blob_bottom_->width());
+  caffe_gpu_prod(n, 3, inputs, result.mutable_gpu_data());
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* y = this->blob_top_->cpu_data();
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(x[i] * y[i] * x[i], result.cpu_data()[i]);
+  }
+}
+
 #endif
 
 
@@ -1,3 +1,5 @@
+#include <boost/thread.hpp>
+
 #include <string>
 #include <vector>
 
@@ -111,6 +113,98 @@ TYPED_TEST(MemoryDataLayerTest, TestForward) {
   }
 }
 
+// Claims, fills and commits num_batches slots, tagging every data and
+// label element of a slot with its claim handle; slots are consumed in
+// claim order, so the consumer expects tag i on its i-th Forward.
+template <typename Dtype>
+void MemoryDataRingProducer(MemoryDataLayer<Dtype>* layer,
+    const int num_batches, const int data_count, const int label_count) {
+  for (int i = 0; i < num_batches; ++i) {
+    Dtype* data;
+    Dtype* labels;
+    unsigned int slot;
+    while (!layer->ClaimBatchSlot(&data, &labels, &slot)) {
+      boost::this_thread::yield();
+    }
+    for (int j = 0; j < data_count; ++j) {
+      data[j] = slot;
+    }
+    for (int j = 0; j < label_count; ++j) {
+      labels[j] = slot;
+    }
+    layer->CommitBatchSlot(slot);
+  }
+}
+
+TYPED_TEST(MemoryDataLayerTest, TestRingProducers) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  md_param->set_ring_slots(3);
+  shared_ptr<MemoryDataLayer<Dtype> > layer(
+      new MemoryDataLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int data_count = this->batch_size_ * this->channels_ *
+      this->height_ * this->width_;
+  // Two producers feed the ring while this thread consumes; the claim
+  // order fixes the consumption order regardless of the interleaving.
+  const int batches_per_producer = 3 * this->batches_;
+  boost::thread producer_a(&MemoryDataRingProducer<Dtype>, layer.get(),
+      batches_per_producer, data_count, this->batch_size_);
+  boost::thread producer_b(&MemoryDataRingProducer<Dtype>, layer.get(),
+      batches_per_producer, data_count, this->batch_size_);
+  for (int i = 0; i < 2 * batches_per_producer; ++i) {
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    for (int j = 0; j < this->data_blob_->count(); ++j) {
+      EXPECT_EQ(Dtype(i), this->data_blob_->cpu_data()[j]);
+    }
+    for (int j = 0; j < this->label_blob_->count(); ++j) {
+      EXPECT_EQ(Dtype(i), this->label_blob_->cpu_data()[j]);
+    }
+  }
+  producer_a.join();
+  producer_b.join();
+}
+
+TYPED_TEST(MemoryDataLayerTest, TestRingFull) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  md_param->set_ring_slots(2);
+  shared_ptr<MemoryDataLayer<Dtype> > layer(
+      new MemoryDataLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Dtype* data;
+  Dtype* labels;
+  unsigned int slot;
+  ASSERT_TRUE(layer->ClaimBatchSlot(&data, &labels, &slot));
+  EXPECT_EQ(0U, slot);
+  layer->CommitBatchSlot(slot);
+  ASSERT_TRUE(layer->ClaimBatchSlot(&data, &labels, &slot));
+  EXPECT_EQ(1U, slot);
+  layer->CommitBatchSlot(slot);
+  // Both slots are committed and unconsumed, so the ring is full.
+  EXPECT_FALSE(layer->ClaimBatchSlot(&data, &labels, &slot));
+  // The first slot is recycled on the Forward after the one that serves
+  // it, once the net cannot reference its batch any more.
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_FALSE(layer->ClaimBatchSlot(&data, &labels, &slot));
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  ASSERT_TRUE(layer->ClaimBatchSlot(&data, &labels, &slot));
+  EXPECT_EQ(2U, slot);
+  EXPECT_FALSE(layer->ClaimBatchSlot(&data, &labels, &slot));
+}
+
 TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   typedef typename TypeParam::Dtype Dtype;
 
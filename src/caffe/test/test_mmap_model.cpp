@@ -0,0 +1,149 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mmap_model.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MMapModelTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    // Two layers with one parameter blob each, so the round trip covers
+    // payload alignment between consecutive blobs.
+    net_param_.set_name("mmap_test_net");
+    LayerParameter* layer1 = net_param_.add_layers();
+    layer1->set_name("layer1");
+    BlobProto* blob1 = layer1->add_blobs();
+    blob1->set_num(2);
+    blob1->set_channels(3);
+    blob1->set_height(1);
+    blob1->set_width(1);
+    for (int i = 0; i < 6; ++i) {
+      blob1->add_data(0.5 * i);
+    }
+    LayerParameter* layer2 = net_param_.add_layers();
+    layer2->set_name("layer2");
+    BlobProto* blob2 = layer2->add_blobs();
+    blob2->set_num(1);
+    blob2->set_channels(4);
+    blob2->set_height(1);
+    blob2->set_width(1);
+    for (int i = 0; i < 4; ++i) {
+      blob2->add_data(-1.5 * i);
+    }
+  }
+
+  string filename_;
+  NetParameter net_param_;
+};
+
+TEST_F(MMapModelTest, TestRoundTrip) {
+  WriteNetParamsToMMapFile(net_param_, filename_);
+  MMapModel<float> model(filename_);
+  const NetParameter& index = model.index();
+  ASSERT_EQ(index.layers_size(), 2);
+  EXPECT_EQ(index.layers(0).name(), "layer1");
+  EXPECT_EQ(index.layers(1).name(), "layer2");
+  // The index carries shapes but no data.
+  ASSERT_EQ(index.layers(0).blobs_size(), 1);
+  EXPECT_EQ(index.layers(0).blobs(0).num(), 2);
+  EXPECT_EQ(index.layers(0).blobs(0).channels(), 3);
+  EXPECT_EQ(index.layers(0).blobs(0).data_size(), 0);
+  // The payloads alias the mapped pages and match what was written.
+  const float* data1 = model.blob_data(0);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(data1[i], 0.5f * i);
+  }
+  const float* data2 = model.blob_data(1);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(data2[i], -1.5f * i);
+  }
+}
+
+TEST_F(MMapModelTest, TestPayloadAlignment) {
+  WriteNetParamsToMMapFile(net_param_, filename_);
+  MMapModel<float> model(filename_);
+  EXPECT_EQ(reinterpret_cast<size_t>(model.blob_data(0))
+      % kMMapModelAlignment, 0);
+  EXPECT_EQ(reinterpret_cast<size_t>(model.blob_data(1))
+      % kMMapModelAlignment, 0);
+}
+
+class MMapSolverStateTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    state_.set_iter(1200);
+    state_.set_current_step(3);
+    state_.set_learned_net("some_net.caffemodel");
+    // Two history blobs, so the round trip covers payload alignment.
+    BlobProto* blob1 = state_.add_history();
+    blob1->set_num(2);
+    blob1->set_channels(3);
+    blob1->set_height(1);
+    blob1->set_width(1);
+    for (int i = 0; i < 6; ++i) {
+      blob1->add_data(0.25 * i);
+    }
+    BlobProto* blob2 = state_.add_history();
+    blob2->set_num(1);
+    blob2->set_channels(4);
+    blob2->set_height(1);
+    blob2->set_width(1);
+    for (int i = 0; i < 4; ++i) {
+      blob2->add_data(-0.75 * i);
+    }
+  }
+
+  string filename_;
+  SolverState state_;
+};
+
+TEST_F(MMapSolverStateTest, TestRoundTrip) {
+  WriteSolverStateToMMapFile(state_, filename_);
+  MMapSolverState<float> state(filename_);
+  const SolverState& index = state.index();
+  EXPECT_EQ(index.iter(), 1200);
+  EXPECT_EQ(index.current_step(), 3);
+  EXPECT_EQ(index.learned_net(), "some_net.caffemodel");
+  // The index carries shapes but no data.
+  ASSERT_EQ(index.history_size(), 2);
+  EXPECT_EQ(index.history(0).num(), 2);
+  EXPECT_EQ(index.history(0).channels(), 3);
+  EXPECT_EQ(index.history(0).data_size(), 0);
+  // The payloads alias the mapped pages and match what was written.
+  const float* data1 = state.blob_data(0);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(data1[i], 0.25f * i);
+  }
+  const float* data2 = state.blob_data(1);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(data2[i], -0.75f * i);
+  }
+}
+
+TEST_F(MMapSolverStateTest, TestPayloadAlignment) {
+  WriteSolverStateToMMapFile(state_, filename_);
+  MMapSolverState<float> state(filename_);
+  EXPECT_EQ(reinterpret_cast<size_t>(state.blob_data(0))
+      % kMMapModelAlignment, 0);
+  EXPECT_EQ(reinterpret_cast<size_t>(state.blob_data(1))
+      % kMMapModelAlignment, 0);
+}
+
+TEST_F(MMapSolverStateTest, TestFileDetection) {
+  WriteSolverStateToMMapFile(state_, filename_);
+  EXPECT_TRUE(IsMMapSolverStateFile(filename_));
+  string plain_filename;
+  MakeTempFilename(&plain_filename);
+  WriteProtoToBinaryFile(state_, plain_filename);
+  EXPECT_FALSE(IsMMapSolverStateFile(plain_filename));
+}
+
+}  // namespace caffe
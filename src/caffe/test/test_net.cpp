@@ -9,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -123,6 +124,106 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitInputConvNet() {
+    const string& proto =
+        "name: 'InputConvNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 8 "
+        "input_dim: 8 "
+        "layers: { "
+        "  name: 'conv' "
+        "  type: CONVOLUTION "
+        "  convolution_param { "
+        "    num_output: 2 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitFrozenPrefixNet() {
+    const string& proto =
+        "name: 'FrozenPrefixNetwork' "
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 2 "
+        "    height: 3 "
+        "    width: 4 "
+        "    num: 5 "
+        "    channels: 1 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.01 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} "
+        "layers: { "
+        "  name: 'frozenip' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.01 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0 "
+        "    } "
+        "  } "
+        "  blobs_lr: 0. "
+        "  blobs_lr: 0. "
+        "  bottom: 'data' "
+        "  top: 'frozenip' "
+        "} "
+        "layers: { "
+        "  name: 'innerproduct' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.01 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0 "
+        "    } "
+        "  } "
+        "  blobs_lr: 1. "
+        "  blobs_lr: 2. "
+        "  bottom: 'frozenip' "
+        "  top: 'innerproduct' "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: SOFTMAX_LOSS "
+        "  bottom: 'innerproduct' "
+        "  bottom: 'label' "
+        "  top: 'top_loss' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
   virtual void InitTinyNetEuclidean(const bool force_backward = false) {
     string proto =
         "name: 'TinyTestEuclidLossNetwork' "
@@ -534,6 +635,161 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitMemoryPlanChainNet(const bool optimize_memory,
+      const bool half_activations = false) {
+    ostringstream proto;
+    proto <<
+        "name: 'MemoryPlanChainNetwork' ";
+    if (optimize_memory) {
+      proto << "optimize_memory: true ";
+    }
+    if (half_activations) {
+      proto << "half_activations: true ";
+    }
+    proto <<
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 2 "
+        "    height: 3 "
+        "    width: 4 "
+        "    data_filler { "
+        "      type: 'constant' "
+        "      value: 1 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "} ";
+    InitNetFromProtoString(proto.str());
+  }
+
+  virtual void InitCheckpointChainNet(const int checkpoint_interval) {
+    ostringstream proto;
+    proto <<
+        "name: 'CheckpointChainNetwork' ";
+    if (checkpoint_interval > 0) {
+      proto << "checkpoint_interval: " << checkpoint_interval << " ";
+    }
+    proto <<
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 2 "
+        "    height: 3 "
+        "    width: 4 "
+        "    data_filler { "
+        "      type: 'constant' "
+        "      value: 1 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "} "
+        "layers: { "
+        "  name: 'targets' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 10 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'constant' "
+        "      value: 0 "
+        "    } "
+        "  } "
+        "  top: 'targets' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip3' "
+        "  bottom: 'targets' "
+        "} ";
+    InitNetFromProtoString(proto.str());
+  }
+
   virtual void InitReshapableNet() {
     const string& proto =
         "name: 'ReshapableNetwork' "
@@ -596,10 +852,95 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // A two-stage pipelined net (both stages on device 0, so it also runs
+  // on single-GPU machines): data and inner product in stage 0, an
+  // in-place ReLU and the loss in stage 1. Both the 'ip' and 'label'
+  // blobs cross the boundary. With pipelined = false the same net is
+  // built without pipeline placement, for reference results.
+  virtual void InitPipelineNet(const bool pipelined = true) {
+    string proto =
+        "name: 'PipelineTestNetwork' ";
+    if (pipelined) {
+      proto +=
+          "pipeline_device: 0 "
+          "pipeline_device: 0 ";
+    }
+    proto +=
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 4 "
+        "    channels: 3 "
+        "    height: 2 "
+        "    width: 2 "
+        "    num: 4 "
+        "    channels: 1 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'constant' "
+        "      value: 0.5 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} "
+        "layers: { "
+        "  name: 'ip' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip' "
+        "} "
+        "layers: { "
+        "  name: 'relu' "
+        "  type: RELU ";
+    if (pipelined) {
+      proto += "  pipeline_stage: 1 ";
+    }
+    proto +=
+        "  bottom: 'ip' "
+        "  top: 'ip' "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: SOFTMAX_LOSS ";
+    if (pipelined) {
+      proto += "  pipeline_stage: 1 ";
+    }
+    proto +=
+        "  bottom: 'ip' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
 
+// Records the buckets handed over during the backward pass.
+template <typename Dtype>
+class RecordingReducer : public GradientReducer<Dtype> {
+ public:
+  virtual void Reduce(const vector<Blob<Dtype>*>& bucket) {
+    buckets_.push_back(bucket);
+  }
+  vector<vector<Blob<Dtype>*> > buckets_;
+};
+
 TYPED_TEST_CASE(NetTest, TestDtypesAndDevices);
 
 TYPED_TEST(NetTest, TestHasBlob) {
@@ -611,6 +952,21 @@ TYPED_TEST(NetTest, TestHasBlob) {
   EXPECT_TRUE(this->net_->has_blob("top_loss"));
 }
 
+TYPED_TEST(NetTest, TestMemoryReport) {
+  this->InitTinyNet();
+  const string& report = this->net_->memory_report();
+  // One line per layer plus totals and the process-wide accounting.
+  EXPECT_NE(string::npos, report.find("innerproduct: activations "));
+  EXPECT_NE(string::npos, report.find("total: activations "));
+  EXPECT_NE(string::npos, report.find("process: host "));
+  // The inner product layer owns its weights and bias: 1000x24 weights
+  // plus 1000 biases, data and diff.
+  typedef typename TypeParam::Dtype Dtype;
+  ostringstream expected_params;
+  expected_params << "params " << 2 * (1000 * 24 + 1000) * sizeof(Dtype);
+  EXPECT_NE(string::npos, report.find(expected_params.str()));
+}
+
 TYPED_TEST(NetTest, TestGetBlob) {
   this->InitTinyNet();
   EXPECT_EQ(this->net_->blob_by_name("data"), this->net_->blobs()[0]);
@@ -899,30 +1255,285 @@ TYPED_TEST(NetTest, TestComboLossWeight) {
     }
   }
 
-  const Dtype kMinLossDiffAbsValue = 1e-4;
+  const Dtype kMinLossDiffAbsValue = 1e-4;
+
+  Dtype loss_diff_2 = loss_main_2 - loss;
+  // Test non-triviality.
+  EXPECT_GT(fabs(loss_diff_2), kMinLossDiffAbsValue);
+  Dtype loss_diff_3 = loss_main_3 - loss;
+  EXPECT_NEAR(2 * loss_diff_2, loss_diff_3, kErrorMargin);
+
+  loss_diff_2 = loss_midnet_2 - loss;
+  // Test non-triviality.
+  EXPECT_GT(fabs(loss_diff_2), kMinLossDiffAbsValue);
+  loss_diff_3 = loss_midnet_3 - loss;
+  EXPECT_NEAR(2 * loss_diff_2, loss_diff_3, kErrorMargin);
+}
+
+TYPED_TEST(NetTest, TestBackwardWithAccuracyLayer) {
+  typedef typename TypeParam::Dtype Dtype;
+  const bool kForceBackward = false;
+  const bool kAccuracyLayer = true;
+  this->InitTinyNet(kForceBackward, kAccuracyLayer);
+  EXPECT_TRUE(this->net_->has_blob("accuracy"));
+  vector<Blob<Dtype>*> bottom;
+  // Test that we can do Backward even though we have an ACCURACY layer.
+  this->net_->ForwardBackward(bottom);
+}
+
+TYPED_TEST(NetTest, TestParamsContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitUnsharedWeightsNet();
+  ASSERT_TRUE(this->net_->params_data_arena());
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  int total = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    total += params[i]->count();
+  }
+  EXPECT_EQ(this->net_->params_total_count(), total);
+  // Each parameter is a view right behind its predecessor.
+  for (int i = 1; i < params.size(); ++i) {
+    EXPECT_EQ(params[i]->cpu_data(),
+              params[i - 1]->cpu_data() + params[i - 1]->count());
+    EXPECT_EQ(params[i]->cpu_diff(),
+              params[i - 1]->cpu_diff() + params[i - 1]->count());
+  }
+}
+
+TYPED_TEST(NetTest, TestParamsContiguousSkippedWhenShared) {
+  this->InitSharedWeightsNet();
+  EXPECT_FALSE(this->net_->params_data_arena());
+}
+
+TYPED_TEST(NetTest, TestBackwardTruncationFrozenPrefix) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitFrozenPrefixNet();
+  Net<Dtype>* net = this->net_.get();
+  // Layers: data (0), frozen ip (1), trainable ip (2), loss (3); the
+  // frozen prefix ends below the trainable ip.
+  EXPECT_EQ(2, net->first_backward_layer());
+  vector<Blob<Dtype>*> bottom;
+  net->ForwardBackward(bottom);
+  // The frozen layer's params saw no gradient; the trainable one's did.
+  const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+  EXPECT_EQ(0, params[0]->asum_diff());
+  EXPECT_EQ(0, params[1]->asum_diff());
+  EXPECT_GT(params[2]->asum_diff(), 0);
+}
+
+TYPED_TEST(NetTest, TestLearnableParamIds) {
+  this->InitFrozenPrefixNet();
+  // Params: frozen ip weights and bias (0, 1), trainable ip weights and
+  // bias (2, 3); only the trainable pair needs update work.
+  const vector<int>& learnable = this->net_->learnable_param_ids();
+  ASSERT_EQ(2, learnable.size());
+  EXPECT_EQ(2, learnable[0]);
+  EXPECT_EQ(3, learnable[1]);
+}
+
+TYPED_TEST(NetTest, TestUpdateSkipsFrozenParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitFrozenPrefixNet();
+  Net<Dtype>* net = this->net_.get();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+  ASSERT_EQ(4, params.size());
+  const vector<Dtype> frozen(params[0]->cpu_data(),
+      params[0]->cpu_data() + params[0]->count());
+  const vector<Dtype> trainable(params[2]->cpu_data(),
+      params[2]->cpu_data() + params[2]->count());
+  // Give every param a nonzero diff, as a backward pass whose result the
+  // solver never scaled would.
+  for (int i = 0; i < params.size(); ++i) {
+    caffe_set(params[i]->count(), Dtype(1), params[i]->mutable_cpu_diff());
+  }
+  net->Update();
+  // The frozen blob kept its values; the trainable one stepped by -1.
+  for (int i = 0; i < params[0]->count(); ++i) {
+    EXPECT_EQ(frozen[i], params[0]->cpu_data()[i]);
+  }
+  for (int i = 0; i < params[2]->count(); ++i) {
+    EXPECT_EQ(trainable[i] - 1, params[2]->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestBackwardTruncationDefault) {
+  this->InitTinyNet();
+  // Only the data layer precedes the first layer that needs gradients.
+  EXPECT_EQ(1, this->net_->first_backward_layer());
+  const bool kForceBackward = true;
+  this->InitTinyNet(kForceBackward);
+  EXPECT_EQ(0, this->net_->first_backward_layer());
+}
+
+TYPED_TEST(NetTest, TestActivationCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitFrozenPrefixNet();
+  Net<Dtype>* net = this->net_.get();
+  string prefix;
+  MakeTempFilename(&prefix);
+  net->EnableActivationCache(prefix, "frozenip");
+  // First pass misses and stores the boundary blob.
+  net->ForwardPrefilled();
+  EXPECT_EQ(1, net->activation_cache_key());
+  Blob<Dtype> stored;
+  const bool kCopyDiff = false;
+  const bool kReshape = true;
+  stored.CopyFrom(*net->blob_by_name("frozenip"), kCopyDiff, kReshape);
+  // Replaying the key hits: the boundary blob comes back from the cache
+  // instead of being recomputed from the data layer's fresh draw, which
+  // would differ at the filler's 0.01 scale.
+  net->set_activation_cache_key(0);
+  net->ForwardPrefilled();
+  EXPECT_EQ(1, net->activation_cache_key());
+  const shared_ptr<Blob<Dtype> > loaded = net->blob_by_name("frozenip");
+  ASSERT_EQ(stored.count(), loaded->count());
+  for (int i = 0; i < stored.count(); ++i) {
+    EXPECT_NEAR(stored.cpu_data()[i], loaded->cpu_data()[i], 1e-6);
+  }
+}
+
+TYPED_TEST(NetTest, TestReshapeInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitInputConvNet();
+  Net<Dtype>* net = this->net_.get();
+  EXPECT_EQ(1, net->warmed_shapes());
+  Blob<Dtype>* output = net->output_blobs()[0];
+  EXPECT_EQ(6, output->height());
+  EXPECT_EQ(6, output->width());
+  net->ReshapeInput(0, 2, 3, 16, 16);
+  EXPECT_EQ(14, output->height());
+  EXPECT_EQ(14, output->width());
+  EXPECT_EQ(2, net->warmed_shapes());
+  // The same shape again is a no-op, not a new warmup.
+  net->ReshapeInput(0, 2, 3, 16, 16);
+  EXPECT_EQ(2, net->warmed_shapes());
+  // The net runs at the new resolution.
+  caffe_set(net->input_blobs()[0]->count(), Dtype(1),
+      net->input_blobs()[0]->mutable_cpu_data());
+  net->ForwardPrefilled();
+}
+
+TYPED_TEST(NetTest, TestForwardZeroCopy) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitInputConvNet();
+  Net<Dtype>* net = this->net_.get();
+  Blob<Dtype>* input = net->input_blobs()[0];
+  // A Blob makes a convenient aligned caller-owned buffer.
+  Blob<Dtype> buffer(input->num(), input->channels(), input->height(),
+      input->width());
+  Dtype* data = buffer.mutable_cpu_data();
+  for (int i = 0; i < buffer.count(); ++i) {
+    data[i] = (i % 17) * Dtype(0.25);
+  }
+  // Reference result via the copying path.
+  caffe_copy(input->count(), data, input->mutable_cpu_data());
+  net->ForwardPrefilled();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*net->output_blobs()[0], false, true);
+  // The zero-copy path must read the caller's buffer directly and
+  // produce the same output.
+  vector<Dtype*> inputs(1, data);
+  const vector<Blob<Dtype>*>& outputs = net->ForwardZeroCopy(inputs);
+  ASSERT_EQ(1, outputs.size());
+  EXPECT_EQ(data, net->input_blobs()[0]->cpu_data());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], outputs[0]->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestWarmUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet(true);
+  this->net_->WarmUp(2);
+  // The passes ran backward (force_backward), so the dummy gradients
+  // must have been cleared again.
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(Dtype(0), params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestCreateReplica) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitInputConvNet();
+  Net<Dtype>* net = this->net_.get();
+  Blob<Dtype>* input = net->input_blobs()[0];
+  for (int i = 0; i < input->count(); ++i) {
+    input->mutable_cpu_data()[i] = (i % 13) * Dtype(0.5);
+  }
+  net->ForwardPrefilled();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*net->output_blobs()[0], false, true);
+  shared_ptr<Net<Dtype> > replica = net->CreateReplica();
+  // Parameters alias the source net's storage, and the shared memory
+  // is frozen for everyone.
+  ASSERT_EQ(net->params().size(), replica->params().size());
+  for (int i = 0; i < net->params().size(); ++i) {
+    EXPECT_EQ(net->params()[i]->cpu_data(), replica->params()[i]->cpu_data());
+    EXPECT_TRUE(net->params()[i]->data()->read_only());
+    EXPECT_TRUE(replica->params()[i]->data()->read_only());
+  }
+  // Activations are private, and the replica computes the same result.
+  Blob<Dtype>* replica_input = replica->input_blobs()[0];
+  caffe_copy(input->count(), input->cpu_data(),
+      replica_input->mutable_cpu_data());
+  EXPECT_NE(input->cpu_data(), replica_input->cpu_data());
+  replica->ForwardPrefilled();
+  const Blob<Dtype>* output = replica->output_blobs()[0];
+  ASSERT_EQ(expected.count(), output->count());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output->cpu_data()[i]);
+  }
+}
 
-  Dtype loss_diff_2 = loss_main_2 - loss;
-  // Test non-triviality.
-  EXPECT_GT(fabs(loss_diff_2), kMinLossDiffAbsValue);
-  Dtype loss_diff_3 = loss_main_3 - loss;
-  EXPECT_NEAR(2 * loss_diff_2, loss_diff_3, kErrorMargin);
+TYPED_TEST(NetTest, TestShareActivationsWith) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitInputConvNet();
+  Net<Dtype>* net = this->net_.get();
+  shared_ptr<Net<Dtype> > other = net->CreateReplica();
+  // The nets run alternately, so the second one can hand the first
+  // one's activation buffers back and forth instead of owning its own.
+  other->ShareActivationsWith(net);
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = net->blobs();
+  const vector<string>& names = net->blob_names();
+  for (int i = 0; i < blobs.size(); ++i) {
+    ASSERT_TRUE(other->has_blob(names[i]));
+    EXPECT_EQ(blobs[i]->data().get(),
+        other->blob_by_name(names[i])->data().get());
+  }
+}
 
-  loss_diff_2 = loss_midnet_2 - loss;
-  // Test non-triviality.
-  EXPECT_GT(fabs(loss_diff_2), kMinLossDiffAbsValue);
-  loss_diff_3 = loss_midnet_3 - loss;
-  EXPECT_NEAR(2 * loss_diff_2, loss_diff_3, kErrorMargin);
+TYPED_TEST(NetTest, TestReshapeInputWarmSwitchKeepsStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitInputConvNet();
+  Net<Dtype>* net = this->net_.get();
+  // Warm the larger resolution, sizing every buffer to its maximum.
+  net->ReshapeInput(0, 2, 3, 16, 16);
+  const Dtype* input_data = net->input_blobs()[0]->cpu_data();
+  const Dtype* output_data = net->output_blobs()[0]->cpu_data();
+  // Alternating between warmed shapes must not reallocate anything.
+  net->ReshapeInput(0, 2, 3, 8, 8);
+  net->ReshapeInput(0, 2, 3, 16, 16);
+  EXPECT_EQ(input_data, net->input_blobs()[0]->cpu_data());
+  EXPECT_EQ(output_data, net->output_blobs()[0]->cpu_data());
+  // The initial 8x8 shape was warm from Init, so only 16x16 was new.
+  EXPECT_EQ(2, net->warmed_shapes());
 }
 
-TYPED_TEST(NetTest, TestBackwardWithAccuracyLayer) {
+TYPED_TEST(NetTest, TestShareTrainedLayersDropsArena) {
   typedef typename TypeParam::Dtype Dtype;
-  const bool kForceBackward = false;
-  const bool kAccuracyLayer = true;
-  this->InitTinyNet(kForceBackward, kAccuracyLayer);
-  EXPECT_TRUE(this->net_->has_blob("accuracy"));
-  vector<Blob<Dtype>*> bottom;
-  // Test that we can do Backward even though we have an ACCURACY layer.
-  this->net_->ForwardBackward(bottom);
+  this->InitUnsharedWeightsNet();
+  shared_ptr<Net<Dtype> > source_net = this->net_;
+  this->InitUnsharedWeightsNet();
+  ASSERT_TRUE(this->net_->params_data_arena());
+  this->net_->ShareTrainedLayersWith(source_net.get());
+  // The parameters now alias the source net's memory, so the contiguous
+  // arena no longer backs them and must not drive bulk updates.
+  EXPECT_FALSE(this->net_->params_data_arena());
+  EXPECT_EQ(source_net->params()[0]->cpu_data(),
+            this->net_->params()[0]->cpu_data());
 }
 
 TYPED_TEST(NetTest, TestUnsharedWeightsDataNet) {
@@ -1068,6 +1679,100 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   }
 }
 
+TYPED_TEST(NetTest, TestParamDiffAccumulation) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitUnsharedWeightsNet();
+  vector<Blob<Dtype>*> bottom;
+  Net<Dtype>* net = this->net_.get();
+  net->Forward(bottom);
+  net->ClearParamDiffs();
+  net->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+  vector<vector<Dtype> > single_pass_diffs(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Dtype* diff = params[i]->cpu_diff();
+    single_pass_diffs[i].assign(diff, diff + params[i]->count());
+  }
+  // A second backward pass over the same data accumulates on top of the
+  // first instead of overwriting it.
+  net->Backward();
+  for (int i = 0; i < params.size(); ++i) {
+    const Dtype* diff = params[i]->cpu_diff();
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(2 * single_pass_diffs[i][j], diff[j]);
+    }
+  }
+  net->ClearParamDiffs();
+  for (int i = 0; i < params.size(); ++i) {
+    const Dtype* diff = params[i]->cpu_diff();
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(0, diff[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestGradientReducerBuckets) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitUnsharedWeightsNet();
+  RecordingReducer<Dtype> reducer;
+  // A one-element bucket flushes after every layer with parameters.
+  this->net_->set_gradient_reducer(&reducer, 1);
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  vector<Blob<Dtype>*> handed;
+  for (int i = 0; i < reducer.buckets_.size(); ++i) {
+    for (int j = 0; j < reducer.buckets_[i].size(); ++j) {
+      handed.push_back(reducer.buckets_[i][j]);
+    }
+  }
+  // Every parameter is handed over exactly once, in reverse layer order.
+  ASSERT_EQ(handed.size(), params.size());
+  for (int i = 0; i < handed.size(); ++i) {
+    EXPECT_EQ(handed[i], params[params.size() - 1 - i].get());
+  }
+  this->net_->set_gradient_reducer(NULL, 0);
+}
+
+TYPED_TEST(NetTest, TestGradientReducerLargeBucket) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitUnsharedWeightsNet();
+  RecordingReducer<Dtype> reducer;
+  // A bucket bigger than the whole net only flushes at the end of the
+  // pass, carrying all parameters at once.
+  this->net_->set_gradient_reducer(&reducer, 1 << 30);
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  ASSERT_EQ(reducer.buckets_.size(), 1);
+  EXPECT_EQ(reducer.buckets_[0].size(), this->net_->params().size());
+}
+
+TYPED_TEST(NetTest, TestGradientReducerSharedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitSharedWeightsNet();
+  RecordingReducer<Dtype> reducer;
+  this->net_->set_gradient_reducer(&reducer, 1);
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  // Both layers share one parameter: only the owning blob is handed
+  // over, and only once both sharers have finished their backward.
+  ASSERT_EQ(reducer.buckets_.size(), 1);
+  ASSERT_EQ(reducer.buckets_[0].size(), 1);
+  EXPECT_EQ(reducer.buckets_[0][0], this->net_->params()[0].get());
+  // The sharer's contribution was folded into the owner's diff and
+  // zeroed, so the later accumulation in Update cannot double-count it.
+  const Dtype* sharer_diff = this->net_->params()[1]->cpu_diff();
+  for (int j = 0; j < this->net_->params()[1]->count(); ++j) {
+    EXPECT_EQ(sharer_diff[j], 0);
+  }
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   vector<Blob<Dtype>*> bottom;
@@ -2091,6 +2796,389 @@ TEST_F(FilterNetTest, TestFilterInOutByExcludeMultiRule) {
   this->RunFilterNetTest(input_proto_test, output_proto_test);
 }
 
+TYPED_TEST(NetTest, TestDagForwardMatchesSequential) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two inner product branches off the same data blob, joined by a loss:
+  // the branches are independent, so the DAG scheduler may run them
+  // concurrently, and the result must match the sequential pass.
+  const string proto_tail =
+      "layers: { "
+      "  name: 'data' "
+      "  type: DUMMY_DATA "
+      "  dummy_data_param { "
+      "    num: 5 "
+      "    channels: 2 "
+      "    height: 3 "
+      "    width: 4 "
+      "    data_filler { "
+      "      type: 'constant' "
+      "      value: 1 "
+      "    } "
+      "  } "
+      "  top: 'data' "
+      "} "
+      "layers: { "
+      "  name: 'branch1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 10 "
+      "    weight_filler { "
+      "      type: 'constant' "
+      "      value: 0.5 "
+      "    } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'branch1' "
+      "} "
+      "layers: { "
+      "  name: 'branch2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 10 "
+      "    weight_filler { "
+      "      type: 'constant' "
+      "      value: 0.3 "
+      "    } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'branch2' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'branch1' "
+      "  bottom: 'branch2' "
+      "} ";
+  this->InitNetFromProtoString("name: 'SequentialNet' " + proto_tail);
+  Dtype sequential_loss;
+  this->net_->ForwardPrefilled(&sequential_loss);
+
+  this->InitNetFromProtoString(
+      "name: 'DagNet' dag_forward: true " + proto_tail);
+  Dtype dag_loss;
+  this->net_->ForwardPrefilled(&dag_loss);
+  EXPECT_FLOAT_EQ(sequential_loss, dag_loss);
+}
+
+TYPED_TEST(NetTest, TestMemoryPlanning) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitMemoryPlanChainNet(false);
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  this->InitMemoryPlanChainNet(true);
+  // 'data' is dead once ip1 has run, so ip2 can reuse its arena; ip1 is
+  // still live while ip2 is written and needs its own, and the net output
+  // ip3 always keeps its own storage.
+  EXPECT_EQ(this->net_->blob_by_name("data")->data().get(),
+            this->net_->blob_by_name("ip2")->data().get());
+  EXPECT_NE(this->net_->blob_by_name("data")->data().get(),
+            this->net_->blob_by_name("ip1")->data().get());
+  EXPECT_NE(this->net_->blob_by_name("ip3")->data().get(),
+            this->net_->blob_by_name("data")->data().get());
+  EXPECT_NE(this->net_->blob_by_name("ip3")->data().get(),
+            this->net_->blob_by_name("ip1")->data().get());
+  // The planned net computes the same output.
+  this->net_->ForwardPrefilled();
+  output_blob = this->net_->output_blobs()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output_blob->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestHalfActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;  // the half activation store only engages in CPU mode
+  }
+  this->InitMemoryPlanChainNet(false);
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  this->InitMemoryPlanChainNet(false, true);
+  this->net_->ForwardPrefilled();
+  // Intermediate activations are parked in half precision; the net output
+  // is exempt so callers always see full precision data.
+  EXPECT_TRUE(this->net_->blob_by_name("ip1")->data_compressed());
+  EXPECT_FALSE(this->net_->blob_by_name("ip3")->data_compressed());
+  // All the chain's values are exactly representable in half, so the
+  // output matches the full precision run bit for bit.
+  output_blob = this->net_->output_blobs()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output_blob->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestCheckpointRecompute) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitCheckpointChainNet(0);
+  this->net_->ForwardPrefilled();
+  this->net_->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& ref_params = this->net_->params();
+  vector<shared_ptr<Blob<Dtype> > > expected_diffs(ref_params.size());
+  for (int i = 0; i < ref_params.size(); ++i) {
+    expected_diffs[i].reset(new Blob<Dtype>());
+    expected_diffs[i]->ReshapeLike(*ref_params[i]);
+    caffe_copy(ref_params[i]->count(), ref_params[i]->cpu_diff(),
+        expected_diffs[i]->mutable_cpu_diff());
+  }
+
+  this->InitCheckpointChainNet(2);
+  this->net_->ForwardPrefilled();
+  // ip1 lives entirely inside the recomputable (ip1, ip2) segment, so it
+  // was freed once ip2 had run; ip2 crosses into the next segment and is
+  // kept.
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+      this->net_->blob_by_name("ip1")->data()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+      this->net_->blob_by_name("ip2")->data()->head());
+  // Backward re-runs the segment's forward; the net is deterministic, so
+  // the regenerated activations -- and hence the gradients -- match the
+  // uncheckpointed run.
+  this->net_->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(expected_diffs[i]->cpu_diff()[j],
+          params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestForwardAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::GPU) {
+    return;  // the async queueing API is GPU only
+  }
+  this->InitMemoryPlanChainNet(false);
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  // The net is deterministic, so the queued pass must reproduce the
+  // synchronous result once it has drained.
+  this->net_->ForwardAsync();
+  this->net_->Synchronize();
+  EXPECT_TRUE(this->net_->ForwardComplete());
+  output_blob = this->net_->output_blobs()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output_blob->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestToBinaryFileStreaming) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet();
+  string filename;
+  MakeTempFilename(&filename);
+  // The streamed file must parse to exactly the proto the staging path
+  // builds, so every reader sees the same snapshot either way.
+  this->net_->ToBinaryFile(filename);
+  NetParameter streamed;
+  ReadProtoFromBinaryFile(filename, &streamed);
+  NetParameter staged;
+  this->net_->ToProto(&staged);
+  EXPECT_EQ(streamed.DebugString(), staged.DebugString());
+  // Same with the diff and half-precision payload options.
+  this->net_->ToBinaryFile(filename, true, true);
+  ReadProtoFromBinaryFile(filename, &streamed);
+  this->net_->ToProto(&staged, true, true);
+  EXPECT_EQ(streamed.DebugString(), staged.DebugString());
+}
+
+TYPED_TEST(NetTest, TestOutputReadback) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::GPU) {
+    return;  // the pinned readback ring is GPU only
+  }
+  this->InitMemoryPlanChainNet(false);
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  // The staged copy must land the synchronous result in pinned memory.
+  const int first = this->net_->BeginOutputReadback();
+  const vector<const Dtype*>& outputs =
+      this->net_->WaitOutputReadback(first);
+  ASSERT_EQ(outputs.size(), 1);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], outputs[0][i]);
+  }
+  // The ring holds two tickets; with both in flight the older one is
+  // still waitable and carries the same pass's results.
+  const int second = this->net_->BeginOutputReadback();
+  this->net_->ForwardPrefilled();
+  const int third = this->net_->BeginOutputReadback();
+  const vector<const Dtype*>& older =
+      this->net_->WaitOutputReadback(second);
+  const vector<const Dtype*>& newer =
+      this->net_->WaitOutputReadback(third);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], older[0][i]);
+    // The net is deterministic, so the second pass reproduces it.
+    EXPECT_EQ(expected.cpu_data()[i], newer[0][i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseNeuronLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  const string proto_tail =
+      "layers: { "
+      "  name: 'data' "
+      "  type: DUMMY_DATA "
+      "  dummy_data_param { "
+      "    num: 2 "
+      "    channels: 3 "
+      "    height: 4 "
+      "    width: 5 "
+      "    data_filler { "
+      "      type: 'uniform' "
+      "      min: -3 "
+      "      max: 3 "
+      "    } "
+      "  } "
+      "  top: 'data' "
+      "} "
+      "layers: { "
+      "  name: 'power' "
+      "  type: POWER "
+      "  power_param { "
+      "    power: 2 "
+      "    scale: 0.5 "
+      "    shift: 0.1 "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'neuron' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  relu_param { "
+      "    negative_slope: 0.1 "
+      "  } "
+      "  bottom: 'neuron' "
+      "  top: 'neuron' "
+      "} "
+      "layers: { "
+      "  name: 'tanh' "
+      "  type: TANH "
+      "  bottom: 'neuron' "
+      "  top: 'out' "
+      "} ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString("name: 'UnfusedNet' " + proto_tail);
+  EXPECT_EQ(4, this->net_->layers().size());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(
+      "name: 'FusedNet' fuse_neuron_layers: true " + proto_tail);
+  // Power, ReLU and TanH collapse into a single chain; the in-place ReLU
+  // rewrite of 'neuron' and its disappearance as an intermediate are both
+  // handled by the fusion pass.
+  EXPECT_EQ(2, this->net_->layers().size());
+  EXPECT_EQ(LayerParameter_LayerType_NEURON_CHAIN,
+      this->net_->layers()[1]->type());
+  this->net_->ForwardPrefilled();
+  output_blob = this->net_->output_blobs()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_FLOAT_EQ(expected.cpu_data()[i], output_blob->cpu_data()[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestStripIdentityLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  const string proto_tail =
+      "layers: { "
+      "  name: 'data' "
+      "  type: DUMMY_DATA "
+      "  dummy_data_param { "
+      "    num: 2 "
+      "    channels: 3 "
+      "    height: 4 "
+      "    width: 5 "
+      "    data_filler { "
+      "      type: 'uniform' "
+      "      min: -3 "
+      "      max: 3 "
+      "    } "
+      "  } "
+      "  top: 'data' "
+      "} "
+      "layers: { "
+      "  name: 'split' "
+      "  type: SPLIT "
+      "  bottom: 'data' "
+      "  top: 'split' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  bottom: 'split' "
+      "  top: 'relu_out' "
+      "} "
+      "layers: { "
+      "  name: 'dropout' "
+      "  type: DROPOUT "
+      "  bottom: 'relu_out' "
+      "  top: 'relu_out' "
+      "} "
+      "layers: { "
+      "  name: 'identity_power' "
+      "  type: POWER "
+      "  bottom: 'relu_out' "
+      "  top: 'out' "
+      "} ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString("name: 'PlainNet' " + proto_tail);
+  EXPECT_EQ(5, this->net_->layers().size());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  Blob<Dtype> expected;
+  expected.ReshapeLike(*output_blob);
+  caffe_copy(expected.count(), output_blob->cpu_data(),
+      expected.mutable_cpu_data());
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(
+      "name: 'StrippedNet' strip_identity_layers: true " + proto_tail);
+  // The single-top split, the (test-phase) dropout, and the
+  // default-parameter power all disappear; only the data layer and the
+  // ReLU remain, with the ReLU's top becoming the net output.
+  EXPECT_EQ(2, this->net_->layers().size());
+  EXPECT_EQ(LayerParameter_LayerType_RELU,
+      this->net_->layers()[1]->type());
+  this->net_->ForwardPrefilled();
+  output_blob = this->net_->output_blobs()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output_blob->cpu_data()[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
 TYPED_TEST(NetTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   // We set up bottom blobs of two different sizes, switch between
@@ -2149,4 +3237,122 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestPipelineTransferInsertion) {
+  this->InitPipelineNet();
+  // Both blobs crossing into stage 1 get a transfer layer, and the
+  // in-place ReLU is rewired onto the transferred copy.
+  EXPECT_TRUE(this->net_->has_layer("ip_pipe_1"));
+  EXPECT_TRUE(this->net_->has_layer("label_pipe_1"));
+  EXPECT_TRUE(this->net_->has_blob("ip_pipe_1"));
+  EXPECT_FALSE(this->net_->has_layer("data_pipe_1"));
+}
+
+TYPED_TEST(NetTest, TestForwardPipelined) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitPipelineNet();
+  // The dummy data is constant, so every pass sees the same batch and
+  // the pipelined average loss must match a plain forward pass.
+  Dtype reference_loss;
+  this->net_->ForwardPrefilled(&reference_loss);
+  const Dtype pipelined_loss = this->net_->ForwardPipelined(3);
+  EXPECT_NEAR(reference_loss, pipelined_loss, 1e-4);
+}
+
+TYPED_TEST(NetTest, TestBackwardPipelined) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitPipelineNet();
+  this->net_->ForwardPipelined(1);
+  this->net_->BackwardPipelined();
+  vector<shared_ptr<Blob<Dtype> > > pipelined_params;
+  this->CopyNetParams(true, &pipelined_params);
+  // The same net without pipeline placement draws identical weights from
+  // the reseeded filler (the transfer layers have no parameters), so the
+  // gradients must agree.
+  Caffe::set_random_seed(this->seed_);
+  const bool kPipelined = false;
+  this->InitPipelineNet(kPipelined);
+  Dtype loss;
+  this->net_->ForwardPrefilled(&loss);
+  this->net_->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  ASSERT_EQ(params.size(), pipelined_params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(params[i]->cpu_diff()[j],
+          pipelined_params[i]->cpu_diff()[j], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestForwardEarlyExit) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two classifier heads; the constant-weight inner products make both
+  // softmax outputs exactly uniform, so the confidence is 1/num_output.
+  const string& proto =
+      "name: 'EarlyExitNet' "
+      "early_exit_blob: 'prob1' "
+      "early_exit_blob: 'prob2' "
+      "layers: { "
+      "  name: 'data' "
+      "  type: DUMMY_DATA "
+      "  dummy_data_param { "
+      "    num: 2 "
+      "    channels: 3 "
+      "    height: 1 "
+      "    width: 1 "
+      "    data_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  top: 'data' "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "    weight_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'softmax1' "
+      "  type: SOFTMAX "
+      "  bottom: 'ip1' "
+      "  top: 'prob1' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "    weight_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  bottom: 'prob1' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'softmax2' "
+      "  type: SOFTMAX "
+      "  bottom: 'ip2' "
+      "  top: 'prob2' "
+      "} ";
+  // With the default threshold of zero the first head always wins.
+  this->InitNetFromProtoString(proto);
+  int exit_index = -1;
+  Dtype confidence = 0;
+  const Blob<Dtype>* prob = this->net_->ForwardEarlyExit(&exit_index,
+      &confidence);
+  EXPECT_EQ(exit_index, 0);
+  EXPECT_EQ(prob, this->net_->blob_by_name("prob1").get());
+  EXPECT_NEAR(confidence, 0.25, 1e-4);
+  // A threshold the uniform distribution cannot clear falls through to
+  // the final head, which is returned regardless of its confidence.
+  this->InitNetFromProtoString(proto + "early_exit_threshold: 0.9 ");
+  prob = this->net_->ForwardEarlyExit(&exit_index, &confidence);
+  EXPECT_EQ(exit_index, 1);
+  EXPECT_EQ(prob, this->net_->blob_by_name("prob2").get());
+  EXPECT_NEAR(confidence, 0.25, 1e-4);
+}
+
 }  // namespace caffe
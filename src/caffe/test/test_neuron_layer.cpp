@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -169,6 +170,26 @@ TYPED_TEST(NeuronLayerTest, TestSigmoidGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(NeuronLayerTest, TestSigmoidFast) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_sigmoid_param()->set_engine(
+      SigmoidParameter_Engine_FAST);
+  SigmoidLayer<Dtype> layer(layer_param);
+  // Verify mode makes the layer itself CHECK the approximation against
+  // its documented bound on the CPU fast path.
+  Caffe::set_fast_math_verify(true);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_fast_math_verify(false);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], 1. / (1 + exp(-bottom_data[i])),
+        kFastSigmoidMaxError);
+  }
+}
+
 TYPED_TEST(NeuronLayerTest, TestTanH) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -201,6 +222,39 @@ TYPED_TEST(NeuronLayerTest, TestTanHGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(NeuronLayerTest, TestTanHFast) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_tanh_param()->set_engine(TanHParameter_Engine_FAST);
+  TanHLayer<Dtype> layer(layer_param);
+  Caffe::set_fast_math_verify(true);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_fast_math_verify(false);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], tanh(bottom_data[i]), kFastTanHMaxError);
+  }
+}
+
+TYPED_TEST(NeuronLayerTest, TestTanHFastGlobalSwitch) {
+  typedef typename TypeParam::Dtype Dtype;
+  // With the engine left at DEFAULT, Caffe::set_fast_math selects the
+  // fast path globally; the result must still track the exact one.
+  LayerParameter layer_param;
+  TanHLayer<Dtype> layer(layer_param);
+  Caffe::set_fast_math(true);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_fast_math(false);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], tanh(bottom_data[i]), kFastTanHMaxError);
+  }
+}
+
 TYPED_TEST(NeuronLayerTest, TestDropoutHalf) {
   const float kDropoutRatio = 0.5;
   this->TestDropoutForward(kDropoutRatio);
@@ -272,6 +326,25 @@ TYPED_TEST(NeuronLayerTest, TestBNLLGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(NeuronLayerTest, TestBNLLFast) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_bnll_param()->set_engine(BNLLParameter_Engine_FAST);
+  BNLLLayer<Dtype> layer(layer_param);
+  Caffe::set_fast_math_verify(true);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_fast_math_verify(false);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    const Dtype exact = bottom_data[i] > 0 ?
+        bottom_data[i] + log(1. + exp(-bottom_data[i])) :
+        log(1. + exp(bottom_data[i]));
+    EXPECT_NEAR(top_data[i], exact, kFastBNLLMaxError);
+  }
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNNeuronLayerTest : public ::testing::Test {
@@ -0,0 +1,89 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/oversample.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class OversampleTest : public ::testing::Test {
+ protected:
+  OversampleTest()
+      : crop_size_(4),
+        images_(new Blob<Dtype>(2, 3, 7, 9)),
+        crops_(new Blob<Dtype>(2 * kOversampleCrops, 3, 4, 4)) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(images_);
+  }
+  virtual ~OversampleTest() {
+    delete images_;
+    delete crops_;
+  }
+  const int crop_size_;
+  Blob<Dtype>* const images_;
+  Blob<Dtype>* const crops_;
+};
+
+TYPED_TEST_CASE(OversampleTest, TestDtypes);
+
+TYPED_TEST(OversampleTest, TestCropWindows) {
+  typedef TypeParam Dtype;
+  const Blob<Dtype>* images = this->images_;
+  oversample_cpu(images->cpu_data(), images->num(), images->channels(),
+      images->height(), images->width(), this->crop_size_,
+      this->crops_->mutable_cpu_data());
+  const int c = this->crop_size_;
+  const int h_off[5] = { 0, 0, images->height() - c, images->height() - c,
+                         (images->height() - c) / 2 };
+  const int w_off[5] = { 0, images->width() - c, 0, images->width() - c,
+                         (images->width() - c) / 2 };
+  for (int n = 0; n < images->num(); ++n) {
+    for (int crop = 0; crop < kOversampleCrops; ++crop) {
+      const int crop_n = n * kOversampleCrops + crop;
+      for (int ch = 0; ch < images->channels(); ++ch) {
+        for (int y = 0; y < c; ++y) {
+          for (int x = 0; x < c; ++x) {
+            // Crops 5..9 mirror the columns of crops 0..4.
+            const int src_x = w_off[crop % 5] +
+                (crop >= 5 ? c - 1 - x : x);
+            EXPECT_EQ(images->data_at(n, ch, h_off[crop % 5] + y, src_x),
+                      this->crops_->data_at(crop_n, ch, y, x))
+                << "crop " << crop << " at " << y << "," << x;
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(OversampleTest, TestMean) {
+  typedef TypeParam Dtype;
+  const int num = 2;
+  const int dim = 5;
+  Blob<Dtype> predictions(num * kOversampleCrops, dim, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&predictions);
+  Blob<Dtype> means(num, dim, 1, 1);
+  oversample_mean_cpu(predictions.cpu_data(), num, dim,
+      means.mutable_cpu_data());
+  for (int n = 0; n < num; ++n) {
+    for (int d = 0; d < dim; ++d) {
+      Dtype expected = 0;
+      for (int crop = 0; crop < kOversampleCrops; ++crop) {
+        expected += predictions.data_at(n * kOversampleCrops + crop, d, 0, 0);
+      }
+      expected /= kOversampleCrops;
+      EXPECT_NEAR(expected, means.data_at(n, d, 0, 0), 1e-5);
+    }
+  }
+}
+
+}  // namespace caffe
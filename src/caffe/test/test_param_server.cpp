@@ -0,0 +1,227 @@
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gradient_compression.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Runs ParamServer::Run on its own thread so the test thread can act as
+// the worker over the loopback interface.
+template <typename Dtype>
+class ParamServerThread : public InternalThread {
+ public:
+  explicit ParamServerThread(ParamServer<Dtype>* server) : server_(server) {}
+
+ protected:
+  virtual void InternalThreadEntry() { server_->Run(); }
+
+  ParamServer<Dtype>* server_;
+};
+
+template <typename Dtype>
+class ParamServerTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    master_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(2, 3, 4, 5)));
+    master_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(1, 1, 1, 7)));
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < master_.size(); ++i) {
+      filler.Fill(master_[i].get());
+      // Keep a copy of the starting weights; the server mutates master_
+      // from its own thread while it runs.
+      shared_ptr<Blob<Dtype> > init(new Blob<Dtype>());
+      init->ReshapeLike(*master_[i]);
+      caffe_copy(master_[i]->count(), master_[i]->cpu_data(),
+          init->mutable_cpu_data());
+      initial_.push_back(init);
+      shared_ptr<Blob<Dtype> > worker(new Blob<Dtype>());
+      worker->ReshapeLike(*master_[i]);
+      worker_.push_back(worker);
+    }
+  }
+
+  string Address(const ParamServer<Dtype>& server) {
+    std::ostringstream address;
+    address << "127.0.0.1:" << server.port();
+    return address.str();
+  }
+
+  vector<shared_ptr<Blob<Dtype> > > master_, initial_, worker_;
+};
+
+TYPED_TEST_CASE(ParamServerTest, TestDtypes);
+
+TYPED_TEST(ParamServerTest, TestPullPushAsync) {
+  typedef TypeParam Dtype;
+  SolverParameter param;  // asynchronous by default
+  ParamServer<Dtype> server(this->master_, param, 0);
+  ParamServerThread<Dtype> thread(&server);
+  ASSERT_TRUE(thread.StartInternalThread());
+  {
+    ParamServerClient<Dtype> client(this->Address(server), this->worker_);
+    client.PullParams();
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      const Dtype* data = this->worker_[i]->cpu_data();
+      const Dtype* init = this->initial_[i]->cpu_data();
+      for (int j = 0; j < this->worker_[i]->count(); ++j) {
+        EXPECT_EQ(data[j], init[j]);
+      }
+    }
+    // Push a known update; the returned weights must be init - diff.
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      caffe_set(this->worker_[i]->count(), Dtype(0.5),
+          this->worker_[i]->mutable_cpu_diff());
+    }
+    client.PushPull();
+    EXPECT_EQ(client.round(), 1);
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      const Dtype* data = this->worker_[i]->cpu_data();
+      const Dtype* init = this->initial_[i]->cpu_data();
+      for (int j = 0; j < this->worker_[i]->count(); ++j) {
+        EXPECT_NEAR(data[j], init[j] - Dtype(0.5), 1e-5);
+      }
+    }
+  }
+  ASSERT_TRUE(thread.WaitForInternalThreadToExit());
+  EXPECT_EQ(server.round(), 1);
+}
+
+TYPED_TEST(ParamServerTest, TestSyncRoundAverages) {
+  typedef TypeParam Dtype;
+  SolverParameter param;
+  param.set_sync_workers(1);
+  ParamServer<Dtype> server(this->master_, param, 0);
+  ParamServerThread<Dtype> thread(&server);
+  ASSERT_TRUE(thread.StartInternalThread());
+  {
+    ParamServerClient<Dtype> client(this->Address(server), this->worker_);
+    client.PullParams();
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      caffe_set(this->worker_[i]->count(), Dtype(2),
+          this->worker_[i]->mutable_cpu_diff());
+    }
+    client.PushPull();
+    client.PushPull();
+    EXPECT_EQ(client.round(), 2);
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      const Dtype* data = this->worker_[i]->cpu_data();
+      const Dtype* init = this->initial_[i]->cpu_data();
+      for (int j = 0; j < this->worker_[i]->count(); ++j) {
+        EXPECT_NEAR(data[j], init[j] - Dtype(4), 1e-5);
+      }
+    }
+  }
+  ASSERT_TRUE(thread.WaitForInternalThreadToExit());
+  EXPECT_EQ(server.round(), 2);
+}
+
+TYPED_TEST(ParamServerTest, TestTopKCompressionRoundTrip) {
+  typedef TypeParam Dtype;
+  const int count = 10;
+  const Dtype diff[count] = { 1, -8, 2, -7, 3, -6, 4, -5, 0.5, -0.25 };
+  // A 0.2 fraction of 10 entries keeps the two largest magnitudes.
+  TopKGradientCompressor<Dtype> compressor(Dtype(0.2));
+  vector<uint8_t> payload;
+  compressor.Compress(diff, count, &payload);
+  EXPECT_EQ(payload.size(),
+      sizeof(uint32_t) + 2 * (sizeof(uint32_t) + sizeof(Dtype)));
+  Dtype decoded[count];
+  compressor.Decompress(&payload[0], payload.size(), count, decoded);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(decoded[i], i == 1 || i == 3 ? diff[i] : Dtype(0));
+  }
+  // The unsent entries stayed in the residual: pushing a zero diff
+  // next drains the now-largest of them instead of sending nothing.
+  const Dtype zeros[count] = { 0 };
+  compressor.Compress(zeros, count, &payload);
+  compressor.Decompress(&payload[0], payload.size(), count, decoded);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(decoded[i], i == 5 || i == 7 ? diff[i] : Dtype(0));
+  }
+}
+
+TYPED_TEST(ParamServerTest, TestOneBitCompressionRoundTrip) {
+  typedef TypeParam Dtype;
+  const int count = 4;
+  // Each sign bucket is reconstructed at its mean magnitude, so this
+  // diff -- constant within each bucket -- survives exactly.
+  const Dtype diff[count] = { 1.5, -2.5, 1.5, -2.5 };
+  OneBitGradientCompressor<Dtype> compressor;
+  vector<uint8_t> payload;
+  compressor.Compress(diff, count, &payload);
+  EXPECT_EQ(payload.size(), 2 * sizeof(Dtype) + 1);
+  Dtype decoded[count];
+  compressor.Decompress(&payload[0], payload.size(), count, decoded);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(decoded[i], diff[i]);
+  }
+  // The mean-magnitude scales preserve each sign bucket's sum, so a
+  // push delivers the gradient total exactly; what an entry over- or
+  // undershoots stays in the residual for later pushes.
+  const Dtype uneven[count] = { 3, 1, -2, 0 };
+  compressor.Compress(uneven, count, &payload);
+  compressor.Decompress(&payload[0], payload.size(), count, decoded);
+  Dtype sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += decoded[i];
+  }
+  EXPECT_NEAR(sum, Dtype(2), 1e-5);
+  // The residual sums to zero in turn, so a zero follow-up push
+  // flushes corrections that cancel in total.
+  const Dtype zeros[count] = { 0 };
+  compressor.Compress(zeros, count, &payload);
+  compressor.Decompress(&payload[0], payload.size(), count, decoded);
+  sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += decoded[i];
+  }
+  EXPECT_NEAR(sum, Dtype(0), 1e-5);
+}
+
+TYPED_TEST(ParamServerTest, TestPushPullCompressed) {
+  typedef TypeParam Dtype;
+  SolverParameter param;
+  // A fraction of 1 makes top-k lossless, so the compressed push must
+  // reproduce the plain-push result exactly.
+  param.set_gradient_compression(
+      SolverParameter_CompressionType_COMPRESS_TOP_K);
+  param.set_topk_fraction(1);
+  ParamServer<Dtype> server(this->master_, param, 0);
+  ParamServerThread<Dtype> thread(&server);
+  ASSERT_TRUE(thread.StartInternalThread());
+  {
+    ParamServerClient<Dtype> client(this->Address(server), this->worker_,
+        param);
+    client.PullParams();
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      caffe_set(this->worker_[i]->count(), Dtype(0.5),
+          this->worker_[i]->mutable_cpu_diff());
+    }
+    client.PushPull();
+    EXPECT_EQ(client.round(), 1);
+    for (int i = 0; i < this->worker_.size(); ++i) {
+      const Dtype* data = this->worker_[i]->cpu_data();
+      const Dtype* init = this->initial_[i]->cpu_data();
+      for (int j = 0; j < this->worker_[i]->count(); ++j) {
+        EXPECT_NEAR(data[j], init[j] - Dtype(0.5), 1e-5);
+      }
+    }
+  }
+  ASSERT_TRUE(thread.WaitForInternalThreadToExit());
+  EXPECT_EQ(server.round(), 1);
+}
+
+}  // namespace caffe
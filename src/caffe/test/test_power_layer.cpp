@@ -167,4 +167,12 @@ TYPED_TEST(PowerLayerTest, TestPowerTwoScaleHalfGradient) {
   this->TestBackward(power, scale, shift);
 }
 
+TYPED_TEST(PowerLayerTest, TestPowerHalf) {
+  typedef typename TypeParam::Dtype Dtype;
+  Dtype power = 0.5;
+  Dtype scale = 0.83;
+  Dtype shift = 2.4;
+  this->TestForward(power, scale, shift);
+}
+
 }  // namespace caffe
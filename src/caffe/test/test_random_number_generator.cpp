@@ -160,6 +160,11 @@ class RandomNumberGeneratorTest : public ::testing::Test {
     caffe_rng_bernoulli(sample_size_, p, rng_data);
   }
 
+  void RngBernoulliBlockFill(const Dtype p, void* cpu_data) {
+    int* rng_data = static_cast<int*>(cpu_data);
+    caffe_rng_bernoulli_block(sample_size_, p, rng_data);
+  }
+
   void RngBernoulliChecks(const Dtype p, const void* cpu_data) {
     const int* rng_data = static_cast<const int*>(cpu_data);
     const Dtype true_mean = p;
@@ -251,6 +256,14 @@ TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulli) {
 }
 
 
+TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulliBlock) {
+  const TypeParam p = 0.3;
+  void* bernoulli_data = this->int_data_->mutable_cpu_data();
+  this->RngBernoulliBlockFill(p, bernoulli_data);
+  this->RngBernoulliChecks(p, bernoulli_data);
+}
+
+
 TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulli2) {
   const TypeParam p = 0.9;
   void* bernoulli_data = this->int_data_->mutable_cpu_data();
@@ -0,0 +1,109 @@
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/loss_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class SampledSoftmaxLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  SampledSoftmaxLossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(8, 4, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(8, 1, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~SampledSoftmaxLossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_loss_;
+  }
+  void FillLabels(const int num_classes) {
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] =
+          caffe_rng_rand() % num_classes;
+    }
+  }
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SampledSoftmaxLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SampledSoftmaxLossLayerTest, TestForwardZeroWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  // With all-zero weights and no bias every logit is zero before the
+  // correction, so whatever negatives get drawn, the uniform-sampler
+  // loss is exactly log(1 + num_classes): each of the num_samples
+  // negatives contributes exp(log(num_classes / num_samples)).
+  const int kNumClasses = 50;
+  LayerParameter layer_param;
+  SampledSoftmaxParameter* param = layer_param.mutable_sampled_softmax_param();
+  param->set_num_classes(kNumClasses);
+  param->set_num_samples(5);
+  param->set_bias_term(false);
+  param->mutable_weight_filler()->set_type("constant");
+  param->mutable_weight_filler()->set_value(0);
+  this->FillLabels(kNumClasses);
+  SampledSoftmaxLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_NEAR(log(Dtype(1 + kNumClasses)),
+              this->blob_top_loss_->cpu_data()[0], 1e-4);
+}
+
+TYPED_TEST(SampledSoftmaxLossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two classes and one sample make the drawn negative deterministic
+  // (it may not equal the label), so the repeated Forward calls of the
+  // finite-difference checker see the same sample set.
+  LayerParameter layer_param;
+  SampledSoftmaxParameter* param = layer_param.mutable_sampled_softmax_param();
+  param->set_num_classes(2);
+  param->set_num_samples(1);
+  param->mutable_weight_filler()->set_type("gaussian");
+  param->mutable_bias_filler()->set_type("gaussian");
+  this->FillLabels(2);
+  SampledSoftmaxLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_), 0);
+}
+
+TYPED_TEST(SampledSoftmaxLossLayerTest, TestGradientLogUniform) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  SampledSoftmaxParameter* param = layer_param.mutable_sampled_softmax_param();
+  param->set_num_classes(2);
+  param->set_num_samples(1);
+  param->set_sampler(SampledSoftmaxParameter_Sampler_LOG_UNIFORM);
+  param->mutable_weight_filler()->set_type("gaussian");
+  param->mutable_bias_filler()->set_type("gaussian");
+  this->FillLabels(2);
+  SampledSoftmaxLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_), 0);
+}
+
+}  // namespace caffe
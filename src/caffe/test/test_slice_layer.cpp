@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -161,6 +162,59 @@ TYPED_TEST(SliceLayerTest, TestSliceAcrossChannels) {
   }
 }
 
+TYPED_TEST(SliceLayerTest, TestInPlaceSliceAcrossNum) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_slice_param()->set_slice_dim(0);
+  layer_param.mutable_slice_param()->set_in_place(true);
+  SliceLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_0_));
+  const int top_count = this->blob_top_0_->count();
+  // Forward aliases the tops into the bottom's storage and copies
+  // nothing.
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_0_));
+  EXPECT_EQ(this->blob_bottom_->cpu_data(), this->blob_top_0_->cpu_data());
+  EXPECT_EQ(this->blob_bottom_->cpu_data() + top_count,
+      this->blob_top_1_->cpu_data());
+  for (int i = 0; i < top_count; ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+        this->blob_top_0_->cpu_data()[i]);
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[top_count + i],
+        this->blob_top_1_->cpu_data()[i]);
+  }
+  // The first Backward copies the consumers' diffs into the bottom and
+  // aliases the tops; after that, a consumer writing a top diff writes
+  // the bottom diff directly.
+  caffe_set(top_count, Dtype(1), this->blob_top_0_->mutable_cpu_diff());
+  caffe_set(top_count, Dtype(2), this->blob_top_1_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_0_, propagate_down,
+      &(this->blob_bottom_vec_));
+  for (int i = 0; i < top_count; ++i) {
+    EXPECT_EQ(1, this->blob_bottom_->cpu_diff()[i]);
+    EXPECT_EQ(2, this->blob_bottom_->cpu_diff()[top_count + i]);
+  }
+  caffe_set(top_count, Dtype(3), this->blob_top_1_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_0_, propagate_down,
+      &(this->blob_bottom_vec_));
+  for (int i = 0; i < top_count; ++i) {
+    EXPECT_EQ(3, this->blob_bottom_->cpu_diff()[top_count + i]);
+  }
+}
+
+TYPED_TEST(SliceLayerTest, TestInPlaceGradientAcrossNum) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Gradient checks are slow; reduce blob size.
+  this->ReduceBottomBlobSize();
+  LayerParameter layer_param;
+  layer_param.mutable_slice_param()->set_slice_dim(0);
+  layer_param.mutable_slice_param()->set_in_place(true);
+  SliceLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+    &(this->blob_top_vec_0_));
+}
+
 TYPED_TEST(SliceLayerTest, TestGradientAcrossNum) {
   typedef typename TypeParam::Dtype Dtype;
   // Gradient checks are slow; reduce blob size.
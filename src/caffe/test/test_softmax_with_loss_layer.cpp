@@ -51,6 +51,27 @@ class SoftmaxWithLossLayerTest : public MultiDeviceTest<TypeParam> {
 TYPED_TEST_CASE(SoftmaxWithLossLayerTest, TestDtypesAndDevices);
 
 
+TYPED_TEST(SoftmaxWithLossLayerTest, TestFusedMatchesUnfused) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  // With a single top the layer takes the fused path that never forms
+  // the softmax output; requesting the softmax as a second top forces
+  // the unfused path. The losses must agree.
+  SoftmaxWithLossLayer<Dtype> fused_layer(layer_param);
+  fused_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  fused_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const Dtype fused_loss = this->blob_top_loss_->cpu_data()[0];
+  Blob<Dtype> top_loss;
+  Blob<Dtype> top_prob;
+  vector<Blob<Dtype>*> top_vec;
+  top_vec.push_back(&top_loss);
+  top_vec.push_back(&top_prob);
+  SoftmaxWithLossLayer<Dtype> unfused_layer(layer_param);
+  unfused_layer.SetUp(this->blob_bottom_vec_, &top_vec);
+  unfused_layer.Forward(this->blob_bottom_vec_, &top_vec);
+  EXPECT_NEAR(fused_loss, top_loss.cpu_data()[0], 1e-4);
+}
+
 TYPED_TEST(SoftmaxWithLossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #include <cstring>
 #include <vector>
 
@@ -6,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/memory_pool.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -68,6 +71,27 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestSkipZeroFill) {
+  // Without the flag, first touch zero fills.
+  SyncedMemory zeroed(10);
+  const uint8_t* data = static_cast<const uint8_t*>(zeroed.cpu_data());
+  for (int i = 0; i < zeroed.size(); ++i) {
+    EXPECT_EQ(0, data[i]);
+  }
+  // With the flag and poisoning enabled, first touch fills with all-ones
+  // bytes instead (the flag alone leaves the contents unspecified, which
+  // a test cannot observe portably).
+  Caffe::set_poison_skipped_fills(true);
+  SyncedMemory poisoned(10);
+  poisoned.set_skip_zero_fill();
+  EXPECT_TRUE(poisoned.skip_zero_fill());
+  data = static_cast<const uint8_t*>(poisoned.cpu_data());
+  for (int i = 0; i < poisoned.size(); ++i) {
+    EXPECT_EQ(0xFF, data[i]);
+  }
+  Caffe::set_poison_skipped_fills(false);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -121,6 +145,94 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
   EXPECT_EQ(mem.head(), SyncedMemory::SYNCED);
 }
 
+TEST_F(SyncedMemoryTest, TestTransferCounters) {
+  SyncedMemory mem(10);
+  EXPECT_EQ(0, mem.h2d_count());
+  EXPECT_EQ(0, mem.d2h_count());
+  caffe_memset(mem.size(), 1, mem.mutable_cpu_data());
+  mem.gpu_data();
+  EXPECT_EQ(1, mem.h2d_count());
+  EXPECT_EQ(10, mem.h2d_bytes());
+  // Reading the host copy while SYNCED costs nothing.
+  mem.cpu_data();
+  EXPECT_EQ(0, mem.d2h_count());
+  mem.mutable_gpu_data();
+  mem.cpu_data();
+  EXPECT_EQ(1, mem.d2h_count());
+  EXPECT_EQ(10, mem.d2h_bytes());
+  EXPECT_EQ(1, mem.h2d_count());
+}
+
+TEST_F(SyncedMemoryTest, TestHotRegionWarnsOnSync) {
+  SyncedMemory mem(10);
+  mem.set_debug_name("hot test");
+  caffe_gpu_memset(mem.size(), 1, mem.mutable_gpu_data());
+  Caffe::BeginHotRegion();
+  EXPECT_TRUE(Caffe::in_hot_region());
+  // Regions nest; the warning itself goes to the log, so only the
+  // counter effect is checked here.
+  Caffe::BeginHotRegion();
+  Caffe::EndHotRegion();
+  mem.cpu_data();
+  EXPECT_EQ(1, mem.d2h_count());
+  Caffe::EndHotRegion();
+  EXPECT_FALSE(Caffe::in_hot_region());
+}
+
 #endif
 
+TEST_F(SyncedMemoryTest, TestMemoryPoolReuse) {
+  Caffe::set_memory_pool_enabled(true);
+  const void* first_ptr = NULL;
+  {
+    SyncedMemory mem(10);
+    first_ptr = mem.cpu_data();
+  }
+  // The freed block should be handed back for an allocation of the same
+  // bucket size.
+  SyncedMemory mem(10);
+  EXPECT_EQ(first_ptr, mem.cpu_data());
+  Caffe::set_memory_pool_enabled(false);
+  MemoryPool::Get().Clear();
+}
+
+TEST_F(SyncedMemoryTest, TestHostAlignment) {
+  // Every host allocation, whatever its size, lands on a cacheline
+  // boundary so SIMD kernels can use aligned loads without peeling.
+  const size_t sizes[] = { 1, 10, 100, 4096, 1000000 };
+  for (int i = 0; i < 5; ++i) {
+    SyncedMemory mem(sizes[i]);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(mem.cpu_data())
+        % kCaffeHostAlignment, 0) << "size " << sizes[i];
+  }
+}
+
+TEST_F(SyncedMemoryTest, TestMemoryAccounting) {
+  MemoryAccounting before;
+  CaffeMemoryAccounting(&before);
+  {
+    SyncedMemory mem(4096);
+    mem.mutable_cpu_data();
+    MemoryAccounting during;
+    CaffeMemoryAccounting(&during);
+    EXPECT_EQ(before.host_bytes + 4096, during.host_bytes);
+    EXPECT_GE(during.host_bytes_peak, during.host_bytes);
+  }
+  MemoryAccounting after;
+  CaffeMemoryAccounting(&after);
+  EXPECT_EQ(before.host_bytes, after.host_bytes);
+  // Peaks never go back down.
+  EXPECT_GE(after.host_bytes_peak, before.host_bytes_peak);
+}
+
+TEST_F(SyncedMemoryTest, TestHugePageAlignment) {
+  Caffe::set_huge_pages_enabled(true);
+  // Below the threshold allocations stay plain malloc; above it they come
+  // back aligned to a huge-page boundary.
+  SyncedMemory mem(2 * kHugePageSize);
+  EXPECT_TRUE(mem.mutable_cpu_data());
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mem.cpu_data()) % kHugePageSize, 0);
+  Caffe::set_huge_pages_enabled(false);
+}
+
 }  // namespace caffe
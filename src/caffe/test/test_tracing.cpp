@@ -0,0 +1,66 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/tracing.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class TracingTest : public ::testing::Test {
+ protected:
+  virtual void TearDown() {
+    Tracer::Get().set_enabled(false);
+    Tracer::Get().Clear();
+  }
+
+  string ReadFile(const string& filename) {
+    std::ifstream in(filename.c_str());
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+  }
+};
+
+TEST_F(TracingTest, TestDisabledRecordsNothing) {
+  { CAFFE_TRACE_SCOPE("tracing_test_off"); }
+  string filename;
+  MakeTempFilename(&filename);
+  Tracer::Get().WriteTraceFile(filename);
+  const string trace = ReadFile(filename);
+  EXPECT_EQ(trace.find("tracing_test_off"), string::npos);
+}
+
+TEST_F(TracingTest, TestScopeRecordsEvent) {
+  Tracer::Get().set_enabled(true);
+  { CAFFE_TRACE_SCOPE("tracing_test_event"); }
+  Tracer::Get().set_enabled(false);
+  string filename;
+  MakeTempFilename(&filename);
+  Tracer::Get().WriteTraceFile(filename);
+  const string trace = ReadFile(filename);
+  EXPECT_NE(trace.find("\"traceEvents\""), string::npos);
+  EXPECT_NE(trace.find("\"tracing_test_event\""), string::npos);
+  EXPECT_NE(trace.find("\"ph\":\"X\""), string::npos);
+}
+
+TEST_F(TracingTest, TestClearDropsEvents) {
+  Tracer::Get().set_enabled(true);
+  { CAFFE_TRACE_SCOPE("tracing_test_cleared"); }
+  Tracer::Get().Clear();
+  { CAFFE_TRACE_SCOPE("tracing_test_kept"); }
+  Tracer::Get().set_enabled(false);
+  string filename;
+  MakeTempFilename(&filename);
+  Tracer::Get().WriteTraceFile(filename);
+  const string trace = ReadFile(filename);
+  EXPECT_EQ(trace.find("tracing_test_cleared"), string::npos);
+  EXPECT_NE(trace.find("tracing_test_kept"), string::npos);
+}
+
+}  // namespace caffe
@@ -1,4 +1,5 @@
 #include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
 
@@ -7,6 +8,7 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -2442,4 +2444,77 @@ TEST_F(V0UpgradeTest, TestImageNet) {
   this->RunV0UpgradeTest(input_proto, expected_output_proto);
 }
 
+class CompiledCacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&param_file_);
+    cache_file_ = param_file_ + ".compiled";
+  }
+
+  void WriteSource(const string& text) {
+    std::ofstream out(param_file_.c_str(), std::ios::trunc);
+    out << text;
+  }
+
+  string param_file_;
+  string cache_file_;
+};
+
+TEST_F(CompiledCacheTest, TestCompileAndHit) {
+  this->WriteSource(
+      "name: 'TinyNet' "
+      "layers { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  bottom: 'data' "
+      "  top: 'data' "
+      "} ");
+  NetParameter param;
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &param);
+  EXPECT_EQ("TinyNet", param.name());
+  ASSERT_EQ(1, param.layers_size());
+  // The first read compiled the source and wrote the cache next to it.
+  NetParameterCache cache;
+  ReadProtoFromBinaryFileOrDie(this->cache_file_, &cache);
+  EXPECT_EQ("TinyNet", cache.net().name());
+  // Tamper with the cached net while keeping the hash valid: a second
+  // read must return the tampered copy, proving it came from the cache
+  // rather than a recompile of the source.
+  cache.mutable_net()->set_name("CachedSentinel");
+  WriteProtoToBinaryFile(cache, this->cache_file_);
+  NetParameter cached_param;
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &cached_param);
+  EXPECT_EQ("CachedSentinel", cached_param.name());
+}
+
+TEST_F(CompiledCacheTest, TestStaleSourceRecompiles) {
+  this->WriteSource("name: 'FirstNet' ");
+  NetParameter param;
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &param);
+  EXPECT_EQ("FirstNet", param.name());
+  // Editing the source invalidates the hash; the next read must compile
+  // the new text and refresh the cache.
+  this->WriteSource("name: 'SecondNet' ");
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &param);
+  EXPECT_EQ("SecondNet", param.name());
+  NetParameterCache cache;
+  ReadProtoFromBinaryFileOrDie(this->cache_file_, &cache);
+  EXPECT_EQ("SecondNet", cache.net().name());
+}
+
+TEST_F(CompiledCacheTest, TestVersionMismatchRecompiles) {
+  this->WriteSource("name: 'VersionedNet' ");
+  NetParameter param;
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &param);
+  NetParameterCache cache;
+  ReadProtoFromBinaryFileOrDie(this->cache_file_, &cache);
+  // A cache written under another compiled-format version must not load,
+  // even though the source hash still matches.
+  cache.set_cache_version(cache.cache_version() + 1);
+  cache.mutable_net()->set_name("StaleSentinel");
+  WriteProtoToBinaryFile(cache, this->cache_file_);
+  ReadNetParamsFromCompiledCacheOrDie(this->param_file_, &param);
+  EXPECT_EQ("VersionedNet", param.name());
+}
+
 }  // namespace caffe
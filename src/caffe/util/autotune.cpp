@@ -0,0 +1,58 @@
+#include <boost/thread.hpp>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <set>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/autotune.hpp"
+
+namespace caffe {
+
+static boost::mutex autotune_mutex_;
+static map<string, string> autotune_choices_;
+static set<string> autotune_files_loaded_;
+
+// Must be called with autotune_mutex_ held.
+static void AutotuneLoadFile(const string& cache_file) {
+  if (cache_file.empty() ||
+      autotune_files_loaded_.find(cache_file) != autotune_files_loaded_.end()) {
+    return;
+  }
+  autotune_files_loaded_.insert(cache_file);
+  std::ifstream file(cache_file.c_str());
+  string key, engine;
+  while (file >> key >> engine) {
+    autotune_choices_[key] = engine;
+  }
+}
+
+bool AutotuneLookup(const string& cache_file, const string& key,
+    string* engine) {
+  boost::mutex::scoped_lock lock(autotune_mutex_);
+  AutotuneLoadFile(cache_file);
+  map<string, string>::const_iterator it = autotune_choices_.find(key);
+  if (it == autotune_choices_.end()) {
+    return false;
+  }
+  *engine = it->second;
+  return true;
+}
+
+void AutotuneStore(const string& cache_file, const string& key,
+    const string& engine) {
+  boost::mutex::scoped_lock lock(autotune_mutex_);
+  autotune_choices_[key] = engine;
+  if (cache_file.empty()) {
+    return;
+  }
+  std::ofstream file(cache_file.c_str(), std::ios::app);
+  if (!file) {
+    LOG(WARNING) << "Could not append to autotune cache " << cache_file;
+    return;
+  }
+  file << key << " " << engine << "\n";
+}
+
+}  // namespace caffe
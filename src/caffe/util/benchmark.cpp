@@ -1,5 +1,15 @@
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <cerrno>
+#include <cstring>
+
 #include "caffe/common.hpp"
 #include "caffe/util/benchmark.hpp"
 
@@ -76,6 +86,28 @@ float Timer::MilliSeconds() {
   return elapsed_milliseconds_;
 }
 
+float Timer::MicroSeconds() {
+  if (!has_run_at_least_once()) {
+    LOG(WARNING) << "Timer has never been run before reading time.";
+    return 0;
+  }
+  if (running()) {
+    Stop();
+  }
+  if (Caffe::mode() == Caffe::GPU) {
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaEventElapsedTime(&elapsed_milliseconds_, start_gpu_,
+                                    stop_gpu_));
+    elapsed_microseconds_ = elapsed_milliseconds_ * 1000;
+#else
+      NO_GPU;
+#endif
+  } else {
+    elapsed_microseconds_ = (stop_cpu_ - start_cpu_).total_microseconds();
+  }
+  return elapsed_microseconds_;
+}
+
 float Timer::Seconds() {
   return MilliSeconds() / 1000.;
 }
@@ -94,4 +126,156 @@ void Timer::Init() {
   }
 }
 
+CPUTimer::CPUTimer() {
+}
+
+void CPUTimer::Start() {
+  if (!running()) {
+    start_cpu_ = boost::posix_time::microsec_clock::local_time();
+    running_ = true;
+    has_run_at_least_once_ = true;
+  }
+}
+
+void CPUTimer::Stop() {
+  if (running()) {
+    stop_cpu_ = boost::posix_time::microsec_clock::local_time();
+    running_ = false;
+  }
+}
+
+float CPUTimer::MilliSeconds() {
+  if (!has_run_at_least_once()) {
+    LOG(WARNING) << "Timer has never been run before reading time.";
+    return 0;
+  }
+  if (running()) {
+    Stop();
+  }
+  elapsed_milliseconds_ = (stop_cpu_ - start_cpu_).total_milliseconds();
+  return elapsed_milliseconds_;
+}
+
+float CPUTimer::MicroSeconds() {
+  if (!has_run_at_least_once()) {
+    LOG(WARNING) << "Timer has never been run before reading time.";
+    return 0;
+  }
+  if (running()) {
+    Stop();
+  }
+  elapsed_microseconds_ = (stop_cpu_ - start_cpu_).total_microseconds();
+  return elapsed_microseconds_;
+}
+
+#ifdef __linux__
+
+namespace {
+
+// Opens one counter on the calling thread, on any CPU. User space only:
+// kernel-side counts would blame a layer for interrupt work that just
+// happened to land in its interval.
+int OpenPerfCounter(const uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters()
+    : available_(false),
+      running_(false) {
+  static const uint64_t configs[NUM_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND };
+  // The counters are opened independently rather than as a group: some
+  // PMUs do not implement every event (stalled cycles in particular),
+  // and one missing event should not take the others down with it.
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    fds_[c] = OpenPerfCounter(configs[c]);
+    values_[c] = 0;
+  }
+  available_ = fds_[CYCLES] >= 0 && fds_[INSTRUCTIONS] >= 0;
+  if (!available_) {
+    LOG(WARNING) << "Hardware performance counters are unavailable ("
+        << strerror(errno) << "); check /proc/sys/kernel/perf_event_paranoid "
+        << "and that the machine exposes a PMU.";
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      if (fds_[c] >= 0) { close(fds_[c]); }
+      fds_[c] = -1;
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    if (fds_[c] >= 0) { close(fds_[c]); }
+  }
+}
+
+void PerfCounters::Start() {
+  if (!available_ || running_) { return; }
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    if (fds_[c] < 0) { continue; }
+    ioctl(fds_[c], PERF_EVENT_IOC_RESET, 0);
+    ioctl(fds_[c], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  running_ = true;
+}
+
+void PerfCounters::Stop() {
+  if (!available_ || !running_) { return; }
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    if (fds_[c] < 0) { continue; }
+    ioctl(fds_[c], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fds_[c], &values_[c], sizeof(values_[c]))
+        != sizeof(values_[c])) {
+      values_[c] = 0;
+    }
+  }
+  running_ = false;
+}
+
+#else  // no perf_event outside Linux.
+
+PerfCounters::PerfCounters()
+    : available_(false),
+      running_(false) {
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    fds_[c] = -1;
+    values_[c] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters() {}
+
+void PerfCounters::Start() {}
+
+void PerfCounters::Stop() {}
+
+#endif
+
+const char* PerfCounters::CounterName(const Counter counter) {
+  switch (counter) {
+  case CYCLES:
+    return "cycles";
+  case INSTRUCTIONS:
+    return "instructions";
+  case LLC_MISSES:
+    return "LLC misses";
+  case STALLED_CYCLES:
+    return "stalled cycles";
+  default:
+    LOG(FATAL) << "Unknown counter " << counter;
+  }
+  return "";
+}
+
 }  // namespace caffe
@@ -0,0 +1,45 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "caffe/util/cpu_dispatch.hpp"
+
+namespace caffe {
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static bool cpu_has_avx2() {
+  unsigned int eax, ebx, ecx, edx;
+  // AVX2 kernels also use FMA, and the ymm registers are only usable
+  // when the OS saves them across context switches (OSXSAVE + XCR0).
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  if (!(ecx & (1 << 12)) || !(ecx & (1 << 27))) {  // FMA, OSXSAVE
+    return false;
+  }
+  unsigned int xcr0_lo, xcr0_hi;
+  __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  if ((xcr0_lo & 0x6) != 0x6) {  // xmm and ymm state enabled
+    return false;
+  }
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx) || eax < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx & (1 << 5)) != 0;  // AVX2
+}
+
+bool CaffeCpuHasAVX2() {
+  // cpuid is idempotent, so a racing first call is harmless.
+  static const bool has_avx2 = cpu_has_avx2();
+  return has_avx2;
+}
+
+#else
+
+bool CaffeCpuHasAVX2() { return false; }
+
+#endif
+
+}  // namespace caffe
@@ -0,0 +1,91 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_neuron_layers.hpp"
+
+namespace caffe {
+
+// A layer can join a chain if it is a single-bottom, single-top elementwise
+// neuron layer whose top is not itself a loss.
+static bool IsFusableNeuronLayer(const LayerParameter& layer) {
+  switch (layer.type()) {
+  case LayerParameter_LayerType_ABSVAL:
+  case LayerParameter_LayerType_BNLL:
+  case LayerParameter_LayerType_DROPOUT:
+  case LayerParameter_LayerType_POWER:
+  case LayerParameter_LayerType_RELU:
+  case LayerParameter_LayerType_SIGMOID:
+  case LayerParameter_LayerType_TANH:
+  case LayerParameter_LayerType_THRESHOLD:
+    break;
+  default:
+    return false;
+  }
+  return layer.bottom_size() == 1 && layer.top_size() == 1 &&
+      layer.loss_weight_size() == 0;
+}
+
+void FuseNeuronLayers(const NetParameter& param, NetParameter* param_fused) {
+  // Initialize by copying from the input NetParameter.
+  param_fused->CopyFrom(param);
+  if (Caffe::phase() != Caffe::TEST || param.force_backward()) {
+    LOG(INFO) << "Skipping neuron layer fusion: the fused layer does not "
+              << "implement Backward.";
+    return;
+  }
+  param_fused->clear_layers();
+  // Count how many bottoms resolve to the top written by each layer. As in
+  // InsertSplits, a bottom resolves to the most recent writer of its blob
+  // name, so in-place rewrites of the same name count as distinct values.
+  // (Only the counts for single-top layers are consulted below, so lumping
+  // a layer's tops together in one count is fine.)
+  map<string, int> last_writer;
+  vector<int> top_readers(param.layers_size(), 0);
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer = param.layers(i);
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      map<string, int>::const_iterator writer =
+          last_writer.find(layer.bottom(j));
+      if (writer != last_writer.end()) {
+        ++top_readers[writer->second];
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      last_writer[layer.top(j)] = i;
+    }
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    // Extend the chain while the next layer reads exactly what this one
+    // writes and is the only reader of that value, so collapsing the pair
+    // cannot change any other layer's input. The final top is unconstrained:
+    // it survives the fusion holding the same value as before.
+    int last = i;
+    while (last + 1 < param.layers_size() &&
+        IsFusableNeuronLayer(param.layers(last)) &&
+        IsFusableNeuronLayer(param.layers(last + 1)) &&
+        param.layers(last + 1).bottom(0) == param.layers(last).top(0) &&
+        top_readers[last] == 1) {
+      ++last;
+    }
+    if (last == i) {
+      param_fused->add_layers()->CopyFrom(param.layers(i));
+      continue;
+    }
+    LayerParameter* fused = param_fused->add_layers();
+    fused->set_type(LayerParameter_LayerType_NEURON_CHAIN);
+    fused->add_bottom(param.layers(i).bottom(0));
+    fused->add_top(param.layers(last).top(0));
+    string name = param.layers(i).name();
+    for (int j = i; j <= last; ++j) {
+      if (j > i) { name += "+" + param.layers(j).name(); }
+      fused->mutable_neuron_chain_param()->add_op()->CopyFrom(param.layers(j));
+    }
+    fused->set_name(name);
+    LOG(INFO) << "Fused " << last - i + 1 << " neuron layers into " << name;
+    i = last;
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "caffe/util/gradient_compression.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Both payloads are raw little-endian structs, like the rest of the
+// parameter-server wire format: workers and server already have to
+// agree on Dtype and endianness.
+//
+// Top-k: uint32 k, then k uint32 indices, then k Dtype values.
+// 1-bit: Dtype positive scale, Dtype negative scale (both stored as
+// magnitudes), then ceil(count / 8) bytes of sign bits, bit set for a
+// non-negative entry, least significant bit first.
+
+template <typename Dtype>
+GradientCompressor<Dtype>* GradientCompressor<Dtype>::Create(
+    const SolverParameter& param) {
+  switch (param.gradient_compression()) {
+  case SolverParameter_CompressionType_COMPRESS_NONE:
+    return NULL;
+  case SolverParameter_CompressionType_COMPRESS_TOP_K:
+    return new TopKGradientCompressor<Dtype>(param.topk_fraction());
+  case SolverParameter_CompressionType_COMPRESS_ONE_BIT:
+    return new OneBitGradientCompressor<Dtype>();
+  default:
+    LOG(FATAL) << "Unknown gradient compression type "
+        << param.gradient_compression();
+  }
+  return NULL;
+}
+
+template <typename Dtype>
+TopKGradientCompressor<Dtype>::TopKGradientCompressor(const Dtype fraction)
+    : fraction_(fraction) {
+  CHECK_GT(fraction, 0) << "topk_fraction must be positive";
+  CHECK_LE(fraction, 1) << "topk_fraction cannot exceed 1";
+}
+
+template <typename Dtype>
+void TopKGradientCompressor<Dtype>::Compress(const Dtype* diff,
+    const int count, vector<uint8_t>* out) {
+  if (residual_.empty()) {
+    residual_.resize(count, Dtype(0));
+  }
+  CHECK_EQ(residual_.size(), count) << "Parameter count changed mid-run";
+  for (int i = 0; i < count; ++i) {
+    residual_[i] += diff[i];
+  }
+  const uint32_t k = std::max(1,
+      static_cast<int>(count * static_cast<double>(fraction_)));
+  // The k-th largest magnitude is the admission threshold; ties beyond
+  // the k-th keep their residual for a later push.
+  magnitudes_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    magnitudes_[i] = std::fabs(residual_[i]);
+  }
+  std::nth_element(magnitudes_.begin(), magnitudes_.begin() + (k - 1),
+      magnitudes_.end(), std::greater<Dtype>());
+  const Dtype threshold = magnitudes_[k - 1];
+  out->resize(sizeof(uint32_t) + k * (sizeof(uint32_t) + sizeof(Dtype)));
+  uint8_t* ptr = &(*out)[0];
+  memcpy(ptr, &k, sizeof(uint32_t));  // NOLINT(caffe/alt_fn)
+  uint32_t* indices = reinterpret_cast<uint32_t*>(ptr + sizeof(uint32_t));
+  Dtype* values = reinterpret_cast<Dtype*>(
+      ptr + sizeof(uint32_t) + k * sizeof(uint32_t));
+  uint32_t sent = 0;
+  for (int i = 0; i < count && sent < k; ++i) {
+    if (std::fabs(residual_[i]) >= threshold) {
+      indices[sent] = i;
+      values[sent] = residual_[i];
+      residual_[i] = 0;
+      ++sent;
+    }
+  }
+  CHECK_EQ(sent, k);
+}
+
+template <typename Dtype>
+void TopKGradientCompressor<Dtype>::Decompress(const uint8_t* data,
+    const size_t size, const int count, Dtype* diff) {
+  CHECK_GE(size, sizeof(uint32_t)) << "Truncated top-k payload";
+  uint32_t k;
+  memcpy(&k, data, sizeof(uint32_t));  // NOLINT(caffe/alt_fn)
+  CHECK_EQ(size, sizeof(uint32_t) + k * (sizeof(uint32_t) + sizeof(Dtype)))
+      << "Corrupt top-k payload";
+  const uint32_t* indices = reinterpret_cast<const uint32_t*>(
+      data + sizeof(uint32_t));
+  const Dtype* values = reinterpret_cast<const Dtype*>(
+      data + sizeof(uint32_t) + k * sizeof(uint32_t));
+  caffe_set(count, Dtype(0), diff);
+  for (uint32_t i = 0; i < k; ++i) {
+    CHECK_LT(indices[i], static_cast<uint32_t>(count))
+        << "Top-k index out of range";
+    diff[indices[i]] = values[i];
+  }
+}
+
+template <typename Dtype>
+void OneBitGradientCompressor<Dtype>::Compress(const Dtype* diff,
+    const int count, vector<uint8_t>* out) {
+  if (residual_.empty()) {
+    residual_.resize(count, Dtype(0));
+  }
+  CHECK_EQ(residual_.size(), count) << "Parameter count changed mid-run";
+  // The per-sign mean magnitude minimizes the squared quantization
+  // error among single-scale reconstructions of each sign bucket.
+  double positive_sum = 0, negative_sum = 0;
+  int positive_count = 0;
+  for (int i = 0; i < count; ++i) {
+    residual_[i] += diff[i];
+    if (residual_[i] >= 0) {
+      positive_sum += residual_[i];
+      ++positive_count;
+    } else {
+      negative_sum -= residual_[i];
+    }
+  }
+  const Dtype positive_scale = positive_count > 0 ?
+      static_cast<Dtype>(positive_sum / positive_count) : Dtype(0);
+  const Dtype negative_scale = count > positive_count ?
+      static_cast<Dtype>(negative_sum / (count - positive_count)) : Dtype(0);
+  const size_t sign_bytes = (count + 7) / 8;
+  out->assign(2 * sizeof(Dtype) + sign_bytes, 0);
+  uint8_t* ptr = &(*out)[0];
+  memcpy(ptr, &positive_scale, sizeof(Dtype));  // NOLINT(caffe/alt_fn)
+  memcpy(ptr + sizeof(Dtype), &negative_scale,  // NOLINT(caffe/alt_fn)
+      sizeof(Dtype));
+  uint8_t* bits = ptr + 2 * sizeof(Dtype);
+  for (int i = 0; i < count; ++i) {
+    Dtype sent;
+    if (residual_[i] >= 0) {
+      bits[i / 8] |= 1 << (i % 8);
+      sent = positive_scale;
+    } else {
+      sent = -negative_scale;
+    }
+    residual_[i] -= sent;
+  }
+}
+
+template <typename Dtype>
+void OneBitGradientCompressor<Dtype>::Decompress(const uint8_t* data,
+    const size_t size, const int count, Dtype* diff) {
+  const size_t sign_bytes = (count + 7) / 8;
+  CHECK_EQ(size, 2 * sizeof(Dtype) + sign_bytes)
+      << "Corrupt 1-bit payload";
+  Dtype positive_scale, negative_scale;
+  memcpy(&positive_scale, data, sizeof(Dtype));  // NOLINT(caffe/alt_fn)
+  memcpy(&negative_scale, data + sizeof(Dtype),  // NOLINT(caffe/alt_fn)
+      sizeof(Dtype));
+  const uint8_t* bits = data + 2 * sizeof(Dtype);
+  for (int i = 0; i < count; ++i) {
+    diff[i] = (bits[i / 8] >> (i % 8)) & 1 ?
+        positive_scale : -negative_scale;
+  }
+}
+
+INSTANTIATE_CLASS(GradientCompressor);
+INSTANTIATE_CLASS(TopKGradientCompressor);
+INSTANTIATE_CLASS(OneBitGradientCompressor);
+
+}  // namespace caffe
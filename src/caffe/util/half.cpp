@@ -0,0 +1,49 @@
+#include "caffe/util/half.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void caffe_cpu_convert_to_half(const int n, const Dtype* x, uint16_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_float2half(static_cast<float>(x[i]));
+  }
+}
+
+template
+void caffe_cpu_convert_to_half<float>(const int n, const float* x,
+    uint16_t* y);
+template
+void caffe_cpu_convert_to_half<double>(const int n, const double* x,
+    uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_convert_from_half(const int n, const uint16_t* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = static_cast<Dtype>(caffe_half2float(x[i]));
+  }
+}
+
+template
+void caffe_cpu_convert_from_half<float>(const int n, const uint16_t* x,
+    float* y);
+template
+void caffe_cpu_convert_from_half<double>(const int n, const uint16_t* x,
+    double* y);
+
+template <typename Dtype>
+void caffe_cpu_axpby_half(const int n, const Dtype alpha, const Dtype* x,
+    const Dtype beta, uint16_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_float2half(static_cast<float>(
+        alpha * x[i] + beta * caffe_half2float(y[i])));
+  }
+}
+
+template
+void caffe_cpu_axpby_half<float>(const int n, const float alpha,
+    const float* x, const float beta, uint16_t* y);
+template
+void caffe_cpu_axpby_half<double>(const int n, const double alpha,
+    const double* x, const double beta, uint16_t* y);
+
+}  // namespace caffe
@@ -0,0 +1,56 @@
+#include "caffe/common.hpp"
+#include "caffe/util/half.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__global__ void convert_from_half_kernel(const int n, const uint16_t* x,
+    Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    y[index] = __half2float(x[index]);
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_convert_from_half(const int n, const uint16_t* x, Dtype* y) {
+  const CaffeLaunchConfig cfg =
+      CaffeGetLaunchConfig(convert_from_half_kernel<Dtype>, n);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  convert_from_half_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
+      n, x, y);
+}
+
+template
+void caffe_gpu_convert_from_half<float>(const int n, const uint16_t* x,
+    float* y);
+template
+void caffe_gpu_convert_from_half<double>(const int n, const uint16_t* x,
+    double* y);
+
+template <typename Dtype>
+__global__ void axpby_half_kernel(const int n, const Dtype alpha,
+    const Dtype* x, const Dtype beta, uint16_t* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    y[index] = __float2half_rn(static_cast<float>(
+        alpha * x[index] + beta * __half2float(y[index])));
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_axpby_half(const int n, const Dtype alpha, const Dtype* x,
+    const Dtype beta, uint16_t* y) {
+  const CaffeLaunchConfig cfg =
+      CaffeGetLaunchConfig(axpby_half_kernel<Dtype>, n);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  axpby_half_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
+      n, alpha, x, beta, y);
+}
+
+template
+void caffe_gpu_axpby_half<float>(const int n, const float alpha,
+    const float* x, const float beta, uint16_t* y);
+template
+void caffe_gpu_axpby_half<double>(const int n, const double alpha,
+    const double* x, const double beta, uint16_t* y);
+
+}  // namespace caffe
@@ -8,32 +8,61 @@
 namespace caffe {
 
 template <typename Dtype>
-void im2col_cpu(const Dtype* data_im, const int channels,
+void im2col_strip_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
+    const int h_col_begin, const int h_col_end,
     Dtype* data_col) {
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
   int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  int strip = h_col_end - h_col_begin;
   int channels_col = channels * kernel_h * kernel_w;
+  // Each c writes a disjoint stripe of data_col, so the loop may be shared
+  // across threads.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
   for (int c = 0; c < channels_col; ++c) {
     int w_offset = c % kernel_w;
     int h_offset = (c / kernel_w) % kernel_h;
     int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
+    for (int h = h_col_begin; h < h_col_end; ++h) {
       for (int w = 0; w < width_col; ++w) {
         int h_pad = h * stride_h - pad_h + h_offset;
         int w_pad = w * stride_w - pad_w + w_offset;
         if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
+          data_col[(c * strip + h - h_col_begin) * width_col + w] =
             data_im[(c_im * height + h_pad) * width + w_pad];
         else
-          data_col[(c * height_col + h) * width_col + w] = 0;
+          data_col[(c * strip + h - h_col_begin) * width_col + w] = 0;
       }
     }
   }
 }
 
+// Explicit instantiation
+template void im2col_strip_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int h_col_begin,
+    const int h_col_end, float* data_col);
+template void im2col_strip_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int h_col_begin,
+    const int h_col_end, double* data_col);
+
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  im2col_strip_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, 0, height_col, data_col);
+}
+
 // Explicit instantiation
 template void im2col_cpu<float>(const float* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -45,31 +74,62 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int stride_w, double* data_col);
 
 template <typename Dtype>
-void col2im_cpu(const Dtype* data_col, const int channels,
+void col2im_strip_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
+    const int h_col_begin, const int h_col_end,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
-  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
   int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
-  int channels_col = channels * patch_h * patch_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % patch_w;
-    int h_offset = (c / patch_w) % patch_h;
-    int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
+  int strip = h_col_end - h_col_begin;
+  // Unlike im2col, different column channels accumulate into the same image
+  // channel, so the image channel is the outer (parallel) loop: every thread
+  // then writes only its own channel of data_im.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    for (int patch = 0; patch < patch_h * patch_w; ++patch) {
+      int w_offset = patch % patch_w;
+      int h_offset = patch / patch_w;
+      int c = c_im * patch_h * patch_w + patch;
+      for (int h = h_col_begin; h < h_col_end; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          int h_pad = h * stride_h - pad_h + h_offset;
+          int w_pad = w * stride_w - pad_w + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+            data_im[(c_im * height + h_pad) * width + w_pad] +=
+                data_col[(c * strip + h - h_col_begin) * width_col + w];
+        }
       }
     }
   }
 }
 
+// Explicit instantiation
+template void col2im_strip_cpu<float>(const float* data_col,
+    const int channels, const int height, const int width, const int patch_h,
+    const int patch_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    float* data_im);
+template void col2im_strip_cpu<double>(const double* data_col,
+    const int channels, const int height, const int width, const int patch_h,
+    const int patch_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    double* data_im);
+
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_im) {
+  caffe_set(height * width * channels, Dtype(0), data_im);
+  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  col2im_strip_cpu(data_col, channels, height, width, patch_h, patch_w,
+      pad_h, pad_w, stride_h, stride_w, 0, height_col, data_im);
+}
+
 // Explicit instantiation
 template void col2im_cpu<float>(const float* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
@@ -8,57 +8,134 @@
 
 namespace caffe {
 
+// Covers the output rows [h_col_begin, h_col_begin + strip); the full
+// im2col is the strip spanning every output row.
 template <typename Dtype>
 __global__ void im2col_gpu_kernel(const int n, const Dtype* data_im,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
-    const int height_col, const int width_col,
+    const int h_col_begin, const int strip, const int width_col,
     Dtype* data_col) {
   CUDA_KERNEL_LOOP(index, n) {
     int w_out = index % width_col;
     int h_index = index / width_col;
-    int h_out = h_index % height_col;
-    int channel_in = h_index / height_col;
+    int h_local = h_index % strip;
+    int channel_in = h_index / strip;
     int channel_out = channel_in * kernel_h * kernel_w;
-    int h_in = h_out * stride_h - pad_h;
+    int h_in = (h_col_begin + h_local) * stride_h - pad_h;
     int w_in = w_out * stride_w - pad_w;
     Dtype* data_col_ptr = data_col;
-    data_col_ptr += (channel_out * height_col + h_out) * width_col + w_out;
+    data_col_ptr += (channel_out * strip + h_local) * width_col + w_out;
+    const Dtype* data_im_ptr = data_im;
+    data_im_ptr += (channel_in * height + h_in) * width + w_in;
+    for (int i = 0; i < kernel_h; ++i) {
+      for (int j = 0; j < kernel_w; ++j) {
+        int h = h_in + i;
+        int w = w_in + j;
+        *data_col_ptr = (h >= 0 && w >= 0 && h < height && w < width) ?
+            data_im_ptr[i * width + j] : 0;
+        data_col_ptr += strip * width_col;
+      }
+    }
+  }
+}
+
+// Same as im2col_gpu_kernel but with the window geometry fixed at
+// compile time, so the window loops fully unroll and the kernel, stride
+// and pad arithmetic folds into the addressing. The dispatch in
+// im2col_strip_gpu routes the ubiquitous geometries here.
+template <typename Dtype, int kernel_h, int kernel_w, int stride, int pad>
+__global__ void im2col_gpu_fixed_kernel(const int n, const Dtype* data_im,
+    const int height, const int width,
+    const int h_col_begin, const int strip, const int width_col,
+    Dtype* data_col) {
+  CUDA_KERNEL_LOOP(index, n) {
+    int w_out = index % width_col;
+    int h_index = index / width_col;
+    int h_local = h_index % strip;
+    int channel_in = h_index / strip;
+    int channel_out = channel_in * kernel_h * kernel_w;
+    int h_in = (h_col_begin + h_local) * stride - pad;
+    int w_in = w_out * stride - pad;
+    Dtype* data_col_ptr = data_col;
+    data_col_ptr += (channel_out * strip + h_local) * width_col + w_out;
     const Dtype* data_im_ptr = data_im;
     data_im_ptr += (channel_in * height + h_in) * width + w_in;
+#pragma unroll
     for (int i = 0; i < kernel_h; ++i) {
+#pragma unroll
       for (int j = 0; j < kernel_w; ++j) {
         int h = h_in + i;
         int w = w_in + j;
         *data_col_ptr = (h >= 0 && w >= 0 && h < height && w < width) ?
             data_im_ptr[i * width + j] : 0;
-        data_col_ptr += height_col * width_col;
+        data_col_ptr += strip * width_col;
       }
     }
   }
 }
 
 template <typename Dtype>
-void im2col_gpu(const Dtype* data_im, const int channels,
+void im2col_strip_gpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
+    const int h_col_begin, const int h_col_end,
     Dtype* data_col) {
-  // We are going to launch channels * height_col * width_col kernels, each
+  // We are going to launch channels * strip * width_col kernels, each
   // kernel responsible for copying a single-channel grid.
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
   int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
-  int num_kernels = channels * height_col * width_col;
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
-                             CAFFE_CUDA_NUM_THREADS>>>(
-      num_kernels, data_im, height, width, kernel_h, kernel_w, pad_h,
-      pad_w, stride_h, stride_w, height_col,
-      width_col, data_col);
+  int strip = h_col_end - h_col_begin;
+  int num_kernels = channels * strip * width_col;
+  if (kernel_h == 3 && kernel_w == 3 && stride_h == 1 && stride_w == 1 &&
+      pad_h == 1 && pad_w == 1) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    im2col_gpu_fixed_kernel<Dtype, 3, 3, 1, 1><<<CAFFE_GET_BLOCKS(num_kernels),
+                                                 CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_im, height, width, h_col_begin, strip,
+        width_col, data_col);
+  } else if (kernel_h == 1 && kernel_w == 1 && stride_h == 1 &&
+      stride_w == 1 && pad_h == 0 && pad_w == 0) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    im2col_gpu_fixed_kernel<Dtype, 1, 1, 1, 0><<<CAFFE_GET_BLOCKS(num_kernels),
+                                                 CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_im, height, width, h_col_begin, strip,
+        width_col, data_col);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+                               CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_im, height, width, kernel_h, kernel_w, pad_h,
+        pad_w, stride_h, stride_w, h_col_begin, strip,
+        width_col, data_col);
+  }
   CUDA_POST_KERNEL_CHECK;
 }
 
+// Explicit instantiation
+template void im2col_strip_gpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int h_col_begin,
+    const int h_col_end, float* data_col);
+template void im2col_strip_gpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int h_col_begin,
+    const int h_col_end, double* data_col);
+
+template <typename Dtype>
+void im2col_gpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  im2col_strip_gpu(data_im, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, 0, height_col, data_col);
+}
+
 
 // Explicit instantiation
 template void im2col_gpu<float>(const float* data_im, const int channels,
@@ -112,6 +189,39 @@ __global__ void col2im_gpu_kernel(const int n, const Dtype* data_col,
   }
 }
 
+// Compile-time counterpart of col2im_gpu_kernel. With the patch, stride
+// and pad fixed, the start/end divisions constant-fold away and the
+// accumulation loops unroll to at most patch_h * patch_w terms.
+template <typename Dtype, int patch_h, int patch_w, int stride, int pad>
+__global__ void col2im_gpu_fixed_kernel(const int n, const Dtype* data_col,
+    const int height, const int width, const int channels,
+    const int height_col, const int width_col,
+    Dtype* data_im) {
+  CUDA_KERNEL_LOOP(index, n) {
+    Dtype val = 0;
+    int w = index % width + pad;
+    int h = (index / width) % height + pad;
+    int c = index / (width * height);
+    // compute the start and end of the output
+    int w_col_start = (w < patch_w) ? 0 : (w - patch_w) / stride + 1;
+    int w_col_end = min(w / stride + 1, width_col);
+    int h_col_start = (h < patch_h) ? 0 : (h - patch_h) / stride + 1;
+    int h_col_end = min(h / stride + 1, height_col);
+    int offset =
+        (c * patch_h * patch_w + h * patch_w + w) * height_col * width_col;
+    int coeff_h_col = (1 - stride * patch_w * height_col) * width_col;
+    int coeff_w_col = (1 - stride * height_col * width_col);
+#pragma unroll
+    for (int h_col = h_col_start; h_col < h_col_end; ++h_col) {
+#pragma unroll
+      for (int w_col = w_col_start; w_col < w_col_end; ++w_col) {
+        val += data_col[offset + h_col * coeff_h_col + w_col * coeff_w_col];
+      }
+    }
+    data_im[index] = val;
+  }
+}
+
 template <typename Dtype>
 void col2im_gpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
@@ -122,12 +232,28 @@ void col2im_gpu(const Dtype* data_col, const int channels,
   int num_kernels = channels * height * width;
   // To avoid involving atomic operations, we will launch one kernel per
   // bottom dimension, and then in the kernel add up the top dimensions.
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  col2im_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
-                             CAFFE_CUDA_NUM_THREADS>>>(
-      num_kernels, data_col, height, width, channels, patch_h, patch_w,
-      pad_h, pad_w, stride_h, stride_w,
-      height_col, width_col, data_im);
+  if (patch_h == 3 && patch_w == 3 && stride_h == 1 && stride_w == 1 &&
+      pad_h == 1 && pad_w == 1) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    col2im_gpu_fixed_kernel<Dtype, 3, 3, 1, 1><<<CAFFE_GET_BLOCKS(num_kernels),
+                                                 CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_col, height, width, channels,
+        height_col, width_col, data_im);
+  } else if (patch_h == 1 && patch_w == 1 && stride_h == 1 &&
+      stride_w == 1 && pad_h == 0 && pad_w == 0) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    col2im_gpu_fixed_kernel<Dtype, 1, 1, 1, 0><<<CAFFE_GET_BLOCKS(num_kernels),
+                                                 CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_col, height, width, channels,
+        height_col, width_col, data_im);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    col2im_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+                               CAFFE_CUDA_NUM_THREADS>>>(
+        num_kernels, data_col, height, width, channels, patch_h, patch_w,
+        pad_h, pad_w, stride_h, stride_w,
+        height_col, width_col, data_im);
+  }
   CUDA_POST_KERNEL_CHECK;
 }
 
@@ -141,4 +267,74 @@ template void col2im_gpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_im);
 
+// One thread per input element touched by the strip of output rows
+// [h_col_begin, h_col_end); h_im_begin is the first touched input row.
+// Accumulates into data_im (the caller zeroes the image before the first
+// strip), so launches for consecutive strips stay race free.
+template <typename Dtype>
+__global__ void col2im_strip_gpu_kernel(const int n, const Dtype* data_col,
+    const int height, const int width, const int channels,
+    const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int h_col_begin, const int h_col_end,
+    const int h_im_begin, const int h_im_count, const int width_col,
+    Dtype* data_im) {
+  const int strip = h_col_end - h_col_begin;
+  CUDA_KERNEL_LOOP(index, n) {
+    Dtype val = 0;
+    int w = index % width + pad_w;
+    int h = (index / width) % h_im_count + h_im_begin + pad_h;
+    int c = index / width / h_im_count;
+    // compute the start and end of the output, clamped to the strip
+    int w_col_start = (w < patch_w) ? 0 : (w - patch_w) / stride_w + 1;
+    int w_col_end = min(w / stride_w + 1, width_col);
+    int h_col_start = (h < patch_h) ? 0 : (h - patch_h) / stride_h + 1;
+    h_col_start = max(h_col_start, h_col_begin);
+    int h_col_stop = min(h / stride_h + 1, h_col_end);
+    for (int h_col = h_col_start; h_col < h_col_stop; ++h_col) {
+      for (int w_col = w_col_start; w_col < w_col_end; ++w_col) {
+        int c_col = c * patch_h * patch_w +
+            (h - h_col * stride_h) * patch_w + (w - w_col * stride_w);
+        val += data_col[(c_col * strip + h_col - h_col_begin) * width_col
+            + w_col];
+      }
+    }
+    data_im[(c * height + h - pad_h) * width + w - pad_w] += val;
+  }
+}
+
+template <typename Dtype>
+void col2im_strip_gpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    Dtype* data_im) {
+  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  // Only the input rows read by the strip's filter windows get a thread.
+  int h_im_begin = max(0, h_col_begin * stride_h - pad_h);
+  int h_im_end = min(height, (h_col_end - 1) * stride_h - pad_h + patch_h);
+  int h_im_count = h_im_end - h_im_begin;
+  int num_kernels = channels * h_im_count * width;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  col2im_strip_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+                                   CAFFE_CUDA_NUM_THREADS>>>(
+      num_kernels, data_col, height, width, channels, patch_h, patch_w,
+      pad_h, pad_w, stride_h, stride_w,
+      h_col_begin, h_col_end, h_im_begin, h_im_count, width_col, data_im);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+// Explicit instantiation
+template void col2im_strip_gpu<float>(const float* data_col,
+    const int channels, const int height, const int width, const int patch_h,
+    const int patch_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    float* data_im);
+template void col2im_strip_gpu<double>(const double* data_col,
+    const int channels, const int height, const int width, const int patch_h,
+    const int patch_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int h_col_begin, const int h_col_end,
+    double* data_im);
+
 }  // namespace caffe
@@ -0,0 +1,109 @@
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/insert_pipeline_transfers.hpp"
+
+namespace caffe {
+
+void InsertPipelineTransfers(const NetParameter& param,
+    NetParameter* param_transfer) {
+  // Initialize by copying from the input NetParameter.
+  param_transfer->CopyFrom(param);
+  param_transfer->clear_layers();
+  // The stage that produced each blob. Net inputs belong to stage 0.
+  map<string, int> blob_stage;
+  for (int i = 0; i < param.input_size(); ++i) {
+    blob_stage[param.input(i)] = 0;
+  }
+  // Collect the boundary blobs each stage consumes, in first-use order,
+  // so the stage's transfers can be emitted as one block in front of it.
+  int prev_stage = 0;
+  map<pair<int, string>, bool> crossing_seen;
+  vector<vector<string> > stage_crossings;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    const int stage = layer_param.pipeline_stage();
+    CHECK_GE(stage, prev_stage)
+        << "Layer " << layer_param.name() << " has pipeline_stage " << stage
+        << " after a layer of stage " << prev_stage
+        << "; stages must be non-decreasing in layer order";
+    prev_stage = stage;
+    if (static_cast<int>(stage_crossings.size()) <= stage) {
+      stage_crossings.resize(stage + 1);
+    }
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      CHECK(blob_stage.count(blob_name))
+          << "Unknown blob input " << blob_name << " to layer "
+          << layer_param.name();
+      const int source_stage = blob_stage[blob_name];
+      if (source_stage == stage) {
+        continue;
+      }
+      // A skipped stage would need synchronization with a stage the
+      // worker threads exchange no tokens with; relay the blob through
+      // the intermediate stages explicitly instead.
+      CHECK_EQ(source_stage, stage - 1)
+          << "Blob " << blob_name << " is produced in pipeline stage "
+          << source_stage << " but consumed in stage " << stage
+          << "; a blob may only cross into the next stage";
+      if (!crossing_seen[make_pair(stage, blob_name)]) {
+        crossing_seen[make_pair(stage, blob_name)] = true;
+        stage_crossings[stage].push_back(blob_name);
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      blob_stage[layer_param.top(j)] = stage;
+    }
+  }
+  // Emit the layers, placing each stage's transfer block in front of its
+  // first layer. From the crossing point on, every reference to a
+  // transferred blob -- bottoms, and tops of in-place layers -- is
+  // renamed to the transferred copy, so whole in-place chains keep
+  // operating on the stage-local blob.
+  map<string, string> rename;
+  prev_stage = -1;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    const int stage = layer_param.pipeline_stage();
+    if (stage != prev_stage) {
+      prev_stage = stage;
+      for (int j = 0; j < stage_crossings[stage].size(); ++j) {
+        const string& blob_name = stage_crossings[stage][j];
+        LayerParameter* transfer_param = param_transfer->add_layers();
+        transfer_param->set_name(
+            PipelineTransferLayerName(blob_name, stage));
+        transfer_param->set_type(LayerParameter_LayerType_PIPELINE_TRANSFER);
+        transfer_param->set_pipeline_stage(stage);
+        transfer_param->add_bottom(rename.count(blob_name) ?
+            rename[blob_name] : blob_name);
+        transfer_param->add_top(transfer_param->name());
+        rename[blob_name] = transfer_param->name();
+      }
+    }
+    LayerParameter* new_layer_param = param_transfer->add_layers();
+    new_layer_param->CopyFrom(layer_param);
+    for (int j = 0; j < new_layer_param->bottom_size(); ++j) {
+      if (rename.count(new_layer_param->bottom(j))) {
+        new_layer_param->set_bottom(j, rename[new_layer_param->bottom(j)]);
+      }
+    }
+    for (int j = 0; j < new_layer_param->top_size(); ++j) {
+      if (rename.count(new_layer_param->top(j))) {
+        new_layer_param->set_top(j, rename[new_layer_param->top(j)]);
+      }
+    }
+  }
+}
+
+string PipelineTransferLayerName(const string& blob_name, const int stage) {
+  ostringstream transfer_layer_name;
+  transfer_layer_name << blob_name << "_pipe_" << stage;
+  return transfer_layer_name.str();
+}
+
+}  // namespace caffe
@@ -96,6 +96,9 @@ void InsertSplits(const NetParameter& param, NetParameter* param_split) {
         const float loss_weight = top_idx_to_loss_weight[top_idx];
         ConfigureSplitLayer(layer_name, blob_name, j, split_count,
             loss_weight, split_layer_param);
+        // The split runs wherever its producer runs, so pipelined nets
+        // keep their stages contiguous.
+        split_layer_param->set_pipeline_stage(layer_param->pipeline_stage());
         if (loss_weight) {
           layer_param->clear_loss_weight();
           top_idx_to_bottom_split_idx[top_idx]++;
@@ -1,15 +1,26 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <dirent.h>
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <stdio.h>  // jpeglib.h needs FILE and size_t declared first
+#include <jpeglib.h>
 #include <leveldb/db.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #include <algorithm>
+#include <csetjmp>
+#include <cstring>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -46,9 +57,120 @@ void WriteProtoToTextFile(const Message& proto, const char* filename) {
   close(fd);
 }
 
+// Container layout for compressed proto files: uint32 magic, uint32 block
+// count, uint64 serialized size, then the blocks' uint64 deflated sizes,
+// then the deflated blocks in order. Each block covers a fixed span of the
+// serialized message (the last one whatever remains), so blocks deflate
+// and inflate independently on all cores.
+const uint32_t kCompressedProtoMagic = 0x0caffe2aU;
+const size_t kProtoCompressBlockSize = 4 * 1024 * 1024;
+
+namespace {
+
+// Threads each take every num_threads-th block, so the work spreads
+// evenly without any queue.
+void DeflateBlockStripe(const string* raw, vector<string>* blocks,
+    const int first, const int stride) {
+  for (int b = first; b < blocks->size(); b += stride) {
+    const size_t offset = static_cast<size_t>(b) * kProtoCompressBlockSize;
+    const size_t block_size =
+        std::min(kProtoCompressBlockSize, raw->size() - offset);
+    uLongf deflated_size = compressBound(block_size);
+    (*blocks)[b].resize(deflated_size);
+    // Z_BEST_SPEED: the point is fewer bytes on the wire, not archival
+    // density, and it keeps the CPU cost negligible next to training.
+    CHECK_EQ(compress2(reinterpret_cast<Bytef*>(&(*blocks)[b][0]),
+        &deflated_size,
+        reinterpret_cast<const Bytef*>(raw->data() + offset), block_size,
+        Z_BEST_SPEED), Z_OK) << "Snapshot compression failed";
+    (*blocks)[b].resize(deflated_size);
+  }
+}
+
+void InflateBlockStripe(const vector<string>* blocks, string* raw,
+    const int first, const int stride) {
+  for (int b = first; b < blocks->size(); b += stride) {
+    const size_t offset = static_cast<size_t>(b) * kProtoCompressBlockSize;
+    uLongf block_size =
+        std::min(kProtoCompressBlockSize, raw->size() - offset);
+    CHECK_EQ(uncompress(
+        reinterpret_cast<Bytef*>(&(*raw)[0]) + offset, &block_size,
+        reinterpret_cast<const Bytef*>((*blocks)[b].data()),
+        (*blocks)[b].size()), Z_OK)
+        << "Corrupt compressed proto block " << b;
+  }
+}
+
+int ProtoCodecThreads(const int num_blocks) {
+  const int cores = std::max(1u, boost::thread::hardware_concurrency());
+  return std::min(num_blocks, cores);
+}
+
+bool ReadFully(const int fd, void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t got = read(fd, ptr, size);
+    if (got <= 0) {
+      return false;
+    }
+    ptr += got;
+    size -= got;
+  }
+  return true;
+}
+
+bool ReadCompressedProto(const int fd, Message* proto) {
+  uint32_t num_blocks;
+  uint64_t raw_size;
+  if (!ReadFully(fd, &num_blocks, sizeof(num_blocks)) ||
+      !ReadFully(fd, &raw_size, sizeof(raw_size))) {
+    return false;
+  }
+  CHECK_LE(raw_size, 1073741824)
+      << "Compressed proto larger than the 1 GB parse limit";
+  vector<uint64_t> deflated_sizes(num_blocks);
+  if (num_blocks > 0 && !ReadFully(fd, &deflated_sizes[0],
+      num_blocks * sizeof(uint64_t))) {
+    return false;
+  }
+  vector<string> blocks(num_blocks);
+  for (uint32_t b = 0; b < num_blocks; ++b) {
+    blocks[b].resize(deflated_sizes[b]);
+    if (!ReadFully(fd, &blocks[b][0], blocks[b].size())) {
+      return false;
+    }
+  }
+  string raw;
+  raw.resize(raw_size);
+  const int num_threads = ProtoCodecThreads(num_blocks);
+  boost::thread_group inflaters;
+  for (int t = 0; t < num_threads; ++t) {
+    inflaters.create_thread(
+        boost::bind(&InflateBlockStripe, &blocks, &raw, t, num_threads));
+  }
+  inflaters.join_all();
+  CodedInputStream coded_input(
+      reinterpret_cast<const uint8_t*>(raw.data()), raw.size());
+  coded_input.SetTotalBytesLimit(1073741824, 536870912);
+  return proto->ParseFromCodedStream(&coded_input);
+}
+
+}  // namespace
+
 bool ReadProtoFromBinaryFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
   CHECK_NE(fd, -1) << "File not found: " << filename;
+  // Compressed containers announce themselves by their leading magic;
+  // anything else is a plain serialized message, parsed as before.
+  uint32_t magic = 0;
+  const ssize_t peeked = read(fd, &magic, sizeof(magic));
+  if (peeked == sizeof(magic) && magic == kCompressedProtoMagic) {
+    const bool success = ReadCompressedProto(fd, proto);
+    close(fd);
+    return success;
+  }
+  CHECK_EQ(lseek(fd, 0, SEEK_SET), 0)
+      << "Could not rewind " << filename << ": " << strerror(errno);
   ZeroCopyInputStream* raw_input = new FileInputStream(fd);
   CodedInputStream* coded_input = new CodedInputStream(raw_input);
   coded_input->SetTotalBytesLimit(1073741824, 536870912);
@@ -66,28 +188,47 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
-bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum) {
-  cv::Mat cv_img;
-  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
-
-  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
-  if (!cv_img_origin.data) {
-    LOG(ERROR) << "Could not open or find file " << filename;
-    return false;
+void WriteProtoToCompressedBinaryFile(const Message& proto,
+    const char* filename) {
+  string raw;
+  CHECK(proto.SerializeToString(&raw));
+  const uint32_t num_blocks =
+      (raw.size() + kProtoCompressBlockSize - 1) / kProtoCompressBlockSize;
+  vector<string> blocks(num_blocks);
+  const int num_threads = ProtoCodecThreads(num_blocks);
+  boost::thread_group deflaters;
+  for (int t = 0; t < num_threads; ++t) {
+    deflaters.create_thread(
+        boost::bind(&DeflateBlockStripe, &raw, &blocks, t, num_threads));
   }
-  if (height > 0 && width > 0) {
-    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
-  } else {
-    cv_img = cv_img_origin;
+  deflaters.join_all();
+  fstream output(filename, ios::out | ios::trunc | ios::binary);
+  const uint64_t raw_size = raw.size();
+  output.write(reinterpret_cast<const char*>(&kCompressedProtoMagic),
+      sizeof(kCompressedProtoMagic));
+  output.write(reinterpret_cast<const char*>(&num_blocks),
+      sizeof(num_blocks));
+  output.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+  for (uint32_t b = 0; b < num_blocks; ++b) {
+    const uint64_t deflated_size = blocks[b].size();
+    output.write(reinterpret_cast<const char*>(&deflated_size),
+        sizeof(deflated_size));
+  }
+  for (uint32_t b = 0; b < num_blocks; ++b) {
+    output.write(blocks[b].data(), blocks[b].size());
   }
+  CHECK(output.good()) << "Could not write " << filename;
+}
 
+// Packs a decoded image into the datum's raw uint8 layout.
+static void CVMatToDatum(const cv::Mat& cv_img, Datum* datum) {
+  const bool is_color = (cv_img.channels() == 3);
+  CHECK(is_color || cv_img.channels() == 1)
+      << "Image must have 1 or 3 channels";
   int num_channels = (is_color ? 3 : 1);
   datum->set_channels(num_channels);
   datum->set_height(cv_img.rows);
   datum->set_width(cv_img.cols);
-  datum->set_label(label);
   datum->clear_data();
   datum->clear_float_data();
   string* datum_string = datum->mutable_data();
@@ -108,6 +249,192 @@ bool ReadImageToDatum(const string& filename, const int label,
         }
       }
   }
+}
+
+// libjpeg reports errors by calling error_exit, which by default kills
+// the process; this handler longjmps back into the decoder instead so a
+// corrupt file just falls through to the cv::imdecode path.
+struct JpegErrorMgr {
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+static void JpegErrorExit(j_common_ptr cinfo) {
+  JpegErrorMgr* err = reinterpret_cast<JpegErrorMgr*>(cinfo->err);
+  longjmp(err->setjmp_buffer, 1);
+}
+
+// Decode a JPEG at reduced scale with libjpeg, which can produce 1/2,
+// 1/4, and 1/8 size output directly from the DCT coefficients for a
+// fraction of a full decode; the caller resizes the result down to the
+// exact target. Uses the largest denominator whose output is still at
+// least (target_height, target_width) so the final resize only ever
+// shrinks. Returns false -- leaving *out untouched -- when the buffer
+// is not a JPEG, nothing better than full scale would be picked, or the
+// decode fails, in which case the caller should fall back to OpenCV.
+static bool DecodeJpegScaled(const char* buffer, const size_t size,
+    const int target_height, const int target_width, const bool is_color,
+    cv::Mat* out) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer);
+  if (size < 3 || bytes[0] != 0xFF || bytes[1] != 0xD8 || bytes[2] != 0xFF) {
+    return false;  // Not a JPEG.
+  }
+  struct jpeg_decompress_struct cinfo;
+  JpegErrorMgr jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = JpegErrorExit;
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(bytes), size);
+  jpeg_read_header(&cinfo, TRUE);
+  // Exotic color spaces (CMYK scans and the like) go to OpenCV.
+  if (cinfo.jpeg_color_space != JCS_YCbCr &&
+      cinfo.jpeg_color_space != JCS_GRAYSCALE &&
+      cinfo.jpeg_color_space != JCS_RGB) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  int denom = 1;
+  while (denom < 8 &&
+      static_cast<int>(cinfo.image_height) / (denom * 2) >= target_height &&
+      static_cast<int>(cinfo.image_width) / (denom * 2) >= target_width) {
+    denom *= 2;
+  }
+  if (denom == 1) {  // No cheaper than a full decode.
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  cinfo.out_color_space = is_color ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_start_decompress(&cinfo);
+  cv::Mat decoded(cinfo.output_height, cinfo.output_width,
+      is_color ? CV_8UC3 : CV_8UC1);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = decoded.ptr<JSAMPLE>(cinfo.output_scanline);
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  if (is_color) {
+    // libjpeg hands back RGB; the rest of the pipeline is BGR.
+    cv::cvtColor(decoded, decoded, CV_RGB2BGR);
+  }
+  *out = decoded;
+  return true;
+}
+
+// Shared decode for the file and in-memory entry points below: scaled
+// JPEG decode when a target size makes it worthwhile, cv::imdecode
+// otherwise, then the exact resize. Returns an empty Mat on failure.
+static cv::Mat DecodeImage(const char* buffer, const size_t size,
+    const int height, const int width, const bool is_color) {
+  cv::Mat cv_img;
+  cv::Mat cv_img_origin;
+  if (!(height > 0 && width > 0) ||
+      !DecodeJpegScaled(buffer, size, height, width, is_color,
+                        &cv_img_origin)) {
+    int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+      CV_LOAD_IMAGE_GRAYSCALE);
+    // imdecode does not write through the buffer header, so the cast is
+    // safe.
+    const cv::Mat cv_buffer(1, static_cast<int>(size), CV_8UC1,
+        const_cast<char*>(buffer));
+    cv_img_origin = cv::imdecode(cv_buffer, cv_read_flag);
+    if (!cv_img_origin.data) {
+      return cv_img_origin;
+    }
+  }
+  if (height > 0 && width > 0) {
+    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
+  } else {
+    cv_img = cv_img_origin;
+  }
+  return cv_img;
+}
+
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  // Pull the raw bytes ourselves so JPEG files can take the scaled
+  // decode path; cv::imread would read the whole file anyway.
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!file.good()) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  const size_t size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  string buffer(size, ' ');
+  file.read(&buffer[0], size);
+  if (!file.good()) {
+    LOG(ERROR) << "Could not read file " << filename;
+    return false;
+  }
+  const cv::Mat cv_img = DecodeImage(buffer.data(), size, height, width,
+      is_color);
+  if (!cv_img.data) {
+    LOG(ERROR) << "Could not decode file " << filename;
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
+  datum->set_label(label);
+  return true;
+}
+
+bool DecodeImageToDatum(const char* buffer, const size_t size,
+    const int label, const int height, const int width, const bool is_color,
+    Datum* datum) {
+  const cv::Mat cv_img = DecodeImage(buffer, size, height, width, is_color);
+  if (!cv_img.data) {
+    LOG(ERROR) << "Could not decode image buffer";
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
+  datum->set_label(label);
+  return true;
+}
+
+bool ReadFileToDatum(const string& filename, const int label, Datum* datum) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!file.good()) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  const size_t size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  string buffer(size, ' ');
+  file.read(&buffer[0], size);
+  if (!file.good()) {
+    LOG(ERROR) << "Could not read file " << filename;
+    return false;
+  }
+  datum->clear_channels();
+  datum->clear_height();
+  datum->clear_width();
+  datum->clear_float_data();
+  datum->set_data(buffer);
+  datum->set_label(label);
+  datum->set_encoded(true);
+  return true;
+}
+
+bool DecodeDatum(Datum* datum) {
+  if (!datum->encoded()) {
+    return false;
+  }
+  const string& data = datum->data();
+  std::vector<char> buffer(data.begin(), data.end());
+  // Decode the image as stored in the file: color images come back with
+  // 3 channels, grayscale ones with 1.
+  cv::Mat cv_img = cv::imdecode(buffer, -1);
+  CHECK(cv_img.data) << "Could not decode datum";
+  CVMatToDatum(cv_img, datum);
+  datum->set_encoded(false);
   return true;
 }
 
@@ -119,6 +446,113 @@ leveldb::Options GetLevelDBOptions() {
   return options;
 }
 
+namespace {
+
+// Collects the regular files under path: a bare file is returned as-is,
+// a directory (the flat layout both database backends use) yields its
+// immediate regular entries, sorted for a deterministic visit order.
+void ListRegularFiles(const string& path, vector<string>* files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    LOG(WARNING) << "Cannot stat " << path;
+    return;
+  }
+  if (S_ISREG(st.st_mode)) {
+    files->push_back(path);
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == NULL) {
+    LOG(WARNING) << "Cannot open directory " << path;
+    return;
+  }
+  for (struct dirent* entry = readdir(dir); entry != NULL;
+       entry = readdir(dir)) {
+    const string name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    const string child = path + "/" + name;
+    if (stat(child.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files->push_back(child);
+    }
+  }
+  closedir(dir);
+  std::sort(files->begin(), files->end());
+}
+
+}  // namespace
+
+size_t WarmPageCache(const string& path) {
+  vector<string> files;
+  ListRegularFiles(path, &files);
+  // Large reads keep the disk streaming; the data itself is discarded,
+  // only the page-cache side effect matters.
+  const size_t kReadChunk = 4 * 1024 * 1024;
+  vector<char> buffer(kReadChunk);
+  size_t total = 0;
+  for (int i = 0; i < files.size(); ++i) {
+    const int fd = open(files[i].c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(WARNING) << "Cannot open " << files[i];
+      continue;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ssize_t bytes;
+    while ((bytes = read(fd, &buffer[0], kReadChunk)) > 0) {
+      total += bytes;
+    }
+    close(fd);
+  }
+  return total;
+}
+
+size_t MLockPath(const string& path, const double fraction) {
+  CHECK_GT(fraction, 0.);
+  CHECK_LE(fraction, 1.);
+  vector<string> files;
+  ListRegularFiles(path, &files);
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t total = 0;
+  for (int i = 0; i < files.size(); ++i) {
+    struct stat st;
+    if (stat(files[i].c_str(), &st) != 0) {
+      continue;
+    }
+    // The leading fraction: both backends write (and the cursor reads)
+    // files front to back, so the prefix is the hot part.
+    size_t bytes = static_cast<size_t>(st.st_size * fraction);
+    bytes -= bytes % page_size;
+    if (bytes == 0) {
+      continue;
+    }
+    const int fd = open(files[i].c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(WARNING) << "Cannot open " << files[i];
+      continue;
+    }
+    void* mapped = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      LOG(WARNING) << "Cannot map " << files[i];
+      continue;
+    }
+    if (mlock(mapped, bytes) != 0) {
+      LOG(WARNING) << "mlock failed for " << bytes << " bytes of "
+          << files[i] << "; raise RLIMIT_MEMLOCK (ulimit -l)";
+      munmap(mapped, bytes);
+      continue;
+    }
+    // The mapping is kept for the life of the process; unmapping would
+    // drop the lock.
+    total += bytes;
+  }
+  return total;
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
@@ -147,6 +581,15 @@ void hdf5_load_nd_dataset_helper(
     (dims.size() > 3) ? dims[3] : 1);
 }
 
+// Instantiated for use by the HDF5 data layer, which sizes its tops from
+// the dataset shapes without reading the data.
+template void hdf5_load_nd_dataset_helper<float>(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<float>* blob);
+template void hdf5_load_nd_dataset_helper<double>(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<double>* blob);
+
 template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
@@ -165,6 +608,59 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+// Reads a hyperslab of num_rows rows starting at start_row into the blob;
+// the memory type decides whether the library converts to float or double.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows_helper(
+    hid_t file_id, const char* dataset_name_, const hsize_t start_row,
+    const hsize_t num_rows, const hid_t mem_type, Blob<Dtype>* blob) {
+  hid_t dataset = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset, 0) << "Failed to open dataset " << dataset_name_;
+  hid_t file_space = H5Dget_space(dataset);
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  CHECK_GE(ndims, 1);
+  CHECK_LE(ndims, 4);
+  std::vector<hsize_t> dims(ndims);
+  H5Sget_simple_extent_dims(file_space, dims.data(), NULL);
+  CHECK_LE(start_row + num_rows, dims[0])
+      << "Hyperslab past the end of dataset " << dataset_name_;
+  std::vector<hsize_t> start(ndims, 0);
+  std::vector<hsize_t> count(dims);
+  start[0] = start_row;
+  count[0] = num_rows;
+  herr_t status = H5Sselect_hyperslab(
+      file_space, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select hyperslab in " << dataset_name_;
+  hid_t mem_space = H5Screate_simple(ndims, count.data(), NULL);
+  blob->Reshape(
+    num_rows,
+    (ndims > 1) ? dims[1] : 1,
+    (ndims > 2) ? dims[2] : 1,
+    (ndims > 3) ? dims[3] : 1);
+  status = H5Dread(dataset, mem_type, mem_space, file_space, H5P_DEFAULT,
+      blob->mutable_cpu_data());
+  CHECK_GE(status, 0) << "Failed to read hyperslab from " << dataset_name_;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(
+    hid_t file_id, const char* dataset_name_, const hsize_t start_row,
+    const hsize_t num_rows, Blob<float>* blob) {
+  hdf5_load_nd_dataset_rows_helper(
+      file_id, dataset_name_, start_row, num_rows, H5T_NATIVE_FLOAT, blob);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(
+    hid_t file_id, const char* dataset_name_, const hsize_t start_row,
+    const hsize_t num_rows, Blob<double>* blob) {
+  hdf5_load_nd_dataset_rows_helper(
+      file_id, dataset_name_, start_row, num_rows, H5T_NATIVE_DOUBLE, blob);
+}
+
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string dataset_name, const Blob<float>& blob) {
@@ -191,4 +687,85 @@ void hdf5_save_nd_dataset<double>(
   CHECK_GE(status, 0) << "Failed to make double dataset " << dataset_name;
 }
 
+static void hdf5_append_nd_dataset_helper(
+    const hid_t file_id, const string& dataset_name, const hid_t dtype,
+    const hsize_t* blob_dims, const void* data, const int compression_level) {
+  hid_t dataset;
+  hsize_t offset[HDF5_NUM_DIMS] = {0, 0, 0, 0};
+  if (!H5LTfind_dataset(file_id, dataset_name.c_str())) {
+    // First append: create an extensible dataset chunked by one append's
+    // worth of rows, so later extensions land on chunk boundaries.
+    hsize_t max_dims[HDF5_NUM_DIMS];
+    for (int i = 0; i < HDF5_NUM_DIMS; ++i) {
+      max_dims[i] = blob_dims[i];
+    }
+    max_dims[0] = H5S_UNLIMITED;
+    hid_t file_space = H5Screate_simple(HDF5_NUM_DIMS, blob_dims, max_dims);
+    hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+    CHECK_GE(H5Pset_chunk(plist, HDF5_NUM_DIMS, blob_dims), 0)
+        << "Failed to set chunking for dataset " << dataset_name;
+    if (compression_level > 0) {
+      CHECK_GE(H5Pset_deflate(plist, compression_level), 0)
+          << "Failed to set compression for dataset " << dataset_name;
+    }
+    dataset = H5Dcreate2(file_id, dataset_name.c_str(), dtype, file_space,
+        H5P_DEFAULT, plist, H5P_DEFAULT);
+    CHECK_GE(dataset, 0) << "Failed to create dataset " << dataset_name;
+    H5Pclose(plist);
+    H5Sclose(file_space);
+  } else {
+    dataset = H5Dopen2(file_id, dataset_name.c_str(), H5P_DEFAULT);
+    CHECK_GE(dataset, 0) << "Failed to open dataset " << dataset_name;
+    hid_t file_space = H5Dget_space(dataset);
+    CHECK_EQ(H5Sget_simple_extent_ndims(file_space), HDF5_NUM_DIMS);
+    hsize_t dims[HDF5_NUM_DIMS];
+    H5Sget_simple_extent_dims(file_space, dims, NULL);
+    H5Sclose(file_space);
+    for (int i = 1; i < HDF5_NUM_DIMS; ++i) {
+      CHECK_EQ(dims[i], blob_dims[i])
+          << "Appended batches must share the datum shape of dataset "
+          << dataset_name;
+    }
+    offset[0] = dims[0];
+    dims[0] += blob_dims[0];
+    CHECK_GE(H5Dset_extent(dataset, dims), 0)
+        << "Failed to extend dataset " << dataset_name;
+  }
+  hid_t file_space = H5Dget_space(dataset);
+  CHECK_GE(H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL,
+      blob_dims, NULL), 0) << "Failed to select rows of " << dataset_name;
+  hid_t mem_space = H5Screate_simple(HDF5_NUM_DIMS, blob_dims, NULL);
+  CHECK_GE(H5Dwrite(dataset, dtype, mem_space, file_space, H5P_DEFAULT,
+      data), 0) << "Failed to append to dataset " << dataset_name;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset);
+}
+
+template <>
+void hdf5_append_nd_dataset<float>(
+    const hid_t file_id, const string dataset_name, const Blob<float>& blob,
+    const int compression_level) {
+  hsize_t dims[HDF5_NUM_DIMS];
+  dims[0] = blob.num();
+  dims[1] = blob.channels();
+  dims[2] = blob.height();
+  dims[3] = blob.width();
+  hdf5_append_nd_dataset_helper(file_id, dataset_name, H5T_NATIVE_FLOAT,
+      dims, blob.cpu_data(), compression_level);
+}
+
+template <>
+void hdf5_append_nd_dataset<double>(
+    const hid_t file_id, const string dataset_name, const Blob<double>& blob,
+    const int compression_level) {
+  hsize_t dims[HDF5_NUM_DIMS];
+  dims[0] = blob.num();
+  dims[1] = blob.channels();
+  dims[2] = blob.height();
+  dims[3] = blob.width();
+  hdf5_append_nd_dataset_helper(file_id, dataset_name, H5T_NATIVE_DOUBLE,
+      dims, blob.cpu_data(), compression_level);
+}
+
 }  // namespace caffe
@@ -1,14 +1,65 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
 #include <limits>
+#include <vector>
 
 #include "caffe/common.hpp"
+#include "caffe/util/cpu_dispatch.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+#ifndef CAFFE_NO_SMALL_GEMM
+// Below this many multiply-accumulates (M*N*K), BLAS dispatch overhead
+// (thread wakeup, packing) dominates and the plain kernels below win.
+// Measured with tools/gemm_benchmark; re-measure when changing the BLAS
+// library and build with NO_SMALL_GEMM := 1 to always dispatch.
+const int64_t kSmallGemmThreshold = 1 << 16;
+
+// C = alpha * A * B + beta * C for small row-major untransposed
+// operands. Only the non-transposed case is handled here -- that is the
+// shape the convolution forward pass uses; everything else goes to
+// BLAS. When beta == 0, C is never read, matching BLAS semantics.
+template <typename Dtype>
+static void caffe_small_gemm_nn(const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
+    Dtype* C) {
+  for (int i = 0; i < M; ++i) {
+    const Dtype* a = A + i * K;
+    Dtype* c = C + i * N;
+    for (int j = 0; j < N; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < K; ++k) {
+        sum += a[k] * B[k * N + j];
+      }
+      c[j] = (beta == 0) ? alpha * sum : alpha * sum + beta * c[j];
+    }
+  }
+}
+
+#ifdef CAFFE_X86_DISPATCH
+// Float overload dispatched by cpuid: AVX2 hosts take the hand-tiled
+// variant in math_functions_avx2.cpp, others the scalar template above,
+// so one build serves the whole fleet.
+static void caffe_small_gemm_nn(const int M, const int N, const int K,
+    const float alpha, const float* A, const float* B, const float beta,
+    float* C) {
+  if (CaffeCpuHasAVX2()) {
+    caffe_avx2_small_gemm_nn(M, N, K, alpha, A, B, beta, C);
+    return;
+  }
+  caffe_small_gemm_nn<float>(M, N, K, alpha, A, B, beta, C);
+}
+#endif  // CAFFE_X86_DISPATCH
+#endif  // CAFFE_NO_SMALL_GEMM
+
 template<>
 void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
     const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
@@ -16,6 +67,13 @@ void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
     float* C) {
   int lda = (TransA == CblasNoTrans) ? K : M;
   int ldb = (TransB == CblasNoTrans) ? N : K;
+#ifndef CAFFE_NO_SMALL_GEMM
+  if (TransA == CblasNoTrans && TransB == CblasNoTrans &&
+      static_cast<int64_t>(M) * N * K <= kSmallGemmThreshold) {
+    caffe_small_gemm_nn(M, N, K, alpha, A, B, beta, C);
+    return;
+  }
+#endif
   cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
       ldb, beta, C, N);
 }
@@ -27,10 +85,35 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
     double* C) {
   int lda = (TransA == CblasNoTrans) ? K : M;
   int ldb = (TransB == CblasNoTrans) ? N : K;
+#ifndef CAFFE_NO_SMALL_GEMM
+  if (TransA == CblasNoTrans && TransB == CblasNoTrans &&
+      static_cast<int64_t>(M) * N * K <= kSmallGemmThreshold) {
+    caffe_small_gemm_nn(M, N, K, alpha, A, B, beta, C);
+    return;
+  }
+#endif
   cblas_dgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
       ldb, beta, C, N);
 }
 
+template <>
+void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int lda, const float* B,
+    const int ldb, const float beta, float* C, const int ldc) {
+  cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
+template <>
+void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int lda, const double* B,
+    const int ldb, const double beta, double* C, const int ldc) {
+  cblas_dgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
 template <>
 void caffe_cpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -196,6 +279,16 @@ void caffe_sqr<double>(const int n, const double* a, double* y) {
   vdSqr(n, a, y);
 }
 
+template <>
+void caffe_sqrt<float>(const int n, const float* a, float* y) {
+  vsSqrt(n, a, y);
+}
+
+template <>
+void caffe_sqrt<double>(const int n, const double* a, double* y) {
+  vdSqrt(n, a, y);
+}
+
 template <>
 void caffe_exp<float>(const int n, const float* a, float* y) {
   vsExp(n, a, y);
@@ -206,6 +299,54 @@ void caffe_exp<double>(const int n, const double* a, double* y) {
   vdExp(n, a, y);
 }
 
+// Fused softmax of one dense vector: a max sweep, an exp-and-sum sweep
+// writing y, and a scale sweep. The AVX2 float variant folds the first
+// two into one online sweep.
+template <typename Dtype>
+static void caffe_softmax_generic(const int n, const Dtype* x, Dtype* y) {
+  Dtype max = x[0];
+  for (int i = 1; i < n; ++i) {
+    max = std::max(max, x[i]);
+  }
+  Dtype sum = 0;
+  for (int i = 0; i < n; ++i) {
+    y[i] = exp(x[i] - max);
+    sum += y[i];
+  }
+  const Dtype scale = Dtype(1) / sum;
+  for (int i = 0; i < n; ++i) {
+    y[i] *= scale;
+  }
+}
+
+template <>
+void caffe_cpu_softmax<float>(const int n, const float* x, float* y) {
+  CHECK_GT(n, 0);
+#ifdef CAFFE_X86_DISPATCH
+  if (CaffeCpuHasAVX2()) {
+    caffe_avx2_softmax_ps(n, x, y);
+    return;
+  }
+#endif
+  caffe_softmax_generic(n, x, y);
+}
+
+template <>
+void caffe_cpu_softmax<double>(const int n, const double* x, double* y) {
+  CHECK_GT(n, 0);
+  caffe_softmax_generic(n, x, y);
+}
+
+template <>
+void caffe_log<float>(const int n, const float* a, float* y) {
+  vsLn(n, a, y);
+}
+
+template <>
+void caffe_log<double>(const int n, const double* a, double* y) {
+  vdLn(n, a, y);
+}
+
 template <>
 void caffe_abs<float>(const int n, const float* a, float* y) {
     vsAbs(n, a, y);
@@ -216,6 +357,60 @@ void caffe_abs<double>(const int n, const double* a, double* y) {
     vdAbs(n, a, y);
 }
 
+template <typename Dtype>
+void caffe_sum(const int N, const int num_inputs, const Dtype* const* inputs,
+    const Dtype* coeffs, Dtype* y) {
+  CHECK_GE(num_inputs, 1);
+  // Separate loops so the hot unweighted path carries no coefficient
+  // loads and both bodies stay simple enough to vectorize.
+  if (coeffs) {
+    for (int i = 0; i < N; ++i) {
+      Dtype sum = coeffs[0] * inputs[0][i];
+      for (int j = 1; j < num_inputs; ++j) {
+        sum += coeffs[j] * inputs[j][i];
+      }
+      y[i] = sum;
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      Dtype sum = inputs[0][i];
+      for (int j = 1; j < num_inputs; ++j) {
+        sum += inputs[j][i];
+      }
+      y[i] = sum;
+    }
+  }
+}
+
+template
+void caffe_sum<float>(const int N, const int num_inputs,
+    const float* const* inputs, const float* coeffs, float* y);
+
+template
+void caffe_sum<double>(const int N, const int num_inputs,
+    const double* const* inputs, const double* coeffs, double* y);
+
+template <typename Dtype>
+void caffe_prod(const int N, const int num_inputs, const Dtype* const* inputs,
+    Dtype* y) {
+  CHECK_GE(num_inputs, 1);
+  for (int i = 0; i < N; ++i) {
+    Dtype prod = inputs[0][i];
+    for (int j = 1; j < num_inputs; ++j) {
+      prod *= inputs[j][i];
+    }
+    y[i] = prod;
+  }
+}
+
+template
+void caffe_prod<float>(const int N, const int num_inputs,
+    const float* const* inputs, float* y);
+
+template
+void caffe_prod<double>(const int N, const int num_inputs,
+    const double* const* inputs, double* y);
+
 unsigned int caffe_rng_rand() {
   return (*caffe_rng())();
 }
@@ -232,17 +427,53 @@ float caffe_nextafter(const float b);
 template
 double caffe_nextafter(const double b);
 
+// Above this many variates a fill is partitioned across an OpenMP
+// team. Each chunk draws from its own generator seeded from the master
+// stream up front, so the result depends only on the master seed (not
+// the thread schedule), though it is not bit-identical to the serial
+// order. Large weight fillers are the intended beneficiaries.
+const int kParallelRngThreshold = 1 << 20;
+
+template <typename Dtype, typename Dist>
+static void caffe_rng_fill(const int n, const Dist& dist, Dtype* r) {
+#ifdef _OPENMP
+  if (n >= kParallelRngThreshold) {
+    const int nthreads = omp_get_max_threads();
+    const int chunk = (n + nthreads - 1) / nthreads;
+    std::vector<unsigned int> seeds(nthreads);
+    for (int t = 0; t < nthreads; ++t) {
+      seeds[t] = (*caffe_rng())();
+    }
+    #pragma omp parallel for
+    for (int t = 0; t < nthreads; ++t) {
+      const int begin = t * chunk;
+      const int len = std::min(chunk, n - begin);
+      if (len > 0) {
+        caffe::rng_t rng(seeds[t]);
+        boost::variate_generator<caffe::rng_t*, Dist>
+            variate_generator(&rng, dist);
+        for (int i = 0; i < len; ++i) {
+          r[begin + i] = variate_generator();
+        }
+      }
+    }
+    return;
+  }
+#endif
+  boost::variate_generator<caffe::rng_t*, Dist>
+      variate_generator(caffe_rng(), dist);
+  for (int i = 0; i < n; ++i) {
+    r[i] = variate_generator();
+  }
+}
+
 template <typename Dtype>
 void caffe_rng_uniform(const int n, const Dtype a, const Dtype b, Dtype* r) {
   CHECK_GE(n, 0);
   CHECK(r);
   CHECK_LE(a, b);
   boost::uniform_real<Dtype> random_distribution(a, caffe_nextafter<Dtype>(b));
-  boost::variate_generator<caffe::rng_t*, boost::uniform_real<Dtype> >
-      variate_generator(caffe_rng(), random_distribution);
-  for (int i = 0; i < n; ++i) {
-    r[i] = variate_generator();
-  }
+  caffe_rng_fill(n, random_distribution, r);
 }
 
 template
@@ -260,11 +491,7 @@ void caffe_rng_gaussian(const int n, const Dtype a,
   CHECK(r);
   CHECK_GT(sigma, 0);
   boost::normal_distribution<Dtype> random_distribution(a, sigma);
-  boost::variate_generator<caffe::rng_t*, boost::normal_distribution<Dtype> >
-      variate_generator(caffe_rng(), random_distribution);
-  for (int i = 0; i < n; ++i) {
-    r[i] = variate_generator();
-  }
+  caffe_rng_fill(n, random_distribution, r);
 }
 
 template
@@ -315,6 +542,48 @@ void caffe_rng_bernoulli<double>(const int n, const double p, unsigned int* r);
 template
 void caffe_rng_bernoulli<float>(const int n, const float p, unsigned int* r);
 
+template <typename Dtype, typename Itype>
+static void caffe_rng_bernoulli_block_impl(const int n, const Dtype p,
+                                           Itype* r) {
+  CHECK_GE(n, 0);
+  CHECK(r);
+  CHECK_GE(p, 0);
+  CHECK_LE(p, 1);
+  caffe::rng_t* rng = caffe_rng();
+  // One raw generator word per variate: r[i] = (word < p * 2^32). caffe::rng_t
+  // (mt19937) yields full 32-bit words, and the threshold is computed once in
+  // 64 bits so that p == 1 maps to 2^32 and always passes.
+  const uint64_t range = static_cast<uint64_t>(1) << 32;
+  const uint64_t threshold = static_cast<uint64_t>(p * range);
+  for (int i = 0; i < n; ++i) {
+    r[i] = static_cast<Itype>(static_cast<uint64_t>((*rng)()) < threshold);
+  }
+}
+
+template <typename Dtype>
+void caffe_rng_bernoulli_block(const int n, const Dtype p, int* r) {
+  caffe_rng_bernoulli_block_impl(n, p, r);
+}
+
+template
+void caffe_rng_bernoulli_block<double>(const int n, const double p, int* r);
+
+template
+void caffe_rng_bernoulli_block<float>(const int n, const float p, int* r);
+
+template <typename Dtype>
+void caffe_rng_bernoulli_block(const int n, const Dtype p, unsigned int* r) {
+  caffe_rng_bernoulli_block_impl(n, p, r);
+}
+
+template
+void caffe_rng_bernoulli_block<double>(const int n, const double p,
+                                       unsigned int* r);
+
+template
+void caffe_rng_bernoulli_block<float>(const int n, const float p,
+                                      unsigned int* r);
+
 template <>
 float caffe_cpu_strided_dot<float>(const int n, const float* x, const int incx,
     const float* y, const int incy) {
@@ -327,8 +596,29 @@ double caffe_cpu_strided_dot<double>(const int n, const double* x,
   return cblas_ddot(n, x, incx, y, incy);
 }
 
+// Reductions below this many elements stay on the single-threaded BLAS
+// call; the parallel split only pays off once the vector no longer fits
+// in cache.
+const int kParallelReduceThreshold = 1 << 20;
+
 template <typename Dtype>
 Dtype caffe_cpu_dot(const int n, const Dtype* x, const Dtype* y) {
+#ifdef _OPENMP
+  if (n >= kParallelReduceThreshold) {
+    Dtype sum = 0;
+    #pragma omp parallel reduction(+:sum)
+    {
+      const int chunk = (n + omp_get_num_threads() - 1) /
+          omp_get_num_threads();
+      const int begin = omp_get_thread_num() * chunk;
+      const int len = std::min(chunk, n - begin);
+      if (len > 0) {
+        sum = caffe_cpu_strided_dot(len, x + begin, 1, y + begin, 1);
+      }
+    }
+    return sum;
+  }
+#endif
   return caffe_cpu_strided_dot(n, x, 1, y, 1);
 }
 
@@ -360,16 +650,267 @@ int caffe_cpu_hamming_distance<double>(const int n, const double* x,
   return dist;
 }
 
+// Popcount of the XOR of two packed code rows of n 64-bit words. AVX2
+// hosts take the table-lookup variant in math_functions_avx2.cpp.
+static inline int caffe_hamming_popcnt_words(const int n, const uint64_t* a,
+                                             const uint64_t* b) {
+#ifdef CAFFE_X86_DISPATCH
+  if (CaffeCpuHasAVX2()) {
+    return caffe_avx2_hamming_popcnt(n, a, b);
+  }
+#endif
+  int dist = 0;
+  for (int i = 0; i < n; ++i) {
+    dist += __builtin_popcountll(a[i] ^ b[i]);
+  }
+  return dist;
+}
+
+// float codes occupy 32 bits each, so two pack into a word; the odd
+// tail leaves the high half zero, consistently for both operands.
+static inline int caffe_hamming_words(const int dim, const float*) {
+  return (dim + 1) / 2;
+}
+
+static inline int caffe_hamming_words(const int dim, const double*) {
+  return dim;
+}
+
+static void caffe_hamming_pack(const int rows, const int dim,
+                               const float* src, uint64_t* dst) {
+  const int words = (dim + 1) / 2;
+  for (int r = 0; r < rows; ++r) {
+    const float* a = src + r * dim;
+    uint64_t* w = dst + r * words;
+    int d = 0;
+    for (int k = 0; d + 2 <= dim; ++k, d += 2) {
+      w[k] = static_cast<uint64_t>(static_cast<uint32_t>(a[d])) |
+          (static_cast<uint64_t>(static_cast<uint32_t>(a[d + 1])) << 32);
+    }
+    if (d < dim) {
+      w[words - 1] = static_cast<uint32_t>(a[d]);
+    }
+  }
+}
+
+static void caffe_hamming_pack(const int rows, const int dim,
+                               const double* src, uint64_t* dst) {
+  for (int i = 0; i < rows * dim; ++i) {
+    dst[i] = static_cast<uint64_t>(src[i]);
+  }
+}
+
+// Rows of y processed per tile; a tile of packed codes stays
+// cache-resident while every row of x streams past it.
+const int kHammingTileRows = 64;
+
+template <typename Dtype>
+void caffe_cpu_hamming_distance_matrix(const int n, const int m,
+    const int dim, const Dtype* x, const Dtype* y, int* out) {
+  CHECK_GE(n, 0);
+  CHECK_GE(m, 0);
+  CHECK_GT(dim, 0);
+  CHECK(x);
+  CHECK(y);
+  CHECK(out);
+  const int words = caffe_hamming_words(dim, x);
+  std::vector<uint64_t> x_codes(static_cast<size_t>(n) * words);
+  std::vector<uint64_t> y_codes(static_cast<size_t>(kHammingTileRows) * words);
+  caffe_hamming_pack(n, dim, x, &x_codes[0]);
+  for (int jb = 0; jb < m; jb += kHammingTileRows) {
+    const int jn = std::min(kHammingTileRows, m - jb);
+    caffe_hamming_pack(jn, dim, y + static_cast<size_t>(jb) * dim,
+                       &y_codes[0]);
+    for (int i = 0; i < n; ++i) {
+      const uint64_t* xi = &x_codes[static_cast<size_t>(i) * words];
+      int* out_row = out + static_cast<size_t>(i) * m + jb;
+      for (int j = 0; j < jn; ++j) {
+        out_row[j] = caffe_hamming_popcnt_words(
+            words, xi, &y_codes[static_cast<size_t>(j) * words]);
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_hamming_distance_matrix<float>(const int n, const int m,
+    const int dim, const float* x, const float* y, int* out);
+
+template
+void caffe_cpu_hamming_distance_matrix<double>(const int n, const int m,
+    const int dim, const double* x, const double* y, int* out);
+
+template <typename Dtype>
+Dtype caffe_asum_blas(const int n, const Dtype* x);
+
 template <>
-float caffe_cpu_asum<float>(const int n, const float* x) {
+float caffe_asum_blas<float>(const int n, const float* x) {
   return cblas_sasum(n, x, 1);
 }
 
 template <>
-double caffe_cpu_asum<double>(const int n, const double* x) {
+double caffe_asum_blas<double>(const int n, const double* x) {
   return cblas_dasum(n, x, 1);
 }
 
+template <typename Dtype>
+Dtype caffe_cpu_asum(const int n, const Dtype* x) {
+#ifdef _OPENMP
+  if (n >= kParallelReduceThreshold) {
+    Dtype sum = 0;
+    #pragma omp parallel reduction(+:sum)
+    {
+      const int chunk = (n + omp_get_num_threads() - 1) /
+          omp_get_num_threads();
+      const int begin = omp_get_thread_num() * chunk;
+      const int len = std::min(chunk, n - begin);
+      if (len > 0) {
+        sum = caffe_asum_blas(len, x + begin);
+      }
+    }
+    return sum;
+  }
+#endif
+  return caffe_asum_blas(n, x);
+}
+
+template
+float caffe_cpu_asum<float>(const int n, const float* x);
+
+template
+double caffe_cpu_asum<double>(const int n, const double* x);
+
+template <>
+float caffe_cpu_strided_asum<float>(const int n, const float* x,
+    const int incx) {
+  return cblas_sasum(n, x, incx);
+}
+
+template <>
+double caffe_cpu_strided_asum<double>(const int n, const double* x,
+    const int incx) {
+  return cblas_dasum(n, x, incx);
+}
+
+template <>
+float caffe_cpu_strided_amax<float>(const int n, const float* x,
+    const int incx) {
+  if (n <= 0) { return 0; }
+  return std::fabs(x[cblas_isamax(n, x, incx) * incx]);
+}
+
+template <>
+double caffe_cpu_strided_amax<double>(const int n, const double* x,
+    const int incx) {
+  if (n <= 0) { return 0; }
+  return std::fabs(x[cblas_idamax(n, x, incx) * incx]);
+}
+
+// Branch-free single-precision exp, after Cephes: split x into an
+// integer power of two and a residual in [-ln2/2, ln2/2], evaluate a
+// degree-5 polynomial for the residual, and assemble the power of two
+// directly in the IEEE exponent bits. Inputs are clamped to where the
+// result is a finite normal, so the tails saturate instead of
+// overflowing. Relative error is within 1e-7 across the clamp range.
+inline float caffe_fast_expf(float x) {
+  x = std::min(88.3762626647949f, std::max(-87.3365478515625f, x));
+  // Round x / ln(2) to the nearest integer n; the cast truncates, so
+  // shift by 0.5 first and correct the negative half-open interval.
+  const float fx = x * 1.44269504088896341f + 0.5f;
+  const int n = static_cast<int>(fx) - (fx < 0.f);
+  // Subtract n * ln(2) in two pieces so the residual keeps full
+  // precision despite the cancellation.
+  float r = x - n * 0.693359375f;
+  r -= n * -2.12194440e-4f;
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * r * r + r + 1.f;
+  union { int i; float f; } pow2n;
+  pow2n.i = (n + 127) << 23;
+  return p * pow2n.f;
+}
+
+// The matching single-precision log, also after Cephes: pull the
+// exponent out of the IEEE representation, reduce the mantissa to
+// [sqrt(1/2), sqrt(2)), and evaluate a degree-9 polynomial there.
+// Valid for x > 0; error is within about 1e-7 of |log(x)| (absolute
+// near 1, where log crosses zero).
+inline float caffe_fast_logf(float x) {
+  union { float f; int i; } v;
+  v.f = x;
+  int e = ((v.i >> 23) & 255) - 126;
+  v.i = (v.i & 0x007fffff) | (126 << 23);
+  float m = v.f;
+  if (m < 0.707106781186547524f) {
+    m += m;
+    --e;
+  }
+  m -= 1.f;
+  float p = 7.0376836292e-2f;
+  p = p * m + -1.1514610310e-1f;
+  p = p * m + 1.1676998740e-1f;
+  p = p * m + -1.2420140846e-1f;
+  p = p * m + 1.4249322787e-1f;
+  p = p * m + -1.6668057665e-1f;
+  p = p * m + 2.0000714765e-1f;
+  p = p * m + -2.4999993993e-1f;
+  p = p * m + 3.3333331174e-1f;
+  p = p * m * m * m;
+  // Add e * ln(2) in the same two pieces as the exp reduction.
+  float result = e * -2.12194440e-4f + p;
+  result -= 0.5f * m * m;
+  result += m;
+  result += e * 0.693359375f;
+  return result;
+}
+
+template <typename Dtype>
+void caffe_cpu_fast_tanh(const int n, const Dtype* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    // tanh(x) = (1 - e) / (1 + e) with e = exp(-2x); the exp clamp
+    // saturates the tails to +/-1 within float precision.
+    const float e = caffe_fast_expf(-2.f * static_cast<float>(x[i]));
+    y[i] = (1.f - e) / (1.f + e);
+  }
+}
+
+template
+void caffe_cpu_fast_tanh<float>(const int n, const float* x, float* y);
+template
+void caffe_cpu_fast_tanh<double>(const int n, const double* x, double* y);
+
+template <typename Dtype>
+void caffe_cpu_fast_sigmoid(const int n, const Dtype* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = 1.f / (1.f + caffe_fast_expf(-static_cast<float>(x[i])));
+  }
+}
+
+template
+void caffe_cpu_fast_sigmoid<float>(const int n, const float* x, float* y);
+template
+void caffe_cpu_fast_sigmoid<double>(const int n, const double* x, double* y);
+
+template <typename Dtype>
+void caffe_cpu_fast_bnll(const int n, const Dtype* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    // log(1 + exp(x)) = max(x, 0) + log(1 + exp(-|x|)), which never
+    // overflows the exp and feeds the log an argument in (1, 2].
+    const float xf = static_cast<float>(x[i]);
+    const float e = caffe_fast_expf(-std::fabs(xf));
+    y[i] = (xf > 0.f ? xf : 0.f) + caffe_fast_logf(1.f + e);
+  }
+}
+
+template
+void caffe_cpu_fast_bnll<float>(const int n, const float* x, float* y);
+template
+void caffe_cpu_fast_bnll<double>(const int n, const double* x, double* y);
+
 INSTANTIATE_CAFFE_CPU_UNARY_FUNC(sign);
 INSTANTIATE_CAFFE_CPU_UNARY_FUNC(sgnbit);
 
@@ -387,4 +928,116 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    Dtype value = x[i] * scale;
+    value = std::min(value, Dtype(127));
+    value = std::max(value, Dtype(-127));
+    y[i] = static_cast<int8_t>(value < 0 ? value - Dtype(0.5)
+                                         : value + Dtype(0.5));
+  }
+}
+
+template
+void caffe_cpu_quantize<float>(const int n, const float* x, const float scale,
+    int8_t* y);
+template
+void caffe_cpu_quantize<double>(const int n, const double* x,
+    const double scale, int8_t* y);
+
+template <typename Dtype>
+void caffe_cpu_dequantize(const int n, const int32_t* x, const Dtype scale,
+    Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = x[i] * scale;
+  }
+}
+
+template
+void caffe_cpu_dequantize<float>(const int n, const int32_t* x,
+    const float scale, float* y);
+template
+void caffe_cpu_dequantize<double>(const int n, const int32_t* x,
+    const double scale, double* y);
+
+void caffe_cpu_igemm(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int32_t* C) {
+  if (TransB == CblasNoTrans) {
+    // Accumulate rank-1 updates row by row; the inner loop over n is
+    // contiguous in both B and C, so the compiler can vectorize it.
+    for (int m = 0; m < M; ++m) {
+      int32_t* C_row = C + m * N;
+      caffe_memset(N * sizeof(int32_t), 0, C_row);
+      for (int k = 0; k < K; ++k) {
+        const int32_t a = A[m * K + k];
+        const int8_t* B_row = B + k * N;
+        for (int n = 0; n < N; ++n) {
+          C_row[n] += a * B_row[n];
+        }
+      }
+    }
+  } else {
+    // B is N x K, so each output is a contiguous dot product.
+    for (int m = 0; m < M; ++m) {
+      const int8_t* A_row = A + m * K;
+      for (int n = 0; n < N; ++n) {
+        const int8_t* B_row = B + n * K;
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) {
+          sum += static_cast<int32_t>(A_row[k]) * B_row[k];
+        }
+        C[m * N + n] = sum;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_gemv_int8(const int M, const int K, const int8_t* A,
+    const Dtype* scale, const Dtype* x, Dtype* y) {
+  for (int m = 0; m < M; ++m) {
+    const int8_t* A_row = A + m * K;
+    Dtype sum = 0;
+    for (int k = 0; k < K; ++k) {
+      sum += A_row[k] * x[k];
+    }
+    y[m] = scale[m] * sum;
+  }
+}
+
+template
+void caffe_cpu_gemv_int8<float>(const int M, const int K, const int8_t* A,
+    const float* scale, const float* x, float* y);
+template
+void caffe_cpu_gemv_int8<double>(const int M, const int K, const int8_t* A,
+    const double* scale, const double* x, double* y);
+
+template <typename Dtype>
+void caffe_cpu_csrmm(const int M, const int N, const int K, const Dtype* A,
+    const Dtype* B_val, const int* B_col, const int* B_ptr, Dtype* C) {
+  for (int m = 0; m < M; ++m) {
+    const Dtype* A_row = A + m * K;
+    Dtype* C_row = C + m * N;
+    for (int n = 0; n < N; ++n) {
+      // Gather-style dot product over the nonzeros of row n of B.
+      Dtype sum = 0;
+      for (int i = B_ptr[n]; i < B_ptr[n + 1]; ++i) {
+        sum += B_val[i] * A_row[B_col[i]];
+      }
+      C_row[n] = sum;
+    }
+  }
+}
+
+template
+void caffe_cpu_csrmm<float>(const int M, const int N, const int K,
+    const float* A, const float* B_val, const int* B_col, const int* B_ptr,
+    float* C);
+template
+void caffe_cpu_csrmm<double>(const int M, const int N, const int K,
+    const double* A, const double* B_val, const int* B_col, const int* B_ptr,
+    double* C);
+
 }  // namespace caffe
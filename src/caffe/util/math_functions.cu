@@ -44,6 +44,66 @@ void caffe_gpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       N, M, K, &alpha, B, ldb, A, lda, &beta, C, N));
 }
 
+template <>
+void caffe_gpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int lda, const float* B,
+    const int ldb, const float beta, float* C, const int ldc) {
+  // Note that cublas follows fortran order; the row-major leading
+  // dimensions carry over unchanged to the transposed problem.
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasSgemm(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, A, lda, &beta, C, ldc));
+}
+
+template <>
+void caffe_gpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int lda, const double* B,
+    const int ldb, const double beta, double* C, const int ldc) {
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasDgemm(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, A, lda, &beta, C, ldc));
+}
+
+template <>
+void caffe_gpu_gemm_batched<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float** A, const float** B, const float beta,
+    float** C, const int batch_size) {
+  // Note that cublas follows fortran order.
+  int lda = (TransA == CblasNoTrans) ? K : M;
+  int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasSgemmBatched(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, A, lda, &beta, C, N, batch_size));
+}
+
+template <>
+void caffe_gpu_gemm_batched<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double** A, const double** B, const double beta,
+    double** C, const int batch_size) {
+  // Note that cublas follows fortran order.
+  int lda = (TransA == CblasNoTrans) ? K : M;
+  int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasDgemmBatched(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, A, lda, &beta, C, N, batch_size));
+}
+
 template <>
 void caffe_gpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -128,6 +188,44 @@ void caffe_gpu_asum<double>(const int n, const double* x, double* y) {
   CUBLAS_CHECK(cublasDasum(Caffe::cublas_handle(), n, x, 1, y));
 }
 
+template <>
+void caffe_gpu_strided_asum<float>(const int n, const float* x,
+    const int incx, float* y) {
+  CUBLAS_CHECK(cublasSasum(Caffe::cublas_handle(), n, x, incx, y));
+}
+
+template <>
+void caffe_gpu_strided_asum<double>(const int n, const double* x,
+    const int incx, double* y) {
+  CUBLAS_CHECK(cublasDasum(Caffe::cublas_handle(), n, x, incx, y));
+}
+
+template <>
+void caffe_gpu_strided_amax<float>(const int n, const float* x,
+    const int incx, float* y) {
+  if (n <= 0) { *y = 0; return; }
+  int index;  // 1-based, per the BLAS convention.
+  CUBLAS_CHECK(cublasIsamax(Caffe::cublas_handle(), n, x, incx, &index));
+  float value;
+  CUDA_CHECK(cudaMemcpy(&value,
+      x + static_cast<size_t>(index - 1) * incx, sizeof(float),
+      cudaMemcpyDeviceToHost));
+  *y = std::fabs(value);
+}
+
+template <>
+void caffe_gpu_strided_amax<double>(const int n, const double* x,
+    const int incx, double* y) {
+  if (n <= 0) { *y = 0; return; }
+  int index;  // 1-based, per the BLAS convention.
+  CUBLAS_CHECK(cublasIdamax(Caffe::cublas_handle(), n, x, incx, &index));
+  double value;
+  CUDA_CHECK(cudaMemcpy(&value,
+      x + static_cast<size_t>(index - 1) * incx, sizeof(double),
+      cudaMemcpyDeviceToHost));
+  *y = std::fabs(value);
+}
+
 template <>
 void caffe_gpu_scale<float>(const int n, const float alpha, const float *x,
                             float* y) {
@@ -155,8 +253,9 @@ void caffe_gpu_set(const int N, const Dtype alpha, Dtype* Y) {
     CUDA_CHECK(cudaMemset(Y, 0, sizeof(Dtype) * N));  // NOLINT(caffe/alt_fn)
     return;
   }
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(set_kernel<Dtype>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  set_kernel<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  set_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
       N, alpha, Y);
 }
 
@@ -173,15 +272,19 @@ __global__ void add_scalar_kernel(const int n, const Dtype alpha, Dtype* y) {
 
 template <>
 void caffe_gpu_add_scalar(const int N, const float alpha, float* Y) {
+  const CaffeLaunchConfig cfg =
+      CaffeGetLaunchConfig(add_scalar_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_scalar_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  add_scalar_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, alpha, Y);
 }
 
 template <>
 void caffe_gpu_add_scalar(const int N, const double alpha, double* Y) {
+  const CaffeLaunchConfig cfg =
+      CaffeGetLaunchConfig(add_scalar_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_scalar_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  add_scalar_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, alpha, Y);
 }
 
@@ -196,16 +299,18 @@ __global__ void add_kernel(const int n, const Dtype* a,
 template <>
 void caffe_gpu_add<float>(const int N, const float* a, const float* b,
     float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(add_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  add_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
 template <>
 void caffe_gpu_add<double>(const int N, const double* a, const double* b,
     double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(add_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  add_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
@@ -220,16 +325,18 @@ __global__ void sub_kernel(const int n, const Dtype* a,
 template <>
 void caffe_gpu_sub<float>(const int N, const float* a, const float* b,
     float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(sub_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  sub_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  sub_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
 template <>
 void caffe_gpu_sub<double>(const int N, const double* a, const double* b,
     double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(sub_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  sub_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  sub_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
@@ -244,19 +351,102 @@ __global__ void mul_kernel(const int n, const Dtype* a,
 template <>
 void caffe_gpu_mul<float>(const int N, const float* a,
     const float* b, float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(mul_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  mul_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  mul_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
 template <>
 void caffe_gpu_mul<double>(const int N, const double* a,
     const double* b, double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(mul_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  mul_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  mul_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
+// The n-ary kernels fold up to this many inputs into one launch; longer
+// input lists accumulate chunk by chunk. The pointers (and coefficients)
+// ride along in a by-value argument struct, so no device-side array is
+// needed.
+const int kNaryChunk = 8;
+
+template <typename Dtype>
+struct NaryArgs {
+  const Dtype* x[kNaryChunk];
+  Dtype coeff[kNaryChunk];
+};
+
+template <typename Dtype>
+__global__ void sum_n_kernel(const int n, const int k,
+    const NaryArgs<Dtype> args, const bool accumulate, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    Dtype sum = accumulate ? y[index] : Dtype(0);
+    for (int j = 0; j < k; ++j) {
+      sum += args.coeff[j] * args.x[j][index];
+    }
+    y[index] = sum;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_sum(const int N, const int num_inputs,
+    const Dtype* const* inputs, const Dtype* coeffs, Dtype* y) {
+  CHECK_GE(num_inputs, 1);
+  for (int start = 0; start < num_inputs; start += kNaryChunk) {
+    const int k = min(num_inputs - start, kNaryChunk);
+    NaryArgs<Dtype> args;
+    for (int j = 0; j < k; ++j) {
+      args.x[j] = inputs[start + j];
+      args.coeff[j] = coeffs ? coeffs[start + j] : Dtype(1);
+    }
+    const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(sum_n_kernel<Dtype>, N);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    sum_n_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
+        N, k, args, start > 0, y);
+  }
+}
+
+template void caffe_gpu_sum<float>(const int N, const int num_inputs,
+    const float* const* inputs, const float* coeffs, float* y);
+template void caffe_gpu_sum<double>(const int N, const int num_inputs,
+    const double* const* inputs, const double* coeffs, double* y);
+
+template <typename Dtype>
+__global__ void prod_n_kernel(const int n, const int k,
+    const NaryArgs<Dtype> args, const bool accumulate, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    Dtype prod = accumulate ? y[index] : Dtype(1);
+    for (int j = 0; j < k; ++j) {
+      prod *= args.x[j][index];
+    }
+    y[index] = prod;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_prod(const int N, const int num_inputs,
+    const Dtype* const* inputs, Dtype* y) {
+  CHECK_GE(num_inputs, 1);
+  for (int start = 0; start < num_inputs; start += kNaryChunk) {
+    const int k = min(num_inputs - start, kNaryChunk);
+    NaryArgs<Dtype> args;
+    for (int j = 0; j < k; ++j) {
+      args.x[j] = inputs[start + j];
+    }
+    const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(prod_n_kernel<Dtype>, N);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    prod_n_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
+        N, k, args, start > 0, y);
+  }
+}
+
+template void caffe_gpu_prod<float>(const int N, const int num_inputs,
+    const float* const* inputs, float* y);
+template void caffe_gpu_prod<double>(const int N, const int num_inputs,
+    const double* const* inputs, double* y);
+
 template <typename Dtype>
 __global__ void div_kernel(const int n, const Dtype* a,
     const Dtype* b, Dtype* y) {
@@ -268,16 +458,18 @@ __global__ void div_kernel(const int n, const Dtype* a,
 template <>
 void caffe_gpu_div<float>(const int N, const float* a,
     const float* b, float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(div_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  div_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  div_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
 template <>
 void caffe_gpu_div<double>(const int N, const double* a,
     const double* b, double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(div_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  div_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  div_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, b, y);
 }
 
@@ -290,15 +482,17 @@ __global__ void abs_kernel(const int n, const Dtype* a, Dtype* y) {
 
 template <>
 void caffe_gpu_abs<float>(const int N, const float* a, float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(abs_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  abs_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  abs_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, y);
 }
 
 template <>
 void caffe_gpu_abs<double>(const int N, const double* a, double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(abs_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  abs_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  abs_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, y);
 }
 
@@ -314,19 +508,44 @@ __global__ void powx_kernel(const int n, const Dtype* a,
 template <>
 void caffe_gpu_powx<float>(const int N, const float* a,
     const float alpha, float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(powx_kernel<float>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  powx_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  powx_kernel<float><<<cfg.blocks, cfg.threads>>>(
       N, a, alpha, y);
 }
 
 template <>
 void caffe_gpu_powx<double>(const int N, const double* a,
     const double alpha, double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(powx_kernel<double>, N);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  powx_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+  powx_kernel<double><<<cfg.blocks, cfg.threads>>>(
       N, a, alpha, y);
 }
 
+template <typename Dtype>
+__global__ void sqrt_kernel(const int n, const Dtype* a, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    y[index] = sqrt(a[index]);
+  }
+}
+
+template <>
+void caffe_gpu_sqrt<float>(const int N, const float* a, float* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(sqrt_kernel<float>, N);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  sqrt_kernel<float><<<cfg.blocks, cfg.threads>>>(
+      N, a, y);
+}
+
+template <>
+void caffe_gpu_sqrt<double>(const int N, const double* a, double* y) {
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(sqrt_kernel<double>, N);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  sqrt_kernel<double><<<cfg.blocks, cfg.threads>>>(
+      N, a, y);
+}
+
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sign, y[index] = (Dtype(0) < x[index])
                                       - (x[index] < Dtype(0)));
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sgnbit, y[index] = signbit(x[index]));
@@ -354,8 +573,9 @@ uint32_t caffe_gpu_hamming_distance<float>(const int n, const float* x,
   // TestHammingDistanceGPU in test_math_functions.cpp).
   NOT_IMPLEMENTED;
   thrust::device_vector<uint8_t> popcounts(n);
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(popc_kernel, n);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  popc_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+  popc_kernel<<<cfg.blocks, cfg.threads>>>(
       n, x, y, thrust::raw_pointer_cast(popcounts.data()));
   return thrust::reduce(popcounts.begin(), popcounts.end(),
                         (uint32_t) 0, thrust::plus<uint32_t>());
@@ -368,14 +588,57 @@ uint32_t caffe_gpu_hamming_distance<double>(const int n, const double* x,
   // TestHammingDistanceGPU in test_math_functions.cpp).
   NOT_IMPLEMENTED;
   thrust::device_vector<uint8_t> popcounts(n);
+  const CaffeLaunchConfig cfg = CaffeGetLaunchConfig(popcll_kernel, n);
   // NOLINT_NEXT_LINE(whitespace/operators)
-  popcll_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+  popcll_kernel<<<cfg.blocks, cfg.threads>>>(
       n, x, y, thrust::raw_pointer_cast(popcounts.data()));
   return thrust::reduce(popcounts.begin(), popcounts.end(),
                         /* NOLINT_NEXT_LINE(build/include_what_you_use) */
                         (uint32_t) 0, thrust::plus<uint32_t>());
 }
 
+__device__ inline int hamming_popc(const float a, const float b) {
+  return __popc(static_cast<uint32_t>(a) ^ static_cast<uint32_t>(b));
+}
+
+__device__ inline int hamming_popc(const double a, const double b) {
+  return __popcll(static_cast<uint64_t>(a) ^ static_cast<uint64_t>(b));
+}
+
+template <typename Dtype>
+__global__ void hamming_distance_matrix_kernel(const int total, const int m,
+    const int dim, const Dtype* x, const Dtype* y, int* out) {
+  CUDA_KERNEL_LOOP(index, total) {
+    const Dtype* a = x + (index / m) * dim;
+    const Dtype* b = y + (index % m) * dim;
+    int dist = 0;
+    for (int d = 0; d < dim; ++d) {
+      dist += hamming_popc(a[d], b[d]);
+    }
+    out[index] = dist;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_hamming_distance_matrix(const int n, const int m,
+    const int dim, const Dtype* x, const Dtype* y, int* out) {
+  const int total = n * m;
+  const CaffeLaunchConfig cfg =
+      CaffeGetLaunchConfig(hamming_distance_matrix_kernel<Dtype>, total);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  hamming_distance_matrix_kernel<Dtype><<<cfg.blocks, cfg.threads>>>(
+      total, m, dim, x, y, out);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template
+void caffe_gpu_hamming_distance_matrix<float>(const int n, const int m,
+    const int dim, const float* x, const float* y, int* out);
+
+template
+void caffe_gpu_hamming_distance_matrix<double>(const int n, const int m,
+    const int dim, const double* x, const double* y, int* out);
+
 void caffe_gpu_rng_uniform(const int n, unsigned int* r) {
   CURAND_CHECK(curandGenerate(Caffe::curand_generator(), r, n));
 }
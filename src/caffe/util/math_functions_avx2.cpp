@@ -0,0 +1,235 @@
+// AVX2/FMA variants of the hand-written CPU kernels. This file is the
+// only one compiled with -mavx2 -mfma regardless of the baseline
+// architecture flags (see the Makefile), so nothing outside it may call
+// these functions without checking CaffeCpuHasAVX2() first.
+
+#ifdef CAFFE_X86_DISPATCH
+
+#include <float.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "caffe/util/cpu_dispatch.hpp"
+
+namespace caffe {
+
+// 8-lane float exp/log in the Cephes/SVML style, so builds without MKL
+// keep up on the transcendental-heavy layers (softmax, sigmoid, power).
+// exp reduces x = k*ln(2) + r with a split ln(2) and evaluates a
+// degree-6 polynomial for e^r; log splits its argument into exponent
+// and mantissa and evaluates the Cephes series for log(1+m). Both stay
+// within a couple of ulps of libm; log returns NaN for non-positive
+// input (callers clamp first).
+static inline __m256 caffe_mm256_exp_ps(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647950f));
+  x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                              _mm256_set1_ps(0.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, one));
+  const __m256i k = _mm256_add_epi32(_mm256_cvttps_epi32(fx),
+                                     _mm256_set1_epi32(127));
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(k, 23)));
+}
+
+static inline __m256 caffe_mm256_log_ps(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 invalid_mask =
+      _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OS);
+  // Flush denormals to the smallest normal so the exponent extraction
+  // below is valid.
+  x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+  __m256i emm0 = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+  emm0 = _mm256_sub_epi32(emm0, _mm256_set1_epi32(127));
+  __m256 e = _mm256_add_ps(_mm256_cvtepi32_ps(emm0), one);
+  x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff)));
+  x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+  // Keep the mantissa in [sqrt(1/2), sqrt(2)) so the series converges.
+  const __m256 mask =
+      _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OS);
+  const __m256 tmp = _mm256_and_ps(x, mask);
+  x = _mm256_sub_ps(x, one);
+  e = _mm256_sub_ps(e, _mm256_and_ps(one, mask));
+  x = _mm256_add_ps(x, tmp);
+  __m256 y = _mm256_set1_ps(7.0376836292e-2f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.1514610310e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.1676998740e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.2420140846e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.4249322787e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.6668057665e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(2.0000714765e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-2.4999993993e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(3.3333331174e-1f));
+  const __m256 z = _mm256_mul_ps(x, x);
+  y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+  y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+  y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+  x = _mm256_add_ps(x, y);
+  x = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), x);
+  return _mm256_or_ps(x, invalid_mask);
+}
+
+void caffe_avx2_exp_ps(const int n, const float* a, float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, caffe_mm256_exp_ps(_mm256_loadu_ps(a + i)));
+  }
+  for (; i < n; ++i) { y[i] = exp(a[i]); }
+}
+
+void caffe_avx2_ln_ps(const int n, const float* a, float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, caffe_mm256_log_ps(_mm256_loadu_ps(a + i)));
+  }
+  for (; i < n; ++i) { y[i] = log(a[i]); }
+}
+
+void caffe_avx2_powx_ps(const int n, const float* a, const float b,
+    float* y) {
+  const __m256 vb = _mm256_set1_ps(b);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 va = _mm256_loadu_ps(a + i);
+    // a^b = exp(b * log(a)) only holds for positive bases; a block with
+    // a zero or negative lane takes the scalar path.
+    if (_mm256_movemask_ps(
+            _mm256_cmp_ps(va, _mm256_setzero_ps(), _CMP_GT_OS)) != 0xff) {
+      for (int j = 0; j < 8; ++j) { y[i + j] = pow(a[i + j], b); }
+      continue;
+    }
+    _mm256_storeu_ps(y + i,
+        caffe_mm256_exp_ps(_mm256_mul_ps(vb, caffe_mm256_log_ps(va))));
+  }
+  for (; i < n; ++i) { y[i] = pow(a[i], b); }
+}
+
+// Hand-tiled small-matrix float GEMM: eight columns of C accumulate in
+// a ymm register while a column strip of B streams once per k. When
+// beta == 0, C is never read, matching BLAS semantics.
+void caffe_avx2_small_gemm_nn(const int M, const int N, const int K,
+    const float alpha, const float* A, const float* B, const float beta,
+    float* C) {
+  for (int i = 0; i < M; ++i) {
+    const float* a = A + i * K;
+    float* c = C + i * N;
+    int j = 0;
+    for (; j + 8 <= N; j += 8) {
+      __m256 acc = _mm256_setzero_ps();
+      for (int k = 0; k < K; ++k) {
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(a[k]),
+                              _mm256_loadu_ps(B + k * N + j), acc);
+      }
+      acc = _mm256_mul_ps(acc, _mm256_set1_ps(alpha));
+      if (beta != 0) {
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(beta),
+                              _mm256_loadu_ps(c + j), acc);
+      }
+      _mm256_storeu_ps(c + j, acc);
+    }
+    for (; j < N; ++j) {
+      float sum = 0;
+      for (int k = 0; k < K; ++k) {
+        sum += a[k] * B[k * N + j];
+      }
+      c[j] = (beta == 0) ? alpha * sum : alpha * sum + beta * c[j];
+    }
+  }
+}
+
+void caffe_avx2_softmax_ps(const int n, const float* x, float* y) {
+  // Online max/sum sweep: each lane keeps a running max and a running
+  // exp-sum relative to it; when a lane's max rises, its sum is rescaled
+  // by exp(old - new). Max, exp and sum thus come out of a single read
+  // of x, and the only other sweep is the exp-and-scale store below.
+  int i = 0;
+  __m256 vmax = _mm256_set1_ps(-FLT_MAX);
+  __m256 vsum = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vx = _mm256_loadu_ps(x + i);
+    const __m256 vnew = _mm256_max_ps(vmax, vx);
+    vsum = _mm256_fmadd_ps(
+        vsum, caffe_mm256_exp_ps(_mm256_sub_ps(vmax, vnew)),
+        caffe_mm256_exp_ps(_mm256_sub_ps(vx, vnew)));
+    vmax = vnew;
+  }
+  const int vec_end = i;
+  // Combine the lanes and the scalar tail. Untouched lanes hold a max
+  // of -FLT_MAX, so their rescale factor underflows to zero.
+  float lane_max[8], lane_sum[8];
+  _mm256_storeu_ps(lane_max, vmax);
+  _mm256_storeu_ps(lane_sum, vsum);
+  float max = -FLT_MAX;
+  for (int j = 0; j < 8; ++j) {
+    max = lane_max[j] > max ? lane_max[j] : max;
+  }
+  for (i = vec_end; i < n; ++i) {
+    max = x[i] > max ? x[i] : max;
+  }
+  float sum = 0;
+  for (int j = 0; j < 8; ++j) {
+    sum += lane_sum[j] * expf(lane_max[j] - max);
+  }
+  for (i = vec_end; i < n; ++i) {
+    sum += expf(x[i] - max);
+  }
+  // Second sweep: y = exp(x - max) / sum.
+  const __m256 vm = _mm256_set1_ps(max);
+  const __m256 vscale = _mm256_set1_ps(1.0f / sum);
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(
+        caffe_mm256_exp_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), vm)),
+        vscale));
+  }
+  for (; i < n; ++i) {
+    y[i] = expf(x[i] - max) / sum;
+  }
+}
+
+// Byte-wise popcount via two 4-bit table lookups; AVX2 has no vector
+// popcount instruction.
+static inline __m256i caffe_mm256_popcnt_epi8(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_and_si256(v, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                         _mm256_shuffle_epi8(lut, hi));
+}
+
+int caffe_avx2_hamming_popcnt(const int n, const uint64_t* a,
+    const uint64_t* b) {
+  int dist = 0;
+  int i = 0;
+  __m256i acc = _mm256_setzero_si256();
+  for (; i + 4 <= n; i += 4) {
+    const __m256i v = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+    acc = _mm256_add_epi64(acc,
+        _mm256_sad_epu8(caffe_mm256_popcnt_epi8(v), _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  dist += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < n; ++i) {
+    dist += __builtin_popcountll(a[i] ^ b[i]);
+  }
+  return dist;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_X86_DISPATCH
@@ -0,0 +1,143 @@
+#include <boost/thread.hpp>
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/memory_pool.hpp"
+
+namespace caffe {
+
+shared_ptr<MemoryPool> MemoryPool::singleton_;
+
+class MemoryPool::sync {
+ public:
+  boost::mutex mutex_;
+};
+
+MemoryPool::MemoryPool() : sync_(new sync()) {}
+
+MemoryPool& MemoryPool::Get() {
+  if (!singleton_.get()) {
+    singleton_.reset(new MemoryPool());
+  }
+  return *singleton_;
+}
+
+size_t MemoryPool::BucketSize(size_t size) {
+  // Round up to the next power of two so that slightly-grown reshapes
+  // (e.g. variable batch sizes) reuse the same bucket.
+  size_t bucket = 1;
+  while (bucket < size) {
+    bucket <<= 1;
+  }
+  return bucket;
+}
+
+void* MemoryPool::MallocHost(size_t size) {
+  const size_t bucket = BucketSize(size);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  vector<void*>& free_list = host_.free_blocks[bucket];
+  void* ptr;
+  if (!free_list.empty()) {
+    ptr = free_list.back();
+    free_list.pop_back();
+    host_.cached_bytes -= bucket;
+  } else {
+    CaffeMallocHost(&ptr, bucket);
+  }
+  host_.in_use[ptr] = bucket;
+  host_.outstanding_bytes += bucket;
+  return ptr;
+}
+
+void MemoryPool::FreeHost(void* ptr) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  map<void*, size_t>::iterator it = host_.in_use.find(ptr);
+  CHECK(it != host_.in_use.end()) << "FreeHost of pointer not from the pool";
+  const size_t bucket = it->second;
+  host_.in_use.erase(it);
+  host_.outstanding_bytes -= bucket;
+  host_.free_blocks[bucket].push_back(ptr);
+  host_.cached_bytes += bucket;
+}
+
+#ifndef CPU_ONLY
+void* MemoryPool::MallocDevice(size_t size) {
+  const size_t bucket = BucketSize(size);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  vector<void*>& free_list = device_.free_blocks[bucket];
+  void* ptr;
+  if (!free_list.empty()) {
+    ptr = free_list.back();
+    free_list.pop_back();
+    device_.cached_bytes -= bucket;
+  } else {
+    CUDA_CHECK(cudaMalloc(&ptr, bucket));
+  }
+  device_.in_use[ptr] = bucket;
+  device_.outstanding_bytes += bucket;
+  return ptr;
+}
+
+void MemoryPool::FreeDevice(void* ptr) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  map<void*, size_t>::iterator it = device_.in_use.find(ptr);
+  CHECK(it != device_.in_use.end())
+      << "FreeDevice of pointer not from the pool";
+  const size_t bucket = it->second;
+  device_.in_use.erase(it);
+  device_.outstanding_bytes -= bucket;
+  device_.free_blocks[bucket].push_back(ptr);
+  device_.cached_bytes += bucket;
+}
+#endif  // CPU_ONLY
+
+void MemoryPool::Clear() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  for (map<size_t, vector<void*> >::iterator it = host_.free_blocks.begin();
+       it != host_.free_blocks.end(); ++it) {
+    for (int i = 0; i < it->second.size(); ++i) {
+      CaffeFreeHost(it->second[i]);
+    }
+  }
+  host_.free_blocks.clear();
+  host_.cached_bytes = 0;
+#ifndef CPU_ONLY
+  for (map<size_t, vector<void*> >::iterator it = device_.free_blocks.begin();
+       it != device_.free_blocks.end(); ++it) {
+    for (int i = 0; i < it->second.size(); ++i) {
+      CUDA_CHECK(cudaFree(it->second[i]));
+    }
+  }
+  device_.free_blocks.clear();
+  device_.cached_bytes = 0;
+#endif  // CPU_ONLY
+}
+
+void MemoryPool::DumpStats() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  size_t host_cached_blocks = 0;
+  for (map<size_t, vector<void*> >::const_iterator it =
+       host_.free_blocks.begin(); it != host_.free_blocks.end(); ++it) {
+    host_cached_blocks += it->second.size();
+  }
+  LOG(INFO) << "MemoryPool host: " << host_.in_use.size() << " blocks / "
+      << host_.outstanding_bytes << " bytes outstanding, "
+      << host_cached_blocks << " blocks / " << host_.cached_bytes
+      << " bytes cached";
+#ifndef CPU_ONLY
+  size_t device_cached_blocks = 0;
+  for (map<size_t, vector<void*> >::const_iterator it =
+       device_.free_blocks.begin(); it != device_.free_blocks.end(); ++it) {
+    device_cached_blocks += it->second.size();
+  }
+  LOG(INFO) << "MemoryPool device: " << device_.in_use.size() << " blocks / "
+      << device_.outstanding_bytes << " bytes outstanding, "
+      << device_cached_blocks << " blocks / " << device_.cached_bytes
+      << " bytes cached";
+#endif  // CPU_ONLY
+}
+
+}  // namespace caffe
@@ -0,0 +1,243 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/mmap_model.hpp"
+
+namespace caffe {
+
+static size_t AlignUp(const size_t offset) {
+  return (offset + kMMapModelAlignment - 1)
+      / kMMapModelAlignment * kMMapModelAlignment;
+}
+
+void WriteNetParamsToMMapFile(const NetParameter& net_param,
+    const string& filename) {
+  // The index is the source NetParameter with every blob's data dropped;
+  // shapes stay so the loader can validate against the target net. Payload
+  // offsets are implied by the layout, so no offset table is needed.
+  NetParameter index(net_param);
+  for (int i = 0; i < index.layers_size(); ++i) {
+    for (int j = 0; j < index.mutable_layers(i)->blobs_size(); ++j) {
+      index.mutable_layers(i)->mutable_blobs(j)->clear_data();
+      index.mutable_layers(i)->mutable_blobs(j)->clear_diff();
+    }
+  }
+  string index_bytes;
+  CHECK(index.SerializeToString(&index_bytes));
+
+  MMapModelHeader header;
+  header.magic = kMMapModelMagic;
+  header.element_size = sizeof(float);
+  header.index_size = index_bytes.size();
+
+  FILE* file = fopen(filename.c_str(), "wb");
+  CHECK(file) << "Failed to open " << filename << " for writing";
+  CHECK_EQ(fwrite(&header, sizeof(header), 1, file), 1);
+  CHECK_EQ(fwrite(index_bytes.data(), 1, index_bytes.size(), file),
+      index_bytes.size());
+  size_t offset = sizeof(header) + index_bytes.size();
+  const string zeros(kMMapModelAlignment, '\0');
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    for (int j = 0; j < net_param.layers(i).blobs_size(); ++j) {
+      const BlobProto& blob = net_param.layers(i).blobs(j);
+      const int count =
+          blob.num() * blob.channels() * blob.height() * blob.width();
+      CHECK_EQ(blob.data_size(), count)
+          << "Blob " << j << " of layer " << net_param.layers(i).name()
+          << " has a payload inconsistent with its shape";
+      const size_t padding = AlignUp(offset) - offset;
+      CHECK_EQ(fwrite(zeros.data(), 1, padding, file), padding);
+      offset += padding;
+      for (int k = 0; k < blob.data_size(); ++k) {
+        const float value = blob.data(k);
+        CHECK_EQ(fwrite(&value, sizeof(value), 1, file), 1);
+      }
+      offset += blob.data_size() * sizeof(float);
+    }
+  }
+  CHECK_EQ(fclose(file), 0);
+}
+
+template <typename Dtype>
+MMapModel<Dtype>::MMapModel(const string& filename)
+    : mapping_(NULL), mapping_size_(0) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0);
+  mapping_size_ = file_stat.st_size;
+  CHECK_GE(mapping_size_, sizeof(MMapModelHeader))
+      << filename << " is not a mmap model file";
+  // Copy-on-write: untouched payload pages are shared between every
+  // process mapping this file, while a stray write faults in a private
+  // copy instead of corrupting the model on disk.
+  mapping_ = mmap(NULL, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+      fd, 0);
+  CHECK_NE(mapping_, MAP_FAILED) << "Failed to map " << filename;
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+
+  const MMapModelHeader* header =
+      static_cast<const MMapModelHeader*>(mapping_);
+  CHECK_EQ(header->magic, kMMapModelMagic)
+      << filename << " is not a mmap model file";
+  CHECK_EQ(header->element_size, sizeof(Dtype))
+      << filename << " stores " << header->element_size
+      << "-byte elements, but this net uses " << sizeof(Dtype) << "-byte ones";
+  const char* const base = static_cast<const char*>(mapping_);
+  CHECK(index_.ParseFromArray(base + sizeof(MMapModelHeader),
+      header->index_size)) << "Failed to parse the index of " << filename;
+  // Recompute the implied payload offsets from the index shapes.
+  size_t offset = sizeof(MMapModelHeader) + header->index_size;
+  for (int i = 0; i < index_.layers_size(); ++i) {
+    for (int j = 0; j < index_.layers(i).blobs_size(); ++j) {
+      const BlobProto& blob = index_.layers(i).blobs(j);
+      const size_t count = static_cast<size_t>(blob.num()) * blob.channels()
+          * blob.height() * blob.width();
+      offset = AlignUp(offset);
+      blob_offsets_.push_back(offset);
+      offset += count * sizeof(Dtype);
+    }
+  }
+  CHECK_LE(offset, mapping_size_) << filename << " is truncated";
+}
+
+template <typename Dtype>
+MMapModel<Dtype>::~MMapModel() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+}
+
+template <typename Dtype>
+Dtype* MMapModel<Dtype>::blob_data(const int i) const {
+  CHECK_GE(i, 0);
+  CHECK_LT(i, blob_offsets_.size());
+  return reinterpret_cast<Dtype*>(
+      static_cast<char*>(mapping_) + blob_offsets_[i]);
+}
+
+template class MMapModel<float>;
+template class MMapModel<double>;
+
+bool IsMMapSolverStateFile(const string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  uint32_t magic = 0;
+  const bool read_ok = (fread(&magic, sizeof(magic), 1, file) == 1);
+  fclose(file);
+  return read_ok && magic == kMMapStateMagic;
+}
+
+void WriteSolverStateToMMapFile(const SolverState& state,
+    const string& filename) {
+  // As for models: the index is the state with every history payload
+  // dropped, shapes kept for validation; offsets are implied by layout.
+  SolverState index(state);
+  for (int i = 0; i < index.history_size(); ++i) {
+    index.mutable_history(i)->clear_data();
+    index.mutable_history(i)->clear_diff();
+  }
+  string index_bytes;
+  CHECK(index.SerializeToString(&index_bytes));
+
+  MMapModelHeader header;
+  header.magic = kMMapStateMagic;
+  header.element_size = sizeof(float);
+  header.index_size = index_bytes.size();
+
+  FILE* file = fopen(filename.c_str(), "wb");
+  CHECK(file) << "Failed to open " << filename << " for writing";
+  CHECK_EQ(fwrite(&header, sizeof(header), 1, file), 1);
+  CHECK_EQ(fwrite(index_bytes.data(), 1, index_bytes.size(), file),
+      index_bytes.size());
+  size_t offset = sizeof(header) + index_bytes.size();
+  const string zeros(kMMapModelAlignment, '\0');
+  for (int i = 0; i < state.history_size(); ++i) {
+    const BlobProto& blob = state.history(i);
+    const int count =
+        blob.num() * blob.channels() * blob.height() * blob.width();
+    CHECK_EQ(blob.data_size(), count)
+        << "History blob " << i
+        << " has a payload inconsistent with its shape";
+    const size_t padding = AlignUp(offset) - offset;
+    CHECK_EQ(fwrite(zeros.data(), 1, padding, file), padding);
+    offset += padding;
+    for (int k = 0; k < blob.data_size(); ++k) {
+      const float value = blob.data(k);
+      CHECK_EQ(fwrite(&value, sizeof(value), 1, file), 1);
+    }
+    offset += blob.data_size() * sizeof(float);
+  }
+  CHECK_EQ(fclose(file), 0);
+}
+
+template <typename Dtype>
+MMapSolverState<Dtype>::MMapSolverState(const string& filename)
+    : mapping_(NULL), mapping_size_(0) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0);
+  mapping_size_ = file_stat.st_size;
+  CHECK_GE(mapping_size_, sizeof(MMapModelHeader))
+      << filename << " is not a mmap solver-state file";
+  // Copy-on-write, as for models -- but here the writes are expected: the
+  // solver updates its history in place every iteration, and each touched
+  // page faults in a private copy while the file stays intact.
+  mapping_ = mmap(NULL, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+      fd, 0);
+  CHECK_NE(mapping_, MAP_FAILED) << "Failed to map " << filename;
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+
+  const MMapModelHeader* header =
+      static_cast<const MMapModelHeader*>(mapping_);
+  CHECK_EQ(header->magic, kMMapStateMagic)
+      << filename << " is not a mmap solver-state file";
+  CHECK_EQ(header->element_size, sizeof(Dtype))
+      << filename << " stores " << header->element_size
+      << "-byte elements, but this solver uses " << sizeof(Dtype)
+      << "-byte ones";
+  const char* const base = static_cast<const char*>(mapping_);
+  CHECK(index_.ParseFromArray(base + sizeof(MMapModelHeader),
+      header->index_size)) << "Failed to parse the index of " << filename;
+  // Recompute the implied payload offsets from the index shapes.
+  size_t offset = sizeof(MMapModelHeader) + header->index_size;
+  for (int i = 0; i < index_.history_size(); ++i) {
+    const BlobProto& blob = index_.history(i);
+    const size_t count = static_cast<size_t>(blob.num()) * blob.channels()
+        * blob.height() * blob.width();
+    offset = AlignUp(offset);
+    blob_offsets_.push_back(offset);
+    offset += count * sizeof(Dtype);
+  }
+  CHECK_LE(offset, mapping_size_) << filename << " is truncated";
+}
+
+template <typename Dtype>
+MMapSolverState<Dtype>::~MMapSolverState() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+}
+
+template <typename Dtype>
+Dtype* MMapSolverState<Dtype>::blob_data(const int i) const {
+  CHECK_GE(i, 0);
+  CHECK_LT(i, blob_offsets_.size());
+  return reinterpret_cast<Dtype*>(
+      static_cast<char*>(mapping_) + blob_offsets_[i]);
+}
+
+template class MMapSolverState<float>;
+template class MMapSolverState<double>;
+
+}  // namespace caffe
@@ -0,0 +1,66 @@
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/oversample.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void oversample_cpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int crop_size,
+    Dtype* data_crops) {
+  CHECK_LE(crop_size, height);
+  CHECK_LE(crop_size, width);
+  // Top-left corners of the five unmirrored crops; crops 5..9 are the
+  // horizontally mirrored versions of crops 0..4.
+  const int h_off[5] = { 0, 0, height - crop_size, height - crop_size,
+                         (height - crop_size) / 2 };
+  const int w_off[5] = { 0, width - crop_size, 0, width - crop_size,
+                         (width - crop_size) / 2 };
+  for (int n = 0; n < num; ++n) {
+    for (int crop = 0; crop < kOversampleCrops; ++crop) {
+      const bool mirror = crop >= 5;
+      const int h0 = h_off[crop % 5];
+      const int w0 = w_off[crop % 5];
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* src = data_im + (n * channels + c) * height * width;
+        Dtype* dst = data_crops +
+            ((n * kOversampleCrops + crop) * channels + c) *
+            crop_size * crop_size;
+        for (int y = 0; y < crop_size; ++y) {
+          for (int x = 0; x < crop_size; ++x) {
+            const int src_x = mirror ? w0 + crop_size - 1 - x : w0 + x;
+            dst[y * crop_size + x] = src[(h0 + y) * width + src_x];
+          }
+        }
+      }
+    }
+  }
+}
+
+template void oversample_cpu<float>(const float* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int crop_size, float* data_crops);
+template void oversample_cpu<double>(const double* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int crop_size, double* data_crops);
+
+template <typename Dtype>
+void oversample_mean_cpu(const Dtype* predictions, const int num,
+    const int dim, Dtype* means) {
+  const Dtype scale = Dtype(1) / kOversampleCrops;
+  for (int n = 0; n < num; ++n) {
+    Dtype* mean = means + n * dim;
+    caffe_set(dim, Dtype(0), mean);
+    for (int crop = 0; crop < kOversampleCrops; ++crop) {
+      caffe_axpy(dim, scale,
+          predictions + (n * kOversampleCrops + crop) * dim, mean);
+    }
+  }
+}
+
+template void oversample_mean_cpu<float>(const float* predictions,
+    const int num, const int dim, float* means);
+template void oversample_mean_cpu<double>(const double* predictions,
+    const int num, const int dim, double* means);
+
+}  // namespace caffe
@@ -0,0 +1,89 @@
+#include "caffe/common.hpp"
+#include "caffe/util/oversample.hpp"
+
+namespace caffe {
+
+// One thread per output element; the crop id selects the window corner
+// and, for crops 5..9, mirrors the column index. See oversample.hpp for
+// the crop layout.
+template <typename Dtype>
+__global__ void OversampleKernel(const int n, const Dtype* data_im,
+    const int channels, const int height, const int width,
+    const int crop_size, Dtype* data_crops) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int x = index % crop_size;
+    const int y = (index / crop_size) % crop_size;
+    const int c = (index / crop_size / crop_size) % channels;
+    const int crop_n = index / crop_size / crop_size / channels;
+    const int crop = crop_n % kOversampleCrops;
+    const int im_n = crop_n / kOversampleCrops;
+    const int base = crop % 5;
+    int h0 = 0;
+    int w0 = 0;
+    if (base == 1 || base == 3) { w0 = width - crop_size; }
+    if (base == 2 || base == 3) { h0 = height - crop_size; }
+    if (base == 4) {
+      h0 = (height - crop_size) / 2;
+      w0 = (width - crop_size) / 2;
+    }
+    const int src_x = crop >= 5 ? w0 + crop_size - 1 - x : w0 + x;
+    data_crops[index] =
+        data_im[((im_n * channels + c) * height + h0 + y) * width + src_x];
+  }
+}
+
+template <typename Dtype>
+void oversample_gpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int crop_size,
+    Dtype* data_crops) {
+  CHECK_LE(crop_size, height);
+  CHECK_LE(crop_size, width);
+  const int count =
+      num * kOversampleCrops * channels * crop_size * crop_size;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  OversampleKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+                            CAFFE_CUDA_NUM_THREADS>>>(
+      count, data_im, channels, height, width, crop_size, data_crops);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void oversample_gpu<float>(const float* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int crop_size, float* data_crops);
+template void oversample_gpu<double>(const double* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int crop_size, double* data_crops);
+
+// One thread per mean element, summing that output across the image's
+// crops; the crop count is small, so a flat loop beats a reduction.
+template <typename Dtype>
+__global__ void OversampleMeanKernel(const int n, const Dtype* predictions,
+    const int dim, Dtype* means) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int d = index % dim;
+    const int im_n = index / dim;
+    Dtype sum = 0;
+    for (int crop = 0; crop < kOversampleCrops; ++crop) {
+      sum += predictions[(im_n * kOversampleCrops + crop) * dim + d];
+    }
+    means[index] = sum / kOversampleCrops;
+  }
+}
+
+template <typename Dtype>
+void oversample_mean_gpu(const Dtype* predictions, const int num,
+    const int dim, Dtype* means) {
+  const int count = num * dim;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  OversampleMeanKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+                                CAFFE_CUDA_NUM_THREADS>>>(
+      count, predictions, dim, means);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void oversample_mean_gpu<float>(const float* predictions,
+    const int num, const int dim, float* means);
+template void oversample_mean_gpu<double>(const double* predictions,
+    const int num, const int dim, double* means);
+
+}  // namespace caffe
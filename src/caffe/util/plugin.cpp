@@ -0,0 +1,65 @@
+#include <dlfcn.h>
+
+#include <boost/thread.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+#include "caffe/util/plugin.hpp"
+
+namespace caffe {
+
+typedef Layer<float>* (*FloatCreator)(const LayerParameter&);
+typedef Layer<double>* (*DoubleCreator)(const LayerParameter&);
+
+// Guarded by a mutex since data-parallel replicas initialize nets
+// concurrently. Registration itself happens inside dlopen, which runs
+// under the loader's own lock.
+static boost::mutex plugin_mutex_;
+static map<int, std::pair<FloatCreator, DoubleCreator> > plugin_creators_;
+static set<string> plugins_loaded_;
+
+void LoadLayerPlugin(const string& path) {
+  boost::mutex::scoped_lock lock(plugin_mutex_);
+  if (plugins_loaded_.find(path) != plugins_loaded_.end()) {
+    return;
+  }
+  // The handle is deliberately never dlclosed: the registry holds
+  // function pointers into the plugin for the life of the process.
+  void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  CHECK(handle) << "Could not load layer plugin " << path << ": "
+      << dlerror();
+  plugins_loaded_.insert(path);
+  LOG(INFO) << "Loaded layer plugin " << path;
+}
+
+PluginLayerRegistrar::PluginLayerRegistrar(LayerParameter_LayerType type,
+    Layer<float>* (*float_creator)(const LayerParameter&),
+    Layer<double>* (*double_creator)(const LayerParameter&)) {
+  std::pair<FloatCreator, DoubleCreator>& creators = plugin_creators_[type];
+  CHECK(!creators.first) << "Layer type " << type
+      << " is registered by two plugins.";
+  creators = std::make_pair(float_creator, double_creator);
+  LOG(INFO) << "Registered plugin implementation for layer type " << type;
+}
+
+template <>
+Layer<float>* CreatePluginLayer<float>(const LayerParameter& param) {
+  boost::mutex::scoped_lock lock(plugin_mutex_);
+  map<int, std::pair<FloatCreator, DoubleCreator> >::const_iterator it =
+      plugin_creators_.find(param.type());
+  return it == plugin_creators_.end() ? NULL : it->second.first(param);
+}
+
+template <>
+Layer<double>* CreatePluginLayer<double>(const LayerParameter& param) {
+  boost::mutex::scoped_lock lock(plugin_mutex_);
+  map<int, std::pair<FloatCreator, DoubleCreator> >::const_iterator it =
+      plugin_creators_.find(param.type());
+  return it == plugin_creators_.end() ? NULL : it->second.second(param);
+}
+
+}  // namespace caffe
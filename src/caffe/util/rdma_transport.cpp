@@ -0,0 +1,477 @@
+#ifdef USE_RDMA
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "caffe/util/rdma_transport.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Ring depth of pre-posted eager receives, and the size of one slot.
+const int kEagerRing = 16;
+const size_t kEagerSize = 4096;
+// Largest single RDMA write; bigger payloads go in several writes with
+// the immediate on the last one.
+const size_t kMaxWrite = 1 << 30;
+// Milliseconds to wait for address and route resolution.
+const int kResolveTimeoutMs = 2000;
+
+// One eager message: the control word, followed by the payload for DATA.
+enum RdmaMsgKind {
+  RDMA_MSG_DATA = 0,  // small payload carried inline
+  RDMA_MSG_RTS = 1,   // sender announces a large transfer of `bytes`
+  RDMA_MSG_CTS = 2    // receiver answers with its sink `addr` and `rkey`
+};
+struct RdmaControl {
+  uint32_t kind;
+  uint32_t rkey;
+  uint64_t bytes;
+  uint64_t addr;
+};
+const size_t kEagerPayload = kEagerSize - sizeof(RdmaControl);
+
+// Whether ptr lives in device memory, so copies to or from it must go
+// through cudaMemcpy. Registration itself is uniform: with nv_peer_mem
+// loaded ibv_reg_mr pins device pages like host pages.
+bool IsDevicePointer(const void* ptr) {
+#ifndef CPU_ONLY
+  struct cudaPointerAttributes attributes;
+  if (cudaPointerGetAttributes(&attributes, ptr) != cudaSuccess) {
+    cudaGetLastError();  // clear the not-a-device-pointer error
+    return false;
+  }
+  return attributes.memoryType == cudaMemoryTypeDevice;
+#else
+  return false;
+#endif
+}
+
+// Copy between an eager slot (host) and a user buffer that may be on
+// the device.
+void CopyFromSlot(void* dst, const void* src, const size_t size,
+    const bool dst_device) {
+  if (dst_device) {
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaMemcpy(dst, src, size, cudaMemcpyHostToDevice));
+#else
+    NO_GPU;
+#endif
+  } else {
+    memcpy(dst, src, size);
+  }
+}
+void CopyToSlot(void* dst, const void* src, const size_t size,
+    const bool src_device) {
+  if (src_device) {
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaMemcpy(dst, src, size, cudaMemcpyDeviceToHost));
+#else
+    NO_GPU;
+#endif
+  } else {
+    memcpy(dst, src, size);
+  }
+}
+
+// Block for the next connection-manager event and insist on its type.
+void WaitCmEvent(struct rdma_event_channel* channel,
+    const enum rdma_cm_event_type expected) {
+  struct rdma_cm_event* event = NULL;
+  CHECK_EQ(rdma_get_cm_event(channel, &event), 0)
+      << "rdma_get_cm_event failed: " << strerror(errno);
+  const enum rdma_cm_event_type type = event->event;
+  const int status = event->status;
+  rdma_ack_cm_event(event);
+  CHECK_EQ(type, expected) << "Unexpected RDMA connection event "
+      << rdma_event_str(type) << " (status " << status << ")";
+}
+
+}  // namespace
+
+RdmaTransport::RdmaTransport(struct rdma_cm_id* id, const bool owns_channel)
+    : id_(id), owns_channel_(owns_channel), pd_(NULL), recv_channel_(NULL),
+      send_cq_(NULL), recv_cq_(NULL), eager_slab_(NULL), eager_mr_(NULL) {
+  pd_ = ibv_alloc_pd(id_->verbs);
+  CHECK(pd_ != NULL) << "ibv_alloc_pd failed: " << strerror(errno);
+  recv_channel_ = ibv_create_comp_channel(id_->verbs);
+  CHECK(recv_channel_ != NULL)
+      << "ibv_create_comp_channel failed: " << strerror(errno);
+  recv_cq_ = ibv_create_cq(id_->verbs, 2 * kEagerRing, NULL,
+      recv_channel_, 0);
+  CHECK(recv_cq_ != NULL) << "ibv_create_cq failed: " << strerror(errno);
+  // Sends are waited for inline by polling, so their queue needs no
+  // event channel.
+  send_cq_ = ibv_create_cq(id_->verbs, kEagerRing, NULL, NULL, 0);
+  CHECK(send_cq_ != NULL) << "ibv_create_cq failed: " << strerror(errno);
+  CHECK_EQ(ibv_req_notify_cq(recv_cq_, 0), 0)
+      << "ibv_req_notify_cq failed";
+  struct ibv_qp_init_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.send_cq = send_cq_;
+  attr.recv_cq = recv_cq_;
+  attr.qp_type = IBV_QPT_RC;
+  attr.cap.max_send_wr = kEagerRing;
+  attr.cap.max_recv_wr = kEagerRing;
+  attr.cap.max_send_sge = 1;
+  attr.cap.max_recv_sge = 1;
+  CHECK_EQ(rdma_create_qp(id_, pd_, &attr), 0)
+      << "rdma_create_qp failed: " << strerror(errno);
+  // The eager slab: kEagerRing receive slots plus one send slot, posted
+  // before the connection completes so the peer never finds the ring
+  // empty at startup.
+  eager_slab_ = static_cast<char*>(malloc((kEagerRing + 1) * kEagerSize));
+  CHECK(eager_slab_ != NULL) << "Out of memory for the RDMA eager ring";
+  eager_mr_ = ibv_reg_mr(pd_, eager_slab_, (kEagerRing + 1) * kEagerSize,
+      IBV_ACCESS_LOCAL_WRITE);
+  CHECK(eager_mr_ != NULL) << "ibv_reg_mr failed: " << strerror(errno);
+  for (int i = 0; i < kEagerRing; ++i) {
+    PostEagerRecv(i);
+  }
+}
+
+RdmaTransport::~RdmaTransport() {
+  // Moves the queue pair to the error state; the peer's pending
+  // receives flush, which its Recv reports as an orderly close.
+  rdma_disconnect(id_);
+  for (std::map<std::pair<uint64_t, size_t>, Region>::iterator it =
+       regions_.begin(); it != regions_.end(); ++it) {
+    ibv_dereg_mr(it->second.mr);
+  }
+  if (eager_mr_) { ibv_dereg_mr(eager_mr_); }
+  free(eager_slab_);
+  rdma_destroy_qp(id_);
+  if (send_cq_) { ibv_destroy_cq(send_cq_); }
+  if (recv_cq_) { ibv_destroy_cq(recv_cq_); }
+  if (recv_channel_) { ibv_destroy_comp_channel(recv_channel_); }
+  if (pd_) { ibv_dealloc_pd(pd_); }
+  struct rdma_event_channel* channel = id_->channel;
+  rdma_destroy_id(id_);
+  if (owns_channel_) {
+    rdma_destroy_event_channel(channel);
+  }
+}
+
+shared_ptr<ParamTransport> RdmaTransport::Connect(const string& host,
+    const int port) {
+  struct rdma_event_channel* channel = rdma_create_event_channel();
+  CHECK(channel != NULL) << "rdma_create_event_channel failed (are the "
+      << "rdma_cm modules loaded?): " << strerror(errno);
+  struct rdma_cm_id* id = NULL;
+  CHECK_EQ(rdma_create_id(channel, &id, NULL, RDMA_PS_TCP), 0)
+      << "rdma_create_id failed: " << strerror(errno);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  struct addrinfo* result = NULL;
+  const int error = getaddrinfo(host.c_str(), port_str, &hints, &result);
+  CHECK_EQ(error, 0) << "Could not resolve parameter server " << host
+      << ": " << gai_strerror(error);
+  CHECK_EQ(rdma_resolve_addr(id, NULL, result->ai_addr,
+      kResolveTimeoutMs), 0)
+      << "rdma_resolve_addr failed: " << strerror(errno);
+  freeaddrinfo(result);
+  WaitCmEvent(channel, RDMA_CM_EVENT_ADDR_RESOLVED);
+  CHECK_EQ(rdma_resolve_route(id, kResolveTimeoutMs), 0)
+      << "rdma_resolve_route failed: " << strerror(errno);
+  WaitCmEvent(channel, RDMA_CM_EVENT_ROUTE_RESOLVED);
+  // The queue pair and the eager ring must exist before connecting; the
+  // transport's constructor builds both.
+  shared_ptr<ParamTransport> transport(new RdmaTransport(id, true));
+  struct rdma_conn_param param;
+  memset(&param, 0, sizeof(param));
+  param.responder_resources = 1;
+  param.initiator_depth = 1;
+  param.retry_count = 7;
+  param.rnr_retry_count = 7;  // wait out a peer with no posted buffer
+  CHECK_EQ(rdma_connect(id, &param), 0)
+      << "rdma_connect failed: " << strerror(errno);
+  WaitCmEvent(channel, RDMA_CM_EVENT_ESTABLISHED);
+  return transport;
+}
+
+RdmaTransport::Region RdmaTransport::GetRegion(void* addr, size_t size) {
+  const std::pair<uint64_t, size_t> key(
+      static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr)), size);
+  std::map<std::pair<uint64_t, size_t>, Region>::const_iterator it =
+      regions_.find(key);
+  if (it != regions_.end()) {
+    return it->second;
+  }
+  Region region;
+  region.device = IsDevicePointer(addr);
+  region.mr = ibv_reg_mr(pd_, addr, size,
+      IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  CHECK(region.mr != NULL) << "ibv_reg_mr failed for " << size << " bytes"
+      << (region.device ? " of device memory (is nv_peer_mem loaded?)"
+                        : "") << ": " << strerror(errno);
+  regions_[key] = region;
+  return region;
+}
+
+void RdmaTransport::PostEagerRecv(const int index) {
+  struct ibv_sge sge;
+  sge.addr = reinterpret_cast<uintptr_t>(eager_slab_ + index * kEagerSize);
+  sge.length = kEagerSize;
+  sge.lkey = eager_mr_->lkey;
+  struct ibv_recv_wr wr;
+  struct ibv_recv_wr* bad = NULL;
+  memset(&wr, 0, sizeof(wr));
+  wr.wr_id = index;
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  CHECK_EQ(ibv_post_recv(id_->qp, &wr, &bad), 0)
+      << "ibv_post_recv failed: " << strerror(errno);
+}
+
+void RdmaTransport::SendEager(const uint32_t kind, const uint64_t bytes,
+    const uint64_t addr, const uint32_t rkey, const void* payload,
+    const size_t payload_size) {
+  CHECK_LE(payload_size, kEagerPayload);
+  char* slot = eager_slab_ + kEagerRing * kEagerSize;
+  RdmaControl control;
+  control.kind = kind;
+  control.rkey = rkey;
+  control.bytes = bytes;
+  control.addr = addr;
+  memcpy(slot, &control, sizeof(control));
+  if (payload_size > 0) {
+    CopyToSlot(slot + sizeof(control), payload, payload_size,
+        IsDevicePointer(payload));
+  }
+  struct ibv_sge sge;
+  sge.addr = reinterpret_cast<uintptr_t>(slot);
+  sge.length = sizeof(control) + payload_size;
+  sge.lkey = eager_mr_->lkey;
+  struct ibv_send_wr wr;
+  struct ibv_send_wr* bad = NULL;
+  memset(&wr, 0, sizeof(wr));
+  wr.opcode = IBV_WR_SEND;
+  wr.send_flags = IBV_SEND_SIGNALED;
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  CHECK_EQ(ibv_post_send(id_->qp, &wr, &bad), 0)
+      << "ibv_post_send failed: " << strerror(errno);
+  WaitSendCompletion();
+}
+
+void RdmaTransport::WaitSendCompletion() {
+  // Sends complete in microseconds on the fabrics this targets; polling
+  // skips the event-channel round trip on the critical path.
+  struct ibv_wc wc;
+  int polled;
+  while ((polled = ibv_poll_cq(send_cq_, 1, &wc)) == 0) {}
+  CHECK_GT(polled, 0) << "ibv_poll_cq failed";
+  CHECK_EQ(wc.status, IBV_WC_SUCCESS) << "RDMA send failed: "
+      << ibv_wc_status_str(wc.status);
+}
+
+bool RdmaTransport::WaitRecvCompletion(struct ibv_wc* wc) {
+  while (pending_wc_.empty()) {
+    struct ibv_wc drained[kEagerRing];
+    int polled = ibv_poll_cq(recv_cq_, kEagerRing, drained);
+    CHECK_GE(polled, 0) << "ibv_poll_cq failed";
+    if (polled == 0) {
+      // Re-arm, then poll once more to close the race with a completion
+      // that slipped in between, then sleep on the channel.
+      CHECK_EQ(ibv_req_notify_cq(recv_cq_, 0), 0)
+          << "ibv_req_notify_cq failed";
+      polled = ibv_poll_cq(recv_cq_, kEagerRing, drained);
+      CHECK_GE(polled, 0) << "ibv_poll_cq failed";
+      if (polled == 0) {
+        struct ibv_cq* cq = NULL;
+        void* context = NULL;
+        CHECK_EQ(ibv_get_cq_event(recv_channel_, &cq, &context), 0)
+            << "ibv_get_cq_event failed: " << strerror(errno);
+        ibv_ack_cq_events(cq, 1);
+        continue;
+      }
+    }
+    for (int i = 0; i < polled; ++i) {
+      pending_wc_.push_back(drained[i]);
+    }
+  }
+  *wc = pending_wc_.front();
+  pending_wc_.pop_front();
+  if (wc->status == IBV_WC_WR_FLUSH_ERR) {
+    return false;  // the peer disconnected and our receives flushed
+  }
+  CHECK_EQ(wc->status, IBV_WC_SUCCESS) << "RDMA receive failed: "
+      << ibv_wc_status_str(wc->status);
+  return true;
+}
+
+void RdmaTransport::Send(const void* data, size_t size) {
+  if (size <= kEagerPayload) {
+    SendEager(RDMA_MSG_DATA, size, 0, 0, data, size);
+    return;
+  }
+  // Announce the transfer and wait for the receiver's sink; peers run
+  // the parameter protocol in lock step, so nothing else can arrive.
+  SendEager(RDMA_MSG_RTS, size, 0, 0, NULL, 0);
+  struct ibv_wc wc;
+  CHECK(WaitRecvCompletion(&wc))
+      << "RDMA peer left before accepting a transfer";
+  CHECK_EQ(wc.opcode, IBV_WC_RECV)
+      << "Expected the receiver's sink, got opcode " << wc.opcode;
+  RdmaControl control;
+  memcpy(&control, eager_slab_ + wc.wr_id * kEagerSize, sizeof(control));
+  PostEagerRecv(wc.wr_id);
+  CHECK_EQ(control.kind, RDMA_MSG_CTS)
+      << "Expected the receiver's sink, got message kind " << control.kind;
+  CHECK_EQ(control.bytes, size) << "RDMA transfer size mismatch";
+  const Region region = GetRegion(const_cast<void*>(data), size);
+  // Write straight into the advertised sink; the immediate on the last
+  // chunk tells the receiver the payload landed.
+  size_t offset = 0;
+  while (offset < size) {
+    const size_t chunk = std::min(size - offset, kMaxWrite);
+    struct ibv_sge sge;
+    sge.addr = reinterpret_cast<uintptr_t>(data) + offset;
+    sge.length = chunk;
+    sge.lkey = region.mr->lkey;
+    struct ibv_send_wr wr;
+    struct ibv_send_wr* bad = NULL;
+    memset(&wr, 0, sizeof(wr));
+    wr.opcode = (offset + chunk == size) ?
+        IBV_WR_RDMA_WRITE_WITH_IMM : IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.wr.rdma.remote_addr = control.addr + offset;
+    wr.wr.rdma.rkey = control.rkey;
+    CHECK_EQ(ibv_post_send(id_->qp, &wr, &bad), 0)
+        << "ibv_post_send failed: " << strerror(errno);
+    WaitSendCompletion();
+    offset += chunk;
+  }
+}
+
+bool RdmaTransport::Recv(void* data, size_t size) {
+  char* dst = static_cast<char*>(data);
+  size_t filled = 0;
+  bool probed = false;
+  bool device = false;
+  Region region;
+  region.mr = NULL;
+  region.device = false;
+  uint64_t announced = 0;  // bytes promised by our sink, not yet landed
+  bool first = true;
+  while (filled < size) {
+    struct ibv_wc wc;
+    if (!WaitRecvCompletion(&wc)) {
+      if (first) {
+        return false;  // orderly shutdown between messages
+      }
+      LOG(FATAL) << "RDMA peer closed the connection mid-message";
+    }
+    first = false;
+    if (wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+      // A direct write into our sink completed.
+      CHECK_GT(announced, 0) << "Unexpected RDMA write completion";
+      filled += announced;
+      announced = 0;
+      PostEagerRecv(wc.wr_id);
+      continue;
+    }
+    CHECK_EQ(wc.opcode, IBV_WC_RECV)
+        << "Unexpected RDMA completion opcode " << wc.opcode;
+    const char* slot = eager_slab_ + wc.wr_id * kEagerSize;
+    RdmaControl control;
+    memcpy(&control, slot, sizeof(control));
+    if (control.kind == RDMA_MSG_DATA) {
+      CHECK_LE(control.bytes, size - filled)
+          << "RDMA send straddles a Recv boundary";
+      if (!probed) {
+        device = IsDevicePointer(data);
+        probed = true;
+      }
+      CopyFromSlot(dst + filled, slot + sizeof(control), control.bytes,
+          device);
+      filled += control.bytes;
+    } else if (control.kind == RDMA_MSG_RTS) {
+      // Register the destination (once per buffer, cached across
+      // rounds) and advertise the slice the sender asked for.
+      CHECK_LE(control.bytes, size - filled)
+          << "RDMA send straddles a Recv boundary";
+      CHECK_EQ(announced, 0) << "Overlapping RDMA transfers";
+      if (region.mr == NULL) {
+        region = GetRegion(data, size);
+      }
+      SendEager(RDMA_MSG_CTS, control.bytes,
+          reinterpret_cast<uintptr_t>(dst + filled), region.mr->rkey,
+          NULL, 0);
+      announced = control.bytes;
+    } else {
+      LOG(FATAL) << "Unknown RDMA message kind " << control.kind;
+    }
+    PostEagerRecv(wc.wr_id);
+  }
+  return true;
+}
+
+RdmaListener::RdmaListener(const int port) {
+  channel_ = rdma_create_event_channel();
+  CHECK(channel_ != NULL) << "rdma_create_event_channel failed (are the "
+      << "rdma_cm modules loaded?): " << strerror(errno);
+  CHECK_EQ(rdma_create_id(channel_, &listen_id_, NULL, RDMA_PS_TCP), 0)
+      << "rdma_create_id failed: " << strerror(errno);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  CHECK_EQ(rdma_bind_addr(listen_id_,
+      reinterpret_cast<struct sockaddr*>(&addr)), 0)
+      << "RDMA listener could not bind port " << port << ": "
+      << strerror(errno);
+  CHECK_EQ(rdma_listen(listen_id_, 64), 0)
+      << "rdma_listen failed: " << strerror(errno);
+  LOG(INFO) << "Parameter server listening for RDMA workers on port "
+      << port;
+}
+
+RdmaListener::~RdmaListener() {
+  rdma_destroy_id(listen_id_);
+  rdma_destroy_event_channel(channel_);
+}
+
+shared_ptr<ParamTransport> RdmaListener::Accept() {
+  struct rdma_cm_event* event = NULL;
+  CHECK_EQ(rdma_get_cm_event(channel_, &event), 0)
+      << "rdma_get_cm_event failed: " << strerror(errno);
+  shared_ptr<ParamTransport> transport;
+  if (event->event == RDMA_CM_EVENT_CONNECT_REQUEST) {
+    // Build the queue pair and the eager ring before accepting, so the
+    // worker's first message always finds a posted receive.
+    struct rdma_cm_id* id = event->id;
+    transport.reset(new RdmaTransport(id, false));
+    struct rdma_conn_param param;
+    memset(&param, 0, sizeof(param));
+    param.responder_resources = 1;
+    param.initiator_depth = 1;
+    param.rnr_retry_count = 7;
+    CHECK_EQ(rdma_accept(id, &param), 0)
+        << "rdma_accept failed: " << strerror(errno);
+  }
+  // ESTABLISHED and DISCONNECTED need only the acknowledgement; a
+  // disconnect surfaces to the serving loop as flushed receives.
+  rdma_ack_cm_event(event);
+  return transport;
+}
+
+}  // namespace caffe
+
+#endif  // USE_RDMA
@@ -0,0 +1,78 @@
+#include <map>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/strip_identity_layers.hpp"
+
+namespace caffe {
+
+// A layer can be stripped if its single top is an unmodified copy of its
+// single bottom in the test phase.
+static bool IsTestIdentityLayer(const LayerParameter& layer) {
+  if (layer.bottom_size() != 1 || layer.top_size() != 1 ||
+      layer.loss_weight_size() != 0) {
+    return false;
+  }
+  switch (layer.type()) {
+  case LayerParameter_LayerType_DROPOUT:
+    // Dropout only masks activations during training.
+    return true;
+  case LayerParameter_LayerType_SPLIT:
+    // A split with a single top is a plain copy.
+    return true;
+  case LayerParameter_LayerType_POWER:
+    // y = (0 + 1 * x) ^ 1.
+    return layer.power_param().power() == 1 &&
+        layer.power_param().scale() == 1 &&
+        layer.power_param().shift() == 0;
+  default:
+    return false;
+  }
+}
+
+void StripIdentityLayers(const NetParameter& param,
+    NetParameter* param_stripped) {
+  // Initialize by copying from the input NetParameter.
+  param_stripped->CopyFrom(param);
+  if (Caffe::phase() != Caffe::TEST) {
+    LOG(INFO) << "Skipping identity layer stripping: layers such as "
+              << "DROPOUT are only identities in the test phase.";
+    return;
+  }
+  param_stripped->clear_layers();
+  // Maps each stripped layer's top to the surviving blob holding the same
+  // value. Bottoms are rewritten before the identity check, so chains of
+  // stripped layers resolve in a single lookup.
+  map<string, string> replacement;
+  int num_stripped = 0;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    LayerParameter layer(param.layers(i));
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      const map<string, string>::const_iterator it =
+          replacement.find(layer.bottom(j));
+      if (it != replacement.end()) {
+        layer.set_bottom(j, it->second);
+      }
+    }
+    if (IsTestIdentityLayer(layer)) {
+      if (layer.top(0) != layer.bottom(0)) {
+        replacement[layer.top(0)] = layer.bottom(0);
+      }
+      LOG(INFO) << "Stripping test-phase identity layer " << layer.name();
+      ++num_stripped;
+      continue;
+    }
+    // A surviving layer that rewrites a replaced blob name supersedes the
+    // replacement from that point on.
+    for (int j = 0; j < layer.top_size(); ++j) {
+      replacement.erase(layer.top(j));
+    }
+    param_stripped->add_layers()->CopyFrom(layer);
+  }
+  if (num_stripped > 0) {
+    LOG(INFO) << "Stripped " << num_stripped
+              << " test-phase identity layers.";
+  }
+}
+
+}  // namespace caffe
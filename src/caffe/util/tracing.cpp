@@ -0,0 +1,104 @@
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/tracing.hpp"
+
+namespace caffe {
+
+shared_ptr<Tracer> Tracer::singleton_;
+
+class Tracer::sync {
+ public:
+  sync() : buffer_(&NoOpCleanup) {}
+  // Rings are owned by Tracer::buffers_, not by the thread-specific
+  // pointer, so a thread exiting must not free its ring.
+  static void NoOpCleanup(ThreadBuffer*) {}
+  boost::mutex mutex_;
+  boost::thread_specific_ptr<ThreadBuffer> buffer_;
+};
+
+Tracer::Tracer() : enabled_(false), sync_(new sync()) {}
+
+Tracer& Tracer::Get() {
+  if (!singleton_.get()) {
+    singleton_.reset(new Tracer());
+  }
+  return *singleton_;
+}
+
+uint64_t Tracer::NowMicroseconds() {
+  static const boost::posix_time::ptime epoch(
+      boost::gregorian::date(1970, 1, 1));
+  return (boost::posix_time::microsec_clock::universal_time() - epoch)
+      .total_microseconds();
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer() {
+  ThreadBuffer* buffer = sync_->buffer_.get();
+  if (!buffer) {
+    buffer = new ThreadBuffer();
+    buffer->events.resize(kTraceRingCapacity);
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    buffer->tid = buffers_.size();
+    buffers_.push_back(buffer);
+    sync_->buffer_.reset(buffer);
+  }
+  return buffer;
+}
+
+void Tracer::RecordEvent(const char* name, uint64_t start_us,
+    uint64_t end_us) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  TraceEvent& event = buffer->events[buffer->next];
+  event.name = name;
+  event.start_us = start_us;
+  event.dur_us = end_us - start_us;
+  if (++buffer->next == kTraceRingCapacity) {
+    buffer->next = 0;
+    buffer->wrapped = true;
+  }
+}
+
+void Tracer::WriteTraceFile(const string& filename) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  std::ofstream out(filename.c_str());
+  if (!out.good()) {
+    LOG(ERROR) << "Could not open trace file " << filename;
+    return;
+  }
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (int i = 0; i < buffers_.size(); ++i) {
+    const ThreadBuffer& buffer = *buffers_[i];
+    const size_t count = buffer.wrapped ? kTraceRingCapacity : buffer.next;
+    for (size_t j = 0; j < count; ++j) {
+      const TraceEvent& event = buffer.events[j];
+      if (!first) {
+        out << ",";
+      }
+      first = false;
+      out << "\n{\"name\":\"" << event.name << "\",\"ph\":\"X\","
+          << "\"pid\":0,\"tid\":" << buffer.tid << ","
+          << "\"ts\":" << event.start_us << ",\"dur\":" << event.dur_us
+          << "}";
+    }
+  }
+  out << "\n]}\n";
+  LOG(INFO) << "Wrote trace of " << buffers_.size() << " threads to "
+      << filename;
+}
+
+void Tracer::Clear() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  for (int i = 0; i < buffers_.size(); ++i) {
+    buffers_[i]->next = 0;
+    buffers_[i]->wrapped = false;
+  }
+}
+
+}  // namespace caffe
@@ -1,8 +1,11 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <stdint.h>
 
+#include <fstream>  // NOLINT(readability/streams)
 #include <map>
+#include <sstream>
 #include <string>
 
 #include "caffe/common.hpp"
@@ -632,4 +635,55 @@ void ReadNetParamsFromBinaryFileOrDie(const string& param_file,
   UpgradeNetAsNeeded(param_file, param);
 }
 
+// Bump whenever the compiled cache layout or the upgrade pipeline changes,
+// so caches written by older builds recompile instead of loading stale
+// results.
+const int kNetParameterCacheVersion = 1;
+
+// FNV-1a over the source prototxt bytes. Cheap and stable across runs;
+// the cache only guards against edits to one known file, so 64 bits of
+// collision resistance is plenty.
+uint64_t NetParameterSourceHash(const string& text) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < text.size(); ++i) {
+    hash ^= static_cast<unsigned char>(text[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void ReadNetParamsFromCompiledCacheOrDie(const string& param_file,
+                                         NetParameter* param) {
+  std::ifstream source(param_file.c_str(), std::ios::binary);
+  CHECK(source.good()) << "Could not open NetParameter file: " << param_file;
+  std::ostringstream text_stream;
+  text_stream << source.rdbuf();
+  const string& text = text_stream.str();
+  const uint64_t source_hash = NetParameterSourceHash(text);
+  const string cache_file = param_file + ".compiled";
+  NetParameterCache cache;
+  std::ifstream cache_in(cache_file.c_str(), std::ios::binary);
+  if (cache_in.good() && cache.ParseFromIstream(&cache_in) &&
+      cache.cache_version() == kNetParameterCacheVersion &&
+      cache.source_hash() == source_hash) {
+    param->CopyFrom(cache.net());
+    LOG(INFO) << "Loaded compiled net from " << cache_file;
+    return;
+  }
+  CHECK(google::protobuf::TextFormat::ParseFromString(text, param))
+      << "Failed to parse NetParameter file: " << param_file;
+  UpgradeNetAsNeeded(param_file, param);
+  cache.Clear();
+  cache.set_cache_version(kNetParameterCacheVersion);
+  cache.set_source_hash(source_hash);
+  cache.mutable_net()->CopyFrom(*param);
+  std::ofstream cache_out(cache_file.c_str(),
+      std::ios::binary | std::ios::trunc);
+  if (cache_out.good() && cache.SerializeToOstream(&cache_out)) {
+    LOG(INFO) << "Wrote compiled net to " << cache_file;
+  } else {
+    LOG(WARNING) << "Could not write compiled net cache: " << cache_file;
+  }
+}
+
 }  // namespace caffe
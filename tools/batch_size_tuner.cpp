@@ -0,0 +1,244 @@
+// Recommend a batch size for a net on this machine: probe increasing
+// batch sizes, measure images/s and memory with the SyncedMemory
+// accounting, and print a table with the largest batch that fits and
+// the one with the best throughput.
+//
+// Usage:
+//    batch_size_tuner --model=net.prototxt [--gpu=0] [--min_batch=1]
+//        [--max_batch=1024] [--warmup=2] [--iterations=10]
+//        [--forward_only] [--memory_limit_mb=N]
+//
+// The probe never lets a candidate run whose predicted footprint
+// exceeds the budget (90% of free device memory unless
+// --memory_limit_mb overrides it), because an actual CUDA allocation
+// failure aborts the process; the prediction comes from a linear fit
+// over the batches already measured, which memory use follows closely
+// since activations scale with the batch and parameters do not.
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Caffe;
+using caffe::CaffeMemoryAccounting;
+using caffe::MemoryAccounting;
+using caffe::Net;
+using caffe::NetParameter;
+using caffe::Timer;
+using caffe::string;
+using caffe::vector;
+
+DEFINE_string(model, "",
+    "The model definition protocol buffer text file.");
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on given device ID.");
+DEFINE_int32(min_batch, 1,
+    "Smallest batch size probed.");
+DEFINE_int32(max_batch, 1024,
+    "Largest batch size considered.");
+DEFINE_int32(warmup, 2,
+    "Unmeasured iterations per probe to settle allocation and clocks.");
+DEFINE_int32(iterations, 10,
+    "Measured iterations per probe.");
+DEFINE_bool(forward_only, false,
+    "Probe Forward only, in TEST phase, as in serving.");
+DEFINE_int32(memory_limit_mb, 0,
+    "Memory budget in MB a candidate must fit into. 0 uses 90% of the "
+    "free device memory in GPU mode and no limit in CPU mode.");
+
+// Rewrites every batch dimension in the net definition: the leading
+// input_dim of each declared input, and the batch_size of any data
+// layer present.
+static void SetBatchSize(NetParameter* param, const int batch) {
+  for (int i = 0; i < param->input_dim_size(); i += 4) {
+    param->set_input_dim(i, batch);
+  }
+  for (int i = 0; i < param->layers_size(); ++i) {
+    caffe::LayerParameter* layer = param->mutable_layers(i);
+    if (layer->has_data_param()) {
+      layer->mutable_data_param()->set_batch_size(batch);
+    }
+    if (layer->has_hdf5_data_param()) {
+      layer->mutable_hdf5_data_param()->set_batch_size(batch);
+    }
+    if (layer->has_image_data_param()) {
+      layer->mutable_image_data_param()->set_batch_size(batch);
+    }
+    if (layer->has_window_data_param()) {
+      layer->mutable_window_data_param()->set_batch_size(batch);
+    }
+  }
+}
+
+// What one probe measured. bytes is the accounting delta the net caused
+// while running, on the side the computation lives on.
+struct ProbeResult {
+  int batch;
+  double images_per_s;
+  size_t bytes;
+  bool fits;
+};
+
+static size_t CurrentBytes() {
+  MemoryAccounting accounting;
+  CaffeMemoryAccounting(&accounting);
+  return FLAGS_gpu >= 0 ? accounting.device_bytes : accounting.host_bytes;
+}
+
+static ProbeResult Probe(const NetParameter& base, const int batch) {
+  NetParameter param = base;
+  SetBatchSize(&param, batch);
+  ProbeResult result;
+  result.batch = batch;
+  const size_t before = CurrentBytes();
+  {
+    Net<float> net(param);
+    for (int i = 0; i < FLAGS_warmup; ++i) {
+      net.ForwardPrefilled();
+      if (!FLAGS_forward_only) { net.Backward(); }
+    }
+    Timer timer;
+    timer.Start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+      net.ForwardPrefilled();
+      if (!FLAGS_forward_only) { net.Backward(); }
+    }
+    timer.Stop();
+    // Measured while the net is alive, so everything it holds (blobs,
+    // col buffers, prefetch batches) is still allocated and counted.
+    result.bytes = CurrentBytes() - before;
+    result.images_per_s = timer.MilliSeconds() > 0 ?
+        1000.0 * batch * FLAGS_iterations / timer.MilliSeconds() : 0;
+  }
+  return result;
+}
+
+// Linear extrapolation of the footprint of `batch` from the probes run
+// so far: activations grow with the batch, parameters are constant, so
+// two points pin the line down well. With fewer than two probes the
+// candidate is allowed through (the first probes are small).
+static bool PredictedToFit(const vector<ProbeResult>& results,
+    const int batch, const size_t budget) {
+  if (budget == 0 || results.size() < 2) { return true; }
+  const ProbeResult& a = results[results.size() - 2];
+  const ProbeResult& b = results[results.size() - 1];
+  const double slope = static_cast<double>(b.bytes) - a.bytes > 0 ?
+      (static_cast<double>(b.bytes) - a.bytes) / (b.batch - a.batch) : 0;
+  const double predicted = b.bytes + slope * (batch - b.batch);
+  return predicted <= budget;
+}
+
+static bool ProbeBatchLess(const ProbeResult& a, const ProbeResult& b) {
+  return a.batch < b.batch;
+}
+
+int main(int argc, char** argv) {
+  caffe::GlobalInit(&argc, &argv);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to tune.";
+  CHECK_GE(FLAGS_min_batch, 1);
+  CHECK_GE(FLAGS_max_batch, FLAGS_min_batch);
+  CHECK_GT(FLAGS_iterations, 0);
+
+  size_t budget = static_cast<size_t>(FLAGS_memory_limit_mb) << 20;
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+#ifndef CPU_ONLY
+    if (budget == 0) {
+      size_t free_bytes, total_bytes;
+      CUDA_CHECK(cudaMemGetInfo(&free_bytes, &total_bytes));
+      // Keep a margin below what is free right now: fragmentation and
+      // cuBLAS workspaces are not in the accounting, and overshooting
+      // means an allocation failure that kills the probe.
+      budget = free_bytes / 10 * 9;
+      LOG(INFO) << "Budget: " << (budget >> 20) << " MB (90% of free "
+                << (free_bytes >> 20) << " MB on device " << FLAGS_gpu
+                << ")";
+    }
+#endif
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(FLAGS_forward_only ? Caffe::TEST : Caffe::TRAIN);
+
+  NetParameter base;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &base);
+
+  // Doubling phase: probe upward until the budget, a slowdown would not
+  // stop us (throughput is reported, not used to stop), or max_batch.
+  vector<ProbeResult> results;
+  int first_too_big = 0;
+  for (int batch = FLAGS_min_batch; batch <= FLAGS_max_batch; batch *= 2) {
+    if (!PredictedToFit(results, batch, budget)) {
+      first_too_big = batch;
+      break;
+    }
+    ProbeResult result = Probe(base, batch);
+    result.fits = budget == 0 || result.bytes <= budget;
+    LOG(INFO) << "batch " << result.batch << ": " << result.images_per_s
+              << " images/s, " << (result.bytes >> 20) << " MB"
+              << (result.fits ? "" : " (over budget)");
+    results.push_back(result);
+    if (!result.fits) {
+      first_too_big = batch;
+      results.pop_back();
+      break;
+    }
+  }
+  CHECK(!results.empty())
+      << "Even batch " << FLAGS_min_batch << " exceeds the budget.";
+
+  // Refinement: bisect between the largest batch that fit and the first
+  // that did not, growing the largest-that-fits answer. A handful of
+  // probes narrows the gap to a few percent of the batch.
+  int largest_fit = results.back().batch;
+  if (first_too_big > 0) {
+    int lo = largest_fit;
+    int hi = first_too_big;
+    for (int probe = 0; probe < 5 && hi - lo > 1; ++probe) {
+      const int mid = lo + (hi - lo) / 2;
+      if (!PredictedToFit(results, mid, budget)) {
+        hi = mid;
+        continue;
+      }
+      ProbeResult result = Probe(base, mid);
+      result.fits = budget == 0 || result.bytes <= budget;
+      LOG(INFO) << "batch " << result.batch << ": " << result.images_per_s
+                << " images/s, " << (result.bytes >> 20) << " MB"
+                << (result.fits ? "" : " (over budget)");
+      if (result.fits) {
+        results.push_back(result);
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    largest_fit = lo;
+  }
+
+  std::sort(results.begin(), results.end(), ProbeBatchLess);
+  int best = 0;
+  for (int i = 1; i < results.size(); ++i) {
+    if (results[i].images_per_s > results[best].images_per_s) {
+      best = i;
+    }
+  }
+
+  std::cout << "batch\timages/s\tmemory_mb\n";
+  for (int i = 0; i < results.size(); ++i) {
+    std::cout << results[i].batch << "\t" << results[i].images_per_s
+              << "\t" << (results[i].bytes >> 20) << "\n";
+  }
+  std::cout << "largest fitting batch: " << largest_fit << "\n";
+  std::cout << "best throughput: batch " << results[best].batch << " ("
+            << results[best].images_per_s << " images/s)\n";
+  return 0;
+}
@@ -1,7 +1,13 @@
 #include <glog/logging.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <cstring>
+#include <iomanip>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -11,6 +17,7 @@ using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
+using caffe::PerfCounters;
 using caffe::shared_ptr;
 using caffe::Timer;
 using caffe::vector;
@@ -29,6 +36,13 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(listen, "",
+    "The unix socket path the daemon command serves inference on.");
+DEFINE_bool(perf_counters, false,
+    "Optional; also sample hardware performance counters (cycles, "
+    "instructions, LLC misses, stalled cycles) per layer in the time "
+    "command. Linux only; counters measure the host thread, so the "
+    "numbers are most meaningful in CPU mode.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -124,6 +138,166 @@ int train() {
 RegisterBrewFunction(train);
 
 
+// Serve the master copy of the weights to distributed workers.
+int param_server() {
+  CHECK_GT(FLAGS_solver.size(), 0) << "Need a solver definition to serve.";
+
+  caffe::SolverParameter solver_param;
+  caffe::ReadProtoFromTextFileOrDie(FLAGS_solver, &solver_param);
+  CHECK(solver_param.has_param_server())
+      << "The solver definition must name a param_server address.";
+
+  // The master copy lives in host memory and is updated with a handful of
+  // axpys per push; no GPU is involved.
+  Caffe::set_mode(Caffe::CPU);
+  shared_ptr<caffe::Solver<float> >
+    solver(caffe::GetSolver<float>(solver_param));
+  if (FLAGS_weights.size()) {
+    LOG(INFO) << "Serving weights initialized from " << FLAGS_weights;
+    solver->net()->CopyTrainedLayersFrom(FLAGS_weights);
+  }
+
+  const int port = caffe::ParamServerPort(solver_param.param_server());
+  caffe::ParamServer<float> server(solver->net()->params(), solver_param,
+      port);
+  server.Run();
+  return 0;
+}
+RegisterBrewFunction(param_server);
+
+
+// Wire protocol for the daemon command, mirroring the parameter-server
+// framing: a fixed header, then a raw payload. Clients send FORWARD with
+// the input blobs' float data concatenated in input_blobs() order (or an
+// empty payload to let the net's own data layers -- e.g. an image-list
+// source -- supply a batch), and get one OUTPUT back with the output
+// blobs concatenated the same way.
+const uint32_t kDaemonMsgMagic = 0x0caffeda;
+enum DaemonMsgType {
+  DAEMON_MSG_FORWARD = 0,   // client -> daemon: run one batch
+  DAEMON_MSG_OUTPUT = 1,    // daemon -> client: that batch's outputs
+  DAEMON_MSG_BYE = 2,       // client -> daemon: orderly leave
+  DAEMON_MSG_SHUTDOWN = 3   // client -> daemon: leave and stop serving
+};
+struct DaemonMsgHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t bytes;  // payload size following the header
+};
+
+// Serve one client until it leaves; returns false when it asked for the
+// daemon to shut down.
+static bool daemon_serve_client(caffe::SocketTransport* transport,
+    Net<float>* net) {
+  const vector<Blob<float>*>& input_blobs = net->input_blobs();
+  size_t input_bytes = 0;
+  for (int i = 0; i < input_blobs.size(); ++i) {
+    input_bytes += input_blobs[i]->count() * sizeof(float);
+  }
+  while (true) {
+    DaemonMsgHeader header;
+    if (!transport->Recv(&header, sizeof(header))) {
+      return true;  // client went away between requests
+    }
+    CHECK_EQ(header.magic, kDaemonMsgMagic) << "Corrupt daemon message";
+    switch (header.type) {
+    case DAEMON_MSG_FORWARD: {
+      CHECK(header.bytes == 0 || header.bytes == input_bytes)
+          << "Daemon request payload of " << header.bytes << " bytes does "
+          << "not match the net's input size of " << input_bytes;
+      if (header.bytes > 0) {
+        for (int i = 0; i < input_blobs.size(); ++i) {
+          CHECK(transport->Recv(input_blobs[i]->mutable_cpu_data(),
+              input_blobs[i]->count() * sizeof(float)))
+              << "Client closed the connection mid-request";
+        }
+      }
+      const vector<Blob<float>*>& output_blobs = net->ForwardPrefilled();
+      DaemonMsgHeader reply;
+      reply.magic = kDaemonMsgMagic;
+      reply.type = DAEMON_MSG_OUTPUT;
+      reply.bytes = 0;
+      for (int i = 0; i < output_blobs.size(); ++i) {
+        reply.bytes += output_blobs[i]->count() * sizeof(float);
+      }
+      transport->Send(&reply, sizeof(reply));
+      for (int i = 0; i < output_blobs.size(); ++i) {
+        transport->Send(output_blobs[i]->cpu_data(),
+            output_blobs[i]->count() * sizeof(float));
+      }
+      break;
+    }
+    case DAEMON_MSG_BYE:
+      return true;
+    case DAEMON_MSG_SHUTDOWN:
+      return false;
+    default:
+      LOG(FATAL) << "Unknown daemon message type " << header.type;
+    }
+  }
+}
+
+// Daemon: load a model once, then serve inference over a unix socket.
+// The GPU context, weights and warmed allocations all persist between
+// requests, so repeated invocations skip the ~seconds of startup a fresh
+// process pays. Clients are served one at a time; batches from one
+// connection stream back as soon as each forward pass finishes.
+int daemon() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to serve.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to serve.";
+  CHECK_GT(FLAGS_listen.size(), 0)
+      << "Need a -listen unix socket path to serve on.";
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  // Instantiate the caffe net.
+  Caffe::set_phase(Caffe::TEST);
+  Net<float> caffe_net(FLAGS_model);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  // Run one pass now so allocation and autotuning happen before the
+  // first request instead of inside its latency.
+  LOG(INFO) << "Warming up";
+  caffe_net.ForwardPrefilled();
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd, 0) << "Daemon socket failed: " << strerror(errno);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  CHECK_LT(FLAGS_listen.size(), sizeof(addr.sun_path))
+      << "Unix socket path too long: " << FLAGS_listen;
+  strncpy(addr.sun_path, FLAGS_listen.c_str(), sizeof(addr.sun_path) - 1);
+  // A previous daemon's socket file would make bind fail; replace it.
+  unlink(FLAGS_listen.c_str());
+  CHECK_GE(bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+      sizeof(addr)), 0)
+      << "Daemon could not bind " << FLAGS_listen << ": " << strerror(errno);
+  CHECK_GE(listen(listen_fd, 8), 0)
+      << "Daemon listen failed: " << strerror(errno);
+  LOG(INFO) << "Daemon serving " << FLAGS_model << " on " << FLAGS_listen;
+
+  bool serving = true;
+  while (serving) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    CHECK_GE(fd, 0) << "Daemon accept failed: " << strerror(errno);
+    caffe::SocketTransport transport(fd);
+    serving = daemon_serve_client(&transport, &caffe_net);
+  }
+  close(listen_fd);
+  unlink(FLAGS_listen.c_str());
+  LOG(INFO) << "Daemon shut down.";
+  return 0;
+}
+RegisterBrewFunction(daemon);
+
+
 // Test: score a model.
 int test() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to score.";
@@ -191,6 +365,24 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Formats the counter values latched by the last Start/Stop interval;
+// totals over the timed loop, with rate metrics alongside.
+static caffe::string CounterSummary(const PerfCounters& counters) {
+  const uint64_t cycles = counters.Value(PerfCounters::CYCLES);
+  std::ostringstream stream;
+  stream << cycles << " cycles";
+  if (cycles > 0) {
+    stream << ", " << std::setprecision(3)
+        << static_cast<double>(counters.Value(PerfCounters::INSTRUCTIONS))
+            / cycles << " insn/cycle, "
+        << counters.Value(PerfCounters::LLC_MISSES) << " LLC misses, "
+        << std::setprecision(3)
+        << 100. * counters.Value(PerfCounters::STALLED_CYCLES) / cycles
+        << "% stalled";
+  }
+  return stream.str();
+}
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
@@ -226,6 +418,14 @@ int time() {
       caffe_net.bottom_need_backward();
   LOG(INFO) << "*** Benchmark begins ***";
   LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
+  shared_ptr<PerfCounters> counters;
+  if (FLAGS_perf_counters) {
+    counters.reset(new PerfCounters());
+    if (!counters->available()) {
+      // The constructor has already logged why.
+      counters.reset();
+    }
+  }
   Timer total_timer;
   total_timer.Start();
   Timer forward_timer;
@@ -234,14 +434,19 @@ int time() {
   for (int i = 0; i < layers.size(); ++i) {
     const caffe::string& layername = layers[i]->layer_param().name();
     timer.Start();
+    if (counters) { counters->Start(); }
     for (int j = 0; j < FLAGS_iterations; ++j) {
       // Although Reshape should be essentially free, we include it here
       // so that we will notice Reshape performance bugs.
       layers[i]->Reshape(bottom_vecs[i], &top_vecs[i]);
       layers[i]->Forward(bottom_vecs[i], &top_vecs[i]);
     }
+    if (counters) { counters->Stop(); }
     LOG(INFO) << layername << "\tforward: " << timer.MilliSeconds() <<
         " milliseconds.";
+    if (counters) {
+      LOG(INFO) << "    " << CounterSummary(*counters);
+    }
   }
   LOG(INFO) << "Forward pass: " << forward_timer.MilliSeconds() <<
       " milliseconds.";
@@ -250,12 +455,17 @@ int time() {
   for (int i = layers.size() - 1; i >= 0; --i) {
     const caffe::string& layername = layers[i]->layer_param().name();
     timer.Start();
+    if (counters) { counters->Start(); }
     for (int j = 0; j < FLAGS_iterations; ++j) {
       layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
                           &bottom_vecs[i]);
     }
+    if (counters) { counters->Stop(); }
     LOG(INFO) << layername << "\tbackward: "
         << timer.MilliSeconds() << " milliseconds.";
+    if (counters) {
+      LOG(INFO) << "    " << CounterSummary(*counters);
+    }
   }
   LOG(INFO) << "Backward pass: " << backward_timer.MilliSeconds() <<
       " milliseconds.";
@@ -275,6 +485,7 @@ int main(int argc, char** argv) {
       "commands:\n"
       "  train           train or finetune a model\n"
       "  test            score a model\n"
+      "  daemon          serve warm inference over a unix socket\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
   // Run tool or show usage.
@@ -0,0 +1,82 @@
+// This program records the input ranges needed by the INT8 inference path
+// (see QuantizationParameter). It runs a number of forward passes over the
+// given net, tracks the maximum absolute input value of every Convolution
+// and InnerProduct layer, and writes out a copy of the net definition with
+// quantization_param filled in for those layers.
+// Usage:
+//    calibrate_net net_proto trained_model num_iterations out_net_proto
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: calibrate_net net_proto trained_model "
+        << "num_iterations out_net_proto";
+    return 1;
+  }
+
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+
+  Net<float> caffe_net(argv[1]);
+  caffe_net.CopyTrainedLayersFrom(argv[2]);
+  const int iterations = atoi(argv[3]);
+  CHECK_GT(iterations, 0) << "num_iterations must be positive";
+
+  // Track the largest absolute input seen by each quantizable layer.
+  map<string, float> input_ranges;
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  const vector<string>& layer_names = caffe_net.layer_names();
+  LOG(INFO) << "Running " << iterations << " calibration iterations";
+  for (int iter = 0; iter < iterations; ++iter) {
+    caffe_net.ForwardPrefilled();
+    for (int i = 0; i < layers.size(); ++i) {
+      const LayerParameter_LayerType type = layers[i]->type();
+      if (type != LayerParameter_LayerType_CONVOLUTION &&
+          type != LayerParameter_LayerType_INNER_PRODUCT) {
+        continue;
+      }
+      const Blob<float>* bottom = caffe_net.bottom_vecs()[i][0];
+      const float* data = bottom->cpu_data();
+      float max_abs = input_ranges[layer_names[i]];
+      for (int j = 0; j < bottom->count(); ++j) {
+        max_abs = std::max(max_abs, std::fabs(data[j]));
+      }
+      input_ranges[layer_names[i]] = max_abs;
+    }
+  }
+
+  // Write the net definition back out with the calibrated ranges.
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  int num_calibrated = 0;
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    LayerParameter* layer_param = net_param.mutable_layers(i);
+    map<string, float>::const_iterator it =
+        input_ranges.find(layer_param->name());
+    if (it == input_ranges.end() || it->second <= 0) {
+      continue;
+    }
+    layer_param->mutable_quantization_param()->set_quantize(true);
+    layer_param->mutable_quantization_param()->set_input_range(it->second);
+    LOG(INFO) << "Layer " << layer_param->name()
+        << ": input_range " << it->second;
+    ++num_calibrated;
+  }
+  WriteProtoToTextFile(net_param, argv[4]);
+  LOG(INFO) << "Calibrated " << num_calibrated << " layers; wrote "
+      << argv[4];
+  return 0;
+}
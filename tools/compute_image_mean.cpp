@@ -1,26 +1,118 @@
+// Computes the per-pixel mean of a leveldb/lmdb image database.
+//
+// Usage:
+//   compute_image_mean [FLAGS] input_db output_file [db_backend]
+//
+// The database cursor is walked serially (neither backend allows a shared
+// cursor), staging raw values in chunks that --threads workers parse and
+// accumulate into private partial sums, merged once at the end. Pass
+// --sample=N to accumulate only every Nth image for a quick approximate
+// mean.
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <leveldb/db.h>
 #include <lmdb.h>
 #include <stdint.h>
 
+#include <boost/thread.hpp>
+
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
 
 using caffe::Datum;
 using caffe::BlobProto;
+using caffe::shared_ptr;
 using std::string;
 using std::max;
+using std::vector;
+
+DEFINE_int32(threads, 1, "Number of parallel accumulation threads");
+DEFINE_int32(sample, 1,
+    "Accumulate every Nth image, for a quick approximate mean");
+
+namespace {
+
+// How many staged images one round of workers accumulates.
+const int kChunkSize = 1024;
+
+// One staged datum: a pointer/size pair that either aliases the LMDB
+// memory map directly (the read transaction pins the pages) or a string
+// staged from leveldb.
+struct RawValue {
+  const void* data;
+  size_t size;
+};
+
+// Context handed to one accumulation worker: the worker owns the strided
+// slice {first, first + stride, ...} of the staged chunk and its own
+// partial sum buffer, so no locking is needed.
+struct SumContext {
+  const vector<RawValue>* values;
+  int num_values;
+  int first;
+  int stride;
+  int data_size;
+  double* partial;
+};
+
+// Parses and accumulates the items assigned to one worker.
+void SumEntry(SumContext* context) {
+  Datum datum;
+  double* partial = context->partial;
+  const int data_size = context->data_size;
+  for (int i = context->first; i < context->num_values;
+       i += context->stride) {
+    const RawValue& value = (*context->values)[i];
+    CHECK(datum.ParseFromArray(value.data, value.size));
+    if (datum.encoded()) {
+      caffe::DecodeDatum(&datum);
+    }
+    const string& data = datum.data();
+    const int size_in_datum = max<int>(data.size(), datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size "
+        << size_in_datum;
+    if (data.size() != 0) {
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+      // Plain index arithmetic over raw arrays, so the compiler can
+      // vectorize the uint8 -> double accumulation.
+      for (int j = 0; j < data_size; ++j) {
+        partial[j] += bytes[j];
+      }
+    } else {
+      for (int j = 0; j < data_size; ++j) {
+        partial[j] += datum.float_data(j);
+      }
+    }
+  }
+}
+
+}  // namespace
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compute the per-pixel mean of a leveldb/lmdb\n"
+        "image database.\n"
+        "Usage:\n"
+        "    compute_image_mean [FLAGS] input_db output_file"
+        " [db_backend: leveldb or lmdb]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
   if (argc < 3 || argc > 4) {
-    LOG(ERROR) << "Usage: compute_image_mean input_db output_file"
-               << " db_backend[leveldb or lmdb]";
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
+  const int num_threads = max(1, FLAGS_threads);
+  const int sample = max(1, FLAGS_sample);
 
   string db_backend = "lmdb";
   if (argc == 4) {
@@ -78,78 +170,107 @@ int main(int argc, char** argv) {
   } else {
     LOG(FATAL) << "Unknown db backend " << db_backend;
   }
+  if (datum.encoded()) {
+    CHECK(caffe::DecodeDatum(&datum));
+  }
 
   sum_blob.set_num(1);
   sum_blob.set_channels(datum.channels());
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
+  const int size_in_datum = std::max<int>(datum.data().size(),
+                                          datum.float_data_size());
+  CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size "
+      << size_in_datum;
+
+  // Per-thread partial sums, merged after the walk.
+  vector<vector<double> > partials(num_threads,
+      vector<double>(size_in_datum, 0.));
+
   LOG(INFO) << "Starting Iteration";
-  if (db_backend == "leveldb") {  // leveldb
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      // just a dummy operation
-      datum.ParseFromString(it->value().ToString());
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
-    }
-  } else if (db_backend == "lmdb") {  // lmdb
+  vector<RawValue> raw_values(kChunkSize);
+  vector<string> leveldb_values(kChunkSize);
+  bool cursor_valid = true;
+  int visited = 0;
+  if (db_backend == "leveldb") {
+    it->SeekToFirst();
+    cursor_valid = it->Valid();
+  } else {
     CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
         MDB_SUCCESS);
-    do {
-      // just a dummy operation
-      datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
+  }
+  while (cursor_valid) {
+    // Stage a chunk of raw values; only the cursor walk is serial.
+    int num_staged = 0;
+    while (cursor_valid && num_staged < kChunkSize) {
+      if (visited % sample == 0) {
+        if (db_backend == "leveldb") {
+          leveldb_values[num_staged].assign(it->value().data(),
+              it->value().size());
+          raw_values[num_staged].data = leveldb_values[num_staged].data();
+          raw_values[num_staged].size = leveldb_values[num_staged].size();
+        } else {
+          raw_values[num_staged].data = mdb_value.mv_data;
+          raw_values[num_staged].size = mdb_value.mv_size;
         }
+        ++num_staged;
+      }
+      ++visited;
+      if (db_backend == "leveldb") {
+        it->Next();
+        cursor_valid = it->Valid();
       } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
+        cursor_valid = (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value,
+            MDB_NEXT) == MDB_SUCCESS);
       }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
+    }
+    if (num_staged == 0) {
+      break;
+    }
+    // Accumulate the chunk across the workers.
+    if (num_threads == 1) {
+      SumContext context;
+      context.values = &raw_values;
+      context.num_values = num_staged;
+      context.first = 0;
+      context.stride = 1;
+      context.data_size = data_size;
+      context.partial = &partials[0][0];
+      SumEntry(&context);
+    } else {
+      vector<SumContext> contexts(num_threads);
+      vector<shared_ptr<boost::thread> > threads(num_threads);
+      for (int t = 0; t < num_threads; ++t) {
+        contexts[t].values = &raw_values;
+        contexts[t].num_values = num_staged;
+        contexts[t].first = t;
+        contexts[t].stride = num_threads;
+        contexts[t].data_size = data_size;
+        contexts[t].partial = &partials[t][0];
+        threads[t].reset(new boost::thread(&SumEntry, &contexts[t]));
       }
-    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
-        == MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+      for (int t = 0; t < num_threads; ++t) {
+        threads[t]->join();
+      }
+    }
+    count += num_staged;
+    if (count / 10000 != (count - num_staged) / 10000) {
+      LOG(ERROR) << "Processed " << count << " files.";
+    }
   }
 
   if (count % 10000 != 0) {
     LOG(ERROR) << "Processed " << count << " files.";
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  CHECK_GT(count, 0) << "No images accumulated";
+  // Merge the partial sums and divide.
+  for (int i = 0; i < size_in_datum; ++i) {
+    double sum = 0;
+    for (int t = 0; t < num_threads; ++t) {
+      sum += partials[t][i];
+    }
+    sum_blob.add_data(sum / count);
   }
   // Write to disk
   LOG(INFO) << "Write to " << argv[2];
@@ -7,6 +7,10 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// Decoding runs on --threads parallel workers that feed one writer thread
+// through a bounded queue, and the output can be split into --shards
+// databases (DB_NAME_shard00, DB_NAME_shard01, ...) for parallel readers.
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -15,7 +19,10 @@
 #include <lmdb.h>
 #include <sys/stat.h>
 
+#include <boost/thread.hpp>
+
 #include <algorithm>
+#include <deque>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
@@ -26,6 +33,7 @@
 #include "caffe/util/rng.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
+using std::deque;
 using std::pair;
 using std::string;
 
@@ -36,6 +44,212 @@ DEFINE_bool(shuffle, false,
 DEFINE_string(backend, "lmdb", "The backend for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_int32(threads, 1, "Number of parallel image decoding threads");
+DEFINE_int32(shards, 1, "Number of output database shards");
+DEFINE_bool(encoded, false,
+    "When this option is on, store the original encoded file bytes "
+    "(JPEG/PNG) instead of raw pixels; the data layer decodes at read time");
+
+namespace {
+
+const int kMaxKeyLength = 256;
+const int kCommitEvery = 1000;
+// At most this many serialized images wait for the writer, so decoding
+// cannot run arbitrarily far ahead of the disk.
+const size_t kQueueCapacity = 256;
+
+// One decoded and serialized image, handed from a decoder to the writer.
+struct DatumRecord {
+  int line_id;
+  string key;
+  string value;
+  int data_size;
+};
+
+// Bounded multi-producer single-consumer handoff queue. pop returns NULL
+// once every producer has finished and the queue has drained.
+class RecordQueue {
+ public:
+  explicit RecordQueue(const size_t capacity)
+      : capacity_(capacity), producers_(0) {}
+
+  void add_producer() {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++producers_;
+  }
+
+  void remove_producer() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (--producers_ == 0) {
+      cond_not_empty_.notify_all();
+    }
+  }
+
+  void push(DatumRecord* record) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (records_.size() >= capacity_) {
+      cond_not_full_.wait(lock);
+    }
+    records_.push_back(record);
+    cond_not_empty_.notify_one();
+  }
+
+  DatumRecord* pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (records_.empty() && producers_ > 0) {
+      cond_not_empty_.wait(lock);
+    }
+    if (records_.empty()) {
+      return NULL;
+    }
+    DatumRecord* record = records_.front();
+    records_.pop_front();
+    cond_not_full_.notify_one();
+    return record;
+  }
+
+ private:
+  deque<DatumRecord*> records_;
+  const size_t capacity_;
+  int producers_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_not_empty_;
+  boost::condition_variable cond_not_full_;
+};
+
+// Decodes and serializes the strided slice {first, first + stride, ...} of
+// the input list. Keys embed the global line id, so the database contents
+// do not depend on the thread count.
+void DecodeEntry(const vector<pair<string, int> >* lines,
+    const string root_folder, const int first, const int stride,
+    const int resize_height, const int resize_width, const bool is_color,
+    const bool encoded, RecordQueue* queue) {
+  Datum datum;
+  char key_cstr[kMaxKeyLength];
+  for (int line_id = first; line_id < lines->size(); line_id += stride) {
+    const string filename = root_folder + (*lines)[line_id].first;
+    const int label = (*lines)[line_id].second;
+    // In encoded mode we only stage the original file bytes; the data
+    // layer decodes them at read time.
+    const bool read_ok = encoded ?
+        ReadFileToDatum(filename, label, &datum) :
+        ReadImageToDatum(filename, label, resize_height, resize_width,
+            is_color, &datum);
+    if (!read_ok) {
+      continue;
+    }
+    DatumRecord* record = new DatumRecord;
+    record->line_id = line_id;
+    snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
+        (*lines)[line_id].first.c_str());
+    record->key = key_cstr;
+    datum.SerializeToString(&record->value);
+    record->data_size = datum.channels() * datum.height() * datum.width();
+    queue->push(record);
+  }
+  queue->remove_producer();
+}
+
+// One output database of either backend, with batched commits.
+struct ShardDb {
+  // lmdb
+  MDB_env* mdb_env;
+  MDB_dbi mdb_dbi;
+  MDB_txn* mdb_txn;
+  // leveldb
+  leveldb::DB* db;
+  leveldb::WriteBatch* batch;
+  int pending;
+};
+
+void OpenShardDb(const string& db_backend, const string& db_path,
+    ShardDb* shard) {
+  shard->pending = 0;
+  if (db_backend == "leveldb") {  // leveldb
+    LOG(INFO) << "Opening leveldb " << db_path;
+    leveldb::Options options;
+    options.error_if_exists = true;
+    options.create_if_missing = true;
+    options.write_buffer_size = 268435456;
+    leveldb::Status status = leveldb::DB::Open(
+        options, db_path, &shard->db);
+    CHECK(status.ok()) << "Failed to open leveldb " << db_path
+        << ". Is it already existing?";
+    shard->batch = new leveldb::WriteBatch();
+  } else if (db_backend == "lmdb") {  // lmdb
+    LOG(INFO) << "Opening lmdb " << db_path;
+    CHECK_EQ(mkdir(db_path.c_str(), 0744), 0)
+        << "mkdir " << db_path << "failed";
+    CHECK_EQ(mdb_env_create(&shard->mdb_env), MDB_SUCCESS)
+        << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(shard->mdb_env, 1099511627776), MDB_SUCCESS)
+        << "mdb_env_set_mapsize failed";  // 1TB
+    CHECK_EQ(mdb_env_open(shard->mdb_env, db_path.c_str(), 0, 0664),
+        MDB_SUCCESS) << "mdb_env_open failed";
+    CHECK_EQ(mdb_txn_begin(shard->mdb_env, NULL, 0, &shard->mdb_txn),
+        MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(shard->mdb_txn, NULL, 0, &shard->mdb_dbi), MDB_SUCCESS)
+        << "mdb_open failed. Does the lmdb already exist?";
+  } else {
+    LOG(FATAL) << "Unknown db backend " << db_backend;
+  }
+}
+
+void CommitShardDb(const string& db_backend, ShardDb* shard) {
+  if (db_backend == "leveldb") {  // leveldb
+    shard->db->Write(leveldb::WriteOptions(), shard->batch);
+    delete shard->batch;
+    shard->batch = new leveldb::WriteBatch();
+  } else if (db_backend == "lmdb") {  // lmdb
+    CHECK_EQ(mdb_txn_commit(shard->mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_commit failed";
+    CHECK_EQ(mdb_txn_begin(shard->mdb_env, NULL, 0, &shard->mdb_txn),
+        MDB_SUCCESS) << "mdb_txn_begin failed";
+  } else {
+    LOG(FATAL) << "Unknown db backend " << db_backend;
+  }
+  shard->pending = 0;
+}
+
+void PutShardDb(const string& db_backend, ShardDb* shard,
+    const string& keystr, string* value) {
+  if (db_backend == "leveldb") {  // leveldb
+    shard->batch->Put(keystr, *value);
+  } else if (db_backend == "lmdb") {  // lmdb
+    MDB_val mdb_key, mdb_data;
+    mdb_data.mv_size = value->size();
+    mdb_data.mv_data = reinterpret_cast<void*>(&(*value)[0]);
+    mdb_key.mv_size = keystr.size();
+    mdb_key.mv_data = const_cast<void*>(
+        reinterpret_cast<const void*>(keystr.data()));
+    CHECK_EQ(mdb_put(shard->mdb_txn, shard->mdb_dbi, &mdb_key, &mdb_data, 0),
+        MDB_SUCCESS) << "mdb_put failed";
+  } else {
+    LOG(FATAL) << "Unknown db backend " << db_backend;
+  }
+  if (++shard->pending >= kCommitEvery) {
+    CommitShardDb(db_backend, shard);
+  }
+}
+
+void CloseShardDb(const string& db_backend, ShardDb* shard) {
+  if (shard->pending > 0) {
+    CommitShardDb(db_backend, shard);
+  }
+  if (db_backend == "leveldb") {  // leveldb
+    delete shard->batch;
+    delete shard->db;
+  } else if (db_backend == "lmdb") {  // lmdb
+    CHECK_EQ(mdb_txn_commit(shard->mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_commit failed";
+    mdb_close(shard->mdb_env, shard->mdb_dbi);
+    mdb_env_close(shard->mdb_env);
+  } else {
+    LOG(FATAL) << "Unknown db backend " << db_backend;
+  }
+}
+
+}  // namespace
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -57,9 +271,9 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  bool is_color = !FLAGS_gray;
+  const bool is_color = !FLAGS_gray;
   std::ifstream infile(argv[2]);
-  std::vector<std::pair<string, int> > lines;
+  vector<pair<string, int> > lines;
   string filename;
   int label;
   while (infile >> filename >> label) {
@@ -73,123 +287,75 @@ int main(int argc, char** argv) {
   LOG(INFO) << "A total of " << lines.size() << " images.";
 
   const string& db_backend = FLAGS_backend;
-  const char* db_path = argv[3];
-
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const string db_path(argv[3]);
 
-  // Open new db
-  // lmdb
-  MDB_env *mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_data;
-  MDB_txn *mdb_txn;
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  leveldb::WriteBatch* batch = NULL;
+  const int resize_height = std::max<int>(0, FLAGS_resize_height);
+  const int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const int num_threads = std::max(1, FLAGS_threads);
+  const int num_shards = std::max(1, FLAGS_shards);
+  const bool encoded = FLAGS_encoded;
+  if (encoded) {
+    CHECK_EQ(resize_height, 0)
+        << "--encoded stores the original file bytes and cannot resize";
+    CHECK_EQ(resize_width, 0)
+        << "--encoded stores the original file bytes and cannot resize";
+    CHECK(is_color) << "--gray cannot be combined with --encoded";
+  }
 
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << db_path;
-    leveldb::Status status = leveldb::DB::Open(
-        options, db_path, &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << db_path
-        << ". Is it already existing?";
-    batch = new leveldb::WriteBatch();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << db_path;
-    CHECK_EQ(mkdir(db_path, 0744), 0)
-        << "mkdir " << db_path << "failed";
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
-        << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(mdb_env, db_path, 0, 0664), MDB_SUCCESS)
-        << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed. Does the lmdb already exist?";
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  // Open the output shard(s). Records go to shard line_id % shards, so
+  // every shard sees an even slice of the (possibly shuffled) list.
+  vector<ShardDb> shards(num_shards);
+  for (int s = 0; s < num_shards; ++s) {
+    string shard_path = db_path;
+    if (num_shards > 1) {
+      char shard_suffix[kMaxKeyLength];
+      snprintf(shard_suffix, kMaxKeyLength, "_shard%02d", s);
+      shard_path += shard_suffix;
+    }
+    OpenShardDb(db_backend, shard_path, &shards[s]);
   }
 
-  // Storing to db
+  // Start the decoder pool; the main thread is the single writer.
+  RecordQueue queue(kQueueCapacity);
   string root_folder(argv[1]);
-  Datum datum;
+  vector<shared_ptr<boost::thread> > decoders(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    queue.add_producer();
+    decoders[t].reset(new boost::thread(&DecodeEntry, &lines, root_folder,
+        t, num_threads, resize_height, resize_width, is_color, encoded,
+        &queue));
+  }
+
   int count = 0;
-  const int kMaxKeyLength = 256;
-  char key_cstr[kMaxKeyLength];
-  int data_size;
+  int data_size = 0;
   bool data_size_initialized = false;
-
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    if (!ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color, &datum)) {
-      continue;
-    }
-    if (!data_size_initialized) {
-      data_size = datum.channels() * datum.height() * datum.width();
-      data_size_initialized = true;
-    } else {
-      const string& data = datum.data();
-      CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-          << data.size();
-    }
-    // sequential
-    snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
-    string value;
-    datum.SerializeToString(&value);
-    string keystr(key_cstr);
-
-    // Put in db
-    if (db_backend == "leveldb") {  // leveldb
-      batch->Put(keystr, value);
-    } else if (db_backend == "lmdb") {  // lmdb
-      mdb_data.mv_size = value.size();
-      mdb_data.mv_data = reinterpret_cast<void*>(&value[0]);
-      mdb_key.mv_size = keystr.size();
-      mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
-      CHECK_EQ(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0), MDB_SUCCESS)
-          << "mdb_put failed";
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
-
-    if (++count % 1000 == 0) {
-      // Commit txn
-      if (db_backend == "leveldb") {  // leveldb
-        db->Write(leveldb::WriteOptions(), batch);
-        delete batch;
-        batch = new leveldb::WriteBatch();
-      } else if (db_backend == "lmdb") {  // lmdb
-        CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_commit failed";
-        CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
+  DatumRecord* record;
+  while ((record = queue.pop()) != NULL) {
+    // Encoded records vary in size by nature, so only raw pixels are
+    // checked for a consistent data field size.
+    if (!encoded) {
+      if (!data_size_initialized) {
+        data_size = record->data_size;
+        data_size_initialized = true;
       } else {
-        LOG(FATAL) << "Unknown db backend " << db_backend;
+        CHECK_EQ(record->data_size, data_size) << "Incorrect data field size "
+            << record->data_size;
       }
+    }
+    PutShardDb(db_backend, &shards[record->line_id % num_shards],
+        record->key, &record->value);
+    delete record;
+    if (++count % 1000 == 0) {
       LOG(ERROR) << "Processed " << count << " files.";
     }
   }
-  // write the last batch
+  for (int t = 0; t < num_threads; ++t) {
+    decoders[t]->join();
+  }
+  for (int s = 0; s < num_shards; ++s) {
+    CloseShardDb(db_backend, &shards[s]);
+  }
   if (count % 1000 != 0) {
-    if (db_backend == "leveldb") {  // leveldb
-      db->Write(leveldb::WriteOptions(), batch);
-      delete batch;
-      delete db;
-    } else if (db_backend == "lmdb") {  // lmdb
-      CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-      mdb_close(mdb_env, mdb_dbi);
-      mdb_env_close(mdb_env);
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
     LOG(ERROR) << "Processed " << count << " files.";
   }
   return 0;
@@ -0,0 +1,27 @@
+// This is a script to convert a binary proto model (.caffemodel) into the
+// memory-mappable container loaded by Net::MapTrainedLayersFrom.
+// Usage:
+//    convert_model_to_mmap net_proto_file_in mmap_model_file_out
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mmap_model.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_model_to_mmap net_proto_file_in mmap_model_file_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[1], &net_param);
+  WriteNetParamsToMMapFile(net_param, argv[2]);
+
+  LOG(ERROR) << "Wrote mmap model to " << argv[2];
+  return 0;
+}
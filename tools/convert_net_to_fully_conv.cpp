@@ -0,0 +1,160 @@
+// This program rewrites the InnerProduct layers of a trained classifier
+// into equivalent Convolution layers, turning the net fully convolutional
+// so it can be run densely over inputs larger than the training crop:
+// every sliding-window position then shares the overlapping computation
+// instead of re-running the net per crop. An InnerProduct layer whose
+// bottom has shape C x H x W becomes an H x W convolution with the same
+// number of outputs; later InnerProduct layers become 1 x 1 convolutions.
+// The weight matrices are reshaped in place -- the InnerProduct
+// flattening order matches the convolution weight layout, so no data
+// moves. Enlarge the input_dim of the emitted definition to the desired
+// image size; the output then carries one score map per class. Note that
+// a trailing Softmax still normalizes over the whole C x H x W extent,
+// so apply it per spatial position outside the net (or argmax the score
+// maps directly).
+// Usage:
+//    convert_net_to_fully_conv net_proto_in trained_model \
+//        net_proto_out trained_model_out
+// net_proto_in must declare its input dimensions (a deploy definition),
+// which anchor the kernel sizes of the converted layers.
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+// The bottom shape an InnerProduct layer sees, recorded while walking
+// the instantiated net; it fixes the converted kernel geometry.
+struct BottomShape {
+  int channels;
+  int height;
+  int width;
+};
+
+// Rewrites the InnerProduct layer src into the equivalent Convolution
+// layer: kernel spanning the full bottom extent, same outputs and bias.
+// Weight blobs are only emitted when src carries them, so the same
+// helper rewrites both the definition and the trained model.
+static void ConvertInnerProduct(const LayerParameter& src,
+    const BottomShape& shape, LayerParameter* dst) {
+  dst->CopyFrom(src);
+  dst->set_type(LayerParameter_LayerType_CONVOLUTION);
+  dst->clear_inner_product_param();
+  ConvolutionParameter* conv_param = dst->mutable_convolution_param();
+  conv_param->set_num_output(src.inner_product_param().num_output());
+  conv_param->set_bias_term(src.inner_product_param().bias_term());
+  if (shape.height == shape.width) {
+    conv_param->set_kernel_size(shape.height);
+  } else {
+    conv_param->set_kernel_h(shape.height);
+    conv_param->set_kernel_w(shape.width);
+  }
+  // Any calibrated range was collected for the InnerProduct kernel; the
+  // converted layer needs recalibration before INT8 deployment.
+  dst->clear_quantization_param();
+  dst->clear_blobs();
+  if (src.blobs_size() > 0) {
+    const int num_output = src.blobs(0).height();
+    const int fan_in = src.blobs(0).width();
+    CHECK_EQ(fan_in, shape.channels * shape.height * shape.width)
+        << "Layer " << src.name() << ": weight fan-in " << fan_in
+        << " does not match its bottom shape " << shape.channels << "x"
+        << shape.height << "x" << shape.width;
+    // The InnerProduct rows are already laid out in (c, h, w) order, so
+    // the convolution weights are a pure reshape of the same data.
+    BlobProto* weight = dst->add_blobs();
+    weight->CopyFrom(src.blobs(0));
+    weight->set_num(num_output);
+    weight->set_channels(shape.channels);
+    weight->set_height(shape.height);
+    weight->set_width(shape.width);
+    if (src.blobs_size() > 1) {
+      dst->add_blobs()->CopyFrom(src.blobs(1));
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: convert_net_to_fully_conv net_proto_in "
+        << "trained_model net_proto_out trained_model_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  CHECK_GT(net_param.input_dim_size(), 0)
+      << "The net definition must declare input dimensions";
+
+  // Instantiate the net to recover the bottom shape of every
+  // InnerProduct layer; the shapes fix the converted kernel sizes.
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(net_param);
+  std::map<std::string, BottomShape> shapes;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    if (net.layers()[i]->type() != LayerParameter_LayerType_INNER_PRODUCT) {
+      continue;
+    }
+    const Blob<float>* bottom = net.bottom_vecs()[i][0];
+    BottomShape& shape = shapes[net.layer_names()[i]];
+    shape.channels = bottom->channels();
+    shape.height = bottom->height();
+    shape.width = bottom->width();
+  }
+  CHECK(!shapes.empty()) << "No InnerProduct layers in " << argv[1];
+
+  // Rewrite the net definition.
+  NetParameter net_out(net_param);
+  net_out.clear_layers();
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    const LayerParameter& layer = net_param.layers(i);
+    std::map<std::string, BottomShape>::const_iterator it =
+        shapes.find(layer.name());
+    if (it == shapes.end()) {
+      net_out.add_layers()->CopyFrom(layer);
+    } else {
+      ConvertInnerProduct(layer, it->second, net_out.add_layers());
+    }
+  }
+  WriteProtoToTextFile(net_out, argv[3]);
+
+  // Rewrite the trained model with the same conversion, remapping the
+  // weight blobs.
+  NetParameter model;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &model);
+  NetParameter model_out(model);
+  model_out.clear_layers();
+  int converted = 0;
+  for (int i = 0; i < model.layers_size(); ++i) {
+    const LayerParameter& layer = model.layers(i);
+    std::map<std::string, BottomShape>::const_iterator it =
+        shapes.find(layer.name());
+    if (it == shapes.end()) {
+      model_out.add_layers()->CopyFrom(layer);
+      continue;
+    }
+    CHECK_EQ(layer.type(), LayerParameter_LayerType_INNER_PRODUCT)
+        << "Layer " << layer.name() << " is not an InnerProduct layer "
+        << "in " << argv[2];
+    const BottomShape& shape = it->second;
+    LOG(INFO) << "Layer " << layer.name() << ": InnerProduct -> "
+        << shape.height << "x" << shape.width << " Convolution over "
+        << shape.channels << " channels";
+    ConvertInnerProduct(layer, shape, model_out.add_layers());
+    ++converted;
+  }
+  CHECK_EQ(converted, shapes.size())
+      << "Not all InnerProduct layers of " << argv[1] << " were found in "
+      << argv[2];
+  WriteProtoToBinaryFile(model_out, argv[4]);
+
+  LOG(INFO) << "Converted " << converted << " layers; wrote " << argv[3]
+      << " and " << argv[4];
+  return 0;
+}
@@ -0,0 +1,128 @@
+// Benchmark the data pipeline without running a solver: instantiate the
+// layers of a prototxt (normally just the data layers) and drive Forward in
+// a tight loop, reporting images/s and where the prefetch thread spends its
+// time (database read vs. datum decode vs. transform). Use it to size
+// decode_threads, prefetch depth and storage before launching training jobs.
+//
+// Usage:
+//    data_benchmark --model=data.prototxt [--gpu=0] [--warmup=4]
+//        [--iterations=100] [--phase=TRAIN]
+//
+// Any non-data layers in the prototxt also run inside the consumer loop, so
+// keep the net down to the layers whose pipeline is being measured.
+
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/data_layers.hpp"
+
+using caffe::BasePrefetchingDataLayer;
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Layer;
+using caffe::Net;
+using caffe::Timer;
+using caffe::shared_ptr;
+using caffe::string;
+using caffe::vector;
+
+DEFINE_string(model, "",
+    "The model definition protocol buffer text file.");
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on given device ID; data layers then fill pinned "
+    "buffers and upload, as during GPU training.");
+DEFINE_int32(warmup, 4,
+    "Unmeasured batches consumed first to drain the startup prefetch.");
+DEFINE_int32(iterations, 100,
+    "The number of measured batches to consume.");
+DEFINE_string(phase, "TRAIN",
+    "Run in TRAIN or TEST phase; the phase decides mirroring and cropping.");
+
+int main(int argc, char** argv) {
+  caffe::GlobalInit(&argc, &argv);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to benchmark.";
+  CHECK_GT(FLAGS_iterations, 0) << "Need at least one measured iteration.";
+  CHECK_GE(FLAGS_warmup, 0);
+  CHECK(FLAGS_phase == "TRAIN" || FLAGS_phase == "TEST")
+      << "Unknown phase: " << FLAGS_phase;
+
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(FLAGS_phase == "TRAIN" ? Caffe::TRAIN : Caffe::TEST);
+  Net<float> net(FLAGS_model);
+
+  // Find the prefetching data layers and turn their stage timing on. The
+  // batches prefetched before this point stay untimed, which is fine: the
+  // stage split is reported per timed batch.
+  const vector<shared_ptr<Layer<float> > >& layers = net.layers();
+  vector<BasePrefetchingDataLayer<float>*> data_layers;
+  int images_per_batch = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    BasePrefetchingDataLayer<float>* data_layer =
+        dynamic_cast<BasePrefetchingDataLayer<float>*>(layers[i].get());
+    if (data_layer) {
+      data_layer->set_collect_timing(true);
+      data_layers.push_back(data_layer);
+      images_per_batch += net.top_vecs()[i][0]->num();
+    }
+  }
+  CHECK_GT(data_layers.size(), 0)
+      << "No prefetching data layer in " << FLAGS_model;
+
+  for (int i = 0; i < FLAGS_warmup; ++i) {
+    net.ForwardPrefilled();
+  }
+
+  Timer total;
+  total.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    net.ForwardPrefilled();
+  }
+  total.Stop();
+  const float consume_ms = total.MilliSeconds() / FLAGS_iterations;
+  LOG(INFO) << "Consumed " << FLAGS_iterations << " batches ("
+            << images_per_batch << " images each) in " << total.Seconds()
+            << " s: " << 1000. * images_per_batch / consume_ms << " images/s.";
+
+  // The prefetch threads keep running while we report, so read each
+  // layer's counters once up front.
+  for (int i = 0; i < data_layers.size(); ++i) {
+    BasePrefetchingDataLayer<float>* data_layer = data_layers[i];
+    const string& name = data_layer->layer_param().name();
+    const int batches = data_layer->batches_timed();
+    const double read_ms = data_layer->read_time_ms();
+    const double decode_ms = data_layer->decode_time_ms();
+    const double transform_ms = data_layer->transform_time_ms();
+    if (batches == 0 || read_ms + decode_ms + transform_ms == 0) {
+      LOG(INFO) << name << ": no stage timing collected.";
+      continue;
+    }
+    const double batch_ms = (read_ms + decode_ms + transform_ms) / batches;
+    LOG(INFO) << name << ": per batch over " << batches << " timed batches, "
+              << "summed across decode workers:";
+    LOG(INFO) << name << "\tDB read:   " << read_ms / batches << " ms ("
+              << 100. * read_ms / batches / batch_ms << "%)";
+    LOG(INFO) << name << "\tdecode:    " << decode_ms / batches << " ms ("
+              << 100. * decode_ms / batches / batch_ms << "%)";
+    LOG(INFO) << name << "\ttransform: " << transform_ms / batches << " ms ("
+              << 100. * transform_ms / batches / batch_ms << "%)";
+    if (batch_ms > consume_ms) {
+      LOG(INFO) << name << " spends " << batch_ms << " ms of CPU per batch "
+                << "against " << consume_ms << " ms consumed: the pipeline "
+                << "is producer-bound; add decode threads or faster storage.";
+    } else {
+      LOG(INFO) << name << " keeps up: " << batch_ms << " ms of CPU per "
+                << "batch against " << consume_ms << " ms consumed.";
+    }
+  }
+  return 0;
+}
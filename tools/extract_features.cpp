@@ -1,8 +1,11 @@
 #include <stdio.h>  // for snprintf
+#include <fstream>  // NOLINT(readability/streams)
+#include <queue>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
 #include "google/protobuf/text_format.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
@@ -12,10 +15,125 @@
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
+// One extracted mini batch of one feature blob, staged for the background
+// writer thread: a flattened num x dim feature matrix and the index of the
+// first image in it.
+template<typename Dtype>
+struct FeatureWriteJob {
+  int blob_index;
+  int first_image;
+  int num;
+  int dim;
+  std::vector<Dtype> features;
+};
+
+// A minimal blocking hand-off between the forward loop and the writer
+// thread. The library's BlockingQueue is only instantiated for prefetch
+// batches, and this tool does not need anything more general.
+template<typename Dtype>
+class FeatureJobQueue {
+ public:
+  void push(FeatureWriteJob<Dtype>* job) {
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.push(job);
+    condition_.notify_one();
+  }
+  FeatureWriteJob<Dtype>* pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      condition_.wait(lock);
+    }
+    FeatureWriteJob<Dtype>* job = queue_.front();
+    queue_.pop();
+    return job;
+  }
+
+ private:
+  std::queue<FeatureWriteJob<Dtype>*> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+// Everything the writer thread touches. It owns the serialization and the
+// leveldb commits (or the raw file writes) so the forward loop never blocks
+// on the disk.
+template<typename Dtype>
+struct FeatureWriterContext {
+  FeatureJobQueue<Dtype>* free_jobs;
+  FeatureJobQueue<Dtype>* full_jobs;
+  bool raw_output;
+  vector<shared_ptr<leveldb::DB> >* dbs;
+  vector<shared_ptr<leveldb::WriteBatch> >* batches;
+  vector<shared_ptr<std::ofstream> >* raw_files;
+  vector<string>* blob_names;
+  // Images written so far per blob, maintained on the writer thread.
+  vector<int>* image_indices;
+};
+
+// Drains jobs until the NULL sentinel: serializes each feature vector into
+// the leveldb WriteBatch (committed every 1000 images), or appends the raw
+// feature matrix to the blob's output file.
+template<typename Dtype>
+void FeatureWriterEntry(FeatureWriterContext<Dtype>* context) {
+  const int kMaxKeyStrLength = 100;
+  char key_str[kMaxKeyStrLength];
+  Datum datum;
+  while (true) {
+    FeatureWriteJob<Dtype>* job = context->full_jobs->pop();
+    if (job == NULL) {
+      break;
+    }
+    const int i = job->blob_index;
+    if (context->raw_output) {
+      (*context->raw_files)[i]->write(
+          reinterpret_cast<const char*>(&job->features[0]),
+          sizeof(Dtype) * job->num * job->dim);
+      CHECK((*context->raw_files)[i]->good())
+          << "Failed writing features for blob " << (*context->blob_names)[i];
+      (*context->image_indices)[i] += job->num;
+      if ((*context->image_indices)[i] % 1000 < job->num) {
+        LOG(ERROR)<< "Extracted features of " << (*context->image_indices)[i]
+            << " query images for feature blob "
+            << (*context->blob_names)[i];
+      }
+    } else {
+      leveldb::WriteBatch* batch = (*context->batches)[i].get();
+      for (int n = 0; n < job->num; ++n) {
+        datum.set_height(job->dim);
+        datum.set_width(1);
+        datum.set_channels(1);
+        datum.clear_data();
+        datum.clear_float_data();
+        const Dtype* feature_row = &job->features[n * job->dim];
+        for (int d = 0; d < job->dim; ++d) {
+          datum.add_float_data(feature_row[d]);
+        }
+        string value;
+        datum.SerializeToString(&value);
+        snprintf(key_str, kMaxKeyStrLength, "%d", job->first_image + n);
+        batch->Put(string(key_str), value);
+        ++(*context->image_indices)[i];
+        if ((*context->image_indices)[i] % 1000 == 0) {
+          (*context->dbs)[i]->Write(leveldb::WriteOptions(), batch);
+          LOG(ERROR)<< "Extracted features of "
+              << (*context->image_indices)[i]
+              << " query images for feature blob "
+              << (*context->blob_names)[i];
+          (*context->batches)[i].reset(new leveldb::WriteBatch());
+          batch = (*context->batches)[i].get();
+        }
+      }
+    }
+    context->free_jobs->push(job);
+  }
+}
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -35,11 +153,14 @@ int feature_extraction_pipeline(int argc, char** argv) {
     "Usage: extract_features  pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_leveldb_name1[,name2,...]  num_mini_batches  [CPU/GPU]"
-    "  [DEVICE_ID=0]\n"
+    "  [DEVICE_ID=0]  [raw]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and leveldb names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and leveldbs must be equal.";
+    " and leveldbs must be equal.\n"
+    "Pass 'raw' as the last argument to write each blob as one packed"
+    " row-major matrix of native-endian floats (num_images x dim) at the"
+    " given path instead of a leveldb of Datum protobufs.";
     return 1;
   }
   int arg_pos = num_required_args;
@@ -59,6 +180,7 @@ int feature_extraction_pipeline(int argc, char** argv) {
     LOG(ERROR) << "Using CPU";
     Caffe::set_mode(Caffe::CPU);
   }
+  const bool raw_output = (strcmp(argv[argc - 1], "raw") == 0);
   Caffe::set_phase(Caffe::TEST);
 
   arg_pos = 0;  // the name of the executable
@@ -92,14 +214,41 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
 
   string extract_feature_blob_names(argv[++arg_pos]);
   vector<string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
+  // Every layer past the last one producing a requested blob would be
+  // forwarded for nothing. Find that layer in the proto and drop the tail
+  // before instantiation, so the pruned layers' weights are never
+  // allocated or copied either. In-place layers on a requested blob
+  // (e.g. a ReLU rewriting fc6) count as producers, so the extracted
+  // values match what a full forward pass would have left in the blob.
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(feature_extraction_proto, &net_param);
+  int last_needed_layer = -1;
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    for (int j = 0; j < net_param.layers(i).top_size(); ++j) {
+      for (size_t k = 0; k < blob_names.size(); ++k) {
+        if (net_param.layers(i).top(j) == blob_names[k]) {
+          last_needed_layer = i;
+        }
+      }
+    }
+  }
+  if (last_needed_layer >= 0 &&
+      last_needed_layer + 1 < net_param.layers_size()) {
+    const int num_pruned = net_param.layers_size() - last_needed_layer - 1;
+    LOG(ERROR) << "Pruning " << num_pruned << " layer(s) above "
+        << net_param.layers(last_needed_layer).name()
+        << " not needed for the requested blobs";
+    net_param.mutable_layers()->DeleteSubrange(last_needed_layer + 1,
+                                               num_pruned);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(new Net<Dtype>(net_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
   string save_feature_leveldb_names(argv[++arg_pos]);
   vector<string> leveldb_names;
   boost::split(leveldb_names, save_feature_leveldb_names,
@@ -114,70 +263,94 @@ int feature_extraction_pipeline(int argc, char** argv) {
         << " in the network " << feature_extraction_proto;
   }
 
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
   vector<shared_ptr<leveldb::DB> > feature_dbs;
-  for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening leveldb " << leveldb_names[i];
-    leveldb::DB* db;
-    leveldb::Status status = leveldb::DB::Open(options,
-                                               leveldb_names[i].c_str(),
-                                               &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << leveldb_names[i];
-    feature_dbs.push_back(shared_ptr<leveldb::DB>(db));
+  vector<shared_ptr<std::ofstream> > raw_files;
+  if (raw_output) {
+    for (size_t i = 0; i < num_features; ++i) {
+      LOG(INFO)<< "Opening raw output file " << leveldb_names[i];
+      raw_files.push_back(shared_ptr<std::ofstream>(new std::ofstream(
+          leveldb_names[i].c_str(), std::ofstream::binary)));
+      CHECK(raw_files[i]->good())
+          << "Failed to open raw output file " << leveldb_names[i];
+    }
+  } else {
+    leveldb::Options options;
+    options.error_if_exists = true;
+    options.create_if_missing = true;
+    options.write_buffer_size = 268435456;
+    for (size_t i = 0; i < num_features; ++i) {
+      LOG(INFO)<< "Opening leveldb " << leveldb_names[i];
+      leveldb::DB* db;
+      leveldb::Status status = leveldb::DB::Open(options,
+                                                 leveldb_names[i].c_str(),
+                                                 &db);
+      CHECK(status.ok()) << "Failed to open leveldb " << leveldb_names[i];
+      feature_dbs.push_back(shared_ptr<leveldb::DB>(db));
+    }
   }
 
   int num_mini_batches = atoi(argv[++arg_pos]);
 
   LOG(ERROR)<< "Extracting Features";
 
-  Datum datum;
-  vector<shared_ptr<leveldb::WriteBatch> > feature_batches(
-      num_features,
-      shared_ptr<leveldb::WriteBatch>(new leveldb::WriteBatch()));
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
-  vector<Blob<float>*> input_vec;
+  // The writer thread serializes and commits batch N while the net forwards
+  // batch N + 1, so the GPU no longer idles on leveldb compactions. Two
+  // jobs per blob give double buffering: one in flight to the disk, one
+  // being filled from the net.
+  vector<shared_ptr<leveldb::WriteBatch> > feature_batches;
+  for (size_t i = 0; i < num_features; ++i) {
+    feature_batches.push_back(
+        shared_ptr<leveldb::WriteBatch>(new leveldb::WriteBatch()));
+  }
   vector<int> image_indices(num_features, 0);
+  FeatureJobQueue<Dtype> free_jobs;
+  FeatureJobQueue<Dtype> full_jobs;
+  vector<shared_ptr<FeatureWriteJob<Dtype> > > job_pool;
+  for (size_t i = 0; i < 2 * num_features; ++i) {
+    job_pool.push_back(
+        shared_ptr<FeatureWriteJob<Dtype> >(new FeatureWriteJob<Dtype>()));
+    free_jobs.push(job_pool[i].get());
+  }
+  FeatureWriterContext<Dtype> writer_context;
+  writer_context.free_jobs = &free_jobs;
+  writer_context.full_jobs = &full_jobs;
+  writer_context.raw_output = raw_output;
+  writer_context.dbs = &feature_dbs;
+  writer_context.batches = &feature_batches;
+  writer_context.raw_files = &raw_files;
+  writer_context.blob_names = &blob_names;
+  writer_context.image_indices = &image_indices;
+  boost::thread writer(&FeatureWriterEntry<Dtype>, &writer_context);
+
+  vector<Blob<float>*> input_vec;
+  vector<int> next_image(num_features, 0);
   for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
     feature_extraction_net->Forward(input_vec);
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(dim_features);
-        datum.set_width(1);
-        datum.set_channels(1);
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->mutable_cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        string value;
-        datum.SerializeToString(&value);
-        snprintf(key_str, kMaxKeyStrLength, "%d", image_indices[i]);
-        feature_batches[i]->Put(string(key_str), value);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          feature_dbs[i]->Write(leveldb::WriteOptions(),
-                                feature_batches[i].get());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-          feature_batches[i].reset(new leveldb::WriteBatch());
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
+      FeatureWriteJob<Dtype>* job = free_jobs.pop();
+      job->blob_index = i;
+      job->first_image = next_image[i];
+      job->num = feature_blob->num();
+      job->dim = feature_blob->count() / feature_blob->num();
+      job->features.resize(feature_blob->count());
+      caffe_copy(feature_blob->count(), feature_blob->cpu_data(),
+                 &job->features[0]);
+      next_image[i] += job->num;
+      full_jobs.push(job);
+    }
+  }
+  full_jobs.push(NULL);
+  writer.join();
+
   // write the last batch
   for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
+    if (raw_output) {
+      raw_files[i]->close();
+      CHECK(raw_files[i]->good())
+          << "Failed closing raw output file " << leveldb_names[i];
+    } else if (image_indices[i] % 1000 != 0) {
       feature_dbs[i]->Write(leveldb::WriteOptions(), feature_batches[i].get());
     }
     LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
@@ -187,4 +360,3 @@ int feature_extraction_pipeline(int argc, char** argv) {
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
 }
-
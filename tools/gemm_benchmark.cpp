@@ -0,0 +1,74 @@
+// Microbenchmark for the small-matrix GEMM fast path in
+// caffe_cpu_gemm. For each shape it times caffe_cpu_gemm (which takes
+// the hand-written kernel below the M*N*K threshold) against a direct
+// cblas_sgemm call, so the crossover point on this machine and BLAS
+// library can be read straight off the output. Use it to validate the
+// threshold in math_functions.cpp, or to decide whether to build with
+// NO_SMALL_GEMM := 1.
+//
+// Usage:
+//    gemm_benchmark [--repeats=10000] [--max_dim=256]
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::Timer;
+using caffe::caffe_cpu_gemm;
+using caffe::caffe_rng_uniform;
+using caffe::vector;
+
+DEFINE_int32(repeats, 10000,
+    "Calls per shape; small shapes need many repeats for stable times.");
+DEFINE_int32(max_dim, 256,
+    "Largest square dimension benchmarked.");
+
+int main(int argc, char** argv) {
+  caffe::GlobalInit(&argc, &argv);
+  CHECK_GT(FLAGS_repeats, 0);
+  CHECK_GE(FLAGS_max_dim, 4);
+
+  std::printf("%6s %6s %6s %12s %12s %12s\n",
+              "M", "N", "K", "caffe (us)", "cblas (us)", "speedup");
+  for (int dim = 4; dim <= FLAGS_max_dim; dim *= 2) {
+    const int m = dim;
+    const int n = dim;
+    const int k = dim;
+    vector<float> a(m * k);
+    vector<float> b(k * n);
+    vector<float> c(m * n);
+    caffe_rng_uniform(m * k, -1.0f, 1.0f, &a[0]);
+    caffe_rng_uniform(k * n, -1.0f, 1.0f, &b[0]);
+
+    // Warm up both paths so neither pays first-touch or thread-pool
+    // startup costs inside the measured loop.
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+        &a[0], &b[0], 0.0f, &c[0]);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+        &a[0], k, &b[0], n, 0.0f, &c[0], n);
+
+    Timer timer;
+    timer.Start();
+    for (int r = 0; r < FLAGS_repeats; ++r) {
+      caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+          &a[0], &b[0], 0.0f, &c[0]);
+    }
+    const float caffe_us = timer.MicroSeconds() / FLAGS_repeats;
+
+    timer.Start();
+    for (int r = 0; r < FLAGS_repeats; ++r) {
+      cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+          &a[0], k, &b[0], n, 0.0f, &c[0], n);
+    }
+    const float cblas_us = timer.MicroSeconds() / FLAGS_repeats;
+
+    std::printf("%6d %6d %6d %12.2f %12.2f %11.2fx\n",
+                m, n, k, caffe_us, cblas_us, cblas_us / caffe_us);
+  }
+  return 0;
+}
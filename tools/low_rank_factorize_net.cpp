@@ -0,0 +1,235 @@
+// This program factorizes the weight matrices of chosen InnerProduct
+// layers into two rank-k layers, cutting their FLOPs and parameter count
+// from M*K to k*(M+K). Each selected layer "fc" is replaced by "fc_svd_a"
+// (rank outputs, no bias) feeding "fc_svd_b" (original outputs and bias),
+// and both the net definition and the trained model are rewritten so the
+// result is directly loadable. The per-layer relative reconstruction
+// error printed by the tool is a weight-space proxy for the accuracy
+// cost; validate the factorized model with test_net before deployment.
+// Usage:
+//    low_rank_factorize_net net_proto_in trained_model \
+//        layer:rank[,layer:rank...] net_proto_out trained_model_out
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+// Orthonormalizes the columns of the row-major rows x cols matrix Y by
+// modified Gram-Schmidt with re-orthogonalization.
+static void OrthonormalizeColumns(const int rows, const int cols, float* Y) {
+  for (int j = 0; j < cols; ++j) {
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < j; ++i) {
+        double dot = 0;
+        for (int r = 0; r < rows; ++r) {
+          dot += Y[r * cols + i] * Y[r * cols + j];
+        }
+        for (int r = 0; r < rows; ++r) {
+          Y[r * cols + j] -= dot * Y[r * cols + i];
+        }
+      }
+    }
+    double norm = 0;
+    for (int r = 0; r < rows; ++r) {
+      norm += Y[r * cols + j] * Y[r * cols + j];
+    }
+    norm = std::sqrt(norm);
+    const float scale = norm > 0 ? 1.0 / norm : 0;
+    for (int r = 0; r < rows; ++r) {
+      Y[r * cols + j] *= scale;
+    }
+  }
+}
+
+// Rank-k factorization of the M x K matrix W into U (M x k, orthonormal
+// columns) and B = U^T W (k x K) by subspace iteration, so W ~ U * B.
+// The iteration converges to the truncated SVD subspace without needing
+// a LAPACK dependency. Returns the relative Frobenius reconstruction
+// error.
+static float FactorizeWeights(const float* W, const int M, const int K,
+    const int k, float* U, float* B) {
+  std::vector<float> Y(M * k), Z(K * k);
+  caffe_rng_gaussian<float>(M * k, 0, 1, &Y[0]);
+  double energy = 0;
+  for (int iter = 0; iter < 100; ++iter) {
+    OrthonormalizeColumns(M, k, &Y[0]);
+    // Z = W^T Y
+    caffe_cpu_gemm<float>(CblasTrans, CblasNoTrans, K, k, M, 1., W, &Y[0],
+        0., &Z[0]);
+    double new_energy = 0;
+    for (int i = 0; i < K * k; ++i) {
+      new_energy += static_cast<double>(Z[i]) * Z[i];
+    }
+    if (iter > 0 && new_energy - energy <= 1e-6 * new_energy) {
+      break;
+    }
+    energy = new_energy;
+    // Y = W Z
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, M, k, K, 1., W, &Z[0],
+        0., &Y[0]);
+  }
+  caffe_copy(M * k, &Y[0], U);
+  // With Y orthonormal, B = U^T W is the transpose of the last Z.
+  for (int r = 0; r < k; ++r) {
+    for (int c = 0; c < K; ++c) {
+      B[r * K + c] = Z[c * k + r];
+    }
+  }
+  double total = 0, kept = 0;
+  for (int i = 0; i < M * K; ++i) {
+    total += static_cast<double>(W[i]) * W[i];
+  }
+  for (int i = 0; i < k * K; ++i) {
+    kept += static_cast<double>(B[i]) * B[i];
+  }
+  const double residual = total > kept ? total - kept : 0;
+  return total > 0 ? std::sqrt(residual / total) : 0;
+}
+
+// Splits the InnerProduct layer src into the pair a (rank outputs, no
+// bias) and b (original outputs and bias), connected through the blob
+// "<name>_svd". Weight blobs are only emitted when src carries them, so
+// the same helper rewrites both the definition and the trained model.
+static void SplitInnerProduct(const LayerParameter& src, const int rank,
+    const float* U, const float* B, LayerParameter* a, LayerParameter* b) {
+  const std::string mid_blob = src.name() + "_svd";
+  a->CopyFrom(src);
+  a->set_name(src.name() + "_svd_a");
+  a->clear_top();
+  a->add_top(mid_blob);
+  a->mutable_inner_product_param()->set_num_output(rank);
+  a->mutable_inner_product_param()->set_bias_term(false);
+  a->mutable_inner_product_param()->clear_bias_filler();
+  // The bias entries of per-blob multipliers do not apply to a.
+  if (a->blobs_lr_size() == 2) {
+    a->mutable_blobs_lr()->RemoveLast();
+  }
+  if (a->weight_decay_size() == 2) {
+    a->mutable_weight_decay()->RemoveLast();
+  }
+  b->CopyFrom(src);
+  b->set_name(src.name() + "_svd_b");
+  b->clear_bottom();
+  b->add_bottom(mid_blob);
+  // Any calibrated input range refers to the original bottom; the
+  // factorized layers need recalibration before INT8 deployment.
+  a->clear_quantization_param();
+  b->clear_quantization_param();
+  a->clear_blobs();
+  b->clear_blobs();
+  if (src.blobs_size() > 0) {
+    const int M = src.blobs(0).height();
+    const int K = src.blobs(0).width();
+    Blob<float> blob_a(1, 1, rank, K);
+    caffe_copy(rank * K, B, blob_a.mutable_cpu_data());
+    blob_a.ToProto(a->add_blobs());
+    Blob<float> blob_b(1, 1, M, rank);
+    caffe_copy(M * rank, U, blob_b.mutable_cpu_data());
+    blob_b.ToProto(b->add_blobs());
+    if (src.blobs_size() > 1) {
+      b->add_blobs()->CopyFrom(src.blobs(1));
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 6) {
+    LOG(ERROR) << "Usage: low_rank_factorize_net net_proto_in trained_model "
+        << "layer:rank[,layer:rank...] net_proto_out trained_model_out";
+    return 1;
+  }
+
+  // Parse the layer:rank specification.
+  std::map<std::string, int> ranks;
+  std::string spec(argv[3]);
+  while (!spec.empty()) {
+    const size_t comma = spec.find(',');
+    const std::string entry = spec.substr(0, comma);
+    spec = comma == std::string::npos ? "" : spec.substr(comma + 1);
+    const size_t colon = entry.find(':');
+    CHECK_NE(colon, std::string::npos)
+        << "Malformed spec entry (want layer:rank): " << entry;
+    const int rank = atoi(entry.substr(colon + 1).c_str());
+    CHECK_GT(rank, 0) << "Malformed rank in spec entry: " << entry;
+    ranks[entry.substr(0, colon)] = rank;
+  }
+
+  NetParameter model;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &model);
+
+  // Factorize the trained weights and rebuild the model proto.
+  typedef std::pair<std::vector<float>, std::vector<float> > Factors;
+  std::map<std::string, Factors> factors;
+  NetParameter model_out(model);
+  model_out.clear_layers();
+  for (int i = 0; i < model.layers_size(); ++i) {
+    const LayerParameter& layer = model.layers(i);
+    std::map<std::string, int>::const_iterator it = ranks.find(layer.name());
+    if (it == ranks.end()) {
+      model_out.add_layers()->CopyFrom(layer);
+      continue;
+    }
+    CHECK_EQ(layer.type(), LayerParameter_LayerType_INNER_PRODUCT)
+        << "Layer " << layer.name() << " is not an InnerProduct layer";
+    CHECK_GE(layer.blobs_size(), 1)
+        << "Layer " << layer.name() << " has no trained weights";
+    Blob<float> weight;
+    weight.FromProto(layer.blobs(0));
+    const int M = weight.height();
+    const int K = weight.width();
+    const int rank = it->second;
+    CHECK_LT(rank, std::min(M, K))
+        << "Layer " << layer.name() << ": rank must be below min("
+        << M << ", " << K << ") to be a compression";
+    Factors& f = factors[layer.name()];
+    f.first.resize(M * rank);   // U
+    f.second.resize(rank * K);  // B
+    const float error = FactorizeWeights(weight.cpu_data(), M, K, rank,
+        &f.first[0], &f.second[0]);
+    const double speedup =
+        static_cast<double>(M) * K / (static_cast<double>(rank) * (M + K));
+    LOG(INFO) << "Layer " << layer.name() << ": " << M << "x" << K
+        << " -> rank " << rank << ", " << speedup << "x fewer FLOPs and "
+        << "weights, relative reconstruction error " << error;
+    SplitInnerProduct(layer, rank, &f.first[0], &f.second[0],
+        model_out.add_layers(), model_out.add_layers());
+  }
+  for (std::map<std::string, int>::const_iterator it = ranks.begin();
+       it != ranks.end(); ++it) {
+    CHECK(factors.count(it->first))
+        << "Layer " << it->first << " not found in " << argv[2];
+  }
+  WriteProtoToBinaryFile(model_out, argv[5]);
+
+  // Rewrite the net definition with the same split.
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter net_out(net_param);
+  net_out.clear_layers();
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    const LayerParameter& layer = net_param.layers(i);
+    std::map<std::string, int>::const_iterator it = ranks.find(layer.name());
+    if (it == ranks.end()) {
+      net_out.add_layers()->CopyFrom(layer);
+      continue;
+    }
+    SplitInnerProduct(layer, it->second, NULL, NULL,
+        net_out.add_layers(), net_out.add_layers());
+  }
+  WriteProtoToTextFile(net_out, argv[4]);
+
+  LOG(INFO) << "Factorized " << factors.size() << " layers; wrote "
+      << argv[4] << " and " << argv[5];
+  return 0;
+}
@@ -0,0 +1,404 @@
+// Benchmark a net with warmup discard, per-layer latency distributions and
+// a roofline report against the machine's measured compute and bandwidth
+// ceilings, replacing net_speed_benchmark.
+//
+// Usage:
+//    net_benchmark --model=net.prototxt [--gpu=0] [--warmup=10]
+//        [--iterations=50] [--forward_only] [--format=json|csv]
+//        [--output=bench.json] [--peak_gflops=N] [--peak_gbps=N]
+//
+// The machine-readable output is stable across runs of the same net, so
+// results can be checked in and diffed across commits.
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Layer;
+using caffe::Net;
+using caffe::Timer;
+using caffe::shared_ptr;
+using caffe::string;
+using caffe::vector;
+
+DEFINE_string(model, "",
+    "The model definition protocol buffer text file.");
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on given device ID.");
+DEFINE_int32(warmup, 10,
+    "Unmeasured iterations run first to settle allocation and clocks.");
+DEFINE_int32(iterations, 50,
+    "The number of measured iterations to run.");
+DEFINE_bool(forward_only, false,
+    "Benchmark Forward only, in TEST phase, as in serving.");
+DEFINE_string(format, "json",
+    "Machine-readable output format: json or csv.");
+DEFINE_string(output, "",
+    "File the json/csv report is written to; stdout if unset.");
+DEFINE_double(peak_gflops, 0,
+    "Compute ceiling for the roofline report, in GFLOP/s. 0 measures it "
+    "with a large dense SGEMM on the selected device.");
+DEFINE_double(peak_gbps, 0,
+    "Memory bandwidth ceiling for the roofline report, in GB/s. 0 "
+    "measures it with a large copy on the selected device.");
+DEFINE_double(roofline_threshold, 0.5,
+    "Layers achieving less than this fraction of their attainable "
+    "GFLOP/s are flagged as optimization candidates.");
+
+// Sorts the samples; percentile is in [0, 1].
+static float Percentile(vector<float>* samples, const float percentile) {
+  CHECK(!samples->empty());
+  std::sort(samples->begin(), samples->end());
+  const int index = static_cast<int>((samples->size() - 1) * percentile + 0.5);
+  return (*samples)[index];
+}
+
+static float Mean(const vector<float>& samples) {
+  float sum = 0;
+  for (int i = 0; i < samples.size(); ++i) {
+    sum += samples[i];
+  }
+  return sum / samples.size();
+}
+
+// Estimates the multiply-add work of one forward pass of the layer from its
+// parameters and blob shapes. Layers without a dominant GEMM are charged one
+// operation per output element, which is the right order for the elementwise
+// and pooling layers and keeps their GFLOP/s columns comparable.
+static double EstimateLayerFlops(const caffe::LayerParameter& param,
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top) {
+  switch (param.type()) {
+  case caffe::LayerParameter_LayerType_CONVOLUTION:
+  case caffe::LayerParameter_LayerType_CONVOLUTION_RELU: {
+    const caffe::ConvolutionParameter& conv = param.convolution_param();
+    const int kernel_h = conv.has_kernel_h() ? conv.kernel_h()
+                                             : conv.kernel_size();
+    const int kernel_w = conv.has_kernel_w() ? conv.kernel_w()
+                                             : conv.kernel_size();
+    return 2.0 * top[0]->count() * bottom[0]->channels() / conv.group() *
+        kernel_h * kernel_w;
+  }
+  case caffe::LayerParameter_LayerType_INNER_PRODUCT:
+    return 2.0 * bottom[0]->num() * param.inner_product_param().num_output() *
+        (bottom[0]->count() / bottom[0]->num());
+  case caffe::LayerParameter_LayerType_POOLING: {
+    const caffe::PoolingParameter& pool = param.pooling_param();
+    const int kernel_h = pool.has_kernel_h() ? pool.kernel_h()
+                                             : pool.kernel_size();
+    const int kernel_w = pool.has_kernel_w() ? pool.kernel_w()
+                                             : pool.kernel_size();
+    // One compare (MAX) or add (AVE) per window element.
+    return 1.0 * top[0]->count() * kernel_h * kernel_w;
+  }
+  case caffe::LayerParameter_LayerType_LRN:
+    // A multiply-add per window element for the running square sum,
+    // plus the pow and scale per output.
+    return top[0]->count() * (2.0 * param.lrn_param().local_size() + 3.0);
+  default:
+    return top.empty() ? 0 : top[0]->count();
+  }
+}
+
+// The least traffic one forward pass can generate: every bottom and
+// parameter blob read once, every top blob written once. Caches can beat
+// this for small blobs, so the roofline treats it as a floor, which only
+// makes the attainable-GFLOP/s ceiling optimistic -- a layer flagged as
+// far below the roofline really is.
+static double EstimateLayerBytes(const shared_ptr<Layer<float> >& layer,
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top) {
+  double count = 0;
+  for (int i = 0; i < bottom.size(); ++i) {
+    count += bottom[i]->count();
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    count += top[i]->count();
+  }
+  const vector<shared_ptr<Blob<float> > >& blobs = layer->blobs();
+  for (int i = 0; i < blobs.size(); ++i) {
+    count += blobs[i]->count();
+  }
+  return count * sizeof(float);
+}
+
+// Measures the compute ceiling with a large dense SGEMM; best of a few
+// trials so clock ramp-up does not understate it.
+static double MeasurePeakGflops() {
+  const int n = 1024;
+  Blob<float> a(1, 1, n, n);
+  Blob<float> b(1, 1, n, n);
+  Blob<float> c(1, 1, n, n);
+  caffe::caffe_set(a.count(), 1.0f, a.mutable_cpu_data());
+  caffe::caffe_set(b.count(), 1.0f, b.mutable_cpu_data());
+  Timer timer;
+  double best = 0;
+  for (int trial = 0; trial < 4; ++trial) {
+    timer.Start();
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe::caffe_gpu_gemm<float>(CblasNoTrans, CblasNoTrans, n, n, n, 1.,
+          a.gpu_data(), b.gpu_data(), 0., c.mutable_gpu_data());
+    } else {
+      caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, n, n, n, 1.,
+          a.cpu_data(), b.cpu_data(), 0., c.mutable_cpu_data());
+    }
+#else
+    caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, n, n, n, 1.,
+        a.cpu_data(), b.cpu_data(), 0., c.mutable_cpu_data());
+#endif
+    timer.Stop();
+    // The first trial is the warmup (allocation, clocks, cuBLAS init).
+    const float ms = timer.MilliSeconds();
+    if (trial == 0 || ms <= 0) { continue; }
+    best = std::max(best, 2.0 * n * n * n / (ms * 1e6));
+  }
+  return best;
+}
+
+// Measures the bandwidth ceiling with a large copy (a read plus a write
+// per element); best of a few trials, first discarded as warmup.
+static double MeasurePeakGbps() {
+  const int count = 16 << 20;  // 64 MB per buffer, well past the caches.
+  Blob<float> src(1, 1, 4096, count / 4096);
+  Blob<float> dst(1, 1, 4096, count / 4096);
+  caffe::caffe_set(src.count(), 1.0f, src.mutable_cpu_data());
+  Timer timer;
+  double best = 0;
+  for (int trial = 0; trial < 4; ++trial) {
+    timer.Start();
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe::caffe_gpu_memcpy(count * sizeof(float), src.gpu_data(),
+          dst.mutable_gpu_data());
+    } else {
+      caffe::caffe_copy(count, src.cpu_data(), dst.mutable_cpu_data());
+    }
+#else
+    caffe::caffe_copy(count, src.cpu_data(), dst.mutable_cpu_data());
+#endif
+    timer.Stop();
+    const float ms = timer.MilliSeconds();
+    if (trial == 0 || ms <= 0) { continue; }
+    best = std::max(best, 2.0 * count * sizeof(float) / (ms * 1e6));
+  }
+  return best;
+}
+
+struct LayerStats {
+  string name;
+  string type;
+  float forward_mean, forward_p50, forward_p99;
+  float backward_mean, backward_p50, backward_p99;
+  double gflops;
+  double gflop_per_s;
+  // Roofline model: analytic bytes and FLOP/byte intensity, the ceiling
+  // the intensity permits on this machine, and the fraction of that
+  // ceiling the measured forward rate reaches.
+  double gbytes;
+  double intensity;
+  double attainable_gflop_per_s;
+  double roofline_fraction;
+  bool compute_bound;
+};
+
+static void WriteJson(const vector<LayerStats>& stats,
+    const float forward_total, const float backward_total,
+    const double peak_gflops, const double peak_gbps,
+    std::ostream* out) {
+  *out << "{\n";
+  *out << "  \"model\": \"" << FLAGS_model << "\",\n";
+  *out << "  \"mode\": \"" << (FLAGS_gpu >= 0 ? "GPU" : "CPU") << "\",\n";
+  *out << "  \"iterations\": " << FLAGS_iterations << ",\n";
+  *out << "  \"peak_gflop_per_s\": " << peak_gflops << ",\n";
+  *out << "  \"peak_gb_per_s\": " << peak_gbps << ",\n";
+  *out << "  \"forward_total_ms\": " << forward_total << ",\n";
+  *out << "  \"backward_total_ms\": " << backward_total << ",\n";
+  *out << "  \"layers\": [\n";
+  for (int i = 0; i < stats.size(); ++i) {
+    const LayerStats& s = stats[i];
+    *out << "    {\"name\": \"" << s.name << "\", \"type\": \"" << s.type
+         << "\", \"forward_mean_ms\": " << s.forward_mean
+         << ", \"forward_p50_ms\": " << s.forward_p50
+         << ", \"forward_p99_ms\": " << s.forward_p99
+         << ", \"backward_mean_ms\": " << s.backward_mean
+         << ", \"backward_p50_ms\": " << s.backward_p50
+         << ", \"backward_p99_ms\": " << s.backward_p99
+         << ", \"gflops\": " << s.gflops
+         << ", \"gflop_per_s\": " << s.gflop_per_s
+         << ", \"gbytes\": " << s.gbytes
+         << ", \"flop_per_byte\": " << s.intensity
+         << ", \"attainable_gflop_per_s\": " << s.attainable_gflop_per_s
+         << ", \"roofline_fraction\": " << s.roofline_fraction
+         << ", \"bound\": \"" << (s.compute_bound ? "compute" : "memory")
+         << "\"}" << (i + 1 < stats.size() ? "," : "") << "\n";
+  }
+  *out << "  ]\n}\n";
+}
+
+static void WriteCsv(const vector<LayerStats>& stats, std::ostream* out) {
+  *out << "name,type,forward_mean_ms,forward_p50_ms,forward_p99_ms,"
+       << "backward_mean_ms,backward_p50_ms,backward_p99_ms,"
+       << "gflops,gflop_per_s,gbytes,flop_per_byte,"
+       << "attainable_gflop_per_s,roofline_fraction,bound\n";
+  for (int i = 0; i < stats.size(); ++i) {
+    const LayerStats& s = stats[i];
+    *out << s.name << "," << s.type << ","
+         << s.forward_mean << "," << s.forward_p50 << "," << s.forward_p99
+         << "," << s.backward_mean << "," << s.backward_p50 << ","
+         << s.backward_p99 << "," << s.gflops << "," << s.gflop_per_s << ","
+         << s.gbytes << "," << s.intensity << ","
+         << s.attainable_gflop_per_s << "," << s.roofline_fraction << ","
+         << (s.compute_bound ? "compute" : "memory") << "\n";
+  }
+}
+
+int main(int argc, char** argv) {
+  caffe::GlobalInit(&argc, &argv);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to benchmark.";
+  CHECK_GT(FLAGS_iterations, 0) << "Need at least one measured iteration.";
+  CHECK_GE(FLAGS_warmup, 0);
+  CHECK(FLAGS_format == "json" || FLAGS_format == "csv")
+      << "Unknown format: " << FLAGS_format;
+
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(FLAGS_forward_only ? Caffe::TEST : Caffe::TRAIN);
+  Net<float> net(FLAGS_model);
+
+  const vector<shared_ptr<Layer<float> > >& layers = net.layers();
+  vector<vector<Blob<float>*> >& bottom_vecs = net.bottom_vecs();
+  vector<vector<Blob<float>*> >& top_vecs = net.top_vecs();
+  const vector<vector<bool> >& bottom_need_backward =
+      net.bottom_need_backward();
+
+  double peak_gflops = FLAGS_peak_gflops;
+  if (peak_gflops <= 0) {
+    peak_gflops = MeasurePeakGflops();
+  }
+  double peak_gbps = FLAGS_peak_gbps;
+  if (peak_gbps <= 0) {
+    peak_gbps = MeasurePeakGbps();
+  }
+  LOG(INFO) << "Machine ceilings: " << peak_gflops << " GFLOP/s, "
+            << peak_gbps << " GB/s.";
+
+  LOG(INFO) << "Benchmarking " << layers.size() << " layers: "
+            << FLAGS_warmup << " warmup + " << FLAGS_iterations
+            << " measured iterations.";
+  vector<vector<float> > forward_ms(layers.size());
+  vector<vector<float> > backward_ms(layers.size());
+  Timer timer;
+  for (int iter = 0; iter < FLAGS_warmup + FLAGS_iterations; ++iter) {
+    const bool measured = iter >= FLAGS_warmup;
+    for (int i = 0; i < layers.size(); ++i) {
+      timer.Start();
+      // Reshape should be essentially free, but is included so that Reshape
+      // performance bugs show up in the layer it belongs to.
+      layers[i]->Reshape(bottom_vecs[i], &top_vecs[i]);
+      layers[i]->Forward(bottom_vecs[i], &top_vecs[i]);
+      timer.Stop();
+      if (measured) { forward_ms[i].push_back(timer.MilliSeconds()); }
+    }
+    if (FLAGS_forward_only) { continue; }
+    for (int i = layers.size() - 1; i >= 0; --i) {
+      timer.Start();
+      layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
+                          &bottom_vecs[i]);
+      timer.Stop();
+      if (measured) { backward_ms[i].push_back(timer.MilliSeconds()); }
+    }
+  }
+
+  vector<LayerStats> stats(layers.size());
+  float forward_total = 0;
+  float backward_total = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerStats& s = stats[i];
+    const caffe::LayerParameter& param = layers[i]->layer_param();
+    s.name = param.name();
+    s.type = caffe::LayerParameter_LayerType_Name(param.type());
+    s.forward_mean = Mean(forward_ms[i]);
+    s.forward_p50 = Percentile(&forward_ms[i], 0.5);
+    s.forward_p99 = Percentile(&forward_ms[i], 0.99);
+    forward_total += s.forward_mean;
+    if (backward_ms[i].empty()) {
+      s.backward_mean = s.backward_p50 = s.backward_p99 = 0;
+    } else {
+      s.backward_mean = Mean(backward_ms[i]);
+      s.backward_p50 = Percentile(&backward_ms[i], 0.5);
+      s.backward_p99 = Percentile(&backward_ms[i], 0.99);
+      backward_total += s.backward_mean;
+    }
+    const double flops =
+        EstimateLayerFlops(param, bottom_vecs[i], top_vecs[i]);
+    s.gflops = flops * 1e-9;
+    s.gflop_per_s = s.forward_mean > 0 ? flops / (s.forward_mean * 1e6) : 0;
+    const double bytes =
+        EstimateLayerBytes(layers[i], bottom_vecs[i], top_vecs[i]);
+    s.gbytes = bytes * 1e-9;
+    s.intensity = bytes > 0 ? flops / bytes : 0;
+    // A layer cannot beat the compute peak, nor stream its data faster
+    // than its intensity and the bandwidth peak allow.
+    s.attainable_gflop_per_s =
+        std::min(peak_gflops, s.intensity * peak_gbps);
+    s.compute_bound = s.intensity * peak_gbps >= peak_gflops;
+    s.roofline_fraction = s.attainable_gflop_per_s > 0 ?
+        s.gflop_per_s / s.attainable_gflop_per_s : 0;
+    LOG(INFO) << s.name << "\tforward: " << s.forward_mean << " ms (p50 "
+              << s.forward_p50 << ", p99 " << s.forward_p99 << "), "
+              << s.gflop_per_s << " GFLOP/s";
+    if (!FLAGS_forward_only) {
+      LOG(INFO) << s.name << "\tbackward: " << s.backward_mean << " ms (p50 "
+                << s.backward_p50 << ", p99 " << s.backward_p99 << ")";
+    }
+  }
+  LOG(INFO) << "Forward pass: " << forward_total << " ms mean per iteration.";
+  if (!FLAGS_forward_only) {
+    LOG(INFO) << "Backward pass: " << backward_total
+              << " ms mean per iteration.";
+  }
+
+  // The roofline report: where each layer sits against the ceiling its
+  // arithmetic intensity allows, worst offenders being the layers worth
+  // optimizing. Layers too fast or too small to estimate are skipped.
+  LOG(INFO) << "Roofline (forward, against " << peak_gflops << " GFLOP/s / "
+            << peak_gbps << " GB/s):";
+  for (int i = 0; i < stats.size(); ++i) {
+    const LayerStats& s = stats[i];
+    if (s.forward_mean <= 0 || s.gflops <= 0 || s.gbytes <= 0) { continue; }
+    LOG(INFO) << "  " << s.name << "\t" << s.intensity << " FLOP/B, "
+              << s.gflop_per_s << " of " << s.attainable_gflop_per_s
+              << " attainable GFLOP/s ("
+              << 100 * s.roofline_fraction << "%, "
+              << (s.compute_bound ? "compute" : "memory") << "-bound)"
+              << (s.roofline_fraction < FLAGS_roofline_threshold ?
+                  "  <-- candidate" : "");
+  }
+
+  std::ofstream file;
+  if (FLAGS_output.size()) {
+    file.open(FLAGS_output.c_str());
+    CHECK(file.good()) << "Failed to open " << FLAGS_output;
+  }
+  std::ostream& out = FLAGS_output.size() ? file : std::cout;
+  if (FLAGS_format == "json") {
+    WriteJson(stats, forward_total, backward_total, peak_gflops, peak_gbps,
+              &out);
+  } else {
+    WriteCsv(stats, &out);
+  }
+  return 0;
+}
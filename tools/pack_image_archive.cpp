@@ -0,0 +1,114 @@
+// This program packs a set of image files into a single archive file plus
+// an offset index, for use with ImageDataLayer's archive mode
+// (image_data_param.archive). The archive is simply the concatenation of
+// the original encoded files (JPEG/PNG), so the layer can read each image
+// with one positioned read and decode it in memory; on network filesystems
+// this replaces millions of per-file opens with large streaming reads.
+// Usage:
+//   pack_image_archive [FLAGS] ROOTFOLDER/ LISTFILE ARCHIVE INDEX
+//
+// where ROOTFOLDER is the root folder that holds all the images, and
+// LISTFILE should be a list of files as well as their labels, in the
+// format as
+//   subfolder1/file1.JPEG 7
+//   ....
+//
+// INDEX is written with one line per packed image,
+//   subfolder1/file1.JPEG 7 0 130944
+// (filename, label, byte offset into ARCHIVE, byte size), and is passed to
+// the layer as image_data_param.source.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/rng.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::pair;
+using std::string;
+
+DEFINE_bool(shuffle, false,
+    "Randomly shuffle the order of images and their labels; sequential "
+    "readers then see the images in a fixed random order");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Pack a set of images into a single archive\n"
+        "file plus an offset index for ImageDataLayer's archive mode.\n"
+        "Usage:\n"
+        "    pack_image_archive [FLAGS] ROOTFOLDER/ LISTFILE ARCHIVE "
+        "INDEX\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 5) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/pack_image_archive");
+    return 1;
+  }
+
+  std::ifstream infile(argv[2]);
+  CHECK(infile.good()) << "Could not open image list " << argv[2];
+  vector<pair<string, int> > lines;
+  string filename;
+  int label;
+  while (infile >> filename >> label) {
+    lines.push_back(std::make_pair(filename, label));
+  }
+  if (FLAGS_shuffle) {
+    // randomly shuffle data
+    LOG(INFO) << "Shuffling data";
+    shuffle(lines.begin(), lines.end());
+  }
+  LOG(INFO) << "A total of " << lines.size() << " images.";
+
+  const string root_folder(argv[1]);
+  std::ofstream archive(argv[3], std::ios::out | std::ios::binary);
+  CHECK(archive.good()) << "Could not open archive " << argv[3];
+  std::ofstream index(argv[4]);
+  CHECK(index.good()) << "Could not open index " << argv[4];
+
+  size_t offset = 0;
+  int count = 0;
+  string buffer;
+  const int num_lines = lines.size();
+  for (int line_id = 0; line_id < num_lines; ++line_id) {
+    const string path = root_folder + lines[line_id].first;
+    std::ifstream image(path.c_str(), std::ios::in | std::ios::binary);
+    if (!image.good()) {
+      LOG(ERROR) << "Could not open or find file " << path;
+      continue;
+    }
+    image.seekg(0, std::ios::end);
+    const size_t size = image.tellg();
+    image.seekg(0, std::ios::beg);
+    buffer.resize(size);
+    image.read(&buffer[0], size);
+    if (!image.good()) {
+      LOG(ERROR) << "Could not read file " << path;
+      continue;
+    }
+    archive.write(buffer.data(), size);
+    CHECK(archive.good()) << "Could not write to archive " << argv[3];
+    index << lines[line_id].first << " " << lines[line_id].second << " "
+        << offset << " " << size << "\n";
+    offset += size;
+    if (++count % 1000 == 0) {
+      LOG(INFO) << "Packed " << count << " files.";
+    }
+  }
+  index.flush();
+  CHECK(index.good()) << "Could not write to index " << argv[4];
+  if (count % 1000 != 0) {
+    LOG(INFO) << "Packed " << count << " files.";
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+// Warms the kernel page cache for a leveldb/lmdb database.
+//
+// Usage:
+//   warmup_db [FLAGS] db_path
+//
+// After a host reboot the first epoch runs at disk speed while the data
+// layer's cursor demand-faults the database map page by page. This tool
+// touches the database's pages up front with large sequential reads, so
+// epoch 1 runs at epoch 2 speed. Pass --mlock_fraction to additionally
+// pin the leading fraction of every file in physical memory, protecting
+// the hot prefix from page-cache pressure; the locks only last as long
+// as the process, so with that flag the tool stays resident until
+// killed. For warmup concurrent with training, see the warm_page_cache
+// option of DataParameter instead.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+
+using std::string;
+
+DEFINE_double(mlock_fraction, 0,
+    "Additionally mlock this leading fraction (0..1) of every database "
+    "file and stay resident to hold the locks");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Warm the kernel page cache for a leveldb/lmdb\n"
+        "database with large sequential reads.\n"
+        "Usage:\n"
+        "    warmup_db [FLAGS] db_path\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 2) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/warmup_db");
+    return 1;
+  }
+  CHECK_GE(FLAGS_mlock_fraction, 0) << "mlock_fraction must be in [0, 1]";
+  CHECK_LE(FLAGS_mlock_fraction, 1) << "mlock_fraction must be in [0, 1]";
+  const string db_path(argv[1]);
+
+  caffe::CPUTimer timer;
+  timer.Start();
+  const size_t bytes = caffe::WarmPageCache(db_path);
+  timer.Stop();
+  CHECK_GT(bytes, 0) << "No bytes read from " << db_path;
+  const double mb = bytes / (1024. * 1024.);
+  LOG(INFO) << "Touched " << mb << " MB in " << timer.MilliSeconds() / 1000.
+      << " s (" << mb / (timer.MilliSeconds() / 1000.) << " MB/s).";
+
+  if (FLAGS_mlock_fraction > 0) {
+    const size_t locked = caffe::MLockPath(db_path, FLAGS_mlock_fraction);
+    LOG(INFO) << "Locked " << locked / (1024. * 1024.) << " MB in memory; "
+        << "staying resident to hold the locks (kill to release).";
+    for (;;) {
+      pause();
+    }
+  }
+  return 0;
+}